@@ -0,0 +1,366 @@
+#!/usr/bin/env python3
+#
+# bench_compare.py -- store benchmark baselines and compare runs
+#
+# Copyright 2019-2020, Laurence Lundblade
+#
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# See BSD-3-Clause license in README.md
+#
+# t_cose_bench prints one result per line as
+#
+#     <benchmark>.<metric> <value> <unit>
+#
+# (see bench/t_cose_bench_util.h). One run is not enough to tell a
+# regression from noise, so this runs the benchmarks several times and
+# keeps every sample. Results are stored as JSON under
+#
+#     bench/results/<config>/<commit>.json
+#
+# where <config> names the crypto adapter and the optimization, e.g.
+# "ossl-Os" or "psa-perf".
+#
+# Two runs are compared metric by metric with a bootstrap confidence
+# interval for the change in the median. A metric has regressed when
+# the whole interval is slower than its threshold. Thresholds are set
+# per metric with shell-style patterns, so each operation and each
+# algorithm can have its own. The exit status is 1 if anything
+# regressed, which is what make bench-compare uses.
+#
+#   record   Run the benchmarks and store the result for the commit.
+#   compare  Compare two stored results or JSON files.
+#   check    Run the benchmarks and compare to a stored baseline.
+#
+# Only the Python standard library is used.
+
+import argparse
+import fnmatch
+import json
+import os
+import platform
+import random
+import re
+import subprocess
+import sys
+import time
+
+
+SCHEMA_VERSION = 1
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+RESULTS_DIR = os.path.join(BENCH_DIR, 'results')
+DEFAULT_THRESHOLDS_FILE = os.path.join(BENCH_DIR, 'bench_thresholds.json')
+
+# Units where a bigger number is better. Everything else is a time
+# or a count where smaller is better.
+HIGHER_IS_BETTER_UNITS = ('ops/s', 'pkt/s', 'files/s', 'MB/s', 'B/s')
+
+# Default thresholds in percent. The first pattern that matches a
+# metric wins. None means the metric is reported but never fails.
+# Maximums are dominated by scheduling noise.
+DEFAULT_THRESHOLDS = [
+    ('*_max', None),
+    ('*', 5.0),
+]
+
+ALGORITHM_RE = re.compile(r'(es256|es384|es512|ps256|ps384|ps512|eddsa|'
+                          r'a128gcm|a256gcm|ccm|a128kw|hpke|ml_dsa)', re.I)
+
+
+# ---- Running and parsing ----
+
+def parse_bench_output(text):
+    """Return {name: (value, unit)} from t_cose_bench output."""
+    results = {}
+    for line in text.splitlines():
+        fields = line.split()
+        if len(fields) != 3 or '.' not in fields[0]:
+            continue
+        try:
+            value = float(fields[1])
+        except ValueError:
+            continue
+        results[fields[0]] = (value, fields[2])
+    return results
+
+
+def run_bench(bench, bench_names, repeat):
+    """Run the benchmark binary repeat times and collect all samples."""
+    metrics = {}
+    for i in range(repeat):
+        proc = subprocess.run([bench] + bench_names,
+                              stdout=subprocess.PIPE,
+                              universal_newlines=True)
+        if proc.returncode != 0:
+            sys.exit('%s failed with status %d' % (bench, proc.returncode))
+        for name, (value, unit) in parse_bench_output(proc.stdout).items():
+            entry = metrics.setdefault(name, {'unit': unit, 'samples': []})
+            entry['samples'].append(value)
+        print('run %d of %d: %d metrics' % (i + 1, repeat, len(metrics)),
+              file=sys.stderr)
+    return metrics
+
+
+# ---- Storage ----
+
+def git(*args):
+    try:
+        return subprocess.run(('git',) + args,
+                              stdout=subprocess.PIPE,
+                              stderr=subprocess.DEVNULL,
+                              universal_newlines=True,
+                              check=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def resolve_commit(ref):
+    commit = git('rev-parse', '--verify', ref + '^{commit}')
+    if commit is None:
+        sys.exit('unknown commit %s' % ref)
+    return commit
+
+
+def current_commit():
+    commit = git('rev-parse', 'HEAD') or 'unknown'
+    dirty = bool(git('status', '--porcelain', '--untracked-files=no'))
+    return commit, dirty
+
+
+def result_path(config, commit):
+    return os.path.join(RESULTS_DIR, config, commit + '.json')
+
+
+def make_result(args, metrics):
+    commit, dirty = current_commit()
+    return {
+        'schema': SCHEMA_VERSION,
+        'commit': commit,
+        'dirty': dirty,
+        'config': args.config,
+        'cflags': args.cflags,
+        'date': time.strftime('%Y-%m-%dT%H:%M:%SZ', time.gmtime()),
+        'host': platform.node(),
+        'machine': platform.machine(),
+        'repeat': args.repeat,
+        'metrics': metrics,
+    }
+
+
+def load_result(spec, config):
+    """A JSON file name or a commit whose result for config is stored."""
+    if os.path.isfile(spec):
+        path = spec
+    else:
+        path = result_path(config, resolve_commit(spec))
+        if not os.path.isfile(path):
+            sys.exit('no baseline %s; run make bench-record on that commit' % path)
+    with open(path) as f:
+        result = json.load(f)
+    if result.get('schema') != SCHEMA_VERSION:
+        sys.exit('%s: unsupported schema %r' % (path, result.get('schema')))
+    return result
+
+
+# ---- Statistics ----
+
+def median(values):
+    s = sorted(values)
+    n = len(s)
+    mid = n // 2
+    return s[mid] if n % 2 else (s[mid - 1] + s[mid]) / 2.0
+
+
+def slowdown(base, new, higher_is_better):
+    """Fractional slowdown of new relative to base. Positive is worse."""
+    if higher_is_better:
+        return base / new - 1.0 if new > 0 else float('inf')
+    return new / base - 1.0 if base > 0 else 0.0
+
+
+def bootstrap_interval(base, new, higher_is_better, resamples, confidence, rng):
+    """Confidence interval of the slowdown of the median."""
+    estimates = []
+    for _ in range(resamples):
+        b = median([rng.choice(base) for _ in base])
+        n = median([rng.choice(new) for _ in new])
+        estimates.append(slowdown(b, n, higher_is_better))
+    estimates.sort()
+    tail = (1.0 - confidence) / 2.0
+    low = estimates[int(tail * (resamples - 1))]
+    high = estimates[int((1.0 - tail) * (resamples - 1))]
+    return low, high
+
+
+# ---- Comparison ----
+
+def load_thresholds(path, default):
+    thresholds = []
+    if path and os.path.isfile(path):
+        with open(path) as f:
+            for pattern, value in json.load(f).items():
+                thresholds.append((pattern, value))
+    thresholds.extend(DEFAULT_THRESHOLDS if default is None
+                      else [('*_max', None), ('*', default)])
+    return thresholds
+
+
+def threshold_for(name, thresholds):
+    for pattern, value in thresholds:
+        if fnmatch.fnmatchcase(name, pattern):
+            return value
+    return None
+
+
+def algorithm_of(name):
+    match = ALGORITHM_RE.search(name)
+    return match.group(1).lower() if match else '-'
+
+
+def compare(base, new, thresholds, resamples, confidence, seed):
+    """Print a report and return the number of regressions."""
+    rng = random.Random(seed)
+    regressions = 0
+    groups = {}
+
+    print('base %s %s (%s)' % (base['commit'][:12], base['config'], base['date']))
+    print('new  %s%s %s (%s)' % (new['commit'][:12],
+                                 '-dirty' if new.get('dirty') else '',
+                                 new['config'], new['date']))
+    if base['config'] != new['config']:
+        print('warning: comparing different build configurations')
+    print()
+    print('%-44s %12s %12s %8s %19s  %s' %
+          ('metric', 'base', 'new', 'change', 'interval', 'verdict'))
+
+    for name in sorted(set(base['metrics']) | set(new['metrics'])):
+        if name not in base['metrics'] or name not in new['metrics']:
+            print('%-44s %s' % (name, 'only in ' +
+                                ('new' if name in new['metrics'] else 'base')))
+            continue
+        b = base['metrics'][name]
+        n = new['metrics'][name]
+        higher_is_better = b['unit'] in HIGHER_IS_BETTER_UNITS
+        threshold = threshold_for(name, thresholds)
+
+        change = slowdown(median(b['samples']), median(n['samples']),
+                          higher_is_better)
+        low, high = bootstrap_interval(b['samples'], n['samples'],
+                                       higher_is_better,
+                                       resamples, confidence, rng)
+        if threshold is None:
+            verdict = 'ignored'
+        elif low * 100.0 > threshold:
+            verdict = 'REGRESSION'
+            regressions += 1
+        elif high * 100.0 < -threshold:
+            verdict = 'improved'
+        else:
+            verdict = 'ok'
+
+        print('%-44s %12.3f %12.3f %+7.1f%% [%+7.1f%%,%+7.1f%%]  %s %s' %
+              (name, median(b['samples']), median(n['samples']),
+               change * 100.0, low * 100.0, high * 100.0, verdict, b['unit']))
+
+        key = (name.split('.')[0], algorithm_of(name))
+        group = groups.setdefault(key, [0, 0])
+        group[0] += 1
+        group[1] += verdict == 'REGRESSION'
+
+    print()
+    print('%-30s %-10s %8s %12s' % ('operation', 'algorithm', 'metrics', 'regressions'))
+    for (operation, algorithm), (count, regressed) in sorted(groups.items()):
+        print('%-30s %-10s %8d %12d' % (operation, algorithm, count, regressed))
+    print()
+    print('%d regression(s) at %.0f%% confidence' % (regressions, confidence * 100))
+
+    return regressions
+
+
+# ---- Commands ----
+
+def cmd_record(args):
+    metrics = run_bench(args.bench, args.names, args.repeat)
+    result = make_result(args, metrics)
+    path = args.output or result_path(args.config, result['commit'])
+    os.makedirs(os.path.dirname(os.path.abspath(path)), exist_ok=True)
+    with open(path, 'w') as f:
+        json.dump(result, f, indent=1, sort_keys=True)
+    print('stored %s%s' % (path, ' (tree is dirty)' if result['dirty'] else ''),
+          file=sys.stderr)
+    return 0
+
+
+def cmd_compare(args):
+    base = load_result(args.base, args.config)
+    new = load_result(args.new, args.config)
+    thresholds = load_thresholds(args.thresholds, args.threshold)
+    regressions = compare(base, new, thresholds,
+                          args.resamples, args.confidence, args.seed)
+    return 1 if regressions else 0
+
+
+def cmd_check(args):
+    base = load_result(args.base, args.config)
+    new = make_result(args, run_bench(args.bench, args.names, args.repeat))
+    thresholds = load_thresholds(args.thresholds, args.threshold)
+    regressions = compare(base, new, thresholds,
+                          args.resamples, args.confidence, args.seed)
+    return 1 if regressions else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Store t_cose benchmark baselines and compare runs.')
+    sub = parser.add_subparsers(dest='command')
+
+    def add_run_args(p):
+        p.add_argument('--bench', default='./t_cose_bench',
+                       help='benchmark binary')
+        p.add_argument('--repeat', type=int, default=10,
+                       help='number of runs, each giving one sample per metric')
+        p.add_argument('--cflags', default='', help='compiler options recorded')
+        p.add_argument('names', nargs='*', help='benchmarks to run, default all')
+
+    def add_compare_args(p):
+        p.add_argument('--threshold', type=float, default=None,
+                       help='default regression threshold in percent')
+        p.add_argument('--thresholds', default=DEFAULT_THRESHOLDS_FILE,
+                       help='JSON file of {"pattern": percent or null}')
+        p.add_argument('--confidence', type=float, default=0.95)
+        p.add_argument('--resamples', type=int, default=2000)
+        p.add_argument('--seed', type=int, default=1)
+
+    for p in (sub.add_parser('record'), sub.add_parser('compare'),
+              sub.add_parser('check')):
+        p.add_argument('--config', required=True,
+                       help='build configuration, e.g. ossl-Os')
+
+    p = sub.choices['record']
+    add_run_args(p)
+    p.add_argument('--output', default=None,
+                   help='file to write instead of bench/results')
+    p.set_defaults(func=cmd_record)
+
+    p = sub.choices['compare']
+    add_compare_args(p)
+    p.add_argument('base', help='commit or JSON file')
+    p.add_argument('new', help='commit or JSON file')
+    p.set_defaults(func=cmd_compare)
+
+    p = sub.choices['check']
+    add_run_args(p)
+    add_compare_args(p)
+    p.add_argument('--base', default='HEAD', help='commit or JSON file')
+    p.set_defaults(func=cmd_check)
+
+    args = parser.parse_args()
+    if args.command is None:
+        parser.print_help()
+        return 2
+    return args.func(args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,108 @@
+/*==============================================================================
+ run_benchmarks.c -- benchmark aggregator
+
+ Copyright (c) 2018-2020, Laurence Lundblade. All rights reserved.
+
+ SPDX-License-Identifier: BSD-3-Clause
+
+ See BSD-3-Clause license in README.md
+ =============================================================================*/
+
+#include "run_benchmarks.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "t_cose_restartable_bench.h"
+#include "t_cose_known_length_bench.h"
+#include "t_cose_hash_bench.h"
+#include "t_cose_oscore_bench.h"
+#include "t_cose_replay_bench.h"
+#include "t_cose_rate_limit_bench.h"
+#include "t_cose_bulk_verify_bench.h"
+#include "t_cose_key_arena_bench.h"
+
+
+/*
+ Benchmark configuration. This works the same as the test
+ configuration in run_tests.c.
+ */
+
+typedef int_fast32_t (bench_fun_t)(void);
+
+#define BENCH_ENTRY(bench_name)  {#bench_name, bench_name, true}
+#define BENCH_ENTRY_DISABLED(bench_name)  {#bench_name, bench_name, false}
+
+typedef struct {
+    const char  *szBenchName;
+    bench_fun_t *bench_fun;
+    bool         bEnabled;
+} bench_entry;
+
+
+static bench_entry s_benches[] = {
+#ifdef T_COSE_ENABLE_RESTARTABLE
+    BENCH_ENTRY(restartable_sign_bench),
+    BENCH_ENTRY(restartable_verify_bench),
+#endif /* T_COSE_ENABLE_RESTARTABLE */
+    BENCH_ENTRY(known_length_bench),
+    BENCH_ENTRY(hash_bench),
+#ifdef T_COSE_ENABLE_OSCORE
+    BENCH_ENTRY(oscore_bench),
+#endif /* T_COSE_ENABLE_OSCORE */
+#ifdef T_COSE_ENABLE_CAPTURE
+    BENCH_ENTRY(replay_bench),
+#endif /* T_COSE_ENABLE_CAPTURE */
+#ifdef T_COSE_ENABLE_RATE_LIMIT
+    BENCH_ENTRY(rate_limit_bench),
+#endif /* T_COSE_ENABLE_RATE_LIMIT */
+#ifdef T_COSE_ENABLE_BULK_VERIFY
+    BENCH_ENTRY(bulk_verify_bench),
+#endif /* T_COSE_ENABLE_BULK_VERIFY */
+#if defined(T_COSE_ENABLE_KEY_ARENA) && defined(T_COSE_ENABLE_KEY_RECOVERY)
+    BENCH_ENTRY(key_arena_bench),
+#endif /* T_COSE_ENABLE_KEY_ARENA && T_COSE_ENABLE_KEY_RECOVERY */
+    /* Keeps the array non-empty for configurations with no benchmarks */
+    {NULL, NULL, false}
+};
+
+
+/*
+ Public function. See run_benchmarks.h.
+ */
+int RunBenchmarksTCose(const char *szBenchNames[])
+{
+    int nFailed = 0;
+    bench_entry *b;
+    const bench_entry *s_benches_end = s_benches + sizeof(s_benches)/sizeof(bench_entry);
+
+    for(b = s_benches; b < s_benches_end; b++) {
+        if(b->bench_fun == NULL) {
+            continue;
+        }
+        if(szBenchNames[0]) {
+            // Some benchmarks have been named
+            const char **szRequestedNames;
+            for(szRequestedNames = szBenchNames; *szRequestedNames;  szRequestedNames++) {
+                if(!strcmp(b->szBenchName, *szRequestedNames)) {
+                    break; // Name matched
+                }
+            }
+            if(*szRequestedNames == NULL) {
+                // Didn't match this benchmark
+                continue;
+            }
+        } else if(!b->bEnabled) {
+            continue;
+        }
+
+        int_fast32_t nResult = (b->bench_fun)();
+        if(nResult) {
+            printf("%s FAILED (returned %d)\n", b->szBenchName, (int)nResult);
+            nFailed++;
+        }
+    }
+
+    return nFailed;
+}
@@ -0,0 +1,26 @@
+/*==============================================================================
+ run_benchmarks.h -- benchmark aggregator
+
+ Copyright (c) 2018-2020, Laurence Lundblade. All rights reserved.
+
+ SPDX-License-Identifier: BSD-3-Clause
+
+ See BSD-3-Clause license in README.md
+ =============================================================================*/
+
+/**
+ @file run_benchmarks.h
+*/
+
+/**
+ @brief Runs the t_cose benchmarks.
+
+ @param[in]  szBenchNames   An argv-style list of benchmark names to
+                            run. If empty, all are run.
+
+ @return The number of benchmarks that failed to run. Zero means
+         overall success.
+
+ Results are printed to stdout as described in t_cose_bench_util.h.
+ */
+int RunBenchmarksTCose(const char *szBenchNames[]);
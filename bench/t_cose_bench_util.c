@@ -0,0 +1,93 @@
+/*
+ *  t_cose_bench_util.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#define _POSIX_C_SOURCE 200112L /* For clock_gettime() */
+
+#include "t_cose_bench_util.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+/*
+ * Public function, see t_cose_bench_util.h
+ */
+uint64_t t_cose_bench_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+
+/*
+ * Public function, see t_cose_bench_util.h
+ */
+void t_cose_bench_report(const char *bench_name,
+                         const char *metric,
+                         double      value,
+                         const char *unit)
+{
+    printf("%s.%s %.3f %s\n", bench_name, metric, value, unit);
+}
+
+
+/*
+ * Public function, see t_cose_bench_util.h
+ */
+void t_cose_bench_stats_init(struct t_cose_bench_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->min_ns = UINT64_MAX;
+}
+
+
+/*
+ * Public function, see t_cose_bench_util.h
+ */
+void t_cose_bench_stats_add(struct t_cose_bench_stats *stats,
+                            uint64_t                   elapsed_ns)
+{
+    stats->count++;
+    stats->total_ns += elapsed_ns;
+    if(elapsed_ns < stats->min_ns) {
+        stats->min_ns = elapsed_ns;
+    }
+    if(elapsed_ns > stats->max_ns) {
+        stats->max_ns = elapsed_ns;
+    }
+}
+
+
+/*
+ * Public function, see t_cose_bench_util.h
+ */
+void t_cose_bench_stats_report(const char                      *bench_name,
+                               const char                      *metric,
+                               const struct t_cose_bench_stats *stats)
+{
+    char name[96];
+
+    if(stats->count == 0) {
+        return;
+    }
+
+    snprintf(name, sizeof(name), "%s_avg", metric);
+    t_cose_bench_report(bench_name, name,
+                        (double)stats->total_ns / (double)stats->count / 1000.0,
+                        "us");
+    snprintf(name, sizeof(name), "%s_min", metric);
+    t_cose_bench_report(bench_name, name, (double)stats->min_ns / 1000.0, "us");
+    snprintf(name, sizeof(name), "%s_max", metric);
+    t_cose_bench_report(bench_name, name, (double)stats->max_ns / 1000.0, "us");
+}
@@ -0,0 +1,83 @@
+/*
+ *  t_cose_bench_util.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef t_cose_bench_util_h
+#define t_cose_bench_util_h
+
+#include <stdint.h>
+
+
+/**
+ * \file t_cose_bench_util.h
+ *
+ * \brief Timing and reporting shared by the benchmarks.
+ *
+ * Unlike the tests, the benchmarks need a clock and formatted
+ * output, so they depend on POSIX and stdio. Each result is one line
+ * of the form
+ *
+ *     <benchmark>.<metric> <value> <unit>
+ *
+ * so that results are easy to compare with diff or a script.
+ */
+
+
+/**
+ * \brief Monotonic time in nanoseconds.
+ */
+uint64_t t_cose_bench_now_ns(void);
+
+
+/**
+ * \brief Output one benchmark result.
+ *
+ * \param[in] bench_name  Name of the benchmark.
+ * \param[in] metric      Name of the thing measured.
+ * \param[in] value       The measurement.
+ * \param[in] unit        The unit of \c value, e.g., "ns" or "ops/s".
+ */
+void t_cose_bench_report(const char *bench_name,
+                         const char *metric,
+                         double      value,
+                         const char *unit);
+
+
+/**
+ * \brief Running min / max / total of a series of timings.
+ */
+struct t_cose_bench_stats {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+};
+
+
+/**
+ * \brief Clear stats before use.
+ */
+void t_cose_bench_stats_init(struct t_cose_bench_stats *stats);
+
+
+/**
+ * \brief Add one timing to the stats.
+ */
+void t_cose_bench_stats_add(struct t_cose_bench_stats *stats,
+                            uint64_t                   elapsed_ns);
+
+
+/**
+ * \brief Report avg, min and max of the stats as three lines.
+ */
+void t_cose_bench_stats_report(const char                      *bench_name,
+                               const char                      *metric,
+                               const struct t_cose_bench_stats *stats);
+
+#endif /* t_cose_bench_util_h */
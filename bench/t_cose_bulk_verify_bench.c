@@ -0,0 +1,260 @@
+/*
+ *  t_cose_bulk_verify_bench.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifdef T_COSE_ENABLE_BULK_VERIFY
+/* For mkdir() and rmdir() */
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "t_cose_bulk_verify_bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "t_cose/t_cose_bulk_verify.h"
+#include "t_cose/t_cose_autotune.h"
+#include "t_cose/t_cose_sign1_sign.h"
+#include "t_cose/t_cose_sign1_verify.h"
+#include "t_cose/q_useful_buf.h"
+#include "t_cose_bench_util.h"
+
+
+#ifdef T_COSE_ENABLE_BULK_VERIFY
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BENCH_DIR   "t_cose_bulk_bench"
+#define BENCH_FILES 20000
+
+/* Room for a short-circuit signature of a small payload */
+#define BENCH_MESSAGE_SIZE 200
+
+/* Files per run while autotuning, and the number of runs */
+#define TUNE_FILES 2000
+#define TUNE_RUNS  240
+
+static char        s_path_storage[BENCH_FILES][sizeof(BENCH_DIR) + 16];
+static const char *s_paths[BENCH_FILES];
+static struct t_cose_bulk_result s_results[BENCH_FILES];
+
+
+#ifndef T_COSE_DISABLE_SHORT_CIRCUIT_SIGN
+static void
+remove_files(size_t count)
+{
+    size_t i;
+
+    for(i = 0; i < count; i++) {
+        unlink(s_paths[i]);
+    }
+    rmdir(BENCH_DIR);
+}
+
+
+/*
+ * Verify all the files and report the rate.
+ */
+static enum t_cose_err_t
+time_bulk_verify(struct t_cose_bulk_verify_config *config)
+{
+    struct t_cose_bulk_verify_stats stats;
+    struct q_useful_buf             buffer;
+    enum t_cose_err_t               result;
+
+    buffer.len = t_cose_bulk_verify_buffer_size(config);
+    buffer.ptr = malloc(buffer.len);
+    if(buffer.ptr == NULL) {
+        return T_COSE_ERR_INSUFFICIENT_MEMORY;
+    }
+
+    result = t_cose_bulk_verify(config, buffer, s_paths, BENCH_FILES,
+                                s_results, &stats);
+    free(buffer.ptr);
+    if(result) {
+        return result;
+    }
+    if(stats.failed != 0) {
+        return T_COSE_ERR_FAIL;
+    }
+
+    t_cose_bench_report("bulk_verify",
+                        stats.used_io_uring ? "io_uring" : "blocking",
+                        stats.elapsed_ns ? (double)stats.files * 1e9 /
+                                               (double)stats.elapsed_ns
+                                         : 0.0,
+                        "files/s");
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Tune the queue depth and number of threads with the autotuner, as
+ * its batch size and worker count, then report what it chose. Each
+ * run verifies the next TUNE_FILES of the files.
+ */
+static enum t_cose_err_t
+tune_bulk_verify(struct t_cose_bulk_verify_config *config)
+{
+    struct t_cose_autotune              tuner;
+    struct t_cose_autotune_config       tune_config;
+    const struct t_cose_autotune_stats *tune_stats;
+    struct t_cose_autotune_settings     settings;
+    struct t_cose_bulk_verify_stats     stats;
+    struct q_useful_buf                 buffer;
+    enum t_cose_err_t                   result;
+    size_t                              first;
+    int                                 run;
+
+    memset(&tune_config, 0, sizeof(tune_config));
+    tune_config.batch_size   = (struct t_cose_autotune_range){16, 4096, 256};
+    tune_config.worker_count = (struct t_cose_autotune_range){1, 16, 4};
+    /* The bulk verifier has no lanes */
+    tune_config.lane_width   = (struct t_cose_autotune_range){1, 1, 1};
+    tune_config.runs_per_trial = 2;
+    result = t_cose_autotune_init(&tuner, &tune_config);
+    if(result) {
+        return result;
+    }
+
+    /* Big enough for the deepest queue */
+    config->queue_depth = tune_config.batch_size.max;
+    buffer.len = t_cose_bulk_verify_buffer_size(config);
+    buffer.ptr = malloc(buffer.len);
+    if(buffer.ptr == NULL) {
+        return T_COSE_ERR_INSUFFICIENT_MEMORY;
+    }
+
+    first = 0;
+    for(run = 0; run < TUNE_RUNS; run++) {
+        settings = t_cose_autotune_current(&tuner);
+        config->queue_depth    = settings.batch_size;
+        config->worker_threads = settings.worker_count;
+        result = t_cose_bulk_verify(config, buffer, s_paths + first,
+                                    TUNE_FILES, s_results, &stats);
+        if(result) {
+            goto Done;
+        }
+        if(stats.failed != 0) {
+            result = T_COSE_ERR_FAIL;
+            goto Done;
+        }
+        t_cose_autotune_record(&tuner, stats.files, stats.elapsed_ns,
+                               stats.elapsed_ns);
+        first = (first + TUNE_FILES) % BENCH_FILES;
+    }
+
+    tune_stats = t_cose_autotune_get_stats(&tuner);
+    t_cose_bench_report("bulk_verify", "tuned",
+                        (double)tune_stats->best_throughput, "files/s");
+    t_cose_bench_report("bulk_verify", "tuned_queue_depth",
+                        (double)tune_stats->best.batch_size, "reads");
+    t_cose_bench_report("bulk_verify", "tuned_threads",
+                        (double)tune_stats->best.worker_count, "threads");
+    t_cose_bench_report("bulk_verify", "tune_moves",
+                        (double)tune_stats->moves, "moves");
+
+Done:
+    free(buffer.ptr);
+    return result;
+}
+#endif /* T_COSE_DISABLE_SHORT_CIRCUIT_SIGN */
+
+
+/*
+ * Public function, see t_cose_bulk_verify_bench.h
+ */
+int_fast32_t bulk_verify_bench()
+{
+#ifndef T_COSE_DISABLE_SHORT_CIRCUIT_SIGN
+    struct t_cose_sign1_sign_ctx     sign_ctx;
+    struct t_cose_sign1_verify_ctx   verify_ctx;
+    struct t_cose_bulk_verify_config config;
+    Q_USEFUL_BUF_MAKE_STACK_UB(      message_buffer, BENCH_MESSAGE_SIZE);
+    struct q_useful_buf_c            message;
+    enum t_cose_err_t                result;
+    FILE                            *file;
+    size_t                           written;
+    size_t                           i;
+    int_fast32_t                     return_value;
+
+    t_cose_sign1_sign_init(&sign_ctx,
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           T_COSE_ALGORITHM_ES256);
+    result = t_cose_sign1_sign(&sign_ctx,
+                               Q_USEFUL_BUF_FROM_SZ_LITERAL("bulk verify bench payload"),
+                               message_buffer,
+                               &message);
+    if(result) {
+        return 100 + (int32_t)result;
+    }
+
+    /* -- Write the files -- */
+    mkdir(BENCH_DIR, 0700);
+    return_value = 0;
+    for(i = 0; i < BENCH_FILES; i++) {
+        snprintf(s_path_storage[i], sizeof(s_path_storage[i]),
+                 BENCH_DIR "/%05u", (unsigned)i);
+        s_paths[i] = s_path_storage[i];
+        file = fopen(s_paths[i], "wb");
+        if(file == NULL) {
+            return_value = 200;
+            break;
+        }
+        written = fwrite(message.ptr, 1, message.len, file);
+        if(fclose(file) || written != message.len) {
+            return_value = 300;
+            i++;
+            break;
+        }
+    }
+    if(return_value) {
+        remove_files(i);
+        return return_value;
+    }
+
+    /* -- Verify them with io_uring, if there is one, then without -- */
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+    memset(&config, 0, sizeof(config));
+    config.verify_template = &verify_ctx;
+    config.max_file_size   = BENCH_MESSAGE_SIZE;
+
+    result = time_bulk_verify(&config);
+    if(result) {
+        return_value = 400 + (int32_t)result;
+        goto Done;
+    }
+    config.disable_io_uring = true;
+    result = time_bulk_verify(&config);
+    if(result) {
+        return_value = 500 + (int32_t)result;
+        goto Done;
+    }
+
+    /* -- Let the autotuner choose the queue depth and threads -- */
+    config.disable_io_uring = false;
+    result = tune_bulk_verify(&config);
+    if(result) {
+        return_value = 600 + (int32_t)result;
+        goto Done;
+    }
+
+Done:
+    remove_files(BENCH_FILES);
+
+    return return_value;
+#else
+    return 0;
+#endif /* T_COSE_DISABLE_SHORT_CIRCUIT_SIGN */
+}
+
+#endif /* T_COSE_ENABLE_BULK_VERIFY */
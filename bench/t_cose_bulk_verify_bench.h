@@ -0,0 +1,43 @@
+/*
+ *  t_cose_bulk_verify_bench.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef t_cose_bulk_verify_bench_h
+#define t_cose_bulk_verify_bench_h
+
+#include <stdint.h>
+
+
+/**
+ * \file t_cose_bulk_verify_bench.h
+ *
+ * \brief Benchmark of verifying a directory of small files.
+ *
+ * This writes a directory of files that are each a short-circuit
+ * signed \c COSE_Sign1 and reports the files per second of
+ * t_cose_bulk_verify() with io_uring, if it is available, and with
+ * blocking reads. Then the queue depth and number of threads are
+ * chosen with the autotuner of t_cose_autotune.h over a series of
+ * smaller runs and the chosen values and their files per second are
+ * reported. The files are just written so they are in the page
+ * cache. This measures the system call and thread overhead, not the
+ * storage.
+ */
+
+
+#ifdef T_COSE_ENABLE_BULK_VERIFY
+/**
+ * \brief Time bulk verification of files.
+ *
+ * \return non-zero on failure.
+ */
+int_fast32_t bulk_verify_bench(void);
+#endif /* T_COSE_ENABLE_BULK_VERIFY */
+
+#endif /* t_cose_bulk_verify_bench_h */
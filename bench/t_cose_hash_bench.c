@@ -0,0 +1,165 @@
+/*
+ *  t_cose_hash_bench.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "t_cose_hash_bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "t_cose/q_useful_buf.h"
+#include "t_cose_crypto.h"
+#include "t_cose_standard_constants.h"
+#include "t_cose_bench_util.h"
+
+#ifdef T_COSE_USE_B_CON_SHA256
+#if !defined T_COSE_DISABLE_ES512 || !defined T_COSE_DISABLE_ES384
+#include "sha512.h" /* For sha512_select_kernel() */
+#define HASH_BENCH_KERNELS
+#endif
+#endif
+
+
+/* Bytes hashed for each measurement of each size */
+#define BENCH_TOTAL_BYTES (64 * 1024 * 1024)
+
+/* A large payload and a typical small one */
+static const size_t s_payload_sizes[] = {1048576, 256};
+
+static const struct {
+    int32_t     cose_hash_alg_id;
+    const char *name;
+} s_hashes[] = {
+    {COSE_ALGORITHM_SHA_256, "sha256"},
+#ifndef T_COSE_DISABLE_ES384
+    {COSE_ALGORITHM_SHA_384, "sha384"},
+#endif
+#ifndef T_COSE_DISABLE_ES512
+    {COSE_ALGORITHM_SHA_512, "sha512"},
+#endif
+};
+
+
+/*
+ * Hash BENCH_TOTAL_BYTES as payloads of payload.len and report the
+ * MB/s.
+ */
+static enum t_cose_err_t
+time_hash(int32_t               cose_hash_alg_id,
+          const char           *name,
+          struct q_useful_buf_c payload)
+{
+    struct t_cose_crypto_hash  hash_ctx;
+    Q_USEFUL_BUF_MAKE_STACK_UB(hash_buffer, T_COSE_CRYPTO_MAX_HASH_SIZE);
+    struct q_useful_buf_c      hash;
+    enum t_cose_err_t          result;
+    char                       metric[40];
+    uint64_t                   start;
+    uint64_t                   elapsed_ns;
+    size_t                     count;
+    size_t                     i;
+
+    count = BENCH_TOTAL_BYTES / payload.len;
+
+    start = t_cose_bench_now_ns();
+    for(i = 0; i < count; i++) {
+        result = t_cose_crypto_hash_start(&hash_ctx, cose_hash_alg_id);
+        if(result) {
+            return result;
+        }
+        t_cose_crypto_hash_update(&hash_ctx, payload);
+        result = t_cose_crypto_hash_finish(&hash_ctx, hash_buffer, &hash);
+        if(result) {
+            return result;
+        }
+    }
+    elapsed_ns = t_cose_bench_now_ns() - start;
+
+    snprintf(metric, sizeof(metric), "%s_%zu", name, payload.len);
+    t_cose_bench_report("hash", metric,
+                        elapsed_ns ? (double)(count * payload.len) * 1000.0 /
+                                         (double)elapsed_ns
+                                   : 0.0,
+                        "MB/s");
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function, see t_cose_hash_bench.h
+ */
+int_fast32_t hash_bench()
+{
+    struct q_useful_buf payload_buf;
+    enum t_cose_err_t   result;
+    size_t              size_index;
+    size_t              i;
+    int_fast32_t        return_value;
+#ifdef HASH_BENCH_KERNELS
+    char                name[40];
+#endif
+
+    payload_buf.len = s_payload_sizes[0];
+    payload_buf.ptr = malloc(payload_buf.len);
+    if(payload_buf.ptr == NULL) {
+        return 100;
+    }
+    memset(payload_buf.ptr, 'x', payload_buf.len);
+
+    return_value = 0;
+    for(size_index = 0;
+        size_index < sizeof(s_payload_sizes) / sizeof(s_payload_sizes[0]);
+        size_index++) {
+        for(i = 0; i < sizeof(s_hashes) / sizeof(s_hashes[0]); i++) {
+#ifdef HASH_BENCH_KERNELS
+            if(s_hashes[i].cose_hash_alg_id != COSE_ALGORITHM_SHA_256) {
+                /* Scalar, then AVX2 if there is one */
+                sha512_select_kernel(SHA512_KERNEL_SCALAR);
+                snprintf(name, sizeof(name), "%s_scalar", s_hashes[i].name);
+                result = time_hash(s_hashes[i].cose_hash_alg_id, name,
+                                   (struct q_useful_buf_c){payload_buf.ptr,
+                                                           s_payload_sizes[size_index]});
+                if(result) {
+                    return_value = 200 + (int32_t)result;
+                    goto Done;
+                }
+                if(sha512_select_kernel(SHA512_KERNEL_AVX2) != SHA512_KERNEL_AVX2) {
+                    continue;
+                }
+                snprintf(name, sizeof(name), "%s_avx2", s_hashes[i].name);
+                result = time_hash(s_hashes[i].cose_hash_alg_id, name,
+                                   (struct q_useful_buf_c){payload_buf.ptr,
+                                                           s_payload_sizes[size_index]});
+                if(result) {
+                    return_value = 300 + (int32_t)result;
+                    goto Done;
+                }
+                continue;
+            }
+#endif
+            result = time_hash(s_hashes[i].cose_hash_alg_id, s_hashes[i].name,
+                               (struct q_useful_buf_c){payload_buf.ptr,
+                                                       s_payload_sizes[size_index]});
+            if(result) {
+                return_value = 400 + (int32_t)result;
+                goto Done;
+            }
+        }
+    }
+
+Done:
+#ifdef HASH_BENCH_KERNELS
+    sha512_select_kernel(SHA512_KERNEL_AVX2);
+#endif
+    free(payload_buf.ptr);
+
+    return return_value;
+}
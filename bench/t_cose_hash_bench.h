@@ -0,0 +1,37 @@
+/*
+ *  t_cose_hash_bench.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef t_cose_hash_bench_h
+#define t_cose_hash_bench_h
+
+#include <stdint.h>
+
+
+/**
+ * \file t_cose_hash_bench.h
+ *
+ * \brief Benchmark of the hashes of the crypto adapter.
+ *
+ * This reports the MB/s of SHA-256, SHA-384 and SHA-512 through
+ * t_cose_crypto_hash_update() for a large payload and a small one.
+ * With the bundled hashes (\c T_COSE_USE_B_CON_SHA256) SHA-512 is
+ * reported once with the scalar code and once with the AVX2 kernel,
+ * if the CPU has it.
+ */
+
+
+/**
+ * \brief Time hashing.
+ *
+ * \return non-zero on failure.
+ */
+int_fast32_t hash_bench(void);
+
+#endif /* t_cose_hash_bench_h */
@@ -0,0 +1,235 @@
+/*
+ *  t_cose_key_arena_bench.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#if defined(T_COSE_ENABLE_KEY_ARENA) && defined(__linux__)
+/* For syscall() when compiling with -std=c99 */
+#define _DEFAULT_SOURCE
+#endif
+
+#include "t_cose_key_arena_bench.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "t_cose/t_cose_key_arena.h"
+#include "t_cose/t_cose_key_index.h"
+#include "t_cose/q_useful_buf.h"
+#include "t_cose_make_test_pub_key.h"
+#include "t_cose_bench_util.h"
+
+
+#if defined(T_COSE_ENABLE_KEY_ARENA) && defined(T_COSE_ENABLE_KEY_RECOVERY)
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+/* Twice the entries of a quarter of a million keys */
+#define BENCH_ENTRIES (512 * 1024)
+
+#define BENCH_LOOKUPS 4000000
+
+/* An uncompressed P-256 point */
+#define BENCH_POINT_SIZE (1 + 2 * 32)
+
+
+/*
+ * Open a counter of dTLB load misses in this thread or return -1 if
+ * there isn't one, for example in a virtual machine.
+ */
+static int
+open_dtlb_counter(void)
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = PERF_TYPE_HW_CACHE;
+    attr.config         = PERF_COUNT_HW_CACHE_DTLB |
+                          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+
+static void
+start_counter(int counter)
+{
+#ifdef __linux__
+    if(counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#else
+    (void)counter;
+#endif
+}
+
+
+/*
+ * Stop the counter and return its count, or -1 if there is none.
+ */
+static int64_t
+stop_counter(int counter)
+{
+#ifdef __linux__
+    uint64_t count;
+
+    if(counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if(read(counter, &count, sizeof(count)) == sizeof(count)) {
+            return (int64_t)count;
+        }
+    }
+#else
+    (void)counter;
+#endif
+    return -1;
+}
+
+
+/*
+ * Make an index in an arena with the given options, look up random
+ * points in it and report the time and misses with the given name.
+ */
+static enum t_cose_err_t
+time_lookups(const char        *name,
+             uint32_t           arena_options,
+             struct t_cose_key  key,
+             int                counter)
+{
+    struct t_cose_key_arena  arena;
+    struct t_cose_key_index  index;
+    struct q_useful_buf      entries;
+    struct t_cose_key        found;
+    uint8_t                  point[BENCH_POINT_SIZE];
+    enum t_cose_err_t        result;
+    uint64_t                 random;
+    uint64_t                 start;
+    uint64_t                 elapsed_ns;
+    int64_t                  misses;
+    uint32_t                 i;
+    uint32_t                 hits;
+    char                     metric[64];
+
+    result = t_cose_key_arena_init(&arena,
+                                   BENCH_ENTRIES * sizeof(struct t_cose_key_index_entry),
+                                   arena_options);
+    if(result) {
+        return result;
+    }
+    entries = t_cose_key_arena_alloc(&arena,
+                                     BENCH_ENTRIES * sizeof(struct t_cose_key_index_entry));
+    if(q_useful_buf_is_null(entries)) {
+        result = T_COSE_ERR_INSUFFICIENT_MEMORY;
+        goto Done;
+    }
+    /* This writes every entry so all the pages are there before the
+     * timing */
+    t_cose_key_index_init(&index, entries.ptr, BENCH_ENTRIES);
+    result = t_cose_key_index_add(&index, key);
+    if(result) {
+        goto Done;
+    }
+
+    memset(point, 0x5a, sizeof(point));
+    point[0] = 0x04;
+    random   = 0x9e3779b97f4a7c15;
+    hits     = 0;
+
+    start_counter(counter);
+    start = t_cose_bench_now_ns();
+    for(i = 0; i < BENCH_LOOKUPS; i++) {
+        /* xorshift64 into the start of x, which is what is hashed */
+        random ^= random << 13;
+        random ^= random >> 7;
+        random ^= random << 17;
+        memcpy(&point[1], &random, sizeof(random));
+        if(t_cose_key_index_find(&index,
+                                 (struct q_useful_buf_c){point, sizeof(point)},
+                                 &found)) {
+            hits++;
+        }
+    }
+    elapsed_ns = t_cose_bench_now_ns() - start;
+    misses = stop_counter(counter);
+
+    if(hits != 0) {
+        result = T_COSE_ERR_FAIL;
+        goto Done;
+    }
+
+    snprintf(metric, sizeof(metric), "%s_lookup", name);
+    t_cose_bench_report("key_arena", metric,
+                        (double)elapsed_ns / BENCH_LOOKUPS, "ns");
+    if(misses >= 0) {
+        snprintf(metric, sizeof(metric), "%s_dtlb_misses", name);
+        t_cose_bench_report("key_arena", metric,
+                            (double)misses / BENCH_LOOKUPS, "per_lookup");
+    }
+
+Done:
+    t_cose_key_arena_free(&arena);
+    return result;
+}
+
+
+/*
+ * Public function, see t_cose_key_arena_bench.h
+ */
+int_fast32_t key_arena_bench()
+{
+    struct t_cose_key  key;
+    enum t_cose_err_t  result;
+    int_fast32_t       return_value;
+    int                counter;
+
+    result = make_ecdsa_key_pair(T_COSE_ALGORITHM_ES256, &key);
+    if(result) {
+        return 100 + (int32_t)result;
+    }
+    counter = open_dtlb_counter();
+
+    result = time_lookups("small_pages", T_COSE_KEY_ARENA_OPT_NO_HUGE_PAGES,
+                          key, counter);
+    if(result) {
+        return_value = 200 + (int32_t)result;
+        goto Done;
+    }
+    result = time_lookups("huge_pages", 0, key, counter);
+    if(result) {
+        return_value = 300 + (int32_t)result;
+        goto Done;
+    }
+    return_value = 0;
+
+Done:
+#ifdef __linux__
+    if(counter >= 0) {
+        close(counter);
+    }
+#endif
+    free_ecdsa_key_pair(key);
+
+    return return_value;
+}
+
+#endif /* T_COSE_ENABLE_KEY_ARENA && T_COSE_ENABLE_KEY_RECOVERY */
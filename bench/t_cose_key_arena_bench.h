@@ -0,0 +1,45 @@
+/*
+ *  t_cose_key_arena_bench.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef t_cose_key_arena_bench_h
+#define t_cose_key_arena_bench_h
+
+#include <stdint.h>
+
+
+/**
+ * \file t_cose_key_arena_bench.h
+ *
+ * \brief Benchmark of a large key index on ordinary and huge pages.
+ *
+ * This makes a \ref t_cose_key_index big enough for a quarter of a
+ * million keys in a \ref t_cose_key_arena, once on ordinary pages
+ * and once on huge pages, and reports the time of each lookup in it.
+ * On Linux, when the hardware counters can be read, it also reports
+ * the dTLB load misses per lookup. Otherwise that metric is left out.
+ *
+ * Making that many EC keys would take most of the time, so only one
+ * key is added and the lookups are of random points that aren't in
+ * the index. Each lookup reads one entry at a random place in the
+ * table, the same as a lookup of a key that is there, so the TLB
+ * behaves the same.
+ */
+
+
+#if defined(T_COSE_ENABLE_KEY_ARENA) && defined(T_COSE_ENABLE_KEY_RECOVERY)
+/**
+ * \brief Time lookups in a key index on ordinary and huge pages.
+ *
+ * \return non-zero on failure.
+ */
+int_fast32_t key_arena_bench(void);
+#endif /* T_COSE_ENABLE_KEY_ARENA && T_COSE_ENABLE_KEY_RECOVERY */
+
+#endif /* t_cose_key_arena_bench_h */
@@ -0,0 +1,181 @@
+/*
+ *  t_cose_known_length_bench.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "t_cose_known_length_bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "t_cose/t_cose_sign1_sign.h"
+#include "t_cose/q_useful_buf.h"
+#include "qcbor/qcbor.h"
+#include "t_cose_bench_util.h"
+
+
+#define BENCH_ITERATIONS 20
+
+/* Payload sizes to try */
+static const size_t payload_sizes[] = {1024, 65536, 1048576, 8388608};
+
+/* Room for the header parameters and short-circuit signature */
+#define BENCH_OVERHEAD 200
+
+/* The ways of making the COSE_Sign1 that are compared */
+enum payload_mode {
+    PAYLOAD_WRAP,
+    PAYLOAD_KNOWN_LENGTH,
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
+    PAYLOAD_INCREMENTAL,
+#endif
+    PAYLOAD_MODE_COUNT
+};
+
+static const char *payload_mode_names[] = {
+    "wrap",
+    "known",
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
+    "incremental",
+#endif
+};
+
+
+/*
+ * Make one COSE_Sign1 with the given way of outputting the
+ * payload. The payload is output with QCBOREncode_AddEncoded() as an
+ * application would output its encoded payload.
+ */
+static enum t_cose_err_t
+sign_once(enum payload_mode      mode,
+          struct q_useful_buf_c  payload,
+          struct q_useful_buf    out_buf,
+          struct q_useful_buf_c *signed_cose)
+{
+    struct t_cose_sign1_sign_ctx sign_ctx;
+    QCBOREncodeContext           cbor_encode;
+    enum t_cose_err_t            result;
+
+    t_cose_sign1_sign_init(&sign_ctx,
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           T_COSE_ALGORITHM_ES256);
+    QCBOREncode_Init(&cbor_encode, out_buf);
+
+    switch(mode) {
+    case PAYLOAD_KNOWN_LENGTH:
+        result = t_cose_sign1_encode_parameters_known_length(&sign_ctx,
+                                                             payload.len,
+                                                             &cbor_encode);
+        break;
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
+    case PAYLOAD_INCREMENTAL:
+        result = t_cose_sign1_encode_parameters_incremental(&sign_ctx,
+                                                            payload.len,
+                                                            &cbor_encode);
+        break;
+#endif
+    default:
+        result = t_cose_sign1_encode_parameters(&sign_ctx, &cbor_encode);
+        break;
+    }
+    if(result) {
+        return result;
+    }
+
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
+    if(mode == PAYLOAD_INCREMENTAL) {
+        result = t_cose_sign1_add_payload_bytes(&sign_ctx, &cbor_encode, payload);
+        if(result) {
+            return result;
+        }
+    } else
+#endif
+    QCBOREncode_AddEncoded(&cbor_encode, payload);
+
+    result = t_cose_sign1_encode_signature(&sign_ctx, &cbor_encode);
+    if(result) {
+        return result;
+    }
+
+    if(QCBOREncode_Finish(&cbor_encode, signed_cose)) {
+        return T_COSE_ERR_CBOR_FORMATTING;
+    }
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function, see t_cose_known_length_bench.h
+ */
+int_fast32_t known_length_bench()
+{
+    struct t_cose_bench_stats stats;
+    struct q_useful_buf       payload_buf;
+    struct q_useful_buf       out_buf;
+    struct q_useful_buf_c     signed_cose;
+    enum t_cose_err_t         result;
+    int_fast32_t              return_value;
+    size_t                    size_index;
+    int                       mode;
+    unsigned                  i;
+    uint64_t                  start;
+    char                      metric[40];
+
+    const size_t max_size = payload_sizes[sizeof(payload_sizes)/sizeof(payload_sizes[0]) - 1];
+
+    payload_buf.len = max_size;
+    payload_buf.ptr = malloc(payload_buf.len);
+    out_buf.len     = max_size + BENCH_OVERHEAD;
+    out_buf.ptr     = malloc(out_buf.len);
+    if(payload_buf.ptr == NULL || out_buf.ptr == NULL) {
+        return_value = 1;
+        goto Done;
+    }
+    /* Content doesn't matter as it is not decoded */
+    memset(payload_buf.ptr, 0xa5, payload_buf.len);
+    /* Touch the output so page faults are not counted in the first run */
+    memset(out_buf.ptr, 0, out_buf.len);
+
+    for(size_index = 0;
+        size_index < sizeof(payload_sizes)/sizeof(payload_sizes[0]);
+        size_index++) {
+        const struct q_useful_buf_c payload = {payload_buf.ptr,
+                                               payload_sizes[size_index]};
+
+        for(mode = 0; mode < PAYLOAD_MODE_COUNT; mode++) {
+            t_cose_bench_stats_init(&stats);
+
+            for(i = 0; i < BENCH_ITERATIONS; i++) {
+                start  = t_cose_bench_now_ns();
+                result = sign_once((enum payload_mode)mode,
+                                   payload,
+                                   out_buf,
+                                   &signed_cose);
+                t_cose_bench_stats_add(&stats, t_cose_bench_now_ns() - start);
+                if(result) {
+                    return_value = 2000 + (int32_t)result;
+                    goto Done;
+                }
+            }
+
+            snprintf(metric, sizeof(metric), "%s_%zu",
+                     payload_mode_names[mode],
+                     payload_sizes[size_index]);
+            t_cose_bench_stats_report("known_length", metric, &stats);
+        }
+    }
+
+    return_value = 0;
+
+Done:
+    free(payload_buf.ptr);
+    free(out_buf.ptr);
+    return return_value;
+}
@@ -0,0 +1,43 @@
+/*
+ *  t_cose_known_length_bench.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef t_cose_known_length_bench_h
+#define t_cose_known_length_bench_h
+
+#include <stdint.h>
+
+
+/**
+ * \file t_cose_known_length_bench.h
+ *
+ * \brief Benchmark of payload byte string wrapping.
+ *
+ * For a range of payload sizes this reports the time to make a \c
+ * COSE_Sign1 with t_cose_sign1_encode_parameters(), where the payload
+ * is moved into place when the byte string wrapping it is closed, and
+ * with t_cose_sign1_encode_parameters_known_length(), where it is
+ * not. Short-circuit signing is used so the time of the signature
+ * doesn't hide the difference, but the payload is still hashed.
+ *
+ * With \c T_COSE_ENABLE_INCREMENTAL_HASH it also reports
+ * t_cose_sign1_encode_parameters_incremental(), where the payload is
+ * hashed a block at a time as it is output rather than in a second
+ * pass over all of it.
+ */
+
+
+/**
+ * \brief Time the two ways of wrapping the payload.
+ *
+ * \return non-zero on failure.
+ */
+int_fast32_t known_length_bench(void);
+
+#endif /* t_cose_known_length_bench_h */
@@ -0,0 +1,196 @@
+/*
+ *  t_cose_oscore_bench.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "t_cose_oscore_bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "t_cose/t_cose_oscore.h"
+#include "t_cose/q_useful_buf.h"
+#include "t_cose_bench_util.h"
+
+
+#ifdef T_COSE_ENABLE_OSCORE
+
+/* Packets per timed run. Each needs its own partial IV so they are
+ * all made before the gateway side is timed. */
+#define BENCH_PACKETS 20000
+
+/* Typical size of the plaintext of a CoAP message from a sensor */
+#define BENCH_PLAINTEXT_SIZE 64
+
+#define BENCH_CONTEXT_ITERATIONS 200
+
+/* One protected request as it would arrive at the gateway */
+struct bench_packet {
+    uint8_t option[T_COSE_OSCORE_MAX_OPTION_SIZE];
+    size_t  option_len;
+    uint8_t ciphertext[BENCH_PLAINTEXT_SIZE + T_COSE_OSCORE_TAG_SIZE];
+    size_t  ciphertext_len;
+};
+
+
+static const uint8_t master_secret[] = {
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+    0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10};
+static const uint8_t master_salt[] = {
+    0x9e, 0x7c, 0xa9, 0x22, 0x23, 0x78, 0x63, 0x40};
+static const uint8_t device_id[] = {0x00, 0x2a};
+static const uint8_t gateway_id[] = {0x01};
+
+
+static enum t_cose_err_t
+init_context(struct t_cose_oscore_ctx *context, bool is_device)
+{
+    const struct q_useful_buf_c device  = Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(device_id);
+    const struct q_useful_buf_c gateway = Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(gateway_id);
+
+    return t_cose_oscore_init(context,
+                              T_COSE_ALGORITHM_AES_CCM_16_64_128,
+                              Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(master_secret),
+                              Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(master_salt),
+                              is_device ? device : gateway,
+                              is_device ? gateway : device,
+                              NULL_Q_USEFUL_BUF_C);
+}
+
+
+static void
+report_rate(const char *metric, uint64_t elapsed_ns)
+{
+    t_cose_bench_report("oscore",
+                        metric,
+                        elapsed_ns ? (double)BENCH_PACKETS * 1e9 / (double)elapsed_ns : 0.0,
+                        "pkt/s");
+}
+
+
+/*
+ * Public function, see t_cose_oscore_bench.h
+ */
+int_fast32_t oscore_bench()
+{
+    struct t_cose_oscore_ctx     device;
+    struct t_cose_oscore_ctx     gateway;
+    struct t_cose_oscore_request request;
+    struct t_cose_oscore_option  option;
+    struct t_cose_bench_stats    stats;
+    struct bench_packet         *packets;
+    uint8_t                      plaintext_bytes[BENCH_PLAINTEXT_SIZE];
+    Q_USEFUL_BUF_MAKE_STACK_UB(  out_buffer, BENCH_PLAINTEXT_SIZE + T_COSE_OSCORE_TAG_SIZE);
+    struct q_useful_buf_c        option_value;
+    struct q_useful_buf_c        ciphertext;
+    struct q_useful_buf_c        plaintext;
+    enum t_cose_err_t            result;
+    int_fast32_t                 return_value;
+    uint64_t                     start;
+    uint64_t                     unprotect_ns;
+    uint64_t                     respond_ns;
+    size_t                       i;
+
+    packets = malloc(BENCH_PACKETS * sizeof(*packets));
+    if(packets == NULL) {
+        return_value = 1;
+        goto Done;
+    }
+    memset(plaintext_bytes, 0xa5, sizeof(plaintext_bytes));
+
+    /* -- Deriving a context, which caching avoids per packet -- */
+    t_cose_bench_stats_init(&stats);
+    for(i = 0; i < BENCH_CONTEXT_ITERATIONS; i++) {
+        start  = t_cose_bench_now_ns();
+        result = init_context(&gateway, false);
+        t_cose_bench_stats_add(&stats, t_cose_bench_now_ns() - start);
+        if(result) {
+            return_value = 1000 + (int32_t)result;
+            goto Done;
+        }
+    }
+    t_cose_bench_stats_report("oscore", "derive_context", &stats);
+
+    result = init_context(&device, true);
+    if(result) {
+        return_value = 1100 + (int32_t)result;
+        goto Done;
+    }
+
+    /* -- The device protects the requests -- */
+    start = t_cose_bench_now_ns();
+    for(i = 0; i < BENCH_PACKETS; i++) {
+        result = t_cose_oscore_protect_request(&device,
+                                               (struct q_useful_buf_c){plaintext_bytes,
+                                                                       sizeof(plaintext_bytes)},
+                                               (struct q_useful_buf){packets[i].option,
+                                                                     sizeof(packets[i].option)},
+                                               &option_value,
+                                               (struct q_useful_buf){packets[i].ciphertext,
+                                                                     sizeof(packets[i].ciphertext)},
+                                               &ciphertext,
+                                               &request);
+        if(result) {
+            return_value = 2000 + (int32_t)result;
+            goto Done;
+        }
+        packets[i].option_len     = option_value.len;
+        packets[i].ciphertext_len = ciphertext.len;
+    }
+    report_rate("protect_request", t_cose_bench_now_ns() - start);
+
+    /* -- The gateway unprotects each request and protects a response
+     * of the same size. The two are timed separately. -- */
+    unprotect_ns = 0;
+    respond_ns   = 0;
+    for(i = 0; i < BENCH_PACKETS; i++) {
+        start = t_cose_bench_now_ns();
+        result = t_cose_oscore_parse_option((struct q_useful_buf_c){packets[i].option,
+                                                                    packets[i].option_len},
+                                            &option);
+        if(result == T_COSE_SUCCESS) {
+            result = t_cose_oscore_unprotect_request(&gateway,
+                                                     &option,
+                                                     (struct q_useful_buf_c){packets[i].ciphertext,
+                                                                             packets[i].ciphertext_len},
+                                                     (struct q_useful_buf){plaintext_bytes,
+                                                                           sizeof(plaintext_bytes)},
+                                                     &plaintext,
+                                                     &request);
+        }
+        unprotect_ns += t_cose_bench_now_ns() - start;
+        if(result) {
+            return_value = 3000 + (int32_t)result;
+            goto Done;
+        }
+
+        start = t_cose_bench_now_ns();
+        result = t_cose_oscore_protect_response(&gateway,
+                                                &request,
+                                                plaintext,
+                                                out_buffer,
+                                                &ciphertext);
+        respond_ns += t_cose_bench_now_ns() - start;
+        if(result) {
+            return_value = 4000 + (int32_t)result;
+            goto Done;
+        }
+    }
+    report_rate("unprotect_request", unprotect_ns);
+    report_rate("protect_response", respond_ns);
+    report_rate("gateway_round_trip", unprotect_ns + respond_ns);
+
+    return_value = 0;
+
+Done:
+    free(packets);
+    return return_value;
+}
+
+#endif /* T_COSE_ENABLE_OSCORE */
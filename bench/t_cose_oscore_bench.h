@@ -0,0 +1,40 @@
+/*
+ *  t_cose_oscore_bench.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef t_cose_oscore_bench_h
+#define t_cose_oscore_bench_h
+
+#include <stdint.h>
+
+
+/**
+ * \file t_cose_oscore_bench.h
+ *
+ * \brief Benchmark of OSCORE message protection.
+ *
+ * This reports how many packets per second one core protects and
+ * unprotects with a cached security context, for the client sending
+ * requests and for a gateway unprotecting them and protecting the
+ * responses. Each run is on one thread so the rates are per core. The
+ * time to derive a security context is reported too, to show what
+ * caching it saves.
+ */
+
+
+#ifdef T_COSE_ENABLE_OSCORE
+/**
+ * \brief Time OSCORE requests and responses.
+ *
+ * \return non-zero on failure.
+ */
+int_fast32_t oscore_bench(void);
+#endif /* T_COSE_ENABLE_OSCORE */
+
+#endif /* t_cose_oscore_bench_h */
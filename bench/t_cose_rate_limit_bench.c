@@ -0,0 +1,177 @@
+/*
+ *  t_cose_rate_limit_bench.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "t_cose_rate_limit_bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "t_cose/t_cose_rate_limit.h"
+#include "t_cose/t_cose_sign1_sign.h"
+#include "t_cose/t_cose_sign1_verify.h"
+#include "t_cose/q_useful_buf.h"
+#include "t_cose_bench_util.h"
+
+
+#ifdef T_COSE_ENABLE_RATE_LIMIT
+
+#define BENCH_TAKES 1000000
+#define BENCH_KIDS  1000
+#define BENCH_SLOTS 4096
+
+#define BENCH_VERIFIES 20000
+
+/* Room for a short-circuit signature of a small payload */
+#define BENCH_MESSAGE_SIZE 200
+
+
+static uint64_t s_limiter_memory[(BENCH_SLOTS * 16 + 64) / sizeof(uint64_t)];
+
+
+static void
+report_ns_per_op(const char *metric, uint64_t elapsed_ns, uint32_t ops)
+{
+    t_cose_bench_report("rate_limit", metric, (double)elapsed_ns / (double)ops, "ns");
+}
+
+
+#ifndef T_COSE_DISABLE_SHORT_CIRCUIT_SIGN
+/*
+ * Verify the same message count times and return the total time.
+ */
+static enum t_cose_err_t
+time_verify(struct t_cose_rate_limit *limiter,
+            struct q_useful_buf_c     message,
+            enum t_cose_err_t         expected,
+            uint64_t                 *elapsed_ns,
+            uint32_t                  count)
+{
+    struct t_cose_sign1_verify_ctx verify_ctx;
+    struct q_useful_buf_c          payload;
+    enum t_cose_err_t              result;
+    uint64_t                       start;
+    uint32_t                       i;
+
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+    t_cose_sign1_verify_set_rate_limit(&verify_ctx, limiter);
+
+    start = t_cose_bench_now_ns();
+    for(i = 0; i < count; i++) {
+        result = t_cose_sign1_verify(&verify_ctx, message, &payload, NULL);
+        if(result != expected) {
+            return result == T_COSE_SUCCESS ? T_COSE_ERR_FAIL : result;
+        }
+    }
+    *elapsed_ns = t_cose_bench_now_ns() - start;
+
+    return T_COSE_SUCCESS;
+}
+#endif /* T_COSE_DISABLE_SHORT_CIRCUIT_SIGN */
+
+
+/*
+ * Public function, see t_cose_rate_limit_bench.h
+ */
+int_fast32_t rate_limit_bench()
+{
+    struct t_cose_rate_limit *limiter;
+    enum t_cose_err_t         result;
+    uint32_t                  kid_bytes;
+    uint64_t                  start;
+    uint64_t                  elapsed_ns;
+    uint32_t                  i;
+#ifndef T_COSE_DISABLE_SHORT_CIRCUIT_SIGN
+    struct t_cose_sign1_sign_ctx sign_ctx;
+    Q_USEFUL_BUF_MAKE_STACK_UB(  message_buffer, BENCH_MESSAGE_SIZE);
+    struct q_useful_buf_c        message;
+    uint64_t                     baseline_ns;
+#endif
+
+    if(t_cose_rate_limit_size(BENCH_SLOTS) > sizeof(s_limiter_memory)) {
+        return 100;
+    }
+
+    /* -- Taking tokens for many kids, none of them limited -- */
+    result = t_cose_rate_limit_init((struct q_useful_buf){s_limiter_memory,
+                                                          sizeof(s_limiter_memory)},
+                                    BENCH_SLOTS, 1000000, 1000000, &limiter);
+    if(result) {
+        return 200 + (int32_t)result;
+    }
+    start = t_cose_bench_now_ns();
+    for(i = 0; i < BENCH_TAKES; i++) {
+        kid_bytes = i % BENCH_KIDS;
+        if(!t_cose_rate_limit_take(limiter,
+                                   (struct q_useful_buf_c){&kid_bytes,
+                                                           sizeof(kid_bytes)})) {
+            return 300;
+        }
+    }
+    report_ns_per_op("take", t_cose_bench_now_ns() - start, BENCH_TAKES);
+
+#ifndef T_COSE_DISABLE_SHORT_CIRCUIT_SIGN
+    t_cose_sign1_sign_init(&sign_ctx,
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           T_COSE_ALGORITHM_ES256);
+    result = t_cose_sign1_sign(&sign_ctx,
+                               Q_USEFUL_BUF_FROM_SZ_LITERAL("rate limit bench payload"),
+                               message_buffer,
+                               &message);
+    if(result) {
+        return 400 + (int32_t)result;
+    }
+
+    /* -- Verify without and with a limiter that never refuses -- */
+    result = time_verify(NULL, message, T_COSE_SUCCESS, &baseline_ns,
+                         BENCH_VERIFIES);
+    if(result) {
+        return 500 + (int32_t)result;
+    }
+    result = time_verify(limiter, message, T_COSE_SUCCESS, &elapsed_ns,
+                         BENCH_VERIFIES);
+    if(result) {
+        return 600 + (int32_t)result;
+    }
+    report_ns_per_op("verify_baseline", baseline_ns, BENCH_VERIFIES);
+    report_ns_per_op("verify_limited", elapsed_ns, BENCH_VERIFIES);
+    t_cose_bench_report("rate_limit",
+                        "overhead",
+                        baseline_ns ? 100.0 * ((double)elapsed_ns - (double)baseline_ns) /
+                                          (double)baseline_ns
+                                    : 0.0,
+                        "%");
+
+    /* -- Refusing a kid that is flooding. The time never moves and
+     * the one token of the burst is used first, so every message
+     * after is refused. -- */
+    result = t_cose_rate_limit_init((struct q_useful_buf){s_limiter_memory,
+                                                          sizeof(s_limiter_memory)},
+                                    BENCH_SLOTS, 10, 1, &limiter);
+    if(result) {
+        return 700 + (int32_t)result;
+    }
+    /* The one token of the burst */
+    result = time_verify(limiter, message, T_COSE_SUCCESS, &elapsed_ns, 1);
+    if(result) {
+        return 800 + (int32_t)result;
+    }
+    result = time_verify(limiter, message, T_COSE_ERR_RATE_LIMITED, &elapsed_ns,
+                         BENCH_VERIFIES);
+    if(result) {
+        return 900 + (int32_t)result;
+    }
+    report_ns_per_op("verify_refused", elapsed_ns, BENCH_VERIFIES);
+#endif /* T_COSE_DISABLE_SHORT_CIRCUIT_SIGN */
+
+    return 0;
+}
+
+#endif /* T_COSE_ENABLE_RATE_LIMIT */
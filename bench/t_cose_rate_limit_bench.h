@@ -0,0 +1,40 @@
+/*
+ *  t_cose_rate_limit_bench.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef t_cose_rate_limit_bench_h
+#define t_cose_rate_limit_bench_h
+
+#include <stdint.h>
+
+
+/**
+ * \file t_cose_rate_limit_bench.h
+ *
+ * \brief Benchmark of the cost of per-kid rate limiting.
+ *
+ * This reports the time of taking a token across many kids, of
+ * verifying a message with and without a rate limiter set, so the
+ * overhead on the path where nothing is limited can be seen, and of
+ * refusing a message from a kid that is over its rate. Short-circuit
+ * signatures are verified so the time is dominated by decoding and
+ * hashing, the worst case for the relative overhead.
+ */
+
+
+#ifdef T_COSE_ENABLE_RATE_LIMIT
+/**
+ * \brief Time rate limiting.
+ *
+ * \return non-zero on failure.
+ */
+int_fast32_t rate_limit_bench(void);
+#endif /* T_COSE_ENABLE_RATE_LIMIT */
+
+#endif /* t_cose_rate_limit_bench_h */
@@ -0,0 +1,442 @@
+/*
+ *  t_cose_replay_bench.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "t_cose_replay_bench.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "t_cose/t_cose_sign1_sign.h"
+#include "t_cose/t_cose_sign1_verify.h"
+#include "t_cose/t_cose_capture.h"
+#include "t_cose/q_useful_buf.h"
+#include "t_cose_make_test_pub_key.h"
+#include "t_cose_bench_util.h"
+
+
+#ifdef T_COSE_ENABLE_CAPTURE
+
+/* Messages in the synthetic workload */
+#define REPLAY_MESSAGES 2000
+
+/* Payloads are clipped to this to bound memory */
+#define REPLAY_MAX_PAYLOAD (1024 * 1024)
+
+/* All the signed messages are kept in one buffer of this size. The
+ * workload is cut short if it doesn't fit. */
+#define REPLAY_ARENA_SIZE (64 * 1024 * 1024)
+
+/* Room for everything in a message except the payload and the
+ * content type */
+#define REPLAY_OVERHEAD 400
+
+/* Largest content type made to pad the protected parameters */
+#define REPLAY_MAX_CONTENT_TYPE 200
+
+
+/* One message of the synthetic workload */
+struct replay_message {
+    struct q_useful_buf_c cose_sign1;
+    struct t_cose_key     key;
+    uint32_t              verify_options;
+    bool                  expect_success;
+};
+
+
+/*
+ * A mix for when there is no captured log: mostly small ES256
+ * messages from a few hot kids, some larger ES384 ones and a few
+ * failures. Each entry is repeated weight times.
+ */
+static const struct {
+    unsigned                     weight;
+    struct t_cose_capture_record record;
+} s_default_workload[] = {
+    {50, {T_COSE_ALGORITHM_ES256, T_COSE_SUCCESS, T_COSE_CAPTURE_FLAG_TAGGED,
+          200, 3, 64, 8, 4, 1}},
+    {15, {T_COSE_ALGORITHM_ES256, T_COSE_SUCCESS, T_COSE_CAPTURE_FLAG_TAGGED,
+          200, 3, 64, 8, 4, 2}},
+    {10, {T_COSE_ALGORITHM_ES256, T_COSE_SUCCESS,
+          T_COSE_CAPTURE_FLAG_TAGGED | T_COSE_CAPTURE_FLAG_CONTENT_TYPE,
+          1500, 23, 64, 8, 4, 3}},
+    {10, {T_COSE_ALGORITHM_ES384, T_COSE_SUCCESS, 0,
+          4000, 4, 96, 16, 6, 4}},
+    {5,  {T_COSE_ALGORITHM_ES256, T_COSE_SUCCESS, T_COSE_CAPTURE_FLAG_TAGGED,
+          60000, 3, 64, 8, 6, 5}},
+    {4,  {T_COSE_ALGORITHM_ES256, T_COSE_ERR_SIG_VERIFY, T_COSE_CAPTURE_FLAG_TAGGED,
+          200, 3, 64, 8, 4, 6}},
+    {1,  {T_COSE_ALGORITHM_ES256, T_COSE_ERR_SIGN1_FORMAT, T_COSE_CAPTURE_FLAG_TAGGED,
+          0, 0, 0, 0, 40, 0}},
+};
+
+
+/* The algorithms there may be keys for */
+static const int32_t s_replay_algs[] = {
+    T_COSE_ALGORITHM_ES256,
+#ifndef T_COSE_DISABLE_ES384
+    T_COSE_ALGORITHM_ES384,
+#endif
+#ifndef T_COSE_DISABLE_ES512
+    T_COSE_ALGORITHM_ES512,
+#endif
+};
+
+#define REPLAY_ALG_COUNT (sizeof(s_replay_algs) / sizeof(s_replay_algs[0]))
+
+
+static uint32_t
+replay_random(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+
+    return x;
+}
+
+
+/*
+ * Read the log named by T_COSE_REPLAY_LOG or make one from
+ * s_default_workload. The records are returned in a malloc'd array.
+ */
+static int_fast32_t
+load_workload(struct t_cose_capture_record **records, size_t *count)
+{
+    const char                   *path;
+    FILE                         *file;
+    long                          file_len;
+    uint8_t                      *log_bytes;
+    struct q_useful_buf_c         log_records;
+    uint32_t                      sample_rate;
+    size_t                        i;
+    size_t                        j;
+    size_t                        n;
+    int_fast32_t                  return_value;
+
+    path = getenv("T_COSE_REPLAY_LOG");
+    if(path == NULL) {
+        n = 0;
+        for(i = 0; i < sizeof(s_default_workload)/sizeof(s_default_workload[0]); i++) {
+            n += s_default_workload[i].weight;
+        }
+        *records = malloc(n * sizeof(**records));
+        if(*records == NULL) {
+            return 1;
+        }
+        n = 0;
+        for(i = 0; i < sizeof(s_default_workload)/sizeof(s_default_workload[0]); i++) {
+            for(j = 0; j < s_default_workload[i].weight; j++) {
+                (*records)[n++] = s_default_workload[i].record;
+            }
+        }
+        *count = n;
+        return 0;
+    }
+
+    log_bytes = NULL;
+    *records  = NULL;
+    file = fopen(path, "rb");
+    if(file == NULL) {
+        fprintf(stderr, "replay_bench: can't open %s\n", path);
+        return 2;
+    }
+    if(fseek(file, 0, SEEK_END) || (file_len = ftell(file)) < 0 ||
+       fseek(file, 0, SEEK_SET)) {
+        return_value = 3;
+        goto Done;
+    }
+    log_bytes = malloc((size_t)file_len + 1);
+    if(log_bytes == NULL ||
+       fread(log_bytes, 1, (size_t)file_len, file) != (size_t)file_len) {
+        return_value = 4;
+        goto Done;
+    }
+
+    if(t_cose_capture_decode_header((struct q_useful_buf_c){log_bytes, (size_t)file_len},
+                                    &sample_rate,
+                                    &log_records) ||
+       log_records.len == 0) {
+        fprintf(stderr, "replay_bench: %s is not a capture log\n", path);
+        return_value = 5;
+        goto Done;
+    }
+
+    n = log_records.len / T_COSE_CAPTURE_RECORD_SIZE;
+    *records = malloc(n * sizeof(**records));
+    if(*records == NULL) {
+        return_value = 6;
+        goto Done;
+    }
+    for(i = 0; i < n; i++) {
+        (void)t_cose_capture_decode_record(&log_records, &(*records)[i]);
+    }
+    *count = n;
+    return_value = 0;
+
+Done:
+    fclose(file);
+    free(log_bytes);
+    return return_value;
+}
+
+
+/*
+ * Length of the protected parameters with only the algorithm ID.
+ */
+static size_t
+alg_only_protected_len(int32_t cose_algorithm_id)
+{
+    /* A map of one, the label 1 and the ID which is one byte for -1
+     * to -24 and two for -25 to -256 */
+    return cose_algorithm_id >= -24 ? 3 : 4;
+}
+
+
+/*
+ * Sign one message with the shape of a record.
+ */
+static enum t_cose_err_t
+make_message(const struct t_cose_capture_record *record,
+             const struct t_cose_key             keys[REPLAY_ALG_COUNT],
+             const bool                          have_keys[REPLAY_ALG_COUNT],
+             struct q_useful_buf_c               payload_source,
+             struct q_useful_buf                 out_buf,
+             struct replay_message              *message)
+{
+    struct t_cose_sign1_sign_ctx sign_ctx;
+    enum t_cose_err_t            result;
+    int32_t                      alg;
+    size_t                       alg_index;
+    uint8_t                      kid_bytes[UINT8_MAX];
+    uint32_t                     sign_options;
+    size_t                       i;
+#ifndef T_COSE_DISABLE_CONTENT_TYPE
+    char                         content_type[REPLAY_MAX_CONTENT_TYPE + 1];
+    size_t                       content_type_len;
+#endif
+
+    /* -- An algorithm there may be a key for -- */
+    alg       = T_COSE_ALGORITHM_ES256;
+    alg_index = 0;
+    for(i = 0; i < REPLAY_ALG_COUNT; i++) {
+        if(s_replay_algs[i] == record->cose_algorithm_id) {
+            alg       = s_replay_algs[i];
+            alg_index = i;
+        }
+    }
+
+    sign_options = 0;
+    if(!(record->flags & T_COSE_CAPTURE_FLAG_TAGGED)) {
+        sign_options |= T_COSE_OPT_OMIT_CBOR_TAG;
+    }
+    message->verify_options = 0;
+    if(record->flags & T_COSE_CAPTURE_FLAG_DECODE_ONLY) {
+        message->verify_options |= T_COSE_OPT_DECODE_ONLY;
+    }
+    if((record->flags & T_COSE_CAPTURE_FLAG_SHORT_CIRCUIT) || !have_keys[alg_index]) {
+        sign_options            |= T_COSE_OPT_SHORT_CIRCUIT_SIG;
+        message->verify_options |= T_COSE_OPT_ALLOW_SHORT_CIRCUIT;
+        message->key             = T_COSE_NULL_KEY;
+    } else {
+        message->key             = keys[alg_index];
+    }
+
+    t_cose_sign1_sign_init(&sign_ctx, sign_options, alg);
+
+    /* -- The same kid tag gives the same kid so the skew is kept -- */
+    if(!(sign_options & T_COSE_OPT_SHORT_CIRCUIT_SIG)) {
+        for(i = 0; i < record->kid_len; i++) {
+            kid_bytes[i] = (uint8_t)((record->kid_tag >> (8 * (i & 1))) ^ i);
+        }
+        t_cose_sign1_set_signing_key(&sign_ctx,
+                                     message->key,
+                                     record->kid_len ?
+                                         (struct q_useful_buf_c){kid_bytes, record->kid_len} :
+                                         NULL_Q_USEFUL_BUF_C);
+    }
+
+#ifndef T_COSE_DISABLE_CONTENT_TYPE
+    /* -- Pad the protected parameters to their length with a content type -- */
+    if(record->protected_len > alg_only_protected_len(alg) + 2) {
+        content_type_len = record->protected_len - alg_only_protected_len(alg) - 2;
+        if(content_type_len > REPLAY_MAX_CONTENT_TYPE) {
+            content_type_len = REPLAY_MAX_CONTENT_TYPE;
+        }
+        memset(content_type, 'a', content_type_len);
+        content_type[content_type_len] = '\0';
+        t_cose_sign1_set_content_type_tstr(&sign_ctx, content_type);
+    } else if(record->flags & T_COSE_CAPTURE_FLAG_CONTENT_TYPE) {
+        t_cose_sign1_set_content_type_uint(&sign_ctx, 60);
+    }
+#endif
+
+    result = t_cose_sign1_sign(&sign_ctx,
+                               q_useful_buf_head(payload_source, record->payload_len),
+                               out_buf,
+                               &message->cose_sign1);
+    if(result) {
+        return result;
+    }
+
+    /* -- Fail the same way, or close to it -- */
+    message->expect_success = record->result == T_COSE_SUCCESS;
+    if(record->result == T_COSE_ERR_SIG_VERIFY) {
+        ((uint8_t *)out_buf.ptr)[message->cose_sign1.len - 1] ^= 0x01;
+    } else if(!message->expect_success) {
+        /* Other failures are replayed as a malformed message */
+        message->cose_sign1.len--;
+    }
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function, see t_cose_replay_bench.h
+ */
+int_fast32_t replay_bench()
+{
+    struct t_cose_capture_record  *records;
+    size_t                         record_count;
+    struct replay_message         *messages;
+    size_t                         message_count;
+    struct t_cose_key              keys[REPLAY_ALG_COUNT];
+    bool                           have_keys[REPLAY_ALG_COUNT];
+    struct q_useful_buf            payload_source;
+    struct q_useful_buf            arena;
+    size_t                         arena_used;
+    size_t                         payload_bytes;
+    struct t_cose_sign1_verify_ctx verify_ctx;
+    struct q_useful_buf_c          payload;
+    struct t_cose_bench_stats      sign_stats;
+    struct t_cose_bench_stats      verify_stats;
+    struct t_cose_capture_record   record;
+    enum t_cose_err_t              result;
+    int_fast32_t                   return_value;
+    uint32_t                       random_state;
+    uint64_t                       start;
+    uint64_t                       verify_start;
+    uint64_t                       verify_total_ns;
+    size_t                         i;
+
+    records            = NULL;
+    messages           = NULL;
+    payload_source.ptr = NULL;
+    arena.ptr          = NULL;
+    for(i = 0; i < REPLAY_ALG_COUNT; i++) {
+        have_keys[i] = false;
+    }
+
+    return_value = load_workload(&records, &record_count);
+    if(return_value) {
+        goto Done;
+    }
+
+    messages           = malloc(REPLAY_MESSAGES * sizeof(*messages));
+    payload_source.len = REPLAY_MAX_PAYLOAD;
+    payload_source.ptr = malloc(payload_source.len);
+    arena.len          = REPLAY_ARENA_SIZE;
+    arena.ptr          = malloc(arena.len);
+    if(messages == NULL || payload_source.ptr == NULL || arena.ptr == NULL) {
+        return_value = 1;
+        goto Done;
+    }
+    /* Content doesn't matter as it is not decoded */
+    memset(payload_source.ptr, 0xa5, payload_source.len);
+
+#ifndef T_COSE_DISABLE_SIGN_VERIFY_TESTS
+    for(i = 0; i < REPLAY_ALG_COUNT; i++) {
+        have_keys[i] = make_ecdsa_key_pair(s_replay_algs[i], &keys[i]) == T_COSE_SUCCESS;
+    }
+#endif
+
+    /* -- Sign messages drawn at random from the records -- */
+    t_cose_bench_stats_init(&sign_stats);
+    random_state  = 0x2545f491;
+    arena_used    = 0;
+    payload_bytes = 0;
+    for(message_count = 0; message_count < REPLAY_MESSAGES; message_count++) {
+        record = records[replay_random(&random_state) % record_count];
+        if(record.payload_len > REPLAY_MAX_PAYLOAD) {
+            record.payload_len = REPLAY_MAX_PAYLOAD;
+        }
+        if(arena_used + record.payload_len + REPLAY_MAX_CONTENT_TYPE +
+               REPLAY_OVERHEAD > arena.len) {
+            break;
+        }
+
+        start  = t_cose_bench_now_ns();
+        result = make_message(&record,
+                              keys,
+                              have_keys,
+                              q_useful_buf_const(payload_source),
+                              (struct q_useful_buf){(uint8_t *)arena.ptr + arena_used,
+                                                    arena.len - arena_used},
+                              &messages[message_count]);
+        t_cose_bench_stats_add(&sign_stats, t_cose_bench_now_ns() - start);
+        if(result) {
+            return_value = 2000 + (int32_t)result;
+            goto Done;
+        }
+        arena_used    += messages[message_count].cose_sign1.len + 1;
+        payload_bytes += record.payload_len;
+    }
+
+    /* -- Verify them all -- */
+    t_cose_bench_stats_init(&verify_stats);
+    verify_start = t_cose_bench_now_ns();
+    for(i = 0; i < message_count; i++) {
+        start = t_cose_bench_now_ns();
+        t_cose_sign1_verify_init(&verify_ctx, messages[i].verify_options);
+        t_cose_sign1_set_verification_key(&verify_ctx, messages[i].key);
+        result = t_cose_sign1_verify(&verify_ctx,
+                                     messages[i].cose_sign1,
+                                     &payload,
+                                     NULL);
+        t_cose_bench_stats_add(&verify_stats, t_cose_bench_now_ns() - start);
+        if((result == T_COSE_SUCCESS) != messages[i].expect_success) {
+            return_value = 3000 + (int32_t)result;
+            goto Done;
+        }
+    }
+    verify_total_ns = t_cose_bench_now_ns() - verify_start;
+
+    t_cose_bench_report("replay", "records", (double)record_count, "records");
+    t_cose_bench_report("replay", "messages", (double)message_count, "msgs");
+    t_cose_bench_report("replay", "payload_bytes", (double)payload_bytes, "bytes");
+    t_cose_bench_stats_report("replay", "sign", &sign_stats);
+    t_cose_bench_stats_report("replay", "verify", &verify_stats);
+    t_cose_bench_report("replay", "verify_rate",
+                        verify_total_ns ? (double)message_count * 1e9 / (double)verify_total_ns : 0,
+                        "ops/s");
+
+    return_value = 0;
+
+Done:
+#ifndef T_COSE_DISABLE_SIGN_VERIFY_TESTS
+    for(i = 0; i < REPLAY_ALG_COUNT; i++) {
+        if(have_keys[i]) {
+            free_ecdsa_key_pair(keys[i]);
+        }
+    }
+#endif
+    free(records);
+    free(messages);
+    free(payload_source.ptr);
+    free(arena.ptr);
+    return return_value;
+}
+
+#endif /* T_COSE_ENABLE_CAPTURE */
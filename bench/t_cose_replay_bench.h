@@ -0,0 +1,40 @@
+/*
+ *  t_cose_replay_bench.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef t_cose_replay_bench_h
+#define t_cose_replay_bench_h
+
+#include <stdint.h>
+
+
+/**
+ * \file t_cose_replay_bench.h
+ *
+ * \brief Benchmark of a workload captured from production.
+ *
+ * The log named by the environment variable \c T_COSE_REPLAY_LOG,
+ * written by a capture (see t_cose_capture.h), is read and a
+ * synthetic workload with the same mix of algorithms, payload sizes,
+ * header shapes, kids and failures is made from it. Each message is
+ * signed and then verified and the time of each is reported. Without
+ * \c T_COSE_REPLAY_LOG a built-in mix is used.
+ */
+
+
+#ifdef T_COSE_ENABLE_CAPTURE
+/**
+ * \brief Sign and verify a replayed workload.
+ *
+ * \return non-zero on failure.
+ */
+int_fast32_t replay_bench(void);
+#endif /* T_COSE_ENABLE_CAPTURE */
+
+#endif /* t_cose_replay_bench_h */
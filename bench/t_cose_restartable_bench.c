@@ -0,0 +1,205 @@
+/*
+ *  t_cose_restartable_bench.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "t_cose_restartable_bench.h"
+
+#include <stdio.h>
+
+#include "t_cose/t_cose_sign1_sign.h"
+#include "t_cose/t_cose_sign1_verify.h"
+#include "t_cose/q_useful_buf.h"
+#include "t_cose_make_test_pub_key.h"
+#include "t_cose_bench_util.h"
+
+
+#ifdef T_COSE_ENABLE_RESTARTABLE
+
+/* P-384 is the case that motivated this. */
+#ifndef T_COSE_DISABLE_ES384
+#define BENCH_ALG T_COSE_ALGORITHM_ES384
+#else
+#define BENCH_ALG T_COSE_ALGORITHM_ES256
+#endif
+
+#define BENCH_ITERATIONS 50
+
+/* max_ops budgets to try. See mbedtls_ecp_set_max_ops() */
+static const uint32_t slice_budgets[] = {100, 250, 500, 1000, 2000};
+
+
+static const char *payload_sz = "restartable benchmark payload";
+
+
+static enum t_cose_err_t
+sign_once(struct t_cose_key          key_pair,
+          struct t_cose_restart_ctx *restart_ctx,
+          struct q_useful_buf        out_buf,
+          struct q_useful_buf_c     *signed_cose,
+          struct t_cose_bench_stats *slice_stats)
+{
+    struct t_cose_sign1_sign_ctx sign_ctx;
+    enum t_cose_err_t            result;
+    uint64_t                     start;
+
+    t_cose_sign1_sign_init(&sign_ctx, 0, BENCH_ALG);
+    t_cose_sign1_set_signing_key(&sign_ctx, key_pair, NULL_Q_USEFUL_BUF_C);
+    t_cose_sign1_sign_set_restart_ctx(&sign_ctx, restart_ctx);
+
+    do {
+        start  = t_cose_bench_now_ns();
+        result = t_cose_sign1_sign(&sign_ctx,
+                                   q_useful_buf_from_sz(payload_sz),
+                                   out_buf,
+                                   signed_cose);
+        t_cose_bench_stats_add(slice_stats, t_cose_bench_now_ns() - start);
+    } while(result == T_COSE_ERR_SIG_IN_PROGRESS);
+
+    return result;
+}
+
+
+static enum t_cose_err_t
+verify_once(struct t_cose_key          key_pair,
+            struct t_cose_restart_ctx *restart_ctx,
+            struct q_useful_buf_c      signed_cose,
+            struct t_cose_bench_stats *slice_stats)
+{
+    struct t_cose_sign1_verify_ctx verify_ctx;
+    enum t_cose_err_t              result;
+    struct q_useful_buf_c          payload;
+    uint64_t                       start;
+
+    t_cose_sign1_verify_init(&verify_ctx, 0);
+    t_cose_sign1_set_verification_key(&verify_ctx, key_pair);
+    t_cose_sign1_verify_set_restart_ctx(&verify_ctx, restart_ctx);
+
+    do {
+        start  = t_cose_bench_now_ns();
+        result = t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, NULL);
+        t_cose_bench_stats_add(slice_stats, t_cose_bench_now_ns() - start);
+    } while(result == T_COSE_ERR_SIG_IN_PROGRESS);
+
+    return result;
+}
+
+
+/*
+ * Runs BENCH_ITERATIONS operations for each budget, plus the
+ * monolithic call (restart_ctx NULL) reported as "mono".
+ */
+static int_fast32_t run_bench(const char *bench_name, bool is_verify)
+{
+    struct t_cose_key          key_pair;
+    struct t_cose_restart_ctx  restart_ctx;
+    struct t_cose_bench_stats  slice_stats;
+    struct t_cose_bench_stats  op_stats;
+    Q_USEFUL_BUF_MAKE_STACK_UB(signed_cose_buffer, 300);
+    struct q_useful_buf_c      signed_cose;
+    struct q_useful_buf_c      scratch;
+    enum t_cose_err_t          result;
+    int_fast32_t               return_value;
+    size_t                     budget_index;
+    unsigned                   i;
+    uint64_t                   start;
+    char                       metric[32];
+
+    result = make_ecdsa_key_pair(BENCH_ALG, &key_pair);
+    if(result) {
+        return 1000 + (int32_t)result;
+    }
+
+    /* A message to verify */
+    t_cose_bench_stats_init(&slice_stats);
+    result = sign_once(key_pair, NULL, signed_cose_buffer, &signed_cose, &slice_stats);
+    if(result) {
+        return_value = 2000 + (int32_t)result;
+        goto Done;
+    }
+
+    /* budget_index == count of slice_budgets is the monolithic run */
+    for(budget_index = 0;
+        budget_index <= sizeof(slice_budgets)/sizeof(slice_budgets[0]);
+        budget_index++) {
+        const bool is_mono = budget_index == sizeof(slice_budgets)/sizeof(slice_budgets[0]);
+
+        t_cose_bench_stats_init(&slice_stats);
+        t_cose_bench_stats_init(&op_stats);
+
+        for(i = 0; i < BENCH_ITERATIONS; i++) {
+            if(!is_mono) {
+                t_cose_restart_ctx_init(&restart_ctx, slice_budgets[budget_index]);
+            }
+            start = t_cose_bench_now_ns();
+            if(is_verify) {
+                result = verify_once(key_pair,
+                                     is_mono ? NULL : &restart_ctx,
+                                     signed_cose,
+                                     &slice_stats);
+            } else {
+                /* Separate output so signed_cose stays intact */
+                Q_USEFUL_BUF_MAKE_STACK_UB(sign_out, 300);
+                result = sign_once(key_pair,
+                                   is_mono ? NULL : &restart_ctx,
+                                   sign_out,
+                                   &scratch,
+                                   &slice_stats);
+            }
+            t_cose_bench_stats_add(&op_stats, t_cose_bench_now_ns() - start);
+            if(result) {
+                return_value = 3000 + (int32_t)result;
+                goto Done;
+            }
+        }
+
+        if(is_mono) {
+            snprintf(metric, sizeof(metric), "mono");
+        } else {
+            snprintf(metric, sizeof(metric), "ops%u",
+                     (unsigned)slice_budgets[budget_index]);
+        }
+        t_cose_bench_stats_report(bench_name, metric, &op_stats);
+        if(!is_mono) {
+            snprintf(metric, sizeof(metric), "ops%u_slice",
+                     (unsigned)slice_budgets[budget_index]);
+            t_cose_bench_stats_report(bench_name, metric, &slice_stats);
+            snprintf(metric, sizeof(metric), "ops%u_slices_per_op",
+                     (unsigned)slice_budgets[budget_index]);
+            t_cose_bench_report(bench_name, metric,
+                                (double)slice_stats.count / BENCH_ITERATIONS,
+                                "slices");
+        }
+    }
+
+    return_value = 0;
+
+Done:
+    free_ecdsa_key_pair(key_pair);
+    return return_value;
+}
+
+
+/*
+ * Public function, see t_cose_restartable_bench.h
+ */
+int_fast32_t restartable_sign_bench()
+{
+    return run_bench("restartable_sign", false);
+}
+
+
+/*
+ * Public function, see t_cose_restartable_bench.h
+ */
+int_fast32_t restartable_verify_bench()
+{
+    return run_bench("restartable_verify", true);
+}
+
+#endif /* T_COSE_ENABLE_RESTARTABLE */
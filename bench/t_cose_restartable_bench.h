@@ -0,0 +1,48 @@
+/*
+ *  t_cose_restartable_bench.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef t_cose_restartable_bench_h
+#define t_cose_restartable_bench_h
+
+#include <stdint.h>
+
+
+/**
+ * \file t_cose_restartable_bench.h
+ *
+ * \brief Benchmarks of time-sliced signing and verification.
+ *
+ * For a range of \c max_ops budgets these report the average and
+ * worst-case time of one slice alongside the time of the whole
+ * operation, and the same for the monolithic (non-restartable)
+ * call. The worst-case slice time is the latency a slice adds to an
+ * event loop. The total time shows what the slicing costs in
+ * throughput.
+ */
+
+
+#ifdef T_COSE_ENABLE_RESTARTABLE
+/**
+ * \brief Time monolithic and sliced signing.
+ *
+ * \return non-zero on failure.
+ */
+int_fast32_t restartable_sign_bench(void);
+
+
+/**
+ * \brief Time monolithic and sliced verification.
+ *
+ * \return non-zero on failure.
+ */
+int_fast32_t restartable_verify_bench(void);
+#endif /* T_COSE_ENABLE_RESTARTABLE */
+
+#endif /* t_cose_restartable_bench_h */
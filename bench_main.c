@@ -0,0 +1,20 @@
+/*
+ *  bench_main.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md.
+ */
+
+#include "run_benchmarks.h"
+
+
+int main(int argc, const char * argv[])
+{
+    (void)argc; // Avoid unused parameter error
+
+    // Runs all the benchmarks or those named on the command line
+    return RunBenchmarksTCose(argv+1);
+}
@@ -0,0 +1,308 @@
+/*********************************************************************
+* Filename:   sha512.c
+* Details:    Implementation of the SHA-384 and SHA-512 hashing
+              algorithms, following the structure of sha256.c.
+              Algorithm specification can be found here:
+               * https://csrc.nist.gov/publications/detail/fips/180/4/final
+
+              The message schedule, the expansion of each 128-byte
+              block into 80 words, doesn't depend on the hash state,
+              so it can be computed for several blocks at once. On
+              x86-64 CPUs that have AVX2, the schedules of four blocks
+              are computed together, one block per 64-bit lane. The
+              rounds are then run on each block in turn with ordinary
+              64-bit instructions. The CPU is checked at run time, so
+              the same binary works on CPUs without AVX2. Define
+              SHA512_DISABLE_AVX2 to leave the AVX2 code out.
+*********************************************************************/
+
+/*************************** HEADER FILES ***************************/
+#include <string.h>
+#include "sha512.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && \
+    !defined(SHA512_DISABLE_AVX2)
+#define SHA512_HAVE_AVX2
+#include <immintrin.h>
+#endif
+
+/****************************** MACROS ******************************/
+#define ROTRIGHT(a,b) (((a) >> (b)) | ((a) << (64-(b))))
+
+#define CH(x,y,z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x,y,z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define EP0(x) (ROTRIGHT(x,28) ^ ROTRIGHT(x,34) ^ ROTRIGHT(x,39))
+#define EP1(x) (ROTRIGHT(x,14) ^ ROTRIGHT(x,18) ^ ROTRIGHT(x,41))
+#define SIG0(x) (ROTRIGHT(x,1) ^ ROTRIGHT(x,8) ^ ((x) >> 7))
+#define SIG1(x) (ROTRIGHT(x,19) ^ ROTRIGHT(x,61) ^ ((x) >> 6))
+
+// Blocks whose message schedules are computed together with AVX2
+#define SHA512_LANES 4
+
+/**************************** VARIABLES *****************************/
+static const uint64_t k[80] = {
+	0x428a2f98d728ae22ULL,0x7137449123ef65cdULL,0xb5c0fbcfec4d3b2fULL,0xe9b5dba58189dbbcULL,
+	0x3956c25bf348b538ULL,0x59f111f1b605d019ULL,0x923f82a4af194f9bULL,0xab1c5ed5da6d8118ULL,
+	0xd807aa98a3030242ULL,0x12835b0145706fbeULL,0x243185be4ee4b28cULL,0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL,0x80deb1fe3b1696b1ULL,0x9bdc06a725c71235ULL,0xc19bf174cf692694ULL,
+	0xe49b69c19ef14ad2ULL,0xefbe4786384f25e3ULL,0x0fc19dc68b8cd5b5ULL,0x240ca1cc77ac9c65ULL,
+	0x2de92c6f592b0275ULL,0x4a7484aa6ea6e483ULL,0x5cb0a9dcbd41fbd4ULL,0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL,0xa831c66d2db43210ULL,0xb00327c898fb213fULL,0xbf597fc7beef0ee4ULL,
+	0xc6e00bf33da88fc2ULL,0xd5a79147930aa725ULL,0x06ca6351e003826fULL,0x142929670a0e6e70ULL,
+	0x27b70a8546d22ffcULL,0x2e1b21385c26c926ULL,0x4d2c6dfc5ac42aedULL,0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL,0x766a0abb3c77b2a8ULL,0x81c2c92e47edaee6ULL,0x92722c851482353bULL,
+	0xa2bfe8a14cf10364ULL,0xa81a664bbc423001ULL,0xc24b8b70d0f89791ULL,0xc76c51a30654be30ULL,
+	0xd192e819d6ef5218ULL,0xd69906245565a910ULL,0xf40e35855771202aULL,0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL,0x1e376c085141ab53ULL,0x2748774cdf8eeb99ULL,0x34b0bcb5e19b48a8ULL,
+	0x391c0cb3c5c95a63ULL,0x4ed8aa4ae3418acbULL,0x5b9cca4f7763e373ULL,0x682e6ff3d6b2b8a3ULL,
+	0x748f82ee5defb2fcULL,0x78a5636f43172f60ULL,0x84c87814a1f0ab72ULL,0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL,0xa4506cebde82bde9ULL,0xbef9a3f7b2c67915ULL,0xc67178f2e372532bULL,
+	0xca273eceea26619cULL,0xd186b8c721c0c207ULL,0xeada7dd6cde0eb1eULL,0xf57d4f7fee6ed178ULL,
+	0x06f067aa72176fbaULL,0x0a637dc5a2c898a6ULL,0x113f9804bef90daeULL,0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL,0x32caab7b40c72493ULL,0x3c9ebe0a15c9bebcULL,0x431d67c49c100d4cULL,
+	0x4cc5d4becb3e42b6ULL,0x597f299cfc657e2aULL,0x5fcb6fab3ad6faecULL,0x6c44198c4a475817ULL
+};
+
+#ifdef SHA512_HAVE_AVX2
+// -1 until the CPU has been checked, then a SHA512_KERNEL_ value
+static int s_kernel = -1;
+#endif
+
+/*********************** FUNCTION DEFINITIONS ***********************/
+static uint64_t load_be64(const uint8_t *p)
+{
+	return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+	       ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+	       ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+	       ((uint64_t)p[6] << 8)  | ((uint64_t)p[7]);
+}
+
+// The 80 rounds on one block. wk[i * stride] is word i of the message
+// schedule plus k[i].
+static void sha512_rounds(uint64_t state[8], const uint64_t *wk, size_t stride)
+{
+	uint64_t a, b, c, d, e, f, g, h, t1, t2;
+	size_t i;
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+	f = state[5];
+	g = state[6];
+	h = state[7];
+
+	for (i = 0; i < 80; ++i) {
+		t1 = h + EP1(e) + CH(e,f,g) + wk[i * stride];
+		t2 = EP0(a) + MAJ(a,b,c);
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+static void sha512_transform(uint64_t state[8], const uint8_t data[])
+{
+	uint64_t m[80];
+	size_t i;
+
+	for (i = 0; i < 16; ++i)
+		m[i] = load_be64(data + 8 * i);
+	for ( ; i < 80; ++i)
+		m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
+	for (i = 0; i < 80; ++i)
+		m[i] += k[i];
+
+	sha512_rounds(state, m, 1);
+}
+
+#ifdef SHA512_HAVE_AVX2
+#define ROTRIGHT_AVX2(a,b) \
+	_mm256_or_si256(_mm256_srli_epi64((a), (b)), _mm256_slli_epi64((a), 64-(b)))
+
+// Hash the four consecutive blocks at data. Lane j of m[i] is word i
+// of block j.
+__attribute__((target("avx2")))
+static void sha512_transform4_avx2(uint64_t state[8], const uint8_t data[])
+{
+	uint64_t wk[80][SHA512_LANES] __attribute__((aligned(32)));
+	__m256i m[80];
+	__m256i r0, r1, r2, r3, t0, t1, t2, t3, s0, s1;
+	size_t i, j;
+	// Reverses the bytes of each 64-bit word
+	const __m256i bswap = _mm256_set_epi8(8,9,10,11,12,13,14,15,0,1,2,3,4,5,6,7,
+	                                      8,9,10,11,12,13,14,15,0,1,2,3,4,5,6,7);
+
+	// Load words 4i to 4i+3 of each block and transpose so each
+	// vector holds one word of all four blocks
+	for (i = 0; i < 4; ++i) {
+		r0 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(data + 0 * 128 + 32 * i)), bswap);
+		r1 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(data + 1 * 128 + 32 * i)), bswap);
+		r2 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(data + 2 * 128 + 32 * i)), bswap);
+		r3 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(data + 3 * 128 + 32 * i)), bswap);
+		t0 = _mm256_unpacklo_epi64(r0, r1);
+		t1 = _mm256_unpackhi_epi64(r0, r1);
+		t2 = _mm256_unpacklo_epi64(r2, r3);
+		t3 = _mm256_unpackhi_epi64(r2, r3);
+		m[4 * i + 0] = _mm256_permute2x128_si256(t0, t2, 0x20);
+		m[4 * i + 1] = _mm256_permute2x128_si256(t1, t3, 0x20);
+		m[4 * i + 2] = _mm256_permute2x128_si256(t0, t2, 0x31);
+		m[4 * i + 3] = _mm256_permute2x128_si256(t1, t3, 0x31);
+	}
+	for (i = 16; i < 80; ++i) {
+		s0 = _mm256_xor_si256(_mm256_xor_si256(ROTRIGHT_AVX2(m[i - 15], 1),
+		                                       ROTRIGHT_AVX2(m[i - 15], 8)),
+		                      _mm256_srli_epi64(m[i - 15], 7));
+		s1 = _mm256_xor_si256(_mm256_xor_si256(ROTRIGHT_AVX2(m[i - 2], 19),
+		                                       ROTRIGHT_AVX2(m[i - 2], 61)),
+		                      _mm256_srli_epi64(m[i - 2], 6));
+		m[i] = _mm256_add_epi64(_mm256_add_epi64(s1, m[i - 7]),
+		                        _mm256_add_epi64(s0, m[i - 16]));
+	}
+	for (i = 0; i < 80; ++i)
+		_mm256_store_si256((__m256i *)wk[i],
+		                   _mm256_add_epi64(m[i], _mm256_set1_epi64x((long long)k[i])));
+
+	for (j = 0; j < SHA512_LANES; ++j)
+		sha512_rounds(state, &wk[0][j], SHA512_LANES);
+}
+
+static int sha512_kernel(void)
+{
+	int kernel = __atomic_load_n(&s_kernel, __ATOMIC_RELAXED);
+
+	if (kernel < 0) {
+		__builtin_cpu_init();
+		kernel = __builtin_cpu_supports("avx2") ? SHA512_KERNEL_AVX2
+		                                        : SHA512_KERNEL_SCALAR;
+		__atomic_store_n(&s_kernel, kernel, __ATOMIC_RELAXED);
+	}
+	return kernel;
+}
+#endif
+
+int sha512_select_kernel(int kernel)
+{
+#ifdef SHA512_HAVE_AVX2
+	if (kernel == SHA512_KERNEL_AVX2) {
+		// Check the CPU again
+		__atomic_store_n(&s_kernel, -1, __ATOMIC_RELAXED);
+		return sha512_kernel();
+	}
+	__atomic_store_n(&s_kernel, SHA512_KERNEL_SCALAR, __ATOMIC_RELAXED);
+#else
+	(void)kernel;
+#endif
+	return SHA512_KERNEL_SCALAR;
+}
+
+void sha512_init(SHA512_CTX *ctx)
+{
+	ctx->datalen = 0;
+	ctx->digestlen = SHA512_BLOCK_SIZE;
+	ctx->bitlen = 0;
+	ctx->state[0] = 0x6a09e667f3bcc908ULL;
+	ctx->state[1] = 0xbb67ae8584caa73bULL;
+	ctx->state[2] = 0x3c6ef372fe94f82bULL;
+	ctx->state[3] = 0xa54ff53a5f1d36f1ULL;
+	ctx->state[4] = 0x510e527fade682d1ULL;
+	ctx->state[5] = 0x9b05688c2b3e6c1fULL;
+	ctx->state[6] = 0x1f83d9abfb41bd6bULL;
+	ctx->state[7] = 0x5be0cd19137e2179ULL;
+}
+
+void sha384_init(SHA512_CTX *ctx)
+{
+	ctx->datalen = 0;
+	ctx->digestlen = SHA384_BLOCK_SIZE;
+	ctx->bitlen = 0;
+	ctx->state[0] = 0xcbbb9d5dc1059ed8ULL;
+	ctx->state[1] = 0x629a292a367cd507ULL;
+	ctx->state[2] = 0x9159015a3070dd17ULL;
+	ctx->state[3] = 0x152fecd8f70e5939ULL;
+	ctx->state[4] = 0x67332667ffc00b31ULL;
+	ctx->state[5] = 0x8eb44a8768581511ULL;
+	ctx->state[6] = 0xdb0c2e0d64f98fa7ULL;
+	ctx->state[7] = 0x47b5481dbefa4fa4ULL;
+}
+
+void sha512_update(SHA512_CTX *ctx, const uint8_t data[], size_t len)
+{
+	size_t fill;
+
+	ctx->bitlen += (uint64_t)len * 8;
+
+	// Finish a block started by an earlier update
+	if (ctx->datalen > 0) {
+		fill = sizeof(ctx->data) - ctx->datalen;
+		if (len < fill) {
+			memcpy(ctx->data + ctx->datalen, data, len);
+			ctx->datalen += (uint32_t)len;
+			return;
+		}
+		memcpy(ctx->data + ctx->datalen, data, fill);
+		sha512_transform(ctx->state, ctx->data);
+		data += fill;
+		len -= fill;
+		ctx->datalen = 0;
+	}
+
+	// Whole blocks straight from the input
+#ifdef SHA512_HAVE_AVX2
+	if (len >= SHA512_LANES * 128 && sha512_kernel() == SHA512_KERNEL_AVX2) {
+		do {
+			sha512_transform4_avx2(ctx->state, data);
+			data += SHA512_LANES * 128;
+			len -= SHA512_LANES * 128;
+		} while (len >= SHA512_LANES * 128);
+	}
+#endif
+	while (len >= 128) {
+		sha512_transform(ctx->state, data);
+		data += 128;
+		len -= 128;
+	}
+
+	memcpy(ctx->data, data, len);
+	ctx->datalen = (uint32_t)len;
+}
+
+void sha512_final(SHA512_CTX *ctx, uint8_t hash[])
+{
+	uint32_t i;
+
+	i = ctx->datalen;
+
+	// Pad whatever data is left in the buffer. The length goes in
+	// the last 16 bytes.
+	ctx->data[i++] = 0x80;
+	if (i > 112) {
+		memset(ctx->data + i, 0, 128 - i);
+		sha512_transform(ctx->state, ctx->data);
+		i = 0;
+	}
+	// The high 64 bits of the 128-bit length are always zero here
+	memset(ctx->data + i, 0, 120 - i);
+	for (i = 0; i < 8; ++i)
+		ctx->data[120 + i] = (uint8_t)(ctx->bitlen >> (56 - 8 * i));
+	sha512_transform(ctx->state, ctx->data);
+
+	// Output big endian, truncated for SHA-384
+	for (i = 0; i < ctx->digestlen; ++i)
+		hash[i] = (uint8_t)(ctx->state[i / 8] >> (56 - 8 * (i % 8)));
+}
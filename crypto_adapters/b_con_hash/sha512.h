@@ -0,0 +1,44 @@
+/*********************************************************************
+* Filename:   sha512.h
+* Details:    Defines the API for the corresponding SHA-384 and SHA-512
+              implementation. It follows the API of sha256.h.
+*********************************************************************/
+
+#ifndef SHA512_H
+#define SHA512_H
+
+/*************************** HEADER FILES ***************************/
+#include <stddef.h>
+#include <stdint.h>
+
+/****************************** MACROS ******************************/
+#define SHA384_BLOCK_SIZE 48            // SHA384 outputs a 48 byte digest
+#define SHA512_BLOCK_SIZE 64            // SHA512 outputs a 64 byte digest
+
+// Kernels for sha512_select_kernel()
+#define SHA512_KERNEL_SCALAR 0
+#define SHA512_KERNEL_AVX2   1
+
+/**************************** DATA TYPES ****************************/
+typedef struct {
+	uint8_t  data[128];
+	uint32_t datalen;
+	uint32_t digestlen;             // 48 for SHA-384, 64 for SHA-512
+	uint64_t bitlen;                // Messages over 2^64 bits are not supported
+	uint64_t state[8];
+} SHA512_CTX;
+
+/*********************** FUNCTION DECLARATIONS **********************/
+void sha512_init(SHA512_CTX *ctx);
+void sha384_init(SHA512_CTX *ctx);
+void sha512_update(SHA512_CTX *ctx, const uint8_t data[], size_t len);
+// Writes ctx->digestlen bytes
+void sha512_final(SHA512_CTX *ctx, uint8_t hash[]);
+
+// The AVX2 kernel is used when the CPU has it unless this is called
+// with SHA512_KERNEL_SCALAR. Returns the kernel that will be used,
+// which is SHA512_KERNEL_SCALAR if AVX2 was asked for but is not
+// available. For testing and benchmarking.
+int sha512_select_kernel(int kernel);
+
+#endif   // SHA512_H
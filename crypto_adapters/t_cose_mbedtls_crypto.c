@@ -0,0 +1,812 @@
+/*
+ *  t_cose_mbedtls_crypto.c
+ *
+ * Copyright 2019, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+
+#include "t_cose_crypto.h" /* The interface this code implements */
+
+#include <stdlib.h> /* For malloc() and free() of restart state */
+#include <string.h> /* For memcpy() */
+
+#include "mbedtls/ecdsa.h"
+#include "mbedtls/ecp.h"
+#include "mbedtls/bignum.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/sha512.h"
+
+
+/**
+ * \file t_cose_mbedtls_crypto.c
+ *
+ * \brief Crypto Adaptation for t_cose to use Mbed TLS ECDSA and hashes
+ *        directly, without going through PSA Crypto.
+ *
+ * This connects up the abstracted crypto services defined in
+ * t_cose_crypto.h to the Mbed TLS 3.x implementation of them.
+ *
+ * The reason to use Mbed TLS directly rather than through PSA is
+ * restartable ECC. With \c MBEDTLS_ECP_RESTARTABLE enabled in the
+ * Mbed TLS configuration, an ECDSA operation can be stopped after a
+ * configured number of basic EC operations and resumed later. This
+ * is how t_cose_crypto_pub_key_sign_restartable() and
+ * t_cose_crypto_pub_key_verify_restartable() are implemented.
+ *
+ * Keys are passed either as a pointer to an \c mbedtls_ecdsa_context
+ * with \ref T_COSE_CRYPTO_LIB_MBEDTLS, or as a handle returned by
+ * t_cose_load_pubkey() for verification-only public keys.
+ *
+ * The restartable ECC in Mbed TLS uses a budget set with
+ * mbedtls_ecp_set_max_ops(). It is one process-global variable, not
+ * per thread. This sets it before each restartable call and sets it
+ * back to unlimited after. Calls without a restart context don't
+ * check the budget, so they are not affected. Two restartable
+ * operations running at once in different threads would each change
+ * the budget of the other, so restartable signing and verification
+ * must only be used from one thread.
+ */
+
+#ifndef MBEDTLS_ECP_RESTARTABLE
+#error "T_COSE_USE_MBEDTLS_CRYPTO requires MBEDTLS_ECP_RESTARTABLE in the Mbed TLS config"
+#endif
+
+/* Mbed TLS 3 made structure members private. Older versions don't
+ * have this macro. */
+#ifndef MBEDTLS_PRIVATE
+#define MBEDTLS_PRIVATE(member) member
+#endif
+
+
+/* Number of public keys t_cose_load_pubkey() can hold at once */
+#ifndef T_COSE_MBEDTLS_PUBKEY_SLOTS
+#define T_COSE_MBEDTLS_PUBKEY_SLOTS 8
+#endif
+
+
+/*
+ * Random number generator needed for ECDSA signing and for blinding.
+ * Seeded on first use.
+ */
+static mbedtls_entropy_context  entropy;
+static mbedtls_ctr_drbg_context ctr_drbg;
+static bool                     rng_is_seeded = false;
+
+static enum t_cose_err_t seed_rng(void)
+{
+    static const char personalization[] = "t_cose";
+    int               mbed_result;
+
+    if(rng_is_seeded) {
+        return T_COSE_SUCCESS;
+    }
+
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&ctr_drbg);
+    mbed_result = mbedtls_ctr_drbg_seed(&ctr_drbg,
+                                        mbedtls_entropy_func,
+                                        &entropy,
+                                        (const unsigned char *)personalization,
+                                        sizeof(personalization) - 1);
+    if(mbed_result) {
+        return T_COSE_ERR_FAIL;
+    }
+    rng_is_seeded = true;
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public keys loaded by t_cose_load_pubkey(). The handle is the slot
+ * index plus one so that zero is never a valid handle.
+ */
+static mbedtls_ecdsa_context pubkey_slots[T_COSE_MBEDTLS_PUBKEY_SLOTS];
+static bool                  pubkey_slot_used[T_COSE_MBEDTLS_PUBKEY_SLOTS];
+
+
+
+/**
+ * \brief Map a Mbed TLS error to a t_cose error for signing.
+ *
+ * \param[in] err   The Mbed TLS error code.
+ *
+ * \return The \ref t_cose_err_t.
+ */
+static enum t_cose_err_t mbedtls_err_to_t_cose_error_signing(int err)
+{
+    /* Intentionally keep to a minimum the number of errors
+     * that are mapped to save object code. */
+    return err == 0                               ? T_COSE_SUCCESS :
+           err == MBEDTLS_ERR_ECP_IN_PROGRESS     ? T_COSE_ERR_SIG_IN_PROGRESS :
+           err == MBEDTLS_ERR_ECP_VERIFY_FAILED   ? T_COSE_ERR_SIG_VERIFY :
+           err == MBEDTLS_ERR_ECP_ALLOC_FAILED    ? T_COSE_ERR_INSUFFICIENT_MEMORY :
+           err == MBEDTLS_ERR_MPI_ALLOC_FAILED    ? T_COSE_ERR_INSUFFICIENT_MEMORY :
+           err == MBEDTLS_ERR_ECP_INVALID_KEY     ? T_COSE_ERR_WRONG_TYPE_OF_KEY :
+           err == MBEDTLS_ERR_ECP_BAD_INPUT_DATA  ? T_COSE_ERR_INVALID_ARGUMENT :
+                                                    T_COSE_ERR_SIG_FAIL;
+}
+
+
+/**
+ * \brief Common checks and conversions for signing and verification key.
+ *
+ * \param[in] t_cose_key                 The key to check and convert.
+ * \param[out] return_mbed_ec_key        The Mbed TLS EC key.
+ * \param[out] return_key_size_in_bytes  Size of the key in bytes.
+ *
+ * \return Error or \ref T_COSE_SUCCESS.
+ *
+ * Figures out the number of bytes in the key rounded up. This is
+ * also the size of r and s in the signature.
+ */
+static enum t_cose_err_t
+ecdsa_key_checks(struct t_cose_key       t_cose_key,
+                 mbedtls_ecdsa_context **return_mbed_ec_key,
+                 unsigned               *return_key_size_in_bytes)
+{
+    enum t_cose_err_t      return_value;
+    mbedtls_ecdsa_context *mbed_ec_key;
+    size_t                 key_len_bits;
+
+    if(t_cose_key.crypto_lib == T_COSE_CRYPTO_LIB_MBEDTLS) {
+        mbed_ec_key = (mbedtls_ecdsa_context *)t_cose_key.k.key_ptr;
+    } else if(t_cose_key.crypto_lib == T_COSE_CRYPTO_LIB_UNIDENTIFIED) {
+        /* A handle from t_cose_load_pubkey() */
+        if(t_cose_key.k.key_handle == 0 ||
+           t_cose_key.k.key_handle > T_COSE_MBEDTLS_PUBKEY_SLOTS ||
+           !pubkey_slot_used[t_cose_key.k.key_handle - 1]) {
+            return_value = T_COSE_ERR_UNKNOWN_KEY;
+            goto Done;
+        }
+        mbed_ec_key = &pubkey_slots[t_cose_key.k.key_handle - 1];
+    } else {
+        return_value = T_COSE_ERR_INCORRECT_KEY_FOR_LIB;
+        goto Done;
+    }
+    if(mbed_ec_key == NULL) {
+        return_value = T_COSE_ERR_EMPTY_KEY;
+        goto Done;
+    }
+
+    key_len_bits = mbed_ec_key->MBEDTLS_PRIVATE(grp).pbits;
+    if(key_len_bits == 0) {
+        /* No curve was loaded into the key */
+        return_value = T_COSE_ERR_WRONG_TYPE_OF_KEY;
+        goto Done;
+    }
+
+    /* Round up per RFC 8152 section 8.1 */
+    *return_key_size_in_bytes = (unsigned)((key_len_bits + 7) / 8);
+    *return_mbed_ec_key       = mbed_ec_key;
+
+    return_value = T_COSE_SUCCESS;
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_crypto.h
+ */
+enum t_cose_err_t
+t_cose_load_pubkey(uint8_t const *p_pubkey,
+                   size_t         pubkey_size,
+                   uint32_t      *p_key_handle)
+{
+    enum t_cose_err_t      return_value;
+    mbedtls_ecp_group_id   group_id;
+    mbedtls_ecdsa_context *key;
+    unsigned               slot;
+    int                    mbed_result;
+
+    /* Uncompressed points: 0x04 || x || y */
+    switch(pubkey_size) {
+    case 1 + 2 * 32: group_id = MBEDTLS_ECP_DP_SECP256R1; break;
+#ifndef T_COSE_DISABLE_ES384
+    case 1 + 2 * 48: group_id = MBEDTLS_ECP_DP_SECP384R1; break;
+#endif
+#ifndef T_COSE_DISABLE_ES512
+    case 1 + 2 * 66: group_id = MBEDTLS_ECP_DP_SECP521R1; break;
+#endif
+    default:
+        return_value = T_COSE_ERR_WRONG_TYPE_OF_KEY;
+        goto Done;
+    }
+
+    for(slot = 0; slot < T_COSE_MBEDTLS_PUBKEY_SLOTS; slot++) {
+        if(!pubkey_slot_used[slot]) {
+            break;
+        }
+    }
+    if(slot == T_COSE_MBEDTLS_PUBKEY_SLOTS) {
+        return_value = T_COSE_ERR_INSUFFICIENT_MEMORY;
+        goto Done;
+    }
+    key = &pubkey_slots[slot];
+
+    mbedtls_ecdsa_init(key);
+    mbed_result = mbedtls_ecp_group_load(&key->MBEDTLS_PRIVATE(grp), group_id);
+    if(mbed_result == 0) {
+        mbed_result = mbedtls_ecp_point_read_binary(&key->MBEDTLS_PRIVATE(grp),
+                                                    &key->MBEDTLS_PRIVATE(Q),
+                                                    p_pubkey,
+                                                    pubkey_size);
+    }
+    if(mbed_result == 0) {
+        mbed_result = mbedtls_ecp_check_pubkey(&key->MBEDTLS_PRIVATE(grp),
+                                               &key->MBEDTLS_PRIVATE(Q));
+    }
+    if(mbed_result) {
+        mbedtls_ecdsa_free(key);
+        return_value = T_COSE_ERR_WRONG_TYPE_OF_KEY;
+        goto Done;
+    }
+
+    pubkey_slot_used[slot] = true;
+    *p_key_handle = slot + 1;
+    return_value = T_COSE_SUCCESS;
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_crypto.h
+ */
+enum t_cose_err_t
+t_cose_delete_pubkey(uint32_t *p_key_handle)
+{
+    const uint32_t handle = *p_key_handle;
+
+    if(handle == 0 ||
+       handle > T_COSE_MBEDTLS_PUBKEY_SLOTS ||
+       !pubkey_slot_used[handle - 1]) {
+        return T_COSE_ERR_UNKNOWN_KEY;
+    }
+
+    mbedtls_ecdsa_free(&pubkey_slots[handle - 1]);
+    pubkey_slot_used[handle - 1] = false;
+    *p_key_handle = 0;
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function. See t_cose_crypto.h
+ */
+enum t_cose_err_t
+t_cose_get_pubkey(uint32_t key_handle,
+                  uint8_t *p_pubkey,
+                  size_t   capacity,
+                  size_t  *p_size)
+{
+    mbedtls_ecdsa_context *key;
+    int                    mbed_result;
+
+    if(key_handle == 0 ||
+       key_handle > T_COSE_MBEDTLS_PUBKEY_SLOTS ||
+       !pubkey_slot_used[key_handle - 1]) {
+        return T_COSE_ERR_UNKNOWN_KEY;
+    }
+    key = &pubkey_slots[key_handle - 1];
+
+    mbed_result = mbedtls_ecp_point_write_binary(&key->MBEDTLS_PRIVATE(grp),
+                                                 &key->MBEDTLS_PRIVATE(Q),
+                                                 MBEDTLS_ECP_PF_UNCOMPRESSED,
+                                                 p_size,
+                                                 p_pubkey,
+                                                 capacity);
+
+    return mbed_result ? T_COSE_ERR_TOO_SMALL : T_COSE_SUCCESS;
+}
+
+
+/*
+ * See documentation in t_cose_crypto.h
+ */
+enum t_cose_err_t t_cose_crypto_sig_size(int32_t           cose_algorithm_id,
+                                         struct t_cose_key signing_key,
+                                         size_t           *sig_size)
+{
+    enum t_cose_err_t      return_value;
+    mbedtls_ecdsa_context *mbed_ec_key;
+    unsigned               key_size;
+
+    if(!t_cose_algorithm_is_ecdsa(cose_algorithm_id)) {
+        return_value = T_COSE_ERR_UNSUPPORTED_SIGNING_ALG;
+        goto Done;
+    }
+
+    return_value = ecdsa_key_checks(signing_key, &mbed_ec_key, &key_size);
+
+    /* ECDSA signatures for COSE are twice the key size */
+    *sig_size = 2*key_size;
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * The state carried between slices of a restartable operation. r and
+ * s are kept here rather than on the stack as Mbed TLS writes them at
+ * the end of the operation, which may be several calls later.
+ */
+struct mbedtls_restart_state {
+    mbedtls_ecdsa_restart_ctx ecdsa_restart;
+    mbedtls_mpi               r;
+    mbedtls_mpi               s;
+};
+
+
+/**
+ * \brief Get or make the Mbed TLS restart state.
+ *
+ * \param[in,out] restart_ctx  The t_cose restart context. May be NULL.
+ *
+ * \return Pointer to state or NULL if \c restart_ctx is NULL or out
+ *         of memory.
+ */
+static struct mbedtls_restart_state *
+get_restart_state(struct t_cose_restart_ctx *restart_ctx)
+{
+    struct mbedtls_restart_state *state;
+
+    if(restart_ctx == NULL) {
+        return NULL;
+    }
+
+    if(restart_ctx->crypto_ctx == NULL) {
+        state = malloc(sizeof(struct mbedtls_restart_state));
+        if(state == NULL) {
+            return NULL;
+        }
+        mbedtls_ecdsa_restart_init(&state->ecdsa_restart);
+        mbedtls_mpi_init(&state->r);
+        mbedtls_mpi_init(&state->s);
+        restart_ctx->crypto_ctx = state;
+    }
+
+    return (struct mbedtls_restart_state *)restart_ctx->crypto_ctx;
+}
+
+
+/*
+ * Public function. See t_cose_crypto.h
+ */
+void t_cose_crypto_restart_free(struct t_cose_restart_ctx *restart_ctx)
+{
+    struct mbedtls_restart_state *state;
+
+    state = (struct mbedtls_restart_state *)restart_ctx->crypto_ctx;
+    if(state != NULL) {
+        mbedtls_ecdsa_restart_free(&state->ecdsa_restart);
+        mbedtls_mpi_free(&state->r);
+        mbedtls_mpi_free(&state->s);
+        free(state);
+        restart_ctx->crypto_ctx = NULL;
+    }
+}
+
+
+/**
+ * \brief Sign, optionally restartable.
+ *
+ * \param[in] restart_ctx  NULL for a monolithic operation.
+ *
+ * The other parameters and return values are as
+ * t_cose_crypto_pub_key_sign().
+ */
+static enum t_cose_err_t
+ecdsa_sign(int32_t                    cose_algorithm_id,
+           struct t_cose_key          signing_key,
+           struct q_useful_buf_c      hash_to_sign,
+           struct q_useful_buf        signature_buffer,
+           struct q_useful_buf_c     *signature,
+           struct t_cose_restart_ctx *restart_ctx)
+{
+    enum t_cose_err_t             return_value;
+    mbedtls_ecdsa_context        *mbed_ec_key;
+    unsigned                      key_len;
+    struct mbedtls_restart_state *state;
+    mbedtls_ecdsa_restart_ctx    *ecdsa_restart;
+    mbedtls_mpi                   r_local;
+    mbedtls_mpi                   s_local;
+    mbedtls_mpi                  *r;
+    mbedtls_mpi                  *s;
+    int                           mbed_result;
+
+    mbedtls_mpi_init(&r_local);
+    mbedtls_mpi_init(&s_local);
+    r = &r_local;
+    s = &s_local;
+    ecdsa_restart = NULL;
+
+    if(!t_cose_algorithm_is_ecdsa(cose_algorithm_id)) {
+        return_value = T_COSE_ERR_UNSUPPORTED_SIGNING_ALG;
+        goto Done;
+    }
+
+    return_value = ecdsa_key_checks(signing_key, &mbed_ec_key, &key_len);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+
+    if(signature_buffer.len < 2 * key_len) {
+        return_value = T_COSE_ERR_SIG_BUFFER_SIZE;
+        goto Done;
+    }
+
+    return_value = seed_rng();
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+
+    if(restart_ctx != NULL) {
+        state = get_restart_state(restart_ctx);
+        if(state == NULL) {
+            return_value = T_COSE_ERR_INSUFFICIENT_MEMORY;
+            goto Done;
+        }
+        ecdsa_restart = &state->ecdsa_restart;
+        r = &state->r;
+        s = &state->s;
+        mbedtls_ecp_set_max_ops(restart_ctx->max_ops);
+    }
+
+    mbed_result = mbedtls_ecdsa_sign_restartable(&mbed_ec_key->MBEDTLS_PRIVATE(grp),
+                                                 r,
+                                                 s,
+                                                 &mbed_ec_key->MBEDTLS_PRIVATE(d),
+                                                 hash_to_sign.ptr,
+                                                 hash_to_sign.len,
+                                                 mbedtls_ctr_drbg_random,
+                                                 &ctr_drbg,
+                                                 mbedtls_ctr_drbg_random,
+                                                 &ctr_drbg,
+                                                 ecdsa_restart);
+    if(restart_ctx != NULL) {
+        mbedtls_ecp_set_max_ops(0);
+    }
+    return_value = mbedtls_err_to_t_cose_error_signing(mbed_result);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+
+    /* Serialize r and s zero-padded to the key length, RFC 8152 8.1 */
+    if(mbedtls_mpi_write_binary(r, signature_buffer.ptr, key_len) ||
+       mbedtls_mpi_write_binary(s,
+                                (uint8_t *)signature_buffer.ptr + key_len,
+                                key_len)) {
+        return_value = T_COSE_ERR_SIG_FAIL;
+        goto Done;
+    }
+    signature->ptr = signature_buffer.ptr;
+    signature->len = 2 * key_len;
+
+Done:
+    /* Keep the state only if there is more to do */
+    if(restart_ctx != NULL && return_value != T_COSE_ERR_SIG_IN_PROGRESS) {
+        t_cose_crypto_restart_free(restart_ctx);
+    }
+    mbedtls_mpi_free(&r_local);
+    mbedtls_mpi_free(&s_local);
+
+    return return_value;
+}
+
+
+/**
+ * \brief Verify, optionally restartable.
+ *
+ * \param[in] restart_ctx  NULL for a monolithic operation.
+ *
+ * The other parameters and return values are as
+ * t_cose_crypto_pub_key_verify().
+ */
+static enum t_cose_err_t
+ecdsa_verify(int32_t                    cose_algorithm_id,
+             struct t_cose_key          verification_key,
+             struct q_useful_buf_c      hash_to_verify,
+             struct q_useful_buf_c      signature,
+             struct t_cose_restart_ctx *restart_ctx)
+{
+    enum t_cose_err_t             return_value;
+    mbedtls_ecdsa_context        *mbed_ec_key;
+    unsigned                      key_len;
+    struct mbedtls_restart_state *state;
+    mbedtls_ecdsa_restart_ctx    *ecdsa_restart;
+    mbedtls_mpi                   r;
+    mbedtls_mpi                   s;
+    int                           mbed_result;
+
+    mbedtls_mpi_init(&r);
+    mbedtls_mpi_init(&s);
+    ecdsa_restart = NULL;
+
+    if(!t_cose_algorithm_is_ecdsa(cose_algorithm_id)) {
+        return_value = T_COSE_ERR_UNSUPPORTED_SIGNING_ALG;
+        goto Done;
+    }
+
+    return_value = ecdsa_key_checks(verification_key, &mbed_ec_key, &key_len);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+
+    if(signature.len != 2 * key_len) {
+        return_value = T_COSE_ERR_SIG_VERIFY;
+        goto Done;
+    }
+
+    /* r and s are inputs so they are re-read on every slice */
+    if(mbedtls_mpi_read_binary(&r, signature.ptr, key_len) ||
+       mbedtls_mpi_read_binary(&s,
+                               (const uint8_t *)signature.ptr + key_len,
+                               key_len)) {
+        return_value = T_COSE_ERR_INSUFFICIENT_MEMORY;
+        goto Done;
+    }
+
+    if(restart_ctx != NULL) {
+        state = get_restart_state(restart_ctx);
+        if(state == NULL) {
+            return_value = T_COSE_ERR_INSUFFICIENT_MEMORY;
+            goto Done;
+        }
+        ecdsa_restart = &state->ecdsa_restart;
+        mbedtls_ecp_set_max_ops(restart_ctx->max_ops);
+    }
+
+    mbed_result = mbedtls_ecdsa_verify_restartable(&mbed_ec_key->MBEDTLS_PRIVATE(grp),
+                                                   hash_to_verify.ptr,
+                                                   hash_to_verify.len,
+                                                   &mbed_ec_key->MBEDTLS_PRIVATE(Q),
+                                                   &r,
+                                                   &s,
+                                                   ecdsa_restart);
+    if(restart_ctx != NULL) {
+        mbedtls_ecp_set_max_ops(0);
+    }
+    return_value = mbedtls_err_to_t_cose_error_signing(mbed_result);
+
+Done:
+    if(restart_ctx != NULL && return_value != T_COSE_ERR_SIG_IN_PROGRESS) {
+        t_cose_crypto_restart_free(restart_ctx);
+    }
+    mbedtls_mpi_free(&r);
+    mbedtls_mpi_free(&s);
+
+    return return_value;
+}
+
+
+/*
+ * See documentation in t_cose_crypto.h
+ */
+enum t_cose_err_t
+t_cose_crypto_pub_key_sign(int32_t                cose_algorithm_id,
+                           struct t_cose_key      signing_key,
+                           struct q_useful_buf_c  hash_to_sign,
+                           struct q_useful_buf    signature_buffer,
+                           struct q_useful_buf_c *signature)
+{
+    return ecdsa_sign(cose_algorithm_id,
+                      signing_key,
+                      hash_to_sign,
+                      signature_buffer,
+                      signature,
+                      NULL);
+}
+
+
+/*
+ * See documentation in t_cose_crypto.h
+ */
+enum t_cose_err_t
+t_cose_crypto_pub_key_verify(int32_t               cose_algorithm_id,
+                             struct t_cose_key     verification_key,
+                             struct q_useful_buf_c kid,
+                             struct q_useful_buf_c hash_to_verify,
+                             struct q_useful_buf_c signature)
+{
+    /* This implementation doesn't use any key store with the ability
+     * to look up a key based on kid. */
+    (void)kid;
+
+    return ecdsa_verify(cose_algorithm_id,
+                        verification_key,
+                        hash_to_verify,
+                        signature,
+                        NULL);
+}
+
+
+#ifdef T_COSE_ENABLE_RESTARTABLE
+/*
+ * See documentation in t_cose_crypto.h
+ */
+enum t_cose_err_t
+t_cose_crypto_pub_key_sign_restartable(int32_t                    cose_algorithm_id,
+                                       struct t_cose_key          signing_key,
+                                       struct q_useful_buf_c      hash_to_sign,
+                                       struct q_useful_buf        signature_buffer,
+                                       struct q_useful_buf_c     *signature,
+                                       struct t_cose_restart_ctx *restart_ctx)
+{
+    return ecdsa_sign(cose_algorithm_id,
+                      signing_key,
+                      hash_to_sign,
+                      signature_buffer,
+                      signature,
+                      restart_ctx);
+}
+
+
+/*
+ * See documentation in t_cose_crypto.h
+ */
+enum t_cose_err_t
+t_cose_crypto_pub_key_verify_restartable(int32_t                    cose_algorithm_id,
+                                         struct t_cose_key          verification_key,
+                                         struct q_useful_buf_c      kid,
+                                         struct q_useful_buf_c      hash_to_verify,
+                                         struct q_useful_buf_c      signature,
+                                         struct t_cose_restart_ctx *restart_ctx)
+{
+    (void)kid;
+
+    return ecdsa_verify(cose_algorithm_id,
+                        verification_key,
+                        hash_to_verify,
+                        signature,
+                        restart_ctx);
+}
+#endif /* T_COSE_ENABLE_RESTARTABLE */
+
+
+
+
+/*
+ * See documentation in t_cose_crypto.h
+ */
+enum t_cose_err_t t_cose_crypto_hash_start(struct t_cose_crypto_hash *hash_ctx,
+                                           int32_t cose_hash_alg_id)
+{
+    int mbed_result;
+
+    switch(cose_hash_alg_id) {
+
+    case COSE_ALGORITHM_SHA_256:
+        mbedtls_sha256_init(&hash_ctx->ctx.sha_256);
+        mbed_result = mbedtls_sha256_starts(&hash_ctx->ctx.sha_256, 0);
+        break;
+
+#ifndef T_COSE_DISABLE_ES384
+    case COSE_ALGORITHM_SHA_384:
+        mbedtls_sha512_init(&hash_ctx->ctx.sha_512);
+        mbed_result = mbedtls_sha512_starts(&hash_ctx->ctx.sha_512, 1);
+        break;
+#endif
+
+#ifndef T_COSE_DISABLE_ES512
+    case COSE_ALGORITHM_SHA_512:
+        mbedtls_sha512_init(&hash_ctx->ctx.sha_512);
+        mbed_result = mbedtls_sha512_starts(&hash_ctx->ctx.sha_512, 0);
+        break;
+#endif
+
+    default:
+        return T_COSE_ERR_UNSUPPORTED_HASH;
+    }
+    hash_ctx->cose_hash_alg_id = cose_hash_alg_id;
+    hash_ctx->update_error     = 0; /* 0 is success in Mbed TLS */
+
+    return mbed_result ? T_COSE_ERR_HASH_GENERAL_FAIL : T_COSE_SUCCESS;
+}
+
+
+/*
+ * See documentation in t_cose_crypto.h
+ */
+void t_cose_crypto_hash_update(struct t_cose_crypto_hash *hash_ctx,
+                               struct q_useful_buf_c data_to_hash)
+{
+    if(hash_ctx->update_error || data_to_hash.ptr == NULL) {
+        /* Previous error or size calculation mode */
+        return;
+    }
+
+    switch(hash_ctx->cose_hash_alg_id) {
+
+    case COSE_ALGORITHM_SHA_256:
+        hash_ctx->update_error = mbedtls_sha256_update(&hash_ctx->ctx.sha_256,
+                                                       data_to_hash.ptr,
+                                                       data_to_hash.len);
+        break;
+
+#if !defined T_COSE_DISABLE_ES512 || !defined T_COSE_DISABLE_ES384
+    default:
+        /* SHA-384 and SHA-512 */
+        hash_ctx->update_error = mbedtls_sha512_update(&hash_ctx->ctx.sha_512,
+                                                       data_to_hash.ptr,
+                                                       data_to_hash.len);
+        break;
+#endif
+    }
+}
+
+
+/*
+ * See documentation in t_cose_crypto.h
+ */
+enum t_cose_err_t
+t_cose_crypto_hash_finish(struct t_cose_crypto_hash *hash_ctx,
+                          struct q_useful_buf        buffer_to_hold_result,
+                          struct q_useful_buf_c     *hash_result)
+{
+    size_t hash_result_len;
+    int    mbed_result;
+
+    if(hash_ctx->update_error) {
+        return T_COSE_ERR_HASH_GENERAL_FAIL;
+    }
+
+    switch(hash_ctx->cose_hash_alg_id) {
+
+    case COSE_ALGORITHM_SHA_256:
+        hash_result_len = T_COSE_CRYPTO_SHA256_SIZE;
+        break;
+
+#ifndef T_COSE_DISABLE_ES384
+    case COSE_ALGORITHM_SHA_384:
+        hash_result_len = T_COSE_CRYPTO_SHA384_SIZE;
+        break;
+#endif
+
+#ifndef T_COSE_DISABLE_ES512
+    case COSE_ALGORITHM_SHA_512:
+        hash_result_len = T_COSE_CRYPTO_SHA512_SIZE;
+        break;
+#endif
+
+    default:
+        return T_COSE_ERR_UNSUPPORTED_HASH;
+    }
+
+    if(buffer_to_hold_result.len < hash_result_len) {
+        return T_COSE_ERR_HASH_BUFFER_SIZE;
+    }
+
+    /* SHA-384 output is written into a 64 byte buffer by Mbed TLS */
+    if(hash_ctx->cose_hash_alg_id == COSE_ALGORITHM_SHA_256) {
+        mbed_result = mbedtls_sha256_finish(&hash_ctx->ctx.sha_256,
+                                            buffer_to_hold_result.ptr);
+        mbedtls_sha256_free(&hash_ctx->ctx.sha_256);
+    } else {
+#if !defined T_COSE_DISABLE_ES512 || !defined T_COSE_DISABLE_ES384
+        uint8_t sha_512_out[T_COSE_CRYPTO_SHA512_SIZE];
+
+        mbed_result = mbedtls_sha512_finish(&hash_ctx->ctx.sha_512, sha_512_out);
+        mbedtls_sha512_free(&hash_ctx->ctx.sha_512);
+        memcpy(buffer_to_hold_result.ptr, sha_512_out, hash_result_len);
+#else
+        mbed_result = -1;
+#endif
+    }
+
+    *hash_result = (struct q_useful_buf_c){buffer_to_hold_result.ptr,
+                                           hash_result_len};
+
+    return mbed_result ? T_COSE_ERR_HASH_GENERAL_FAIL : T_COSE_SUCCESS;
+}
@@ -15,6 +15,17 @@
 
 #include <openssl/ecdsa.h>
 #include <openssl/err.h>
+#ifdef T_COSE_ENABLE_KEY_RECOVERY
+#include <openssl/obj_mac.h>
+#endif
+#if defined(T_COSE_ENABLE_ENCRYPT) || defined(T_COSE_ENABLE_OSCORE)
+#include <limits.h>
+#include <openssl/crypto.h>
+#include <openssl/ecdh.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/rand.h>
+#endif
 
 #include <openssl/sha.h>
 
@@ -448,6 +459,864 @@ Done:
 
 
 
+#if defined(T_COSE_ENABLE_KEY_RECOVERY) || defined(T_COSE_ENABLE_ENCRYPT) || \
+    defined(T_COSE_ENABLE_OSCORE)
+/**
+ * \brief Write an EC point in uncompressed SEC1 form.
+ *
+ * \param[in] group          The curve.
+ * \param[in] point          The point.
+ * \param[in] point_buffer   Buffer to write to.
+ * \param[out] public_point  The encoded point.
+ * \param[in] bn_ctx         OpenSSL big number scratch or \c NULL.
+ */
+static enum t_cose_err_t
+encode_point(const EC_GROUP       *group,
+             const EC_POINT       *point,
+             struct q_useful_buf   point_buffer,
+             struct q_useful_buf_c *public_point,
+             BN_CTX               *bn_ctx)
+{
+    size_t point_len;
+
+    point_len = EC_POINT_point2oct(group,
+                                   point,
+                                   POINT_CONVERSION_UNCOMPRESSED,
+                                   NULL,
+                                   0,
+                                   bn_ctx);
+    if(point_len == 0) {
+        return T_COSE_ERR_SIG_FAIL;
+    }
+    if(point_len > point_buffer.len) {
+        return T_COSE_ERR_SIG_BUFFER_SIZE;
+    }
+
+    public_point->len = EC_POINT_point2oct(group,
+                                           point,
+                                           POINT_CONVERSION_UNCOMPRESSED,
+                                           point_buffer.ptr,
+                                           point_buffer.len,
+                                           bn_ctx);
+    public_point->ptr = point_buffer.ptr;
+    if(public_point->len != point_len) {
+        return T_COSE_ERR_SIG_FAIL;
+    }
+
+    return T_COSE_SUCCESS;
+}
+#endif /* T_COSE_ENABLE_KEY_RECOVERY || T_COSE_ENABLE_ENCRYPT || T_COSE_ENABLE_OSCORE */
+
+
+#ifdef T_COSE_ENABLE_KEY_RECOVERY
+/*
+ * See documentation in t_cose_crypto.h
+ */
+enum t_cose_err_t
+t_cose_crypto_export_public_point(struct t_cose_key      key,
+                                  struct q_useful_buf    point_buffer,
+                                  struct q_useful_buf_c *public_point)
+{
+    enum t_cose_err_t  return_value;
+    EC_KEY            *ossl_ec_key;
+    unsigned           key_len;
+    const EC_POINT    *ossl_point;
+
+    return_value = ecdsa_key_checks(key, &ossl_ec_key, &key_len);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+
+    ossl_point = EC_KEY_get0_public_key(ossl_ec_key);
+    if(ossl_point == NULL) {
+        return_value = T_COSE_ERR_WRONG_TYPE_OF_KEY;
+        goto Done;
+    }
+
+    return_value = encode_point(EC_KEY_get0_group(ossl_ec_key),
+                                ossl_point,
+                                point_buffer,
+                                public_point,
+                                NULL);
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * See documentation in t_cose_crypto.h
+ *
+ * With n the order of the curve, G the generator and e the hash
+ * truncated to the bit length of n, the public key is
+ *
+ *     Q = r^-1 * (s * R - e * G)
+ *
+ * where R is the point whose x coordinate is r and y has the parity
+ * given by recovery_id. This is computed as u1 * G + u2 * R with
+ * u1 = -e * r^-1 and u2 = s * r^-1 modulo n, which is one
+ * EC_POINT_mul().
+ */
+enum t_cose_err_t
+t_cose_crypto_pub_key_recover(int32_t                cose_algorithm_id,
+                              struct q_useful_buf_c  hash_to_verify,
+                              struct q_useful_buf_c  signature,
+                              unsigned               recovery_id,
+                              struct q_useful_buf    point_buffer,
+                              struct q_useful_buf_c *public_point)
+{
+    enum t_cose_err_t  return_value;
+    int                curve_nid;
+    EC_GROUP          *group;
+    BN_CTX            *bn_ctx;
+    EC_POINT          *r_point;
+    EC_POINT          *q_point;
+    const BIGNUM      *order;
+    BIGNUM            *r;
+    BIGNUM            *s;
+    BIGNUM            *e;
+    BIGNUM            *r_inverse;
+    BIGNUM            *u1;
+    BIGNUM            *u2;
+    int                order_bits;
+    unsigned           key_len;
+
+    group   = NULL;
+    bn_ctx  = NULL;
+    r_point = NULL;
+    q_point = NULL;
+
+    switch(cose_algorithm_id) {
+    case COSE_ALGORITHM_ES256:
+        curve_nid = NID_X9_62_prime256v1;
+        break;
+#ifndef T_COSE_DISABLE_ES384
+    case COSE_ALGORITHM_ES384:
+        curve_nid = NID_secp384r1;
+        break;
+#endif
+#ifndef T_COSE_DISABLE_ES512
+    case COSE_ALGORITHM_ES512:
+        curve_nid = NID_secp521r1;
+        break;
+#endif
+    default:
+        return_value = T_COSE_ERR_UNSUPPORTED_SIGNING_ALG;
+        goto Done;
+    }
+
+    group  = EC_GROUP_new_by_curve_name(curve_nid);
+    bn_ctx = BN_CTX_new();
+    if(group == NULL || bn_ctx == NULL) {
+        return_value = T_COSE_ERR_INSUFFICIENT_MEMORY;
+        goto Done;
+    }
+    r_point = EC_POINT_new(group);
+    q_point = EC_POINT_new(group);
+    BN_CTX_start(bn_ctx);
+    r         = BN_CTX_get(bn_ctx);
+    s         = BN_CTX_get(bn_ctx);
+    e         = BN_CTX_get(bn_ctx);
+    r_inverse = BN_CTX_get(bn_ctx);
+    u1        = BN_CTX_get(bn_ctx);
+    u2        = BN_CTX_get(bn_ctx);
+    if(r_point == NULL || q_point == NULL || u2 == NULL) {
+        return_value = T_COSE_ERR_INSUFFICIENT_MEMORY;
+        goto EndBnCtx;
+    }
+
+    /* -- r and s must each be the size of the curve and in [1, n-1] -- */
+    key_len = ((unsigned)EC_GROUP_get_degree(group) + 7) / 8;
+    if(signature.len != 2 * key_len) {
+        return_value = T_COSE_ERR_SIG_VERIFY;
+        goto EndBnCtx;
+    }
+    order = EC_GROUP_get0_order(group);
+    if(BN_bin2bn(signature.ptr, (int)key_len, r) == NULL ||
+       BN_bin2bn((const uint8_t *)signature.ptr + key_len, (int)key_len, s) == NULL) {
+        return_value = T_COSE_ERR_INSUFFICIENT_MEMORY;
+        goto EndBnCtx;
+    }
+    if(BN_is_zero(r) || BN_cmp(r, order) >= 0 ||
+       BN_is_zero(s) || BN_cmp(s, order) >= 0) {
+        return_value = T_COSE_ERR_SIG_VERIFY;
+        goto EndBnCtx;
+    }
+
+    /* -- R from r and the parity of y -- */
+    if(EC_POINT_set_compressed_coordinates(group,
+                                           r_point,
+                                           r,
+                                           (int)(recovery_id & 1),
+                                           bn_ctx) != 1) {
+        /* r is not the x coordinate of any point on the curve */
+        ERR_clear_error();
+        return_value = T_COSE_ERR_SIG_VERIFY;
+        goto EndBnCtx;
+    }
+
+    /* -- e is the leftmost bits of the hash, as many as in n -- */
+    if(BN_bin2bn(hash_to_verify.ptr, (int)hash_to_verify.len, e) == NULL) {
+        return_value = T_COSE_ERR_INSUFFICIENT_MEMORY;
+        goto EndBnCtx;
+    }
+    order_bits = BN_num_bits(order);
+    if((int)hash_to_verify.len * 8 > order_bits) {
+        BN_rshift(e, e, (int)hash_to_verify.len * 8 - order_bits);
+    }
+
+    /* -- u1 = -e / r and u2 = s / r modulo n -- */
+    if(BN_mod_inverse(r_inverse, r, order, bn_ctx) == NULL ||
+       !BN_mod_mul(u1, e, r_inverse, order, bn_ctx) ||
+       !BN_mod_sub(u1, order, u1, order, bn_ctx) ||
+       !BN_mod_mul(u2, s, r_inverse, order, bn_ctx)) {
+        return_value = T_COSE_ERR_SIG_FAIL;
+        goto EndBnCtx;
+    }
+
+    /* -- Q = u1 * G + u2 * R -- */
+    if(EC_POINT_mul(group, q_point, u1, r_point, u2, bn_ctx) != 1) {
+        return_value = T_COSE_ERR_SIG_FAIL;
+        goto EndBnCtx;
+    }
+    if(EC_POINT_is_at_infinity(group, q_point)) {
+        return_value = T_COSE_ERR_SIG_VERIFY;
+        goto EndBnCtx;
+    }
+
+    return_value = encode_point(group, q_point, point_buffer, public_point, bn_ctx);
+
+EndBnCtx:
+    BN_CTX_end(bn_ctx);
+
+Done:
+    /* These all check for NULL before they free */
+    EC_POINT_free(q_point);
+    EC_POINT_free(r_point);
+    BN_CTX_free(bn_ctx);
+    EC_GROUP_free(group);
+
+    return return_value;
+}
+#endif /* T_COSE_ENABLE_KEY_RECOVERY */
+
+
+#if defined(T_COSE_ENABLE_ENCRYPT) || defined(T_COSE_ENABLE_OSCORE)
+/*
+ * See documentation in t_cose_crypto.h
+ */
+enum t_cose_err_t
+t_cose_crypto_get_random(struct q_useful_buf buffer)
+{
+    if(buffer.len > INT_MAX) {
+        return T_COSE_ERR_INVALID_ARGUMENT;
+    }
+    if(RAND_bytes(buffer.ptr, (int)buffer.len) != 1) {
+        return T_COSE_ERR_FAIL;
+    }
+    return T_COSE_SUCCESS;
+}
+
+
+/**
+ * The OpenSSL cipher and sizes of a COSE AEAD algorithm.
+ */
+struct aead_alg {
+    const EVP_CIPHER *cipher;
+    size_t            nonce_len;
+    size_t            tag_len;
+    /* CCM needs the tag length before the key and the text length
+     * before the AAD, and checks the tag in the update. */
+    bool              ccm;
+};
+
+
+/**
+ * \brief Map a COSE AEAD algorithm ID to an OpenSSL cipher and sizes.
+ *
+ * \param[in] cose_algorithm_id  The COSE algorithm ID.
+ * \param[out] aead              The cipher and sizes.
+ *
+ * \return \c false if the algorithm is not supported.
+ */
+static bool
+aead_alg_lookup(int32_t cose_algorithm_id, struct aead_alg *aead)
+{
+    /* COSE uses 96-bit nonces and 128-bit tags with AES-GCM */
+    aead->nonce_len = 12;
+    aead->tag_len   = 16;
+    aead->ccm       = false;
+
+    switch(cose_algorithm_id) {
+    case COSE_ALGORITHM_A128GCM: aead->cipher = EVP_aes_128_gcm(); break;
+    case COSE_ALGORITHM_A192GCM: aead->cipher = EVP_aes_192_gcm(); break;
+    case COSE_ALGORITHM_A256GCM: aead->cipher = EVP_aes_256_gcm(); break;
+    case COSE_ALGORITHM_AES_CCM_16_64_128:
+        aead->cipher    = EVP_aes_128_ccm();
+        aead->nonce_len = 13;
+        aead->tag_len   = 8;
+        aead->ccm       = true;
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * \brief Start an AEAD operation with key, nonce and AAD.
+ *
+ * \param[in] aead         The cipher and sizes.
+ * \param[in] key          The key.
+ * \param[in] nonce        The nonce.
+ * \param[in] aad          The additional authenticated data.
+ * \param[in] text_len     Length of the plaintext.
+ * \param[in] tag          The tag to check when decrypting, else \c NULL.
+ * \param[out] return_ctx  The OpenSSL cipher context to free.
+ */
+static enum t_cose_err_t
+aead_start(const struct aead_alg  *aead,
+           struct q_useful_buf_c   key,
+           struct q_useful_buf_c   nonce,
+           struct q_useful_buf_c   aad,
+           size_t                  text_len,
+           const uint8_t          *tag,
+           EVP_CIPHER_CTX        **return_ctx)
+{
+    enum t_cose_err_t  return_value;
+    EVP_CIPHER_CTX    *ctx;
+    int                encrypt;
+    int                out_len;
+
+    *return_ctx = NULL;
+    encrypt     = tag == NULL;
+
+    if(key.len != (size_t)EVP_CIPHER_key_length(aead->cipher) ||
+       nonce.len != aead->nonce_len) {
+        return_value = T_COSE_ERR_WRONG_TYPE_OF_KEY;
+        goto Done;
+    }
+    if(aad.len > INT_MAX || text_len > INT_MAX - aead->tag_len) {
+        return_value = T_COSE_ERR_INVALID_ARGUMENT;
+        goto Done;
+    }
+
+    ctx = EVP_CIPHER_CTX_new();
+    if(ctx == NULL) {
+        return_value = T_COSE_ERR_INSUFFICIENT_MEMORY;
+        goto Done;
+    }
+    *return_ctx = ctx;
+
+    /* Casts are safe because of the length checks above. The tag is
+     * only read by OpenSSL when decrypting. */
+    if(EVP_CipherInit_ex(ctx, aead->cipher, NULL, NULL, NULL, encrypt) != 1 ||
+       EVP_CIPHER_CTX_ctrl(ctx,
+                           EVP_CTRL_AEAD_SET_IVLEN,
+                           (int)aead->nonce_len,
+                           NULL) != 1 ||
+       (aead->ccm &&
+        EVP_CIPHER_CTX_ctrl(ctx,
+                            EVP_CTRL_AEAD_SET_TAG,
+                            (int)aead->tag_len,
+                            (void *)(uintptr_t)tag) != 1) ||
+       EVP_CipherInit_ex(ctx, NULL, NULL, key.ptr, nonce.ptr, encrypt) != 1 ||
+       (!aead->ccm && !encrypt &&
+        EVP_CIPHER_CTX_ctrl(ctx,
+                            EVP_CTRL_AEAD_SET_TAG,
+                            (int)aead->tag_len,
+                            (void *)(uintptr_t)tag) != 1) ||
+       (aead->ccm &&
+        EVP_CipherUpdate(ctx, NULL, &out_len, NULL, (int)text_len) != 1) ||
+       (aad.len > 0 &&
+        EVP_CipherUpdate(ctx, NULL, &out_len, aad.ptr, (int)aad.len) != 1)) {
+        return_value = T_COSE_ERR_FAIL;
+        goto Done;
+    }
+
+    return_value = T_COSE_SUCCESS;
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * See documentation in t_cose_crypto.h
+ */
+enum t_cose_err_t
+t_cose_crypto_aead_encrypt(int32_t                cose_algorithm_id,
+                           struct q_useful_buf_c  key,
+                           struct q_useful_buf_c  nonce,
+                           struct q_useful_buf_c  aad,
+                           struct q_useful_buf_c  plaintext,
+                           struct q_useful_buf    ciphertext_buffer,
+                           struct q_useful_buf_c *ciphertext)
+{
+    enum t_cose_err_t  return_value;
+    struct aead_alg    aead;
+    EVP_CIPHER_CTX    *ctx = NULL;
+    int                update_len;
+    int                final_len;
+    uint8_t           *out;
+
+    if(!aead_alg_lookup(cose_algorithm_id, &aead)) {
+        return_value = T_COSE_ERR_UNSUPPORTED_ENCRYPTION_ALG;
+        goto Done;
+    }
+    return_value = aead_start(&aead, key, nonce, aad, plaintext.len, NULL, &ctx);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    if(ciphertext_buffer.len < plaintext.len + aead.tag_len) {
+        return_value = T_COSE_ERR_TOO_SMALL;
+        goto Done;
+    }
+    out = ciphertext_buffer.ptr;
+
+    if(EVP_EncryptUpdate(ctx,
+                         out,
+                         &update_len,
+                         plaintext.ptr,
+                         (int)plaintext.len) != 1 ||
+       EVP_EncryptFinal_ex(ctx, out + update_len, &final_len) != 1 ||
+       (size_t)(update_len + final_len) != plaintext.len ||
+       EVP_CIPHER_CTX_ctrl(ctx,
+                           EVP_CTRL_AEAD_GET_TAG,
+                           (int)aead.tag_len,
+                           out + plaintext.len) != 1) {
+        return_value = T_COSE_ERR_FAIL;
+        goto Done;
+    }
+
+    ciphertext->ptr = out;
+    ciphertext->len = plaintext.len + aead.tag_len;
+
+Done:
+    EVP_CIPHER_CTX_free(ctx);
+    return return_value;
+}
+
+
+/*
+ * See documentation in t_cose_crypto.h
+ */
+enum t_cose_err_t
+t_cose_crypto_aead_decrypt(int32_t                cose_algorithm_id,
+                           struct q_useful_buf_c  key,
+                           struct q_useful_buf_c  nonce,
+                           struct q_useful_buf_c  aad,
+                           struct q_useful_buf_c  ciphertext,
+                           struct q_useful_buf    plaintext_buffer,
+                           struct q_useful_buf_c *plaintext)
+{
+    enum t_cose_err_t  return_value;
+    struct aead_alg    aead;
+    EVP_CIPHER_CTX    *ctx = NULL;
+    size_t             text_len;
+    int                update_len;
+    int                final_len;
+    uint8_t           *out;
+
+    if(!aead_alg_lookup(cose_algorithm_id, &aead)) {
+        return_value = T_COSE_ERR_UNSUPPORTED_ENCRYPTION_ALG;
+        goto Done;
+    }
+    if(ciphertext.len < aead.tag_len) {
+        return_value = T_COSE_ERR_DECRYPT_FAIL;
+        goto Done;
+    }
+    text_len = ciphertext.len - aead.tag_len;
+    if(plaintext_buffer.len < text_len) {
+        return_value = T_COSE_ERR_TOO_SMALL;
+        goto Done;
+    }
+    return_value = aead_start(&aead,
+                              key,
+                              nonce,
+                              aad,
+                              text_len,
+                              (const uint8_t *)ciphertext.ptr + text_len,
+                              &ctx);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    out = plaintext_buffer.ptr;
+
+    /* CCM checks the tag in the update, GCM in the final. The
+     * plaintext is written to the caller's buffer before the tag is
+     * checked, so it is wiped if the check fails. */
+    if(EVP_DecryptUpdate(ctx,
+                         out,
+                         &update_len,
+                         ciphertext.ptr,
+                         (int)text_len) != 1) {
+        OPENSSL_cleanse(out, text_len);
+        return_value = aead.ccm ? T_COSE_ERR_DECRYPT_FAIL : T_COSE_ERR_FAIL;
+        goto Done;
+    }
+    if(!aead.ccm) {
+        if(EVP_DecryptFinal_ex(ctx, out + update_len, &final_len) != 1) {
+            OPENSSL_cleanse(out, text_len);
+            return_value = T_COSE_ERR_DECRYPT_FAIL;
+            goto Done;
+        }
+    }
+
+    plaintext->ptr = out;
+    plaintext->len = text_len;
+
+Done:
+    EVP_CIPHER_CTX_free(ctx);
+    return return_value;
+}
+
+
+/**
+ * \brief Get the OpenSSL key out of a \ref t_cose_key for ECDH.
+ *
+ * \param[in] t_cose_key         The key.
+ * \param[out] return_ossl_key   The OpenSSL key.
+ *
+ * Unlike ecdsa_key_checks() this doesn't run \c EC_KEY_check_key().
+ * That is a full scalar multiplication, as costly as the ECDH, and
+ * keys used for encryption are checked once when they are loaded.
+ */
+static enum t_cose_err_t
+ecdh_key(struct t_cose_key t_cose_key, EC_KEY **return_ossl_key)
+{
+    if(t_cose_key.crypto_lib != T_COSE_CRYPTO_LIB_OPENSSL) {
+        return T_COSE_ERR_INCORRECT_KEY_FOR_LIB;
+    }
+    if(t_cose_key.k.key_ptr == NULL) {
+        return T_COSE_ERR_EMPTY_KEY;
+    }
+    *return_ossl_key = (EC_KEY *)t_cose_key.k.key_ptr;
+    if(EC_KEY_get0_group(*return_ossl_key) == NULL) {
+        return T_COSE_ERR_WRONG_TYPE_OF_KEY;
+    }
+    return T_COSE_SUCCESS;
+}
+
+
+/**
+ * \brief Compute the ECDH shared secret.
+ *
+ * \param[in] peer_point      The public point of the other party.
+ * \param[in] private_key     The key with the private scalar.
+ * \param[in] secret_buffer   Buffer for the shared secret.
+ * \param[out] shared_secret  The x coordinate of the shared point.
+ */
+static enum t_cose_err_t
+compute_shared_secret(const EC_POINT        *peer_point,
+                      const EC_KEY          *private_key,
+                      struct q_useful_buf    secret_buffer,
+                      struct q_useful_buf_c *shared_secret)
+{
+    int    degree;
+    size_t secret_len;
+    int    ossl_result;
+
+    degree = EC_GROUP_get_degree(EC_KEY_get0_group(private_key));
+    if(degree <= 0) {
+        return T_COSE_ERR_WRONG_TYPE_OF_KEY;
+    }
+    secret_len = ((size_t)degree + 7) / 8;
+    if(secret_len > secret_buffer.len) {
+        return T_COSE_ERR_SIG_BUFFER_SIZE;
+    }
+
+    ossl_result = ECDH_compute_key(secret_buffer.ptr,
+                                   secret_len,
+                                   peer_point,
+                                   private_key,
+                                   NULL);
+    if(ossl_result <= 0 || (size_t)ossl_result != secret_len) {
+        return T_COSE_ERR_FAIL;
+    }
+
+    shared_secret->ptr = secret_buffer.ptr;
+    shared_secret->len = secret_len;
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * See documentation in t_cose_crypto.h
+ */
+enum t_cose_err_t
+t_cose_crypto_ecdh_ephemeral(struct t_cose_key      recipient_key,
+                             struct q_useful_buf    point_buffer,
+                             struct q_useful_buf_c *ephemeral_point,
+                             struct q_useful_buf    secret_buffer,
+                             struct q_useful_buf_c *shared_secret)
+{
+    enum t_cose_err_t  return_value;
+    EC_KEY            *ossl_recipient;
+    EC_KEY            *ephemeral = NULL;
+    const EC_POINT    *recipient_point;
+
+    return_value = ecdh_key(recipient_key, &ossl_recipient);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    recipient_point = EC_KEY_get0_public_key(ossl_recipient);
+    if(recipient_point == NULL) {
+        return_value = T_COSE_ERR_WRONG_TYPE_OF_KEY;
+        goto Done;
+    }
+
+    ephemeral = EC_KEY_new();
+    if(ephemeral == NULL) {
+        return_value = T_COSE_ERR_INSUFFICIENT_MEMORY;
+        goto Done;
+    }
+    if(EC_KEY_set_group(ephemeral, EC_KEY_get0_group(ossl_recipient)) != 1 ||
+       EC_KEY_generate_key(ephemeral) != 1) {
+        return_value = T_COSE_ERR_FAIL;
+        goto Done;
+    }
+
+    return_value = encode_point(EC_KEY_get0_group(ephemeral),
+                                EC_KEY_get0_public_key(ephemeral),
+                                point_buffer,
+                                ephemeral_point,
+                                NULL);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+
+    return_value = compute_shared_secret(recipient_point,
+                                         ephemeral,
+                                         secret_buffer,
+                                         shared_secret);
+
+Done:
+    EC_KEY_free(ephemeral);
+    return return_value;
+}
+
+
+/*
+ * See documentation in t_cose_crypto.h
+ */
+enum t_cose_err_t
+t_cose_crypto_ecdh(struct t_cose_key      private_key,
+                   struct q_useful_buf_c  peer_point,
+                   struct q_useful_buf    secret_buffer,
+                   struct q_useful_buf_c *shared_secret)
+{
+    enum t_cose_err_t  return_value;
+    EC_KEY            *ossl_key;
+    const EC_GROUP    *group;
+    EC_POINT          *ossl_peer_point = NULL;
+
+    return_value = ecdh_key(private_key, &ossl_key);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    if(EC_KEY_get0_private_key(ossl_key) == NULL) {
+        return_value = T_COSE_ERR_WRONG_TYPE_OF_KEY;
+        goto Done;
+    }
+    group = EC_KEY_get0_group(ossl_key);
+
+    ossl_peer_point = EC_POINT_new(group);
+    if(ossl_peer_point == NULL) {
+        return_value = T_COSE_ERR_INSUFFICIENT_MEMORY;
+        goto Done;
+    }
+    /* This rejects points that are not on the curve */
+    if(EC_POINT_oct2point(group,
+                          ossl_peer_point,
+                          peer_point.ptr,
+                          peer_point.len,
+                          NULL) != 1) {
+        return_value = T_COSE_ERR_DECRYPT_FAIL;
+        goto Done;
+    }
+
+    return_value = compute_shared_secret(ossl_peer_point,
+                                         ossl_key,
+                                         secret_buffer,
+                                         shared_secret);
+
+Done:
+    EC_POINT_free(ossl_peer_point);
+    return return_value;
+}
+
+
+/*
+ * See documentation in t_cose_crypto.h
+ */
+enum t_cose_err_t
+t_cose_crypto_hkdf(int32_t               cose_hash_algorithm_id,
+                   struct q_useful_buf_c salt,
+                   struct q_useful_buf_c ikm,
+                   struct q_useful_buf_c info,
+                   struct q_useful_buf   okm_buffer)
+{
+    enum t_cose_err_t  return_value;
+    const EVP_MD      *md;
+    EVP_PKEY_CTX      *ctx;
+    size_t             okm_len;
+
+    switch(cose_hash_algorithm_id) {
+    case COSE_ALGORITHM_SHA_256: md = EVP_sha256(); break;
+#ifndef T_COSE_DISABLE_ES384
+    case COSE_ALGORITHM_SHA_384: md = EVP_sha384(); break;
+#endif
+#ifndef T_COSE_DISABLE_ES512
+    case COSE_ALGORITHM_SHA_512: md = EVP_sha512(); break;
+#endif
+    default:
+        return T_COSE_ERR_UNSUPPORTED_HASH;
+    }
+    if(salt.len > INT_MAX || ikm.len > INT_MAX || info.len > INT_MAX) {
+        return T_COSE_ERR_INVALID_ARGUMENT;
+    }
+
+    ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+    if(ctx == NULL) {
+        return T_COSE_ERR_INSUFFICIENT_MEMORY;
+    }
+
+    okm_len = okm_buffer.len;
+    if(EVP_PKEY_derive_init(ctx) != 1 ||
+       EVP_PKEY_CTX_set_hkdf_md(ctx, md) != 1 ||
+       (salt.len > 0 &&
+        EVP_PKEY_CTX_set1_hkdf_salt(ctx, salt.ptr, (int)salt.len) != 1) ||
+       EVP_PKEY_CTX_set1_hkdf_key(ctx, ikm.ptr, (int)ikm.len) != 1 ||
+       (info.len > 0 &&
+        EVP_PKEY_CTX_add1_hkdf_info(ctx, info.ptr, (int)info.len) != 1) ||
+       EVP_PKEY_derive(ctx, okm_buffer.ptr, &okm_len) != 1 ||
+       okm_len != okm_buffer.len) {
+        return_value = T_COSE_ERR_FAIL;
+        goto Done;
+    }
+
+    return_value = T_COSE_SUCCESS;
+
+Done:
+    EVP_PKEY_CTX_free(ctx);
+    return return_value;
+}
+
+
+/* AES key wrap adds one 8-byte block */
+#define AES_KW_OVERHEAD 8
+
+
+/**
+ * \brief Run AES key wrap or unwrap.
+ *
+ * \param[in] cose_algorithm_id  The key wrap algorithm.
+ * \param[in] kek                The key encryption key.
+ * \param[in] in                 The input.
+ * \param[in] buffer             Buffer for the output.
+ * \param[out] out               The output.
+ * \param[in] wrap               1 to wrap, 0 to unwrap.
+ */
+static enum t_cose_err_t
+aes_kw(int32_t                cose_algorithm_id,
+       struct q_useful_buf_c  kek,
+       struct q_useful_buf_c  in,
+       struct q_useful_buf    buffer,
+       struct q_useful_buf_c *out,
+       int                    wrap)
+{
+    enum t_cose_err_t  return_value;
+    EVP_CIPHER_CTX    *ctx;
+    int                update_len;
+    int                final_len;
+
+    if(cose_algorithm_id != COSE_ALGORITHM_A128KW) {
+        return T_COSE_ERR_UNSUPPORTED_ENCRYPTION_ALG;
+    }
+    if(kek.len != 16) {
+        return T_COSE_ERR_WRONG_TYPE_OF_KEY;
+    }
+    if(in.len > INT_MAX - AES_KW_OVERHEAD || in.len % 8 != 0) {
+        return T_COSE_ERR_INVALID_ARGUMENT;
+    }
+    if(wrap) {
+        if(buffer.len < in.len + AES_KW_OVERHEAD) {
+            return T_COSE_ERR_TOO_SMALL;
+        }
+    } else {
+        if(in.len < 2 * AES_KW_OVERHEAD) {
+            return T_COSE_ERR_DECRYPT_FAIL;
+        }
+        if(buffer.len < in.len - AES_KW_OVERHEAD) {
+            return T_COSE_ERR_TOO_SMALL;
+        }
+    }
+
+    ctx = EVP_CIPHER_CTX_new();
+    if(ctx == NULL) {
+        return T_COSE_ERR_INSUFFICIENT_MEMORY;
+    }
+    EVP_CIPHER_CTX_set_flags(ctx, EVP_CIPHER_CTX_FLAG_WRAP_ALLOW);
+
+    if(EVP_CipherInit_ex(ctx, EVP_aes_128_wrap(), NULL, kek.ptr, NULL, wrap) != 1) {
+        return_value = T_COSE_ERR_FAIL;
+        goto Done;
+    }
+    if(EVP_CipherUpdate(ctx,
+                        buffer.ptr,
+                        &update_len,
+                        in.ptr,
+                        (int)in.len) != 1 ||
+       EVP_CipherFinal_ex(ctx,
+                          (uint8_t *)buffer.ptr + update_len,
+                          &final_len) != 1) {
+        /* For unwrap this is the integrity check failing */
+        return_value = wrap ? T_COSE_ERR_FAIL : T_COSE_ERR_DECRYPT_FAIL;
+        goto Done;
+    }
+
+    out->ptr = buffer.ptr;
+    out->len = (size_t)(update_len + final_len);
+    return_value = T_COSE_SUCCESS;
+
+Done:
+    EVP_CIPHER_CTX_free(ctx);
+    return return_value;
+}
+
+
+/*
+ * See documentation in t_cose_crypto.h
+ */
+enum t_cose_err_t
+t_cose_crypto_kw_wrap(int32_t                cose_algorithm_id,
+                      struct q_useful_buf_c  kek,
+                      struct q_useful_buf_c  plaintext,
+                      struct q_useful_buf    buffer,
+                      struct q_useful_buf_c *ciphertext)
+{
+    return aes_kw(cose_algorithm_id, kek, plaintext, buffer, ciphertext, 1);
+}
+
+
+/*
+ * See documentation in t_cose_crypto.h
+ */
+enum t_cose_err_t
+t_cose_crypto_kw_unwrap(int32_t                cose_algorithm_id,
+                        struct q_useful_buf_c  kek,
+                        struct q_useful_buf_c  ciphertext,
+                        struct q_useful_buf    buffer,
+                        struct q_useful_buf_c *plaintext)
+{
+    return aes_kw(cose_algorithm_id, kek, ciphertext, buffer, plaintext, 0);
+}
+#endif /* T_COSE_ENABLE_ENCRYPT || T_COSE_ENABLE_OSCORE */
+
+
 
 /*
  * See documentation in t_cose_crypto.h
@@ -31,12 +31,17 @@
 
 /* The Brad Conte hash implementaiton bundled with t_cose */
 #include "sha256.h"
+#if !defined T_COSE_DISABLE_ES512 || !defined T_COSE_DISABLE_ES384
+#include "sha512.h"
+#endif
 
 /* Use of this file requires definition of T_COSE_USE_B_CON_SHA256 when
  * making t_cose_crypto.h.
  *
- * This only implements SHA-256 as that is all that is needed for the
- * non signing and verification tests using short-circuit signatures.
+ * SHA-256 is needed for the non signing and verification tests using
+ * short-circuit signatures. SHA-384 and SHA-512 are also implemented
+ * so ES384 and ES512 short-circuit signatures work and the hashes can
+ * be used without a crypto library.
  */
 
 #ifdef T_COSE_ENABLE_HASH_FAIL_TEST
@@ -128,11 +133,29 @@ t_cose_crypto_hash_start(struct t_cose_crypto_hash *hash_ctx,
     }
 #endif
 
-    if(cose_hash_alg_id != COSE_ALGORITHM_SHA_256) {
+    switch(cose_hash_alg_id) {
+
+    case COSE_ALGORITHM_SHA_256:
+        sha256_init(&(hash_ctx->b_con_hash_context.sha_256));
+        break;
+
+#ifndef T_COSE_DISABLE_ES384
+    case COSE_ALGORITHM_SHA_384:
+        sha384_init(&(hash_ctx->b_con_hash_context.sha_512));
+        break;
+#endif
+
+#ifndef T_COSE_DISABLE_ES512
+    case COSE_ALGORITHM_SHA_512:
+        sha512_init(&(hash_ctx->b_con_hash_context.sha_512));
+        break;
+#endif
+
+    default:
         return T_COSE_ERR_UNSUPPORTED_HASH;
     }
+    hash_ctx->cose_hash_alg_id = cose_hash_alg_id;
 
-    sha256_init(&(hash_ctx->b_con_hash_context));
     return 0;
 }
 
@@ -143,7 +166,15 @@ void t_cose_crypto_hash_update(struct t_cose_crypto_hash *hash_ctx,
                                struct q_useful_buf_c data_to_hash)
 {
     if(data_to_hash.ptr) {
-        sha256_update(&(hash_ctx->b_con_hash_context),
+#if !defined T_COSE_DISABLE_ES512 || !defined T_COSE_DISABLE_ES384
+        if(hash_ctx->cose_hash_alg_id != COSE_ALGORITHM_SHA_256) {
+            sha512_update(&(hash_ctx->b_con_hash_context.sha_512),
+                          data_to_hash.ptr,
+                          data_to_hash.len);
+            return;
+        }
+#endif
+        sha256_update(&(hash_ctx->b_con_hash_context.sha_256),
                       data_to_hash.ptr,
                       data_to_hash.len);
     }
@@ -163,7 +194,20 @@ t_cose_crypto_hash_finish(struct t_cose_crypto_hash *hash_ctx,
     }
 #endif
 
-    sha256_final(&(hash_ctx->b_con_hash_context), buffer_to_hold_result.ptr);
+#if !defined T_COSE_DISABLE_ES512 || !defined T_COSE_DISABLE_ES384
+    if(hash_ctx->cose_hash_alg_id != COSE_ALGORITHM_SHA_256) {
+        if(buffer_to_hold_result.len < hash_ctx->b_con_hash_context.sha_512.digestlen) {
+            return T_COSE_ERR_HASH_BUFFER_SIZE;
+        }
+        sha512_final(&(hash_ctx->b_con_hash_context.sha_512),
+                     buffer_to_hold_result.ptr);
+        *hash_result = (UsefulBufC){buffer_to_hold_result.ptr,
+                                    hash_ctx->b_con_hash_context.sha_512.digestlen};
+        return 0;
+    }
+#endif
+
+    sha256_final(&(hash_ctx->b_con_hash_context.sha_256), buffer_to_hold_result.ptr);
     *hash_result = (UsefulBufC){buffer_to_hold_result.ptr, 32};
 
     return 0;
@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+#
+# cost_corpus_to_c.py -- make test/t_cose_cost_corpus.h from fuzz/corpus/cost
+#
+# Copyright 2019-2020, Laurence Lundblade
+#
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# See BSD-3-Clause license in README.md
+#
+# The tests don't read files so the regression corpus of slow inputs
+# found by t_cose_verify_fuzz is compiled in. Run this after adding
+# inputs to fuzz/corpus/cost:
+#
+#   python3 fuzz/cost_corpus_to_c.py fuzz/corpus/cost > test/t_cose_cost_corpus.h
+
+import os
+import sys
+
+
+def c_name(file_name):
+    base = os.path.splitext(file_name)[0]
+    return 's_cost_' + ''.join(c if c.isalnum() else '_' for c in base)
+
+
+def main(corpus_dir):
+    names = sorted(n for n in os.listdir(corpus_dir) if n.endswith('.cbor'))
+
+    print('/*')
+    print(' * t_cose_cost_corpus.h')
+    print(' *')
+    print(' * Generated by fuzz/cost_corpus_to_c.py from fuzz/corpus/cost.')
+    print(' * Do not edit.')
+    print(' *')
+    print(' * SPDX-License-Identifier: BSD-3-Clause')
+    print(' */')
+    print()
+    print('#ifndef __T_COSE_COST_CORPUS_H__')
+    print('#define __T_COSE_COST_CORPUS_H__')
+    print()
+    print('#include <stdint.h>')
+    print('#include "t_cose/q_useful_buf.h"')
+    print()
+    for name in names:
+        with open(os.path.join(corpus_dir, name), 'rb') as f:
+            data = f.read()
+        print('/* %s */' % name)
+        print('static const uint8_t %s[] = {' % c_name(name))
+        for i in range(0, len(data), 12):
+            chunk = data[i:i + 12]
+            print('    ' + ', '.join('0x%02x' % b for b in chunk) + ',')
+        print('};')
+        print()
+    print('static const struct q_useful_buf_c s_cost_corpus[] = {')
+    for name in names:
+        print('    {%s, sizeof(%s)},' % (c_name(name), c_name(name)))
+    print('};')
+    print()
+    print('#endif /* __T_COSE_COST_CORPUS_H__ */')
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        sys.exit('usage: cost_corpus_to_c.py <corpus directory>')
+    main(sys.argv[1])
@@ -0,0 +1,185 @@
+/*
+ *  t_cose_verify_fuzz.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "t_cose/t_cose_sign1_verify.h"
+#include "t_cose/t_cose_cost.h"
+#include "t_cose/q_useful_buf.h"
+#include "t_cose_parameters.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+/**
+ * \file t_cose_verify_fuzz.c
+ *
+ * \brief libFuzzer harness that searches for the inputs that cost the
+ * most to verify.
+ *
+ * Coverage guidance alone finds inputs that reach new code, not
+ * inputs that are slow. Like PerfFuzz, this adds the cost of each
+ * input as extra coverage: each verification cost counter from
+ * t_cose_cost.h is mapped to a bucket on a log scale and the bucket
+ * is set in a libFuzzer extra counter. An input that reaches a higher
+ * bucket of any counter than any input before it is new coverage, so
+ * libFuzzer keeps it and mutates it further. The corpus climbs
+ * towards the most expensive inputs.
+ *
+ * Each input is run through t_cose_sign1_verify() and, on its own,
+ * through the header parameter parser so mutations of bare parameter
+ * maps are effective.
+ *
+ * When the environment variable \c T_COSE_FUZZ_SLOW_DIR is set, each
+ * input that is the most expensive so far for its size, as a
+ * fraction of \ref T_COSE_COST_BUDGET, is written there. The
+ * slowest of those are added to fuzz/corpus/cost, which
+ * cost_budget_test() checks against \ref T_COSE_COST_BUDGET. See
+ * \c fuzz in Makefile.test.
+ */
+
+
+/* Number of buckets per counter. Four per power of two up to 2^32. */
+#define COST_BUCKETS 128
+
+/* The counters used for guidance */
+enum cost_metric {
+    METRIC_VERIFY_TOTAL,
+    METRIC_HEADER_TOTAL,
+    METRIC_CBOR_ITEMS,
+    METRIC_UNKNOWN_PARAMETERS,
+    METRIC_LABEL_COMPARES,
+    METRIC_HASH_BYTES,
+    METRIC_COUNT
+};
+
+__attribute__((used, section("__libfuzzer_extra_counters")))
+static uint8_t s_cost_features[METRIC_COUNT * COST_BUCKETS];
+
+/* The highest cost so far as a fraction of the budget for its size */
+static uint64_t s_worst_permille;
+
+
+/*
+ * Bucket of a cost on a log scale with four buckets per power of two.
+ */
+static size_t
+cost_bucket(uint64_t cost)
+{
+    size_t bit;
+    size_t bucket;
+
+    if(cost < 4) {
+        return (size_t)cost;
+    }
+    for(bit = 63; !(cost >> bit); bit--);
+    bucket = 4 * bit + (size_t)((cost >> (bit - 2)) & 3);
+
+    return bucket < COST_BUCKETS ? bucket : COST_BUCKETS - 1;
+}
+
+
+static void
+add_feature(enum cost_metric metric, uint64_t cost)
+{
+    s_cost_features[metric * COST_BUCKETS + cost_bucket(cost)] = 1;
+}
+
+
+static void
+add_features(const struct t_cose_cost *cost)
+{
+    add_feature(METRIC_CBOR_ITEMS, cost->cbor_items);
+    add_feature(METRIC_UNKNOWN_PARAMETERS, cost->unknown_parameters);
+    add_feature(METRIC_LABEL_COMPARES, cost->label_compares);
+    add_feature(METRIC_HASH_BYTES, cost->hash_bytes);
+}
+
+
+/*
+ * Write an input that is the most expensive for its size so far.
+ */
+static void
+save_slow_input(const uint8_t *data, size_t size, uint64_t total)
+{
+    const char *dir;
+    char        path[512];
+    FILE       *file;
+
+    dir = getenv("T_COSE_FUZZ_SLOW_DIR");
+    if(dir == NULL) {
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/slow-%08llu-%zu.cbor",
+             dir, (unsigned long long)total, size);
+    file = fopen(path, "wb");
+    if(file == NULL) {
+        return;
+    }
+    fwrite(data, 1, size, file);
+    fclose(file);
+    fprintf(stderr, "t_cose_verify_fuzz: cost %llu for %zu bytes, budget %llu: %s\n",
+            (unsigned long long)total, size,
+            (unsigned long long)T_COSE_COST_BUDGET(size), path);
+}
+
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    struct t_cose_sign1_verify_ctx verify_ctx;
+    struct q_useful_buf_c          input = {data, size};
+    struct q_useful_buf_c          payload;
+    struct t_cose_parameters       parameters;
+    struct t_cose_label_list       critical_labels;
+    struct t_cose_label_list       unknown_labels;
+    struct t_cose_cost             verify_cost;
+    struct t_cose_cost             header_cost;
+    uint64_t                       verify_total;
+    uint64_t                       header_total;
+    uint64_t                       budget_permille;
+
+    /* -- The whole verification -- */
+    t_cose_cost_reset();
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+    (void)t_cose_sign1_verify(&verify_ctx, input, &payload, &parameters);
+    t_cose_cost_get(&verify_cost);
+
+    /* -- The input as a protected header parameter map -- */
+    t_cose_cost_reset();
+    clear_label_list(&unknown_labels);
+    if(parse_protected_header_parameters(input,
+                                        &parameters,
+                                        &critical_labels,
+                                        &unknown_labels,
+                                         NULL,
+                                         0) == T_COSE_SUCCESS) {
+        (void)check_critical_labels(&critical_labels, &unknown_labels);
+    }
+    t_cose_cost_get(&header_cost);
+
+    verify_total = t_cose_cost_total(&verify_cost);
+    header_total = t_cose_cost_total(&header_cost);
+    add_feature(METRIC_VERIFY_TOTAL, verify_total);
+    add_feature(METRIC_HEADER_TOTAL, header_total);
+    add_features(&verify_cost);
+    add_features(&header_cost);
+
+    /* -- Keep the inputs closest to the budget -- */
+    if(header_total > verify_total) {
+        verify_total = header_total;
+    }
+    budget_permille = verify_total * 1000 / T_COSE_COST_BUDGET(size);
+    if(budget_permille > s_worst_permille) {
+        s_worst_permille = budget_permille;
+        save_slow_input(data, size, verify_total);
+    }
+
+    return 0;
+}
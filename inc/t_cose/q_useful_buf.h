@@ -72,6 +72,12 @@ static inline struct q_useful_buf q_useful_buf_unconst(struct q_useful_buf_c in)
     return UsefulBuf_Unconst(in);
 }
 
+
+static inline struct q_useful_buf_c q_useful_buf_const(struct q_useful_buf in)
+{
+    return UsefulBuf_Const(in);
+}
+
 #define Q_USEFUL_BUF_FROM_SZ_LITERAL UsefulBuf_FROM_SZ_LITERAL
 
 #define Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL  UsefulBuf_FROM_BYTE_ARRAY_LITERAL
@@ -0,0 +1,246 @@
+/*
+ *  t_cose_autotune.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef __T_COSE_AUTOTUNE_H__
+#define __T_COSE_AUTOTUNE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "t_cose/t_cose_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * \file t_cose_autotune.h
+ *
+ * \brief Find the batch size and worker count that give the most
+ * throughput.
+ *
+ * How many messages to give t_cose_sign1_sign_batch() or
+ * t_cose_bulk_verify() at once, and on how many threads, depends on
+ * the machine, the algorithms and the payload sizes. This controller
+ * finds good settings while the real work is being done. Before each
+ * run the caller gets the settings to use with
+ * t_cose_autotune_current(). After it, the caller reports how many
+ * messages were done, how long it took and the latency with
+ * t_cose_autotune_record().
+ *
+ * The settings are tuned by hill climbing. The current best settings
+ * are measured over a few runs, then each neighbour, one step away in
+ * one setting, is measured the same way. If the best neighbour gives
+ * enough more throughput it becomes the best and its neighbours are
+ * tried. Otherwise the controller has converged and stays on the best
+ * settings for a while before trying the neighbours again, in case
+ * the load has changed. The batch size and lane width step by
+ * doubling and halving. The worker count steps by one.
+ *
+ * With a latency target, settings whose latency is over it are used
+ * only while nothing under it has been found. Among settings that are
+ * over, the lowest latency is best.
+ *
+ * There are three settings. Set the minimum and maximum of one to the
+ * same value to leave it fixed. The lane width is for engines that
+ * process several messages at once with SIMD or a similar means. None
+ * of the t_cose engines have one, so it is usually left fixed at 1.
+ *
+ * t_cose_autotune_get_stats() returns the chosen settings and the
+ * throughput and latency measured for them, for export to monitoring.
+ *
+ * No clock is read here. All times come from the caller. A controller
+ * is not thread-safe. It is normally used by the one thread that
+ * starts each run.
+ */
+
+
+/**
+ * The range of one setting.
+ */
+struct t_cose_autotune_range {
+    /** The smallest value to try. At least 1. */
+    uint32_t min;
+    /** The largest value to try */
+    uint32_t max;
+    /** The value to start with. 0 is \c min. */
+    uint32_t start;
+};
+
+
+/**
+ * How to tune.
+ */
+struct t_cose_autotune_config {
+    /** Messages per run */
+    struct t_cose_autotune_range batch_size;
+    /** Threads per run */
+    struct t_cose_autotune_range worker_count;
+    /** Messages processed together by one thread */
+    struct t_cose_autotune_range lane_width;
+    /** The most latency that is acceptable, in the unit of the
+     * latencies given to t_cose_autotune_record(). 0 is no target. */
+    uint64_t                     latency_target;
+    /** Runs measured for each trial of settings. 0 is 4. */
+    uint32_t                     runs_per_trial;
+    /** Percent more throughput needed to move to other settings. 0 is
+     * 3. */
+    uint32_t                     min_gain_percent;
+    /** Trials of the best settings after converging before the
+     * neighbours are tried again. 0 is never. */
+    uint32_t                     reprobe_trials;
+};
+
+
+/**
+ * The settings to use for a run.
+ */
+struct t_cose_autotune_settings {
+    uint32_t batch_size;
+    uint32_t worker_count;
+    uint32_t lane_width;
+};
+
+
+/**
+ * The state and results of a controller.
+ */
+struct t_cose_autotune_stats {
+    /** The best settings found */
+    struct t_cose_autotune_settings best;
+    /** Messages per second with \c best, from its last trial */
+    uint64_t                        best_throughput;
+    /** Latency with \c best, from its last trial */
+    uint64_t                        best_latency;
+    /** Trials of settings measured */
+    uint32_t                        trials;
+    /** Times \c best has changed */
+    uint32_t                        moves;
+    /** \c true if no neighbour of \c best was better the last time
+     * they were all tried */
+    bool                            converged;
+    /** \c true if \c best meets the latency target or there is none */
+    bool                            within_target;
+};
+
+
+/**
+ * One measured trial. Private.
+ */
+struct t_cose_autotune_trial {
+    struct t_cose_autotune_settings settings;
+    uint64_t                        throughput;
+    uint64_t                        latency;
+    bool                            measured;
+};
+
+
+/**
+ * A controller. The members are private.
+ */
+struct t_cose_autotune {
+    /* Private data structure */
+    struct t_cose_autotune_config   config;
+    struct t_cose_autotune_trial    best;
+    struct t_cose_autotune_trial    best_neighbour;
+    struct t_cose_autotune_settings current;
+    /* Which neighbour of best is being measured, or -1 for best */
+    int                             neighbour;
+    uint32_t                        hold_trials;
+    uint32_t                        runs;
+    uint64_t                        run_messages;
+    uint64_t                        run_time;
+    uint64_t                        run_latency;
+    struct t_cose_autotune_stats    stats;
+};
+
+
+/**
+ * \brief Initialize a controller.
+ *
+ * \param[out] tuner   The controller.
+ * \param[in] config   How to tune. It is copied.
+ *
+ * \retval T_COSE_ERR_INVALID_ARGUMENT  A range has a minimum of 0, a
+ *                                     maximum less than the minimum
+ *                                     or a start outside it.
+ */
+enum t_cose_err_t
+t_cose_autotune_init(struct t_cose_autotune              *tuner,
+                     const struct t_cose_autotune_config *config);
+
+
+/**
+ * \brief Get the settings to use for the next run.
+ *
+ * \param[in] tuner  The controller.
+ *
+ * \return The settings.
+ */
+static inline struct t_cose_autotune_settings
+t_cose_autotune_current(const struct t_cose_autotune *tuner);
+
+
+/**
+ * \brief Report the results of a run.
+ *
+ * \param[in] tuner     The controller.
+ * \param[in] messages  Number of messages signed or verified.
+ * \param[in] run_time  How long the run took in nanoseconds.
+ * \param[in] latency   The latency of the run in the same unit as
+ *                      \c latency_target, for example the time from
+ *                      the first message arriving to the end of the
+ *                      run. The largest of a trial is used.
+ *
+ * The run must have used the settings from
+ * t_cose_autotune_current(). They may be different after this.
+ */
+void
+t_cose_autotune_record(struct t_cose_autotune *tuner,
+                       uint64_t                messages,
+                       uint64_t                run_time,
+                       uint64_t                latency);
+
+
+/**
+ * \brief Get the chosen settings and how they performed.
+ *
+ * \param[in] tuner  The controller.
+ *
+ * \return The stats.
+ */
+static inline const struct t_cose_autotune_stats *
+t_cose_autotune_get_stats(const struct t_cose_autotune *tuner);
+
+
+
+
+/* ------------------------------------------------------------------------
+ * Inline implementations of public functions defined above.
+ */
+static inline struct t_cose_autotune_settings
+t_cose_autotune_current(const struct t_cose_autotune *tuner)
+{
+    return tuner->current;
+}
+
+
+static inline const struct t_cose_autotune_stats *
+t_cose_autotune_get_stats(const struct t_cose_autotune *tuner)
+{
+    return &(tuner->stats);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_AUTOTUNE_H__ */
@@ -0,0 +1,190 @@
+/*
+ *  t_cose_bulk_verify.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef __T_COSE_BULK_VERIFY_H__
+#define __T_COSE_BULK_VERIFY_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+#include "t_cose/t_cose_sign1_verify.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * \file t_cose_bulk_verify.h
+ *
+ * \brief Verify a large number of files that are each one \c COSE_Sign1.
+ *
+ * When millions of small files are verified, opening, reading and
+ * closing each one with blocking system calls takes more time than
+ * the verification. Here the file I/O is done in bulk, with thousands
+ * of reads in flight, while a pool of threads verifies the files
+ * already read.
+ *
+ * With \c T_COSE_HAVE_LIBURING defined, and when the kernel supports
+ * it, the files are read with io_uring. The open, read and close of
+ * each file are submitted together as one linked chain. The files are
+ * opened as direct descriptors and read into registered buffers, so
+ * there is no per-file system call. If io_uring can't be set up,
+ * for example because the kernel is too old or it is disabled, each
+ * verification thread instead opens and reads its own files with
+ * ordinary system calls. That is also what happens when
+ * \c T_COSE_HAVE_LIBURING is not defined. Opening into direct
+ * descriptors needs Linux 5.19 and liburing 2.2 or later.
+ *
+ * All buffers are in memory given by the caller. Nothing is
+ * allocated.
+ *
+ * The results are in an array of \ref t_cose_bulk_result, one per
+ * file in the same order as the paths. They can be written out as a
+ * manifest with t_cose_bulk_verify_write_manifest().
+ *
+ * This needs POSIX threads and file I/O and is only available when
+ * \c T_COSE_ENABLE_BULK_VERIFY is defined.
+ */
+
+
+#ifdef T_COSE_ENABLE_BULK_VERIFY
+
+/** The most verification threads */
+#define T_COSE_BULK_VERIFY_MAX_THREADS 64
+
+/** The most reads in flight */
+#define T_COSE_BULK_VERIFY_MAX_QUEUE_DEPTH 8192
+
+
+/**
+ * How to verify the files.
+ */
+struct t_cose_bulk_verify_config {
+    /** Each file is verified with a copy of this context. It must be
+     * safe to use from several threads at once: no custom parameters,
+     * restart context or capture. The verification key, cache and
+     * rate limiter are shared by all the copies. */
+    const struct t_cose_sign1_verify_ctx *verify_template;
+    /** Number of verification threads. 0 is 4. */
+    uint32_t                              worker_threads;
+    /** Number of files read at once. 0 is 1024. */
+    uint32_t                              queue_depth;
+    /** Longest file allowed. 0 is 64KiB. At most 64MiB. */
+    uint32_t                              max_file_size;
+    /** Use blocking reads even if io_uring is available. */
+    bool                                  disable_io_uring;
+};
+
+
+/**
+ * The result for one file.
+ */
+struct t_cose_bulk_result {
+    /** The result of t_cose_sign1_verify(), or
+     * \ref T_COSE_ERR_ARTIFACT_ACCESS if the file couldn't be read, or
+     * \ref T_COSE_ERR_TOO_SMALL if it is longer than
+     * \c max_file_size. */
+    enum t_cose_err_t result;
+    /** The \c errno when the file couldn't be read, otherwise 0 */
+    int32_t           os_error;
+    /** Length of the file read */
+    uint32_t          file_len;
+};
+
+
+/**
+ * Totals for one t_cose_bulk_verify().
+ */
+struct t_cose_bulk_verify_stats {
+    /** Number of files */
+    uint64_t files;
+    /** Number of files that did not verify for any reason */
+    uint64_t failed;
+    /** Total bytes read */
+    uint64_t bytes;
+    /** Wall clock time taken */
+    uint64_t elapsed_ns;
+    /** \c true if the files were read with io_uring */
+    bool     used_io_uring;
+};
+
+
+/**
+ * \brief Compute the memory needed by t_cose_bulk_verify().
+ *
+ * \param[in] config  The configuration.
+ *
+ * \return The size in bytes. It is about
+ *         \c queue_depth * \c max_file_size.
+ */
+size_t
+t_cose_bulk_verify_buffer_size(const struct t_cose_bulk_verify_config *config);
+
+
+/**
+ * \brief Verify many files.
+ *
+ * \param[in] config     The configuration.
+ * \param[in] buffer     Memory for the reads of at least
+ *                       t_cose_bulk_verify_buffer_size() bytes.
+ * \param[in] paths      The files to verify.
+ * \param[in] num_paths  Number of \c paths.
+ * \param[out] results   Array of \c num_paths results.
+ * \param[out] stats     Totals. May be \c NULL.
+ *
+ * \retval T_COSE_ERR_INVALID_ARGUMENT  The configuration is not
+ *                                     allowed.
+ * \retval T_COSE_ERR_TOO_SMALL         \c buffer is too small.
+ *
+ * Only errors that stop all the files from being verified are
+ * returned here. The result of each file is in \c results.
+ *
+ * The verification key set on \c verify_template is used for all
+ * files.
+ */
+enum t_cose_err_t
+t_cose_bulk_verify(const struct t_cose_bulk_verify_config *config,
+                   struct q_useful_buf                     buffer,
+                   const char * const                     *paths,
+                   size_t                                  num_paths,
+                   struct t_cose_bulk_result              *results,
+                   struct t_cose_bulk_verify_stats        *stats);
+
+
+/**
+ * \brief Write the results as a manifest.
+ *
+ * \param[in] fd           File descriptor to write to.
+ * \param[in] paths        The paths given to t_cose_bulk_verify().
+ * \param[in] results      The results from it.
+ * \param[in] num_results  The number of results.
+ *
+ * \retval T_COSE_ERR_ARTIFACT_ACCESS  Writing failed.
+ *
+ * There is one line per file of the result code, the \c errno, the
+ * length and the path, separated by tabs.
+ */
+enum t_cose_err_t
+t_cose_bulk_verify_write_manifest(int                              fd,
+                                  const char * const              *paths,
+                                  const struct t_cose_bulk_result *results,
+                                  size_t                           num_results);
+
+#endif /* T_COSE_ENABLE_BULK_VERIFY */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_BULK_VERIFY_H__ */
@@ -0,0 +1,291 @@
+/*
+ * t_cose_capture.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef __T_COSE_CAPTURE_H__
+#define __T_COSE_CAPTURE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * \file t_cose_capture.h
+ *
+ * \brief Sampled capture of the shape of verified messages.
+ *
+ * Synthetic benchmarks use one algorithm, one header and a few
+ * payload sizes. Real traffic is a mix of algorithms, header
+ * shapes, payload sizes, kids and failures, and an optimization that
+ * helps one can hurt the mix. A capture records that mix from a
+ * running system so it can be replayed in a benchmark (see
+ * bench/t_cose_replay_bench.c).
+ *
+ * When a capture is set on a verification context with
+ * t_cose_sign1_verify_set_capture(), t_cose_sign1_verify() adds a
+ * record for a random sample of the messages it sees. A record
+ * describes the shape of the message, not its contents. It has the
+ * algorithm, the lengths of the parts, the result of verification
+ * and a 16-bit tag made from the kid with a salt. The tag shows how
+ * the kids are distributed without showing what they are. No bytes
+ * of the payload, the kid or the signature are recorded.
+ *
+ * The log is written to a buffer given by the caller. When it is
+ * full, the flush callback is called to save it, for example by
+ * appending it to a file, and the buffer is reused. Without a flush
+ * callback records that don't fit are counted and dropped. The log
+ * starts with a header of \ref T_COSE_CAPTURE_HEADER_SIZE bytes
+ * followed by records of \ref T_COSE_CAPTURE_RECORD_SIZE bytes. The
+ * header is only at the start of the first flush, so the flushed
+ * pieces appended together are one log.
+ *
+ * A capture is not thread safe. Use one per thread or serialize
+ * calls to t_cose_sign1_verify() that share one.
+ *
+ * This is only available when \c T_COSE_ENABLE_CAPTURE is defined.
+ */
+
+
+#ifdef T_COSE_ENABLE_CAPTURE
+
+/** Size of the log header */
+#define T_COSE_CAPTURE_HEADER_SIZE 16
+
+/** Size of each record in the log */
+#define T_COSE_CAPTURE_RECORD_SIZE 16
+
+/** Version of the log format in the header */
+#define T_COSE_CAPTURE_VERSION 1
+
+
+/** The message was a tagged \c COSE_Sign1 */
+#define T_COSE_CAPTURE_FLAG_TAGGED        0x01
+
+/** The message had a content type parameter */
+#define T_COSE_CAPTURE_FLAG_CONTENT_TYPE  0x02
+
+/** The message had a short-circuit signature */
+#define T_COSE_CAPTURE_FLAG_SHORT_CIRCUIT 0x04
+
+/** The message was only decoded, see \ref T_COSE_OPT_DECODE_ONLY */
+#define T_COSE_CAPTURE_FLAG_DECODE_ONLY   0x08
+
+
+/**
+ * The shape of one verified message. Lengths that don't fit are
+ * saturated at the largest value of the field.
+ */
+struct t_cose_capture_record {
+    /** The COSE algorithm ID or 0 if the message didn't get that far */
+    int32_t           cose_algorithm_id;
+    /** What t_cose_sign1_verify() returned */
+    enum t_cose_err_t result;
+    /** \c T_COSE_CAPTURE_FLAG_XXX */
+    uint8_t           flags;
+    /** Length of the payload */
+    uint32_t          payload_len;
+    /** Length of the encoded protected header parameters */
+    uint16_t          protected_len;
+    /** Length of the signature */
+    uint16_t          signature_len;
+    /** Length of the kid */
+    uint8_t           kid_len;
+    /** Bytes of the message not in the above, that is the CBOR
+     * framing and unprotected parameters other than the kid */
+    uint8_t           other_len;
+    /** Salted hash of the kid. The same kid has the same tag in one
+     * capture. */
+    uint16_t          kid_tag;
+};
+
+
+/**
+ * \brief Called when the capture buffer is full or flushed.
+ *
+ * \param[in] cb_context  The context passed to t_cose_capture_init().
+ * \param[in] log_bytes   The bytes of the log since the last flush.
+ *
+ * The bytes are only valid for the duration of the call.
+ */
+typedef void
+t_cose_capture_flush_cb(void                 *cb_context,
+                        struct q_useful_buf_c log_bytes);
+
+
+/**
+ * A capture in progress. Initialize with t_cose_capture_init().
+ */
+struct t_cose_capture {
+    /* Private data structure */
+    struct q_useful_buf      buffer;
+    size_t                   used;
+    uint32_t                 sample_rate;
+    uint32_t                 random_state;
+    uint32_t                 kid_salt;
+    uint64_t                 messages_seen;
+    uint64_t                 messages_recorded;
+    uint64_t                 messages_dropped;
+    t_cose_capture_flush_cb *flush_cb;
+    void                    *flush_cb_context;
+};
+
+
+/**
+ * \brief Start a capture.
+ *
+ * \param[in] capture      The capture to initialize.
+ * \param[in] buffer       Where the log is written. It must stay valid
+ *                         while the capture is used.
+ * \param[in] sample_rate  One in this many messages is recorded. 0 or
+ *                         1 records all of them.
+ * \param[in] seed         Seeds the sampling and the kid salt. Use a
+ *                         different random value for each capture so
+ *                         kid tags can't be matched across captures.
+ * \param[in] flush_cb     Called with the log when \c buffer is full
+ *                         and by t_cose_capture_flush(). May be
+ *                         \c NULL.
+ * \param[in] cb_context   Passed to \c flush_cb.
+ *
+ * \retval T_COSE_ERR_TOO_SMALL  \c buffer doesn't have room for the
+ *                               header and one record.
+ *
+ * The log header is written to the start of \c buffer.
+ */
+enum t_cose_err_t
+t_cose_capture_init(struct t_cose_capture   *capture,
+                    struct q_useful_buf      buffer,
+                    uint32_t                 sample_rate,
+                    uint32_t                 seed,
+                    t_cose_capture_flush_cb *flush_cb,
+                    void                    *cb_context);
+
+
+/**
+ * \brief Pass the log written so far to the flush callback.
+ *
+ * \param[in] capture  The capture.
+ *
+ * Call this when the capture is finished. Nothing is done if there
+ * is no flush callback.
+ */
+void
+t_cose_capture_flush(struct t_cose_capture *capture);
+
+
+/**
+ * \brief Get the log written since the last flush.
+ *
+ * \param[in] capture  The capture.
+ *
+ * \return The log bytes. This is the whole log, header included, if
+ *         there is no flush callback.
+ */
+static inline struct q_useful_buf_c
+t_cose_capture_get_log(const struct t_cose_capture *capture);
+
+
+/**
+ * \brief Get the counts of messages seen by a capture.
+ *
+ * \param[in] capture   The capture.
+ * \param[out] seen     Messages passed to t_cose_sign1_verify().
+ * \param[out] recorded Messages sampled and recorded.
+ * \param[out] dropped  Messages sampled but not recorded because the
+ *                      buffer was full and there is no flush callback.
+ */
+static inline void
+t_cose_capture_get_counts(const struct t_cose_capture *capture,
+                          uint64_t                    *seen,
+                          uint64_t                    *recorded,
+                          uint64_t                    *dropped);
+
+
+/**
+ * \brief Check the header of a log and find the records.
+ *
+ * \param[in] log           A whole log.
+ * \param[out] sample_rate  The sample rate of the capture.
+ * \param[out] records      The records in \c log, for
+ *                          t_cose_capture_decode_record().
+ *
+ * \retval T_COSE_ERR_CAPTURE_FORMAT  The header is wrong or of
+ *                                    another version, or \c log is
+ *                                    not a whole number of records.
+ */
+enum t_cose_err_t
+t_cose_capture_decode_header(struct q_useful_buf_c  log,
+                             uint32_t              *sample_rate,
+                             struct q_useful_buf_c *records);
+
+
+/**
+ * \brief Decode the next record of a log.
+ *
+ * \param[in,out] records  The records from
+ *                         t_cose_capture_decode_header(). The decoded
+ *                         record is removed from the front.
+ * \param[out] record      The decoded record.
+ *
+ * \retval T_COSE_ERR_CAPTURE_FORMAT  There are no more records.
+ */
+enum t_cose_err_t
+t_cose_capture_decode_record(struct q_useful_buf_c        *records,
+                             struct t_cose_capture_record *record);
+
+
+/**
+ * \brief Encode a record in the log format.
+ *
+ * \param[in] record  The record.
+ * \param[out] out    \ref T_COSE_CAPTURE_RECORD_SIZE bytes.
+ *
+ * This is used by t_cose_sign1_verify() and by tools that make logs.
+ */
+void
+t_cose_capture_encode_record(const struct t_cose_capture_record *record,
+                             uint8_t out[T_COSE_CAPTURE_RECORD_SIZE]);
+
+
+
+
+/* ------------------------------------------------------------------------
+ * Inline implementations of public functions defined above.
+ */
+static inline struct q_useful_buf_c
+t_cose_capture_get_log(const struct t_cose_capture *me)
+{
+    return (struct q_useful_buf_c){me->buffer.ptr, me->used};
+}
+
+
+static inline void
+t_cose_capture_get_counts(const struct t_cose_capture *me,
+                          uint64_t                    *seen,
+                          uint64_t                    *recorded,
+                          uint64_t                    *dropped)
+{
+    *seen     = me->messages_seen;
+    *recorded = me->messages_recorded;
+    *dropped  = me->messages_dropped;
+}
+
+#endif /* T_COSE_ENABLE_CAPTURE */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_CAPTURE_H__ */
@@ -13,6 +13,7 @@
 #define __T_COSE_COMMON_H__
 
 #include <stdint.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -44,6 +45,69 @@ extern "C" {
  *
  * \c T_COSE_DISABLE_CONTENT_TYPE -- Disables the content type
  * parameters for both signing and verifying.
+ *
+ * \c T_COSE_DISABLE_HASH_ENVELOPE -- Disables the COSE Hash Envelope
+ * parameters for both signing and verifying. See t_cose_hash_envelope.h.
+ *
+ * \c T_COSE_ENABLE_HASH_ENVELOPE_FILE -- Enables hashing of files
+ * for COSE Hash Envelope with \c mmap(). This needs POSIX.
+ *
+ * \c T_COSE_DISABLE_PROTECTED_INTERN -- Disables the table of
+ * pre-parsed protected headers used when verifying. See
+ * t_cose_protected_intern.h.
+ *
+ * \c T_COSE_ENABLE_VERIFY_CACHE -- Enables the verification cache
+ * that can be shared between processes. See t_cose_verify_cache.h.
+ * This needs the GCC / Clang \c __atomic builtins.
+ *
+ * \c T_COSE_ENABLE_VERIFY_SNAPSHOT_FILE -- Enables writing and
+ * mapping verification cache snapshots as files. This needs POSIX
+ * file I/O and mmap(). See t_cose_verify_cache.h.
+ *
+ * \c T_COSE_ENABLE_RATE_LIMIT -- Enables per-kid rate limiting of
+ * verification. See t_cose_rate_limit.h. This needs the GCC / Clang
+ * \c __atomic builtins.
+ *
+ * \c T_COSE_ENABLE_BULK_VERIFY -- Enables verification of many files
+ * at once. See t_cose_bulk_verify.h. This needs POSIX threads and file
+ * I/O.
+ *
+ * \c T_COSE_HAVE_LIBURING -- With \c T_COSE_ENABLE_BULK_VERIFY, read
+ * the files with io_uring. This needs liburing 2.2 or later and Linux.
+ *
+ * \c T_COSE_ENABLE_KEY_ARENA -- Enables the arena on huge pages for
+ * large key tables. See t_cose_key_arena.h. This needs \c mmap().
+ *
+ * \c T_COSE_ENABLE_INCREMENTAL_HASH -- Enables hashing of the payload
+ * as it is output when signing. See
+ * t_cose_sign1_encode_parameters_incremental(). This adds about 300
+ * bytes to the signing context.
+ *
+ * \c T_COSE_ENABLE_RESTARTABLE -- Enables restartable (time-sliced)
+ * signing and verification. See \ref t_cose_restart_ctx. This
+ * requires a crypto adapter that supports it, currently only the
+ * Mbed TLS adapter built with \c MBEDTLS_ECP_RESTARTABLE.
+ *
+ * \c T_COSE_ENABLE_SUIT -- Enables verification of SUIT manifests and
+ * their component images. See t_cose_suit.h. This needs POSIX and the
+ * GCC / Clang \c __atomic builtins.
+ *
+ * \c T_COSE_ENABLE_ENCRYPT -- Enables \c COSE_Encrypt with
+ * ECDH-ES key agreement recipients. See t_cose_encrypt.h. This
+ * requires a crypto adapter that supports it, currently only the
+ * OpenSSL adapter.
+ *
+ * \c T_COSE_ENABLE_OSCORE -- Enables OSCORE (RFC 8613) message
+ * protection. See t_cose_oscore.h. This uses the same crypto adapter
+ * functions as \c T_COSE_ENABLE_ENCRYPT.
+ *
+ * \c T_COSE_ENABLE_COST_COUNTERS -- Enables counters of the work done
+ * to verify, for fuzzing and tests. See t_cose_cost.h. The counters
+ * are global and not thread safe.
+ *
+ * \c T_COSE_ENABLE_CAPTURE -- Enables sampled capture of the shape of
+ * the messages t_cose_sign1_verify() sees for replay in benchmarks.
+ * See t_cose_capture.h.
  */
 
 
@@ -88,6 +152,75 @@ extern "C" {
  */
 #define T_COSE_ALGORITHM_ES512 -36
 
+/**
+ * \def T_COSE_ALGORITHM_SHA_256
+ *
+ * \brief Indicates simple SHA-256 hash.
+ *
+ * This is used as the payload hash algorithm of a COSE Hash
+ * Envelope. See t_cose_sign1_set_payload_hash_alg().
+ */
+#define T_COSE_ALGORITHM_SHA_256 -16
+
+/**
+ * \def T_COSE_ALGORITHM_SHA_384
+ *
+ * \brief Indicates simple SHA-384 hash.
+ */
+#define T_COSE_ALGORITHM_SHA_384 -43
+
+/**
+ * \def T_COSE_ALGORITHM_SHA_512
+ *
+ * \brief Indicates simple SHA-512 hash.
+ */
+#define T_COSE_ALGORITHM_SHA_512 -44
+
+/**
+ * \def T_COSE_ALGORITHM_A128GCM
+ *
+ * \brief Indicates AES-GCM with a 128-bit key and 128-bit tag.
+ *
+ * This is a content encryption algorithm for \c COSE_Encrypt. See
+ * t_cose_encrypt.h.
+ */
+#define T_COSE_ALGORITHM_A128GCM 1
+
+/**
+ * \def T_COSE_ALGORITHM_A192GCM
+ *
+ * \brief Indicates AES-GCM with a 192-bit key and 128-bit tag.
+ */
+#define T_COSE_ALGORITHM_A192GCM 2
+
+/**
+ * \def T_COSE_ALGORITHM_A256GCM
+ *
+ * \brief Indicates AES-GCM with a 256-bit key and 128-bit tag.
+ */
+#define T_COSE_ALGORITHM_A256GCM 3
+
+/**
+ * \def T_COSE_ALGORITHM_AES_CCM_16_64_128
+ *
+ * \brief Indicates AES-CCM with a 128-bit key, 64-bit tag and 13-byte
+ * nonce.
+ *
+ * This is the mandatory algorithm of OSCORE. See t_cose_oscore.h.
+ */
+#define T_COSE_ALGORITHM_AES_CCM_16_64_128 10
+
+/**
+ * \def T_COSE_ALGORITHM_ECDH_ES_A128KW
+ *
+ * \brief Indicates ECDH with an ephemeral key, HKDF SHA-256 and
+ * AES key wrap with a 128-bit key.
+ *
+ * This is a recipient algorithm for \c COSE_Encrypt. See
+ * t_cose_encrypt.h.
+ */
+#define T_COSE_ALGORITHM_ECDH_ES_A128KW -29
+
 
 
 
@@ -106,7 +239,10 @@ enum t_cose_crypto_lib_t {
     T_COSE_CRYPTO_LIB_OPENSSL = 1,
      /** \c key_handle is a \c psa_key_handle_t in Arm's Platform Security
       * Architecture */
-    T_COSE_CRYPTO_LIB_PSA = 2
+    T_COSE_CRYPTO_LIB_PSA = 2,
+    /** \c key_ptr points to an Mbed TLS \c mbedtls_ecdsa_context. The
+     * caller owns it and frees it after the operation is done. */
+    T_COSE_CRYPTO_LIB_MBEDTLS = 3
 };
 
 
@@ -317,6 +453,98 @@ enum t_cose_err_t {
     /** Something is wrong with the crit parameter. */
     T_COSE_ERR_CRIT_PARAMETER = 36,
 
+    /** A restartable signing or verification operation has used up
+     * its budget of EC operations for this slice and is not yet
+     * complete. Call the same function again with the same inputs to
+     * continue. See \ref t_cose_restart_ctx. */
+    T_COSE_ERR_SIG_IN_PROGRESS = 37,
+
+    /** The content does not hash to the payload of a COSE Hash
+     * Envelope. See t_cose_hash_envelope.h. */
+    T_COSE_ERR_PAYLOAD_HASH_MISMATCH = 38,
+
+    /** The detached content of a COSE Hash Envelope could not be
+     * opened or read. */
+    T_COSE_ERR_ARTIFACT_ACCESS = 39,
+
+    /** The payload output between
+     * t_cose_sign1_encode_parameters_known_length() and
+     * t_cose_sign1_encode_signature() is not the length that was
+     * given. */
+    T_COSE_ERR_WRONG_PAYLOAD_LENGTH = 40,
+
+    /** The verification scheduler estimates that the request can't
+     * be verified before its deadline, so it was not queued. See
+     * t_cose_verify_sched.h. */
+    T_COSE_ERR_DEADLINE_UNREACHABLE = 41,
+
+    /** The deadline of a queued verification request passed before
+     * it was started. It was not verified. */
+    T_COSE_ERR_DEADLINE_MISSED = 42,
+
+    /** The number of countersignatures is more than
+     * \ref T_COSE_MAX_COUNTERSIGNATURES or not the number of
+     * verifiers given. See t_cose_countersign.h. */
+    T_COSE_ERR_COUNTERSIGNATURE_COUNT = 43,
+
+    /** A SUIT envelope or manifest is not well formed or is missing
+     * a part that is needed. See t_cose_suit.h. */
+    T_COSE_ERR_SUIT_FORMAT = 44,
+
+    /** Work was stopped before it was finished because another part
+     * of the same operation failed. */
+    T_COSE_ERR_ABORTED = 45,
+
+    /** The content encryption or recipient algorithm is not
+     * supported. */
+    T_COSE_ERR_UNSUPPORTED_ENCRYPTION_ALG = 46,
+
+    /** A \c COSE_Encrypt or one of its recipients is not well
+     * formed. See t_cose_encrypt.h. */
+    T_COSE_ERR_ENCRYPT_FORMAT = 47,
+
+    /** Decryption or key unwrap failed. The key is wrong or the
+     * message was modified. */
+    T_COSE_ERR_DECRYPT_FAIL = 48,
+
+    /** An OSCORE option value is not well formed or the security
+     * context doesn't fit in the fixed-size buffers. See
+     * t_cose_oscore.h. */
+    T_COSE_ERR_OSCORE_FORMAT = 49,
+
+    /** The partial IV of a received OSCORE message was already
+     * received or is too old for the replay window. */
+    T_COSE_ERR_REPLAY = 50,
+
+    /** The OSCORE sender sequence number has reached its maximum. A
+     * new security context is needed. */
+    T_COSE_ERR_SEQUENCE_EXHAUSTED = 51,
+
+    /** The number of signers of a \c COSE_Sign is more than
+     * \ref T_COSE_MAX_SIGNERS or not the number of verifiers given.
+     * See t_cose_multi_sign.h. */
+    T_COSE_ERR_SIGNER_COUNT = 52,
+
+    /** A \c COSE_Sign is not well formed. */
+    T_COSE_ERR_SIGN_FORMAT = 53,
+
+    /** A workload capture log is not well formed or is of an
+     * unsupported version. See t_cose_capture.h. */
+    T_COSE_ERR_CAPTURE_FORMAT = 54,
+
+    /** A verification cache snapshot is of another version, truncated
+     * or has the wrong checksum. See t_cose_verify_cache.h. */
+    T_COSE_ERR_SNAPSHOT_FORMAT = 55,
+
+    /** The kid of the message is over its rate. The message was not
+     * verified. See t_cose_rate_limit.h. */
+    T_COSE_ERR_RATE_LIMITED = 56,
+
+    /** The protected parameters of a received \c COSE_Encrypt or of
+     * one of its recipients are larger than \ref
+     * T_COSE_ENCRYPT_MAX_PROTECTED_SIZE. See t_cose_encrypt.h. */
+    T_COSE_ERR_ENCRYPT_PROTECTED_SIZE = 57,
+
 };
 
 
@@ -347,6 +575,74 @@ enum t_cose_err_t {
 #define T_COSE_EMPTY_UINT_CONTENT_TYPE UINT16_MAX+1
 
 
+/**
+ * Size of the buffer for the hash of the to-be-signed bytes in a
+ * prepared signature or verification. This is the size of a SHA-512
+ * hash, the largest used. See t_cose_sign1_sign_prepare() and
+ * t_cose_sign1_verify_prepare().
+ */
+#define T_COSE_PREPARED_MAX_HASH_SIZE 64
+
+
+#ifdef T_COSE_ENABLE_RESTARTABLE
+/**
+ * Context for restartable signing and verification.
+ *
+ * A public key operation such as a P-384 ECDSA verify can take long
+ * enough that it is a problem for a single-threaded event loop. When
+ * one of these is given to t_cose_sign1_sign_set_restart_ctx() or
+ * t_cose_sign1_verify_set_restart_ctx(), the public key operation is
+ * broken into slices of at most \c max_ops basic EC operations. When
+ * a slice ends before the operation is complete \ref
+ * T_COSE_ERR_SIG_IN_PROGRESS is returned and the same call is made
+ * again with exactly the same inputs to continue where it left off.
+ *
+ * The meaning of \c max_ops is that of \c mbedtls_ecp_set_max_ops().
+ * Zero means no limit. Mbed TLS keeps this budget in a process-global
+ * variable, so restartable operations must only be used from one
+ * thread.
+ *
+ * Use t_cose_restart_ctx_init() before first use. If an operation
+ * is abandoned while it is in progress call
+ * t_cose_restart_ctx_abort() to release what the crypto adapter
+ * allocated for it. Nothing needs to be released after an operation
+ * completes, successfully or not.
+ */
+struct t_cose_restart_ctx {
+    /* Private data structure */
+    void     *crypto_ctx; /* Owned by the crypto adapter */
+    uint32_t  max_ops;
+};
+
+
+/**
+ * \brief Initialize a restart context.
+ *
+ * \param[out] restart_ctx  The context to initialize.
+ * \param[in]  max_ops      Maximum basic EC operations per slice.
+ */
+static inline void
+t_cose_restart_ctx_init(struct t_cose_restart_ctx *restart_ctx,
+                        uint32_t                   max_ops)
+{
+    restart_ctx->crypto_ctx = NULL;
+    restart_ctx->max_ops    = max_ops;
+}
+
+
+/**
+ * \brief Abandon an in-progress restartable operation.
+ *
+ * \param[in,out] restart_ctx  The context of the abandoned operation.
+ *
+ * This is only needed when an operation that returned \ref
+ * T_COSE_ERR_SIG_IN_PROGRESS will not be continued.
+ */
+void
+t_cose_restart_ctx_abort(struct t_cose_restart_ctx *restart_ctx);
+#endif /* T_COSE_ENABLE_RESTARTABLE */
+
+
 #ifdef __cplusplus
 }
 #endif
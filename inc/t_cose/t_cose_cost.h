@@ -0,0 +1,141 @@
+/*
+ * t_cose_cost.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef __T_COSE_COST_H__
+#define __T_COSE_COST_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "t_cose/t_cose_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * \file t_cose_cost.h
+ *
+ * \brief Counters of the work done to verify a \c COSE_Sign1.
+ *
+ * Rate limits for untrusted senders have to be sized for the most
+ * CPU one hostile message can cost, not for the average. These
+ * counters measure that cost in units that don't depend on the
+ * machine or the compiler, so they can be used to search for the
+ * worst inputs (see fuzz/t_cose_verify_fuzz.c) and to check in a test
+ * that no input costs more than a budget.
+ *
+ * The work that depends on the input is counted: the CBOR items
+ * decoded in the header parameters, the label comparisons made
+ * checking for critical and duplicate parameters, the bytes hashed
+ * and the public key operations. Decoding the four items of the
+ * \c COSE_Sign1 array, which is always the same, is not.
+ *
+ * This is only available when \c T_COSE_ENABLE_COST_COUNTERS is
+ * defined. The counters are global and not thread safe. They are
+ * for test and fuzzing builds, not for production.
+ */
+
+
+#ifdef T_COSE_ENABLE_COST_COUNTERS
+
+/**
+ * The cost of a public key operation in the units of
+ * t_cose_cost_total(). An ECDSA verification takes about as long as
+ * decoding ten thousand CBOR items.
+ */
+#define T_COSE_COST_PUBLIC_KEY_OP 10000
+
+/**
+ * The number of bytes hashed that cost as much as decoding one CBOR
+ * item in the units of t_cose_cost_total().
+ */
+#define T_COSE_COST_HASH_BYTES_PER_UNIT 4
+
+/**
+ * \brief The most t_cose_cost_total() may be for a \c COSE_Sign1 of
+ * \c len bytes verified without custom parameters.
+ *
+ * Each CBOR item is at least one byte and each byte is hashed at
+ * most once, so a linear parser stays under \c 2 * \c len. The label
+ * lists have at most \ref T_COSE_PARAMETER_LIST_MAX entries of each
+ * type, which bounds the comparisons independent of \c len. A
+ * message over this budget has found work that grows faster than
+ * its size.
+ */
+#define T_COSE_COST_BUDGET(len) \
+    (2 * (uint64_t)(len) + \
+     4 * (uint64_t)T_COSE_PARAMETER_LIST_MAX * (T_COSE_PARAMETER_LIST_MAX + 1) + \
+     T_COSE_COST_PUBLIC_KEY_OP + 64)
+
+
+/**
+ * The counters. Each is incremented by the verification of every
+ * \c COSE_Sign1 until reset.
+ */
+struct t_cose_cost {
+    /** CBOR items decoded in header parameters, including the
+     * contents of unknown and critical parameters */
+    uint64_t cbor_items;
+    /** Unknown parameters added to the unknown label list */
+    uint64_t unknown_parameters;
+    /** Label comparisons in the label lists and custom parameters */
+    uint64_t label_compares;
+    /** Bytes input to hashes */
+    uint64_t hash_bytes;
+    /** Public key and short-circuit signature verifications */
+    uint64_t public_key_ops;
+};
+
+
+/**
+ * The global counters. Use t_cose_cost_reset() and t_cose_cost_get()
+ * rather than this.
+ */
+extern struct t_cose_cost t_cose_cost_counters;
+
+
+/**
+ * \brief Set all the counters to zero.
+ */
+void
+t_cose_cost_reset(void);
+
+
+/**
+ * \brief Get the counters.
+ *
+ * \param[out] cost  The counters since the last reset.
+ */
+void
+t_cose_cost_get(struct t_cose_cost *cost);
+
+
+/**
+ * \brief Combine the counters into one cost.
+ *
+ * \param[in] cost  The counters.
+ *
+ * \return The cost in units of about one CBOR item decode.
+ *
+ * This is what the fuzzer maximizes and what is checked against
+ * \ref T_COSE_COST_BUDGET.
+ */
+uint64_t
+t_cose_cost_total(const struct t_cose_cost *cost);
+
+#endif /* T_COSE_ENABLE_COST_COUNTERS */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_COST_H__ */
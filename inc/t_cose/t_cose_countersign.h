@@ -0,0 +1,173 @@
+/*
+ * t_cose_countersign.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef __T_COSE_COUNTERSIGN_H__
+#define __T_COSE_COUNTERSIGN_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+#include "t_cose/t_cose_sign1_sign.h"
+#include "t_cose/t_cose_sign1_verify.h"
+#include "t_cose/t_cose_parallel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * \file t_cose_countersign.h
+ *
+ * \brief Create and verify countersignatures on a \c COSE_Sign1.
+ *
+ * A countersignature, as defined in [RFC 9338]
+ * (https://tools.ietf.org/html/rfc9338), is a signature by another
+ * party over a \c COSE_Sign1 including its signature. It is carried
+ * in the unprotected header parameters of the \c COSE_Sign1 with
+ * label 11. Adding one doesn't change the protected parameters,
+ * payload or signature so the original signature still verifies.
+ *
+ * A notary or a supply-chain step countersigns the \c COSE_Sign1
+ * it has checked with t_cose_countersign(). A relying party verifies
+ * the signature and all the countersignatures together with
+ * t_cose_countersign_verify().
+ *
+ * The to-be-signed bytes of each signature include the payload, but
+ * prefixed differently. The payload is read once and hashed into all
+ * the hash contexts together, and the public key operations, which
+ * are independent, are handed to a \ref t_cose_parallel_cb to be run
+ * concurrently.
+ *
+ * Only the \c COSE_Countersignature form with a full signature is
+ * supported, not the abbreviated \c COSE_Countersignature0, and only
+ * on a \c COSE_Sign1 with the payload attached.
+ */
+
+
+/**
+ * The largest number of countersignatures on one \c COSE_Sign1 that
+ * can be verified or added to.
+ */
+#ifndef T_COSE_MAX_COUNTERSIGNATURES
+#define T_COSE_MAX_COUNTERSIGNATURES 4
+#endif
+
+
+/**
+ * The verification of one countersignature by
+ * t_cose_countersign_verify().
+ */
+struct t_cose_countersign_verifier {
+    /* -- Input -- */
+    /** Context with the key and options to verify the countersignature */
+    struct t_cose_sign1_verify_ctx *verify_ctx;
+
+    /* -- Outputs -- */
+    /** The kid of the countersignature or \c NULL_Q_USEFUL_BUF_C */
+    struct q_useful_buf_c           kid;
+    /** The result of verifying the countersignature */
+    enum t_cose_err_t               result;
+};
+
+
+/**
+ * \brief Add a countersignature to a \c COSE_Sign1.
+ *
+ * \param[in] countersigner  Signing context with the algorithm, key,
+ *                           kid and options of the countersignature.
+ * \param[in] cose_sign1     The \c COSE_Sign1 to countersign.
+ * \param[in] out_buffer     Buffer for the countersigned \c COSE_Sign1.
+ * \param[out] countersigned The countersigned \c COSE_Sign1.
+ *
+ * \retval T_COSE_ERR_TOO_SMALL                  \c out_buffer is too small.
+ * \retval T_COSE_ERR_COUNTERSIGNATURE_COUNT     There are already
+ *                                               \ref T_COSE_MAX_COUNTERSIGNATURES.
+ * \retval T_COSE_ERR_SIGN1_FORMAT               The \c COSE_Sign1 is not
+ *                                               in a form that can be
+ *                                               countersigned.
+ *
+ * \c countersigner is initialized with t_cose_sign1_sign_init() and
+ * given a key with t_cose_sign1_sign_set_signing_key() as for signing
+ * a \c COSE_Sign1. Only the algorithm, key, kid and
+ * \ref T_COSE_OPT_SHORT_CIRCUIT_SIG are used.
+ *
+ * The \c COSE_Sign1 is not verified. The countersignature is added
+ * to the unprotected header parameters. If there is one already the
+ * two are put in an array. If there is an array it is added to the
+ * end of it.
+ *
+ * The unprotected header parameters must be a map with a definite
+ * length encoded in preferred serialization, as t_cose and most
+ * other implementations do. Everything else is copied unchanged.
+ *
+ * \c out_buffer must not overlap \c cose_sign1.
+ */
+enum t_cose_err_t
+t_cose_countersign(struct t_cose_sign1_sign_ctx *countersigner,
+                   struct q_useful_buf_c         cose_sign1,
+                   struct q_useful_buf           out_buffer,
+                   struct q_useful_buf_c        *countersigned);
+
+
+/**
+ * \brief Verify a \c COSE_Sign1 and its countersignatures.
+ *
+ * \param[in] me                 Context to verify the \c COSE_Sign1.
+ * \param[in] cose_sign1         The \c COSE_Sign1 to verify.
+ * \param[in,out] verifiers      One per countersignature, in the order
+ *                               they are in the \c COSE_Sign1.
+ * \param[in] num_verifiers      Number of \c verifiers.
+ * \param[in] parallel_cb        Runs the public key operations or
+ *                               \c NULL to run them one after another.
+ * \param[in] cb_context         Passed to \c parallel_cb.
+ * \param[out] payload           The payload.
+ * \param[out] parameters        Where to put the parameters of the
+ *                               \c COSE_Sign1 or \c NULL.
+ *
+ * \retval T_COSE_ERR_COUNTERSIGNATURE_COUNT  The number of
+ *                                            countersignatures is not
+ *                                            \c num_verifiers.
+ *
+ * This returns the result of verifying the \c COSE_Sign1 if it
+ * failed, else the result of the first countersignature that failed.
+ * The result of each countersignature is also in its verifier, along
+ * with its kid.
+ *
+ * Pass \c num_verifiers of 0 to require there be no
+ * countersignatures. To find out how many there are and what their
+ * kids are, give \c me the \ref T_COSE_OPT_DECODE_ONLY option and
+ * enough verifiers with a \c verify_ctx of \c NULL. Nothing is
+ * verified, the kid of each countersignature is returned and the
+ * \c result of the verifiers that aren't used is
+ * \ref T_COSE_ERR_COUNTERSIGNATURE_COUNT.
+ *
+ * The \c COSE_Sign1 and countersignatures are verified with
+ * t_cose_sign1_verify_complete() so short-circuit signatures, the
+ * verification cache and key lookup by kid work as they do for
+ * t_cose_sign1_verify().
+ */
+enum t_cose_err_t
+t_cose_countersign_verify(struct t_cose_sign1_verify_ctx     *me,
+                          struct q_useful_buf_c               cose_sign1,
+                          struct t_cose_countersign_verifier *verifiers,
+                          size_t                              num_verifiers,
+                          t_cose_parallel_cb                  parallel_cb,
+                          void                               *cb_context,
+                          struct q_useful_buf_c              *payload,
+                          struct t_cose_parameters           *parameters);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_COUNTERSIGN_H__ */
@@ -0,0 +1,291 @@
+/*
+ * t_cose_encrypt.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef __T_COSE_ENCRYPT_H__
+#define __T_COSE_ENCRYPT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+#include "t_cose/t_cose_parallel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * \file t_cose_encrypt.h
+ *
+ * \brief Encrypt and decrypt a \c COSE_Encrypt for many recipients.
+ *
+ * A \c COSE_Encrypt ([RFC 9052](https://tools.ietf.org/html/rfc9052)
+ * section 5.1) has the content encrypted once with a random content
+ * encryption key (CEK) and a list of recipients. Each recipient
+ * carries the CEK wrapped for one recipient key. This is the way to
+ * send the same content, such as a configuration, to many devices.
+ *
+ * t_cose_encrypt() encrypts the content once with AES-GCM. For each
+ * recipient it generates an ephemeral key, does ECDH with the
+ * recipient's public key, derives a key encryption key with HKDF
+ * SHA-256 and wraps the CEK with AES key wrap
+ * (\ref T_COSE_ALGORITHM_ECDH_ES_A128KW). The recipients are
+ * independent and are handed to a \ref t_cose_parallel_cb to be run
+ * concurrently. The recipient public keys are loaded by the caller
+ * once and reused for every message.
+ *
+ * t_cose_decrypt() looks for the recipient with its kid. The kid of
+ * each recipient is compared as the message is decoded, which is
+ * cheap, and the key agreement and unwrap are done only for the
+ * recipient that matches. It is not necessary to try every
+ * recipient.
+ *
+ * The recipients must all be ECDH-ES on NIST curves and at the top
+ * level. Nested recipients, HPKE, external AAD and detached content
+ * are not supported.
+ *
+ * This is only available when \c T_COSE_ENABLE_ENCRYPT is defined.
+ */
+
+
+#ifdef T_COSE_ENABLE_ENCRYPT
+
+/** Size of the largest ephemeral public key, an uncompressed P-521 point */
+#define T_COSE_ENCRYPT_MAX_POINT_SIZE 133
+
+/** Size of the largest wrapped CEK, a 256-bit key plus 8 bytes */
+#define T_COSE_ENCRYPT_MAX_WRAPPED_SIZE (32 + 8)
+
+/** Size of the largest CEK */
+#define T_COSE_ENCRYPT_MAX_CEK_SIZE 32
+
+/**
+ * The largest encoded protected parameters of a received \c
+ * COSE_Encrypt or recipient. The AAD and the KDF context that contain
+ * them are made in buffers on the stack of a little more than this.
+ * It may be increased up to 65535.
+ */
+#ifndef T_COSE_ENCRYPT_MAX_PROTECTED_SIZE
+#define T_COSE_ENCRYPT_MAX_PROTECTED_SIZE 128
+#endif
+
+
+struct t_cose_encrypt_ctx;
+
+
+/**
+ * One recipient of a \c COSE_Encrypt made by t_cose_encrypt().
+ *
+ * The output fields are used by t_cose_encrypt() for each recipient
+ * so there is no limit on the number of recipients and no allocation.
+ */
+struct t_cose_encrypt_recipient {
+    /* -- Input -- */
+    /** The public key of the recipient */
+    struct t_cose_key               public_key;
+    /** The kid of \c public_key or \c NULL_Q_USEFUL_BUF_C */
+    struct q_useful_buf_c           kid;
+
+    /* -- Output -- */
+    /** The result of the key agreement and key wrap */
+    enum t_cose_err_t               result;
+
+    /* Private data */
+    const struct t_cose_encrypt_ctx *encrypt_ctx;
+    uint8_t                         ephemeral_point[T_COSE_ENCRYPT_MAX_POINT_SIZE];
+    size_t                          ephemeral_point_len;
+    uint8_t                         wrapped_cek[T_COSE_ENCRYPT_MAX_WRAPPED_SIZE];
+    size_t                          wrapped_cek_len;
+};
+
+
+/**
+ * Context for creating a \c COSE_Encrypt.
+ */
+struct t_cose_encrypt_ctx {
+    /* Private data structure */
+    int32_t               content_alg_id;
+    int32_t               recipient_alg_id;
+    t_cose_parallel_cb    parallel_cb;
+    void                 *cb_context;
+    uint8_t               cek[T_COSE_ENCRYPT_MAX_CEK_SIZE];
+    size_t                cek_len;
+    struct q_useful_buf_c kdf_context;
+};
+
+
+/**
+ * Context for decrypting a \c COSE_Encrypt.
+ */
+struct t_cose_decrypt_ctx {
+    /* Private data structure */
+    struct t_cose_key     private_key;
+    struct q_useful_buf_c kid;
+};
+
+
+/**
+ * \brief Initialize to make a \c COSE_Encrypt.
+ *
+ * \param[in] me                The context to initialize.
+ * \param[in] content_alg_id    \ref T_COSE_ALGORITHM_A128GCM,
+ *                              \ref T_COSE_ALGORITHM_A192GCM or
+ *                              \ref T_COSE_ALGORITHM_A256GCM.
+ * \param[in] recipient_alg_id  \ref T_COSE_ALGORITHM_ECDH_ES_A128KW.
+ *
+ * The algorithms are checked by t_cose_encrypt().
+ */
+void
+t_cose_encrypt_init(struct t_cose_encrypt_ctx *me,
+                    int32_t                    content_alg_id,
+                    int32_t                    recipient_alg_id);
+
+
+/**
+ * \brief Set how the recipients are run.
+ *
+ * \param[in] me           The context.
+ * \param[in] parallel_cb  Runs the key agreement and key wrap of each
+ *                         recipient. \c NULL, the default, runs them
+ *                         one after another.
+ * \param[in] cb_context   Passed to \c parallel_cb.
+ */
+static void
+t_cose_encrypt_set_parallel(struct t_cose_encrypt_ctx *me,
+                            t_cose_parallel_cb         parallel_cb,
+                            void                      *cb_context);
+
+
+/**
+ * \brief Encrypt content for a list of recipients.
+ *
+ * \param[in] me              The context.
+ * \param[in] plaintext       The content to encrypt.
+ * \param[in,out] recipients  The recipients. The \c result of each is
+ *                            set.
+ * \param[in] num_recipients  Number of \c recipients. Must be at
+ *                            least one.
+ * \param[in] out_buffer      Buffer for the \c COSE_Encrypt.
+ * \param[out] cose_encrypt   The tagged \c COSE_Encrypt.
+ *
+ * \retval T_COSE_ERR_UNSUPPORTED_ENCRYPTION_ALG
+ *         An algorithm is not supported.
+ * \retval T_COSE_ERR_TOO_SMALL
+ *         \c out_buffer is too small.
+ *
+ * If any recipient fails, its error is returned and there is no
+ * \c COSE_Encrypt. The \c result of each recipient tells which.
+ *
+ * The size of the output is about the size of \c plaintext plus 20
+ * bytes plus, for P-256, about 110 bytes and the kid per recipient.
+ */
+enum t_cose_err_t
+t_cose_encrypt(struct t_cose_encrypt_ctx       *me,
+               struct q_useful_buf_c            plaintext,
+               struct t_cose_encrypt_recipient *recipients,
+               size_t                           num_recipients,
+               struct q_useful_buf              out_buffer,
+               struct q_useful_buf_c           *cose_encrypt);
+
+
+/**
+ * \brief Initialize to decrypt a \c COSE_Encrypt.
+ *
+ * \param[in] me  The context to initialize.
+ */
+static void
+t_cose_decrypt_init(struct t_cose_decrypt_ctx *me);
+
+
+/**
+ * \brief Set the private key and kid to decrypt with.
+ *
+ * \param[in] me           The context.
+ * \param[in] private_key  The private key of this recipient.
+ * \param[in] kid          The kid the recipient entry has. Must not
+ *                         be \c NULL_Q_USEFUL_BUF_C.
+ */
+static void
+t_cose_decrypt_set_private_key(struct t_cose_decrypt_ctx *me,
+                               struct t_cose_key          private_key,
+                               struct q_useful_buf_c      kid);
+
+
+/**
+ * \brief Decrypt a \c COSE_Encrypt.
+ *
+ * \param[in] me                The context.
+ * \param[in] cose_encrypt      The \c COSE_Encrypt, tagged or not.
+ * \param[in] plaintext_buffer  Buffer for the content.
+ * \param[out] plaintext        The content.
+ *
+ * \retval T_COSE_ERR_UNKNOWN_KEY
+ *         No recipient has the kid.
+ * \retval T_COSE_ERR_DECRYPT_FAIL
+ *         The key is wrong or the message was modified.
+ * \retval T_COSE_ERR_ENCRYPT_FORMAT
+ *         The message or the recipient is not well formed.
+ * \retval T_COSE_ERR_UNSUPPORTED_ENCRYPTION_ALG
+ *         An algorithm is not supported.
+ * \retval T_COSE_ERR_ENCRYPT_PROTECTED_SIZE
+ *         The protected parameters of the message or the recipient
+ *         are larger than \ref T_COSE_ENCRYPT_MAX_PROTECTED_SIZE.
+ *
+ * Decoding stops at the first recipient with the kid. The recipients
+ * after it are not checked to be well formed.
+ */
+enum t_cose_err_t
+t_cose_decrypt(struct t_cose_decrypt_ctx *me,
+               struct q_useful_buf_c      cose_encrypt,
+               struct q_useful_buf        plaintext_buffer,
+               struct q_useful_buf_c     *plaintext);
+
+
+
+
+/* ------------------------------------------------------------------------
+ * Inline implementations of public functions defined above.
+ */
+static inline void
+t_cose_encrypt_set_parallel(struct t_cose_encrypt_ctx *me,
+                            t_cose_parallel_cb         parallel_cb,
+                            void                      *cb_context)
+{
+    me->parallel_cb = parallel_cb;
+    me->cb_context  = cb_context;
+}
+
+
+static inline void
+t_cose_decrypt_init(struct t_cose_decrypt_ctx *me)
+{
+    memset(me, 0, sizeof(*me));
+}
+
+
+static inline void
+t_cose_decrypt_set_private_key(struct t_cose_decrypt_ctx *me,
+                               struct t_cose_key          private_key,
+                               struct q_useful_buf_c      kid)
+{
+    me->private_key = private_key;
+    me->kid         = kid;
+}
+
+#endif /* T_COSE_ENABLE_ENCRYPT */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_ENCRYPT_H__ */
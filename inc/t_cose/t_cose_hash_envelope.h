@@ -0,0 +1,159 @@
+/*
+ * t_cose_hash_envelope.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef __T_COSE_HASH_ENVELOPE_H__
+#define __T_COSE_HASH_ENVELOPE_H__
+
+#include <stdint.h>
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+#include "t_cose/t_cose_sign1_verify.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * \file t_cose_hash_envelope.h
+ *
+ * \brief Hashing of content for COSE Hash Envelope.
+ *
+ * A COSE Hash Envelope is a \c COSE_Sign1 whose payload is the hash
+ * of the content rather than the content itself. The hash algorithm
+ * is given in the protected \c payload_hash_alg parameter. See
+ * draft-ietf-cose-hash-envelope.
+ *
+ * This is useful when the content is large, for example a multi-GB
+ * build artifact. The content is hashed once, perhaps by a build
+ * system that already has to read it, and then signing and
+ * verification of the \c COSE_Sign1 take the same time no matter how
+ * large the content is. The content is usually detached and carried
+ * or stored separately.
+ *
+ * To sign:
+ *  - Hash the content with t_cose_hash_envelope_compute() or
+ *    t_cose_hash_envelope_compute_file(), or use a hash computed
+ *    elsewhere.
+ *  - Call t_cose_sign1_set_payload_hash_alg() and optionally
+ *    t_cose_sign1_set_preimage_content_type_uint() or _tstr() and
+ *    t_cose_sign1_set_payload_location().
+ *  - Call t_cose_sign1_sign() with the hash as the payload.
+ *
+ * To verify:
+ *  - Call t_cose_sign1_verify() as usual. This verifies the
+ *    signature over the hash.
+ *  - Call t_cose_hash_envelope_check() or
+ *    t_cose_hash_envelope_check_file() with the returned parameters
+ *    and payload to check the content against the hash.
+ *
+ * These use the hash functions of the crypto adapter, so only the
+ * hash algorithms it supports can be used. The test crypto adapter
+ * only supports SHA-256.
+ *
+ * The file functions map the file in windows with \c mmap() so that
+ * very large files can be hashed with a bounded amount of address
+ * space. They need POSIX and are only available when \c
+ * T_COSE_ENABLE_HASH_ENVELOPE_FILE is defined.
+ */
+
+
+#ifndef T_COSE_DISABLE_HASH_ENVELOPE
+
+/**
+ * \brief Hash content for a COSE Hash Envelope.
+ *
+ * \param[in] payload_hash_alg_id  The hash algorithm, for example
+ *                                 \ref T_COSE_ALGORITHM_SHA_256.
+ * \param[in] content              The content to hash.
+ * \param[in] buffer_for_hash      Buffer to put the hash in. It must
+ *                                 be at least the size of the hash.
+ * \param[out] hash                The hash, to be used as the payload.
+ *
+ * \retval T_COSE_ERR_UNSUPPORTED_HASH   The hash algorithm is not supported.
+ * \retval T_COSE_ERR_HASH_BUFFER_SIZE   \c buffer_for_hash is too small.
+ * \retval T_COSE_ERR_HASH_GENERAL_FAIL  The hash failed.
+ */
+enum t_cose_err_t
+t_cose_hash_envelope_compute(int32_t                payload_hash_alg_id,
+                             struct q_useful_buf_c  content,
+                             struct q_useful_buf    buffer_for_hash,
+                             struct q_useful_buf_c *hash);
+
+
+/**
+ * \brief Check content against a verified COSE Hash Envelope.
+ *
+ * \param[in] parameters  The parameters returned by t_cose_sign1_verify().
+ * \param[in] payload     The payload returned by t_cose_sign1_verify().
+ * \param[in] content     The content to check.
+ *
+ * \retval T_COSE_SUCCESS                    The content hashes to \c payload.
+ * \retval T_COSE_ERR_PAYLOAD_HASH_MISMATCH  It doesn't.
+ * \retval T_COSE_ERR_UNSUPPORTED_HASH       The \c COSE_Sign1 is not a
+ *                                           hash envelope or the hash
+ *                                           algorithm is not supported.
+ *
+ * This only makes sense after t_cose_sign1_verify() has succeeded.
+ */
+enum t_cose_err_t
+t_cose_hash_envelope_check(const struct t_cose_parameters *parameters,
+                           struct q_useful_buf_c           payload,
+                           struct q_useful_buf_c           content);
+
+
+#ifdef T_COSE_ENABLE_HASH_ENVELOPE_FILE
+/**
+ * \brief Hash a file for a COSE Hash Envelope.
+ *
+ * \param[in] payload_hash_alg_id  The hash algorithm.
+ * \param[in] path                 Path of the file to hash.
+ * \param[in] buffer_for_hash      Buffer to put the hash in.
+ * \param[out] hash                The hash, to be used as the payload.
+ *
+ * \retval T_COSE_ERR_ARTIFACT_ACCESS  The file could not be opened or read.
+ *
+ * Other errors are as for t_cose_hash_envelope_compute().
+ *
+ * Regular files are mapped and hashed a window at a time. Other files
+ * such as pipes are read.
+ */
+enum t_cose_err_t
+t_cose_hash_envelope_compute_file(int32_t                payload_hash_alg_id,
+                                  const char            *path,
+                                  struct q_useful_buf    buffer_for_hash,
+                                  struct q_useful_buf_c *hash);
+
+
+/**
+ * \brief Check a file against a verified COSE Hash Envelope.
+ *
+ * \param[in] parameters  The parameters returned by t_cose_sign1_verify().
+ * \param[in] payload     The payload returned by t_cose_sign1_verify().
+ * \param[in] path        Path of the file to check.
+ *
+ * \retval T_COSE_ERR_ARTIFACT_ACCESS  The file could not be opened or read.
+ *
+ * Other errors are as for t_cose_hash_envelope_check().
+ */
+enum t_cose_err_t
+t_cose_hash_envelope_check_file(const struct t_cose_parameters *parameters,
+                                struct q_useful_buf_c           payload,
+                                const char                     *path);
+#endif /* T_COSE_ENABLE_HASH_ENVELOPE_FILE */
+
+#endif /* T_COSE_DISABLE_HASH_ENVELOPE */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_HASH_ENVELOPE_H__ */
@@ -0,0 +1,223 @@
+/*
+ *  t_cose_key_arena.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef __T_COSE_KEY_ARENA_H__
+#define __T_COSE_KEY_ARENA_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * \file t_cose_key_arena.h
+ *
+ * \brief Memory on huge pages for large key tables.
+ *
+ * With hundreds of thousands of keys, each lookup in a key table, such
+ * as the entries of a \ref t_cose_key_index or the slots of a
+ * verification cache or rate limiter, lands on a different 4KB page.
+ * The TLB can only hold a few thousand of those, so most lookups also
+ * miss in the TLB and wait for a page table walk. On 2MB pages the
+ * same table needs a few hundred TLB entries.
+ *
+ * An arena is one mapping, made once, from which tables are allocated
+ * with t_cose_key_arena_alloc(). It is backed by the first of these
+ * that works:
+ *
+ *  - Reserved huge pages with \c MAP_HUGETLB. These are only there if
+ *    the administrator has set aside some, for example in
+ *    \c /proc/sys/vm/nr_hugepages.
+ *  - Ordinary memory aligned to 2MB and marked with
+ *    \c madvise(MADV_HUGEPAGE), so the kernel uses transparent huge
+ *    pages when it can.
+ *  - Ordinary memory.
+ *
+ * Each allocation starts on a cache line, \ref T_COSE_KEY_ARENA_ALIGN
+ * bytes, so the first entry of a table doesn't share a line with
+ * another table. There is no free of one allocation. To load a new
+ * set of keys, t_cose_key_arena_reset() frees all the allocations at
+ * once and keeps the memory for the tables of the new set. When keys
+ * are reloaded while other threads are still verifying, use two
+ * arenas, one for the old set and one for the new.
+ *
+ * The mapping of memory is the only system dependency. This is only
+ * available when \c T_COSE_ENABLE_KEY_ARENA is defined.
+ *
+ * Use:
+ *  - Call t_cose_key_arena_init() with the most memory all the tables
+ *    for one set of keys will need.
+ *  - Call t_cose_key_arena_alloc() for each table and give it to
+ *    t_cose_key_index_init(), t_cose_verify_cache_format(),
+ *    t_cose_rate_limit_init() or the like.
+ *  - On reload, stop using the tables, call t_cose_key_arena_reset()
+ *    and allocate them again.
+ *  - Call t_cose_key_arena_free() when done.
+ */
+
+
+#ifdef T_COSE_ENABLE_KEY_ARENA
+
+/** Alignment of each allocation, the size of a cache line */
+#define T_COSE_KEY_ARENA_ALIGN 64
+
+/** The size of the huge pages asked for */
+#define T_COSE_KEY_ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+
+/** Option for t_cose_key_arena_init() to not try reserved huge pages */
+#define T_COSE_KEY_ARENA_OPT_NO_HUGETLB     0x01
+
+/** Option for t_cose_key_arena_init() to use only ordinary pages. For
+ * comparison in benchmarks. */
+#define T_COSE_KEY_ARENA_OPT_NO_HUGE_PAGES  0x02
+
+
+/**
+ * What the memory of an arena is backed by.
+ */
+enum t_cose_key_arena_backing {
+    /** Reserved huge pages from \c MAP_HUGETLB */
+    T_COSE_KEY_ARENA_HUGETLB = 0,
+    /** Marked for transparent huge pages. The kernel may still use
+     * ordinary pages for some or all of it. */
+    T_COSE_KEY_ARENA_TRANSPARENT = 1,
+    /** Ordinary pages */
+    T_COSE_KEY_ARENA_SMALL_PAGES = 2
+};
+
+
+/**
+ * How much of an arena is in use.
+ */
+struct t_cose_key_arena_stats {
+    /** Bytes that can be allocated */
+    size_t                        capacity;
+    /** Bytes allocated since the last reset, including alignment */
+    size_t                        used;
+    /** The most \c used has been */
+    size_t                        high_water;
+    /** Number of t_cose_key_arena_reset() */
+    uint32_t                      resets;
+    /** What the memory is backed by */
+    enum t_cose_key_arena_backing backing;
+};
+
+
+/**
+ * An arena. The members are private.
+ */
+struct t_cose_key_arena {
+    /* Private data structure */
+    uint8_t                      *base;
+    /* What was mapped, which may start before base */
+    void                         *mapping;
+    size_t                        mapping_len;
+    struct t_cose_key_arena_stats stats;
+};
+
+
+/**
+ * \brief Make an arena.
+ *
+ * \param[out] arena     The arena.
+ * \param[in] capacity   Bytes needed. It is rounded up to a whole
+ *                       number of huge pages.
+ * \param[in] options    \ref T_COSE_KEY_ARENA_OPT_NO_HUGETLB and
+ *                       \ref T_COSE_KEY_ARENA_OPT_NO_HUGE_PAGES or 0.
+ *
+ * \retval T_COSE_ERR_INVALID_ARGUMENT    \c capacity is 0 or too big.
+ * \retval T_COSE_ERR_INSUFFICIENT_MEMORY The memory couldn't be mapped.
+ *
+ * The memory is mapped here but only takes up physical memory when
+ * it is first written. Not being able to get huge pages is not an
+ * error. See the \c backing in t_cose_key_arena_get_stats().
+ */
+enum t_cose_err_t
+t_cose_key_arena_init(struct t_cose_key_arena *arena,
+                      size_t                   capacity,
+                      uint32_t                 options);
+
+
+/**
+ * \brief Allocate from an arena.
+ *
+ * \param[in] arena  The arena.
+ * \param[in] size   Bytes needed.
+ *
+ * \return The memory, starting on a cache line, or \c NULL_Q_USEFUL_BUF
+ *         if the arena doesn't have \c size bytes left.
+ *
+ * The memory is zero the first time it is allocated but not after
+ * t_cose_key_arena_reset(). It is valid until the next reset. This is
+ * not thread-safe.
+ */
+struct q_useful_buf
+t_cose_key_arena_alloc(struct t_cose_key_arena *arena, size_t size);
+
+
+/**
+ * \brief Free all the allocations in an arena at once.
+ *
+ * \param[in] arena  The arena.
+ *
+ * The memory stays mapped, and on huge pages if it was, for the
+ * tables of the next set of keys. Nothing allocated before this may
+ * be used after it.
+ */
+void
+t_cose_key_arena_reset(struct t_cose_key_arena *arena);
+
+
+/**
+ * \brief Unmap an arena.
+ *
+ * \param[in] arena  The arena.
+ */
+void
+t_cose_key_arena_free(struct t_cose_key_arena *arena);
+
+
+/**
+ * \brief Get how much of an arena is used and what backs it.
+ *
+ * \param[in] arena  The arena.
+ *
+ * \return The stats.
+ */
+static inline const struct t_cose_key_arena_stats *
+t_cose_key_arena_get_stats(const struct t_cose_key_arena *arena);
+
+
+
+
+/* ------------------------------------------------------------------------
+ * Inline implementations of public functions defined above.
+ */
+static inline const struct t_cose_key_arena_stats *
+t_cose_key_arena_get_stats(const struct t_cose_key_arena *arena)
+{
+    return &(arena->stats);
+}
+
+#endif /* T_COSE_ENABLE_KEY_ARENA */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_KEY_ARENA_H__ */
@@ -0,0 +1,194 @@
+/*
+ * t_cose_key_index.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef __T_COSE_KEY_INDEX_H__
+#define __T_COSE_KEY_INDEX_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+#include "t_cose/t_cose_sign1_verify.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * \file t_cose_key_index.h
+ *
+ * \brief Find the signer of a \c COSE_Sign1 that has no kid.
+ *
+ * When a \c COSE_Sign1 has no kid, the only way to find which of
+ * many keys signed it is usually to try to verify with each in turn.
+ * That is one EC verify per registered key.
+ *
+ * ECDSA allows the public key to be recovered from the signature and
+ * the hash that was signed. There are two candidates, one for each
+ * parity of the y coordinate of the point R. Each candidate is looked
+ * up in an index of the registered public keys. A candidate that is
+ * found is the signer and the signature is valid, as the recovered
+ * key always verifies the signature it was recovered from. The cost
+ * is at most two EC operations and two hash table lookups no matter
+ * how many keys are registered.
+ *
+ * The index is an open-addressed hash table in memory supplied by the
+ * caller. The hash is taken from the x coordinate of the public
+ * point, which is already uniformly distributed. Keys can be added,
+ * but not removed; to remove a key, initialize and fill a new index.
+ *
+ * With a great many keys, put the entries on huge pages with
+ * t_cose_key_arena_alloc() to avoid a TLB miss on most lookups.
+ *
+ * Only the OpenSSL crypto adapter implements key recovery. This is
+ * only available when \c T_COSE_ENABLE_KEY_RECOVERY is defined.
+ *
+ * Use:
+ *  - Call t_cose_key_index_init() with an array of entries about
+ *    twice the number of keys.
+ *  - Call t_cose_key_index_add() for each key.
+ *  - Call t_cose_sign1_verify_recover_signer() instead of
+ *    t_cose_sign1_verify() for messages without a kid.
+ */
+
+
+#ifdef T_COSE_ENABLE_KEY_RECOVERY
+
+/**
+ * The size of the largest uncompressed public point, 0x04 followed
+ * by x and y. This depends on the largest curve enabled.
+ */
+#ifndef T_COSE_DISABLE_ES512
+#define T_COSE_KEY_INDEX_MAX_POINT_SIZE (1 + 2 * 66)
+#elif !defined(T_COSE_DISABLE_ES384)
+#define T_COSE_KEY_INDEX_MAX_POINT_SIZE (1 + 2 * 48)
+#else
+#define T_COSE_KEY_INDEX_MAX_POINT_SIZE (1 + 2 * 32)
+#endif
+
+
+/**
+ * An entry in the index. The caller supplies an array of these to
+ * t_cose_key_index_init(), but shouldn't access them directly.
+ */
+struct t_cose_key_index_entry {
+    /* Private data structure */
+    /* The point goes last so its length and the start of its x
+     * coordinate are near the front. A probe of an entry that
+     * doesn't match then usually reads only one cache line. */
+    struct t_cose_key key;
+    /* Zero for an empty entry */
+    uint8_t           public_point_len;
+    uint8_t           public_point[T_COSE_KEY_INDEX_MAX_POINT_SIZE];
+};
+
+
+/**
+ * The index of public keys.
+ */
+struct t_cose_key_index {
+    /* Private data structure */
+    struct t_cose_key_index_entry *entries;
+    size_t                         num_entries;
+    size_t                         num_keys;
+};
+
+
+/**
+ * \brief Initialize an empty key index.
+ *
+ * \param[out] index        The index.
+ * \param[in] entries       Array for the entries.
+ * \param[in] num_entries   Number of \c entries. At least one more
+ *                          than the number of keys to be added. Twice
+ *                          the number of keys keeps lookups short.
+ *
+ * \c entries must stay valid while the index is used.
+ */
+void
+t_cose_key_index_init(struct t_cose_key_index       *index,
+                      struct t_cose_key_index_entry *entries,
+                      size_t                         num_entries);
+
+
+/**
+ * \brief Add a public key to the index.
+ *
+ * \param[in] index  The index.
+ * \param[in] key    The key. Only its public part is used.
+ *
+ * \retval T_COSE_ERR_TOO_SMALL  The index is full.
+ *
+ * Other errors are from the crypto adapter for a key that is not
+ * usable. Adding a key that is already in the index succeeds and does
+ * nothing. \c key is returned by t_cose_sign1_verify_recover_signer()
+ * as it is, so it must stay valid while the index is used.
+ */
+enum t_cose_err_t
+t_cose_key_index_add(struct t_cose_key_index *index,
+                     struct t_cose_key        key);
+
+
+/**
+ * \brief Look up a public point in the index.
+ *
+ * \param[in] index         The index.
+ * \param[in] public_point  Uncompressed SEC1 public point.
+ * \param[out] key          The key that was added with that point.
+ *
+ * \return \c true if found.
+ */
+bool
+t_cose_key_index_find(const struct t_cose_key_index *index,
+                      struct q_useful_buf_c          public_point,
+                      struct t_cose_key             *key);
+
+
+/**
+ * \brief Verify a \c COSE_Sign1 by recovering its signer.
+ *
+ * \param[in] context      The t_cose signature verification context.
+ *                         Its options and custom parameters are used,
+ *                         but not its verification key.
+ * \param[in] index        The keys that may have signed.
+ * \param[in] sign1        The \c COSE_Sign1 to verify.
+ * \param[out] payload     Pointer and length of the payload.
+ * \param[out] parameters  Place to return parsed parameters. Maybe be \c NULL.
+ * \param[out] signer      The key in \c index that signed.
+ *
+ * \retval T_COSE_ERR_UNKNOWN_KEY  No key in \c index verifies the
+ *                                 signature. Either it was signed by
+ *                                 another key or it was modified.
+ *
+ * Other errors are as for t_cose_sign1_verify().
+ *
+ * The kid, if any, is ignored. The verification cache and restart
+ * context are not used. Short-circuit signatures can't be verified
+ * this way. With \ref T_COSE_OPT_DECODE_ONLY nothing is verified and
+ * \c signer is not set.
+ */
+enum t_cose_err_t
+t_cose_sign1_verify_recover_signer(struct t_cose_sign1_verify_ctx *context,
+                                   const struct t_cose_key_index  *index,
+                                   struct q_useful_buf_c           sign1,
+                                   struct q_useful_buf_c          *payload,
+                                   struct t_cose_parameters       *parameters,
+                                   struct t_cose_key              *signer);
+
+#endif /* T_COSE_ENABLE_KEY_RECOVERY */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_KEY_INDEX_H__ */
@@ -0,0 +1,178 @@
+/*
+ * t_cose_multi_sign.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef __T_COSE_MULTI_SIGN_H__
+#define __T_COSE_MULTI_SIGN_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+#include "t_cose/t_cose_sign1_sign.h"
+#include "t_cose/t_cose_sign1_verify.h"
+#include "t_cose/t_cose_parallel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * \file t_cose_multi_sign.h
+ *
+ * \brief Create and verify a \c COSE_Sign with several signers.
+ *
+ * A \c COSE_Sign ([RFC 9052](https://tools.ietf.org/html/rfc9052)
+ * section 4.1) carries one payload and a signature from each of
+ * several signers. This is how a token is signed with both a
+ * classical and a post-quantum algorithm during a migration, or by
+ * two parties at once. t_cose_multi_sign_verify() requires every
+ * signature to verify, so a relying party that trusts either
+ * algorithm is protected.
+ *
+ * Making two \c COSE_Sign1 one after another reads the payload twice
+ * and does the two public key operations one after another. Here the
+ * payload is read once, a chunk at a time into the hash of every
+ * signer, and the public key operations are handed to a
+ * \ref t_cose_parallel_cb to run concurrently. Signing or verifying
+ * with two algorithms then takes about as long as the slower one.
+ *
+ * Each signer has its own protected parameters with its algorithm
+ * ID, so each has its own to-be-signed bytes and its own hash even
+ * when the hash algorithm is the same. Only the payload is shared.
+ *
+ * Any signing algorithm supported by the crypto adapter can be used
+ * for any signer. The body of the \c COSE_Sign made here has no
+ * header parameters. Each signer has its algorithm ID in its
+ * protected parameters and its kid, if any, in its unprotected
+ * parameters. Detached payloads and external AAD are not supported.
+ */
+
+
+/**
+ * The largest number of signers of one \c COSE_Sign that can be made
+ * or verified.
+ */
+#ifndef T_COSE_MAX_SIGNERS
+#define T_COSE_MAX_SIGNERS 4
+#endif
+
+
+/**
+ * One signer of a \c COSE_Sign made by t_cose_multi_sign().
+ */
+struct t_cose_multi_signer {
+    /* -- Input -- */
+    /** Context with the algorithm, key, kid and options of the signer */
+    const struct t_cose_sign1_sign_ctx *sign_ctx;
+
+    /* -- Output -- */
+    /** The result of signing */
+    enum t_cose_err_t                   result;
+};
+
+
+/**
+ * One signer of a \c COSE_Sign verified by t_cose_multi_sign_verify().
+ */
+struct t_cose_multi_verifier {
+    /* -- Input -- */
+    /** Context with the key and options to verify the signature */
+    const struct t_cose_sign1_verify_ctx *verify_ctx;
+
+    /* -- Outputs -- */
+    /** The algorithm of the signature */
+    int32_t                               cose_algorithm_id;
+    /** The kid of the signer or \c NULL_Q_USEFUL_BUF_C */
+    struct q_useful_buf_c                 kid;
+    /** The result of verifying the signature */
+    enum t_cose_err_t                     result;
+};
+
+
+/**
+ * \brief Make a \c COSE_Sign with several signers.
+ *
+ * \param[in,out] signers    The signers in the order their signatures
+ *                           are output. The \c result of each is set.
+ * \param[in] num_signers    Number of \c signers, 1 to
+ *                           \ref T_COSE_MAX_SIGNERS.
+ * \param[in] payload        The payload.
+ * \param[in] parallel_cb    Runs the signing of each signer or \c NULL
+ *                           to run them one after another.
+ * \param[in] cb_context     Passed to \c parallel_cb.
+ * \param[in] out_buffer     Buffer for the \c COSE_Sign.
+ * \param[out] cose_sign     The tagged \c COSE_Sign.
+ *
+ * \retval T_COSE_ERR_SIGNER_COUNT  \c num_signers is 0 or too many.
+ * \retval T_COSE_ERR_TOO_SMALL     \c out_buffer is too small.
+ *
+ * Each \c sign_ctx is made with t_cose_sign1_sign_init() and
+ * t_cose_sign1_sign_set_signing_key() as for a \c COSE_Sign1. Only
+ * the algorithm, key, kid and \ref T_COSE_OPT_SHORT_CIRCUIT_SIG are
+ * used. Restartable signing is not supported. If any signer fails its
+ * error is returned and there is no \c COSE_Sign.
+ */
+enum t_cose_err_t
+t_cose_multi_sign(struct t_cose_multi_signer *signers,
+                  size_t                      num_signers,
+                  struct q_useful_buf_c       payload,
+                  t_cose_parallel_cb          parallel_cb,
+                  void                       *cb_context,
+                  struct q_useful_buf         out_buffer,
+                  struct q_useful_buf_c      *cose_sign);
+
+
+/**
+ * \brief Verify all the signatures of a \c COSE_Sign.
+ *
+ * \param[in] option_flags    \ref T_COSE_OPT_DECODE_ONLY to only
+ *                            decode, else 0.
+ * \param[in] cose_sign       The \c COSE_Sign, tagged or not.
+ * \param[in,out] verifiers   One per signer, in the order of the
+ *                            signatures in the \c COSE_Sign.
+ * \param[in] num_verifiers   Number of \c verifiers.
+ * \param[in] parallel_cb     Runs the public key operations or
+ *                            \c NULL to run them one after another.
+ * \param[in] cb_context      Passed to \c parallel_cb.
+ * \param[out] payload        The payload.
+ *
+ * \retval T_COSE_ERR_SIGNER_COUNT  The number of signers is not
+ *                                  \c num_verifiers.
+ * \retval T_COSE_ERR_SIGN_FORMAT   The \c COSE_Sign is not well formed.
+ *
+ * This returns the result of the first signature that failed. The
+ * result, algorithm and kid of each signer are in its verifier.
+ *
+ * To find the kids and algorithms of the signers before choosing
+ * keys, call with \ref T_COSE_OPT_DECODE_ONLY and enough verifiers.
+ * The \c verify_ctx need not be set. Nothing is verified and the
+ * \c result of the verifiers that aren't used is
+ * \ref T_COSE_ERR_SIGNER_COUNT.
+ *
+ * The signatures are verified with t_cose_sign1_verify_complete() so
+ * short-circuit signatures and the verification cache work as they
+ * do for t_cose_sign1_verify().
+ */
+enum t_cose_err_t
+t_cose_multi_sign_verify(uint32_t                      option_flags,
+                         struct q_useful_buf_c         cose_sign,
+                         struct t_cose_multi_verifier *verifiers,
+                         size_t                        num_verifiers,
+                         t_cose_parallel_cb            parallel_cb,
+                         void                         *cb_context,
+                         struct q_useful_buf_c        *payload);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_MULTI_SIGN_H__ */
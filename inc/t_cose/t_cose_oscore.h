@@ -0,0 +1,323 @@
+/*
+ * t_cose_oscore.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef __T_COSE_OSCORE_H__
+#define __T_COSE_OSCORE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * \file t_cose_oscore.h
+ *
+ * \brief Protect and unprotect OSCORE messages.
+ *
+ * OSCORE ([RFC 8613](https://tools.ietf.org/html/rfc8613)) protects
+ * CoAP messages end to end with a \c COSE_Encrypt0 that is not sent
+ * as CBOR. Only the ciphertext is sent as the CoAP payload and the
+ * partial IV, kid and kid context are sent in the OSCORE option.
+ *
+ * A gateway for constrained devices keeps one
+ * \ref t_cose_oscore_ctx per device. The keys and the common IV are
+ * derived with HKDF once, by t_cose_oscore_init(), and the part of
+ * each nonce that comes from the sender or recipient ID is
+ * precomputed. Protecting or unprotecting a message then takes one
+ * AEAD operation, a few XORs for the nonce and about 30 bytes of
+ * AAD built on the stack. Nothing is allocated by this module.
+ *
+ * The replay window is a bitmap of the most recent
+ * \ref T_COSE_OSCORE_REPLAY_WINDOW_WORDS times 64 sequence numbers
+ * that were received. Checking and updating it is a few shifts and
+ * masks.
+ *
+ * The CoAP message itself is not handled here. The caller encodes
+ * the inner options and payload as the plaintext (RFC 8613 section
+ * 5.3) and puts the ciphertext and the option value from here in the
+ * outer message. Class I options are not supported; the external AAD
+ * always has an empty options field.
+ *
+ * A \ref t_cose_oscore_ctx is not thread-safe. A gateway processes
+ * the messages of one device on one thread at a time, which spreads
+ * devices over cores with no locking.
+ *
+ * The only AEAD algorithm supported is
+ * \ref T_COSE_ALGORITHM_AES_CCM_16_64_128 and the only HKDF hash is
+ * SHA-256, which are the OSCORE defaults. This is only available
+ * when \c T_COSE_ENABLE_OSCORE is defined and needs a crypto adapter
+ * with AEAD and HKDF, currently only the OpenSSL adapter.
+ */
+
+
+#ifdef T_COSE_ENABLE_OSCORE
+
+/** Number of 64-bit words in the replay window bitmap */
+#ifndef T_COSE_OSCORE_REPLAY_WINDOW_WORDS
+#define T_COSE_OSCORE_REPLAY_WINDOW_WORDS 1
+#endif
+
+/** Largest sender or recipient ID, the nonce size less 6 */
+#define T_COSE_OSCORE_MAX_ID_SIZE 7
+
+/** Largest ID context held in a \ref t_cose_oscore_ctx */
+#define T_COSE_OSCORE_MAX_ID_CONTEXT_SIZE 16
+
+/** Largest partial IV, 40 bits */
+#define T_COSE_OSCORE_MAX_PIV_SIZE 5
+
+/** Largest sender sequence number, 2^40 - 1 */
+#define T_COSE_OSCORE_MAX_SEQUENCE ((UINT64_C(1) << 40) - 1)
+
+/** Size of the key of AES-CCM-16-64-128 */
+#define T_COSE_OSCORE_KEY_SIZE 16
+
+/** Size of the nonce of AES-CCM-16-64-128 */
+#define T_COSE_OSCORE_NONCE_SIZE 13
+
+/** Size of the tag of AES-CCM-16-64-128, which the ciphertext adds */
+#define T_COSE_OSCORE_TAG_SIZE 8
+
+/** Size of the largest OSCORE option value made here */
+#define T_COSE_OSCORE_MAX_OPTION_SIZE \
+    (1 + T_COSE_OSCORE_MAX_PIV_SIZE + 1 + T_COSE_OSCORE_MAX_ID_CONTEXT_SIZE + \
+     T_COSE_OSCORE_MAX_ID_SIZE)
+
+
+/**
+ * The security context of one peer: the common, sender and
+ * recipient contexts of RFC 8613 section 3.
+ */
+struct t_cose_oscore_ctx {
+    /* Private data structure */
+    int32_t  aead_alg_id;
+    uint8_t  sender_key[T_COSE_OSCORE_KEY_SIZE];
+    uint8_t  recipient_key[T_COSE_OSCORE_KEY_SIZE];
+    /* The common IV XORed with the padded sender / recipient ID */
+    uint8_t  sender_nonce_base[T_COSE_OSCORE_NONCE_SIZE];
+    uint8_t  recipient_nonce_base[T_COSE_OSCORE_NONCE_SIZE];
+    uint8_t  sender_id[T_COSE_OSCORE_MAX_ID_SIZE];
+    uint8_t  sender_id_len;
+    uint8_t  recipient_id[T_COSE_OSCORE_MAX_ID_SIZE];
+    uint8_t  recipient_id_len;
+    uint8_t  id_context[T_COSE_OSCORE_MAX_ID_CONTEXT_SIZE];
+    uint8_t  id_context_len;
+    bool     has_id_context;
+    uint64_t sender_sequence;
+    /* Bit n of the window is whether replay_highest - n was received */
+    bool     replay_started;
+    uint64_t replay_highest;
+    uint64_t replay_window[T_COSE_OSCORE_REPLAY_WINDOW_WORDS];
+};
+
+
+/**
+ * What is needed from a request to protect or unprotect its
+ * response. It is filled in by t_cose_oscore_protect_request() or
+ * t_cose_oscore_unprotect_request().
+ */
+struct t_cose_oscore_request {
+    /* Private data structure */
+    uint8_t kid[T_COSE_OSCORE_MAX_ID_SIZE];
+    uint8_t kid_len;
+    uint8_t piv[T_COSE_OSCORE_MAX_PIV_SIZE];
+    uint8_t piv_len;
+    uint8_t nonce[T_COSE_OSCORE_NONCE_SIZE];
+};
+
+
+/**
+ * The fields of an OSCORE option value. Pointers are to the option
+ * value.
+ */
+struct t_cose_oscore_option {
+    /** The partial IV or \c NULL_Q_USEFUL_BUF_C */
+    struct q_useful_buf_c partial_iv;
+    /** The kid context or \c NULL_Q_USEFUL_BUF_C */
+    struct q_useful_buf_c kid_context;
+    /** The kid or \c NULL_Q_USEFUL_BUF_C. It may be present and empty. */
+    struct q_useful_buf_c kid;
+};
+
+
+/**
+ * \brief Derive a security context.
+ *
+ * \param[out] me            The context to initialize.
+ * \param[in] aead_alg_id    \ref T_COSE_ALGORITHM_AES_CCM_16_64_128.
+ * \param[in] master_secret  The master secret.
+ * \param[in] master_salt    The master salt or \c NULL_Q_USEFUL_BUF_C.
+ * \param[in] sender_id      This end's ID. May be empty.
+ * \param[in] recipient_id   The other end's ID. May be empty.
+ * \param[in] id_context     The ID context or \c NULL_Q_USEFUL_BUF_C.
+ *
+ * \retval T_COSE_ERR_UNSUPPORTED_ENCRYPTION_ALG
+ *         The algorithm is not supported.
+ * \retval T_COSE_ERR_OSCORE_FORMAT
+ *         An ID or the ID context is too long.
+ *
+ * The sender sequence number starts at 0 and the replay window is
+ * empty. The master secret and salt are not kept.
+ */
+enum t_cose_err_t
+t_cose_oscore_init(struct t_cose_oscore_ctx *me,
+                   int32_t                   aead_alg_id,
+                   struct q_useful_buf_c     master_secret,
+                   struct q_useful_buf_c     master_salt,
+                   struct q_useful_buf_c     sender_id,
+                   struct q_useful_buf_c     recipient_id,
+                   struct q_useful_buf_c     id_context);
+
+
+/**
+ * \brief Parse an OSCORE option value.
+ *
+ * \param[in] option_value  The value of the OSCORE option.
+ * \param[out] option       The fields.
+ *
+ * \retval T_COSE_ERR_OSCORE_FORMAT
+ *         The value is not well formed.
+ *
+ * A gateway calls this first to find the security context of a
+ * request from its kid and kid context, then passes the result to
+ * t_cose_oscore_unprotect_request().
+ */
+enum t_cose_err_t
+t_cose_oscore_parse_option(struct q_useful_buf_c        option_value,
+                           struct t_cose_oscore_option *option);
+
+
+/**
+ * \brief Protect a request.
+ *
+ * \param[in] me                 The security context.
+ * \param[in] plaintext          The encoded inner options and payload.
+ * \param[in] option_buffer      Buffer for the OSCORE option value.
+ * \param[out] option_value      The OSCORE option value.
+ * \param[in] ciphertext_buffer  Buffer for the ciphertext.
+ * \param[out] ciphertext        The ciphertext, the payload of the
+ *                               outer message.
+ * \param[out] request           Kept to unprotect the response.
+ *
+ * \retval T_COSE_ERR_SEQUENCE_EXHAUSTED
+ *         All sequence numbers have been used.
+ * \retval T_COSE_ERR_TOO_SMALL
+ *         A buffer is too small.
+ *
+ * The sender sequence number is used as the partial IV and
+ * incremented. The option carries the sender ID as the kid and the
+ * ID context, if any. The ciphertext is
+ * \ref T_COSE_OSCORE_TAG_SIZE bytes longer than the plaintext.
+ */
+enum t_cose_err_t
+t_cose_oscore_protect_request(struct t_cose_oscore_ctx     *me,
+                              struct q_useful_buf_c         plaintext,
+                              struct q_useful_buf           option_buffer,
+                              struct q_useful_buf_c        *option_value,
+                              struct q_useful_buf           ciphertext_buffer,
+                              struct q_useful_buf_c        *ciphertext,
+                              struct t_cose_oscore_request *request);
+
+
+/**
+ * \brief Unprotect a request.
+ *
+ * \param[in] me                The security context of the sender.
+ * \param[in] option            The parsed OSCORE option of the request.
+ * \param[in] ciphertext        The payload of the outer message.
+ * \param[in] plaintext_buffer  Buffer for the plaintext.
+ * \param[out] plaintext        The encoded inner options and payload.
+ * \param[out] request          Kept to protect the response.
+ *
+ * \retval T_COSE_ERR_OSCORE_FORMAT
+ *         There is no partial IV or kid, the partial IV is longer
+ *         than \ref T_COSE_OSCORE_MAX_PIV_SIZE or the kid is not the
+ *         recipient ID of \c me.
+ * \retval T_COSE_ERR_REPLAY
+ *         The partial IV was already received or is older than the
+ *         replay window.
+ * \retval T_COSE_ERR_DECRYPT_FAIL
+ *         The message was modified or the key is wrong.
+ *
+ * The replay window is only updated when decryption succeeds, so
+ * forged messages can't move it.
+ */
+enum t_cose_err_t
+t_cose_oscore_unprotect_request(struct t_cose_oscore_ctx          *me,
+                                const struct t_cose_oscore_option *option,
+                                struct q_useful_buf_c              ciphertext,
+                                struct q_useful_buf                plaintext_buffer,
+                                struct q_useful_buf_c             *plaintext,
+                                struct t_cose_oscore_request      *request);
+
+
+/**
+ * \brief Protect the response to a request.
+ *
+ * \param[in] me                 The security context.
+ * \param[in] request            From t_cose_oscore_unprotect_request().
+ * \param[in] plaintext          The encoded inner options and payload.
+ * \param[in] ciphertext_buffer  Buffer for the ciphertext.
+ * \param[out] ciphertext        The ciphertext.
+ *
+ * The nonce of the request is reused so the OSCORE option of the
+ * response is empty. Only one response may be protected this way
+ * per request.
+ */
+enum t_cose_err_t
+t_cose_oscore_protect_response(struct t_cose_oscore_ctx           *me,
+                               const struct t_cose_oscore_request *request,
+                               struct q_useful_buf_c               plaintext,
+                               struct q_useful_buf                 ciphertext_buffer,
+                               struct q_useful_buf_c              *ciphertext);
+
+
+/**
+ * \brief Unprotect the response to a request.
+ *
+ * \param[in] me                The security context.
+ * \param[in] request           From t_cose_oscore_protect_request().
+ * \param[in] option            The parsed OSCORE option of the response.
+ * \param[in] ciphertext        The payload of the outer message.
+ * \param[in] plaintext_buffer  Buffer for the plaintext.
+ * \param[out] plaintext        The encoded inner options and payload.
+ *
+ * \retval T_COSE_ERR_OSCORE_FORMAT
+ *         The partial IV is longer than
+ *         \ref T_COSE_OSCORE_MAX_PIV_SIZE.
+ * \retval T_COSE_ERR_DECRYPT_FAIL
+ *         The message was modified or is not the response to
+ *         \c request.
+ *
+ * If the option has a partial IV the nonce is made from it and the
+ * recipient ID, else the nonce of the request is used. Responses
+ * with a partial IV are not checked against the replay window.
+ */
+enum t_cose_err_t
+t_cose_oscore_unprotect_response(struct t_cose_oscore_ctx           *me,
+                                 const struct t_cose_oscore_request *request,
+                                 const struct t_cose_oscore_option  *option,
+                                 struct q_useful_buf_c               ciphertext,
+                                 struct q_useful_buf                 plaintext_buffer,
+                                 struct q_useful_buf_c              *plaintext);
+
+#endif /* T_COSE_ENABLE_OSCORE */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_OSCORE_H__ */
@@ -0,0 +1,115 @@
+/*
+ * t_cose_parallel.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef __T_COSE_PARALLEL_H__
+#define __T_COSE_PARALLEL_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * \file t_cose_parallel.h
+ *
+ * \brief Hook for running independent pieces of work concurrently.
+ *
+ * Some operations, such as verifying a \c COSE_Sign1 and its
+ * countersignatures, are made of several independent public key
+ * operations. t_cose doesn't create threads itself. Instead it hands
+ * the pieces to a callback supplied by the caller, which may run them
+ * on its own thread pool, on new threads or one after another.
+ *
+ * t_cose_parallel_run_serial() runs them one after another in the
+ * calling thread. When \c T_COSE_ENABLE_PTHREADS is defined,
+ * t_cose_parallel_run_pthreads() runs them on POSIX threads.
+ *
+ * The crypto adapter must be thread-safe for the tasks to be run
+ * concurrently.
+ */
+
+
+/**
+ * \brief A piece of work.
+ *
+ * \param[in,out] task  The task, one element of the \c tasks array
+ *                      given to \ref t_cose_parallel_cb.
+ */
+typedef void (*t_cose_task_fn)(void *task);
+
+
+/**
+ * \brief Callback to run tasks concurrently.
+ *
+ * \param[in] cb_context  Context for the callback given by the caller
+ *                        with the callback.
+ * \param[in] task_fn     Function to call for each task.
+ * \param[in] tasks       Array of tasks.
+ * \param[in] task_size   Size of one element of \c tasks.
+ * \param[in] num_tasks   Number of elements in \c tasks.
+ *
+ * This must call \c task_fn once for each task and return only when
+ * all have returned. The tasks are independent and may be run in any
+ * order and on any thread.
+ */
+typedef void (*t_cose_parallel_cb)(void           *cb_context,
+                                   t_cose_task_fn  task_fn,
+                                   void           *tasks,
+                                   size_t          task_size,
+                                   size_t          num_tasks);
+
+
+/**
+ * \brief Run tasks one after another in the calling thread.
+ *
+ * This is a \ref t_cose_parallel_cb that ignores \c cb_context. It is
+ * used when no callback is given.
+ */
+void
+t_cose_parallel_run_serial(void           *cb_context,
+                           t_cose_task_fn  task_fn,
+                           void           *tasks,
+                           size_t          task_size,
+                           size_t          num_tasks);
+
+
+#ifdef T_COSE_ENABLE_PTHREADS
+/**
+ * \brief Run tasks on POSIX threads.
+ *
+ * This is a \ref t_cose_parallel_cb that ignores \c cb_context. Up
+ * to \c T_COSE_PARALLEL_MAX_THREADS threads are created, one less
+ * than the number of tasks if that is fewer. They and the calling
+ * thread each take the next task not yet run until all are done, so
+ * thousands of tasks are spread evenly. If a thread can't be created
+ * the others do its share.
+ *
+ * This needs the GCC / Clang \c __atomic builtins.
+ *
+ * Creating a thread costs a few tens of microseconds, which is less
+ * than an ECDSA verification, but a pool run by the caller is better
+ * for high rates.
+ */
+void
+t_cose_parallel_run_pthreads(void           *cb_context,
+                             t_cose_task_fn  task_fn,
+                             void           *tasks,
+                             size_t          task_size,
+                             size_t          num_tasks);
+#endif /* T_COSE_ENABLE_PTHREADS */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_PARALLEL_H__ */
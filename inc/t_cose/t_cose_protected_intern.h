@@ -0,0 +1,153 @@
+/*
+ * t_cose_protected_intern.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef __T_COSE_PROTECTED_INTERN_H__
+#define __T_COSE_PROTECTED_INTERN_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+#include "t_cose/t_cose_sign1_verify.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * \file t_cose_protected_intern.h
+ *
+ * \brief Pre-parsed protected header parameters.
+ *
+ * Most \c COSE_Sign1 messages in a given deployment have one of only
+ * a few different protected headers, often just the algorithm ID,
+ * for example \c A1 \c 01 \c 26 for ES256. Instead of running the
+ * CBOR decoder on these every time, t_cose_sign1_verify() compares
+ * the encoded protected header to a table of ones that have already
+ * been parsed. When the bytes match exactly, the parameters and
+ * critical labels from the table are used. When they don't, the
+ * protected header is parsed as usual.
+ *
+ * The headers with just the algorithm ID for ES256, ES384 and ES512
+ * are always in the table. More can be added by the caller with
+ * t_cose_protected_intern_add() and given to the verifier with
+ * t_cose_sign1_verify_set_intern_table(). Only headers made up
+ * entirely of parameters that t_cose knows, like the algorithm ID,
+ * content type and the COSE Hash Envelope parameters, can be
+ * added. Headers with other parameters are always parsed so they can
+ * be returned through t_cose_sign1_verify_set_custom_parameters().
+ *
+ * The table is set up before verifying and not changed after, so it
+ * can be shared by any number of verification contexts and threads.
+ *
+ * This can be disabled with \c T_COSE_DISABLE_PROTECTED_INTERN.
+ */
+
+
+#ifndef T_COSE_DISABLE_PROTECTED_INTERN
+
+/**
+ * The largest encoded protected header that can be added to a table.
+ */
+#ifndef T_COSE_INTERN_MAX_PROTECTED_SIZE
+#define T_COSE_INTERN_MAX_PROTECTED_SIZE 48
+#endif
+
+
+/**
+ * One pre-parsed protected header. The members are private and are
+ * set by t_cose_protected_intern_add().
+ */
+struct t_cose_protected_intern_entry {
+    /* Private data structure */
+    uint8_t                  encoded[T_COSE_INTERN_MAX_PROTECTED_SIZE];
+    size_t                   encoded_len;
+    struct t_cose_parameters parameters;
+    size_t                   num_crit_labels;
+    int64_t                  crit_labels[T_COSE_PARAMETER_LIST_MAX];
+};
+
+
+/**
+ * A table of pre-parsed protected headers. The caller provides the
+ * storage for the entries.
+ */
+struct t_cose_protected_intern_table {
+    /* Private data structure */
+    struct t_cose_protected_intern_entry *entries;
+    size_t                                num_entries;
+    size_t                                max_entries;
+};
+
+
+/**
+ * \brief Initialize an empty table.
+ *
+ * \param[out] table        The table to initialize.
+ * \param[in] entries       Storage for the entries.
+ * \param[in] max_entries   Number of \c entries.
+ */
+static inline void
+t_cose_protected_intern_init(struct t_cose_protected_intern_table *table,
+                             struct t_cose_protected_intern_entry *entries,
+                             size_t                                max_entries);
+
+
+/**
+ * \brief Parse a protected header and add it to the table.
+ *
+ * \param[in,out] table   The table to add to.
+ * \param[in] protected_parameters  The encoded protected header
+ *                        parameters, the contents of the byte string
+ *                        in the \c COSE_Sign1.
+ *
+ * \retval T_COSE_ERR_TOO_SMALL           The table is full or the
+ *                                        header is longer than \ref
+ *                                        T_COSE_INTERN_MAX_PROTECTED_SIZE.
+ * \retval T_COSE_ERR_INVALID_ARGUMENT    The header has a parameter
+ *                                        t_cose doesn't know or a
+ *                                        critical label that is a
+ *                                        text string.
+ *
+ * Other errors are those from parsing the header, as would be
+ * returned by t_cose_sign1_verify().
+ *
+ * The bytes are copied, so \c protected_parameters need not stay
+ * valid. Adding a header that is already in the table does nothing.
+ */
+enum t_cose_err_t
+t_cose_protected_intern_add(struct t_cose_protected_intern_table *table,
+                            struct q_useful_buf_c                 protected_parameters);
+
+
+
+
+/* ------------------------------------------------------------------------
+ * Inline implementations of public functions defined above.
+ */
+static inline void
+t_cose_protected_intern_init(struct t_cose_protected_intern_table *table,
+                             struct t_cose_protected_intern_entry *entries,
+                             size_t                                max_entries)
+{
+    table->entries     = entries;
+    table->num_entries = 0;
+    table->max_entries = max_entries;
+}
+
+#endif /* T_COSE_DISABLE_PROTECTED_INTERN */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_PROTECTED_INTERN_H__ */
@@ -0,0 +1,173 @@
+/*
+ *  t_cose_rate_limit.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef __T_COSE_RATE_LIMIT_H__
+#define __T_COSE_RATE_LIMIT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * \file t_cose_rate_limit.h
+ *
+ * \brief Per-kid rate limiting of verification.
+ *
+ * One device sending a flood of well-formed messages can use up the
+ * verification CPU meant for all devices. With a rate limiter set on
+ * the verification context, each message takes a token from the
+ * bucket of its kid. The bucket refills at a fixed rate up to a
+ * maximum burst. When it is empty t_cose_sign1_verify() returns
+ * \ref T_COSE_ERR_RATE_LIMITED, before the to-be-signed bytes are
+ * hashed or the signature is checked.
+ *
+ * The buckets are in a fixed-size open-addressed hash table in memory
+ * provided by the caller, 16 bytes per slot. Each slot is updated
+ * with a compare-and-swap so threads can share one limiter without a
+ * lock. When the slots near a new kid are full, the one used least
+ * recently is reused for it, so kids that are rarely seen start again
+ * with a full bucket. This is only approximately LRU and two threads
+ * taking the same slot at once can let a message or two too many
+ * through. It is a limit on CPU, not an exact count.
+ *
+ * Messages without a kid all share one bucket.
+ *
+ * Time comes from the caller through t_cose_rate_limit_set_time() so
+ * no clock is needed in the library. If the time is never set no
+ * bucket ever refills.
+ *
+ * This needs the GCC / Clang \c __atomic builtins and is only
+ * available when \c T_COSE_ENABLE_RATE_LIMIT is defined.
+ */
+
+
+#ifdef T_COSE_ENABLE_RATE_LIMIT
+
+/** The largest burst allowed by t_cose_rate_limit_init() */
+#define T_COSE_RATE_LIMIT_MAX_BURST 4000000
+
+
+/**
+ * A rate limiter. It is at the start of the memory given to
+ * t_cose_rate_limit_init().
+ */
+struct t_cose_rate_limit;
+
+
+/**
+ * Counters of a rate limiter.
+ */
+struct t_cose_rate_limit_stats {
+    /** Messages refused */
+    uint64_t limited;
+    /** Kids that replaced another kid's bucket */
+    uint64_t evictions;
+    /** Number of slots in the table */
+    uint32_t slot_count;
+};
+
+
+/**
+ * \brief Compute the memory needed for a rate limiter.
+ *
+ * \param[in] slot_count  The number of buckets. Must be a power of
+ *                        two. Use about twice the number of kids
+ *                        expected to be active at once.
+ *
+ * \return The size in bytes or 0 if \c slot_count is not allowed.
+ */
+size_t
+t_cose_rate_limit_size(uint32_t slot_count);
+
+
+/**
+ * \brief Initialize a rate limiter.
+ *
+ * \param[in] memory      The memory for the limiter. Must be 8-byte
+ *                        aligned and at least
+ *                        t_cose_rate_limit_size() bytes.
+ * \param[in] slot_count  As for t_cose_rate_limit_size().
+ * \param[in] rate        Tokens added to each bucket per second.
+ * \param[in] burst       The most tokens a bucket holds. It must be at
+ *                        least 1 and at most
+ *                        \ref T_COSE_RATE_LIMIT_MAX_BURST.
+ * \param[out] limiter    The limiter, at the start of \c memory.
+ *
+ * \retval T_COSE_ERR_INVALID_ARGUMENT  The slot count or burst is not
+ *                                     allowed or \c memory is not
+ *                                     aligned.
+ * \retval T_COSE_ERR_TOO_SMALL         \c memory is too small.
+ */
+enum t_cose_err_t
+t_cose_rate_limit_init(struct q_useful_buf        memory,
+                       uint32_t                   slot_count,
+                       uint32_t                   rate,
+                       uint32_t                   burst,
+                       struct t_cose_rate_limit **limiter);
+
+
+/**
+ * \brief Set the time used to refill buckets.
+ *
+ * \param[in] limiter  The limiter.
+ * \param[in] now_ms   A monotonic time in milliseconds. It may wrap
+ *                     around.
+ *
+ * One thread should call this every millisecond or so. Buckets refill
+ * only as often as this is called.
+ */
+void
+t_cose_rate_limit_set_time(struct t_cose_rate_limit *limiter,
+                           uint32_t                  now_ms);
+
+
+/**
+ * \brief Take a token from the bucket of a kid.
+ *
+ * \param[in] limiter  The limiter.
+ * \param[in] kid      The kid or \c NULL_Q_USEFUL_BUF_C.
+ *
+ * \return \c true if there was a token, \c false if the kid is over
+ *         its rate.
+ *
+ * t_cose_sign1_verify() calls this when a limiter is set with
+ * t_cose_sign1_verify_set_rate_limit(). It can also be called
+ * directly to limit other work by kid.
+ */
+bool
+t_cose_rate_limit_take(struct t_cose_rate_limit *limiter,
+                       struct q_useful_buf_c     kid);
+
+
+/**
+ * \brief Get the counters of a rate limiter.
+ *
+ * \param[in] limiter  The limiter.
+ * \param[out] stats   The counters.
+ */
+void
+t_cose_rate_limit_get_stats(const struct t_cose_rate_limit *limiter,
+                            struct t_cose_rate_limit_stats *stats);
+
+#endif /* T_COSE_ENABLE_RATE_LIMIT */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_RATE_LIMIT_H__ */
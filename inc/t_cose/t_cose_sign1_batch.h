@@ -0,0 +1,199 @@
+/*
+ * t_cose_sign1_batch.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef __T_COSE_SIGN1_BATCH_H__
+#define __T_COSE_SIGN1_BATCH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+#include "t_cose/t_cose_sign1_sign.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * \file t_cose_sign1_batch.h
+ *
+ * \brief Sign many payloads into one contiguous output buffer.
+ *
+ * When thousands of records are signed in a batch, giving each call
+ * to t_cose_sign1_sign() its own output buffer means either
+ * allocating the worst case for each or running the size calculation
+ * pass before each. Here all the \c COSE_Sign1 messages are written
+ * back-to-back into one buffer called the arena, and their offsets
+ * and lengths are returned in a table.
+ *
+ * The encoded size of the header parameters and signature is
+ * computed once per batch. The size of each record is then exact,
+ * so no space is wasted between records. When the arena is too
+ * small for the next record, a callback from the caller is asked to
+ * grow it, typically with \c realloc(). Nothing is allocated by
+ * t_cose.
+ *
+ * The records are complete CBOR data items with nothing between them,
+ * so the used part of the arena is a CBOR sequence (RFC 8742) that
+ * can be written out with a single I/O call.
+ *
+ * Offsets are used rather than pointers so the table stays correct
+ * when the arena is moved by growing it.
+ */
+
+
+/**
+ * \brief Callback to grow the arena.
+ *
+ * \param[in] cb_context     The \c cb_context given to
+ *                           t_cose_sign1_arena_init().
+ * \param[in] min_size       The minimum size the arena must be grown to.
+ * \param[in,out] arena      The arena. On return it must be at least
+ *                           \c min_size long and contain the bytes of
+ *                           the old arena. It may have moved.
+ *
+ * \return \ref T_COSE_SUCCESS or an error such as \ref
+ *         T_COSE_ERR_INSUFFICIENT_MEMORY that is returned by
+ *         t_cose_sign1_sign_batch().
+ *
+ * The callback may grow by more than \c min_size to reduce the
+ * number of calls. Doubling is typical.
+ */
+typedef enum t_cose_err_t
+(*t_cose_sign1_arena_grow_cb)(void                *cb_context,
+                              size_t               min_size,
+                              struct q_useful_buf *arena);
+
+
+/**
+ * The output buffer for t_cose_sign1_sign_batch(). The members may be
+ * read by the caller, but should only be set by t_cose_sign1_arena_init().
+ */
+struct t_cose_sign1_arena {
+    /** The buffer. */
+    struct q_useful_buf         buffer;
+    /** Bytes of \c buffer used so far. */
+    size_t                      used;
+    /** Called when \c buffer is too small. May be \c NULL. */
+    t_cose_sign1_arena_grow_cb  grow_cb;
+    /** Passed to \c grow_cb. */
+    void                       *cb_context;
+};
+
+
+/**
+ * The location of one \c COSE_Sign1 in the arena.
+ */
+struct t_cose_sign1_batch_entry {
+    /** Offset from the start of the arena buffer */
+    size_t offset;
+    /** Length of the encoded \c COSE_Sign1 */
+    size_t len;
+};
+
+
+/**
+ * \brief Initialize an arena.
+ *
+ * \param[out] arena      The arena to initialize.
+ * \param[in] buffer      Initial buffer. May be \c NULL_Q_USEFUL_BUF if
+ *                        there is a \c grow_cb.
+ * \param[in] grow_cb     Callback to grow the buffer or \c NULL if the
+ *                        buffer is fixed.
+ * \param[in] cb_context  Passed to \c grow_cb.
+ *
+ * One arena can be used for many calls to t_cose_sign1_sign_batch().
+ * The output is appended.
+ */
+static inline void
+t_cose_sign1_arena_init(struct t_cose_sign1_arena  *arena,
+                        struct q_useful_buf         buffer,
+                        t_cose_sign1_arena_grow_cb  grow_cb,
+                        void                       *cb_context);
+
+
+/**
+ * \brief Get all that has been signed into an arena.
+ *
+ * \param[in] arena  The arena.
+ *
+ * \return The used part of the arena, a CBOR sequence of \c COSE_Sign1.
+ */
+static inline struct q_useful_buf_c
+t_cose_sign1_arena_output(const struct t_cose_sign1_arena *arena);
+
+
+/**
+ * \brief Sign many payloads with the same key and parameters.
+ *
+ * \param[in] sign_ctx      A signing context set up with
+ *                          t_cose_sign1_sign_init(),
+ *                          t_cose_sign1_set_signing_key() and such.
+ * \param[in] payloads      Array of payloads to sign.
+ * \param[in] num_payloads  Number of \c payloads.
+ * \param[in,out] arena     The arena to append the outputs to.
+ * \param[out] entries      Array of \c num_payloads entries for the
+ *                          location of each output.
+ * \param[out] num_signed   Number of payloads signed. Less than
+ *                          \c num_payloads only on error.
+ *
+ * \retval T_COSE_ERR_TOO_SMALL  The arena is full and there is no grow
+ *                               callback.
+ *
+ * Other errors are as for t_cose_sign1_sign() or as returned by the
+ * grow callback.
+ *
+ * On error the payloads before the one that failed have been signed
+ * and are in the arena. Nothing of the one that failed is left in
+ * the arena.
+ *
+ * Each output is the same as t_cose_sign1_sign() would make. This
+ * can't be used with a restartable signing context.
+ */
+enum t_cose_err_t
+t_cose_sign1_sign_batch(struct t_cose_sign1_sign_ctx    *sign_ctx,
+                        const struct q_useful_buf_c     *payloads,
+                        size_t                           num_payloads,
+                        struct t_cose_sign1_arena       *arena,
+                        struct t_cose_sign1_batch_entry *entries,
+                        size_t                          *num_signed);
+
+
+
+
+/* ------------------------------------------------------------------------
+ * Inline implementations of public functions defined above.
+ */
+static inline void
+t_cose_sign1_arena_init(struct t_cose_sign1_arena  *arena,
+                        struct q_useful_buf         buffer,
+                        t_cose_sign1_arena_grow_cb  grow_cb,
+                        void                       *cb_context)
+{
+    arena->buffer     = buffer;
+    arena->used       = 0;
+    arena->grow_cb    = grow_cb;
+    arena->cb_context = cb_context;
+}
+
+
+static inline struct q_useful_buf_c
+t_cose_sign1_arena_output(const struct t_cose_sign1_arena *arena)
+{
+    return (struct q_useful_buf_c){arena->buffer.ptr, arena->used};
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_SIGN1_BATCH_H__ */
@@ -60,6 +60,28 @@ extern "C" {
  */
 
 
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
+/**
+ * Bytes set aside in \ref t_cose_sign1_sign_ctx for the hash context
+ * of the crypto adapter used by incremental hashing. It is checked
+ * at compile time in t_cose_sign1_sign.c. The default is enough for
+ * SHA-512 with OpenSSL, Mbed TLS and the test crypto.
+ */
+#ifndef T_COSE_TBS_HASH_CTX_SIZE
+#define T_COSE_TBS_HASH_CTX_SIZE 256
+#endif
+
+/**
+ * Size of the blocks t_cose_sign1_add_payload_bytes() outputs and
+ * hashes at a time. It is small enough that a block is still in the
+ * L1 or L2 cache when it is hashed right after being written.
+ */
+#ifndef T_COSE_INCREMENTAL_HASH_BLOCK_SIZE
+#define T_COSE_INCREMENTAL_HASH_BLOCK_SIZE 16384
+#endif
+#endif /* T_COSE_ENABLE_INCREMENTAL_HASH */
+
+
 /**
  * This is the context for creating a \c COSE_Sign1 structure. The
  * caller should allocate it and pass it to the functions here.  This
@@ -76,6 +98,44 @@ struct t_cose_sign1_sign_ctx {
     uint32_t              content_type_uint;
     const char *          content_type_tstr;
 #endif
+#ifndef T_COSE_DISABLE_HASH_ENVELOPE
+    int32_t               payload_hash_alg_id;
+    uint32_t              preimage_content_type_uint;
+    const char *          preimage_content_type_tstr;
+    const char *          payload_location;
+#endif
+#ifdef T_COSE_ENABLE_RESTARTABLE
+    struct t_cose_restart_ctx *restart_ctx;
+#endif
+    bool                  payload_len_known;
+    size_t                payload_len;
+    size_t                payload_start;
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
+    bool                  tbs_hash_started;
+    size_t                payload_hashed;
+    /* Storage for the hash context, a struct t_cose_crypto_hash,
+     * which is private to t_cose */
+    union {
+        uint64_t          align_int;
+        void             *align_ptr;
+        uint8_t           bytes[T_COSE_TBS_HASH_CTX_SIZE];
+    } tbs_hash_ctx;
+#endif
+};
+
+
+/**
+ * A \c COSE_Sign1 that has been hashed and is ready for the public
+ * key operation. See t_cose_sign1_sign_prepare(). It can be copied
+ * and passed between threads. It is about 100 bytes.
+ */
+struct t_cose_sign1_prepared {
+    /* Private data structure */
+    uint8_t               tbs_hash_bytes[T_COSE_PREPARED_MAX_HASH_SIZE];
+    size_t                tbs_hash_len;
+    struct q_useful_buf_c protected_parameters;
+    int32_t               cose_algorithm_id;
+    bool                  close_array;
 };
 
 
@@ -216,6 +276,102 @@ t_cose_sign1_set_content_type_tstr(struct t_cose_sign1_sign_ctx *context,
 #endif /* T_COSE_DISABLE_CONTENT_TYPE */
 
 
+#ifndef T_COSE_DISABLE_HASH_ENVELOPE
+/**
+ * \brief Sign as a COSE Hash Envelope.
+ *
+ * \param[in] context              The t_cose signing context.
+ * \param[in] payload_hash_alg_id  The COSE algorithm ID of the hash of the
+ *                                 content, for example
+ *                                 \c T_COSE_ALGORITHM_SHA_256.
+ *
+ * With this set, the payload passed to t_cose_sign1_sign() is not the
+ * content but the hash of it computed with \c payload_hash_alg_id,
+ * for example by t_cose_hash_envelope_compute(). The signing cost is
+ * then independent of the size of the content and a hash computed
+ * once can be used for many signatures.
+ *
+ * This adds the \c payload_hash_alg parameter to the protected
+ * header parameters. t_cose_sign1_sign() returns \ref
+ * T_COSE_ERR_INVALID_ARGUMENT if the payload is not the size of the
+ * hash. A content type must not also be set as the payload is a hash.
+ *
+ * See t_cose_hash_envelope.h.
+ */
+static inline void
+t_cose_sign1_set_payload_hash_alg(struct t_cose_sign1_sign_ctx *context,
+                                  int32_t                       payload_hash_alg_id);
+
+
+/**
+ * \brief Set the content type of the content hashed for a COSE Hash Envelope.
+ *
+ * \param[in] context       The t_cose signing context.
+ * \param[in] content_type  CoAP content type of the hashed content.
+ *
+ * This is the CoAP Content-Format of the content before hashing. See
+ * t_cose_sign1_set_content_type_uint() for details.
+ */
+static inline void
+t_cose_sign1_set_preimage_content_type_uint(struct t_cose_sign1_sign_ctx *context,
+                                            uint16_t                      content_type);
+
+
+/**
+ * \brief Set the content type of the content hashed for a COSE Hash Envelope.
+ *
+ * \param[in] context       The t_cose signing context.
+ * \param[in] content_type  MIME type of the hashed content.
+ *
+ * This is the MIME type of the content before hashing. See
+ * t_cose_sign1_set_content_type_tstr() for details.
+ */
+static inline void
+t_cose_sign1_set_preimage_content_type_tstr(struct t_cose_sign1_sign_ctx *context,
+                                            const char                   *content_type);
+
+
+/**
+ * \brief Set where the content hashed for a COSE Hash Envelope can be found.
+ *
+ * \param[in] context   The t_cose signing context.
+ * \param[in] location  A URI or other location of the content.
+ */
+static inline void
+t_cose_sign1_set_payload_location(struct t_cose_sign1_sign_ctx *context,
+                                  const char                   *location);
+#endif /* T_COSE_DISABLE_HASH_ENVELOPE */
+
+
+#ifdef T_COSE_ENABLE_RESTARTABLE
+/**
+ * \brief Make signing restartable (time-sliced).
+ *
+ * \param[in] context      The t_cose signing context.
+ * \param[in] restart_ctx  Restart context or \c NULL to turn off.
+ *
+ * With this set, t_cose_sign1_sign() and
+ * t_cose_sign1_encode_signature() return \ref
+ * T_COSE_ERR_SIG_IN_PROGRESS when the signing operation has used up
+ * the per-slice budget set in \c restart_ctx. To continue, repeat
+ * the whole signing sequence with the same inputs. For
+ * t_cose_sign1_sign() that is just calling it again. When
+ * t_cose_sign1_encode_parameters() and t_cose_sign1_encode_signature()
+ * are used, the encoder context must be re-initialized and the
+ * parameters and payload output again as the encoded output from the
+ * in-progress call is not usable.
+ *
+ * Redoing the encoding and hashing is cheap compared to the public
+ * key operation, which resumes where it left off.
+ *
+ * See \ref t_cose_restart_ctx.
+ */
+static inline void
+t_cose_sign1_sign_set_restart_ctx(struct t_cose_sign1_sign_ctx *context,
+                                  struct t_cose_restart_ctx    *restart_ctx);
+#endif /* T_COSE_ENABLE_RESTARTABLE */
+
+
 
 /**
  * \brief  Create and sign a \c COSE_Sign1 message with a payload.
@@ -304,6 +460,117 @@ t_cose_sign1_encode_parameters(struct t_cose_sign1_sign_ctx *context,
                                QCBOREncodeContext           *cbor_encode_ctx);
 
 
+/**
+ * \brief  Output first part and parameters for a payload of known length.
+ *
+ * \param[in] context          The t_cose signing context.
+ * \param[in] payload_len      The exact length of the encoded payload.
+ * \param[in] cbor_encode_ctx  Encoding context to output to.
+ *
+ * This is the same as t_cose_sign1_encode_parameters() except the
+ * length of the payload is given up front. The head of the payload
+ * byte string is output right away instead of being inserted in
+ * front of the payload by t_cose_sign1_encode_signature(). This
+ * saves moving the whole payload in memory, which is worthwhile for
+ * payloads of more than a few KB.
+ *
+ * After this, exactly \c payload_len bytes of payload must be output
+ * to \c cbor_encode_ctx with \c QCBOREncode_AddXxx calls, then
+ * t_cose_sign1_encode_signature() called. It returns \ref
+ * T_COSE_ERR_WRONG_PAYLOAD_LENGTH if the payload was a different
+ * length.
+ *
+ * Nothing else may be open in \c cbor_encode_ctx when this is called
+ * and the payload must close any arrays and maps it opens. The \c
+ * COSE_Sign1 array is not opened in \c cbor_encode_ctx, so the
+ * payload is encoded at the top level.
+ *
+ * t_cose_sign1_sign() always works this way. It also hashes
+ * incrementally if \c T_COSE_ENABLE_INCREMENTAL_HASH is defined. See
+ * t_cose_sign1_encode_parameters_incremental().
+ */
+enum t_cose_err_t
+t_cose_sign1_encode_parameters_known_length(struct t_cose_sign1_sign_ctx *context,
+                                            size_t                        payload_len,
+                                            QCBOREncodeContext           *cbor_encode_ctx);
+
+
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
+/**
+ * \brief Output first part and parameters and start hashing the payload.
+ *
+ * \param[in] context          The t_cose signing context.
+ * \param[in] payload_len      The exact length of the encoded payload.
+ * \param[in] cbor_encode_ctx  Encoding context to output to.
+ *
+ * This is the same as t_cose_sign1_encode_parameters_known_length()
+ * except the hash of the to-be-signed bytes is started here rather
+ * than in t_cose_sign1_encode_signature(). The payload is then
+ * hashed as it is output, while it is still in the CPU cache,
+ * instead of being read back from memory in a second pass when it is
+ * complete. This helps for payloads that are much larger than the
+ * cache.
+ *
+ * While outputting the payload, call
+ * t_cose_sign1_hash_encoded_payload() every few KB to hash what has
+ * been output so far, or output large byte strings with
+ * t_cose_sign1_add_payload_bytes(). Whatever is not hashed when
+ * t_cose_sign1_encode_signature() is called is hashed then, so the
+ * result is correct however often these are called.
+ *
+ * t_cose_sign1_encode_signature() must always be called after this
+ * as it is what releases the hash context.
+ *
+ * Nothing is hashed when only calculating the size.
+ */
+enum t_cose_err_t
+t_cose_sign1_encode_parameters_incremental(struct t_cose_sign1_sign_ctx *context,
+                                           size_t                        payload_len,
+                                           QCBOREncodeContext           *cbor_encode_ctx);
+
+
+/**
+ * \brief Hash the payload output so far.
+ *
+ * \param[in] context          The t_cose signing context.
+ * \param[in] cbor_encode_ctx  Encoding context the payload is being
+ *                             output to.
+ *
+ * \return This returns one of the error codes defined by \ref t_cose_err_t.
+ *
+ * This hashes the payload bytes output since
+ * t_cose_sign1_encode_parameters_incremental() or the last call to
+ * this. It can only be called when no array, map or byte string
+ * wrapping is open in \c cbor_encode_ctx. It does nothing when
+ * incremental hashing is not in progress.
+ */
+enum t_cose_err_t
+t_cose_sign1_hash_encoded_payload(struct t_cose_sign1_sign_ctx *context,
+                                  QCBOREncodeContext           *cbor_encode_ctx);
+
+
+/**
+ * \brief Output and hash encoded payload bytes.
+ *
+ * \param[in] context          The t_cose signing context.
+ * \param[in] cbor_encode_ctx  Encoding context the payload is being
+ *                             output to.
+ * \param[in] bytes            Encoded bytes to add to the payload.
+ *
+ * \return This returns one of the error codes defined by \ref t_cose_err_t.
+ *
+ * This is \c QCBOREncode_AddEncoded() done in blocks of \ref
+ * T_COSE_INCREMENTAL_HASH_BLOCK_SIZE with each block hashed right
+ * after it is copied to the output. The same conditions apply as for
+ * t_cose_sign1_hash_encoded_payload().
+ */
+enum t_cose_err_t
+t_cose_sign1_add_payload_bytes(struct t_cose_sign1_sign_ctx *context,
+                               QCBOREncodeContext           *cbor_encode_ctx,
+                               struct q_useful_buf_c         bytes);
+#endif /* T_COSE_ENABLE_INCREMENTAL_HASH */
+
+
 /**
  * \brief Finish a \c COSE_Sign1 message by outputting the signature.
  *
@@ -325,6 +592,65 @@ t_cose_sign1_encode_signature(struct t_cose_sign1_sign_ctx *context,
                               QCBOREncodeContext           *cbor_encode_ctx);
 
 
+/**
+ * \brief Hash a \c COSE_Sign1 for signing later.
+ *
+ * \param[in] context          The t_cose signing context.
+ * \param[in] cbor_encode_ctx  Encoding context being output to.
+ * \param[out] prepared        The hash and what else is needed to
+ *                             sign.
+ *
+ * \return This returns one of the error codes defined by \ref t_cose_err_t.
+ *
+ * t_cose_sign1_encode_signature() is this followed by
+ * t_cose_sign1_sign_complete(). Calling them separately allows the
+ * hashing, which is proportional to the size of the payload, and the
+ * public key operation, which is not, to be run on different threads
+ * or scheduled separately. For example the payload can be encoded and
+ * hashed on an I/O thread and the signing done by a pool of threads
+ * for crypto.
+ *
+ * This is called where t_cose_sign1_encode_signature() would be. It
+ * closes off the payload and computes the hash of the to-be-signed
+ * bytes. Nothing more may be output to \c cbor_encode_ctx until
+ * t_cose_sign1_sign_complete() is called with it.
+ *
+ * \c context may be used to start encoding another \c COSE_Sign1
+ * after this returns as long as its key, algorithm and options are
+ * not changed before t_cose_sign1_sign_complete() is called.
+ */
+enum t_cose_err_t
+t_cose_sign1_sign_prepare(struct t_cose_sign1_sign_ctx  *context,
+                          QCBOREncodeContext            *cbor_encode_ctx,
+                          struct t_cose_sign1_prepared  *prepared);
+
+
+/**
+ * \brief Sign a prepared \c COSE_Sign1 and finish the encoding.
+ *
+ * \param[in] context          The t_cose signing context given to
+ *                             t_cose_sign1_sign_prepare().
+ * \param[in] prepared         From t_cose_sign1_sign_prepare().
+ * \param[in] cbor_encode_ctx  The encoding context given to
+ *                             t_cose_sign1_sign_prepare().
+ *
+ * \return This returns one of the error codes defined by \ref t_cose_err_t.
+ *
+ * This runs the public key signing algorithm on the hash in \c
+ * prepared and outputs the signature. The completed \c COSE_Sign1 is
+ * then retrieved with \c QCBOREncode_Finish().
+ *
+ * Only the key, options and restart context are used from \c
+ * context. With a restart context, call this again with the same
+ * inputs when \ref T_COSE_ERR_SIG_IN_PROGRESS is returned. The
+ * hashing is not repeated.
+ */
+enum t_cose_err_t
+t_cose_sign1_sign_complete(const struct t_cose_sign1_sign_ctx *context,
+                           const struct t_cose_sign1_prepared *prepared,
+                           QCBOREncodeContext                 *cbor_encode_ctx);
+
+
 
 
 
@@ -342,6 +668,9 @@ t_cose_sign1_sign_init(struct t_cose_sign1_sign_ctx *me,
     /* Only member for which 0 is not the empty state */
     me->content_type_uint = T_COSE_EMPTY_UINT_CONTENT_TYPE;
 #endif
+#ifndef T_COSE_DISABLE_HASH_ENVELOPE
+    me->preimage_content_type_uint = T_COSE_EMPTY_UINT_CONTENT_TYPE;
+#endif
 
     me->cose_algorithm_id = cose_algorithm_id;
     me->option_flags      = option_flags;
@@ -375,6 +704,50 @@ t_cose_sign1_set_content_type_tstr(struct t_cose_sign1_sign_ctx *me,
 }
 #endif
 
+
+#ifndef T_COSE_DISABLE_HASH_ENVELOPE
+static inline void
+t_cose_sign1_set_payload_hash_alg(struct t_cose_sign1_sign_ctx *me,
+                                  int32_t                       payload_hash_alg_id)
+{
+    me->payload_hash_alg_id = payload_hash_alg_id;
+}
+
+
+static inline void
+t_cose_sign1_set_preimage_content_type_uint(struct t_cose_sign1_sign_ctx *me,
+                                            uint16_t                      content_type)
+{
+    me->preimage_content_type_uint = content_type;
+}
+
+
+static inline void
+t_cose_sign1_set_preimage_content_type_tstr(struct t_cose_sign1_sign_ctx *me,
+                                            const char                   *content_type)
+{
+    me->preimage_content_type_tstr = content_type;
+}
+
+
+static inline void
+t_cose_sign1_set_payload_location(struct t_cose_sign1_sign_ctx *me,
+                                  const char                   *location)
+{
+    me->payload_location = location;
+}
+#endif /* T_COSE_DISABLE_HASH_ENVELOPE */
+
+
+#ifdef T_COSE_ENABLE_RESTARTABLE
+static inline void
+t_cose_sign1_sign_set_restart_ctx(struct t_cose_sign1_sign_ctx *me,
+                                  struct t_cose_restart_ctx    *restart_ctx)
+{
+    me->restart_ctx = restart_ctx;
+}
+#endif
+
 #ifdef __cplusplus
 }
 #endif
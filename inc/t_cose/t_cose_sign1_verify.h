@@ -13,8 +13,11 @@
 #define __T_COSE_SIGN1_VERIFY_H__
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "t_cose/q_useful_buf.h"
 #include "t_cose/t_cose_common.h"
+#include "t_cose/t_cose_verify_cache.h"
+#include "t_cose/t_cose_rate_limit.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -84,6 +87,70 @@ struct t_cose_parameters {
      * present. Allowed range is 0 to UINT16_MAX per RFC 7252. */
     uint32_t              content_type_uint;
 #endif /* T_COSE_DISABLE_CONTENT_TYPE */
+#ifndef T_COSE_DISABLE_HASH_ENVELOPE
+    /** For a COSE Hash Envelope, the algorithm used to hash the
+     * content into the payload. \ref T_COSE_UNSET_ALGORITHM_ID if the
+     * message is not a hash envelope. See t_cose_hash_envelope.h. */
+    int32_t               payload_hash_alg_id;
+    /** Content type of the content that was hashed as a MIME
+     * type. \c NULL_Q_USEFUL_BUF_C if parameter is not present */
+    struct q_useful_buf_c preimage_content_type_tstr;
+    /** Content type of the content that was hashed as a CoAP
+     * Content-Format. \ref T_COSE_EMPTY_UINT_CONTENT_TYPE if
+     * parameter is not present. */
+    uint32_t              preimage_content_type_uint;
+    /** Where the content that was hashed can be found.
+     * \c NULL_Q_USEFUL_BUF_C if parameter is not present */
+    struct q_useful_buf_c payload_location;
+#endif /* T_COSE_DISABLE_HASH_ENVELOPE */
+};
+
+
+/**
+ * The type of value returned for a custom header parameter. See
+ * struct \ref t_cose_custom_parameter.
+ */
+enum t_cose_custom_param_type {
+    /** The parameter did not occur in the message */
+    T_COSE_CUSTOM_PARAM_ABSENT = 0,
+    /** Integer in \c value.int64 */
+    T_COSE_CUSTOM_PARAM_INT64 = 1,
+    /** Byte string in \c value.string */
+    T_COSE_CUSTOM_PARAM_BYTE_STRING = 2,
+    /** Text string in \c value.string */
+    T_COSE_CUSTOM_PARAM_TEXT_STRING = 3,
+    /** true or false in \c value.boolean */
+    T_COSE_CUSTOM_PARAM_BOOL = 4,
+    /** The parameter occurred, but is some other type like a map,
+     * array or float. No value is returned. */
+    T_COSE_CUSTOM_PARAM_OTHER = 5
+};
+
+
+/**
+ * A header parameter defined by the application that is to be
+ * returned by t_cose_sign1_verify(). The caller fills in \c label
+ * and the rest is filled in by t_cose_sign1_verify().
+ *
+ * Strings point back into the \c COSE_Sign1 passed to
+ * t_cose_sign1_verify() the same as in struct \ref
+ * t_cose_parameters. Nothing is copied.
+ *
+ * See t_cose_sign1_verify_set_custom_parameters().
+ */
+struct t_cose_custom_parameter {
+    /** The integer label of the parameter. Set by the caller. */
+    int64_t                       label;
+    /** Type of the value or \ref T_COSE_CUSTOM_PARAM_ABSENT. */
+    enum t_cose_custom_param_type type;
+    /** \c true if it was in the protected header parameters */
+    bool                          in_protected;
+    /** The value. Which member is indicated by \c type. */
+    union {
+        int64_t               int64;
+        struct q_useful_buf_c string;
+        bool                  boolean;
+    } value;
 };
 
 
@@ -144,6 +211,17 @@ struct t_cose_parameters {
 
 
 
+#ifndef T_COSE_DISABLE_PROTECTED_INTERN
+/* See t_cose_protected_intern.h */
+struct t_cose_protected_intern_table;
+#endif
+
+#ifdef T_COSE_ENABLE_CAPTURE
+/* See t_cose_capture.h */
+struct t_cose_capture;
+#endif
+
+
 /**
  * Context for signature verification.  It is about 24 bytes on a
  * 64-bit machine and 12 bytes on a 32-bit machine.
@@ -152,6 +230,44 @@ struct t_cose_sign1_verify_ctx {
     /* Private data structure */
     struct t_cose_key     verification_key;
     uint32_t              option_flags;
+#ifdef T_COSE_ENABLE_RESTARTABLE
+    struct t_cose_restart_ctx *restart_ctx;
+#endif
+    struct t_cose_custom_parameter *custom_params;
+    size_t                          num_custom_params;
+#ifdef T_COSE_ENABLE_VERIFY_CACHE
+    struct t_cose_verify_cache *verify_cache;
+    struct q_useful_buf_c       cache_key_label;
+    const struct t_cose_verify_snapshot *cache_snapshot;
+#endif
+#ifdef T_COSE_ENABLE_RATE_LIMIT
+    struct t_cose_rate_limit *rate_limit;
+#endif
+#ifndef T_COSE_DISABLE_PROTECTED_INTERN
+    const struct t_cose_protected_intern_table *intern_table;
+#endif
+#ifdef T_COSE_ENABLE_CAPTURE
+    struct t_cose_capture *capture;
+#endif
+};
+
+
+/**
+ * A \c COSE_Sign1 that has been decoded and hashed and is ready for
+ * the public key operation. See t_cose_sign1_verify_prepare(). The
+ * pointers in it are to the \c COSE_Sign1 passed to
+ * t_cose_sign1_verify_prepare(), which must stay in place until
+ * t_cose_sign1_verify_complete() is called.
+ */
+struct t_cose_sign1_verify_prepared {
+    /* Private data structure */
+    uint8_t               tbs_hash_bytes[T_COSE_PREPARED_MAX_HASH_SIZE];
+    size_t                tbs_hash_len;
+    struct q_useful_buf_c protected_parameters;
+    int32_t               cose_algorithm_id;
+    struct q_useful_buf_c signature;
+    struct q_useful_buf_c kid;
+    bool                  decode_only;
 };
 
 enum t_cose_err_t
@@ -226,6 +342,195 @@ void
 t_cose_sign1_set_verification_key(struct t_cose_sign1_verify_ctx *context,
                                   struct t_cose_key               verification_key);
 
+/**
+ * \brief Have application-defined header parameters returned.
+ *
+ * \param[in] context            The t_cose verification context.
+ * \param[in,out] custom_params  Array of parameters to return.
+ * \param[in] num_custom_params  Number of entries in \c custom_params.
+ *
+ * The caller sets the \c label of each entry in \c custom_params.
+ * When t_cose_sign1_verify() decodes the header parameters it fills
+ * in the type and value of each that occurs, in the same pass that
+ * decodes the standard parameters. Entries for parameters that don't
+ * occur are set to \ref T_COSE_CUSTOM_PARAM_ABSENT.
+ *
+ * These parameters are understood by the caller, so they are not
+ * unknown for the purpose of the crit parameter. A message that
+ * lists one of them as critical will verify.
+ *
+ * A label that occurs in both the protected and unprotected
+ * parameters is an error, \ref T_COSE_ERR_DUPLICATE_PARAMETER, the
+ * same as for standard parameters. Labels of standard parameters
+ * that t_cose decodes itself, like the kid, are never returned here.
+ *
+ * \c custom_params must stay valid while \c context is used.
+ */
+static inline void
+t_cose_sign1_verify_set_custom_parameters(struct t_cose_sign1_verify_ctx *context,
+                                          struct t_cose_custom_parameter *custom_params,
+                                          size_t                          num_custom_params)
+{
+    context->custom_params     = custom_params;
+    context->num_custom_params = num_custom_params;
+}
+
+
+#ifdef T_COSE_ENABLE_RESTARTABLE
+/**
+ * \brief Make verification restartable (time-sliced).
+ *
+ * \param[in] context      The t_cose verification context.
+ * \param[in] restart_ctx  Restart context or \c NULL to turn off.
+ *
+ * With this set, t_cose_sign1_verify() returns \ref
+ * T_COSE_ERR_SIG_IN_PROGRESS when the verification has used up the
+ * per-slice budget set in \c restart_ctx. Call t_cose_sign1_verify()
+ * again with the same \c COSE_Sign1 to continue. The message is
+ * decoded and hashed again on each call, which is cheap compared to
+ * the EC operations, but the public key operation resumes where it
+ * left off.
+ *
+ * See \ref t_cose_restart_ctx.
+ */
+void
+t_cose_sign1_verify_set_restart_ctx(struct t_cose_sign1_verify_ctx *context,
+                                    struct t_cose_restart_ctx      *restart_ctx);
+#endif /* T_COSE_ENABLE_RESTARTABLE */
+
+#ifdef T_COSE_ENABLE_VERIFY_CACHE
+/**
+ * \brief Use a shared cache of successful verifications.
+ *
+ * \param[in] context    The t_cose verification context.
+ * \param[in] cache      The cache from t_cose_verify_cache_attach() or
+ *                       \c NULL to turn off.
+ * \param[in] key_label  Bytes that identify the verification key the
+ *                       same way in all processes, for example a hash
+ *                       of the public key.
+ *
+ * When set, t_cose_sign1_verify() looks for the message in the cache
+ * after hashing the to-be-signed bytes and skips the public key
+ * operation if it is there. After a successful public key
+ * verification the message is added.
+ *
+ * The kid from the message is part of the cache entry, but the
+ * verification key set with t_cose_sign1_set_verification_key() is
+ * not as it is only a local pointer or handle. \c key_label stands
+ * in for it and must be different for different keys and for
+ * different trust domains sharing a cache. Without it a message
+ * verified with one key would be accepted with any other, so the
+ * cache is not used when \c key_label is empty. Call this after
+ * t_cose_sign1_set_verification_key(). Setting another key turns the
+ * cache off until this is called again with the label of that key.
+ * The bytes of \c key_label must stay valid while \c context is used.
+ *
+ * Short-circuit signatures are never cached.
+ *
+ * See t_cose_verify_cache.h.
+ */
+static inline void
+t_cose_sign1_verify_set_cache(struct t_cose_sign1_verify_ctx *context,
+                              struct t_cose_verify_cache     *cache,
+                              struct q_useful_buf_c           key_label)
+{
+    context->verify_cache    = cache;
+    context->cache_key_label = key_label;
+}
+
+
+/**
+ * \brief Warm the cache from a snapshot as messages arrive.
+ *
+ * \param[in] context   The t_cose verification context.
+ * \param[in] snapshot  A snapshot opened with
+ *                      t_cose_verify_snapshot_open() or
+ *                      t_cose_verify_snapshot_map_file(), or \c NULL
+ *                      to turn off.
+ *
+ * When a message is not in the cache set with
+ * t_cose_sign1_verify_set_cache() it is looked for in the snapshot.
+ * If it is there and not expired, it is copied into the cache and
+ * the public key operation is skipped. This loads the snapshot
+ * lazily, only the entries needed, so startup doesn't wait for it.
+ *
+ * The snapshot must be from a cache used with the same key labels.
+ * It must stay valid while \c context is used.
+ */
+static inline void
+t_cose_sign1_verify_set_cache_snapshot(struct t_cose_sign1_verify_ctx      *context,
+                                       const struct t_cose_verify_snapshot *snapshot)
+{
+    context->cache_snapshot = snapshot;
+}
+#endif /* T_COSE_ENABLE_VERIFY_CACHE */
+
+#ifdef T_COSE_ENABLE_RATE_LIMIT
+/**
+ * \brief Limit the rate of verification per kid.
+ *
+ * \param[in] context  The t_cose verification context.
+ * \param[in] limiter  The limiter from t_cose_rate_limit_init() or
+ *                     \c NULL to turn off.
+ *
+ * When set, a token is taken from the bucket of the kid of each
+ * message once the headers are decoded. If there is none,
+ * verification stops with \ref T_COSE_ERR_RATE_LIMITED before the
+ * to-be-signed bytes are hashed. Messages decoded with
+ * \ref T_COSE_OPT_DECODE_ONLY are not counted.
+ *
+ * A message that is refused still used the CPU to decode it, but
+ * that is small compared to the hash and public key operation.
+ */
+static inline void
+t_cose_sign1_verify_set_rate_limit(struct t_cose_sign1_verify_ctx *context,
+                                   struct t_cose_rate_limit       *limiter)
+{
+    context->rate_limit = limiter;
+}
+#endif /* T_COSE_ENABLE_RATE_LIMIT */
+
+#ifndef T_COSE_DISABLE_PROTECTED_INTERN
+/**
+ * \brief Use a table of pre-parsed protected headers.
+ *
+ * \param[in] context  The t_cose verification context.
+ * \param[in] table    The table or \c NULL for only the built-in
+ *                     headers.
+ *
+ * Protected headers that exactly match one in the table are not
+ * parsed. See t_cose_protected_intern.h. The table must stay valid
+ * and unchanged while \c context is used.
+ */
+static inline void
+t_cose_sign1_verify_set_intern_table(struct t_cose_sign1_verify_ctx             *context,
+                                     const struct t_cose_protected_intern_table *table)
+{
+    context->intern_table = table;
+}
+#endif /* T_COSE_DISABLE_PROTECTED_INTERN */
+
+#ifdef T_COSE_ENABLE_CAPTURE
+/**
+ * \brief Record the shape of a sample of the messages verified.
+ *
+ * \param[in] context  The t_cose verification context.
+ * \param[in] capture  The capture from t_cose_capture_init() or
+ *                     \c NULL to turn off.
+ *
+ * t_cose_sign1_verify() adds a record of the shape of the message
+ * and the result to \c capture for a random sample of messages,
+ * including those that fail. t_cose_sign1_verify_prepare() and
+ * t_cose_sign1_verify_complete() don't. See t_cose_capture.h.
+ */
+static inline void
+t_cose_sign1_verify_set_capture(struct t_cose_sign1_verify_ctx *context,
+                                struct t_cose_capture          *capture)
+{
+    context->capture = capture;
+}
+#endif /* T_COSE_ENABLE_CAPTURE */
+
 enum t_cose_err_t
 t_cose_sign1_get_verification_pubkey(uint32_t key_handle,
                                      uint8_t *p_pubkey, size_t capacity, size_t *p_size); 
@@ -283,6 +588,56 @@ enum t_cose_err_t t_cose_sign1_verify(struct t_cose_sign1_verify_ctx *context,
                                       struct t_cose_parameters       *parameters);
 
 
+/**
+ * \brief Decode and hash a \c COSE_Sign1 for verification later.
+ *
+ * \param[in] context      The t_cose signature verification context.
+ * \param[in] sign1        The \c COSE_Sign1 to verify.
+ * \param[out] payload     Pointer and length of the payload.
+ * \param[out] parameters  Place to return parsed parameters. Maybe be \c NULL.
+ * \param[out] prepared    The hash and what else is needed to verify.
+ *
+ * \return This returns one of the error codes defined by \ref t_cose_err_t.
+ *
+ * t_cose_sign1_verify() is this followed by
+ * t_cose_sign1_verify_complete(). This does all the steps up to and
+ * including computing the hash of the to-be-signed bytes. Its cost is
+ * proportional to the size of the \c COSE_Sign1. The public key
+ * operation in t_cose_sign1_verify_complete() is a fixed cost. They
+ * can be run on different threads or scheduled separately.
+ *
+ * The payload and parameters returned here are not verified until
+ * t_cose_sign1_verify_complete() succeeds and must not be relied upon
+ * before then, except to select the verification key.
+ */
+enum t_cose_err_t
+t_cose_sign1_verify_prepare(struct t_cose_sign1_verify_ctx      *context,
+                            struct q_useful_buf_c                sign1,
+                            struct q_useful_buf_c               *payload,
+                            struct t_cose_parameters            *parameters,
+                            struct t_cose_sign1_verify_prepared *prepared);
+
+
+/**
+ * \brief Verify the signature of a prepared \c COSE_Sign1.
+ *
+ * \param[in] context   The t_cose signature verification context.
+ * \param[in] prepared  From t_cose_sign1_verify_prepare().
+ *
+ * \return This returns one of the error codes defined by \ref t_cose_err_t.
+ *
+ * This runs the public key verification using the key, options,
+ * verification cache and restart context in \c context. It need not
+ * be the same context given to t_cose_sign1_verify_prepare() as long
+ * as the options are the same. With a restart context, call this again
+ * with the same inputs when \ref T_COSE_ERR_SIG_IN_PROGRESS is
+ * returned. The hashing is not repeated.
+ */
+enum t_cose_err_t
+t_cose_sign1_verify_complete(const struct t_cose_sign1_verify_ctx      *context,
+                             const struct t_cose_sign1_verify_prepared *prepared);
+
+
 #ifdef __cplusplus
 }
 #endif
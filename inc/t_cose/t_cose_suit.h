@@ -0,0 +1,180 @@
+/*
+ * t_cose_suit.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef __T_COSE_SUIT_H__
+#define __T_COSE_SUIT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+#include "t_cose/t_cose_sign1_verify.h"
+#include "t_cose/t_cose_parallel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * \file t_cose_suit.h
+ *
+ * \brief Verify SUIT firmware update manifests and their images.
+ *
+ * A SUIT envelope ([RFC 9124]
+ * (https://tools.ietf.org/html/rfc9124) and
+ * draft-ietf-suit-manifest) carries a manifest and an authentication
+ * wrapper. The wrapper is a digest of the manifest and a
+ * \c COSE_Sign1 over that digest. The manifest lists the digest and
+ * size of each component image.
+ *
+ * t_cose_suit_verify_envelope() verifies the \c COSE_Sign1 with
+ * t_cose_sign1_verify(), checks the digest of the manifest and
+ * decodes the digest and size of each component from the manifest.
+ * The caller then gives the file each component image is in and
+ * calls t_cose_suit_check_components().
+ *
+ * t_cose_suit_check_components() hashes all the images at once, one
+ * task per image handed to a \ref t_cose_parallel_cb. Each image is
+ * mapped with \c mmap() a window at a time and hashed as it is read.
+ * When one image doesn't match, the others stop at their next chunk,
+ * so a bad update is rejected quickly. When they match, an update of
+ * several images takes about as long as hashing the largest.
+ *
+ * Only what is needed to check the images is decoded from the
+ * manifest: the sequence number, the number of components and the
+ * image digest and size parameters set in the shared sequence of the
+ * common section by the set-component-index, set-parameters and
+ * override-parameters directives. Other commands are skipped and no
+ * commands are run.
+ *
+ * The payload of the \c COSE_Sign1 must be the encoded digest.
+ * Detached payloads are not supported by t_cose_sign1_verify().
+ *
+ * This is only available when \c T_COSE_ENABLE_SUIT is defined. It
+ * needs POSIX \c mmap() and the GCC / Clang \c __atomic builtins.
+ */
+
+
+#ifdef T_COSE_ENABLE_SUIT
+
+/** Most components in a manifest */
+#ifndef T_COSE_SUIT_MAX_COMPONENTS
+#define T_COSE_SUIT_MAX_COMPONENTS 8
+#endif
+
+
+/**
+ * One component image listed in a manifest.
+ */
+struct t_cose_suit_component {
+    /* -- From the manifest -- */
+    /** COSE ID of the hash algorithm of \c digest */
+    int32_t               digest_alg_id;
+    /** Digest the image must have or \c NULL_Q_USEFUL_BUF_C */
+    struct q_useful_buf_c digest;
+    /** Whether the manifest gives \c image_size */
+    bool                  has_image_size;
+    /** Size the image must have */
+    uint64_t              image_size;
+
+    /* -- Input from the caller -- */
+    /** Path of the file with the image or \c NULL to not check it */
+    const char           *path;
+
+    /* -- Output of t_cose_suit_check_components() -- */
+    /** Result of checking the image */
+    enum t_cose_err_t     result;
+};
+
+
+/**
+ * The parts of a verified manifest needed to check the images.
+ * Pointers in it are to the envelope, which must stay in place.
+ */
+struct t_cose_suit_manifest {
+    /** The encoded manifest */
+    struct q_useful_buf_c        manifest;
+    /** The manifest sequence number */
+    uint64_t                     sequence_number;
+    /** Number of entries used in \c components */
+    size_t                       num_components;
+    /** The components in the order of the manifest */
+    struct t_cose_suit_component components[T_COSE_SUIT_MAX_COMPONENTS];
+};
+
+
+/**
+ * \brief Verify a SUIT envelope and decode its manifest.
+ *
+ * \param[in] verify_ctx  Context with the key and options to verify
+ *                        the \c COSE_Sign1 of the authentication
+ *                        wrapper.
+ * \param[in] envelope    The encoded SUIT envelope.
+ * \param[out] manifest   The decoded manifest.
+ *
+ * \retval T_COSE_ERR_SUIT_FORMAT            The envelope or manifest is
+ *                                           not well formed or is
+ *                                           missing a required part.
+ * \retval T_COSE_ERR_PAYLOAD_HASH_MISMATCH  The digest of the manifest
+ *                                           doesn't match or isn't the
+ *                                           payload of the \c COSE_Sign1.
+ * \retval T_COSE_ERR_TOO_MANY_PARAMETERS    More than
+ *                                           \ref T_COSE_SUIT_MAX_COMPONENTS
+ *                                           components.
+ *
+ * Other errors are from t_cose_sign1_verify(). Only the first
+ * authentication block is verified. The \c path of each component is
+ * set to \c NULL.
+ */
+enum t_cose_err_t
+t_cose_suit_verify_envelope(struct t_cose_sign1_verify_ctx *verify_ctx,
+                            struct q_useful_buf_c           envelope,
+                            struct t_cose_suit_manifest    *manifest);
+
+
+/**
+ * \brief Check the images of the components of a verified manifest.
+ *
+ * \param[in,out] manifest  Manifest from t_cose_suit_verify_envelope()
+ *                          with the \c path of each component to check
+ *                          filled in.
+ * \param[in] parallel_cb   Runs the hashing of each image or \c NULL to
+ *                          hash them one after another.
+ * \param[in] cb_context    Passed to \c parallel_cb.
+ *
+ * \retval T_COSE_ERR_PAYLOAD_HASH_MISMATCH  An image doesn't have the
+ *                                           size or digest in the
+ *                                           manifest.
+ * \retval T_COSE_ERR_ARTIFACT_ACCESS        An image could not be
+ *                                           opened or mapped.
+ * \retval T_COSE_ERR_SUIT_FORMAT            The manifest gives no digest
+ *                                           for a component with a path.
+ *
+ * This returns the first error in component order. The result for
+ * each component is in its \c result. Components whose hashing was
+ * stopped because another failed have \ref T_COSE_ERR_ABORTED.
+ * Components without a path are not checked.
+ *
+ * The image sizes are checked before any hashing starts.
+ */
+enum t_cose_err_t
+t_cose_suit_check_components(struct t_cose_suit_manifest *manifest,
+                             t_cose_parallel_cb           parallel_cb,
+                             void                        *cb_context);
+
+#endif /* T_COSE_ENABLE_SUIT */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_SUIT_H__ */
@@ -0,0 +1,335 @@
+/*
+ * t_cose_verify_cache.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef __T_COSE_VERIFY_CACHE_H__
+#define __T_COSE_VERIFY_CACHE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * \file t_cose_verify_cache.h
+ *
+ * \brief A cache of successful signature verifications that can be
+ * shared between processes.
+ *
+ * A server that runs as many worker processes, each verifying the
+ * same tokens, gets a poor hit rate from a per-process cache. This
+ * cache is laid out in one block of memory supplied by the caller,
+ * typically a \c MAP_SHARED mapping made before forking, so that all
+ * the workers share it.
+ *
+ * The memory contains no pointers so it may be mapped at a different
+ * address in each process. It is a header followed by a fixed number
+ * of buckets that are searched by open addressing. Each bucket is
+ * protected by a sequence lock updated with atomic compare-and-swap
+ * so there are no locks to be left held by a process that dies. A
+ * reader that races with a writer treats the bucket as a miss rather
+ * than waiting.
+ *
+ * An entry is a SHA-256 over the to-be-signed hash, the signature,
+ * the kid and a caller-supplied label for the verification key. The
+ * cache is not used without a label. Only successful verifications
+ * are entered, so a hit means this exact signature over this exact
+ * to-be-signed data was verified with the same key before. There is
+ * nothing to invalidate as a given signature stays valid or invalid.
+ * If keys can be revoked, the label must change with the key or the
+ * cache must be formatted again.
+ *
+ * A restarted server starts with an empty cache and verifies
+ * everything again until it fills, which can be several times the
+ * steady-state CPU. A snapshot of the cache saved before the restart
+ * avoids that. A snapshot is the entries of the cache sorted so they
+ * can be searched where they are, with a format version and a
+ * checksum. Entries are stamped with the time they were added and
+ * those older than the snapshot's maximum age are left out when it is
+ * written and ignored when it is read. The snapshot is loaded lazily:
+ * when a lookup misses the cache, the entry is looked for in the
+ * snapshot and copied into the cache if found. With
+ * \c T_COSE_ENABLE_VERIFY_SNAPSHOT_FILE the snapshot can be written
+ * to and mapped from a file.
+ *
+ * The checksum only detects a damaged or truncated snapshot. Anyone
+ * who can write the snapshot can make any signature verify, so it
+ * must be protected as well as the verification keys are.
+ *
+ * This needs the GCC / Clang \c __atomic builtins and is only
+ * available when \c T_COSE_ENABLE_VERIFY_CACHE is defined.
+ *
+ * Use:
+ *  - One process calls t_cose_verify_cache_format() on the shared memory.
+ *  - Each process calls t_cose_verify_cache_attach().
+ *  - Set the cache on the verification context with
+ *    t_cose_sign1_verify_set_cache().
+ *  - Read hit rate and contention with t_cose_verify_cache_get_stats().
+ *  - Call t_cose_verify_cache_set_time() every second or so.
+ *  - Periodically and on shutdown, write a snapshot with
+ *    t_cose_verify_cache_snapshot() or t_cose_verify_cache_save_file().
+ *  - On startup, open the snapshot with t_cose_verify_snapshot_open()
+ *    or t_cose_verify_snapshot_map_file() and set it on the
+ *    verification context with t_cose_sign1_verify_set_cache_snapshot().
+ */
+
+
+#ifdef T_COSE_ENABLE_VERIFY_CACHE
+
+/**
+ * Opaque handle for the cache. It is the start of the caller's memory.
+ */
+struct t_cose_verify_cache;
+
+
+/**
+ * Counts kept in the shared memory, summed across all processes.
+ */
+struct t_cose_verify_cache_stats {
+    /** Lookups that found the entry */
+    uint64_t hits;
+    /** Lookups that did not find the entry */
+    uint64_t misses;
+    /** Entries added */
+    uint64_t inserts;
+    /** Entries added by replacing an older one */
+    uint64_t evictions;
+    /** Bucket accesses that raced with a writer in another process
+     * or thread */
+    uint64_t contended;
+    /** Entries copied from a snapshot after a miss */
+    uint64_t restored;
+    /** Number of buckets */
+    uint32_t bucket_count;
+};
+
+
+/**
+ * \brief Compute the memory needed for a cache.
+ *
+ * \param[in] bucket_count  Number of buckets. Must be a power of two.
+ *
+ * \return The number of bytes or 0 if \c bucket_count is not valid.
+ *
+ * Each bucket is 40 bytes and holds one entry.
+ */
+size_t t_cose_verify_cache_size(uint32_t bucket_count);
+
+
+/**
+ * \brief Format memory as an empty cache.
+ *
+ * \param[in] memory        The memory. Must be 8-byte aligned.
+ * \param[in] bucket_count  Number of buckets. Must be a power of two.
+ * \param[out] cache        The handle to use the cache.
+ *
+ * \retval T_COSE_ERR_TOO_SMALL         \c memory is smaller than
+ *                                      t_cose_verify_cache_size().
+ * \retval T_COSE_ERR_INVALID_ARGUMENT  Bad \c bucket_count or alignment.
+ *
+ * This must be called once before any process uses the cache and
+ * not while any process is using it.
+ */
+enum t_cose_err_t
+t_cose_verify_cache_format(struct q_useful_buf          memory,
+                           uint32_t                     bucket_count,
+                           struct t_cose_verify_cache **cache);
+
+
+/**
+ * \brief Use memory that was formatted by another process.
+ *
+ * \param[in] memory  The memory, possibly mapped at a different address.
+ * \param[out] cache  The handle to use the cache.
+ *
+ * \retval T_COSE_ERR_INVALID_ARGUMENT  \c memory is not a formatted cache.
+ * \retval T_COSE_ERR_TOO_SMALL         \c memory is smaller than the
+ *                                      formatted cache.
+ */
+enum t_cose_err_t
+t_cose_verify_cache_attach(struct q_useful_buf          memory,
+                           struct t_cose_verify_cache **cache);
+
+
+/**
+ * \brief Get the counts for all processes using the cache.
+ *
+ * \param[in] cache   The cache.
+ * \param[out] stats  The counts.
+ *
+ * The counts are read individually without locking so they may be
+ * slightly inconsistent with each other.
+ */
+void
+t_cose_verify_cache_get_stats(const struct t_cose_verify_cache  *cache,
+                              struct t_cose_verify_cache_stats *stats);
+
+
+/**
+ * \brief Set the time used to stamp and expire entries.
+ *
+ * \param[in] cache  The cache.
+ * \param[in] now    The time in seconds. Use the time since the epoch
+ *                   so it carries over restarts.
+ *
+ * Entries are stamped with the last time set when they are added.
+ * One process or thread should call this about once a second. If it
+ * is never called all entries have the same time and never expire.
+ */
+void
+t_cose_verify_cache_set_time(struct t_cose_verify_cache *cache,
+                             uint32_t                    now);
+
+
+/**
+ * A snapshot opened for reading. The bytes of the snapshot must stay
+ * valid while it is used.
+ */
+struct t_cose_verify_snapshot {
+    /* Private data structure */
+    const void *entries;
+    uint32_t    entry_count;
+    uint32_t    saved_time;
+    uint32_t    max_age;
+    void       *mapping;
+    size_t      mapping_len;
+};
+
+
+/**
+ * \brief Compute the largest a snapshot of a cache can be.
+ *
+ * \param[in] cache  The cache.
+ *
+ * \return The number of bytes, 40 per bucket and a small header.
+ */
+size_t
+t_cose_verify_cache_snapshot_size(const struct t_cose_verify_cache *cache);
+
+
+/**
+ * \brief Write a snapshot of a cache.
+ *
+ * \param[in] cache     The cache.
+ * \param[in] max_age   Entries added more than this many seconds
+ *                      before the time set with
+ *                      t_cose_verify_cache_set_time() are left out.
+ *                      It is also stored in the snapshot and applies
+ *                      when it is read.
+ * \param[in] buffer    Where to write the snapshot. Must be 8-byte
+ *                      aligned.
+ * \param[out] snapshot The snapshot in \c buffer.
+ *
+ * \retval T_COSE_ERR_TOO_SMALL         \c buffer is too small. It
+ *                                      never is if it is
+ *                                      t_cose_verify_cache_snapshot_size().
+ * \retval T_COSE_ERR_INVALID_ARGUMENT  \c buffer is not aligned.
+ *
+ * This may be called while other processes use the cache. Buckets
+ * that are being written at the time are left out.
+ */
+enum t_cose_err_t
+t_cose_verify_cache_snapshot(struct t_cose_verify_cache *cache,
+                             uint32_t                    max_age,
+                             struct q_useful_buf         buffer,
+                             struct q_useful_buf_c      *snapshot);
+
+
+/**
+ * \brief Check a snapshot and prepare to read it.
+ *
+ * \param[in] snapshot_bytes  The bytes of a snapshot. Must be 8-byte
+ *                            aligned, as memory from mmap() is.
+ * \param[out] snapshot       The opened snapshot.
+ *
+ * \retval T_COSE_ERR_SNAPSHOT_FORMAT  The snapshot is of another
+ *                                     version, truncated or the
+ *                                     checksum is wrong.
+ *
+ * The checksum is checked by reading the whole snapshot once.
+ */
+enum t_cose_err_t
+t_cose_verify_snapshot_open(struct q_useful_buf_c          snapshot_bytes,
+                            struct t_cose_verify_snapshot *snapshot);
+
+
+/**
+ * \brief Copy all the entries of a snapshot into a cache.
+ *
+ * \param[in] cache     The cache.
+ * \param[in] snapshot  The snapshot.
+ *
+ * Entries are copied with their original time, so they expire as
+ * they would have. Use this instead of setting the snapshot on the
+ * verification context to fill the cache before traffic arrives. A
+ * cache smaller than the one saved keeps only some of the entries.
+ */
+void
+t_cose_verify_cache_restore(struct t_cose_verify_cache          *cache,
+                            const struct t_cose_verify_snapshot *snapshot);
+
+
+#ifdef T_COSE_ENABLE_VERIFY_SNAPSHOT_FILE
+/**
+ * \brief Write a snapshot of a cache to a file.
+ *
+ * \param[in] cache    The cache.
+ * \param[in] max_age  As for t_cose_verify_cache_snapshot().
+ * \param[in] path     The file. It is replaced atomically.
+ *
+ * \retval T_COSE_ERR_ARTIFACT_ACCESS  The file couldn't be written.
+ *
+ * The snapshot is written to \c path with ".tmp" appended, synced and
+ * renamed to \c path, so a reader sees the old or the new snapshot,
+ * never a partial one. The file is created readable only by its owner.
+ */
+enum t_cose_err_t
+t_cose_verify_cache_save_file(struct t_cose_verify_cache *cache,
+                              uint32_t                    max_age,
+                              const char                 *path);
+
+
+/**
+ * \brief Map a snapshot file and open it.
+ *
+ * \param[in] path       The file.
+ * \param[out] snapshot  The opened snapshot.
+ *
+ * \retval T_COSE_ERR_ARTIFACT_ACCESS  The file couldn't be mapped.
+ *
+ * Other errors are as for t_cose_verify_snapshot_open(). Release it
+ * with t_cose_verify_snapshot_unmap_file().
+ */
+enum t_cose_err_t
+t_cose_verify_snapshot_map_file(const char                    *path,
+                                struct t_cose_verify_snapshot *snapshot);
+
+
+/**
+ * \brief Unmap a snapshot mapped by t_cose_verify_snapshot_map_file().
+ *
+ * \param[in] snapshot  The snapshot. It can't be used after this.
+ */
+void
+t_cose_verify_snapshot_unmap_file(struct t_cose_verify_snapshot *snapshot);
+#endif /* T_COSE_ENABLE_VERIFY_SNAPSHOT_FILE */
+
+#endif /* T_COSE_ENABLE_VERIFY_CACHE */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_VERIFY_CACHE_H__ */
@@ -0,0 +1,307 @@
+/*
+ * t_cose_verify_sched.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef __T_COSE_VERIFY_SCHED_H__
+#define __T_COSE_VERIFY_SCHED_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+#include "t_cose/t_cose_sign1_verify.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * \file t_cose_verify_sched.h
+ *
+ * \brief Deadline-ordered queue of \c COSE_Sign1 verifications.
+ *
+ * When interactive requests and large bulk jobs share a verifier,
+ * first-come first-served makes the interactive requests wait behind
+ * the bulk ones. This queue orders requests by deadline instead,
+ * earliest deadline first (EDF), so a request that must be answered
+ * soon goes ahead of one that can wait.
+ *
+ * Each request has a priority class. A request without a deadline
+ * gets one from the maximum wait of its class. This is the aging
+ * that keeps bulk requests from waiting forever behind a steady
+ * stream of interactive ones. Requests with the same deadline go in
+ * class order and then in the order they were submitted.
+ *
+ * Admission control estimates when a new request would finish from
+ * the number of requests ahead of it and the running average time
+ * of a verification. If that is past its deadline it is rejected
+ * straight away with \ref T_COSE_ERR_DEADLINE_UNREACHABLE so the
+ * caller can shed load or answer from elsewhere. A request whose
+ * deadline passes while it is queued is returned without being
+ * verified with \ref T_COSE_ERR_DEADLINE_MISSED.
+ *
+ * The queue time of each verification is counted in a histogram per
+ * class with buckets on powers of two of the clock unit. Together
+ * with the deadline miss counters this is what is needed to set and
+ * monitor tail-latency targets per class.
+ *
+ * The queue is a binary heap of pointers to requests owned by the
+ * caller, in an array also owned by the caller. Nothing is allocated.
+ * Time comes from a callback so any clock and unit can be used,
+ * typically microseconds from a monotonic clock.
+ *
+ * This is not thread-safe. One thread dispatches from the queue. To
+ * feed a pool of verification threads, give each its own queue or
+ * protect the queue with a lock.
+ */
+
+
+/** The number of priority classes */
+#define T_COSE_SCHED_NUM_CLASSES 2
+
+/** Interactive requests, typically with tight deadlines */
+#define T_COSE_SCHED_CLASS_INTERACTIVE 0
+
+/** Bulk requests, typically with no deadline */
+#define T_COSE_SCHED_CLASS_BULK 1
+
+/** The number of buckets in a queue-time histogram */
+#define T_COSE_SCHED_HISTOGRAM_BUCKETS 32
+
+/** A deadline of this means none */
+#define T_COSE_SCHED_NO_DEADLINE UINT64_MAX
+
+
+/**
+ * \brief Callback to read the clock.
+ *
+ * \param[in] cb_context  The \c cb_context given to
+ *                        t_cose_verify_sched_init().
+ *
+ * \return The time. Any unit can be used as long as deadlines are
+ *         in the same unit. It must not go backwards.
+ */
+typedef uint64_t (*t_cose_sched_clock_cb)(void *cb_context);
+
+
+/**
+ * A request to verify one \c COSE_Sign1. The caller owns it and
+ * fills in the inputs. It must stay in place from
+ * t_cose_verify_sched_submit() until it is returned by
+ * t_cose_verify_sched_run_next().
+ */
+struct t_cose_verify_sched_request {
+    /* -- Inputs -- */
+    /** The verification context with the key and options to use */
+    struct t_cose_sign1_verify_ctx *verify_ctx;
+    /** The \c COSE_Sign1 to verify */
+    struct q_useful_buf_c           cose_sign1;
+    /** Where to put the parameters or \c NULL */
+    struct t_cose_parameters       *parameters;
+    /** Time it must be verified by or \ref T_COSE_SCHED_NO_DEADLINE */
+    uint64_t                        deadline;
+    /** \ref T_COSE_SCHED_CLASS_INTERACTIVE or \ref T_COSE_SCHED_CLASS_BULK */
+    unsigned                        priority_class;
+    /** For the caller's use. Not used by the queue. */
+    void                           *user_context;
+
+    /* -- Outputs set when returned by t_cose_verify_sched_run_next() -- */
+    /** Result of t_cose_sign1_verify() or \ref T_COSE_ERR_DEADLINE_MISSED */
+    enum t_cose_err_t               result;
+    /** The payload from t_cose_sign1_verify() */
+    struct q_useful_buf_c           payload;
+    /** Time from submission to the start of verification */
+    uint64_t                        queue_time;
+
+    /* -- Private -- */
+    uint64_t                        submit_time;
+    uint64_t                        effective_deadline;
+    uint64_t                        sequence;
+};
+
+
+/**
+ * Counters for the queue. All times are in the unit of the clock.
+ */
+struct t_cose_verify_sched_stats {
+    /** Requests accepted by t_cose_verify_sched_submit() */
+    uint64_t submitted;
+    /** Requests rejected by admission control */
+    uint64_t rejected;
+    /** Requests verified, successfully or not */
+    uint64_t verified;
+    /** Requests not verified because their deadline passed in the
+     * queue, per class */
+    uint64_t expired[T_COSE_SCHED_NUM_CLASSES];
+    /** Requests verified, but finished after their deadline, per
+     * class */
+    uint64_t finished_late[T_COSE_SCHED_NUM_CLASSES];
+    /** Queue times per class. Bucket 0 counts times of 0 and 1,
+     * bucket \c i counts times from 2^i up to 2^(i+1) and the last
+     * bucket counts everything longer. */
+    uint64_t queue_time_histogram[T_COSE_SCHED_NUM_CLASSES][T_COSE_SCHED_HISTOGRAM_BUCKETS];
+    /** Running average time of one verification */
+    uint64_t average_verify_time;
+};
+
+
+/**
+ * The verification queue. The members are private.
+ */
+struct t_cose_verify_sched {
+    /* Private data structure */
+    struct t_cose_verify_sched_request **heap;
+    size_t                               max_requests;
+    size_t                               num_requests;
+    uint64_t                             next_sequence;
+    uint64_t                             class_max_wait[T_COSE_SCHED_NUM_CLASSES];
+    t_cose_sched_clock_cb                clock_cb;
+    void                                *cb_context;
+    struct t_cose_verify_sched_stats     stats;
+};
+
+
+/**
+ * \brief Initialize a verification queue.
+ *
+ * \param[out] sched              The queue to initialize.
+ * \param[in] heap                Array for pointers to the queued
+ *                                requests.
+ * \param[in] max_requests        Number of entries in \c heap.
+ * \param[in] clock_cb            Callback to read the clock.
+ * \param[in] cb_context          Passed to \c clock_cb.
+ * \param[in] initial_verify_time Estimate of the time of one
+ *                                verification used for admission
+ *                                control until some have been timed.
+ *
+ * The maximum wait of every class is \ref T_COSE_SCHED_NO_DEADLINE.
+ * Set it with t_cose_verify_sched_set_max_wait().
+ */
+void
+t_cose_verify_sched_init(struct t_cose_verify_sched          *sched,
+                         struct t_cose_verify_sched_request **heap,
+                         size_t                               max_requests,
+                         t_cose_sched_clock_cb                clock_cb,
+                         void                                *cb_context,
+                         uint64_t                             initial_verify_time);
+
+
+/**
+ * \brief Set the longest a request of a class waits.
+ *
+ * \param[in] sched           The queue.
+ * \param[in] priority_class  The class.
+ * \param[in] max_wait        The longest wait or \ref
+ *                            T_COSE_SCHED_NO_DEADLINE.
+ *
+ * A request is scheduled as if its deadline were the earlier of its
+ * own deadline and its submission time plus \c max_wait. Only
+ * requests submitted after this is called are affected.
+ */
+static inline void
+t_cose_verify_sched_set_max_wait(struct t_cose_verify_sched *sched,
+                                 unsigned                    priority_class,
+                                 uint64_t                    max_wait);
+
+
+/**
+ * \brief Queue a request.
+ *
+ * \param[in] sched    The queue.
+ * \param[in] request  The request with its inputs filled in.
+ *
+ * \retval T_COSE_ERR_DEADLINE_UNREACHABLE  The request would not be
+ *                                          finished by its deadline.
+ * \retval T_COSE_ERR_TOO_SMALL             The queue is full.
+ * \retval T_COSE_ERR_INVALID_ARGUMENT      The priority class is not
+ *                                          valid.
+ *
+ * The finish time is estimated as the current time plus the average
+ * verification time for this request and each queued request
+ * scheduled before it. Requests already queued are not re-checked,
+ * so a request with an earlier deadline may push them past theirs.
+ */
+enum t_cose_err_t
+t_cose_verify_sched_submit(struct t_cose_verify_sched         *sched,
+                           struct t_cose_verify_sched_request *request);
+
+
+/**
+ * \brief Verify the request with the earliest deadline.
+ *
+ * \param[in] sched  The queue.
+ *
+ * \return The request, with its outputs filled in, or \c NULL if the
+ *         queue is empty.
+ *
+ * If the deadline of the request has passed it is not verified and
+ * its result is \ref T_COSE_ERR_DEADLINE_MISSED. Otherwise it is
+ * verified with t_cose_sign1_verify() and timed.
+ */
+struct t_cose_verify_sched_request *
+t_cose_verify_sched_run_next(struct t_cose_verify_sched *sched);
+
+
+/**
+ * \brief Number of requests in the queue.
+ *
+ * \param[in] sched  The queue.
+ */
+static inline size_t
+t_cose_verify_sched_pending(const struct t_cose_verify_sched *sched);
+
+
+/**
+ * \brief Get the counters of the queue.
+ *
+ * \param[in] sched  The queue.
+ *
+ * \return The counters. They stay valid and keep being updated while
+ *         \c sched is used.
+ */
+static inline const struct t_cose_verify_sched_stats *
+t_cose_verify_sched_get_stats(const struct t_cose_verify_sched *sched);
+
+
+
+
+/* ------------------------------------------------------------------------
+ * Inline implementations of public functions defined above.
+ */
+static inline void
+t_cose_verify_sched_set_max_wait(struct t_cose_verify_sched *sched,
+                                 unsigned                    priority_class,
+                                 uint64_t                    max_wait)
+{
+    if(priority_class < T_COSE_SCHED_NUM_CLASSES) {
+        sched->class_max_wait[priority_class] = max_wait;
+    }
+}
+
+
+static inline size_t
+t_cose_verify_sched_pending(const struct t_cose_verify_sched *sched)
+{
+    return sched->num_requests;
+}
+
+
+static inline const struct t_cose_verify_sched_stats *
+t_cose_verify_sched_get_stats(const struct t_cose_verify_sched *sched)
+{
+    return &(sched->stats);
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_VERIFY_SCHED_H__ */
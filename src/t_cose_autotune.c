@@ -0,0 +1,286 @@
+/*
+ *  t_cose_autotune.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "t_cose/t_cose_autotune.h"
+#include <string.h>
+
+
+/**
+ * \file t_cose_autotune.c
+ *
+ * \brief Implementation of the hill-climbing controller.
+ *
+ * There is one trial at a time. It is either of the best settings,
+ * when \c neighbour is -1, or of neighbour number \c neighbour of the
+ * best settings. Neighbour \c n changes setting \c n / 2, up when
+ * \c n is even and down when it is odd. Neighbours that are outside
+ * the range or the same as the best are skipped.
+ */
+
+
+/** Number of settings being tuned */
+#define AUTOTUNE_DIMENSIONS 3
+
+/** Number of neighbours of one set of settings */
+#define AUTOTUNE_NEIGHBOURS (AUTOTUNE_DIMENSIONS * 2)
+
+#define DEFAULT_RUNS_PER_TRIAL   4
+#define DEFAULT_MIN_GAIN_PERCENT 3
+
+
+/*
+ * Check a range and fill in its start.
+ */
+static bool
+check_range(struct t_cose_autotune_range *range)
+{
+    if(range->min == 0 || range->max < range->min) {
+        return false;
+    }
+    if(range->start == 0) {
+        range->start = range->min;
+    }
+    return range->start >= range->min && range->start <= range->max;
+}
+
+
+/*
+ * Make neighbour n of the best settings. Returns false if it is
+ * outside the range or the same as the best.
+ */
+static bool
+make_neighbour(const struct t_cose_autotune     *tuner,
+               int                               n,
+               struct t_cose_autotune_settings  *neighbour)
+{
+    const struct t_cose_autotune_range *range;
+    uint32_t                           *value;
+    uint32_t                            old_value;
+    const bool                          up = (n % 2) == 0;
+
+    *neighbour = tuner->best.settings;
+    switch(n / 2) {
+    case 0:
+        range = &tuner->config.batch_size;
+        value = &neighbour->batch_size;
+        break;
+    case 1:
+        range = &tuner->config.worker_count;
+        value = &neighbour->worker_count;
+        break;
+    default:
+        range = &tuner->config.lane_width;
+        value = &neighbour->lane_width;
+        break;
+    }
+    old_value = *value;
+
+    if(value == &neighbour->worker_count) {
+        *value = up ? old_value + 1 : old_value - 1;
+    } else {
+        *value = up ? old_value * 2 : old_value / 2;
+    }
+    /* Clamp so a range that isn't a power of two still reaches its
+     * ends. Going up may also have overflowed. */
+    if(up && (*value > range->max || *value < old_value)) {
+        *value = range->max;
+    }
+    if(!up && *value < range->min) {
+        *value = range->min;
+    }
+
+    return *value != old_value;
+}
+
+
+/*
+ * The next neighbour after n that can be tried or -1 if none are left.
+ */
+static int
+next_neighbour(const struct t_cose_autotune *tuner, int n)
+{
+    struct t_cose_autotune_settings neighbour;
+
+    for(n++; n < AUTOTUNE_NEIGHBOURS; n++) {
+        if(make_neighbour(tuner, n, &neighbour)) {
+            return n;
+        }
+    }
+    return -1;
+}
+
+
+/*
+ * Whether a trial is under the latency target.
+ */
+static inline bool
+within_target(const struct t_cose_autotune       *tuner,
+              const struct t_cose_autotune_trial *trial)
+{
+    return tuner->config.latency_target == 0 ||
+           trial->latency <= tuner->config.latency_target;
+}
+
+
+/*
+ * Whether trial a is better than trial b by at least gain_percent
+ * more throughput.
+ */
+static bool
+is_better(const struct t_cose_autotune       *tuner,
+          const struct t_cose_autotune_trial *a,
+          const struct t_cose_autotune_trial *b,
+          uint32_t                            gain_percent)
+{
+    const bool a_ok = within_target(tuner, a);
+    const bool b_ok = within_target(tuner, b);
+
+    if(a_ok != b_ok) {
+        return a_ok;
+    }
+    if(!a_ok) {
+        return a->latency < b->latency;
+    }
+    /* Throughput is messages per second so this won't overflow */
+    return a->throughput * 100 > b->throughput * (100 + gain_percent);
+}
+
+
+static void
+update_stats(struct t_cose_autotune *tuner)
+{
+    tuner->stats.best            = tuner->best.settings;
+    tuner->stats.best_throughput = tuner->best.throughput;
+    tuner->stats.best_latency    = tuner->best.latency;
+    tuner->stats.within_target   = within_target(tuner, &tuner->best);
+}
+
+
+/*
+ * Start a trial of the neighbours of the best settings, or of the
+ * best settings again if they have no neighbours.
+ */
+static void
+start_neighbours(struct t_cose_autotune *tuner)
+{
+    tuner->best_neighbour.measured = false;
+    tuner->neighbour = next_neighbour(tuner, -1);
+    if(tuner->neighbour < 0) {
+        /* Nothing to tune */
+        tuner->stats.converged = true;
+        tuner->hold_trials     = tuner->config.reprobe_trials;
+    }
+}
+
+
+/*
+ * Public function. See t_cose_autotune.h
+ */
+enum t_cose_err_t
+t_cose_autotune_init(struct t_cose_autotune              *tuner,
+                     const struct t_cose_autotune_config *config)
+{
+    memset(tuner, 0, sizeof(*tuner));
+    tuner->config = *config;
+
+    if(!check_range(&tuner->config.batch_size) ||
+       !check_range(&tuner->config.worker_count) ||
+       !check_range(&tuner->config.lane_width)) {
+        return T_COSE_ERR_INVALID_ARGUMENT;
+    }
+    if(tuner->config.runs_per_trial == 0) {
+        tuner->config.runs_per_trial = DEFAULT_RUNS_PER_TRIAL;
+    }
+    if(tuner->config.min_gain_percent == 0) {
+        tuner->config.min_gain_percent = DEFAULT_MIN_GAIN_PERCENT;
+    }
+
+    tuner->best.settings.batch_size   = tuner->config.batch_size.start;
+    tuner->best.settings.worker_count = tuner->config.worker_count.start;
+    tuner->best.settings.lane_width   = tuner->config.lane_width.start;
+    tuner->current   = tuner->best.settings;
+    tuner->neighbour = -1;
+    update_stats(tuner);
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function. See t_cose_autotune.h
+ */
+void
+t_cose_autotune_record(struct t_cose_autotune *tuner,
+                       uint64_t                messages,
+                       uint64_t                run_time,
+                       uint64_t                latency)
+{
+    struct t_cose_autotune_trial trial;
+
+    tuner->run_messages += messages;
+    tuner->run_time     += run_time;
+    if(latency > tuner->run_latency) {
+        tuner->run_latency = latency;
+    }
+    tuner->runs++;
+    if(tuner->runs < tuner->config.runs_per_trial) {
+        return;
+    }
+
+    /* -- A trial is complete -- */
+    trial.settings   = tuner->current;
+    trial.throughput = tuner->run_time ? tuner->run_messages * 1000000000 / tuner->run_time
+                                       : UINT64_MAX / 200;
+    trial.latency    = tuner->run_latency;
+    trial.measured   = true;
+    tuner->runs         = 0;
+    tuner->run_messages = 0;
+    tuner->run_time     = 0;
+    tuner->run_latency  = 0;
+    tuner->stats.trials++;
+
+    if(tuner->neighbour < 0) {
+        /* The best settings again, to follow changes in the load */
+        tuner->best = trial;
+        if(tuner->stats.converged && tuner->config.reprobe_trials == 0) {
+            /* Never try the neighbours again */
+        } else if(tuner->hold_trials > 0) {
+            tuner->hold_trials--;
+        } else {
+            start_neighbours(tuner);
+        }
+    } else {
+        if(!tuner->best_neighbour.measured ||
+           is_better(tuner, &trial, &tuner->best_neighbour, 0)) {
+            tuner->best_neighbour = trial;
+        }
+        tuner->neighbour = next_neighbour(tuner, tuner->neighbour);
+        if(tuner->neighbour < 0) {
+            /* All the neighbours have been tried */
+            if(is_better(tuner, &tuner->best_neighbour, &tuner->best,
+                         tuner->config.min_gain_percent)) {
+                tuner->best = tuner->best_neighbour;
+                tuner->stats.moves++;
+                tuner->stats.converged = false;
+                start_neighbours(tuner);
+            } else {
+                tuner->stats.converged = true;
+                tuner->hold_trials     = tuner->config.reprobe_trials;
+            }
+        }
+    }
+
+    if(tuner->neighbour < 0) {
+        tuner->current = tuner->best.settings;
+    } else {
+        make_neighbour(tuner, tuner->neighbour, &tuner->current);
+    }
+    update_stats(tuner);
+}
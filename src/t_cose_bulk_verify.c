@@ -0,0 +1,703 @@
+/*
+ *  t_cose_bulk_verify.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifdef T_COSE_ENABLE_BULK_VERIFY
+#ifdef T_COSE_HAVE_LIBURING
+/* liburing.h needs the GNU extensions, for example cpu_set_t */
+#define _GNU_SOURCE
+#else
+/* For pthreads, dprintf() and friends when compiling with -std=c99 */
+#define _POSIX_C_SOURCE 200809L
+#endif
+#endif
+
+#include "t_cose/t_cose_bulk_verify.h"
+#include <string.h>
+
+
+/**
+ * \file t_cose_bulk_verify.c
+ *
+ * \brief Implementation of bulk verification of files.
+ *
+ * The caller's buffer is divided into queue_depth slots, each big
+ * enough for the largest file allowed plus one byte so a file that is
+ * too long can be told from one that just fits. Ahead of the slots
+ * are their bookkeeping and two queues of slot numbers.
+ *
+ * With io_uring the calling thread does all the I/O. For each free
+ * slot it submits a chain of three requests: open the next file into
+ * the direct descriptor with the slot's number, read it into the
+ * slot, and close it. The read is hard-linked to the close so the
+ * close happens even though the read is short, which it always is.
+ * When all three have completed, the slot is put on the ready queue.
+ * The worker threads take slots from the ready queue, verify them and
+ * put them on the free queue for the calling thread to use again.
+ *
+ * Without io_uring each worker thread has its own slot and takes the
+ * next file from a shared counter, then opens, reads and verifies it.
+ */
+
+
+#ifdef T_COSE_ENABLE_BULK_VERIFY
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#ifdef T_COSE_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+
+#define BULK_DEFAULT_THREADS     4
+#define BULK_DEFAULT_QUEUE_DEPTH 1024
+#define BULK_DEFAULT_FILE_SIZE   (64 * 1024)
+/* Registered buffers are limited to 1GiB */
+#define BULK_MAX_FILE_SIZE       (64 * 1024 * 1024)
+
+#define BULK_SLOT_ALIGN 64
+
+
+struct bulk_slot {
+    size_t   file_index;
+    int32_t  open_result;
+    int32_t  read_result;
+    uint32_t pending;
+};
+
+
+/* The configuration with the defaults filled in */
+struct bulk_layout {
+    uint32_t threads;
+    uint32_t queue_depth;
+    uint32_t max_file_size;
+    size_t   slot_len;
+    size_t   meta_len;
+};
+
+
+struct bulk_shared {
+    const struct t_cose_sign1_verify_ctx *verify_template;
+    const char * const                   *paths;
+    size_t                                num_paths;
+    struct t_cose_bulk_result            *results;
+    struct bulk_layout                    layout;
+    struct bulk_slot                     *slots;
+    uint8_t                              *data;
+
+    /* Blocking reads. The next file not yet taken. */
+    size_t                                next_file;
+
+    /* io_uring. Slots read and waiting to be verified, and slots
+     * free to read into. */
+    pthread_mutex_t                       lock;
+    pthread_cond_t                        ready_cond;
+    pthread_cond_t                        free_cond;
+    uint32_t                             *ready;
+    uint32_t                              ready_head;
+    uint32_t                              ready_count;
+    uint32_t                             *free_slots;
+    uint32_t                              free_count;
+    bool                                  done;
+};
+
+
+struct bulk_worker {
+    struct bulk_shared *shared;
+    uint32_t            index;
+};
+
+
+static bool
+get_layout(const struct t_cose_bulk_verify_config *config,
+           struct bulk_layout                     *layout)
+{
+    layout->threads       = config->worker_threads ? config->worker_threads
+                                                   : BULK_DEFAULT_THREADS;
+    layout->queue_depth   = config->queue_depth ? config->queue_depth
+                                                : BULK_DEFAULT_QUEUE_DEPTH;
+    layout->max_file_size = config->max_file_size ? config->max_file_size
+                                                  : BULK_DEFAULT_FILE_SIZE;
+
+    if(layout->threads > T_COSE_BULK_VERIFY_MAX_THREADS ||
+       layout->queue_depth > T_COSE_BULK_VERIFY_MAX_QUEUE_DEPTH ||
+       layout->queue_depth < layout->threads ||
+       layout->max_file_size > BULK_MAX_FILE_SIZE) {
+        return false;
+    }
+
+    /* One more byte than the largest file to detect longer ones */
+    layout->slot_len = ((size_t)layout->max_file_size + 1 + BULK_SLOT_ALIGN - 1) &
+                       ~(size_t)(BULK_SLOT_ALIGN - 1);
+    layout->meta_len = layout->queue_depth *
+                       (sizeof(struct bulk_slot) + 2 * sizeof(uint32_t));
+
+    return true;
+}
+
+
+/*
+ * Public function. See t_cose_bulk_verify.h
+ */
+size_t
+t_cose_bulk_verify_buffer_size(const struct t_cose_bulk_verify_config *config)
+{
+    struct bulk_layout layout;
+
+    if(!get_layout(config, &layout)) {
+        return 0;
+    }
+    return layout.meta_len + BULK_SLOT_ALIGN +
+           (size_t)layout.queue_depth * layout.slot_len;
+}
+
+
+static inline uint64_t
+now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+
+static inline void
+set_io_error(struct t_cose_bulk_result *result, int os_error)
+{
+    result->result   = T_COSE_ERR_ARTIFACT_ACCESS;
+    result->os_error = os_error;
+    result->file_len = 0;
+}
+
+
+/*
+ * Verify one file that has been read. Runs on the worker threads.
+ */
+static void
+verify_file(const struct bulk_shared *shared,
+            size_t                    file_index,
+            const uint8_t            *bytes,
+            size_t                    len)
+{
+    /* A copy so the threads don't share the context */
+    struct t_cose_sign1_verify_ctx verify_ctx = *shared->verify_template;
+    struct t_cose_bulk_result     *result     = &shared->results[file_index];
+    struct q_useful_buf_c          payload;
+
+    result->os_error = 0;
+    result->file_len = (uint32_t)len;
+    if(len > shared->layout.max_file_size) {
+        result->result = T_COSE_ERR_TOO_SMALL;
+        return;
+    }
+
+    result->result = t_cose_sign1_verify(&verify_ctx,
+                                         (struct q_useful_buf_c){bytes, len},
+                                         &payload,
+                                         NULL);
+}
+
+
+/*
+ * Read a whole file, or as much as fits, with blocking calls.
+ */
+static int
+read_file(const char *path, uint8_t *buffer, size_t buffer_len, size_t *len)
+{
+    int     fd;
+    ssize_t bytes_read;
+    size_t  total;
+    int     os_error;
+
+    do {
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    } while(fd < 0 && errno == EINTR);
+    if(fd < 0) {
+        return errno;
+    }
+
+    os_error = 0;
+    total    = 0;
+    while(total < buffer_len) {
+        bytes_read = read(fd, buffer + total, buffer_len - total);
+        if(bytes_read < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            os_error = errno;
+            break;
+        }
+        if(bytes_read == 0) {
+            break;
+        }
+        total += (size_t)bytes_read;
+    }
+    close(fd);
+
+    *len = total;
+    return os_error;
+}
+
+
+/*
+ * A worker thread when not using io_uring.
+ */
+static void *
+blocking_worker_main(void *arg)
+{
+    struct bulk_worker *worker = (struct bulk_worker *)arg;
+    struct bulk_shared *shared = worker->shared;
+    uint8_t            *buffer = shared->data + worker->index * shared->layout.slot_len;
+    size_t              file_index;
+    size_t              len;
+    int                 os_error;
+
+    for(;;) {
+        file_index = __atomic_fetch_add(&shared->next_file, 1, __ATOMIC_RELAXED);
+        if(file_index >= shared->num_paths) {
+            break;
+        }
+        os_error = read_file(shared->paths[file_index],
+                             buffer,
+                             shared->layout.slot_len,
+                             &len);
+        if(os_error) {
+            set_io_error(&shared->results[file_index], os_error);
+            continue;
+        }
+        verify_file(shared, file_index, buffer, len);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Verify with blocking reads on worker threads plus the calling
+ * thread. If a thread can't be created the others do its share.
+ */
+static void
+run_blocking(struct bulk_shared *shared, struct bulk_worker *workers)
+{
+    pthread_t threads[T_COSE_BULK_VERIFY_MAX_THREADS];
+    bool      created[T_COSE_BULK_VERIFY_MAX_THREADS];
+    uint32_t  i;
+
+    shared->next_file = 0;
+    for(i = 0; i < shared->layout.threads; i++) {
+        workers[i].shared = shared;
+        workers[i].index  = i;
+    }
+
+    /* The calling thread is worker 0 */
+    for(i = 1; i < shared->layout.threads; i++) {
+        created[i] = pthread_create(&threads[i],
+                                    NULL,
+                                    blocking_worker_main,
+                                    &workers[i]) == 0;
+    }
+    blocking_worker_main(&workers[0]);
+    for(i = 1; i < shared->layout.threads; i++) {
+        if(created[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+}
+
+
+#ifdef T_COSE_HAVE_LIBURING
+
+/* The request is in the low two bits of the user data, the slot above */
+#define BULK_OP_OPEN  0
+#define BULK_OP_READ  1
+#define BULK_OP_CLOSE 2
+#define BULK_OP_BITS  2
+
+#define BULK_USER_DATA(slot, op) ((void *)(uintptr_t)(((uintptr_t)(slot) << BULK_OP_BITS) | (op)))
+
+
+/*
+ * A worker thread when using io_uring.
+ */
+static void *
+uring_worker_main(void *arg)
+{
+    struct bulk_worker *worker = (struct bulk_worker *)arg;
+    struct bulk_shared *shared = worker->shared;
+    struct bulk_slot   *slot;
+    uint32_t            slot_index;
+
+    for(;;) {
+        pthread_mutex_lock(&shared->lock);
+        while(shared->ready_count == 0 && !shared->done) {
+            pthread_cond_wait(&shared->ready_cond, &shared->lock);
+        }
+        if(shared->ready_count == 0) {
+            pthread_mutex_unlock(&shared->lock);
+            break;
+        }
+        slot_index = shared->ready[shared->ready_head];
+        shared->ready_head = (shared->ready_head + 1) % shared->layout.queue_depth;
+        shared->ready_count--;
+        pthread_mutex_unlock(&shared->lock);
+
+        slot = &shared->slots[slot_index];
+        verify_file(shared,
+                    slot->file_index,
+                    shared->data + slot_index * shared->layout.slot_len,
+                    (size_t)slot->read_result);
+
+        pthread_mutex_lock(&shared->lock);
+        shared->free_slots[shared->free_count++] = slot_index;
+        pthread_cond_signal(&shared->free_cond);
+        pthread_mutex_unlock(&shared->lock);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Submit the open, read and close of a file into a slot.
+ */
+static void
+submit_file(struct io_uring    *ring,
+            struct bulk_shared *shared,
+            bool                fixed_buffers,
+            uint32_t            slot_index,
+            size_t              file_index)
+{
+    struct io_uring_sqe *sqe;
+    uint8_t             *buffer = shared->data + slot_index * shared->layout.slot_len;
+
+    shared->slots[slot_index].file_index  = file_index;
+    shared->slots[slot_index].open_result = 0;
+    shared->slots[slot_index].read_result = 0;
+    shared->slots[slot_index].pending     = 3;
+
+    /* There is always room as the ring has three entries per slot */
+    sqe = io_uring_get_sqe(ring);
+    io_uring_prep_openat_direct(sqe, AT_FDCWD, shared->paths[file_index],
+                                O_RDONLY, 0, slot_index);
+    io_uring_sqe_set_data(sqe, BULK_USER_DATA(slot_index, BULK_OP_OPEN));
+    /* If the open fails, the read and close are cancelled */
+    io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+
+    sqe = io_uring_get_sqe(ring);
+    if(fixed_buffers) {
+        io_uring_prep_read_fixed(sqe, (int)slot_index, buffer,
+                                 (unsigned)shared->layout.slot_len, 0, 0);
+    } else {
+        io_uring_prep_read(sqe, (int)slot_index, buffer,
+                           (unsigned)shared->layout.slot_len, 0);
+    }
+    io_uring_sqe_set_data(sqe, BULK_USER_DATA(slot_index, BULK_OP_READ));
+    /* A short read fails a normal link, but the file must be closed */
+    io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK);
+
+    sqe = io_uring_get_sqe(ring);
+    io_uring_prep_close_direct(sqe, slot_index);
+    io_uring_sqe_set_data(sqe, BULK_USER_DATA(slot_index, BULK_OP_CLOSE));
+}
+
+
+/*
+ * Record a completion. Returns true when all three requests for the
+ * slot are done.
+ */
+static bool
+complete_request(struct bulk_shared *shared, struct io_uring_cqe *cqe)
+{
+    const uintptr_t   user_data = (uintptr_t)io_uring_cqe_get_data(cqe);
+    struct bulk_slot *slot      = &shared->slots[user_data >> BULK_OP_BITS];
+
+    switch(user_data & ((1u << BULK_OP_BITS) - 1)) {
+    case BULK_OP_OPEN:
+        slot->open_result = cqe->res;
+        break;
+    case BULK_OP_READ:
+        slot->read_result = cqe->res;
+        break;
+    default:
+        /* Nothing to do if the close fails */
+        break;
+    }
+
+    return --slot->pending == 0;
+}
+
+
+/*
+ * Read with io_uring on the calling thread and verify on worker
+ * threads. Returns false without doing anything if io_uring can't be
+ * used.
+ */
+static bool
+run_uring(struct bulk_shared *shared, struct bulk_worker *workers)
+{
+    struct io_uring      ring;
+    struct io_uring_cqe *cqe;
+    struct iovec         data_iov;
+    pthread_t            threads[T_COSE_BULK_VERIFY_MAX_THREADS];
+    uint32_t             num_threads;
+    uint32_t             slot_index;
+    uint32_t             in_flight;
+    uint32_t             reaped;
+    unsigned             head;
+    uint32_t             i;
+    size_t               next_file;
+    bool                 fixed_buffers;
+    int                  result;
+    struct bulk_slot    *slot;
+
+    if(io_uring_queue_init(3 * shared->layout.queue_depth, &ring, 0) < 0) {
+        return false;
+    }
+    /* Open into direct descriptors. Needs Linux 5.19. */
+    if(io_uring_register_files_sparse(&ring, shared->layout.queue_depth) < 0) {
+        io_uring_queue_exit(&ring);
+        return false;
+    }
+    /* Registered buffers save mapping the pages of each read, but are
+     * limited by RLIMIT_MEMLOCK on older kernels. Plain reads if not. */
+    data_iov.iov_base = shared->data;
+    data_iov.iov_len  = (size_t)shared->layout.queue_depth * shared->layout.slot_len;
+    fixed_buffers = io_uring_register_buffers(&ring, &data_iov, 1) == 0;
+
+    pthread_mutex_init(&shared->lock, NULL);
+    pthread_cond_init(&shared->ready_cond, NULL);
+    pthread_cond_init(&shared->free_cond, NULL);
+    shared->ready_head  = 0;
+    shared->ready_count = 0;
+    shared->done        = false;
+    for(slot_index = 0; slot_index < shared->layout.queue_depth; slot_index++) {
+        shared->free_slots[slot_index] = shared->layout.queue_depth - 1 - slot_index;
+    }
+    shared->free_count = shared->layout.queue_depth;
+
+    num_threads = 0;
+    for(i = 0; i < shared->layout.threads; i++) {
+        workers[num_threads].shared = shared;
+        workers[num_threads].index  = num_threads;
+        if(pthread_create(&threads[num_threads], NULL, uring_worker_main,
+                          &workers[num_threads]) == 0) {
+            num_threads++;
+        }
+    }
+    if(num_threads == 0) {
+        /* Nothing to verify what is read */
+        pthread_cond_destroy(&shared->free_cond);
+        pthread_cond_destroy(&shared->ready_cond);
+        pthread_mutex_destroy(&shared->lock);
+        io_uring_queue_exit(&ring);
+        return false;
+    }
+
+    next_file = 0;
+    in_flight = 0;
+    for(;;) {
+        /* -- Start reading into every free slot -- */
+        pthread_mutex_lock(&shared->lock);
+        while(shared->free_count > 0 && next_file < shared->num_paths) {
+            slot_index = shared->free_slots[--shared->free_count];
+            submit_file(&ring, shared, fixed_buffers, slot_index, next_file++);
+            in_flight++;
+        }
+        if(in_flight == 0) {
+            if(next_file == shared->num_paths) {
+                pthread_mutex_unlock(&shared->lock);
+                break;
+            }
+            /* All slots are being verified */
+            while(shared->free_count == 0) {
+                pthread_cond_wait(&shared->free_cond, &shared->lock);
+            }
+            pthread_mutex_unlock(&shared->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&shared->lock);
+
+        /* -- Wait for at least one completion -- */
+        result = io_uring_submit_and_wait(&ring, 1);
+        if(result < 0 && result != -EINTR && result != -EAGAIN && result != -EBUSY) {
+            break;
+        }
+
+        /* -- Hand the files read to the workers -- */
+        /* The lock is taken once for everything reaped, not per file */
+        reaped = 0;
+        pthread_mutex_lock(&shared->lock);
+        io_uring_for_each_cqe(&ring, head, cqe) {
+            reaped++;
+            if(!complete_request(shared, cqe)) {
+                continue;
+            }
+            in_flight--;
+            slot_index = (uint32_t)((uintptr_t)io_uring_cqe_get_data(cqe) >> BULK_OP_BITS);
+            slot       = &shared->slots[slot_index];
+            if(slot->open_result < 0 || slot->read_result < 0) {
+                set_io_error(&shared->results[slot->file_index],
+                             slot->open_result < 0 ? -slot->open_result
+                                                   : -slot->read_result);
+                shared->free_slots[shared->free_count++] = slot_index;
+            } else {
+                shared->ready[(shared->ready_head + shared->ready_count) %
+                              shared->layout.queue_depth] = slot_index;
+                shared->ready_count++;
+            }
+        }
+        if(shared->ready_count > 0) {
+            pthread_cond_broadcast(&shared->ready_cond);
+        }
+        pthread_mutex_unlock(&shared->lock);
+        io_uring_cq_advance(&ring, reaped);
+    }
+
+    if(in_flight > 0 || next_file < shared->num_paths) {
+        /* io_uring failed part way. Fail what wasn't finished. */
+        for(slot_index = 0; slot_index < shared->layout.queue_depth; slot_index++) {
+            if(shared->slots[slot_index].pending > 0) {
+                set_io_error(&shared->results[shared->slots[slot_index].file_index], EIO);
+            }
+        }
+        while(next_file < shared->num_paths) {
+            set_io_error(&shared->results[next_file++], EIO);
+        }
+    }
+
+    /* -- Let the workers finish what is ready and exit -- */
+    pthread_mutex_lock(&shared->lock);
+    shared->done = true;
+    pthread_cond_broadcast(&shared->ready_cond);
+    pthread_mutex_unlock(&shared->lock);
+    while(num_threads > 0) {
+        pthread_join(threads[--num_threads], NULL);
+    }
+
+    pthread_cond_destroy(&shared->free_cond);
+    pthread_cond_destroy(&shared->ready_cond);
+    pthread_mutex_destroy(&shared->lock);
+    io_uring_queue_exit(&ring);
+
+    return true;
+}
+#endif /* T_COSE_HAVE_LIBURING */
+
+
+/*
+ * Public function. See t_cose_bulk_verify.h
+ */
+enum t_cose_err_t
+t_cose_bulk_verify(const struct t_cose_bulk_verify_config *config,
+                   struct q_useful_buf                     buffer,
+                   const char * const                     *paths,
+                   size_t                                  num_paths,
+                   struct t_cose_bulk_result              *results,
+                   struct t_cose_bulk_verify_stats        *stats)
+{
+    struct bulk_shared shared;
+    struct bulk_worker workers[T_COSE_BULK_VERIFY_MAX_THREADS];
+    uintptr_t          data_start;
+    uint64_t           start;
+    size_t             i;
+    bool               used_io_uring;
+
+    const struct t_cose_sign1_verify_ctx *verify_template = config->verify_template;
+
+    if(verify_template == NULL || verify_template->custom_params != NULL
+#ifdef T_COSE_ENABLE_RESTARTABLE
+       || verify_template->restart_ctx != NULL
+#endif
+#ifdef T_COSE_ENABLE_CAPTURE
+       || verify_template->capture != NULL
+#endif
+       ) {
+        /* These can't be shared between threads */
+        return T_COSE_ERR_INVALID_ARGUMENT;
+    }
+    if(!get_layout(config, &shared.layout) ||
+       ((uintptr_t)buffer.ptr % sizeof(uint64_t)) != 0) {
+        return T_COSE_ERR_INVALID_ARGUMENT;
+    }
+    if(buffer.ptr == NULL || buffer.len < t_cose_bulk_verify_buffer_size(config)) {
+        return T_COSE_ERR_TOO_SMALL;
+    }
+
+    start = now_ns();
+
+    shared.verify_template = verify_template;
+    shared.paths           = paths;
+    shared.num_paths       = num_paths;
+    shared.results         = results;
+    shared.slots           = (struct bulk_slot *)buffer.ptr;
+    shared.ready           = (uint32_t *)(shared.slots + shared.layout.queue_depth);
+    shared.free_slots      = shared.ready + shared.layout.queue_depth;
+    data_start = ((uintptr_t)buffer.ptr + shared.layout.meta_len + BULK_SLOT_ALIGN - 1) &
+                 ~(uintptr_t)(BULK_SLOT_ALIGN - 1);
+    shared.data            = (uint8_t *)data_start;
+    memset(shared.slots, 0, shared.layout.queue_depth * sizeof(struct bulk_slot));
+
+    used_io_uring = false;
+#ifdef T_COSE_HAVE_LIBURING
+    if(!config->disable_io_uring && num_paths > 0) {
+        used_io_uring = run_uring(&shared, workers);
+    }
+#endif /* T_COSE_HAVE_LIBURING */
+    if(!used_io_uring) {
+        run_blocking(&shared, workers);
+    }
+
+    if(stats != NULL) {
+        stats->files         = num_paths;
+        stats->failed        = 0;
+        stats->bytes         = 0;
+        stats->used_io_uring = used_io_uring;
+        for(i = 0; i < num_paths; i++) {
+            if(results[i].result != T_COSE_SUCCESS) {
+                stats->failed++;
+            }
+            stats->bytes += results[i].file_len;
+        }
+        stats->elapsed_ns = now_ns() - start;
+    }
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function. See t_cose_bulk_verify.h
+ */
+enum t_cose_err_t
+t_cose_bulk_verify_write_manifest(int                              fd,
+                                  const char * const              *paths,
+                                  const struct t_cose_bulk_result *results,
+                                  size_t                           num_results)
+{
+    size_t i;
+
+    for(i = 0; i < num_results; i++) {
+        if(dprintf(fd, "%d\t%d\t%u\t%s\n",
+                   (int)results[i].result,
+                   (int)results[i].os_error,
+                   (unsigned)results[i].file_len,
+                   paths[i]) < 0) {
+            return T_COSE_ERR_ARTIFACT_ACCESS;
+        }
+    }
+
+    return T_COSE_SUCCESS;
+}
+
+#endif /* T_COSE_ENABLE_BULK_VERIFY */
@@ -0,0 +1,334 @@
+/*
+ *  t_cose_capture.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "t_cose/t_cose_capture.h"
+#include "t_cose/q_useful_buf.h"
+#include "t_cose_capture_internal.h"
+#include "t_cose_util.h"
+#include <string.h>
+
+
+/**
+ * \file t_cose_capture.c
+ *
+ * \brief Sampled capture of the shape of verified messages.
+ *
+ * The log is little-endian with fixed-size records so it can be read
+ * without a CBOR decoder. The header is
+ *
+ *     0   4  magic "TCWL"
+ *     4   1  version, \ref T_COSE_CAPTURE_VERSION
+ *     5   1  record size, \ref T_COSE_CAPTURE_RECORD_SIZE
+ *     6   2  zero
+ *     8   4  sample rate
+ *     12  4  zero
+ *
+ * and each record is
+ *
+ *     0   2  COSE algorithm ID, signed
+ *     2   1  result
+ *     3   1  flags
+ *     4   4  payload length
+ *     8   2  protected parameters length
+ *     10  2  signature length
+ *     12  1  kid length
+ *     13  1  other length
+ *     14  2  kid tag
+ */
+
+
+#ifdef T_COSE_ENABLE_CAPTURE
+
+static const uint8_t s_capture_magic[4] = {'T', 'C', 'W', 'L'};
+
+
+static inline void
+put_u16(uint8_t *out, uint16_t value)
+{
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+}
+
+
+static inline void
+put_u32(uint8_t *out, uint32_t value)
+{
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+    out[2] = (uint8_t)(value >> 16);
+    out[3] = (uint8_t)(value >> 24);
+}
+
+
+static inline uint16_t
+get_u16(const uint8_t *in)
+{
+    return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+
+static inline uint32_t
+get_u32(const uint8_t *in)
+{
+    return (uint32_t)in[0]         | ((uint32_t)in[1] << 8) |
+           ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+
+static inline uint32_t
+saturate(size_t value, uint32_t max)
+{
+    return value > max ? max : (uint32_t)value;
+}
+
+
+/*
+ * xorshift32. Sampling doesn't need to be unpredictable, only to not
+ * line up with periodic traffic the way every Nth message would.
+ */
+static inline uint32_t
+next_random(struct t_cose_capture *me)
+{
+    uint32_t x = me->random_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    me->random_state = x;
+
+    return x;
+}
+
+
+/*
+ * FNV-1a of the salt and the kid folded to 16 bits.
+ */
+static uint16_t
+kid_tag(uint32_t salt, struct q_useful_buf_c kid)
+{
+    uint32_t       hash = 2166136261u;
+    const uint8_t *p;
+    size_t         i;
+
+    for(i = 0; i < sizeof(salt); i++) {
+        hash = (hash ^ (uint8_t)(salt >> (8 * i))) * 16777619u;
+    }
+    p = kid.ptr;
+    for(i = 0; i < kid.len; i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+
+    return (uint16_t)(hash ^ (hash >> 16));
+}
+
+
+/*
+ * Public function. See t_cose_capture.h
+ */
+enum t_cose_err_t
+t_cose_capture_init(struct t_cose_capture   *me,
+                    struct q_useful_buf      buffer,
+                    uint32_t                 sample_rate,
+                    uint32_t                 seed,
+                    t_cose_capture_flush_cb *flush_cb,
+                    void                    *cb_context)
+{
+    uint8_t *header;
+
+    if(buffer.ptr == NULL ||
+       buffer.len < T_COSE_CAPTURE_HEADER_SIZE + T_COSE_CAPTURE_RECORD_SIZE) {
+        return T_COSE_ERR_TOO_SMALL;
+    }
+
+    me->buffer            = buffer;
+    me->sample_rate       = sample_rate > 1 ? sample_rate : 1;
+    /* xorshift32 must not start at zero */
+    me->random_state      = seed ? seed : 0x9e3779b9u;
+    me->kid_salt          = seed * 0x85ebca6bu + 0xc2b2ae35u;
+    me->messages_seen     = 0;
+    me->messages_recorded = 0;
+    me->messages_dropped  = 0;
+    me->flush_cb          = flush_cb;
+    me->flush_cb_context  = cb_context;
+
+    header = buffer.ptr;
+    memset(header, 0, T_COSE_CAPTURE_HEADER_SIZE);
+    memcpy(header, s_capture_magic, sizeof(s_capture_magic));
+    header[4] = T_COSE_CAPTURE_VERSION;
+    header[5] = T_COSE_CAPTURE_RECORD_SIZE;
+    put_u32(header + 8, me->sample_rate);
+    me->used = T_COSE_CAPTURE_HEADER_SIZE;
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function. See t_cose_capture.h
+ */
+void
+t_cose_capture_flush(struct t_cose_capture *me)
+{
+    if(me->flush_cb == NULL || me->used == 0) {
+        return;
+    }
+    (me->flush_cb)(me->flush_cb_context,
+                   (struct q_useful_buf_c){me->buffer.ptr, me->used});
+    me->used = 0;
+}
+
+
+/*
+ * Public function. See t_cose_capture.h
+ */
+void
+t_cose_capture_encode_record(const struct t_cose_capture_record *record,
+                             uint8_t out[T_COSE_CAPTURE_RECORD_SIZE])
+{
+    put_u16(out, (uint16_t)(int16_t)record->cose_algorithm_id);
+    out[2] = (uint8_t)record->result;
+    out[3] = record->flags;
+    put_u32(out + 4, record->payload_len);
+    put_u16(out + 8, record->protected_len);
+    put_u16(out + 10, record->signature_len);
+    out[12] = record->kid_len;
+    out[13] = record->other_len;
+    put_u16(out + 14, record->kid_tag);
+}
+
+
+/*
+ * Public function. See t_cose_capture.h
+ */
+enum t_cose_err_t
+t_cose_capture_decode_header(struct q_useful_buf_c  log,
+                             uint32_t              *sample_rate,
+                             struct q_useful_buf_c *records)
+{
+    const uint8_t *header = log.ptr;
+
+    if(log.len < T_COSE_CAPTURE_HEADER_SIZE ||
+       memcmp(header, s_capture_magic, sizeof(s_capture_magic)) ||
+       header[4] != T_COSE_CAPTURE_VERSION ||
+       header[5] != T_COSE_CAPTURE_RECORD_SIZE ||
+       (log.len - T_COSE_CAPTURE_HEADER_SIZE) % T_COSE_CAPTURE_RECORD_SIZE) {
+        return T_COSE_ERR_CAPTURE_FORMAT;
+    }
+
+    *sample_rate = get_u32(header + 8);
+    *records = q_useful_buf_tail(log, T_COSE_CAPTURE_HEADER_SIZE);
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function. See t_cose_capture.h
+ */
+enum t_cose_err_t
+t_cose_capture_decode_record(struct q_useful_buf_c        *records,
+                             struct t_cose_capture_record *record)
+{
+    const uint8_t *in = records->ptr;
+
+    if(records->len < T_COSE_CAPTURE_RECORD_SIZE) {
+        return T_COSE_ERR_CAPTURE_FORMAT;
+    }
+
+    record->cose_algorithm_id = (int16_t)get_u16(in);
+    record->result            = (enum t_cose_err_t)in[2];
+    record->flags             = in[3];
+    record->payload_len       = get_u32(in + 4);
+    record->protected_len     = get_u16(in + 8);
+    record->signature_len     = get_u16(in + 10);
+    record->kid_len           = in[12];
+    record->other_len         = in[13];
+    record->kid_tag           = get_u16(in + 14);
+
+    *records = q_useful_buf_tail(*records, T_COSE_CAPTURE_RECORD_SIZE);
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Internal function. See t_cose_capture_internal.h
+ */
+void
+t_cose_capture_verified(struct t_cose_capture                     *me,
+                        uint32_t                                   option_flags,
+                        struct q_useful_buf_c                      cose_sign1,
+                        struct q_useful_buf_c                      payload,
+                        const struct t_cose_parameters            *parameters,
+                        const struct t_cose_sign1_verify_prepared *prepared,
+                        enum t_cose_err_t                          result)
+{
+    struct t_cose_capture_record record;
+    size_t                       known_len;
+
+    me->messages_seen++;
+    if(me->sample_rate > 1 && next_random(me) % me->sample_rate) {
+        return;
+    }
+
+    if(me->used + T_COSE_CAPTURE_RECORD_SIZE > me->buffer.len) {
+        if(me->flush_cb == NULL) {
+            me->messages_dropped++;
+            return;
+        }
+        t_cose_capture_flush(me);
+    }
+
+    record.cose_algorithm_id = prepared->cose_algorithm_id;
+    record.result            = result;
+    record.flags             = 0;
+    record.payload_len       = saturate(payload.len, UINT32_MAX);
+    record.protected_len     = (uint16_t)saturate(prepared->protected_parameters.len, UINT16_MAX);
+    record.signature_len     = (uint16_t)saturate(prepared->signature.len, UINT16_MAX);
+    record.kid_len           = (uint8_t)saturate(prepared->kid.len, UINT8_MAX);
+    record.kid_tag           = q_useful_buf_c_is_null(prepared->kid) ?
+                                   0 : kid_tag(me->kid_salt, prepared->kid);
+
+    known_len = payload.len + prepared->protected_parameters.len +
+                prepared->signature.len + prepared->kid.len;
+    record.other_len = (uint8_t)saturate(cose_sign1.len > known_len ?
+                                             cose_sign1.len - known_len : 0,
+                                         UINT8_MAX);
+
+    /* Tag 18 is encoded in one byte */
+    if(cose_sign1.len > 0 && *(const uint8_t *)cose_sign1.ptr == 0xd2) {
+        record.flags |= T_COSE_CAPTURE_FLAG_TAGGED;
+    }
+    if(option_flags & T_COSE_OPT_DECODE_ONLY) {
+        record.flags |= T_COSE_CAPTURE_FLAG_DECODE_ONLY;
+    }
+#ifndef T_COSE_DISABLE_SHORT_CIRCUIT_SIGN
+    if(!q_useful_buf_compare(prepared->kid, get_short_circuit_kid())) {
+        record.flags |= T_COSE_CAPTURE_FLAG_SHORT_CIRCUIT;
+    }
+#endif
+#ifndef T_COSE_DISABLE_CONTENT_TYPE
+    /* The parameters are only filled in once the payload is reached */
+    if(parameters != NULL && !q_useful_buf_c_is_null(payload) &&
+       (parameters->content_type_uint != T_COSE_EMPTY_UINT_CONTENT_TYPE ||
+        !q_useful_buf_c_is_null(parameters->content_type_tstr))) {
+        record.flags |= T_COSE_CAPTURE_FLAG_CONTENT_TYPE;
+    }
+#else
+    (void)parameters;
+#endif
+
+    t_cose_capture_encode_record(&record,
+                                 (uint8_t *)me->buffer.ptr + me->used);
+    me->used += T_COSE_CAPTURE_RECORD_SIZE;
+    me->messages_recorded++;
+}
+
+#endif /* T_COSE_ENABLE_CAPTURE */
@@ -0,0 +1,64 @@
+/*
+ *  t_cose_capture_internal.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+
+#ifndef __T_COSE_CAPTURE_INTERNAL_H__
+#define __T_COSE_CAPTURE_INTERNAL_H__
+
+#include <stdint.h>
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+#include "t_cose/t_cose_sign1_verify.h"
+#include "t_cose/t_cose_capture.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \file t_cose_capture_internal.h
+ *
+ * \brief Functions of workload capture used by t_cose_sign1_verify().
+ */
+
+
+#ifdef T_COSE_ENABLE_CAPTURE
+
+/**
+ * \brief Record a message if it is sampled.
+ *
+ * \param[in] capture       The capture.
+ * \param[in] option_flags  The option flags of the verification.
+ * \param[in] cose_sign1    The whole message.
+ * \param[in] payload       The payload or \c NULL_Q_USEFUL_BUF_C if
+ *                          decoding didn't get that far.
+ * \param[in] parameters    The decoded parameters or \c NULL. Only
+ *                          used if \c payload is not
+ *                          \c NULL_Q_USEFUL_BUF_C.
+ * \param[in] prepared      The parts of the message found. Those not
+ *                          found must be \c NULL_Q_USEFUL_BUF_C.
+ * \param[in] result        The result of the verification.
+ */
+void
+t_cose_capture_verified(struct t_cose_capture                     *capture,
+                        uint32_t                                   option_flags,
+                        struct q_useful_buf_c                      cose_sign1,
+                        struct q_useful_buf_c                      payload,
+                        const struct t_cose_parameters            *parameters,
+                        const struct t_cose_sign1_verify_prepared *prepared,
+                        enum t_cose_err_t                          result);
+
+#endif /* T_COSE_ENABLE_CAPTURE */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_CAPTURE_INTERNAL_H__ */
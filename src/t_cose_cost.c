@@ -0,0 +1,61 @@
+/*
+ *  t_cose_cost.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "t_cose/t_cose_cost.h"
+#include <string.h>
+
+
+/**
+ * \file t_cose_cost.c
+ *
+ * \brief Verification cost counters.
+ *
+ * The counting is done by \ref T_COSE_COST_ADD where the work is.
+ */
+
+
+#ifdef T_COSE_ENABLE_COST_COUNTERS
+
+struct t_cose_cost t_cose_cost_counters;
+
+
+/*
+ * Public function. See t_cose_cost.h
+ */
+void
+t_cose_cost_reset(void)
+{
+    memset(&t_cose_cost_counters, 0, sizeof(t_cose_cost_counters));
+}
+
+
+/*
+ * Public function. See t_cose_cost.h
+ */
+void
+t_cose_cost_get(struct t_cose_cost *cost)
+{
+    *cost = t_cose_cost_counters;
+}
+
+
+/*
+ * Public function. See t_cose_cost.h
+ */
+uint64_t
+t_cose_cost_total(const struct t_cose_cost *cost)
+{
+    return cost->cbor_items +
+           cost->label_compares +
+           cost->hash_bytes / T_COSE_COST_HASH_BYTES_PER_UNIT +
+           cost->public_key_ops * T_COSE_COST_PUBLIC_KEY_OP;
+}
+
+#endif /* T_COSE_ENABLE_COST_COUNTERS */
@@ -0,0 +1,779 @@
+/*
+ *  t_cose_countersign.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "qcbor/qcbor.h"
+#include "t_cose/t_cose_countersign.h"
+#include "t_cose/q_useful_buf.h"
+#include "t_cose_crypto.h"
+#include "t_cose_util.h"
+#include "t_cose_parameters.h"
+#include "t_cose_standard_constants.h"
+#include <string.h>
+
+
+/**
+ * \file t_cose_countersign.c
+ *
+ * \brief Implementation of RFC 9338 countersignatures on a
+ * \c COSE_Sign1.
+ */
+
+
+/**
+ * Size of the buffer for the protected parameters of a
+ * countersignature. They are only the algorithm ID.
+ */
+#define COUNTERSIGN_PROTECTED_SIZE 16
+
+/**
+ * Amount of payload hashed into each hash context before moving on
+ * to the next. It is small enough that the chunk is still in the
+ * CPU cache when the last context hashes it.
+ */
+#define COUNTERSIGN_HASH_CHUNK 4096
+
+
+/**
+ * One decoded \c COSE_Countersignature.
+ */
+struct countersignature {
+    struct q_useful_buf_c protected_parameters;
+    int32_t               cose_algorithm_id;
+    struct q_useful_buf_c kid;
+    struct q_useful_buf_c signature;
+};
+
+
+/**
+ * The countersignatures in the unprotected header parameters of a
+ * \c COSE_Sign1 and where they are.
+ */
+struct countersignatures {
+    struct countersignature list[T_COSE_MAX_COUNTERSIGNATURES];
+    size_t                  count;
+    /* Number of entries in the unprotected header parameter map */
+    uint16_t                map_count;
+    /* The encoded value of the countersignature parameter or
+     * NULL_Q_USEFUL_BUF_C if there is none */
+    struct q_useful_buf_c   value;
+    /* Whether value is an array of countersignatures */
+    bool                    is_array;
+    /* The head of the array if it is one */
+    struct q_useful_buf_c   array_head;
+};
+
+
+/**
+ * \brief Find where the head of a CBOR item is.
+ *
+ * \param[in] message     The encoded CBOR the item is in.
+ * \param[in] content     Where the content of the item starts.
+ * \param[in] major_type  The CBOR major type of the item.
+ * \param[in] argument    The length or count of the item.
+ * \param[out] head       The head of the item.
+ *
+ * \return \c false if the head before \c content is not the preferred
+ *         encoding of \c major_type and \c argument.
+ *
+ * QCBOR gives where the content of strings is, but not where their
+ * head is. With preferred serialization the head is known from the
+ * length so it can be found by encoding it and checking.
+ */
+static bool
+find_head(struct q_useful_buf_c  message,
+          const void            *content,
+          uint8_t                major_type,
+          uint64_t               argument,
+          struct q_useful_buf_c *head)
+{
+    Q_USEFUL_BUF_MAKE_STACK_UB( buffer, QCBOR_HEAD_BUFFER_SIZE);
+    struct q_useful_buf_c       encoded_head;
+    size_t                      offset;
+
+    encoded_head = QCBOREncode_EncodeHead(buffer, major_type, 0, argument);
+
+    offset = (size_t)((const uint8_t *)content - (const uint8_t *)message.ptr);
+    if(offset < encoded_head.len) {
+        return false;
+    }
+    head->ptr = (const uint8_t *)content - encoded_head.len;
+    head->len = encoded_head.len;
+
+    return !q_useful_buf_compare(*head, encoded_head);
+}
+
+
+/**
+ * \brief Find the unprotected header parameters of a \c COSE_Sign1.
+ *
+ * \param[in] cose_sign1            The \c COSE_Sign1.
+ * \param[in] protected_parameters  Its protected parameters.
+ * \param[in] payload               Its payload.
+ * \param[out] unprotected          The encoded unprotected parameter map.
+ *
+ * \retval T_COSE_ERR_SIGN1_FORMAT  The payload is not a preferred
+ *                                  encoded byte string right after the
+ *                                  unprotected parameters.
+ *
+ * The map is what lies between the protected parameters and the
+ * payload.
+ */
+static enum t_cose_err_t
+find_unprotected(struct q_useful_buf_c  cose_sign1,
+                 struct q_useful_buf_c  protected_parameters,
+                 struct q_useful_buf_c  payload,
+                 struct q_useful_buf_c *unprotected)
+{
+    struct q_useful_buf_c payload_head;
+    const uint8_t        *map_start;
+
+    if(!find_head(cose_sign1,
+                  payload.ptr,
+                  CBOR_MAJOR_TYPE_BYTE_STRING,
+                  payload.len,
+                  &payload_head)) {
+        return T_COSE_ERR_SIGN1_FORMAT;
+    }
+
+    map_start = (const uint8_t *)protected_parameters.ptr + protected_parameters.len;
+    if((const uint8_t *)payload_head.ptr <= map_start) {
+        return T_COSE_ERR_SIGN1_FORMAT;
+    }
+    unprotected->ptr = map_start;
+    unprotected->len = (size_t)((const uint8_t *)payload_head.ptr - map_start);
+
+    return T_COSE_SUCCESS;
+}
+
+
+/**
+ * \brief Decode one \c COSE_Countersignature.
+ *
+ * \param[in] decode_context    Context positioned after the protected
+ *                              parameters of the countersignature.
+ * \param[in] protected_item    The protected parameters already read.
+ * \param[out] countersignature The decoded countersignature.
+ * \param[out] next_nest_level  Nesting level of the item after it.
+ *
+ * \return This returns one of the error codes defined by \ref t_cose_err_t.
+ */
+static enum t_cose_err_t
+decode_countersignature(QCBORDecodeContext      *decode_context,
+                        const QCBORItem         *protected_item,
+                        struct countersignature *countersignature,
+                        uint_fast8_t            *next_nest_level)
+{
+    enum t_cose_err_t        return_value;
+    QCBORItem                item;
+    struct t_cose_parameters protected_parameters;
+    struct t_cose_parameters unprotected_parameters;
+    struct t_cose_parameters parameters;
+    struct t_cose_label_list critical_labels;
+    struct t_cose_label_list unknown_labels;
+
+    if(protected_item->uDataType != QCBOR_TYPE_BYTE_STRING) {
+        return_value = T_COSE_ERR_SIGN1_FORMAT;
+        goto Done;
+    }
+    countersignature->protected_parameters = protected_item->val.string;
+
+    clear_label_list(&unknown_labels);
+    return_value = parse_protected_header_parameters(protected_item->val.string,
+                                                    &protected_parameters,
+                                                    &critical_labels,
+                                                    &unknown_labels,
+                                                     NULL,
+                                                     0);
+    if(return_value) {
+        goto Done;
+    }
+
+    return_value = parse_unprotected_header_parameters(decode_context,
+                                                      &unprotected_parameters,
+                                                      &unknown_labels,
+                                                       NULL,
+                                                       0);
+    if(return_value) {
+        goto Done;
+    }
+
+    return_value = check_critical_labels(&critical_labels, &unknown_labels);
+    if(return_value) {
+        goto Done;
+    }
+
+    return_value = check_and_copy_parameters(&protected_parameters,
+                                             &unprotected_parameters,
+                                             &parameters);
+    if(return_value) {
+        goto Done;
+    }
+    countersignature->cose_algorithm_id = parameters.cose_algorithm_id;
+    countersignature->kid               = parameters.kid;
+
+    (void)QCBORDecode_GetNext(decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+        return_value = T_COSE_ERR_SIGN1_FORMAT;
+        goto Done;
+    }
+    countersignature->signature = item.val.string;
+    *next_nest_level            = item.uNextNestLevel;
+
+Done:
+    return return_value;
+}
+
+
+/**
+ * \brief Decode the countersignatures in unprotected header parameters.
+ *
+ * \param[in] unprotected        The encoded unprotected parameter map.
+ * \param[out] countersignatures The countersignatures and where they are.
+ *
+ * \return This returns one of the error codes defined by \ref t_cose_err_t.
+ *
+ * The value of the countersignature parameter is either one
+ * \c COSE_Countersignature, an array whose first item is a byte
+ * string, or an array of them.
+ */
+static enum t_cose_err_t
+decode_countersignatures(struct q_useful_buf_c     unprotected,
+                         struct countersignatures *countersignatures)
+{
+    enum t_cose_err_t            return_value;
+    QCBORDecodeContext           decode_context;
+    QCBORItem                    item;
+    QCBORItem                    value_item;
+    uint_fast8_t                 map_nest_level;
+    uint_fast8_t                 next_nest_level;
+    uint16_t                     num_countersignatures;
+    struct countersignature     *countersignature;
+    struct q_useful_buf_c        head;
+    const uint8_t               *value_end;
+
+    countersignatures->count    = 0;
+    countersignatures->value    = NULL_Q_USEFUL_BUF_C;
+    countersignatures->is_array = false;
+
+    QCBORDecode_Init(&decode_context, unprotected, QCBOR_DECODE_MODE_NORMAL);
+
+    (void)QCBORDecode_GetNext(&decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_MAP) {
+        return_value = T_COSE_ERR_SIGN1_FORMAT;
+        goto Done;
+    }
+    countersignatures->map_count = item.val.uCount;
+
+    map_nest_level  = item.uNestingLevel;
+    next_nest_level = item.uNextNestLevel;
+    while(next_nest_level > map_nest_level) {
+        if(QCBORDecode_GetNext(&decode_context, &item) != QCBOR_SUCCESS) {
+            return_value = T_COSE_ERR_CBOR_NOT_WELL_FORMED;
+            goto Done;
+        }
+
+        if(item.uLabelType != QCBOR_TYPE_INT64 ||
+           item.label.int64 != COSE_HEADER_PARAM_COUNTER_SIGNATURE_V2) {
+            /* Everything else has been checked by the COSE_Sign1 decode */
+            if(consume_item(&decode_context, &item, &next_nest_level)) {
+                return_value = T_COSE_ERR_CBOR_NOT_WELL_FORMED;
+                goto Done;
+            }
+            continue;
+        }
+
+        if(!q_useful_buf_c_is_null(countersignatures->value)) {
+            return_value = T_COSE_ERR_DUPLICATE_PARAMETER;
+            goto Done;
+        }
+        if(item.uDataType != QCBOR_TYPE_ARRAY) {
+            return_value = T_COSE_ERR_SIGN1_FORMAT;
+            goto Done;
+        }
+        if(item.val.uCount == 0) {
+            return_value = T_COSE_ERR_SIGN1_FORMAT;
+            goto Done;
+        }
+        value_item = item;
+
+        /* -- One countersignature or an array of them -- */
+        (void)QCBORDecode_GetNext(&decode_context, &item);
+        if(item.uDataType == QCBOR_TYPE_BYTE_STRING) {
+            num_countersignatures = 1;
+        } else {
+            countersignatures->is_array = true;
+            num_countersignatures = value_item.val.uCount;
+        }
+        if(num_countersignatures > T_COSE_MAX_COUNTERSIGNATURES) {
+            return_value = T_COSE_ERR_COUNTERSIGNATURE_COUNT;
+            goto Done;
+        }
+
+        while(1) {
+            if(countersignatures->is_array) {
+                /* item is the array of one countersignature */
+                if(item.uDataType != QCBOR_TYPE_ARRAY || item.val.uCount != 3) {
+                    return_value = T_COSE_ERR_SIGN1_FORMAT;
+                    goto Done;
+                }
+                (void)QCBORDecode_GetNext(&decode_context, &item);
+            } else if(value_item.val.uCount != 3) {
+                return_value = T_COSE_ERR_SIGN1_FORMAT;
+                goto Done;
+            }
+
+            countersignature = &countersignatures->list[countersignatures->count];
+            return_value = decode_countersignature(&decode_context,
+                                                   &item,
+                                                   countersignature,
+                                                   &next_nest_level);
+            if(return_value) {
+                goto Done;
+            }
+            countersignatures->count++;
+            if(countersignatures->count == num_countersignatures) {
+                break;
+            }
+            (void)QCBORDecode_GetNext(&decode_context, &item);
+        }
+
+        /* -- Where the value is, for adding to it -- */
+        value_end = (const uint8_t *)countersignature->signature.ptr +
+                    countersignature->signature.len;
+        countersignature = &countersignatures->list[0];
+        if(!find_head(unprotected,
+                      countersignature->protected_parameters.ptr,
+                      CBOR_MAJOR_TYPE_BYTE_STRING,
+                      countersignature->protected_parameters.len,
+                      &head) ||
+           !find_head(unprotected, head.ptr, CBOR_MAJOR_TYPE_ARRAY, 3, &head) ||
+           (countersignatures->is_array &&
+            !find_head(unprotected,
+                       head.ptr,
+                       CBOR_MAJOR_TYPE_ARRAY,
+                       countersignatures->count,
+                       &countersignatures->array_head))) {
+            return_value = T_COSE_ERR_SIGN1_FORMAT;
+            goto Done;
+        }
+        if(countersignatures->is_array) {
+            head = countersignatures->array_head;
+        }
+        countersignatures->value.ptr = head.ptr;
+        countersignatures->value.len = (size_t)(value_end - (const uint8_t *)head.ptr);
+    }
+
+    if(QCBORDecode_Finish(&decode_context) != QCBOR_SUCCESS) {
+        return_value = T_COSE_ERR_CBOR_NOT_WELL_FORMED;
+        goto Done;
+    }
+
+    return_value = T_COSE_SUCCESS;
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_countersign.h
+ */
+enum t_cose_err_t
+t_cose_countersign(struct t_cose_sign1_sign_ctx *countersigner,
+                   struct q_useful_buf_c         cose_sign1,
+                   struct q_useful_buf           out_buffer,
+                   struct q_useful_buf_c        *countersigned)
+{
+    enum t_cose_err_t                   return_value;
+    QCBORError                          cbor_err;
+    struct t_cose_sign1_verify_ctx      decode_ctx;
+    struct t_cose_sign1_verify_prepared target;
+    struct q_useful_buf_c               payload;
+    struct q_useful_buf_c               unprotected;
+    struct countersignatures            existing;
+    QCBOREncodeContext                  cbor_encode_ctx;
+    Q_USEFUL_BUF_MAKE_STACK_UB(         protected_buffer, COUNTERSIGN_PROTECTED_SIZE);
+    struct q_useful_buf_c               protected_parameters;
+    struct t_cose_crypto_hash           hash_ctx;
+    struct t_cose_sign1_prepared        prepared;
+    struct q_useful_buf_c               tbs_hash;
+    struct q_useful_buf_c               kid;
+    Q_USEFUL_BUF_MAKE_STACK_UB(         head_buffer, QCBOR_HEAD_BUFFER_SIZE);
+    struct q_useful_buf_c               new_head;
+    struct q_useful_buf_c               old_head;
+    struct q_useful_buf_c               before;
+    struct q_useful_buf_c               middle;
+    struct q_useful_buf_c               after;
+    const uint8_t                      *middle_end;
+    struct q_useful_buf_c               encoded;
+    size_t                              offset;
+
+    /* -- Decode the COSE_Sign1 and find its countersignatures -- */
+    t_cose_sign1_verify_init(&decode_ctx, T_COSE_OPT_DECODE_ONLY);
+    return_value = t_cose_sign1_verify_prepare(&decode_ctx,
+                                               cose_sign1,
+                                               &payload,
+                                               NULL,
+                                               &target);
+    if(return_value) {
+        goto Done;
+    }
+    return_value = find_unprotected(cose_sign1,
+                                    target.protected_parameters,
+                                    payload,
+                                    &unprotected);
+    if(return_value) {
+        goto Done;
+    }
+    return_value = decode_countersignatures(unprotected, &existing);
+    if(return_value) {
+        goto Done;
+    }
+    if(existing.count == T_COSE_MAX_COUNTERSIGNATURES) {
+        return_value = T_COSE_ERR_COUNTERSIGNATURE_COUNT;
+        goto Done;
+    }
+
+    /* -- Work out how the COSE_Sign1 is split to insert it --
+     * The output is before, new_head, middle, [label,]
+     * countersignature, after. */
+    if(q_useful_buf_c_is_null(existing.value)) {
+        /* A new entry at the end of the map, which has one more entry */
+        new_head = QCBOREncode_EncodeHead(head_buffer,
+                                          CBOR_MAJOR_TYPE_MAP,
+                                          0,
+                                          existing.map_count);
+        old_head = q_useful_buf_head(unprotected, new_head.len);
+        if(q_useful_buf_compare(old_head, new_head)) {
+            /* Indefinite length or not preferred serialization */
+            return_value = T_COSE_ERR_SIGN1_FORMAT;
+            goto Done;
+        }
+        new_head   = QCBOREncode_EncodeHead(head_buffer,
+                                            CBOR_MAJOR_TYPE_MAP,
+                                            0,
+                                            existing.map_count + 1u);
+        middle_end = (const uint8_t *)unprotected.ptr + unprotected.len;
+    } else {
+        if(existing.is_array) {
+            /* Added to the end of the array */
+            old_head = existing.array_head;
+        } else {
+            /* The one there is put in an array with the new one */
+            old_head = (struct q_useful_buf_c){existing.value.ptr, 0};
+        }
+        new_head   = QCBOREncode_EncodeHead(head_buffer,
+                                            CBOR_MAJOR_TYPE_ARRAY,
+                                            0,
+                                            existing.count + 1);
+        middle_end = (const uint8_t *)existing.value.ptr + existing.value.len;
+    }
+    before.ptr = cose_sign1.ptr;
+    before.len = (size_t)((const uint8_t *)old_head.ptr - (const uint8_t *)cose_sign1.ptr);
+    middle.ptr = (const uint8_t *)old_head.ptr + old_head.len;
+    middle.len = (size_t)(middle_end - (const uint8_t *)middle.ptr);
+    after.ptr  = middle_end;
+    after.len  = cose_sign1.len - (size_t)(middle_end - (const uint8_t *)cose_sign1.ptr);
+
+    /* -- Protected parameters of the countersignature -- */
+    QCBOREncode_Init(&cbor_encode_ctx, protected_buffer);
+    QCBOREncode_OpenMap(&cbor_encode_ctx);
+    QCBOREncode_AddInt64ToMapN(&cbor_encode_ctx,
+                               COSE_HEADER_PARAM_ALG,
+                               countersigner->cose_algorithm_id);
+    QCBOREncode_CloseMap(&cbor_encode_ctx);
+    if(QCBOREncode_Finish(&cbor_encode_ctx, &protected_parameters)) {
+        return_value = T_COSE_ERR_CBOR_FORMATTING;
+        goto Done;
+    }
+
+    /* -- Hash the Countersign_structure -- */
+    return_value = start_countersign_hash(countersigner->cose_algorithm_id,
+                                          target.protected_parameters,
+                                          protected_parameters,
+                                          payload.len,
+                                          &hash_ctx);
+    if(return_value) {
+        goto Done;
+    }
+    t_cose_crypto_hash_update(&hash_ctx, payload);
+    return_value = finish_countersign_hash(&hash_ctx,
+                                           target.signature,
+                                           (struct q_useful_buf){prepared.tbs_hash_bytes,
+                                                         sizeof(prepared.tbs_hash_bytes)},
+                                           &tbs_hash);
+    if(return_value) {
+        goto Done;
+    }
+    prepared.tbs_hash_len         = tbs_hash.len;
+    prepared.protected_parameters = protected_parameters;
+    prepared.cose_algorithm_id    = countersigner->cose_algorithm_id;
+    prepared.close_array          = true;
+
+    /* -- Output everything up to the countersignature -- */
+    offset = 0;
+    return_value = append_bytes(out_buffer, &offset, before);
+    if(return_value == T_COSE_SUCCESS) {
+        return_value = append_bytes(out_buffer, &offset, new_head);
+    }
+    if(return_value == T_COSE_SUCCESS) {
+        return_value = append_bytes(out_buffer, &offset, middle);
+    }
+    if(return_value == T_COSE_SUCCESS && q_useful_buf_c_is_null(existing.value)) {
+        /* The label, 11, encodes as a single byte */
+        return_value = append_bytes(out_buffer,
+                                    &offset,
+                                    Q_USEFUL_BUF_FROM_SZ_LITERAL("\x0b"));
+    }
+    if(return_value) {
+        goto Done;
+    }
+
+    /* -- Output the countersignature -- */
+    kid = countersigner->kid;
+#ifndef T_COSE_DISABLE_SHORT_CIRCUIT_SIGN
+    if((countersigner->option_flags & T_COSE_OPT_SHORT_CIRCUIT_SIG) &&
+       q_useful_buf_c_is_null_or_empty(kid)) {
+        kid = get_short_circuit_kid();
+    }
+#endif /* T_COSE_DISABLE_SHORT_CIRCUIT_SIGN */
+
+    QCBOREncode_Init(&cbor_encode_ctx,
+                     (struct q_useful_buf){(uint8_t *)out_buffer.ptr + offset,
+                                           out_buffer.len - offset});
+    QCBOREncode_OpenArray(&cbor_encode_ctx);
+    QCBOREncode_AddBytes(&cbor_encode_ctx, protected_parameters);
+    QCBOREncode_OpenMap(&cbor_encode_ctx);
+    if(!q_useful_buf_c_is_null_or_empty(kid)) {
+        QCBOREncode_AddBytesToMapN(&cbor_encode_ctx, COSE_HEADER_PARAM_KID, kid);
+    }
+    QCBOREncode_CloseMap(&cbor_encode_ctx);
+    return_value = t_cose_sign1_sign_complete(countersigner,
+                                              &prepared,
+                                              &cbor_encode_ctx);
+    if(return_value) {
+        goto Done;
+    }
+    cbor_err = QCBOREncode_Finish(&cbor_encode_ctx, &encoded);
+    if(cbor_err == QCBOR_ERR_BUFFER_TOO_SMALL) {
+        return_value = T_COSE_ERR_TOO_SMALL;
+        goto Done;
+    } else if(cbor_err != QCBOR_SUCCESS) {
+        return_value = T_COSE_ERR_CBOR_FORMATTING;
+        goto Done;
+    }
+    offset += encoded.len;
+
+    /* -- Output the payload and signature -- */
+    return_value = append_bytes(out_buffer, &offset, after);
+    if(return_value) {
+        goto Done;
+    }
+
+    countersigned->ptr = out_buffer.ptr;
+    countersigned->len = offset;
+
+Done:
+    return return_value;
+}
+
+
+/**
+ * One public key operation of t_cose_countersign_verify().
+ */
+struct verify_task {
+    const struct t_cose_sign1_verify_ctx *verify_ctx;
+    struct t_cose_sign1_verify_prepared   prepared;
+    enum t_cose_err_t                     result;
+};
+
+
+/**
+ * \brief Run a \ref verify_task. This is a \ref t_cose_task_fn.
+ *
+ * \param[in,out] task  The \ref verify_task.
+ */
+static void
+verify_task_run(void *task)
+{
+    struct verify_task *verify_task = (struct verify_task *)task;
+
+    verify_task->result = t_cose_sign1_verify_complete(verify_task->verify_ctx,
+                                                      &verify_task->prepared);
+}
+
+
+/*
+ * Public function. See t_cose_countersign.h
+ */
+enum t_cose_err_t
+t_cose_countersign_verify(struct t_cose_sign1_verify_ctx     *me,
+                          struct q_useful_buf_c               cose_sign1,
+                          struct t_cose_countersign_verifier *verifiers,
+                          size_t                              num_verifiers,
+                          t_cose_parallel_cb                  parallel_cb,
+                          void                               *cb_context,
+                          struct q_useful_buf_c              *payload,
+                          struct t_cose_parameters           *parameters)
+{
+    /* Task 0 is the COSE_Sign1, task i is countersignature i - 1 */
+    enum t_cose_err_t              return_value;
+    struct t_cose_sign1_verify_ctx decode_ctx;
+    struct q_useful_buf_c          unprotected;
+    struct countersignatures       countersignatures;
+    struct verify_task             tasks[T_COSE_MAX_COUNTERSIGNATURES + 1];
+    struct t_cose_crypto_hash      hash_ctxs[T_COSE_MAX_COUNTERSIGNATURES + 1];
+    struct countersignature       *countersignature;
+    struct q_useful_buf_c          chunk;
+    struct q_useful_buf_c          tbs_hash;
+    int32_t                        cose_hash_alg_id;
+    size_t                         num_tasks;
+    size_t                         offset;
+    size_t                         i;
+
+    /* -- Decode the COSE_Sign1 and its countersignatures -- */
+    decode_ctx = *me;
+    decode_ctx.option_flags |= T_COSE_OPT_DECODE_ONLY;
+    return_value = t_cose_sign1_verify_prepare(&decode_ctx,
+                                               cose_sign1,
+                                               payload,
+                                               parameters,
+                                               &tasks[0].prepared);
+    if(return_value) {
+        goto Done;
+    }
+    return_value = find_unprotected(cose_sign1,
+                                    tasks[0].prepared.protected_parameters,
+                                    *payload,
+                                    &unprotected);
+    if(return_value) {
+        goto Done;
+    }
+    return_value = decode_countersignatures(unprotected, &countersignatures);
+    if(return_value) {
+        goto Done;
+    }
+
+    for(i = 0; i < num_verifiers; i++) {
+        if(i < countersignatures.count) {
+            verifiers[i].kid    = countersignatures.list[i].kid;
+            verifiers[i].result = T_COSE_SUCCESS;
+        } else {
+            verifiers[i].kid    = NULL_Q_USEFUL_BUF_C;
+            verifiers[i].result = T_COSE_ERR_COUNTERSIGNATURE_COUNT;
+        }
+    }
+
+    if(me->option_flags & T_COSE_OPT_DECODE_ONLY) {
+        if(countersignatures.count > num_verifiers) {
+            return_value = T_COSE_ERR_COUNTERSIGNATURE_COUNT;
+        }
+        goto Done;
+    }
+    if(countersignatures.count != num_verifiers) {
+        return_value = T_COSE_ERR_COUNTERSIGNATURE_COUNT;
+        goto Done;
+    }
+
+    /* -- Check everything that could fail before starting any hash -- */
+    num_tasks = countersignatures.count + 1;
+    for(i = 1; i < num_tasks; i++) {
+        if(verifiers[i - 1].verify_ctx == NULL) {
+            return_value = T_COSE_ERR_INVALID_ARGUMENT;
+            goto Done;
+        }
+        cose_hash_alg_id = hash_alg_id_from_sig_alg_id(countersignatures.list[i - 1].cose_algorithm_id);
+        if(hash_size_from_hash_alg_id(cose_hash_alg_id) == 0) {
+            return_value = T_COSE_ERR_UNSUPPORTED_HASH;
+            goto Done;
+        }
+    }
+
+    /* -- Start all the hashes -- */
+    tasks[0].verify_ctx           = me;
+    tasks[0].prepared.decode_only = false;
+    return_value = start_tbs_hash(tasks[0].prepared.cose_algorithm_id,
+                                  tasks[0].prepared.protected_parameters,
+                                  payload->len,
+                                  &hash_ctxs[0]);
+    if(return_value) {
+        goto Done;
+    }
+    for(i = 1; i < num_tasks; i++) {
+        countersignature = &countersignatures.list[i - 1];
+        tasks[i].verify_ctx                    = verifiers[i - 1].verify_ctx;
+        tasks[i].prepared.protected_parameters = countersignature->protected_parameters;
+        tasks[i].prepared.cose_algorithm_id    = countersignature->cose_algorithm_id;
+        tasks[i].prepared.kid                  = countersignature->kid;
+        tasks[i].prepared.signature            = countersignature->signature;
+        tasks[i].prepared.decode_only          = false;
+        return_value = start_countersign_hash(countersignature->cose_algorithm_id,
+                                              tasks[0].prepared.protected_parameters,
+                                              countersignature->protected_parameters,
+                                              payload->len,
+                                              &hash_ctxs[i]);
+        if(return_value) {
+            abandon_hashes(hash_ctxs, i);
+            goto Done;
+        }
+    }
+
+    /* -- Hash the payload into all of them reading it once -- */
+    for(offset = 0; offset < payload->len; offset += chunk.len) {
+        chunk = q_useful_buf_head(q_useful_buf_tail(*payload, offset),
+                                  COUNTERSIGN_HASH_CHUNK);
+        if(q_useful_buf_c_is_null(chunk)) {
+            chunk = q_useful_buf_tail(*payload, offset);
+        }
+        for(i = 0; i < num_tasks; i++) {
+            t_cose_crypto_hash_update(&hash_ctxs[i], chunk);
+        }
+    }
+
+    /* -- Finish them. After a failure the rest are still finished. -- */
+    return_value = t_cose_crypto_hash_finish(&hash_ctxs[0],
+                                             (struct q_useful_buf){tasks[0].prepared.tbs_hash_bytes,
+                                                     sizeof(tasks[0].prepared.tbs_hash_bytes)},
+                                             &tbs_hash);
+    if(return_value) {
+        abandon_hashes(&hash_ctxs[1], num_tasks - 1);
+        goto Done;
+    }
+    tasks[0].prepared.tbs_hash_len = tbs_hash.len;
+    for(i = 1; i < num_tasks; i++) {
+        return_value = finish_countersign_hash(&hash_ctxs[i],
+                                               tasks[0].prepared.signature,
+                                               (struct q_useful_buf){tasks[i].prepared.tbs_hash_bytes,
+                                                       sizeof(tasks[i].prepared.tbs_hash_bytes)},
+                                               &tbs_hash);
+        if(return_value) {
+            abandon_hashes(&hash_ctxs[i + 1], num_tasks - i - 1);
+            goto Done;
+        }
+        tasks[i].prepared.tbs_hash_len = tbs_hash.len;
+    }
+
+    /* -- The public key operations, which are independent -- */
+    if(parallel_cb == NULL) {
+        parallel_cb = t_cose_parallel_run_serial;
+    }
+    (*parallel_cb)(cb_context, verify_task_run, tasks, sizeof(tasks[0]), num_tasks);
+
+    return_value = tasks[0].result;
+    for(i = 1; i < num_tasks; i++) {
+        verifiers[i - 1].result = tasks[i].result;
+        if(return_value == T_COSE_SUCCESS) {
+            return_value = tasks[i].result;
+        }
+    }
+
+Done:
+    return return_value;
+}
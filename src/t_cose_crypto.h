@@ -286,20 +286,353 @@ t_cose_crypto_pub_key_verify(int32_t               cose_algorithm_id,
                              struct q_useful_buf_c signature);
 
 
+#ifdef T_COSE_ENABLE_RESTARTABLE
+
+#ifndef T_COSE_USE_MBEDTLS_CRYPTO
+#error "T_COSE_ENABLE_RESTARTABLE is only supported by the Mbed TLS crypto adapter"
+#endif
+
+/**
+ * \brief Perform public key signing in time slices.
+ *
+ * \param[in] cose_algorithm_id    The algorithm to sign with.
+ * \param[in] signing_key          Opaque key used to sign.
+ * \param[in] hash_to_sign         The bytes to sign.
+ * \param[in] signature_buffer     Pointer and length of buffer into
+ *                                 which the resulting signature is put.
+ * \param[in] signature            Pointer and length of the signature
+ *                                 returned.
+ * \param[in,out] restart_ctx      State carried between slices.
+ *
+ * \retval T_COSE_ERR_SIG_IN_PROGRESS
+ *         The operation used up \c restart_ctx->max_ops and should
+ *         be called again with the same inputs.
+ *
+ * Otherwise the same as t_cose_crypto_pub_key_sign(). Any state the
+ * adapter allocates into \c restart_ctx->crypto_ctx is freed when
+ * the operation completes, successfully or not, or by
+ * t_cose_crypto_restart_free().
+ *
+ * Only the Mbed TLS adapter implements this. Another adapter that
+ * adds it must also be allowed by the check above.
+ */
+enum t_cose_err_t
+t_cose_crypto_pub_key_sign_restartable(int32_t                    cose_algorithm_id,
+                                       struct t_cose_key          signing_key,
+                                       struct q_useful_buf_c      hash_to_sign,
+                                       struct q_useful_buf        signature_buffer,
+                                       struct q_useful_buf_c     *signature,
+                                       struct t_cose_restart_ctx *restart_ctx);
+
+
+/**
+ * \brief Perform public key signature verification in time slices.
+ *
+ * \param[in] cose_algorithm_id  The algorithm to use for verification.
+ * \param[in] verification_key   The verification key to use.
+ * \param[in] kid                The COSE kid (key ID) or \c NULL_Q_USEFUL_BUF_C.
+ * \param[in] hash_to_verify     The data or hash that is to be verified.
+ * \param[in] signature          The signature.
+ * \param[in,out] restart_ctx    State carried between slices.
+ *
+ * \retval T_COSE_ERR_SIG_IN_PROGRESS
+ *         The operation used up \c restart_ctx->max_ops and should
+ *         be called again with the same inputs.
+ *
+ * Otherwise the same as t_cose_crypto_pub_key_verify().
+ */
+enum t_cose_err_t
+t_cose_crypto_pub_key_verify_restartable(int32_t                    cose_algorithm_id,
+                                         struct t_cose_key          verification_key,
+                                         struct q_useful_buf_c      kid,
+                                         struct q_useful_buf_c      hash_to_verify,
+                                         struct q_useful_buf_c      signature,
+                                         struct t_cose_restart_ctx *restart_ctx);
+
+
+/**
+ * \brief Release adapter state of an abandoned restartable operation.
+ *
+ * \param[in,out] restart_ctx  The restart context.
+ *
+ * Must be safe to call when no operation is in progress.
+ */
+void
+t_cose_crypto_restart_free(struct t_cose_restart_ctx *restart_ctx);
+#endif /* T_COSE_ENABLE_RESTARTABLE */
+
+
+#ifdef T_COSE_ENABLE_KEY_RECOVERY
+/**
+ * \brief Recover a candidate public key from an ECDSA signature.
+ *
+ * \param[in] cose_algorithm_id  The ECDSA algorithm. Selects the curve.
+ * \param[in] hash_to_verify     The hash that was signed.
+ * \param[in] signature          The signature, r and s concatenated.
+ * \param[in] recovery_id        0 or 1. Selects the even or odd y
+ *                               coordinate of the point R whose x
+ *                               coordinate is r.
+ * \param[in] point_buffer       Buffer for the recovered point.
+ * \param[out] public_point      The recovered public key as an
+ *                               uncompressed SEC1 point.
+ *
+ * \retval T_COSE_ERR_SIG_VERIFY
+ *         r or s is out of range or there is no point R for this
+ *         \c recovery_id. No key verifies this signature.
+ * \retval T_COSE_ERR_UNSUPPORTED_SIGNING_ALG
+ *         The algorithm is not ECDSA or not supported.
+ * \retval T_COSE_ERR_SIG_BUFFER_SIZE
+ *         \c point_buffer is too small.
+ *
+ * The signature verifies with the public key returned, so if that
+ * key is trusted there is no need to verify the signature again.
+ *
+ * The point R with x coordinate r + n is not tried. For the NIST
+ * curves the chance of it being needed is around 2^-128.
+ */
+enum t_cose_err_t
+t_cose_crypto_pub_key_recover(int32_t                cose_algorithm_id,
+                              struct q_useful_buf_c  hash_to_verify,
+                              struct q_useful_buf_c  signature,
+                              unsigned               recovery_id,
+                              struct q_useful_buf    point_buffer,
+                              struct q_useful_buf_c *public_point);
+
+
+/**
+ * \brief Get the public point of a key.
+ *
+ * \param[in] key            The key. Only the public part is used.
+ * \param[in] point_buffer   Buffer for the point.
+ * \param[out] public_point  The public key as an uncompressed SEC1 point.
+ *
+ * \return Errors as for t_cose_crypto_pub_key_verify() for a bad key
+ *         or \ref T_COSE_ERR_SIG_BUFFER_SIZE.
+ *
+ * The output is in the same form as t_cose_crypto_pub_key_recover()
+ * so the two can be compared byte-for-byte.
+ */
+enum t_cose_err_t
+t_cose_crypto_export_public_point(struct t_cose_key      key,
+                                  struct q_useful_buf    point_buffer,
+                                  struct q_useful_buf_c *public_point);
+#endif /* T_COSE_ENABLE_KEY_RECOVERY */
+
+
+#if defined(T_COSE_ENABLE_ENCRYPT) || defined(T_COSE_ENABLE_OSCORE)
+/**
+ * \brief Fill a buffer with random bytes.
+ *
+ * \param[in] buffer  The buffer to fill. All of it is filled.
+ *
+ * \retval T_COSE_ERR_FAIL  The random number generator failed.
+ *
+ * The bytes must be suitable for keys and nonces.
+ */
+enum t_cose_err_t
+t_cose_crypto_get_random(struct q_useful_buf buffer);
+
+
+/**
+ * \brief Encrypt with an AEAD algorithm.
+ *
+ * \param[in] cose_algorithm_id  The AEAD algorithm, e.g.,
+ *                               \ref COSE_ALGORITHM_A128GCM.
+ * \param[in] key                The content encryption key.
+ * \param[in] nonce              The nonce (IV).
+ * \param[in] aad                Additional authenticated data.
+ * \param[in] plaintext          Data to encrypt.
+ * \param[in] ciphertext_buffer  Buffer for the ciphertext and tag.
+ * \param[out] ciphertext        The ciphertext with the tag appended.
+ *
+ * \retval T_COSE_ERR_UNSUPPORTED_ENCRYPTION_ALG
+ *         The algorithm is not supported.
+ * \retval T_COSE_ERR_WRONG_TYPE_OF_KEY
+ *         The key or nonce is the wrong size for the algorithm.
+ * \retval T_COSE_ERR_TOO_SMALL
+ *         \c ciphertext_buffer is too small.
+ *
+ * The ciphertext is the length of the plaintext plus the length of
+ * the tag, 16 bytes for AES-GCM and 8 for AES-CCM-16-64-128.
+ */
+enum t_cose_err_t
+t_cose_crypto_aead_encrypt(int32_t                cose_algorithm_id,
+                           struct q_useful_buf_c  key,
+                           struct q_useful_buf_c  nonce,
+                           struct q_useful_buf_c  aad,
+                           struct q_useful_buf_c  plaintext,
+                           struct q_useful_buf    ciphertext_buffer,
+                           struct q_useful_buf_c *ciphertext);
+
+
+/**
+ * \brief Decrypt with an AEAD algorithm.
+ *
+ * \param[in] cose_algorithm_id  The AEAD algorithm.
+ * \param[in] key                The content encryption key.
+ * \param[in] nonce              The nonce (IV).
+ * \param[in] aad                Additional authenticated data.
+ * \param[in] ciphertext         The ciphertext with the tag appended.
+ * \param[in] plaintext_buffer   Buffer for the plaintext.
+ * \param[out] plaintext         The plaintext.
+ *
+ * \retval T_COSE_ERR_DECRYPT_FAIL
+ *         The tag doesn't match. Nothing in \c plaintext_buffer
+ *         should be used.
+ *
+ * Other errors are as for t_cose_crypto_aead_encrypt().
+ */
+enum t_cose_err_t
+t_cose_crypto_aead_decrypt(int32_t                cose_algorithm_id,
+                           struct q_useful_buf_c  key,
+                           struct q_useful_buf_c  nonce,
+                           struct q_useful_buf_c  aad,
+                           struct q_useful_buf_c  ciphertext,
+                           struct q_useful_buf    plaintext_buffer,
+                           struct q_useful_buf_c *plaintext);
+
+
+/**
+ * \brief ECDH with a new ephemeral key.
+ *
+ * \param[in] recipient_key    The public key of the recipient.
+ * \param[in] point_buffer     Buffer for the ephemeral public key.
+ * \param[out] ephemeral_point The ephemeral public key as an
+ *                             uncompressed SEC1 point.
+ * \param[in] secret_buffer    Buffer for the shared secret.
+ * \param[out] shared_secret   The x coordinate of the shared point.
+ *
+ * \retval T_COSE_ERR_SIG_BUFFER_SIZE
+ *         A buffer is too small.
+ *
+ * Errors for a bad key are as for t_cose_crypto_pub_key_verify().
+ *
+ * A key pair is generated on the curve of \c recipient_key, used
+ * once and destroyed. This is called concurrently for different
+ * recipients so it must be thread-safe. \c recipient_key is assumed
+ * to have been checked when it was loaded; it is not checked on
+ * every call.
+ */
+enum t_cose_err_t
+t_cose_crypto_ecdh_ephemeral(struct t_cose_key      recipient_key,
+                             struct q_useful_buf    point_buffer,
+                             struct q_useful_buf_c *ephemeral_point,
+                             struct q_useful_buf    secret_buffer,
+                             struct q_useful_buf_c *shared_secret);
+
+
+/**
+ * \brief ECDH with a private key and a received public point.
+ *
+ * \param[in] private_key     The private key of the recipient.
+ * \param[in] peer_point      The public key of the sender as an
+ *                            uncompressed SEC1 point.
+ * \param[in] secret_buffer   Buffer for the shared secret.
+ * \param[out] shared_secret  The x coordinate of the shared point.
+ *
+ * \retval T_COSE_ERR_DECRYPT_FAIL
+ *         \c peer_point is not a point on the curve of
+ *         \c private_key.
+ */
+enum t_cose_err_t
+t_cose_crypto_ecdh(struct t_cose_key      private_key,
+                   struct q_useful_buf_c  peer_point,
+                   struct q_useful_buf    secret_buffer,
+                   struct q_useful_buf_c *shared_secret);
+
+
+/**
+ * \brief Derive a key with HKDF (RFC 5869).
+ *
+ * \param[in] cose_hash_algorithm_id  The hash, e.g.,
+ *                                    \ref COSE_ALGORITHM_SHA_256.
+ * \param[in] salt                    The salt or \c NULL_Q_USEFUL_BUF_C.
+ * \param[in] ikm                     The input keying material.
+ * \param[in] info                    The context information.
+ * \param[in] okm_buffer              Filled with the output keying
+ *                                    material. Its length is the
+ *                                    length derived.
+ *
+ * \retval T_COSE_ERR_UNSUPPORTED_HASH
+ *         The hash is not supported.
+ */
+enum t_cose_err_t
+t_cose_crypto_hkdf(int32_t               cose_hash_algorithm_id,
+                   struct q_useful_buf_c salt,
+                   struct q_useful_buf_c ikm,
+                   struct q_useful_buf_c info,
+                   struct q_useful_buf   okm_buffer);
+
+
+/**
+ * \brief Wrap a key with AES key wrap (RFC 3394).
+ *
+ * \param[in] cose_algorithm_id  The key wrap algorithm, e.g.,
+ *                               \ref COSE_ALGORITHM_A128KW.
+ * \param[in] kek                The key encryption key.
+ * \param[in] plaintext          The key to wrap. A multiple of 8 bytes.
+ * \param[in] buffer             Buffer for the wrapped key.
+ * \param[out] ciphertext        The wrapped key, 8 bytes longer than
+ *                               \c plaintext.
+ *
+ * \retval T_COSE_ERR_UNSUPPORTED_ENCRYPTION_ALG
+ *         The algorithm is not supported.
+ * \retval T_COSE_ERR_TOO_SMALL
+ *         \c buffer is too small.
+ */
+enum t_cose_err_t
+t_cose_crypto_kw_wrap(int32_t                cose_algorithm_id,
+                      struct q_useful_buf_c  kek,
+                      struct q_useful_buf_c  plaintext,
+                      struct q_useful_buf    buffer,
+                      struct q_useful_buf_c *ciphertext);
+
+
+/**
+ * \brief Unwrap a key with AES key wrap (RFC 3394).
+ *
+ * \param[in] cose_algorithm_id  The key wrap algorithm.
+ * \param[in] kek                The key encryption key.
+ * \param[in] ciphertext         The wrapped key.
+ * \param[in] buffer             Buffer for the key.
+ * \param[out] plaintext         The key.
+ *
+ * \retval T_COSE_ERR_DECRYPT_FAIL
+ *         The integrity check failed. The key encryption key is wrong.
+ *
+ * Other errors are as for t_cose_crypto_kw_wrap().
+ */
+enum t_cose_err_t
+t_cose_crypto_kw_unwrap(int32_t                cose_algorithm_id,
+                        struct q_useful_buf_c  kek,
+                        struct q_useful_buf_c  ciphertext,
+                        struct q_useful_buf    buffer,
+                        struct q_useful_buf_c *plaintext);
+#endif /* T_COSE_ENABLE_ENCRYPT || T_COSE_ENABLE_OSCORE */
+
+
 
 
 #ifdef T_COSE_USE_PSA_CRYPTO
 #include "psa/crypto.h"
 
+#elif T_COSE_USE_MBEDTLS_CRYPTO
+#include "mbedtls/sha256.h"
+#include "mbedtls/sha512.h"
+
 #elif T_COSE_USE_OPENSSL_CRYPTO
 #include "openssl/sha.h"
 
 #elif T_COSE_USE_B_CON_SHA256
 /* This is code for use with Brad Conte's crypto.  See
  * https://github.com/B-Con/crypto-algorithms and see the description
- * of t_cose_crypto_hash
+ * of t_cose_crypto_hash. SHA-384 and SHA-512 are from sha512.c
+ * which is in the same style.
  */
 #include "sha256.h"
+#if !defined T_COSE_DISABLE_ES512 || !defined T_COSE_DISABLE_ES384
+#include "sha512.h"
+#endif
 #endif
 
 
@@ -348,6 +681,19 @@ struct t_cose_crypto_hash {
         psa_hash_operation_t ctx;
         psa_status_t         status;
 
+    #elif T_COSE_USE_MBEDTLS_CRYPTO
+        /* --- The context for Mbed TLS used directly (not via PSA) --- */
+        union {
+            mbedtls_sha256_context sha_256;
+        #if !defined T_COSE_DISABLE_ES512 || !defined T_COSE_DISABLE_ES384
+            /* SHA 384 uses the sha_512 context */
+            mbedtls_sha512_context sha_512;
+        #endif
+        } ctx;
+
+        int     update_error; /* First error from mbedtls_shaXXX_update() */
+        int32_t cose_hash_alg_id; /* COSE integer ID for the hash alg */
+
     #elif T_COSE_USE_OPENSSL_CRYPTO
         /* --- The context for PSA Crypto (MBed Crypto) --- */
 
@@ -365,8 +711,17 @@ struct t_cose_crypto_hash {
         int32_t cose_hash_alg_id; /* COSE integer ID for the hash alg */
 
    #elif T_COSE_USE_B_CON_SHA256
-        /* --- Specific context for Brad Conte's sha256.c --- */
-        SHA256_CTX b_con_hash_context;
+        /* --- Specific context for Brad Conte's sha256.c and sha512.c --- */
+        union {
+            SHA256_CTX sha_256;
+        #if !defined T_COSE_DISABLE_ES512 || !defined T_COSE_DISABLE_ES384
+            /* SHA 384 uses the sha_512 context. This is about 150
+             * bytes more than SHA-256. */
+            SHA512_CTX sha_512;
+        #endif
+        } b_con_hash_context;
+
+        int32_t cose_hash_alg_id; /* COSE integer ID for the hash alg */
 
    #else
     /* --- Default: generic pointer / handle --- */
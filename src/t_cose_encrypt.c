@@ -0,0 +1,933 @@
+/*
+ *  t_cose_encrypt.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "qcbor/qcbor.h"
+#include "t_cose/t_cose_encrypt.h"
+#include "t_cose/q_useful_buf.h"
+#include "t_cose_crypto.h"
+#include "t_cose_util.h"
+#include "t_cose_parameters.h"
+#include "t_cose_standard_constants.h"
+#include <string.h>
+
+
+/**
+ * \file t_cose_encrypt.c
+ *
+ * \brief Implementation of \c COSE_Encrypt with ECDH-ES recipients.
+ */
+
+
+#ifdef T_COSE_ENABLE_ENCRYPT
+
+/** Size of the buffer for protected parameters that are only an alg ID */
+#define ENCRYPT_PROTECTED_SIZE 16
+
+#if ENCRYPT_PROTECTED_SIZE > T_COSE_ENCRYPT_MAX_PROTECTED_SIZE
+#error T_COSE_ENCRYPT_MAX_PROTECTED_SIZE is too small
+#endif
+
+/** Size of the buffer for the Enc_structure used as the AAD. The
+ * protected parameters may be those of a received message. */
+#define ENCRYPT_AAD_SIZE (16 + T_COSE_ENCRYPT_MAX_PROTECTED_SIZE)
+
+/** Size of the buffer for the COSE_KDF_Context. The protected
+ * parameters may be those of a received recipient. */
+#define ENCRYPT_KDF_CONTEXT_SIZE (24 + T_COSE_ENCRYPT_MAX_PROTECTED_SIZE)
+
+/** Size of the AES-GCM nonce */
+#define ENCRYPT_IV_SIZE 12
+
+/** Size of the AES-GCM tag */
+#define ENCRYPT_TAG_SIZE 16
+
+/** Size of the key encryption key for A128KW */
+#define ENCRYPT_KEK_SIZE 16
+
+/** Size of the largest ECDH shared secret, for P-521 */
+#define ENCRYPT_MAX_SECRET_SIZE 66
+
+
+/**
+ * \brief Get the key size of a content encryption algorithm.
+ *
+ * \param[in] content_alg_id  The algorithm.
+ *
+ * \return The size in bytes or 0 if the algorithm is not supported.
+ */
+static size_t
+content_key_size(int32_t content_alg_id)
+{
+    switch(content_alg_id) {
+    case COSE_ALGORITHM_A128GCM: return 16;
+    case COSE_ALGORITHM_A192GCM: return 24;
+    case COSE_ALGORITHM_A256GCM: return 32;
+    default:                     return 0;
+    }
+}
+
+
+/**
+ * \brief Map the size of an uncompressed point to a COSE curve.
+ *
+ * \param[in] point_len  The size of the point.
+ *
+ * \return The curve or 0 if the size is not that of a supported curve.
+ */
+static int32_t
+curve_of_point(size_t point_len)
+{
+    switch(point_len) {
+    case 1 + 2 * 32: return COSE_ELLIPTIC_CURVE_P_256;
+    case 1 + 2 * 48: return COSE_ELLIPTIC_CURVE_P_384;
+    case 1 + 2 * 66: return COSE_ELLIPTIC_CURVE_P_521;
+    default:         return 0;
+    }
+}
+
+
+/**
+ * \brief Finish an encoding and map the error.
+ *
+ * \param[in] cbor_encode_ctx  Encoding context.
+ * \param[out] encoded         The encoded CBOR.
+ */
+static enum t_cose_err_t
+finish_encoding(QCBOREncodeContext    *cbor_encode_ctx,
+                struct q_useful_buf_c *encoded)
+{
+    QCBORError cbor_err;
+
+    cbor_err = QCBOREncode_Finish(cbor_encode_ctx, encoded);
+    if(cbor_err == QCBOR_ERR_BUFFER_TOO_SMALL) {
+        return T_COSE_ERR_TOO_SMALL;
+    } else if(cbor_err != QCBOR_SUCCESS) {
+        return T_COSE_ERR_CBOR_FORMATTING;
+    }
+    return T_COSE_SUCCESS;
+}
+
+
+/**
+ * \brief Encode protected parameters that are only an algorithm ID.
+ *
+ * \param[in] alg_id      The algorithm ID.
+ * \param[in] buffer      Buffer of \ref ENCRYPT_PROTECTED_SIZE.
+ * \param[out] protected  The encoded map.
+ */
+static enum t_cose_err_t
+encode_protected(int32_t                alg_id,
+                 struct q_useful_buf    buffer,
+                 struct q_useful_buf_c *protected)
+{
+    QCBOREncodeContext cbor_encode_ctx;
+
+    QCBOREncode_Init(&cbor_encode_ctx, buffer);
+    QCBOREncode_OpenMap(&cbor_encode_ctx);
+    QCBOREncode_AddInt64ToMapN(&cbor_encode_ctx, COSE_HEADER_PARAM_ALG, alg_id);
+    QCBOREncode_CloseMap(&cbor_encode_ctx);
+    return finish_encoding(&cbor_encode_ctx, protected);
+}
+
+
+/**
+ * \brief Make the Enc_structure that is the AAD of the content.
+ *
+ * \param[in] protected  The protected parameters of the \c COSE_Encrypt.
+ * \param[in] buffer     Buffer of \ref ENCRYPT_AAD_SIZE.
+ * \param[out] aad       The encoded Enc_structure.
+ *
+ * See RFC 9052 section 5.3. The external AAD is always empty.
+ */
+static enum t_cose_err_t
+make_enc_structure(struct q_useful_buf_c  protected,
+                   struct q_useful_buf    buffer,
+                   struct q_useful_buf_c *aad)
+{
+    QCBOREncodeContext cbor_encode_ctx;
+
+    QCBOREncode_Init(&cbor_encode_ctx, buffer);
+    QCBOREncode_OpenArray(&cbor_encode_ctx);
+    QCBOREncode_AddSZString(&cbor_encode_ctx, COSE_ENC_CONTEXT_STRING_ENCRYPT);
+    QCBOREncode_AddBytes(&cbor_encode_ctx, protected);
+    QCBOREncode_AddBytes(&cbor_encode_ctx, NULL_Q_USEFUL_BUF_C);
+    QCBOREncode_CloseArray(&cbor_encode_ctx);
+    return finish_encoding(&cbor_encode_ctx, aad);
+}
+
+
+/**
+ * \brief Make the COSE_KDF_Context for ECDH-ES+A128KW.
+ *
+ * \param[in] recipient_protected  The protected parameters of the
+ *                                 recipient.
+ * \param[in] buffer               Buffer of \ref ENCRYPT_KDF_CONTEXT_SIZE.
+ * \param[out] kdf_context         The encoded context.
+ *
+ * See RFC 9053 section 5.2. There is no party identity or other
+ * information, so the context is the same for all recipients with
+ * the same protected parameters.
+ */
+static enum t_cose_err_t
+make_kdf_context(struct q_useful_buf_c  recipient_protected,
+                 struct q_useful_buf    buffer,
+                 struct q_useful_buf_c *kdf_context)
+{
+    QCBOREncodeContext cbor_encode_ctx;
+    int                party;
+
+    QCBOREncode_Init(&cbor_encode_ctx, buffer);
+    QCBOREncode_OpenArray(&cbor_encode_ctx);
+    QCBOREncode_AddInt64(&cbor_encode_ctx, COSE_ALGORITHM_A128KW);
+    /* PartyUInfo and PartyVInfo are [nil, nil, nil] */
+    for(party = 0; party < 2; party++) {
+        QCBOREncode_OpenArray(&cbor_encode_ctx);
+        QCBOREncode_AddNULL(&cbor_encode_ctx);
+        QCBOREncode_AddNULL(&cbor_encode_ctx);
+        QCBOREncode_AddNULL(&cbor_encode_ctx);
+        QCBOREncode_CloseArray(&cbor_encode_ctx);
+    }
+    /* SuppPubInfo is [keyDataLength, protected] */
+    QCBOREncode_OpenArray(&cbor_encode_ctx);
+    QCBOREncode_AddUInt64(&cbor_encode_ctx, ENCRYPT_KEK_SIZE * 8);
+    QCBOREncode_AddBytes(&cbor_encode_ctx, recipient_protected);
+    QCBOREncode_CloseArray(&cbor_encode_ctx);
+    QCBOREncode_CloseArray(&cbor_encode_ctx);
+    return finish_encoding(&cbor_encode_ctx, kdf_context);
+}
+
+
+/**
+ * \brief Derive the key encryption key from the ECDH shared secret.
+ *
+ * \param[in] shared_secret  The ECDH shared secret.
+ * \param[in] kdf_context    The COSE_KDF_Context.
+ * \param[in] kek_buffer     Buffer of \ref ENCRYPT_KEK_SIZE.
+ */
+static inline enum t_cose_err_t
+derive_kek(struct q_useful_buf_c shared_secret,
+           struct q_useful_buf_c kdf_context,
+           struct q_useful_buf   kek_buffer)
+{
+    return t_cose_crypto_hkdf(COSE_ALGORITHM_SHA_256,
+                              NULL_Q_USEFUL_BUF_C,
+                              shared_secret,
+                              kdf_context,
+                              kek_buffer);
+}
+
+
+/**
+ * \brief Do the key agreement and key wrap for one recipient.
+ *
+ * \param[in,out] task  The \ref t_cose_encrypt_recipient.
+ *
+ * This is a \ref t_cose_task_fn. It only reads the shared encryption
+ * context and only writes to its recipient so recipients can be run
+ * concurrently.
+ */
+static void
+wrap_task(void *task)
+{
+    struct t_cose_encrypt_recipient *recipient = task;
+    const struct t_cose_encrypt_ctx *me = recipient->encrypt_ctx;
+    struct q_useful_buf_c            point;
+    struct q_useful_buf_c            shared_secret;
+    struct q_useful_buf_c            wrapped;
+    Q_USEFUL_BUF_MAKE_STACK_UB(      secret_buffer, ENCRYPT_MAX_SECRET_SIZE);
+    Q_USEFUL_BUF_MAKE_STACK_UB(      kek_buffer, ENCRYPT_KEK_SIZE);
+
+    recipient->result =
+        t_cose_crypto_ecdh_ephemeral(recipient->public_key,
+                                     Q_USEFUL_BUF_FROM_BYTE_ARRAY(recipient->ephemeral_point),
+                                     &point,
+                                     secret_buffer,
+                                     &shared_secret);
+    if(recipient->result != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    recipient->ephemeral_point_len = point.len;
+
+    recipient->result = derive_kek(shared_secret, me->kdf_context, kek_buffer);
+    if(recipient->result != T_COSE_SUCCESS) {
+        goto Done;
+    }
+
+    recipient->result =
+        t_cose_crypto_kw_wrap(COSE_ALGORITHM_A128KW,
+                              q_useful_buf_const(kek_buffer),
+                              (struct q_useful_buf_c){me->cek, me->cek_len},
+                              Q_USEFUL_BUF_FROM_BYTE_ARRAY(recipient->wrapped_cek),
+                              &wrapped);
+    recipient->wrapped_cek_len = wrapped.len;
+
+Done:
+    memset(secret_buffer.ptr, 0, secret_buffer.len);
+    memset(kek_buffer.ptr, 0, kek_buffer.len);
+}
+
+
+/**
+ * \brief Encode the array of recipients.
+ *
+ * \param[in] recipient_protected  Protected parameters of every recipient.
+ * \param[in] recipients           The recipients after wrap_task().
+ * \param[in] num_recipients       Number of \c recipients.
+ * \param[in] buffer               Where to encode.
+ * \param[out] encoded             The encoded array.
+ */
+static enum t_cose_err_t
+encode_recipients(struct q_useful_buf_c                  recipient_protected,
+                  const struct t_cose_encrypt_recipient *recipients,
+                  size_t                                 num_recipients,
+                  struct q_useful_buf                    buffer,
+                  struct q_useful_buf_c                 *encoded)
+{
+    QCBOREncodeContext                     cbor_encode_ctx;
+    const struct t_cose_encrypt_recipient *recipient;
+    size_t                                 coordinate_len;
+
+    QCBOREncode_Init(&cbor_encode_ctx, buffer);
+    QCBOREncode_OpenArray(&cbor_encode_ctx);
+    for(recipient = recipients;
+        recipient < recipients + num_recipients;
+        recipient++) {
+        /* Uncompressed point is 0x04, x then y */
+        coordinate_len = (recipient->ephemeral_point_len - 1) / 2;
+
+        QCBOREncode_OpenArray(&cbor_encode_ctx);
+        QCBOREncode_AddBytes(&cbor_encode_ctx, recipient_protected);
+        QCBOREncode_OpenMap(&cbor_encode_ctx);
+        QCBOREncode_OpenMapInMapN(&cbor_encode_ctx,
+                                  COSE_HEADER_PARAM_EPHEMERAL_KEY);
+        QCBOREncode_AddInt64ToMapN(&cbor_encode_ctx,
+                                   COSE_KEY_COMMON_KTY,
+                                   COSE_KEY_TYPE_EC2);
+        QCBOREncode_AddInt64ToMapN(&cbor_encode_ctx,
+                                   COSE_KEY_PARAM_CRV,
+                                   curve_of_point(recipient->ephemeral_point_len));
+        QCBOREncode_AddBytesToMapN(&cbor_encode_ctx,
+                                   COSE_KEY_PARAM_X_COORDINATE,
+                                   (struct q_useful_buf_c){
+                                       recipient->ephemeral_point + 1,
+                                       coordinate_len});
+        QCBOREncode_AddBytesToMapN(&cbor_encode_ctx,
+                                   COSE_KEY_PARAM_Y_COORDINATE,
+                                   (struct q_useful_buf_c){
+                                       recipient->ephemeral_point + 1 + coordinate_len,
+                                       coordinate_len});
+        QCBOREncode_CloseMap(&cbor_encode_ctx);
+        if(!q_useful_buf_c_is_null(recipient->kid)) {
+            QCBOREncode_AddBytesToMapN(&cbor_encode_ctx,
+                                       COSE_HEADER_PARAM_KID,
+                                       recipient->kid);
+        }
+        QCBOREncode_CloseMap(&cbor_encode_ctx);
+        QCBOREncode_AddBytes(&cbor_encode_ctx,
+                             (struct q_useful_buf_c){recipient->wrapped_cek,
+                                                     recipient->wrapped_cek_len});
+        QCBOREncode_CloseArray(&cbor_encode_ctx);
+    }
+    QCBOREncode_CloseArray(&cbor_encode_ctx);
+    return finish_encoding(&cbor_encode_ctx, encoded);
+}
+
+
+/**
+ * \brief The remaining part of the output buffer.
+ *
+ * \param[in] out_buffer  The output buffer.
+ * \param[in] offset      Where the remaining part starts.
+ */
+static inline struct q_useful_buf
+remaining(struct q_useful_buf out_buffer, size_t offset)
+{
+    return (struct q_useful_buf){(uint8_t *)out_buffer.ptr + offset,
+                                 out_buffer.len - offset};
+}
+
+
+/*
+ * Public function. See t_cose_encrypt.h
+ */
+void
+t_cose_encrypt_init(struct t_cose_encrypt_ctx *me,
+                    int32_t                    content_alg_id,
+                    int32_t                    recipient_alg_id)
+{
+    memset(me, 0, sizeof(*me));
+    me->content_alg_id   = content_alg_id;
+    me->recipient_alg_id = recipient_alg_id;
+}
+
+
+/*
+ * Public function. See t_cose_encrypt.h
+ *
+ * The output is built in place. The heads and parameters are
+ * appended, the content is encrypted directly after its byte string
+ * head and the recipients are encoded after that, so the content is
+ * not copied.
+ */
+enum t_cose_err_t
+t_cose_encrypt(struct t_cose_encrypt_ctx       *me,
+               struct q_useful_buf_c            plaintext,
+               struct t_cose_encrypt_recipient *recipients,
+               size_t                           num_recipients,
+               struct q_useful_buf              out_buffer,
+               struct q_useful_buf_c           *cose_encrypt)
+{
+    enum t_cose_err_t      return_value;
+    size_t                 index;
+    size_t                 offset;
+    struct q_useful_buf_c  protected;
+    struct q_useful_buf_c  recipient_protected;
+    struct q_useful_buf_c  aad;
+    struct q_useful_buf_c  encoded;
+    QCBOREncodeContext     cbor_encode_ctx;
+    Q_USEFUL_BUF_MAKE_STACK_UB(protected_buffer, ENCRYPT_PROTECTED_SIZE);
+    Q_USEFUL_BUF_MAKE_STACK_UB(recipient_protected_buffer, ENCRYPT_PROTECTED_SIZE);
+    Q_USEFUL_BUF_MAKE_STACK_UB(aad_buffer, ENCRYPT_AAD_SIZE);
+    Q_USEFUL_BUF_MAKE_STACK_UB(kdf_context_buffer, ENCRYPT_KDF_CONTEXT_SIZE);
+    Q_USEFUL_BUF_MAKE_STACK_UB(iv_buffer, ENCRYPT_IV_SIZE);
+
+    *cose_encrypt = NULL_Q_USEFUL_BUF_C;
+
+    if(num_recipients == 0) {
+        return_value = T_COSE_ERR_INVALID_ARGUMENT;
+        goto Done;
+    }
+    me->cek_len = content_key_size(me->content_alg_id);
+    if(me->cek_len == 0 ||
+       me->recipient_alg_id != COSE_ALGORITHM_ECDH_ES_A128KW) {
+        return_value = T_COSE_ERR_UNSUPPORTED_ENCRYPTION_ALG;
+        goto Done;
+    }
+
+    /* -- The CEK, IV and fixed encoded parts -- */
+    return_value = t_cose_crypto_get_random((struct q_useful_buf){me->cek,
+                                                                  me->cek_len});
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = t_cose_crypto_get_random(iv_buffer);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = encode_protected(me->content_alg_id,
+                                    protected_buffer,
+                                    &protected);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = encode_protected(me->recipient_alg_id,
+                                    recipient_protected_buffer,
+                                    &recipient_protected);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = make_enc_structure(protected, aad_buffer, &aad);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = make_kdf_context(recipient_protected,
+                                    kdf_context_buffer,
+                                    &me->kdf_context);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+
+    /* -- Key agreement and wrap for every recipient -- */
+    for(index = 0; index < num_recipients; index++) {
+        recipients[index].encrypt_ctx = me;
+        recipients[index].result      = T_COSE_ERR_FAIL;
+    }
+    if(me->parallel_cb != NULL) {
+        me->parallel_cb(me->cb_context,
+                        wrap_task,
+                        recipients,
+                        sizeof(*recipients),
+                        num_recipients);
+    } else {
+        t_cose_parallel_run_serial(NULL,
+                                   wrap_task,
+                                   recipients,
+                                   sizeof(*recipients),
+                                   num_recipients);
+    }
+    for(index = 0; index < num_recipients; index++) {
+        if(recipients[index].result != T_COSE_SUCCESS) {
+            return_value = recipients[index].result;
+            goto Done;
+        }
+    }
+
+    /* -- Tag, array head, protected and unprotected parameters -- */
+    offset = 0;
+    return_value = append_head(out_buffer,
+                               &offset,
+                               CBOR_MAJOR_TYPE_OPTIONAL,
+                               CBOR_TAG_COSE_ENCRYPT);
+    if(return_value == T_COSE_SUCCESS) {
+        return_value = append_head(out_buffer, &offset, CBOR_MAJOR_TYPE_ARRAY, 4);
+    }
+    if(return_value == T_COSE_SUCCESS) {
+        return_value = append_head(out_buffer,
+                                   &offset,
+                                   CBOR_MAJOR_TYPE_BYTE_STRING,
+                                   protected.len);
+    }
+    if(return_value == T_COSE_SUCCESS) {
+        return_value = append_bytes(out_buffer, &offset, protected);
+    }
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    QCBOREncode_Init(&cbor_encode_ctx, remaining(out_buffer, offset));
+    QCBOREncode_OpenMap(&cbor_encode_ctx);
+    QCBOREncode_AddBytesToMapN(&cbor_encode_ctx,
+                               COSE_HEADER_PARAM_IV,
+                               q_useful_buf_const(iv_buffer));
+    QCBOREncode_CloseMap(&cbor_encode_ctx);
+    return_value = finish_encoding(&cbor_encode_ctx, &encoded);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    offset += encoded.len;
+
+    /* -- The content, encrypted once straight into the output -- */
+    return_value = append_head(out_buffer,
+                               &offset,
+                               CBOR_MAJOR_TYPE_BYTE_STRING,
+                               plaintext.len + ENCRYPT_TAG_SIZE);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = t_cose_crypto_aead_encrypt(me->content_alg_id,
+                                              (struct q_useful_buf_c){me->cek,
+                                                                      me->cek_len},
+                                              q_useful_buf_const(iv_buffer),
+                                              aad,
+                                              plaintext,
+                                              remaining(out_buffer, offset),
+                                             &encoded);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    offset += encoded.len;
+
+    /* -- The recipients -- */
+    return_value = encode_recipients(recipient_protected,
+                                     recipients,
+                                     num_recipients,
+                                     remaining(out_buffer, offset),
+                                     &encoded);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    offset += encoded.len;
+
+    cose_encrypt->ptr = out_buffer.ptr;
+    cose_encrypt->len = offset;
+
+Done:
+    /* The CEK is not needed after the content and recipients are done */
+    memset(me->cek, 0, sizeof(me->cek));
+    me->kdf_context = NULL_Q_USEFUL_BUF_C;
+    return return_value;
+}
+
+
+/**
+ * One decoded \c COSE_recipient with ECDH-ES.
+ */
+struct recipient_fields {
+    struct q_useful_buf_c protected_parameters;
+    struct q_useful_buf_c kid;
+    int64_t               key_type;
+    struct q_useful_buf_c x;
+    struct q_useful_buf_c y;
+    struct q_useful_buf_c wrapped_cek;
+};
+
+
+/**
+ * \brief Decode the ephemeral \c COSE_Key of a recipient.
+ *
+ * \param[in] decode_context    Decoder positioned after the map item.
+ * \param[in] key_item          The map item of the key.
+ * \param[out] fields           Where the key type and coordinates go.
+ * \param[out] next_nest_level  Nesting level after the map.
+ *
+ * Only pointers to the coordinates are kept. Nothing is checked
+ * until the recipient is the one that is used.
+ */
+static enum t_cose_err_t
+decode_ephemeral_key(QCBORDecodeContext      *decode_context,
+                     const QCBORItem         *key_item,
+                     struct recipient_fields *fields,
+                     uint_fast8_t            *next_nest_level)
+{
+    QCBORItem item;
+
+    *next_nest_level = key_item->uNextNestLevel;
+    while(*next_nest_level > key_item->uNestingLevel) {
+        if(QCBORDecode_GetNext(decode_context, &item) != QCBOR_SUCCESS) {
+            return T_COSE_ERR_ENCRYPT_FORMAT;
+        }
+        if(item.uLabelType == QCBOR_TYPE_INT64) {
+            if(item.label.int64 == COSE_KEY_COMMON_KTY &&
+               item.uDataType == QCBOR_TYPE_INT64) {
+                fields->key_type = item.val.int64;
+            } else if(item.label.int64 == COSE_KEY_PARAM_X_COORDINATE &&
+                      item.uDataType == QCBOR_TYPE_BYTE_STRING) {
+                fields->x = item.val.string;
+            } else if(item.label.int64 == COSE_KEY_PARAM_Y_COORDINATE &&
+                      item.uDataType == QCBOR_TYPE_BYTE_STRING) {
+                fields->y = item.val.string;
+            }
+            /* The curve is implied by the size of the coordinates and
+             * must be that of the private key. */
+        }
+        if(consume_item(decode_context, &item, next_nest_level) != QCBOR_SUCCESS) {
+            return T_COSE_ERR_ENCRYPT_FORMAT;
+        }
+    }
+    return T_COSE_SUCCESS;
+}
+
+
+/**
+ * \brief Decode one \c COSE_recipient.
+ *
+ * \param[in] decode_context  Decoder positioned at the recipient.
+ * \param[out] fields         The decoded recipient.
+ */
+static enum t_cose_err_t
+decode_recipient(QCBORDecodeContext      *decode_context,
+                 struct recipient_fields *fields)
+{
+    enum t_cose_err_t return_value;
+    QCBORItem         item;
+    uint_fast8_t      map_nest_level;
+    uint_fast8_t      next_nest_level;
+
+    memset(fields, 0, sizeof(*fields));
+
+    (void)QCBORDecode_GetNext(decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_ARRAY || item.val.uCount != 3) {
+        /* Nested recipients with a fourth item are not supported */
+        return_value = T_COSE_ERR_ENCRYPT_FORMAT;
+        goto Done;
+    }
+
+    (void)QCBORDecode_GetNext(decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+        return_value = T_COSE_ERR_ENCRYPT_FORMAT;
+        goto Done;
+    }
+    fields->protected_parameters = item.val.string;
+
+    (void)QCBORDecode_GetNext(decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_MAP) {
+        return_value = T_COSE_ERR_ENCRYPT_FORMAT;
+        goto Done;
+    }
+    map_nest_level  = item.uNestingLevel;
+    next_nest_level = item.uNextNestLevel;
+    while(next_nest_level > map_nest_level) {
+        if(QCBORDecode_GetNext(decode_context, &item) != QCBOR_SUCCESS) {
+            return_value = T_COSE_ERR_ENCRYPT_FORMAT;
+            goto Done;
+        }
+        if(item.uLabelType == QCBOR_TYPE_INT64 &&
+           item.label.int64 == COSE_HEADER_PARAM_EPHEMERAL_KEY &&
+           item.uDataType == QCBOR_TYPE_MAP) {
+            return_value = decode_ephemeral_key(decode_context,
+                                                &item,
+                                                fields,
+                                                &next_nest_level);
+            if(return_value != T_COSE_SUCCESS) {
+                goto Done;
+            }
+            continue;
+        }
+        if(item.uLabelType == QCBOR_TYPE_INT64 &&
+           item.label.int64 == COSE_HEADER_PARAM_KID &&
+           item.uDataType == QCBOR_TYPE_BYTE_STRING) {
+            fields->kid = item.val.string;
+        }
+        if(consume_item(decode_context, &item, &next_nest_level) != QCBOR_SUCCESS) {
+            return_value = T_COSE_ERR_ENCRYPT_FORMAT;
+            goto Done;
+        }
+    }
+
+    (void)QCBORDecode_GetNext(decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+        return_value = T_COSE_ERR_ENCRYPT_FORMAT;
+        goto Done;
+    }
+    fields->wrapped_cek = item.val.string;
+
+    return_value = T_COSE_SUCCESS;
+
+Done:
+    return return_value;
+}
+
+
+/**
+ * \brief Unwrap the CEK from the recipient that matched.
+ *
+ * \param[in] me          The decryption context.
+ * \param[in] fields      The recipient.
+ * \param[in] cek_buffer  Buffer for the CEK.
+ * \param[out] cek        The CEK.
+ */
+static enum t_cose_err_t
+unwrap_cek(const struct t_cose_decrypt_ctx *me,
+           const struct recipient_fields   *fields,
+           struct q_useful_buf              cek_buffer,
+           struct q_useful_buf_c           *cek)
+{
+    enum t_cose_err_t        return_value;
+    struct t_cose_parameters parameters;
+    struct t_cose_label_list critical_labels;
+    struct t_cose_label_list unknown_labels;
+    struct q_useful_buf_c    point;
+    struct q_useful_buf_c    shared_secret;
+    struct q_useful_buf_c    kdf_context;
+    Q_USEFUL_BUF_MAKE_STACK_UB(point_buffer, T_COSE_ENCRYPT_MAX_POINT_SIZE);
+    Q_USEFUL_BUF_MAKE_STACK_UB(secret_buffer, ENCRYPT_MAX_SECRET_SIZE);
+    Q_USEFUL_BUF_MAKE_STACK_UB(kek_buffer, ENCRYPT_KEK_SIZE);
+    Q_USEFUL_BUF_MAKE_STACK_UB(kdf_context_buffer, ENCRYPT_KDF_CONTEXT_SIZE);
+
+    /* -- The recipient algorithm -- */
+    if(fields->protected_parameters.len > T_COSE_ENCRYPT_MAX_PROTECTED_SIZE) {
+        return_value = T_COSE_ERR_ENCRYPT_PROTECTED_SIZE;
+        goto Done;
+    }
+    clear_label_list(&unknown_labels);
+    return_value = parse_protected_header_parameters(fields->protected_parameters,
+                                                    &parameters,
+                                                    &critical_labels,
+                                                    &unknown_labels,
+                                                     NULL,
+                                                     0);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = check_critical_labels(&critical_labels, &unknown_labels);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    if(parameters.cose_algorithm_id != COSE_ALGORITHM_ECDH_ES_A128KW) {
+        return_value = T_COSE_ERR_UNSUPPORTED_ENCRYPTION_ALG;
+        goto Done;
+    }
+
+    /* -- The ephemeral key as an uncompressed point -- */
+    if(fields->key_type != COSE_KEY_TYPE_EC2 ||
+       fields->x.len == 0 ||
+       fields->x.len != fields->y.len ||
+       1 + 2 * fields->x.len > point_buffer.len) {
+        return_value = T_COSE_ERR_ENCRYPT_FORMAT;
+        goto Done;
+    }
+    ((uint8_t *)point_buffer.ptr)[0] = 0x04;
+    memcpy((uint8_t *)point_buffer.ptr + 1, fields->x.ptr, fields->x.len);
+    memcpy((uint8_t *)point_buffer.ptr + 1 + fields->x.len,
+           fields->y.ptr,
+           fields->y.len);
+    point = (struct q_useful_buf_c){point_buffer.ptr, 1 + 2 * fields->x.len};
+
+    /* -- ECDH, HKDF and unwrap -- */
+    return_value = t_cose_crypto_ecdh(me->private_key,
+                                      point,
+                                      secret_buffer,
+                                      &shared_secret);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = make_kdf_context(fields->protected_parameters,
+                                    kdf_context_buffer,
+                                    &kdf_context);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = derive_kek(shared_secret, kdf_context, kek_buffer);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = t_cose_crypto_kw_unwrap(COSE_ALGORITHM_A128KW,
+                                           q_useful_buf_const(kek_buffer),
+                                           fields->wrapped_cek,
+                                           cek_buffer,
+                                           cek);
+
+Done:
+    memset(secret_buffer.ptr, 0, secret_buffer.len);
+    memset(kek_buffer.ptr, 0, kek_buffer.len);
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_encrypt.h
+ */
+enum t_cose_err_t
+t_cose_decrypt(struct t_cose_decrypt_ctx *me,
+               struct q_useful_buf_c      cose_encrypt,
+               struct q_useful_buf        plaintext_buffer,
+               struct q_useful_buf_c     *plaintext)
+{
+    enum t_cose_err_t        return_value;
+    QCBORDecodeContext       decode_context;
+    QCBORItem                item;
+    struct t_cose_parameters protected_parameters;
+    struct t_cose_parameters unprotected_parameters;
+    struct t_cose_parameters parameters;
+    struct t_cose_label_list critical_labels;
+    struct t_cose_label_list unknown_labels;
+    struct q_useful_buf_c    protected;
+    struct q_useful_buf_c    ciphertext;
+    struct q_useful_buf_c    aad;
+    struct q_useful_buf_c    cek;
+    struct recipient_fields  fields;
+    uint16_t                 num_recipients;
+    uint16_t                 index;
+    Q_USEFUL_BUF_MAKE_STACK_UB(aad_buffer, ENCRYPT_AAD_SIZE);
+    Q_USEFUL_BUF_MAKE_STACK_UB(cek_buffer, T_COSE_ENCRYPT_MAX_CEK_SIZE);
+
+    *plaintext = NULL_Q_USEFUL_BUF_C;
+
+    if(q_useful_buf_c_is_null_or_empty(me->kid)) {
+        return_value = T_COSE_ERR_NO_KID;
+        goto Done;
+    }
+
+    QCBORDecode_Init(&decode_context, cose_encrypt, QCBOR_DECODE_MODE_NORMAL);
+
+    /* -- The array of four -- */
+    (void)QCBORDecode_GetNext(&decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_ARRAY || item.val.uCount != 4) {
+        return_value = T_COSE_ERR_ENCRYPT_FORMAT;
+        goto Done;
+    }
+
+    /* -- The parameters -- */
+    (void)QCBORDecode_GetNext(&decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+        return_value = T_COSE_ERR_ENCRYPT_FORMAT;
+        goto Done;
+    }
+    protected = item.val.string;
+    if(protected.len > T_COSE_ENCRYPT_MAX_PROTECTED_SIZE) {
+        return_value = T_COSE_ERR_ENCRYPT_PROTECTED_SIZE;
+        goto Done;
+    }
+
+    clear_label_list(&unknown_labels);
+    return_value = parse_protected_header_parameters(protected,
+                                                    &protected_parameters,
+                                                    &critical_labels,
+                                                    &unknown_labels,
+                                                     NULL,
+                                                     0);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = parse_unprotected_header_parameters(&decode_context,
+                                                       &unprotected_parameters,
+                                                       &unknown_labels,
+                                                        NULL,
+                                                        0);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = check_critical_labels(&critical_labels, &unknown_labels);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = check_and_copy_parameters(&protected_parameters,
+                                             &unprotected_parameters,
+                                             &parameters);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    if(content_key_size(parameters.cose_algorithm_id) == 0) {
+        return_value = T_COSE_ERR_UNSUPPORTED_ENCRYPTION_ALG;
+        goto Done;
+    }
+    if(parameters.iv.len != ENCRYPT_IV_SIZE) {
+        return_value = T_COSE_ERR_ENCRYPT_FORMAT;
+        goto Done;
+    }
+
+    /* -- The ciphertext -- */
+    (void)QCBORDecode_GetNext(&decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+        /* Detached content is not supported */
+        return_value = T_COSE_ERR_ENCRYPT_FORMAT;
+        goto Done;
+    }
+    ciphertext = item.val.string;
+
+    /* -- Find the recipient by kid -- */
+    (void)QCBORDecode_GetNext(&decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_ARRAY) {
+        return_value = T_COSE_ERR_ENCRYPT_FORMAT;
+        goto Done;
+    }
+    num_recipients = item.val.uCount;
+
+    return_value = T_COSE_ERR_UNKNOWN_KEY;
+    for(index = 0; index < num_recipients; index++) {
+        return_value = decode_recipient(&decode_context, &fields);
+        if(return_value != T_COSE_SUCCESS) {
+            goto Done;
+        }
+        if(!q_useful_buf_compare(fields.kid, me->kid)) {
+            break;
+        }
+        return_value = T_COSE_ERR_UNKNOWN_KEY;
+    }
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+
+    /* -- Unwrap the CEK and decrypt -- */
+    return_value = unwrap_cek(me, &fields, cek_buffer, &cek);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    if(cek.len != content_key_size(parameters.cose_algorithm_id)) {
+        return_value = T_COSE_ERR_DECRYPT_FAIL;
+        goto Done;
+    }
+    return_value = make_enc_structure(protected, aad_buffer, &aad);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = t_cose_crypto_aead_decrypt(parameters.cose_algorithm_id,
+                                              cek,
+                                              parameters.iv,
+                                              aad,
+                                              ciphertext,
+                                              plaintext_buffer,
+                                              plaintext);
+
+Done:
+    memset(cek_buffer.ptr, 0, cek_buffer.len);
+    return return_value;
+}
+
+#endif /* T_COSE_ENABLE_ENCRYPT */
@@ -0,0 +1,248 @@
+/*
+ *  t_cose_hash_envelope.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifdef T_COSE_ENABLE_HASH_ENVELOPE_FILE
+/* For fstat() and friends when compiling with -std=c99 */
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "t_cose/t_cose_hash_envelope.h"
+#include "t_cose_crypto.h"
+#include "t_cose_util.h"
+#include "t_cose_standard_constants.h"
+
+#ifdef T_COSE_ENABLE_HASH_ENVELOPE_FILE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+
+/**
+ * \file t_cose_hash_envelope.c
+ *
+ * \brief Implementation of content hashing for COSE Hash Envelope.
+ */
+
+
+#ifndef T_COSE_DISABLE_HASH_ENVELOPE
+
+/*
+ * Public function. See t_cose_hash_envelope.h
+ */
+enum t_cose_err_t
+t_cose_hash_envelope_compute(int32_t                payload_hash_alg_id,
+                             struct q_useful_buf_c  content,
+                             struct q_useful_buf    buffer_for_hash,
+                             struct q_useful_buf_c *hash)
+{
+    enum t_cose_err_t         return_value;
+    struct t_cose_crypto_hash hash_ctx;
+
+    if(hash_size_from_hash_alg_id(payload_hash_alg_id) == 0) {
+        return_value = T_COSE_ERR_UNSUPPORTED_HASH;
+        goto Done;
+    }
+
+    return_value = t_cose_crypto_hash_start(&hash_ctx, payload_hash_alg_id);
+    if(return_value) {
+        goto Done;
+    }
+    t_cose_crypto_hash_update(&hash_ctx, content);
+    return_value = t_cose_crypto_hash_finish(&hash_ctx, buffer_for_hash, hash);
+
+Done:
+    return return_value;
+}
+
+
+/**
+ * \brief Compare a computed hash to the payload of a hash envelope.
+ *
+ * \param[in] computed_hash  Hash of the content or \c NULL_Q_USEFUL_BUF_C.
+ * \param[in] payload        The payload of the hash envelope.
+ *
+ * \retval T_COSE_ERR_PAYLOAD_HASH_MISMATCH  They don't match.
+ */
+static inline enum t_cose_err_t
+compare_to_payload(struct q_useful_buf_c computed_hash,
+                   struct q_useful_buf_c payload)
+{
+    /* The hash is not secret so the comparison need not be constant time */
+    if(q_useful_buf_compare(computed_hash, payload)) {
+        return T_COSE_ERR_PAYLOAD_HASH_MISMATCH;
+    }
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function. See t_cose_hash_envelope.h
+ */
+enum t_cose_err_t
+t_cose_hash_envelope_check(const struct t_cose_parameters *parameters,
+                           struct q_useful_buf_c           payload,
+                           struct q_useful_buf_c           content)
+{
+    enum t_cose_err_t      return_value;
+    Q_USEFUL_BUF_MAKE_STACK_UB(buffer_for_hash, T_COSE_CRYPTO_MAX_HASH_SIZE);
+    struct q_useful_buf_c  computed_hash;
+
+    return_value = t_cose_hash_envelope_compute(parameters->payload_hash_alg_id,
+                                                content,
+                                                buffer_for_hash,
+                                               &computed_hash);
+    if(return_value) {
+        goto Done;
+    }
+
+    return_value = compare_to_payload(computed_hash, payload);
+
+Done:
+    return return_value;
+}
+
+
+#ifdef T_COSE_ENABLE_HASH_ENVELOPE_FILE
+
+/**
+ * Size of the part of a regular file that is mapped at one time. It
+ * must be a multiple of the page size.
+ */
+#ifndef T_COSE_HASH_ENVELOPE_MAP_WINDOW
+#define T_COSE_HASH_ENVELOPE_MAP_WINDOW (64 * 1024 * 1024)
+#endif
+
+/** Size of the buffer for reading files that can't be mapped */
+#define HASH_ENVELOPE_READ_BUFFER_SIZE 16384
+
+
+/**
+ * \brief Hash a file that can't be mapped, such as a pipe.
+ *
+ * \param[in] fd        Open file descriptor.
+ * \param[in] hash_ctx  Hash context to add the contents to.
+ *
+ * \retval T_COSE_ERR_ARTIFACT_ACCESS  A read failed. A read interrupted
+ *                                     by a signal is retried.
+ */
+static enum t_cose_err_t
+hash_read_file(int fd, struct t_cose_crypto_hash *hash_ctx)
+{
+    uint8_t               buffer[HASH_ENVELOPE_READ_BUFFER_SIZE];
+    ssize_t               bytes_read;
+    struct q_useful_buf_c chunk;
+
+    while((bytes_read = read(fd, buffer, sizeof(buffer))) != 0) {
+        if(bytes_read < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return T_COSE_ERR_ARTIFACT_ACCESS;
+        }
+        chunk.ptr = buffer;
+        chunk.len = (size_t)bytes_read;
+        t_cose_crypto_hash_update(hash_ctx, chunk);
+    }
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function. See t_cose_hash_envelope.h
+ */
+enum t_cose_err_t
+t_cose_hash_envelope_compute_file(int32_t                payload_hash_alg_id,
+                                  const char            *path,
+                                  struct q_useful_buf    buffer_for_hash,
+                                  struct q_useful_buf_c *hash)
+{
+    enum t_cose_err_t         return_value;
+    enum t_cose_err_t         finish_result;
+    struct t_cose_crypto_hash hash_ctx;
+    int                       fd;
+    struct stat               file_status;
+
+    if(hash_size_from_hash_alg_id(payload_hash_alg_id) == 0) {
+        return_value = T_COSE_ERR_UNSUPPORTED_HASH;
+        goto Done;
+    }
+
+    do {
+        fd = open(path, O_RDONLY);
+    } while(fd < 0 && errno == EINTR);
+    if(fd < 0) {
+        return_value = T_COSE_ERR_ARTIFACT_ACCESS;
+        goto Done;
+    }
+
+    return_value = t_cose_crypto_hash_start(&hash_ctx, payload_hash_alg_id);
+    if(return_value) {
+        goto CloseFile;
+    }
+
+    if(fstat(fd, &file_status)) {
+        return_value = T_COSE_ERR_ARTIFACT_ACCESS;
+    } else if(S_ISREG(file_status.st_mode)) {
+        return_value = hash_mapped_file(fd,
+                                        file_status.st_size,
+                                        T_COSE_HASH_ENVELOPE_MAP_WINDOW,
+                                        NULL,
+                                        &hash_ctx);
+    } else {
+        return_value = hash_read_file(fd, &hash_ctx);
+    }
+
+    /* Always finish so the crypto adapter can release any resources
+     * held by the hash context, even if reading failed. */
+    finish_result = t_cose_crypto_hash_finish(&hash_ctx, buffer_for_hash, hash);
+    if(return_value == T_COSE_SUCCESS) {
+        return_value = finish_result;
+    }
+
+CloseFile:
+    close(fd);
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_hash_envelope.h
+ */
+enum t_cose_err_t
+t_cose_hash_envelope_check_file(const struct t_cose_parameters *parameters,
+                                struct q_useful_buf_c           payload,
+                                const char                     *path)
+{
+    enum t_cose_err_t      return_value;
+    Q_USEFUL_BUF_MAKE_STACK_UB(buffer_for_hash, T_COSE_CRYPTO_MAX_HASH_SIZE);
+    struct q_useful_buf_c  computed_hash;
+
+    return_value = t_cose_hash_envelope_compute_file(parameters->payload_hash_alg_id,
+                                                     path,
+                                                     buffer_for_hash,
+                                                    &computed_hash);
+    if(return_value) {
+        goto Done;
+    }
+
+    return_value = compare_to_payload(computed_hash, payload);
+
+Done:
+    return return_value;
+}
+
+#endif /* T_COSE_ENABLE_HASH_ENVELOPE_FILE */
+
+#endif /* T_COSE_DISABLE_HASH_ENVELOPE */
@@ -0,0 +1,172 @@
+/*
+ *  t_cose_key_arena.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifdef T_COSE_ENABLE_KEY_ARENA
+/* For MAP_ANONYMOUS, MAP_HUGETLB and MADV_HUGEPAGE when compiling
+ * with -std=c99 */
+#define _DEFAULT_SOURCE
+#endif
+
+#include "t_cose/t_cose_key_arena.h"
+#include <string.h>
+
+
+/**
+ * \file t_cose_key_arena.c
+ *
+ * \brief Implementation of the huge page arena for key tables.
+ *
+ * Allocation just moves \c used forward. \c used and the capacity are
+ * always multiples of the alignment, so an allocation that fits
+ * before rounding also fits after.
+ */
+
+
+#ifdef T_COSE_ENABLE_KEY_ARENA
+
+#include <sys/mman.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+
+/**
+ * \brief Round up to a multiple of a power of two.
+ */
+static inline size_t
+round_up(size_t value, size_t multiple)
+{
+    return (value + multiple - 1) & ~(multiple - 1);
+}
+
+
+/*
+ * Public function. See t_cose_key_arena.h
+ */
+enum t_cose_err_t
+t_cose_key_arena_init(struct t_cose_key_arena *arena,
+                      size_t                   capacity,
+                      uint32_t                 options)
+{
+    enum t_cose_err_t return_value;
+    void             *mapping;
+    size_t            mapping_len;
+
+    memset(arena, 0, sizeof(*arena));
+
+    if(capacity == 0 || capacity > SIZE_MAX / 2) {
+        return_value = T_COSE_ERR_INVALID_ARGUMENT;
+        goto Done;
+    }
+    capacity = round_up(capacity, T_COSE_KEY_ARENA_HUGE_PAGE_SIZE);
+
+#ifdef MAP_HUGETLB
+    /* -- Reserved huge pages, which are usually not there -- */
+    if(!(options & (T_COSE_KEY_ARENA_OPT_NO_HUGETLB | T_COSE_KEY_ARENA_OPT_NO_HUGE_PAGES))) {
+        mapping = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(mapping != MAP_FAILED) {
+            arena->mapping       = mapping;
+            arena->mapping_len   = capacity;
+            arena->base          = mapping;
+            arena->stats.backing = T_COSE_KEY_ARENA_HUGETLB;
+            return_value = T_COSE_SUCCESS;
+            goto Done;
+        }
+    }
+#endif /* MAP_HUGETLB */
+
+    /* -- Ordinary memory with an extra huge page so the start can be
+     * aligned to one -- */
+    mapping_len = capacity + T_COSE_KEY_ARENA_HUGE_PAGE_SIZE;
+    mapping = mmap(NULL, mapping_len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mapping == MAP_FAILED) {
+        return_value = T_COSE_ERR_INSUFFICIENT_MEMORY;
+        goto Done;
+    }
+    arena->mapping     = mapping;
+    arena->mapping_len = mapping_len;
+    arena->base        = (uint8_t *)round_up((size_t)(uintptr_t)mapping,
+                                             T_COSE_KEY_ARENA_HUGE_PAGE_SIZE);
+
+    arena->stats.backing = T_COSE_KEY_ARENA_SMALL_PAGES;
+    if(options & T_COSE_KEY_ARENA_OPT_NO_HUGE_PAGES) {
+#ifdef MADV_NOHUGEPAGE
+        /* So it is ordinary pages even when transparent huge pages
+         * are used for everything */
+        (void)madvise(arena->base, capacity, MADV_NOHUGEPAGE);
+#endif
+    } else {
+#ifdef MADV_HUGEPAGE
+        if(madvise(arena->base, capacity, MADV_HUGEPAGE) == 0) {
+            arena->stats.backing = T_COSE_KEY_ARENA_TRANSPARENT;
+        }
+#endif
+    }
+    return_value = T_COSE_SUCCESS;
+
+Done:
+    if(return_value == T_COSE_SUCCESS) {
+        arena->stats.capacity = capacity;
+    }
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_key_arena.h
+ */
+struct q_useful_buf
+t_cose_key_arena_alloc(struct t_cose_key_arena *arena, size_t size)
+{
+    struct q_useful_buf memory;
+
+    if(size > arena->stats.capacity - arena->stats.used) {
+        return NULL_Q_USEFUL_BUF;
+    }
+
+    memory.ptr = arena->base + arena->stats.used;
+    memory.len = size;
+
+    arena->stats.used += round_up(size, T_COSE_KEY_ARENA_ALIGN);
+    if(arena->stats.used > arena->stats.high_water) {
+        arena->stats.high_water = arena->stats.used;
+    }
+
+    return memory;
+}
+
+
+/*
+ * Public function. See t_cose_key_arena.h
+ */
+void
+t_cose_key_arena_reset(struct t_cose_key_arena *arena)
+{
+    arena->stats.used = 0;
+    arena->stats.resets++;
+}
+
+
+/*
+ * Public function. See t_cose_key_arena.h
+ */
+void
+t_cose_key_arena_free(struct t_cose_key_arena *arena)
+{
+    if(arena->mapping != NULL) {
+        (void)munmap(arena->mapping, arena->mapping_len);
+    }
+    memset(arena, 0, sizeof(*arena));
+}
+
+#endif /* T_COSE_ENABLE_KEY_ARENA */
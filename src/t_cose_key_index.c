@@ -0,0 +1,224 @@
+/*
+ *  t_cose_key_index.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "t_cose/t_cose_key_index.h"
+#include "t_cose_crypto.h"
+#include <string.h>
+
+
+/**
+ * \file t_cose_key_index.c
+ *
+ * \brief Implementation of the index of public keys for recovering
+ * the signer of a \c COSE_Sign1.
+ */
+
+
+#ifdef T_COSE_ENABLE_KEY_RECOVERY
+
+/**
+ * \brief The first slot to look in for a public point.
+ *
+ * \param[in] index         The index.
+ * \param[in] public_point  Uncompressed SEC1 public point.
+ *
+ * The x coordinate of a public key is as good as random so its
+ * first bytes are used directly. Byte 0 is the 0x04 SEC1 prefix and
+ * is skipped. All points are longer than nine bytes.
+ */
+static inline size_t
+first_slot(const struct t_cose_key_index *index,
+           struct q_useful_buf_c          public_point)
+{
+    const uint8_t *x = (const uint8_t *)public_point.ptr + 1;
+    uint64_t       hash;
+    unsigned       i;
+
+    hash = 0;
+    for(i = 0; i < sizeof(hash); i++) {
+        hash = (hash << 8) | x[i];
+    }
+
+    return (size_t)(hash % index->num_entries);
+}
+
+
+/**
+ * \brief Find the slot with a point or the empty slot where it goes.
+ *
+ * \param[in] index         The index. Must have at least one empty slot.
+ * \param[in] public_point  Uncompressed SEC1 public point.
+ */
+static struct t_cose_key_index_entry *
+find_slot(const struct t_cose_key_index *index,
+          struct q_useful_buf_c          public_point)
+{
+    struct t_cose_key_index_entry *entry;
+    size_t                         slot;
+
+    slot = first_slot(index, public_point);
+    while(1) {
+        entry = &index->entries[slot];
+        if(entry->public_point_len == 0) {
+            break;
+        }
+        if(entry->public_point_len == public_point.len &&
+           !memcmp(entry->public_point, public_point.ptr, public_point.len)) {
+            break;
+        }
+        slot++;
+        if(slot == index->num_entries) {
+            slot = 0;
+        }
+    }
+
+    return entry;
+}
+
+
+/*
+ * Public function. See t_cose_key_index.h
+ */
+void
+t_cose_key_index_init(struct t_cose_key_index       *index,
+                      struct t_cose_key_index_entry *entries,
+                      size_t                         num_entries)
+{
+    size_t i;
+
+    index->entries     = entries;
+    index->num_entries = num_entries;
+    index->num_keys    = 0;
+
+    for(i = 0; i < num_entries; i++) {
+        entries[i].public_point_len = 0;
+    }
+}
+
+
+/*
+ * Public function. See t_cose_key_index.h
+ */
+enum t_cose_err_t
+t_cose_key_index_add(struct t_cose_key_index *index,
+                     struct t_cose_key        key)
+{
+    enum t_cose_err_t              return_value;
+    Q_USEFUL_BUF_MAKE_STACK_UB(    point_buffer, T_COSE_KEY_INDEX_MAX_POINT_SIZE);
+    struct q_useful_buf_c          public_point;
+    struct t_cose_key_index_entry *entry;
+
+    return_value = t_cose_crypto_export_public_point(key,
+                                                     point_buffer,
+                                                    &public_point);
+    if(return_value) {
+        goto Done;
+    }
+
+    /* One slot is always left empty so lookups of points that are
+     * not in the index end. */
+    if(index->num_keys + 1 >= index->num_entries) {
+        return_value = T_COSE_ERR_TOO_SMALL;
+        goto Done;
+    }
+
+    entry = find_slot(index, public_point);
+    if(entry->public_point_len == 0) {
+        memcpy(entry->public_point, public_point.ptr, public_point.len);
+        entry->public_point_len = (uint8_t)public_point.len;
+        entry->key              = key;
+        index->num_keys++;
+    }
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_key_index.h
+ */
+bool
+t_cose_key_index_find(const struct t_cose_key_index *index,
+                      struct q_useful_buf_c          public_point,
+                      struct t_cose_key             *key)
+{
+    const struct t_cose_key_index_entry *entry;
+
+    if(index->num_entries == 0 ||
+       public_point.len <= 1 + sizeof(uint64_t) ||
+       public_point.len > T_COSE_KEY_INDEX_MAX_POINT_SIZE) {
+        return false;
+    }
+
+    entry = find_slot(index, public_point);
+    if(entry->public_point_len == 0) {
+        return false;
+    }
+
+    *key = entry->key;
+    return true;
+}
+
+
+/*
+ * Public function. See t_cose_key_index.h
+ */
+enum t_cose_err_t
+t_cose_sign1_verify_recover_signer(struct t_cose_sign1_verify_ctx *me,
+                                   const struct t_cose_key_index  *index,
+                                   struct q_useful_buf_c           cose_sign1,
+                                   struct q_useful_buf_c          *payload,
+                                   struct t_cose_parameters       *parameters,
+                                   struct t_cose_key              *signer)
+{
+    enum t_cose_err_t                   return_value;
+    struct t_cose_sign1_verify_prepared prepared;
+    Q_USEFUL_BUF_MAKE_STACK_UB(         point_buffer, T_COSE_KEY_INDEX_MAX_POINT_SIZE);
+    struct q_useful_buf_c               public_point;
+    unsigned                            recovery_id;
+
+    return_value = t_cose_sign1_verify_prepare(me,
+                                               cose_sign1,
+                                               payload,
+                                               parameters,
+                                              &prepared);
+    if(return_value || prepared.decode_only) {
+        goto Done;
+    }
+
+    /* -- Try the public key for each parity of R -- */
+    for(recovery_id = 0; recovery_id < 2; recovery_id++) {
+        return_value = t_cose_crypto_pub_key_recover(prepared.cose_algorithm_id,
+                                                     (struct q_useful_buf_c){
+                                                         prepared.tbs_hash_bytes,
+                                                         prepared.tbs_hash_len},
+                                                     prepared.signature,
+                                                     recovery_id,
+                                                     point_buffer,
+                                                    &public_point);
+        if(return_value == T_COSE_SUCCESS) {
+            /* The recovered key verifies the signature, so if it is
+             * a known key the signature is verified. */
+            if(t_cose_key_index_find(index, public_point, signer)) {
+                goto Done;
+            }
+        } else if(return_value != T_COSE_ERR_SIG_VERIFY) {
+            /* T_COSE_ERR_SIG_VERIFY is no point for this parity */
+            goto Done;
+        }
+    }
+    return_value = T_COSE_ERR_UNKNOWN_KEY;
+
+Done:
+    return return_value;
+}
+
+#endif /* T_COSE_ENABLE_KEY_RECOVERY */
@@ -0,0 +1,529 @@
+/*
+ *  t_cose_multi_sign.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "qcbor/qcbor.h"
+#include "t_cose/t_cose_multi_sign.h"
+#include "t_cose/q_useful_buf.h"
+#include "t_cose_crypto.h"
+#include "t_cose_util.h"
+#include "t_cose_parameters.h"
+#include "t_cose_standard_constants.h"
+#include <string.h>
+
+
+/**
+ * \file t_cose_multi_sign.c
+ *
+ * \brief Implementation of \c COSE_Sign with several signers.
+ */
+
+
+/**
+ * Size of the buffer for the protected parameters of a signer. They
+ * are only the algorithm ID.
+ */
+#define MULTI_SIGN_PROTECTED_SIZE 16
+
+/**
+ * Amount of payload hashed into each hash context before moving on
+ * to the next. It is small enough that the chunk is still in the
+ * CPU cache when the last context hashes it.
+ */
+#define MULTI_SIGN_HASH_CHUNK 4096
+
+
+/**
+ * \brief Start the hash of every signer and hash the payload into all
+ * of them reading it once.
+ *
+ * \param[in] body_protected  Protected parameters of the \c COSE_Sign.
+ * \param[in] sign_protected  Protected parameters of each signer.
+ * \param[in] algorithm_ids   Algorithm ID of each signer.
+ * \param[in] num_signers     Number of signers.
+ * \param[in] payload         The payload.
+ * \param[out] hash_ctxs      A hash context for each signer with
+ *                            everything but the finish done.
+ *
+ * \return This returns one of the error codes defined by \ref t_cose_err_t.
+ *
+ * On an error none of the hash contexts are left started.
+ */
+static enum t_cose_err_t
+hash_signers(struct q_useful_buf_c        body_protected,
+             const struct q_useful_buf_c *sign_protected,
+             const int32_t               *algorithm_ids,
+             size_t                       num_signers,
+             struct q_useful_buf_c        payload,
+             struct t_cose_crypto_hash   *hash_ctxs)
+{
+    enum t_cose_err_t     return_value;
+    struct q_useful_buf_c chunk;
+    size_t                offset;
+    size_t                i;
+
+    for(i = 0; i < num_signers; i++) {
+        if(hash_size_from_hash_alg_id(hash_alg_id_from_sig_alg_id(algorithm_ids[i])) == 0) {
+            return_value = T_COSE_ERR_UNSUPPORTED_HASH;
+            goto Done;
+        }
+    }
+
+    for(i = 0; i < num_signers; i++) {
+        return_value = start_sign_hash(algorithm_ids[i],
+                                       body_protected,
+                                       sign_protected[i],
+                                       payload.len,
+                                       &hash_ctxs[i]);
+        if(return_value) {
+            abandon_hashes(hash_ctxs, i);
+            goto Done;
+        }
+    }
+
+    for(offset = 0; offset < payload.len; offset += chunk.len) {
+        chunk = q_useful_buf_head(q_useful_buf_tail(payload, offset),
+                                  MULTI_SIGN_HASH_CHUNK);
+        if(q_useful_buf_c_is_null(chunk)) {
+            chunk = q_useful_buf_tail(payload, offset);
+        }
+        for(i = 0; i < num_signers; i++) {
+            t_cose_crypto_hash_update(&hash_ctxs[i], chunk);
+        }
+    }
+
+    return_value = T_COSE_SUCCESS;
+
+Done:
+    return return_value;
+}
+
+
+/**
+ * One public key operation of t_cose_multi_sign().
+ */
+struct sign_task {
+    struct t_cose_sign1_sign_ctx sign_ctx;
+    struct t_cose_sign1_prepared prepared;
+    /* The encoded signature byte string */
+    uint8_t                      buffer[T_COSE_MAX_SIG_SIZE + QCBOR_HEAD_BUFFER_SIZE];
+    struct q_useful_buf_c        signature;
+    enum t_cose_err_t            result;
+};
+
+
+/**
+ * \brief Run a \ref sign_task. This is a \ref t_cose_task_fn.
+ *
+ * \param[in,out] task  The \ref sign_task.
+ */
+static void
+sign_task_run(void *task)
+{
+    struct sign_task  *sign_task = (struct sign_task *)task;
+    QCBOREncodeContext cbor_encode_ctx;
+
+    QCBOREncode_Init(&cbor_encode_ctx,
+                     (struct q_useful_buf){sign_task->buffer, sizeof(sign_task->buffer)});
+    sign_task->result = t_cose_sign1_sign_complete(&sign_task->sign_ctx,
+                                                   &sign_task->prepared,
+                                                   &cbor_encode_ctx);
+    if(sign_task->result) {
+        return;
+    }
+    if(QCBOREncode_Finish(&cbor_encode_ctx, &sign_task->signature)) {
+        sign_task->result = T_COSE_ERR_CBOR_FORMATTING;
+    }
+}
+
+
+/*
+ * Public function. See t_cose_multi_sign.h
+ */
+enum t_cose_err_t
+t_cose_multi_sign(struct t_cose_multi_signer *signers,
+                  size_t                      num_signers,
+                  struct q_useful_buf_c       payload,
+                  t_cose_parallel_cb          parallel_cb,
+                  void                       *cb_context,
+                  struct q_useful_buf         out_buffer,
+                  struct q_useful_buf_c      *cose_sign)
+{
+    enum t_cose_err_t          return_value;
+    QCBORError                 cbor_err;
+    QCBOREncodeContext         cbor_encode_ctx;
+    struct sign_task           tasks[T_COSE_MAX_SIGNERS];
+    struct t_cose_crypto_hash  hash_ctxs[T_COSE_MAX_SIGNERS];
+    uint8_t                    protected_buffers[T_COSE_MAX_SIGNERS][MULTI_SIGN_PROTECTED_SIZE];
+    struct q_useful_buf_c      protected_parameters[T_COSE_MAX_SIGNERS];
+    int32_t                    algorithm_ids[T_COSE_MAX_SIGNERS];
+    struct q_useful_buf_c      tbs_hash;
+    struct q_useful_buf_c      kid;
+    size_t                     i;
+
+    if(num_signers == 0 || num_signers > T_COSE_MAX_SIGNERS) {
+        return_value = T_COSE_ERR_SIGNER_COUNT;
+        goto Done;
+    }
+
+    /* -- Protected parameters of each signer -- */
+    for(i = 0; i < num_signers; i++) {
+        algorithm_ids[i] = signers[i].sign_ctx->cose_algorithm_id;
+
+        QCBOREncode_Init(&cbor_encode_ctx,
+                         (struct q_useful_buf){protected_buffers[i],
+                                               MULTI_SIGN_PROTECTED_SIZE});
+        QCBOREncode_OpenMap(&cbor_encode_ctx);
+        QCBOREncode_AddInt64ToMapN(&cbor_encode_ctx,
+                                   COSE_HEADER_PARAM_ALG,
+                                   algorithm_ids[i]);
+        QCBOREncode_CloseMap(&cbor_encode_ctx);
+        if(QCBOREncode_Finish(&cbor_encode_ctx, &protected_parameters[i])) {
+            return_value = T_COSE_ERR_CBOR_FORMATTING;
+            goto Done;
+        }
+    }
+
+    /* -- Hash the Sig_structure of each, reading the payload once -- */
+    return_value = hash_signers(NULL_Q_USEFUL_BUF_C,
+                                protected_parameters,
+                                algorithm_ids,
+                                num_signers,
+                                payload,
+                                hash_ctxs);
+    if(return_value) {
+        goto Done;
+    }
+    for(i = 0; i < num_signers; i++) {
+        return_value = t_cose_crypto_hash_finish(&hash_ctxs[i],
+                                                 (struct q_useful_buf){tasks[i].prepared.tbs_hash_bytes,
+                                                         sizeof(tasks[i].prepared.tbs_hash_bytes)},
+                                                 &tbs_hash);
+        if(return_value) {
+            abandon_hashes(&hash_ctxs[i + 1], num_signers - i - 1);
+            goto Done;
+        }
+        tasks[i].prepared.tbs_hash_len         = tbs_hash.len;
+        tasks[i].prepared.protected_parameters = protected_parameters[i];
+        tasks[i].prepared.cose_algorithm_id    = algorithm_ids[i];
+        tasks[i].prepared.close_array          = false;
+        tasks[i].sign_ctx                      = *signers[i].sign_ctx;
+#ifdef T_COSE_ENABLE_RESTARTABLE
+        tasks[i].sign_ctx.restart_ctx          = NULL;
+#endif
+    }
+
+    /* -- The public key operations, which are independent -- */
+    if(parallel_cb == NULL) {
+        parallel_cb = t_cose_parallel_run_serial;
+    }
+    (*parallel_cb)(cb_context, sign_task_run, tasks, sizeof(tasks[0]), num_signers);
+
+    return_value = T_COSE_SUCCESS;
+    for(i = 0; i < num_signers; i++) {
+        signers[i].result = tasks[i].result;
+        if(return_value == T_COSE_SUCCESS) {
+            return_value = tasks[i].result;
+        }
+    }
+    if(return_value) {
+        goto Done;
+    }
+
+    /* -- Output the COSE_Sign -- */
+    QCBOREncode_Init(&cbor_encode_ctx, out_buffer);
+    QCBOREncode_AddTag(&cbor_encode_ctx, CBOR_TAG_COSE_SIGN);
+    QCBOREncode_OpenArray(&cbor_encode_ctx);
+    QCBOREncode_AddBytes(&cbor_encode_ctx, NULL_Q_USEFUL_BUF_C);
+    QCBOREncode_OpenMap(&cbor_encode_ctx);
+    QCBOREncode_CloseMap(&cbor_encode_ctx);
+    QCBOREncode_AddBytes(&cbor_encode_ctx, payload);
+    QCBOREncode_OpenArray(&cbor_encode_ctx);
+    for(i = 0; i < num_signers; i++) {
+        kid = signers[i].sign_ctx->kid;
+#ifndef T_COSE_DISABLE_SHORT_CIRCUIT_SIGN
+        if((signers[i].sign_ctx->option_flags & T_COSE_OPT_SHORT_CIRCUIT_SIG) &&
+           q_useful_buf_c_is_null_or_empty(kid)) {
+            kid = get_short_circuit_kid();
+        }
+#endif /* T_COSE_DISABLE_SHORT_CIRCUIT_SIGN */
+
+        QCBOREncode_OpenArray(&cbor_encode_ctx);
+        QCBOREncode_AddBytes(&cbor_encode_ctx, protected_parameters[i]);
+        QCBOREncode_OpenMap(&cbor_encode_ctx);
+        if(!q_useful_buf_c_is_null_or_empty(kid)) {
+            QCBOREncode_AddBytesToMapN(&cbor_encode_ctx, COSE_HEADER_PARAM_KID, kid);
+        }
+        QCBOREncode_CloseMap(&cbor_encode_ctx);
+        QCBOREncode_AddEncoded(&cbor_encode_ctx, tasks[i].signature);
+        QCBOREncode_CloseArray(&cbor_encode_ctx);
+    }
+    QCBOREncode_CloseArray(&cbor_encode_ctx);
+    QCBOREncode_CloseArray(&cbor_encode_ctx);
+
+    cbor_err = QCBOREncode_Finish(&cbor_encode_ctx, cose_sign);
+    if(cbor_err == QCBOR_ERR_BUFFER_TOO_SMALL) {
+        return_value = T_COSE_ERR_TOO_SMALL;
+    } else if(cbor_err != QCBOR_SUCCESS) {
+        return_value = T_COSE_ERR_CBOR_FORMATTING;
+    }
+
+Done:
+    return return_value;
+}
+
+
+/**
+ * \brief Decode the header parameters of a \c COSE_Sign or of one of
+ * its signers.
+ *
+ * \param[in] decode_context   Context positioned after the protected
+ *                             parameters.
+ * \param[in] protected_item   The protected parameters already read.
+ * \param[out] parameters      The decoded parameters.
+ *
+ * \return This returns one of the error codes defined by \ref t_cose_err_t.
+ */
+static enum t_cose_err_t
+decode_parameters(QCBORDecodeContext       *decode_context,
+                  const QCBORItem          *protected_item,
+                  struct t_cose_parameters *parameters)
+{
+    enum t_cose_err_t        return_value;
+    struct t_cose_parameters protected_parameters;
+    struct t_cose_parameters unprotected_parameters;
+    struct t_cose_label_list critical_labels;
+    struct t_cose_label_list unknown_labels;
+
+    if(protected_item->uDataType != QCBOR_TYPE_BYTE_STRING) {
+        return_value = T_COSE_ERR_SIGN_FORMAT;
+        goto Done;
+    }
+
+    clear_label_list(&unknown_labels);
+    return_value = parse_protected_header_parameters(protected_item->val.string,
+                                                    &protected_parameters,
+                                                    &critical_labels,
+                                                    &unknown_labels,
+                                                     NULL,
+                                                     0);
+    if(return_value) {
+        goto Done;
+    }
+
+    return_value = parse_unprotected_header_parameters(decode_context,
+                                                      &unprotected_parameters,
+                                                      &unknown_labels,
+                                                       NULL,
+                                                       0);
+    if(return_value) {
+        goto Done;
+    }
+
+    return_value = check_critical_labels(&critical_labels, &unknown_labels);
+    if(return_value) {
+        goto Done;
+    }
+
+    return_value = check_and_copy_parameters(&protected_parameters,
+                                             &unprotected_parameters,
+                                              parameters);
+
+Done:
+    return return_value;
+}
+
+
+/**
+ * One public key operation of t_cose_multi_sign_verify().
+ */
+struct verify_task {
+    const struct t_cose_sign1_verify_ctx *verify_ctx;
+    struct t_cose_sign1_verify_prepared   prepared;
+    enum t_cose_err_t                     result;
+};
+
+
+/**
+ * \brief Run a \ref verify_task. This is a \ref t_cose_task_fn.
+ *
+ * \param[in,out] task  The \ref verify_task.
+ */
+static void
+verify_task_run(void *task)
+{
+    struct verify_task *verify_task = (struct verify_task *)task;
+
+    verify_task->result = t_cose_sign1_verify_complete(verify_task->verify_ctx,
+                                                      &verify_task->prepared);
+}
+
+
+/*
+ * Public function. See t_cose_multi_sign.h
+ */
+enum t_cose_err_t
+t_cose_multi_sign_verify(uint32_t                      option_flags,
+                         struct q_useful_buf_c         cose_sign,
+                         struct t_cose_multi_verifier *verifiers,
+                         size_t                        num_verifiers,
+                         t_cose_parallel_cb            parallel_cb,
+                         void                         *cb_context,
+                         struct q_useful_buf_c        *payload)
+{
+    enum t_cose_err_t         return_value;
+    QCBORDecodeContext        decode_context;
+    QCBORItem                 item;
+    struct t_cose_parameters  parameters;
+    struct q_useful_buf_c     body_protected;
+    struct verify_task        tasks[T_COSE_MAX_SIGNERS];
+    struct t_cose_crypto_hash hash_ctxs[T_COSE_MAX_SIGNERS];
+    struct q_useful_buf_c     protected_parameters[T_COSE_MAX_SIGNERS];
+    int32_t                   algorithm_ids[T_COSE_MAX_SIGNERS];
+    struct q_useful_buf_c     tbs_hash;
+    size_t                    num_signers;
+    size_t                    i;
+
+    *payload = NULL_Q_USEFUL_BUF_C;
+
+    QCBORDecode_Init(&decode_context, cose_sign, QCBOR_DECODE_MODE_NORMAL);
+
+    /* -- The array of four and the body header parameters -- */
+    (void)QCBORDecode_GetNext(&decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_ARRAY || item.val.uCount != 4) {
+        return_value = T_COSE_ERR_SIGN_FORMAT;
+        goto Done;
+    }
+    (void)QCBORDecode_GetNext(&decode_context, &item);
+    body_protected = item.val.string;
+    return_value = decode_parameters(&decode_context, &item, &parameters);
+    if(return_value) {
+        goto Done;
+    }
+
+    /* -- The payload -- */
+    (void)QCBORDecode_GetNext(&decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+        return_value = T_COSE_ERR_SIGN_FORMAT;
+        goto Done;
+    }
+    *payload = item.val.string;
+
+    /* -- The signers -- */
+    (void)QCBORDecode_GetNext(&decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_ARRAY || item.val.uCount == 0) {
+        return_value = T_COSE_ERR_SIGN_FORMAT;
+        goto Done;
+    }
+    num_signers = item.val.uCount;
+    if(num_signers > T_COSE_MAX_SIGNERS) {
+        return_value = T_COSE_ERR_SIGNER_COUNT;
+        goto Done;
+    }
+    for(i = 0; i < num_signers; i++) {
+        (void)QCBORDecode_GetNext(&decode_context, &item);
+        if(item.uDataType != QCBOR_TYPE_ARRAY || item.val.uCount != 3) {
+            return_value = T_COSE_ERR_SIGN_FORMAT;
+            goto Done;
+        }
+        (void)QCBORDecode_GetNext(&decode_context, &item);
+        protected_parameters[i] = item.val.string;
+        return_value = decode_parameters(&decode_context, &item, &parameters);
+        if(return_value) {
+            goto Done;
+        }
+        algorithm_ids[i] = parameters.cose_algorithm_id;
+
+        (void)QCBORDecode_GetNext(&decode_context, &item);
+        if(item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+            return_value = T_COSE_ERR_SIGN_FORMAT;
+            goto Done;
+        }
+        tasks[i].prepared.protected_parameters = protected_parameters[i];
+        tasks[i].prepared.cose_algorithm_id    = parameters.cose_algorithm_id;
+        tasks[i].prepared.kid                  = parameters.kid;
+        tasks[i].prepared.signature            = item.val.string;
+        tasks[i].prepared.decode_only          = false;
+    }
+
+    if(QCBORDecode_Finish(&decode_context) != QCBOR_SUCCESS) {
+        return_value = T_COSE_ERR_CBOR_NOT_WELL_FORMED;
+        goto Done;
+    }
+
+    for(i = 0; i < num_verifiers; i++) {
+        if(i < num_signers) {
+            verifiers[i].cose_algorithm_id = algorithm_ids[i];
+            verifiers[i].kid               = tasks[i].prepared.kid;
+            verifiers[i].result            = T_COSE_SUCCESS;
+        } else {
+            verifiers[i].cose_algorithm_id = T_COSE_UNSET_ALGORITHM_ID;
+            verifiers[i].kid               = NULL_Q_USEFUL_BUF_C;
+            verifiers[i].result            = T_COSE_ERR_SIGNER_COUNT;
+        }
+    }
+
+    if(option_flags & T_COSE_OPT_DECODE_ONLY) {
+        if(num_signers > num_verifiers) {
+            return_value = T_COSE_ERR_SIGNER_COUNT;
+        }
+        goto Done;
+    }
+    if(num_signers != num_verifiers) {
+        return_value = T_COSE_ERR_SIGNER_COUNT;
+        goto Done;
+    }
+
+    for(i = 0; i < num_signers; i++) {
+        if(verifiers[i].verify_ctx == NULL) {
+            return_value = T_COSE_ERR_INVALID_ARGUMENT;
+            goto Done;
+        }
+        tasks[i].verify_ctx = verifiers[i].verify_ctx;
+    }
+
+    /* -- Hash the Sig_structure of each, reading the payload once -- */
+    return_value = hash_signers(body_protected,
+                                protected_parameters,
+                                algorithm_ids,
+                                num_signers,
+                                *payload,
+                                hash_ctxs);
+    if(return_value) {
+        goto Done;
+    }
+    for(i = 0; i < num_signers; i++) {
+        return_value = t_cose_crypto_hash_finish(&hash_ctxs[i],
+                                                 (struct q_useful_buf){tasks[i].prepared.tbs_hash_bytes,
+                                                         sizeof(tasks[i].prepared.tbs_hash_bytes)},
+                                                 &tbs_hash);
+        if(return_value) {
+            abandon_hashes(&hash_ctxs[i + 1], num_signers - i - 1);
+            goto Done;
+        }
+        tasks[i].prepared.tbs_hash_len = tbs_hash.len;
+    }
+
+    /* -- The public key operations, which are independent -- */
+    if(parallel_cb == NULL) {
+        parallel_cb = t_cose_parallel_run_serial;
+    }
+    (*parallel_cb)(cb_context, verify_task_run, tasks, sizeof(tasks[0]), num_signers);
+
+    return_value = T_COSE_SUCCESS;
+    for(i = 0; i < num_signers; i++) {
+        verifiers[i].result = tasks[i].result;
+        if(return_value == T_COSE_SUCCESS) {
+            return_value = tasks[i].result;
+        }
+    }
+
+Done:
+    return return_value;
+}
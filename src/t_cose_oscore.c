@@ -0,0 +1,844 @@
+/*
+ *  t_cose_oscore.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "qcbor/qcbor.h"
+#include "t_cose/t_cose_oscore.h"
+#include "t_cose/q_useful_buf.h"
+#include "t_cose_crypto.h"
+#include "t_cose_util.h"
+#include "t_cose_standard_constants.h"
+#include <string.h>
+
+
+/**
+ * \file t_cose_oscore.c
+ *
+ * \brief Implementation of OSCORE message protection.
+ *
+ * The CBOR here is small and fixed in shape so it is put together
+ * from heads with QCBOREncode_EncodeHead() rather than with a full
+ * encoder context.
+ */
+
+
+#ifdef T_COSE_ENABLE_OSCORE
+
+/** Size of the buffer for the HKDF info of the key derivation */
+#define OSCORE_INFO_SIZE (16 + T_COSE_OSCORE_MAX_ID_SIZE + \
+                          T_COSE_OSCORE_MAX_ID_CONTEXT_SIZE)
+
+/** Size of the buffer for the external_aad */
+#define OSCORE_EXTERNAL_AAD_SIZE (16 + T_COSE_OSCORE_MAX_ID_SIZE + \
+                                  T_COSE_OSCORE_MAX_PIV_SIZE)
+
+/** Size of the buffer for the Enc_structure used as the AAD */
+#define OSCORE_AAD_SIZE (16 + OSCORE_EXTERNAL_AAD_SIZE)
+
+/* Bits of the flag byte of the OSCORE option, RFC 8613 section 6.1 */
+#define OSCORE_FLAG_PIV_LEN_MASK    0x07
+#define OSCORE_FLAG_KID             0x08
+#define OSCORE_FLAG_KID_CONTEXT     0x10
+#define OSCORE_FLAG_RESERVED_MASK   0xe0
+
+/** Number of sequence numbers the replay window covers */
+#define OSCORE_REPLAY_WINDOW_SIZE (T_COSE_OSCORE_REPLAY_WINDOW_WORDS * 64)
+
+
+/**
+ * \brief Append a CBOR byte or text string to the output.
+ *
+ * \param[in] out_buffer  The output buffer.
+ * \param[in,out] offset  Where to append. Advanced past the string.
+ * \param[in] major_type  \c CBOR_MAJOR_TYPE_BYTE_STRING or
+ *                        \c CBOR_MAJOR_TYPE_TEXT_STRING.
+ * \param[in] string      The string.
+ */
+static enum t_cose_err_t
+append_string(struct q_useful_buf    out_buffer,
+              size_t                *offset,
+              uint8_t                major_type,
+              struct q_useful_buf_c  string)
+{
+    enum t_cose_err_t return_value;
+
+    return_value = append_head(out_buffer, offset, major_type, string.len);
+    if(return_value == T_COSE_SUCCESS) {
+        return_value = append_bytes(out_buffer, offset, string);
+    }
+    return return_value;
+}
+
+
+/**
+ * \brief Append a CBOR integer to the output.
+ *
+ * \param[in] out_buffer  The output buffer.
+ * \param[in,out] offset  Where to append. Advanced past the integer.
+ * \param[in] value       The integer.
+ */
+static enum t_cose_err_t
+append_int(struct q_useful_buf out_buffer, size_t *offset, int64_t value)
+{
+    if(value < 0) {
+        return append_head(out_buffer,
+                           offset,
+                           CBOR_MAJOR_TYPE_NEGATIVE_INT,
+                           (uint64_t)(-1 - value));
+    }
+    return append_head(out_buffer,
+                       offset,
+                       CBOR_MAJOR_TYPE_POSITIVE_INT,
+                       (uint64_t)value);
+}
+
+
+/**
+ * \brief Derive one key or IV of a security context.
+ *
+ * \param[in] me             The context with the ID context and
+ *                           algorithm set.
+ * \param[in] master_secret  The master secret.
+ * \param[in] master_salt    The master salt or \c NULL_Q_USEFUL_BUF_C.
+ * \param[in] id             The sender or recipient ID, or empty for
+ *                           the common IV.
+ * \param[in] type           "Key" or "IV".
+ * \param[in] okm_buffer     Filled with the key or IV.
+ *
+ * This is HKDF-SHA-256 with the info structure of RFC 8613 section
+ * 3.2.1, [id, id_context, alg_aead, type, L].
+ */
+static enum t_cose_err_t
+derive(const struct t_cose_oscore_ctx *me,
+       struct q_useful_buf_c           master_secret,
+       struct q_useful_buf_c           master_salt,
+       struct q_useful_buf_c           id,
+       const char                     *type,
+       struct q_useful_buf             okm_buffer)
+{
+    enum t_cose_err_t return_value;
+    size_t            offset;
+    Q_USEFUL_BUF_MAKE_STACK_UB(info_buffer, OSCORE_INFO_SIZE);
+
+    offset = 0;
+    return_value = append_head(info_buffer, &offset, CBOR_MAJOR_TYPE_ARRAY, 5);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = append_string(info_buffer,
+                                 &offset,
+                                 CBOR_MAJOR_TYPE_BYTE_STRING,
+                                 id);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    if(me->has_id_context) {
+        return_value = append_string(info_buffer,
+                                     &offset,
+                                     CBOR_MAJOR_TYPE_BYTE_STRING,
+                                     (struct q_useful_buf_c){me->id_context,
+                                                             me->id_context_len});
+    } else {
+        return_value = append_head(info_buffer,
+                                   &offset,
+                                   CBOR_MAJOR_TYPE_SIMPLE,
+                                   CBOR_SIMPLEV_NULL);
+    }
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = append_int(info_buffer, &offset, me->aead_alg_id);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = append_string(info_buffer,
+                                 &offset,
+                                 CBOR_MAJOR_TYPE_TEXT_STRING,
+                                 (struct q_useful_buf_c){type, strlen(type)});
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = append_head(info_buffer,
+                               &offset,
+                               CBOR_MAJOR_TYPE_POSITIVE_INT,
+                               okm_buffer.len);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+
+    return_value = t_cose_crypto_hkdf(COSE_ALGORITHM_SHA_256,
+                                      master_salt,
+                                      master_secret,
+                                      (struct q_useful_buf_c){info_buffer.ptr,
+                                                              offset},
+                                      okm_buffer);
+
+Done:
+    return return_value;
+}
+
+
+/**
+ * \brief Precompute the part of the nonce that comes from an ID.
+ *
+ * \param[in] common_iv    The common IV.
+ * \param[in] id           The sender or recipient ID.
+ * \param[in] id_len       Length of \c id.
+ * \param[out] nonce_base  The common IV XORed with the ID length and
+ *                         the left-padded ID.
+ *
+ * This is the nonce of RFC 8613 section 5.2 with a partial IV of
+ * zero. The nonce of a message is this with the partial IV XORed
+ * into the last bytes.
+ */
+static void
+make_nonce_base(const uint8_t *common_iv,
+                const uint8_t *id,
+                size_t         id_len,
+                uint8_t       *nonce_base)
+{
+    const size_t padded_id_len = T_COSE_OSCORE_NONCE_SIZE - 6;
+    size_t       i;
+
+    memcpy(nonce_base, common_iv, T_COSE_OSCORE_NONCE_SIZE);
+    nonce_base[0] ^= (uint8_t)id_len;
+    for(i = 0; i < id_len; i++) {
+        nonce_base[1 + padded_id_len - id_len + i] ^= id[i];
+    }
+}
+
+
+/**
+ * \brief Make the nonce of a message.
+ *
+ * \param[in] nonce_base  From make_nonce_base() for the ID of the
+ *                        party that made the partial IV.
+ * \param[in] piv         The partial IV.
+ * \param[in] piv_len     Length of \c piv, at most 5.
+ * \param[out] nonce      The nonce.
+ */
+static inline void
+make_nonce(const uint8_t *nonce_base,
+           const uint8_t *piv,
+           size_t         piv_len,
+           uint8_t       *nonce)
+{
+    size_t i;
+
+    memcpy(nonce, nonce_base, T_COSE_OSCORE_NONCE_SIZE);
+    for(i = 0; i < piv_len; i++) {
+        nonce[T_COSE_OSCORE_NONCE_SIZE - piv_len + i] ^= piv[i];
+    }
+}
+
+
+/**
+ * \brief Make the AAD of a message.
+ *
+ * \param[in] me           The security context.
+ * \param[in] request      The request the message is or belongs to.
+ * \param[in] aad_buffer   Buffer of size \ref OSCORE_AAD_SIZE.
+ * \param[out] aad         The AAD.
+ *
+ * The AAD is the Enc_structure ["Encrypt0", h'', external_aad] where
+ * external_aad is [1, [alg_aead], request_kid, request_piv, h''] of
+ * RFC 8613 section 5.4.
+ */
+static enum t_cose_err_t
+make_aad(const struct t_cose_oscore_ctx     *me,
+         const struct t_cose_oscore_request *request,
+         struct q_useful_buf                 aad_buffer,
+         struct q_useful_buf_c              *aad)
+{
+    enum t_cose_err_t return_value;
+    size_t            external_len;
+    size_t            offset;
+    Q_USEFUL_BUF_MAKE_STACK_UB(external_buffer, OSCORE_EXTERNAL_AAD_SIZE);
+
+    external_len = 0;
+    return_value = append_head(external_buffer,
+                               &external_len,
+                               CBOR_MAJOR_TYPE_ARRAY,
+                               5);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    /* oscore_version */
+    return_value = append_int(external_buffer, &external_len, 1);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    /* algorithms, only the AEAD */
+    return_value = append_head(external_buffer,
+                               &external_len,
+                               CBOR_MAJOR_TYPE_ARRAY,
+                               1);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = append_int(external_buffer, &external_len, me->aead_alg_id);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = append_string(external_buffer,
+                                 &external_len,
+                                 CBOR_MAJOR_TYPE_BYTE_STRING,
+                                 (struct q_useful_buf_c){request->kid,
+                                                         request->kid_len});
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = append_string(external_buffer,
+                                 &external_len,
+                                 CBOR_MAJOR_TYPE_BYTE_STRING,
+                                 (struct q_useful_buf_c){request->piv,
+                                                         request->piv_len});
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    /* Class I options, always empty here */
+    return_value = append_head(external_buffer,
+                               &external_len,
+                               CBOR_MAJOR_TYPE_BYTE_STRING,
+                               0);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+
+    offset = 0;
+    return_value = append_head(aad_buffer, &offset, CBOR_MAJOR_TYPE_ARRAY, 3);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = append_string(aad_buffer,
+                                 &offset,
+                                 CBOR_MAJOR_TYPE_TEXT_STRING,
+                                 Q_USEFUL_BUF_FROM_SZ_LITERAL(COSE_ENC_CONTEXT_STRING_ENCRYPT0));
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    /* There are no protected parameters */
+    return_value = append_head(aad_buffer,
+                               &offset,
+                               CBOR_MAJOR_TYPE_BYTE_STRING,
+                               0);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = append_string(aad_buffer,
+                                 &offset,
+                                 CBOR_MAJOR_TYPE_BYTE_STRING,
+                                 (struct q_useful_buf_c){external_buffer.ptr,
+                                                         external_len});
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+
+    *aad = (struct q_useful_buf_c){aad_buffer.ptr, offset};
+
+Done:
+    return return_value;
+}
+
+
+/**
+ * \brief Whether a sequence number may be received.
+ *
+ * \param[in] me        The security context.
+ * \param[in] sequence  The sequence number from the partial IV.
+ *
+ * \return \c true if it is newer than the window or in the window
+ *         and not yet received.
+ */
+static inline bool
+replay_check(const struct t_cose_oscore_ctx *me, uint64_t sequence)
+{
+    uint64_t age;
+
+    if(!me->replay_started || sequence > me->replay_highest) {
+        return true;
+    }
+    age = me->replay_highest - sequence;
+    if(age >= OSCORE_REPLAY_WINDOW_SIZE) {
+        return false;
+    }
+    return (me->replay_window[age / 64] & (UINT64_C(1) << (age % 64))) == 0;
+}
+
+
+/**
+ * \brief Mark a sequence number as received.
+ *
+ * \param[in] me        The security context.
+ * \param[in] sequence  The sequence number. replay_check() has
+ *                      returned \c true for it.
+ *
+ * When it is newer than any before, the window is shifted so bit 0
+ * is for it.
+ */
+static void
+replay_update(struct t_cose_oscore_ctx *me, uint64_t sequence)
+{
+    uint64_t shift;
+    size_t   word_shift;
+    unsigned bit_shift;
+    size_t   i;
+    uint64_t age;
+
+    if(!me->replay_started) {
+        memset(me->replay_window, 0, sizeof(me->replay_window));
+        me->replay_started = true;
+        me->replay_highest = sequence;
+
+    } else if(sequence > me->replay_highest) {
+        shift = sequence - me->replay_highest;
+        me->replay_highest = sequence;
+        if(shift >= OSCORE_REPLAY_WINDOW_SIZE) {
+            memset(me->replay_window, 0, sizeof(me->replay_window));
+        } else {
+            word_shift = (size_t)(shift / 64);
+            bit_shift  = (unsigned)(shift % 64);
+            /* Move bit n to bit n + shift, highest word first */
+            for(i = T_COSE_OSCORE_REPLAY_WINDOW_WORDS; i-- > 0; ) {
+                uint64_t word = 0;
+                if(i >= word_shift) {
+                    word = me->replay_window[i - word_shift] << bit_shift;
+                    if(bit_shift != 0 && i > word_shift) {
+                        word |= me->replay_window[i - word_shift - 1] >>
+                                    (64 - bit_shift);
+                    }
+                }
+                me->replay_window[i] = word;
+            }
+        }
+    }
+
+    age = me->replay_highest - sequence;
+    me->replay_window[age / 64] |= UINT64_C(1) << (age % 64);
+}
+
+
+/**
+ * \brief Encrypt with the key and nonce of a message.
+ */
+static enum t_cose_err_t
+seal(const struct t_cose_oscore_ctx     *me,
+     const uint8_t                      *key,
+     const uint8_t                      *nonce,
+     const struct t_cose_oscore_request *request,
+     struct q_useful_buf_c               plaintext,
+     struct q_useful_buf                 ciphertext_buffer,
+     struct q_useful_buf_c              *ciphertext)
+{
+    enum t_cose_err_t     return_value;
+    struct q_useful_buf_c aad;
+    Q_USEFUL_BUF_MAKE_STACK_UB(aad_buffer, OSCORE_AAD_SIZE);
+
+    return_value = make_aad(me, request, aad_buffer, &aad);
+    if(return_value != T_COSE_SUCCESS) {
+        return return_value;
+    }
+    return t_cose_crypto_aead_encrypt(me->aead_alg_id,
+                                      (struct q_useful_buf_c){key, T_COSE_OSCORE_KEY_SIZE},
+                                      (struct q_useful_buf_c){nonce, T_COSE_OSCORE_NONCE_SIZE},
+                                      aad,
+                                      plaintext,
+                                      ciphertext_buffer,
+                                      ciphertext);
+}
+
+
+/**
+ * \brief Decrypt with the key and nonce of a message.
+ */
+static enum t_cose_err_t
+open_sealed(const struct t_cose_oscore_ctx     *me,
+            const uint8_t                      *key,
+            const uint8_t                      *nonce,
+            const struct t_cose_oscore_request *request,
+            struct q_useful_buf_c               ciphertext,
+            struct q_useful_buf                 plaintext_buffer,
+            struct q_useful_buf_c              *plaintext)
+{
+    enum t_cose_err_t     return_value;
+    struct q_useful_buf_c aad;
+    Q_USEFUL_BUF_MAKE_STACK_UB(aad_buffer, OSCORE_AAD_SIZE);
+
+    return_value = make_aad(me, request, aad_buffer, &aad);
+    if(return_value != T_COSE_SUCCESS) {
+        return return_value;
+    }
+    return t_cose_crypto_aead_decrypt(me->aead_alg_id,
+                                      (struct q_useful_buf_c){key, T_COSE_OSCORE_KEY_SIZE},
+                                      (struct q_useful_buf_c){nonce, T_COSE_OSCORE_NONCE_SIZE},
+                                      aad,
+                                      ciphertext,
+                                      plaintext_buffer,
+                                      plaintext);
+}
+
+
+/*
+ * Public function. See t_cose_oscore.h
+ */
+enum t_cose_err_t
+t_cose_oscore_init(struct t_cose_oscore_ctx *me,
+                   int32_t                   aead_alg_id,
+                   struct q_useful_buf_c     master_secret,
+                   struct q_useful_buf_c     master_salt,
+                   struct q_useful_buf_c     sender_id,
+                   struct q_useful_buf_c     recipient_id,
+                   struct q_useful_buf_c     id_context)
+{
+    enum t_cose_err_t return_value;
+    uint8_t           common_iv[T_COSE_OSCORE_NONCE_SIZE];
+
+    memset(me, 0, sizeof(*me));
+
+    if(aead_alg_id != COSE_ALGORITHM_AES_CCM_16_64_128) {
+        return_value = T_COSE_ERR_UNSUPPORTED_ENCRYPTION_ALG;
+        goto Done;
+    }
+    if(sender_id.len > T_COSE_OSCORE_MAX_ID_SIZE ||
+       recipient_id.len > T_COSE_OSCORE_MAX_ID_SIZE ||
+       id_context.len > T_COSE_OSCORE_MAX_ID_CONTEXT_SIZE) {
+        return_value = T_COSE_ERR_OSCORE_FORMAT;
+        goto Done;
+    }
+
+    me->aead_alg_id = aead_alg_id;
+    /* An empty ID is a valid ID so a NULL pointer with length 0 is
+     * fine, but memcpy() must not be given it. */
+    if(sender_id.len) {
+        memcpy(me->sender_id, sender_id.ptr, sender_id.len);
+    }
+    me->sender_id_len = (uint8_t)sender_id.len;
+    if(recipient_id.len) {
+        memcpy(me->recipient_id, recipient_id.ptr, recipient_id.len);
+    }
+    me->recipient_id_len = (uint8_t)recipient_id.len;
+    me->has_id_context = !q_useful_buf_c_is_null(id_context);
+    if(id_context.len) {
+        memcpy(me->id_context, id_context.ptr, id_context.len);
+    }
+    me->id_context_len = (uint8_t)id_context.len;
+
+    return_value = derive(me,
+                          master_secret,
+                          master_salt,
+                          (struct q_useful_buf_c){me->sender_id, me->sender_id_len},
+                          "Key",
+                          (struct q_useful_buf){me->sender_key,
+                                                sizeof(me->sender_key)});
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = derive(me,
+                          master_secret,
+                          master_salt,
+                          (struct q_useful_buf_c){me->recipient_id,
+                                                  me->recipient_id_len},
+                          "Key",
+                          (struct q_useful_buf){me->recipient_key,
+                                                sizeof(me->recipient_key)});
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+    return_value = derive(me,
+                          master_secret,
+                          master_salt,
+                          (struct q_useful_buf_c){common_iv, 0},
+                          "IV",
+                          (struct q_useful_buf){common_iv, sizeof(common_iv)});
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+
+    make_nonce_base(common_iv,
+                    me->sender_id,
+                    me->sender_id_len,
+                    me->sender_nonce_base);
+    make_nonce_base(common_iv,
+                    me->recipient_id,
+                    me->recipient_id_len,
+                    me->recipient_nonce_base);
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_oscore.h
+ */
+enum t_cose_err_t
+t_cose_oscore_parse_option(struct q_useful_buf_c        option_value,
+                           struct t_cose_oscore_option *option)
+{
+    const uint8_t *bytes;
+    size_t         offset;
+    size_t         piv_len;
+    size_t         kid_context_len;
+    uint8_t        flags;
+
+    option->partial_iv  = NULL_Q_USEFUL_BUF_C;
+    option->kid_context = NULL_Q_USEFUL_BUF_C;
+    option->kid         = NULL_Q_USEFUL_BUF_C;
+
+    /* An empty value has all flags zero */
+    if(option_value.len == 0) {
+        return T_COSE_SUCCESS;
+    }
+
+    bytes   = option_value.ptr;
+    flags   = bytes[0];
+    offset  = 1;
+    piv_len = flags & OSCORE_FLAG_PIV_LEN_MASK;
+    if((flags & OSCORE_FLAG_RESERVED_MASK) ||
+       piv_len > T_COSE_OSCORE_MAX_PIV_SIZE) {
+        return T_COSE_ERR_OSCORE_FORMAT;
+    }
+
+    if(piv_len) {
+        if(option_value.len - offset < piv_len) {
+            return T_COSE_ERR_OSCORE_FORMAT;
+        }
+        option->partial_iv = (struct q_useful_buf_c){bytes + offset, piv_len};
+        offset += piv_len;
+    }
+
+    if(flags & OSCORE_FLAG_KID_CONTEXT) {
+        if(option_value.len - offset < 1) {
+            return T_COSE_ERR_OSCORE_FORMAT;
+        }
+        kid_context_len = bytes[offset];
+        offset++;
+        if(option_value.len - offset < kid_context_len) {
+            return T_COSE_ERR_OSCORE_FORMAT;
+        }
+        option->kid_context = (struct q_useful_buf_c){bytes + offset,
+                                                      kid_context_len};
+        offset += kid_context_len;
+    }
+
+    if(flags & OSCORE_FLAG_KID) {
+        /* The kid is the rest of the value */
+        option->kid = (struct q_useful_buf_c){bytes + offset,
+                                              option_value.len - offset};
+    } else if(offset != option_value.len) {
+        return T_COSE_ERR_OSCORE_FORMAT;
+    }
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function. See t_cose_oscore.h
+ */
+enum t_cose_err_t
+t_cose_oscore_protect_request(struct t_cose_oscore_ctx     *me,
+                              struct q_useful_buf_c         plaintext,
+                              struct q_useful_buf           option_buffer,
+                              struct q_useful_buf_c        *option_value,
+                              struct q_useful_buf           ciphertext_buffer,
+                              struct q_useful_buf_c        *ciphertext,
+                              struct t_cose_oscore_request *request)
+{
+    enum t_cose_err_t return_value;
+    uint64_t          sequence;
+    size_t            piv_len;
+    size_t            option_len;
+    uint8_t          *option_bytes;
+    size_t            i;
+
+    if(me->sender_sequence > T_COSE_OSCORE_MAX_SEQUENCE) {
+        return_value = T_COSE_ERR_SEQUENCE_EXHAUSTED;
+        goto Done;
+    }
+    sequence = me->sender_sequence;
+
+    /* The partial IV is the sequence number in the fewest bytes,
+     * at least one. */
+    piv_len = 1;
+    while(piv_len < T_COSE_OSCORE_MAX_PIV_SIZE && (sequence >> (8 * piv_len))) {
+        piv_len++;
+    }
+    request->piv_len = (uint8_t)piv_len;
+    for(i = 0; i < piv_len; i++) {
+        request->piv[i] = (uint8_t)(sequence >> (8 * (piv_len - 1 - i)));
+    }
+    memcpy(request->kid, me->sender_id, me->sender_id_len);
+    request->kid_len = me->sender_id_len;
+    make_nonce(me->sender_nonce_base, request->piv, piv_len, request->nonce);
+
+    /* Flags, partial IV, kid context and kid */
+    option_len = 1 + piv_len + me->sender_id_len;
+    if(me->has_id_context) {
+        option_len += 1 + me->id_context_len;
+    }
+    if(option_buffer.len < option_len) {
+        return_value = T_COSE_ERR_TOO_SMALL;
+        goto Done;
+    }
+    option_bytes = option_buffer.ptr;
+    option_bytes[0] = (uint8_t)(piv_len | OSCORE_FLAG_KID |
+                                (me->has_id_context ? OSCORE_FLAG_KID_CONTEXT : 0));
+    memcpy(option_bytes + 1, request->piv, piv_len);
+    option_len = 1 + piv_len;
+    if(me->has_id_context) {
+        option_bytes[option_len] = me->id_context_len;
+        memcpy(option_bytes + option_len + 1, me->id_context, me->id_context_len);
+        option_len += 1 + me->id_context_len;
+    }
+    memcpy(option_bytes + option_len, me->sender_id, me->sender_id_len);
+    option_len += me->sender_id_len;
+
+    return_value = seal(me,
+                        me->sender_key,
+                        request->nonce,
+                        request,
+                        plaintext,
+                        ciphertext_buffer,
+                        ciphertext);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+
+    /* Only used up when a message is actually made */
+    me->sender_sequence++;
+    *option_value = (struct q_useful_buf_c){option_bytes, option_len};
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_oscore.h
+ */
+enum t_cose_err_t
+t_cose_oscore_unprotect_request(struct t_cose_oscore_ctx          *me,
+                                const struct t_cose_oscore_option *option,
+                                struct q_useful_buf_c              ciphertext,
+                                struct q_useful_buf                plaintext_buffer,
+                                struct q_useful_buf_c             *plaintext,
+                                struct t_cose_oscore_request      *request)
+{
+    enum t_cose_err_t return_value;
+    uint64_t          sequence;
+    const uint8_t    *piv;
+    size_t            i;
+
+    /* The option may not be from t_cose_oscore_parse_option() so the
+     * lengths are checked again before they are copied */
+    if(q_useful_buf_c_is_null(option->partial_iv) ||
+       option->partial_iv.len > T_COSE_OSCORE_MAX_PIV_SIZE ||
+       q_useful_buf_c_is_null(option->kid) ||
+       option->kid.len > T_COSE_OSCORE_MAX_ID_SIZE ||
+       q_useful_buf_compare(option->kid,
+                            (struct q_useful_buf_c){me->recipient_id,
+                                                    me->recipient_id_len})) {
+        return_value = T_COSE_ERR_OSCORE_FORMAT;
+        goto Done;
+    }
+
+    piv = option->partial_iv.ptr;
+    sequence = 0;
+    for(i = 0; i < option->partial_iv.len; i++) {
+        sequence = (sequence << 8) | piv[i];
+    }
+    if(!replay_check(me, sequence)) {
+        return_value = T_COSE_ERR_REPLAY;
+        goto Done;
+    }
+
+    memcpy(request->kid, me->recipient_id, me->recipient_id_len);
+    request->kid_len = me->recipient_id_len;
+    memcpy(request->piv, piv, option->partial_iv.len);
+    request->piv_len = (uint8_t)option->partial_iv.len;
+    make_nonce(me->recipient_nonce_base,
+               request->piv,
+               request->piv_len,
+               request->nonce);
+
+    return_value = open_sealed(me,
+                               me->recipient_key,
+                               request->nonce,
+                               request,
+                               ciphertext,
+                               plaintext_buffer,
+                               plaintext);
+    if(return_value != T_COSE_SUCCESS) {
+        goto Done;
+    }
+
+    replay_update(me, sequence);
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_oscore.h
+ */
+enum t_cose_err_t
+t_cose_oscore_protect_response(struct t_cose_oscore_ctx           *me,
+                               const struct t_cose_oscore_request *request,
+                               struct q_useful_buf_c               plaintext,
+                               struct q_useful_buf                 ciphertext_buffer,
+                               struct q_useful_buf_c              *ciphertext)
+{
+    return seal(me,
+                me->sender_key,
+                request->nonce,
+                request,
+                plaintext,
+                ciphertext_buffer,
+                ciphertext);
+}
+
+
+/*
+ * Public function. See t_cose_oscore.h
+ */
+enum t_cose_err_t
+t_cose_oscore_unprotect_response(struct t_cose_oscore_ctx           *me,
+                                 const struct t_cose_oscore_request *request,
+                                 const struct t_cose_oscore_option  *option,
+                                 struct q_useful_buf_c               ciphertext,
+                                 struct q_useful_buf                 plaintext_buffer,
+                                 struct q_useful_buf_c              *plaintext)
+{
+    uint8_t        nonce[T_COSE_OSCORE_NONCE_SIZE];
+    const uint8_t *response_nonce;
+
+    response_nonce = request->nonce;
+    if(!q_useful_buf_c_is_null(option->partial_iv)) {
+        if(option->partial_iv.len > T_COSE_OSCORE_MAX_PIV_SIZE) {
+            return T_COSE_ERR_OSCORE_FORMAT;
+        }
+        make_nonce(me->recipient_nonce_base,
+                   option->partial_iv.ptr,
+                   option->partial_iv.len,
+                   nonce);
+        response_nonce = nonce;
+    }
+
+    return open_sealed(me,
+                       me->recipient_key,
+                       response_nonce,
+                       request,
+                       ciphertext,
+                       plaintext_buffer,
+                       plaintext);
+}
+
+#endif /* T_COSE_ENABLE_OSCORE */
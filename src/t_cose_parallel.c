@@ -0,0 +1,148 @@
+/*
+ *  t_cose_parallel.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "t_cose/t_cose_parallel.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef T_COSE_ENABLE_PTHREADS
+#include <pthread.h>
+#endif
+
+
+/**
+ * \file t_cose_parallel.c
+ *
+ * \brief Implementation of the built-in task runners.
+ */
+
+
+/*
+ * Public function. See t_cose_parallel.h
+ */
+void
+t_cose_parallel_run_serial(void           *cb_context,
+                           t_cose_task_fn  task_fn,
+                           void           *tasks,
+                           size_t          task_size,
+                           size_t          num_tasks)
+{
+    size_t i;
+
+    (void)cb_context;
+
+    for(i = 0; i < num_tasks; i++) {
+        (*task_fn)((uint8_t *)tasks + i * task_size);
+    }
+}
+
+
+#ifdef T_COSE_ENABLE_PTHREADS
+
+/** Most threads created by one call to t_cose_parallel_run_pthreads() */
+#ifndef T_COSE_PARALLEL_MAX_THREADS
+#define T_COSE_PARALLEL_MAX_THREADS 16
+#endif
+
+
+/**
+ * The tasks shared by the threads of one call. Each thread takes the
+ * next task not yet taken until there are none left, so the work is
+ * spread over the threads however many tasks there are and however
+ * long each one takes.
+ */
+struct pthread_tasks {
+    t_cose_task_fn  task_fn;
+    uint8_t        *tasks;
+    size_t          task_size;
+    size_t          num_tasks;
+    size_t          next_task;
+};
+
+
+/**
+ * \brief Run tasks until none are left.
+ *
+ * \param[in] arg  A struct pthread_tasks.
+ *
+ * This is the start routine of the created threads and is also run
+ * by the calling thread.
+ */
+static void *
+pthread_tasks_main(void *arg)
+{
+    struct pthread_tasks *shared = (struct pthread_tasks *)arg;
+    size_t                task_index;
+
+    while(1) {
+        task_index = __atomic_fetch_add(&shared->next_task, 1, __ATOMIC_RELAXED);
+        if(task_index >= shared->num_tasks) {
+            break;
+        }
+        (*shared->task_fn)(shared->tasks + task_index * shared->task_size);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Public function. See t_cose_parallel.h
+ */
+void
+t_cose_parallel_run_pthreads(void           *cb_context,
+                             t_cose_task_fn  task_fn,
+                             void           *tasks,
+                             size_t          task_size,
+                             size_t          num_tasks)
+{
+    pthread_t            threads[T_COSE_PARALLEL_MAX_THREADS];
+    bool                 created[T_COSE_PARALLEL_MAX_THREADS];
+    struct pthread_tasks shared;
+    size_t               num_threads;
+    size_t               i;
+
+    (void)cb_context;
+
+    if(num_tasks == 0) {
+        return;
+    }
+
+    shared.task_fn   = task_fn;
+    shared.tasks     = tasks;
+    shared.task_size = task_size;
+    shared.num_tasks = num_tasks;
+    shared.next_task = 0;
+
+    /* This thread runs tasks too, so one less thread is created than
+     * there are tasks. If a thread can't be created the others,
+     * including this one, take its share. */
+    num_threads = num_tasks - 1;
+    if(num_threads > T_COSE_PARALLEL_MAX_THREADS) {
+        num_threads = T_COSE_PARALLEL_MAX_THREADS;
+    }
+
+    for(i = 0; i < num_threads; i++) {
+        created[i] = pthread_create(&threads[i],
+                                    NULL,
+                                    pthread_tasks_main,
+                                    &shared) == 0;
+    }
+
+    (void)pthread_tasks_main(&shared);
+
+    for(i = 0; i < num_threads; i++) {
+        if(created[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+}
+
+#endif /* T_COSE_ENABLE_PTHREADS */
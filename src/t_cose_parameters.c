@@ -11,6 +11,7 @@
 
 #include "t_cose_parameters.h"
 #include "t_cose_standard_constants.h"
+#include "t_cose_util.h"
 
 
 /**
@@ -21,21 +22,10 @@
  */
 
 
-/**
- * \brief Consume a CBOR item, particularly a map or array.
- *
- * \param[in] decode_context   Context to read data items from.
- * \param[in] item_to_consume  The already-read item that is being consumed.
- * \param[out] next_nest_level Nesting level of the next item that will be read.
- *
- * \returns A CBOR decoding error or QCBOR_SUCCESS.
- *
- * The primary purpose of this is to consume (read) all the members of
- * a map or an array, however deeply nested it is.
- *
- * This doesn't do much work for non-nested data items.
+/*
+ * Public function. See t_cose_parameters.h
  */
-static inline QCBORError
+QCBORError
 consume_item(QCBORDecodeContext *decode_context,
              const QCBORItem    *item_to_consume,
              uint_fast8_t       *next_nest_level)
@@ -55,6 +45,7 @@ consume_item(QCBORDecodeContext *decode_context,
             if(return_value != QCBOR_SUCCESS) {
                 goto Done;
             }
+            T_COSE_COST_ADD(cbor_items, 1);
         } while(item.uNextNestLevel >= item_to_consume->uNextNestLevel);
 
         *next_nest_level = item.uNextNestLevel;
@@ -100,6 +91,7 @@ add_label_to_list(const QCBORItem          *item,
     if(item->uLabelType == QCBOR_TYPE_INT64) {
         /* Add an integer-labeled parameter to the end of the list */
         for(n = 0; label_list->int_labels[n] != LABEL_LIST_TERMINATOR; n++);
+        T_COSE_COST_ADD(label_compares, n);
         if(n == T_COSE_PARAMETER_LIST_MAX) {
             /* List is full -- error out */
             return_value = T_COSE_ERR_TOO_MANY_PARAMETERS;
@@ -110,6 +102,7 @@ add_label_to_list(const QCBORItem          *item,
     } else if(item->uLabelType == QCBOR_TYPE_TEXT_STRING) {
         /* Add a string-labeled parameter to the end of the list */
         for(n = 0; !q_useful_buf_c_is_null(label_list->tstr_labels[n]); n++);
+        T_COSE_COST_ADD(label_compares, n);
         if(n == T_COSE_PARAMETER_LIST_MAX) {
             /* List is full -- error out */
             return_value = T_COSE_ERR_TOO_MANY_PARAMETERS;
@@ -184,6 +177,7 @@ decode_critical_parameter(QCBORDecodeContext       *decode_context,
             return_value = T_COSE_ERR_CBOR_NOT_WELL_FORMED;
             goto Done;
         }
+        T_COSE_COST_ADD(cbor_items, 1);
 
         if(item.uDataType == QCBOR_TYPE_INT64) {
             if(num_int_labels >= T_COSE_PARAMETER_LIST_MAX) {
@@ -238,6 +232,7 @@ check_critical_labels(const struct t_cose_label_list *critical_labels,
         for(num_critical = 0;
             critical_labels->int_labels[num_critical];
             num_critical++) {
+            T_COSE_COST_ADD(label_compares, 1);
             if(critical_labels->int_labels[num_critical] == unknown_labels->int_labels[num_unknown]) {
                 /* Found a critical label that is unknown to us */
                 return_value = T_COSE_ERR_UNKNOWN_CRITICAL_PARAMETER;
@@ -251,6 +246,7 @@ check_critical_labels(const struct t_cose_label_list *critical_labels,
     for(num_unknown = 0; !q_useful_buf_c_is_null(unknown_labels->tstr_labels[num_unknown]); num_unknown++) {
         /* iterate over critical string labels looking for the unknown param */
         for(num_critical = 0; !q_useful_buf_c_is_null(critical_labels->tstr_labels[num_critical]); num_critical++) {
+            T_COSE_COST_ADD(label_compares, 1);
             if(!q_useful_buf_compare(critical_labels->tstr_labels[num_critical],
                                      unknown_labels->tstr_labels[num_unknown])){
                 /* Found a critical label that is unknown to us */
@@ -290,6 +286,7 @@ process_unknown_parameter(QCBORDecodeContext        *decode_context,
 {
     enum t_cose_err_t return_value;
 
+    T_COSE_COST_ADD(unknown_parameters, 1);
     return_value = add_label_to_list(unknown_parameter, unknown_labels);
     if(return_value) {
         goto Done;
@@ -309,38 +306,111 @@ Done:
 
 
 /**
- * \brief Clear a struct t_cose_parameters to empty
+ * \brief Record the value of an application-defined parameter.
  *
- * \param[in,out] parameters   Parameter list to clear.
+ * \param[in] decode_context       CBOR decode context to read from.
+ * \param[in] item                 The data item for the parameter.
+ * \param[in] is_protected         \c true if in the protected bucket.
+ * \param[out] custom_param        Where to record the value.
+ * \param[out] next_nest_level     The nest level of the next item that will be
+ *                                 fetched.
+ *
+ * \retval T_COSE_ERR_CBOR_NOT_WELL_FORMED  The CBOR is not well-formed.
+ * \retval T_COSE_ERR_DUPLICATE_PARAMETER   The parameter occurred already.
+ *
+ * Strings are returned as pointers into the input, not copied. Maps
+ * and arrays are consumed and reported as \ref
+ * T_COSE_CUSTOM_PARAM_OTHER.
  */
-static inline void clear_cose_parameters(struct t_cose_parameters *parameters)
+static enum t_cose_err_t
+process_custom_parameter(QCBORDecodeContext             *decode_context,
+                         const QCBORItem                *item,
+                         bool                            is_protected,
+                         struct t_cose_custom_parameter *custom_param,
+                         uint_fast8_t                   *next_nest_level)
 {
-#if COSE_ALGORITHM_RESERVED != 0
-#error Invalid algorithm designator not 0. Parameter list initialization fails.
-#endif
+    enum t_cose_err_t return_value;
 
-#if T_COSE_UNSET_ALGORITHM_ID != COSE_ALGORITHM_RESERVED
-#error Constant for unset algorithm ID not aligned with COSE_ALGORITHM_RESERVED
-#endif
+    if(custom_param->type != T_COSE_CUSTOM_PARAM_ABSENT) {
+        return_value = T_COSE_ERR_DUPLICATE_PARAMETER;
+        goto Done;
+    }
+    custom_param->in_protected = is_protected;
+
+    switch(item->uDataType) {
+    case QCBOR_TYPE_INT64:
+        custom_param->type        = T_COSE_CUSTOM_PARAM_INT64;
+        custom_param->value.int64 = item->val.int64;
+        break;
+
+    case QCBOR_TYPE_BYTE_STRING:
+        custom_param->type         = T_COSE_CUSTOM_PARAM_BYTE_STRING;
+        custom_param->value.string = item->val.string;
+        break;
+
+    case QCBOR_TYPE_TEXT_STRING:
+        custom_param->type         = T_COSE_CUSTOM_PARAM_TEXT_STRING;
+        custom_param->value.string = item->val.string;
+        break;
+
+    case QCBOR_TYPE_TRUE:
+    case QCBOR_TYPE_FALSE:
+        custom_param->type          = T_COSE_CUSTOM_PARAM_BOOL;
+        custom_param->value.boolean = item->uDataType == QCBOR_TYPE_TRUE;
+        break;
+
+    default:
+        custom_param->type = T_COSE_CUSTOM_PARAM_OTHER;
+        break;
+    }
 
-    /* This clears all the useful_bufs to NULL_Q_USEFUL_BUF_C
-     * and the cose_algorithm_id to COSE_ALGORITHM_RESERVED
-     */
-    memset(parameters, 0, sizeof(struct t_cose_parameters));
+    /* Maps and arrays have to be fully consumed */
+    if(consume_item(decode_context, item, next_nest_level)) {
+        return_value = T_COSE_ERR_CBOR_NOT_WELL_FORMED;
+        goto Done;
+    }
 
-#ifndef T_COSE_DISABLE_CONTENT_TYPE
-    /* The only non-zero clear-state value. (0 is plain text in CoAP
-     * content format) */
-    parameters->content_type_uint =  T_COSE_EMPTY_UINT_CONTENT_TYPE;
-#endif
+    return_value = T_COSE_SUCCESS;
+
+Done:
+    return return_value;
 }
 
 
+/**
+ * \brief Find an application-defined parameter by label.
+ *
+ * \return The entry or \c NULL if \c label is not one of them.
+ */
+static inline struct t_cose_custom_parameter *
+find_custom_parameter(struct t_cose_custom_parameter *custom_params,
+                      size_t                          num_custom_params,
+                      int64_t                         label)
+{
+    size_t n;
+
+    for(n = 0; n < num_custom_params; n++) {
+        T_COSE_COST_ADD(label_compares, 1);
+        if(custom_params[n].label == label) {
+            return &custom_params[n];
+        }
+    }
+    return NULL;
+}
+
+
+
+
 /**
  * \brief Parse some COSE header parameters.
  *
  * \param[in] decode_context        The QCBOR decode context to read from.
  * \param[out] returned_parameters  The parsed parameters being returned.
+ * \param[out] critical_labels      The crit labels or \c NULL if this is
+ *                                  the unprotected bucket.
+ * \param[in,out] unknown_labels    List to add unknown labels to.
+ * \param[in,out] custom_params     Application parameters to fill in.
+ * \param[in] num_custom_params     Number of \c custom_params.
  *
  * \retval T_COSE_SUCCESS                     The parameters were decoded
  *                                            correctly.
@@ -367,10 +437,12 @@ static inline void clear_cose_parameters(struct t_cose_parameters *parameters)
  * data item that contains the parameters.
  */
 static enum t_cose_err_t
-parse_cose_header_parameters(QCBORDecodeContext        *decode_context,
-                             struct t_cose_parameters  *returned_parameters,
-                             struct t_cose_label_list  *critical_labels,
-                             struct t_cose_label_list  *unknown_labels)
+parse_cose_header_parameters(QCBORDecodeContext             *decode_context,
+                             struct t_cose_parameters       *returned_parameters,
+                             struct t_cose_label_list       *critical_labels,
+                             struct t_cose_label_list       *unknown_labels,
+                             struct t_cose_custom_parameter *custom_params,
+                             size_t                          num_custom_params)
 {
     /* Local stack use 64-bit: 56 + 24 + 488 = 568
      * Local stack use 32-bit: 52 + 12 + 352 = 414
@@ -382,6 +454,7 @@ parse_cose_header_parameters(QCBORDecodeContext        *decode_context,
     uint_fast8_t       map_nest_level;
     uint_fast8_t       next_nest_level;
     QCBORError         qcbor_result;
+    struct t_cose_custom_parameter *custom_param;
 
     clear_cose_parameters(returned_parameters);
 
@@ -423,6 +496,7 @@ parse_cose_header_parameters(QCBORDecodeContext        *decode_context,
             return_value = T_COSE_ERR_CBOR_NOT_WELL_FORMED;
             goto Done;
         }
+        T_COSE_COST_ADD(cbor_items, 1);
 
         if(item.uLabelType != QCBOR_TYPE_INT64) {
             /* Non integer label. We don't handle those. */
@@ -543,7 +617,87 @@ parse_cose_header_parameters(QCBORDecodeContext        *decode_context,
                 break;
 #endif
 
+#ifndef T_COSE_DISABLE_HASH_ENVELOPE
+            case COSE_HEADER_PARAM_PAYLOAD_HASH_ALG:
+                if(critical_labels == NULL) {
+                    return_value = T_COSE_ERR_PARAMETER_NOT_PROTECTED;
+                    goto Done;
+                }
+                if(item.uDataType != QCBOR_TYPE_INT64 ||
+                   item.val.int64 == COSE_ALGORITHM_RESERVED ||
+                   item.val.int64 > INT32_MAX ||
+                   item.val.int64 < INT32_MIN) {
+                    return_value = T_COSE_ERR_NON_INTEGER_ALG_ID;
+                    goto Done;
+                }
+                if(returned_parameters->payload_hash_alg_id != COSE_ALGORITHM_RESERVED) {
+                    return_value = T_COSE_ERR_DUPLICATE_PARAMETER;
+                    goto Done;
+                }
+                returned_parameters->payload_hash_alg_id = (int32_t)item.val.int64;
+                break;
+
+            case COSE_HEADER_PARAM_PAYLOAD_PREIMAGE_CONTENT_TYPE:
+                if(critical_labels == NULL) {
+                    return_value = T_COSE_ERR_PARAMETER_NOT_PROTECTED;
+                    goto Done;
+                }
+                if(item.uDataType == QCBOR_TYPE_TEXT_STRING) {
+                    if(!q_useful_buf_c_is_null_or_empty(returned_parameters->preimage_content_type_tstr)) {
+                        return_value = T_COSE_ERR_DUPLICATE_PARAMETER;
+                        goto Done;
+                    }
+                    returned_parameters->preimage_content_type_tstr = item.val.string;
+                } else if(item.uDataType == QCBOR_TYPE_INT64) {
+                    if(item.val.int64 < 0 || item.val.int64 > UINT16_MAX) {
+                        return_value = T_COSE_ERR_BAD_CONTENT_TYPE;
+                        goto Done;
+                    }
+                    if(returned_parameters->preimage_content_type_uint != T_COSE_EMPTY_UINT_CONTENT_TYPE) {
+                        return_value = T_COSE_ERR_DUPLICATE_PARAMETER;
+                        goto Done;
+                    }
+                    returned_parameters->preimage_content_type_uint = (uint32_t)item.val.int64;
+                } else {
+                    return_value = T_COSE_ERR_BAD_CONTENT_TYPE;
+                    goto Done;
+                }
+                break;
+
+            case COSE_HEADER_PARAM_PAYLOAD_LOCATION:
+                if(critical_labels == NULL) {
+                    return_value = T_COSE_ERR_PARAMETER_NOT_PROTECTED;
+                    goto Done;
+                }
+                if(item.uDataType != QCBOR_TYPE_TEXT_STRING) {
+                    return_value = T_COSE_ERR_PARAMETER_CBOR;
+                    goto Done;
+                }
+                if(!q_useful_buf_c_is_null_or_empty(returned_parameters->payload_location)) {
+                    return_value = T_COSE_ERR_DUPLICATE_PARAMETER;
+                    goto Done;
+                }
+                returned_parameters->payload_location = item.val.string;
+                break;
+#endif /* T_COSE_DISABLE_HASH_ENVELOPE */
+
             default:
+                custom_param = find_custom_parameter(custom_params,
+                                                     num_custom_params,
+                                                     item.label.int64);
+                if(custom_param != NULL) {
+                    /* Known to the application, so not unknown */
+                    return_value = process_custom_parameter(decode_context,
+                                                            &item,
+                                                            critical_labels != NULL,
+                                                            custom_param,
+                                                            &next_nest_level);
+                    if(return_value) {
+                        goto Done;
+                    }
+                    break;
+                }
+
                 /* The parameter is not recognized. Its label has to
                  * be added to the the list of unknown labels so it
                  * can be checked against the list of critical labels.
@@ -570,10 +724,12 @@ Done:
  * Public function. See t_cose_parameters.h
  */
 enum t_cose_err_t
-parse_protected_header_parameters(const struct q_useful_buf_c encoded_protected_parameters,
-                                  struct t_cose_parameters   *returned_params,
-                                  struct t_cose_label_list   *critical_labels,
-                                  struct t_cose_label_list   *unknown)
+parse_protected_header_parameters(const struct q_useful_buf_c     encoded_protected_parameters,
+                                  struct t_cose_parameters       *returned_params,
+                                  struct t_cose_label_list       *critical_labels,
+                                  struct t_cose_label_list       *unknown,
+                                  struct t_cose_custom_parameter *custom_params,
+                                  size_t                          num_custom_params)
 {
     /* Local stack use 64-bit: 144 + 8 = 152
      * Local stack use 32-bit: 108 + 4 = 112
@@ -588,7 +744,9 @@ parse_protected_header_parameters(const struct q_useful_buf_c encoded_protected_
     return_value = parse_cose_header_parameters(&decode_context,
                                                  returned_params,
                                                  critical_labels,
-                                                 unknown);
+                                                 unknown,
+                                                 custom_params,
+                                                 num_custom_params);
     if(return_value != T_COSE_SUCCESS) {
         goto Done;
     }
@@ -607,14 +765,18 @@ Done:
  * Static inline implementation. See documentation above.
  */
 enum t_cose_err_t
-parse_unprotected_header_parameters(QCBORDecodeContext *decode_context,
-                                    struct t_cose_parameters *returned_params,
-                                    struct t_cose_label_list *unknown_labels)
+parse_unprotected_header_parameters(QCBORDecodeContext             *decode_context,
+                                    struct t_cose_parameters       *returned_params,
+                                    struct t_cose_label_list       *unknown_labels,
+                                    struct t_cose_custom_parameter *custom_params,
+                                    size_t                          num_custom_params)
 {
     return parse_cose_header_parameters(decode_context,
                                         returned_params,
                                         NULL,
-                                        unknown_labels);
+                                        unknown_labels,
+                                        custom_params,
+                                        num_custom_params);
 }
 
 
@@ -699,6 +861,33 @@ check_and_copy_parameters(const struct t_cose_parameters  *protected,
     }
 #endif
 
+#ifndef T_COSE_DISABLE_HASH_ENVELOPE
+    /* These are only accepted in the protected bucket so there is
+     * nothing in the unprotected bucket to be a duplicate of. */
+    if(protected->payload_hash_alg_id != COSE_ALGORITHM_RESERVED) {
+#ifndef T_COSE_DISABLE_CONTENT_TYPE
+        /* The content type describes the payload which is a hash,
+         * so a hash envelope must not have one. */
+        if(!q_useful_buf_c_is_null_or_empty(protected->content_type_tstr) ||
+           !q_useful_buf_c_is_null_or_empty(unprotected->content_type_tstr) ||
+           protected->content_type_uint != T_COSE_EMPTY_UINT_CONTENT_TYPE ||
+           unprotected->content_type_uint != T_COSE_EMPTY_UINT_CONTENT_TYPE) {
+            return_value = T_COSE_ERR_BAD_CONTENT_TYPE;
+            goto Done;
+        }
+#endif
+        if(returned_params) {
+            returned_params->payload_hash_alg_id = protected->payload_hash_alg_id;
+        }
+    }
+
+    if(returned_params) {
+        returned_params->preimage_content_type_tstr = protected->preimage_content_type_tstr;
+        returned_params->preimage_content_type_uint = protected->preimage_content_type_uint;
+        returned_params->payload_location           = protected->payload_location;
+    }
+#endif /* T_COSE_DISABLE_HASH_ENVELOPE */
+
     return_value = T_COSE_SUCCESS;
 
 Done:
@@ -16,6 +16,8 @@
 #include "t_cose/t_cose_sign1_verify.h"
 #include "t_cose/q_useful_buf.h"
 #include "t_cose/t_cose_common.h"
+#include "t_cose/t_cose_protected_intern.h"
+#include "t_cose_standard_constants.h"
 #include "qcbor/qcbor.h"
 
 
@@ -57,6 +59,26 @@ struct t_cose_label_list {
 #define LABEL_LIST_TERMINATOR 0
 
 
+/**
+ * \brief Consume a CBOR item, particularly a map or array.
+ *
+ * \param[in] decode_context   Context to read data items from.
+ * \param[in] item_to_consume  The already-read item that is being consumed.
+ * \param[out] next_nest_level Nesting level of the next item that will be read.
+ *
+ * \returns A CBOR decoding error or QCBOR_SUCCESS.
+ *
+ * The primary purpose of this is to consume (read) all the members of
+ * a map or an array, however deeply nested it is.
+ *
+ * This doesn't do much work for non-nested data items.
+ */
+QCBORError
+consume_item(QCBORDecodeContext *decode_context,
+             const QCBORItem    *item_to_consume,
+             uint_fast8_t       *next_nest_level);
+
+
 /**
  * \brief Clear a label list to empty.
  *
@@ -104,6 +126,10 @@ check_critical_labels(const struct t_cose_label_list *critical_labels,
  *
  * \param[in] decode_context        Decode context to read the parameters from.
  * \param[out] returned_parameters  The parsed parameters.
+ * \param[in,out] unknown           List to which unknown labels are added.
+ * \param[in,out] custom_params     Application parameters to fill in. May
+ *                                  be \c NULL.
+ * \param[in] num_custom_params     Number of entries in \c custom_params.
  *
  * \returns The same as parse_cose_header_parameters().
  *
@@ -115,9 +141,11 @@ check_critical_labels(const struct t_cose_label_list *critical_labels,
  * data item that contains the parameters.
  */
 enum t_cose_err_t
-parse_unprotected_header_parameters(QCBORDecodeContext       *decode_context,
-                                    struct t_cose_parameters *returned_parameters,
-                                    struct t_cose_label_list *unknown);
+parse_unprotected_header_parameters(QCBORDecodeContext             *decode_context,
+                                    struct t_cose_parameters       *returned_parameters,
+                                    struct t_cose_label_list       *unknown,
+                                    struct t_cose_custom_parameter *custom_params,
+                                    size_t                          num_custom_params);
 
 
 /**
@@ -126,6 +154,11 @@ parse_unprotected_header_parameters(QCBORDecodeContext       *decode_context,
  * \param[in] protected_parameters  Pointer and length of CBOR-encoded
  *                                  protected parameters to parse.
  * \param[out] returned_parameters  The parsed parameters that are returned.
+ * \param[out] critical             The labels listed in the crit parameter.
+ * \param[in,out] unknown           List to which unknown labels are added.
+ * \param[in,out] custom_params     Application parameters to fill in. May
+ *                                  be \c NULL.
+ * \param[in] num_custom_params     Number of entries in \c custom_params.
  *
  * \retval T_COSE_SUCCESS                  Protected parameters were parsed.
  * \retval T_COSE_ERR_CBOR_NOT_WELL_FORMED The CBOR formatting of the protected
@@ -140,10 +173,45 @@ parse_unprotected_header_parameters(QCBORDecodeContext       *decode_context,
  * INT32_MIN.
  */
 enum t_cose_err_t
-parse_protected_header_parameters(const struct q_useful_buf_c protected_parameters,
-                                  struct t_cose_parameters   *returned_parameters,
-                                  struct t_cose_label_list   *critical,
-                                  struct t_cose_label_list   *unknown);
+parse_protected_header_parameters(const struct q_useful_buf_c     protected_parameters,
+                                  struct t_cose_parameters       *returned_parameters,
+                                  struct t_cose_label_list       *critical,
+                                  struct t_cose_label_list       *unknown,
+                                  struct t_cose_custom_parameter *custom_params,
+                                  size_t                          num_custom_params);
+
+
+/**
+ * \brief Clear a struct t_cose_parameters to empty
+ *
+ * \param[in,out] parameters   Parameter list to clear.
+ */
+inline static void clear_cose_parameters(struct t_cose_parameters *parameters);
+
+
+#ifndef T_COSE_DISABLE_PROTECTED_INTERN
+/**
+ * \brief Look up encoded protected parameters in the interned headers.
+ *
+ * \param[in] table                 The caller's table or \c NULL for
+ *                                  only the built-in headers.
+ * \param[in] protected_parameters  The encoded protected parameters.
+ * \param[out] returned_parameters  The parsed parameters if found.
+ * \param[out] critical_labels      The crit labels if found.
+ *
+ * \return \c true if found. If not, nothing is returned and the
+ *         protected parameters must be parsed.
+ *
+ * The output is the same as from parse_protected_header_parameters()
+ * for headers that have no unknown labels. Pointers in \c
+ * returned_parameters point into \c protected_parameters.
+ */
+bool
+find_interned_protected_parameters(const struct t_cose_protected_intern_table *table,
+                                   struct q_useful_buf_c                       protected_parameters,
+                                   struct t_cose_parameters                   *returned_parameters,
+                                   struct t_cose_label_list                   *critical_labels);
+#endif /* T_COSE_DISABLE_PROTECTED_INTERN */
 
 
 /**
@@ -185,4 +253,30 @@ is_label_list_clear(const struct t_cose_label_list *list)
            q_useful_buf_c_is_null_or_empty(list->tstr_labels[0]);
 }
 
+
+inline static void clear_cose_parameters(struct t_cose_parameters *parameters)
+{
+#if COSE_ALGORITHM_RESERVED != 0
+#error Invalid algorithm designator not 0. Parameter list initialization fails.
+#endif
+
+#if T_COSE_UNSET_ALGORITHM_ID != COSE_ALGORITHM_RESERVED
+#error Constant for unset algorithm ID not aligned with COSE_ALGORITHM_RESERVED
+#endif
+
+    /* This clears all the useful_bufs to NULL_Q_USEFUL_BUF_C
+     * and the cose_algorithm_id to COSE_ALGORITHM_RESERVED
+     */
+    memset(parameters, 0, sizeof(struct t_cose_parameters));
+
+#ifndef T_COSE_DISABLE_CONTENT_TYPE
+    /* The only non-zero clear-state value. (0 is plain text in CoAP
+     * content format) */
+    parameters->content_type_uint =  T_COSE_EMPTY_UINT_CONTENT_TYPE;
+#endif
+#ifndef T_COSE_DISABLE_HASH_ENVELOPE
+    parameters->preimage_content_type_uint = T_COSE_EMPTY_UINT_CONTENT_TYPE;
+#endif
+}
+
 #endif /* t_cose_parameters_h */
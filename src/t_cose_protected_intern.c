@@ -0,0 +1,222 @@
+/*
+ *  t_cose_protected_intern.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "t_cose/t_cose_protected_intern.h"
+#include "t_cose_parameters.h"
+#include "t_cose_standard_constants.h"
+
+
+/**
+ * \file t_cose_protected_intern.c
+ *
+ * \brief Implementation of the table of pre-parsed protected headers.
+ */
+
+
+#ifndef T_COSE_DISABLE_PROTECTED_INTERN
+
+/**
+ * A protected header that is always interned. These are the headers
+ * t_cose_sign1_sign() makes when there are no optional parameters.
+ */
+struct builtin_protected {
+    struct q_useful_buf_c encoded;
+    int32_t               cose_algorithm_id;
+};
+
+static const struct builtin_protected builtin_protected_headers[] = {
+    /* {1: -7} */
+    {{(const uint8_t *)"\xa1\x01\x26", 3}, COSE_ALGORITHM_ES256},
+    /* {1: -35} */
+    {{(const uint8_t *)"\xa1\x01\x38\x22", 4}, COSE_ALGORITHM_ES384},
+    /* {1: -36} */
+    {{(const uint8_t *)"\xa1\x01\x38\x23", 4}, COSE_ALGORITHM_ES512},
+};
+
+
+/**
+ * \brief Move a pointer from the interned copy to the message.
+ *
+ * \param[in,out] string  A string in the parameters of an entry.
+ * \param[in] entry       The entry.
+ * \param[in] message     The protected parameters in the message.
+ *
+ * The bytes are the same, so the string is at the same offset.
+ */
+static inline void
+rebase_string(struct q_useful_buf_c                      *string,
+              const struct t_cose_protected_intern_entry *entry,
+              struct q_useful_buf_c                       message)
+{
+    if(!q_useful_buf_c_is_null(*string)) {
+        string->ptr = (const uint8_t *)message.ptr +
+                      ((const uint8_t *)string->ptr - entry->encoded);
+    }
+}
+
+
+/**
+ * \brief Return the parameters and crit labels of an entry.
+ *
+ * \param[in] entry                  The entry that matched.
+ * \param[in] protected_parameters   The protected parameters in the message.
+ * \param[out] returned_parameters   The parameters.
+ * \param[out] critical_labels       The crit labels.
+ */
+static void
+copy_entry(const struct t_cose_protected_intern_entry *entry,
+           struct q_useful_buf_c                       protected_parameters,
+           struct t_cose_parameters                   *returned_parameters,
+           struct t_cose_label_list                   *critical_labels)
+{
+    size_t index;
+
+    *returned_parameters = entry->parameters;
+    rebase_string(&returned_parameters->kid, entry, protected_parameters);
+    rebase_string(&returned_parameters->iv, entry, protected_parameters);
+    rebase_string(&returned_parameters->partial_iv, entry, protected_parameters);
+#ifndef T_COSE_DISABLE_CONTENT_TYPE
+    rebase_string(&returned_parameters->content_type_tstr,
+                  entry,
+                  protected_parameters);
+#endif
+#ifndef T_COSE_DISABLE_HASH_ENVELOPE
+    rebase_string(&returned_parameters->preimage_content_type_tstr,
+                  entry,
+                  protected_parameters);
+    rebase_string(&returned_parameters->payload_location,
+                  entry,
+                  protected_parameters);
+#endif
+
+    /* Only the terminators need to be set for an empty list, which
+     * is the usual case, so the whole list is not cleared. */
+    for(index = 0; index < entry->num_crit_labels; index++) {
+        critical_labels->int_labels[index] = entry->crit_labels[index];
+    }
+    critical_labels->int_labels[index] = LABEL_LIST_TERMINATOR;
+    critical_labels->tstr_labels[0]    = NULL_Q_USEFUL_BUF_C;
+}
+
+
+/*
+ * Public function. See t_cose_parameters.h
+ */
+bool
+find_interned_protected_parameters(const struct t_cose_protected_intern_table *table,
+                                   struct q_useful_buf_c                       protected_parameters,
+                                   struct t_cose_parameters                   *returned_parameters,
+                                   struct t_cose_label_list                   *critical_labels)
+{
+    size_t                                      index;
+    const struct t_cose_protected_intern_entry *entry;
+
+    /* -- The built-in headers -- */
+    for(index = 0;
+        index < sizeof(builtin_protected_headers)/sizeof(builtin_protected_headers[0]);
+        index++) {
+        if(!q_useful_buf_compare(protected_parameters,
+                                 builtin_protected_headers[index].encoded)) {
+            clear_cose_parameters(returned_parameters);
+            returned_parameters->cose_algorithm_id =
+                                  builtin_protected_headers[index].cose_algorithm_id;
+            critical_labels->int_labels[0]  = LABEL_LIST_TERMINATOR;
+            critical_labels->tstr_labels[0] = NULL_Q_USEFUL_BUF_C;
+            return true;
+        }
+    }
+
+    /* -- The caller's headers -- */
+    if(table == NULL) {
+        return false;
+    }
+    for(index = 0; index < table->num_entries; index++) {
+        entry = &table->entries[index];
+        if(entry->encoded_len == protected_parameters.len &&
+           !memcmp(entry->encoded, protected_parameters.ptr, entry->encoded_len)) {
+            copy_entry(entry,
+                       protected_parameters,
+                       returned_parameters,
+                       critical_labels);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*
+ * Public function. See t_cose_protected_intern.h
+ */
+enum t_cose_err_t
+t_cose_protected_intern_add(struct t_cose_protected_intern_table *table,
+                            struct q_useful_buf_c                 protected_parameters)
+{
+    enum t_cose_err_t                     return_value;
+    struct t_cose_protected_intern_entry *entry;
+    struct t_cose_label_list              critical_labels;
+    struct t_cose_label_list              unknown_labels;
+    size_t                                index;
+
+    /* -- Already there? -- */
+    for(index = 0; index < table->num_entries; index++) {
+        entry = &table->entries[index];
+        if(entry->encoded_len == protected_parameters.len &&
+           !memcmp(entry->encoded, protected_parameters.ptr, entry->encoded_len)) {
+            return_value = T_COSE_SUCCESS;
+            goto Done;
+        }
+    }
+
+    if(table->num_entries >= table->max_entries ||
+       protected_parameters.len > T_COSE_INTERN_MAX_PROTECTED_SIZE) {
+        return_value = T_COSE_ERR_TOO_SMALL;
+        goto Done;
+    }
+
+    /* -- Parse the entry's own copy so the parameters point into it -- */
+    entry = &table->entries[table->num_entries];
+    memcpy(entry->encoded, protected_parameters.ptr, protected_parameters.len);
+    entry->encoded_len = protected_parameters.len;
+
+    clear_label_list(&unknown_labels);
+    return_value = parse_protected_header_parameters(
+                        (struct q_useful_buf_c){entry->encoded, entry->encoded_len},
+                        &entry->parameters,
+                        &critical_labels,
+                        &unknown_labels,
+                        NULL,
+                        0);
+    if(return_value) {
+        goto Done;
+    }
+
+    /* Unknown parameters must go through the parser every time so
+     * they can be returned as custom parameters and checked against
+     * the crit list. Only integer crit labels are kept. */
+    if(!is_label_list_clear(&unknown_labels) ||
+       !q_useful_buf_c_is_null(critical_labels.tstr_labels[0])) {
+        return_value = T_COSE_ERR_INVALID_ARGUMENT;
+        goto Done;
+    }
+
+    for(index = 0; critical_labels.int_labels[index] != LABEL_LIST_TERMINATOR; index++) {
+        entry->crit_labels[index] = critical_labels.int_labels[index];
+    }
+    entry->num_crit_labels = index;
+
+    table->num_entries++;
+
+Done:
+    return return_value;
+}
+
+#endif /* T_COSE_DISABLE_PROTECTED_INTERN */
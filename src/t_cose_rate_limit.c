@@ -0,0 +1,279 @@
+/*
+ *  t_cose_rate_limit.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "t_cose/t_cose_rate_limit.h"
+#include <string.h>
+
+
+/**
+ * \file t_cose_rate_limit.c
+ *
+ * \brief Implementation of per-kid token buckets.
+ *
+ * The memory is a struct t_cose_rate_limit followed by slot_count
+ * struct rate_limit_slot. A slot has a 64-bit tag, a hash of the kid,
+ * and a 64-bit state that is the time of the last update in
+ * milliseconds in the high 32 bits and the tokens in thousandths in
+ * the low 32 bits. Thousandths of a token per millisecond is tokens
+ * per second, so refilling is one multiply with no rounding.
+ *
+ * A tag of zero is an empty slot. The state is only ever changed by a
+ * compare-and-swap of the whole word so the time and tokens always go
+ * together. The tag and state are not changed together, so a thread
+ * can briefly see a new kid with the bucket of the kid it replaced.
+ */
+
+
+#ifdef T_COSE_ENABLE_RATE_LIMIT
+
+/* How many slots past the home slot are searched */
+#define RATE_LIMIT_PROBE_LIMIT 4
+
+/* Thousandths */
+#define MILLI_TOKENS 1000
+
+#define STATE_TIME(state)   ((uint32_t)((state) >> 32))
+#define STATE_TOKENS(state) ((uint32_t)(state))
+#define MAKE_STATE(time, tokens) (((uint64_t)(time) << 32) | (tokens))
+
+
+struct t_cose_rate_limit {
+    uint32_t slot_count;
+    uint32_t rate;
+    uint32_t max_tokens;
+    uint32_t now_ms;
+    uint64_t limited;
+    uint64_t evictions;
+    /* The slots follow */
+};
+
+
+struct rate_limit_slot {
+    uint64_t tag;
+    uint64_t state;
+};
+
+
+static inline struct rate_limit_slot *
+get_slots(struct t_cose_rate_limit *limiter)
+{
+    return (struct rate_limit_slot *)(limiter + 1);
+}
+
+
+static inline bool is_power_of_two(uint32_t n)
+{
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+
+/*
+ * FNV-1a 64 of the kid. Never zero as that is an empty slot.
+ */
+static inline uint64_t kid_tag(struct q_useful_buf_c kid)
+{
+    uint64_t       hash = 0xcbf29ce484222325ull;
+    const uint8_t *p    = kid.ptr;
+    size_t         i;
+
+    for(i = 0; i < kid.len; i++) {
+        hash = (hash ^ p[i]) * 0x100000001b3ull;
+    }
+    /* The low bits pick the slot so fold the high bits into them */
+    hash ^= hash >> 32;
+
+    return hash | 1;
+}
+
+
+/*
+ * Public function. See t_cose_rate_limit.h
+ */
+size_t t_cose_rate_limit_size(uint32_t slot_count)
+{
+    if(!is_power_of_two(slot_count)) {
+        return 0;
+    }
+    return sizeof(struct t_cose_rate_limit) +
+           (size_t)slot_count * sizeof(struct rate_limit_slot);
+}
+
+
+/*
+ * Public function. See t_cose_rate_limit.h
+ */
+enum t_cose_err_t
+t_cose_rate_limit_init(struct q_useful_buf        memory,
+                       uint32_t                   slot_count,
+                       uint32_t                   rate,
+                       uint32_t                   burst,
+                       struct t_cose_rate_limit **limiter)
+{
+    struct t_cose_rate_limit *new_limiter;
+    const size_t              size = t_cose_rate_limit_size(slot_count);
+
+    if(size == 0 || burst == 0 || burst > T_COSE_RATE_LIMIT_MAX_BURST ||
+       ((uintptr_t)memory.ptr % sizeof(uint64_t)) != 0) {
+        return T_COSE_ERR_INVALID_ARGUMENT;
+    }
+    if(memory.len < size) {
+        return T_COSE_ERR_TOO_SMALL;
+    }
+
+    /* All slots get tag 0, empty */
+    memset(memory.ptr, 0, size);
+
+    new_limiter = (struct t_cose_rate_limit *)memory.ptr;
+    new_limiter->slot_count = slot_count;
+    new_limiter->rate       = rate;
+    new_limiter->max_tokens = burst * MILLI_TOKENS;
+
+    *limiter = new_limiter;
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function. See t_cose_rate_limit.h
+ */
+void
+t_cose_rate_limit_set_time(struct t_cose_rate_limit *limiter,
+                           uint32_t                  now_ms)
+{
+    __atomic_store_n(&limiter->now_ms, now_ms, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Refill the bucket for the time since it was last updated and take
+ * a token if there is one.
+ */
+static bool
+take_token(struct t_cose_rate_limit *limiter,
+           struct rate_limit_slot   *slot,
+           uint32_t                  now)
+{
+    uint64_t old_state;
+    uint64_t new_state;
+    uint64_t refill;
+    uint32_t tokens;
+    bool     allowed;
+
+    old_state = __atomic_load_n(&slot->state, __ATOMIC_RELAXED);
+    do {
+        tokens = STATE_TOKENS(old_state);
+        /* At most (2^32 - 1) * (2^32 - 1) so it can't overflow */
+        refill = (uint64_t)(uint32_t)(now - STATE_TIME(old_state)) * limiter->rate;
+        if(tokens >= limiter->max_tokens || refill >= limiter->max_tokens - tokens) {
+            tokens = limiter->max_tokens;
+        } else {
+            tokens += (uint32_t)refill;
+        }
+
+        allowed = tokens >= MILLI_TOKENS;
+        if(allowed) {
+            tokens -= MILLI_TOKENS;
+        }
+
+        new_state = MAKE_STATE(now, tokens);
+        if(new_state == old_state) {
+            /* Still empty in the same millisecond. Don't dirty the
+             * cache line when being flooded. */
+            break;
+        }
+    } while(!__atomic_compare_exchange_n(&slot->state, &old_state, new_state,
+                                         true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    if(!allowed) {
+        __atomic_fetch_add(&limiter->limited, 1, __ATOMIC_RELAXED);
+    }
+
+    return allowed;
+}
+
+
+/*
+ * Public function. See t_cose_rate_limit.h
+ */
+bool
+t_cose_rate_limit_take(struct t_cose_rate_limit *limiter,
+                       struct q_useful_buf_c     kid)
+{
+    struct rate_limit_slot *slots = get_slots(limiter);
+    const uint32_t          mask  = limiter->slot_count - 1;
+    const uint32_t          now   = __atomic_load_n(&limiter->now_ms, __ATOMIC_RELAXED);
+    const uint64_t          tag   = kid_tag(kid);
+    struct rate_limit_slot *slot;
+    struct rate_limit_slot *victim;
+    uint32_t                victim_age;
+    uint32_t                age;
+    uint32_t                probe;
+    uint64_t                slot_tag;
+
+    victim     = NULL;
+    victim_age = 0;
+    for(probe = 0; probe < RATE_LIMIT_PROBE_LIMIT; probe++) {
+        slot     = &slots[((uint32_t)tag + probe) & mask];
+        slot_tag = __atomic_load_n(&slot->tag, __ATOMIC_ACQUIRE);
+        if(slot_tag == tag) {
+            return take_token(limiter, slot, now);
+        }
+        if(slot_tag == 0) {
+            victim = slot;
+            break;
+        }
+        /* Remember the slot updated longest ago */
+        age = now - STATE_TIME(__atomic_load_n(&slot->state, __ATOMIC_RELAXED));
+        if(victim == NULL || age > victim_age) {
+            victim     = slot;
+            victim_age = age;
+        }
+    }
+
+    /* A kid not seen recently. Claim the empty or least recently used
+     * slot. */
+    slot_tag = __atomic_load_n(&victim->tag, __ATOMIC_RELAXED);
+    if(slot_tag == tag) {
+        return take_token(limiter, victim, now);
+    }
+    if(!__atomic_compare_exchange_n(&victim->tag, &slot_tag, tag, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        /* Another thread claimed it at the same time. If it was for
+         * the same kid, use it. Otherwise let this one through
+         * rather than retry; it is only one message. */
+        return slot_tag == tag ? take_token(limiter, victim, now) : true;
+    }
+    if(slot_tag != 0) {
+        __atomic_fetch_add(&limiter->evictions, 1, __ATOMIC_RELAXED);
+    }
+
+    /* A new bucket starts full, less the token for this message */
+    __atomic_store_n(&victim->state,
+                     MAKE_STATE(now, limiter->max_tokens - MILLI_TOKENS),
+                     __ATOMIC_RELAXED);
+
+    return true;
+}
+
+
+/*
+ * Public function. See t_cose_rate_limit.h
+ */
+void
+t_cose_rate_limit_get_stats(const struct t_cose_rate_limit *limiter,
+                            struct t_cose_rate_limit_stats *stats)
+{
+    stats->limited    = __atomic_load_n(&limiter->limited, __ATOMIC_RELAXED);
+    stats->evictions  = __atomic_load_n(&limiter->evictions, __ATOMIC_RELAXED);
+    stats->slot_count = limiter->slot_count;
+}
+
+#endif /* T_COSE_ENABLE_RATE_LIMIT */
@@ -0,0 +1,156 @@
+/*
+ *  t_cose_sign1_batch.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "t_cose/t_cose_sign1_batch.h"
+#include "qcbor/qcbor.h"
+
+
+/**
+ * \file t_cose_sign1_batch.c
+ *
+ * \brief Implementation of batch signing into an arena.
+ *
+ * A \c COSE_Sign1 is the header parameters, the payload wrapped in a
+ * byte string and the signature. For a given signing context
+ * everything but the payload is the same size for every record as
+ * ECDSA signatures in COSE are fixed length. The size of a record is
+ * thus the size with an empty payload, less the one-byte head of the
+ * empty byte string, plus the head and bytes of the actual payload.
+ */
+
+
+/**
+ * \brief Size of the head of a CBOR byte string.
+ *
+ * \param[in] len  Length of the byte string.
+ *
+ * \return The size of the major type and argument in bytes.
+ */
+static inline size_t
+cbor_bstr_head_size(size_t len)
+{
+    return len < 24           ? 1 :
+           len <= UINT8_MAX   ? 2 :
+           len <= UINT16_MAX  ? 3 :
+           (uint64_t)len <= UINT32_MAX ? 5 :
+                                9;
+}
+
+
+/**
+ * \brief Compute the size of a \c COSE_Sign1 with an empty payload.
+ *
+ * \param[in] sign_ctx     The signing context.
+ * \param[out] fixed_size  The size.
+ *
+ * This runs the size calculation mode of the CBOR encoder with no
+ * output buffer. No signing is done.
+ */
+static enum t_cose_err_t
+size_with_empty_payload(struct t_cose_sign1_sign_ctx *sign_ctx,
+                        size_t                       *fixed_size)
+{
+    enum t_cose_err_t  return_value;
+    QCBOREncodeContext cbor_encode;
+
+    QCBOREncode_Init(&cbor_encode, (struct q_useful_buf){NULL, INT32_MAX});
+
+    return_value = t_cose_sign1_encode_parameters(sign_ctx, &cbor_encode);
+    if(return_value) {
+        goto Done;
+    }
+
+    QCBOREncode_AddEncoded(&cbor_encode, NULL_Q_USEFUL_BUF_C);
+
+    return_value = t_cose_sign1_encode_signature(sign_ctx, &cbor_encode);
+    if(return_value) {
+        goto Done;
+    }
+
+    if(QCBOREncode_FinishGetSize(&cbor_encode, fixed_size)) {
+        return_value = T_COSE_ERR_CBOR_FORMATTING;
+    }
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_sign1_batch.h
+ */
+enum t_cose_err_t
+t_cose_sign1_sign_batch(struct t_cose_sign1_sign_ctx    *sign_ctx,
+                        const struct q_useful_buf_c     *payloads,
+                        size_t                           num_payloads,
+                        struct t_cose_sign1_arena       *arena,
+                        struct t_cose_sign1_batch_entry *entries,
+                        size_t                          *num_signed)
+{
+    enum t_cose_err_t     return_value;
+    size_t                fixed_size;
+    size_t                record_size;
+    size_t                index;
+    struct q_useful_buf   record_buffer;
+    struct q_useful_buf_c signed_record;
+
+    *num_signed = 0;
+
+    /* -- Size everything but the payload once for the whole batch -- */
+    return_value = size_with_empty_payload(sign_ctx, &fixed_size);
+    if(return_value) {
+        goto Done;
+    }
+    /* The empty payload was encoded as a one-byte head */
+    fixed_size -= 1;
+
+    for(index = 0; index < num_payloads; index++) {
+        record_size = fixed_size +
+                      cbor_bstr_head_size(payloads[index].len) +
+                      payloads[index].len;
+
+        /* -- Make room in the arena -- */
+        if(arena->buffer.len - arena->used < record_size) {
+            if(arena->grow_cb == NULL) {
+                return_value = T_COSE_ERR_TOO_SMALL;
+                goto Done;
+            }
+            return_value = (*arena->grow_cb)(arena->cb_context,
+                                             arena->used + record_size,
+                                            &arena->buffer);
+            if(return_value) {
+                goto Done;
+            }
+            if(arena->buffer.len - arena->used < record_size) {
+                return_value = T_COSE_ERR_TOO_SMALL;
+                goto Done;
+            }
+        }
+
+        /* -- Sign straight into the arena -- */
+        record_buffer.ptr = (uint8_t *)arena->buffer.ptr + arena->used;
+        record_buffer.len = record_size;
+        return_value = t_cose_sign1_sign(sign_ctx,
+                                         payloads[index],
+                                         record_buffer,
+                                         &signed_record);
+        if(return_value) {
+            goto Done;
+        }
+
+        entries[index].offset = arena->used;
+        entries[index].len    = signed_record.len;
+        arena->used          += signed_record.len;
+        (*num_signed)++;
+    }
+
+Done:
+    return return_value;
+}
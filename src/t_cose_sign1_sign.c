@@ -43,6 +43,23 @@
 #error COSE algorithm identifier definitions are in error
 #endif
 
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
+/*
+ * Compile-time check that the crypto adapter's hash context fits in
+ * the space for it in the signing context. If this fails, define
+ * T_COSE_TBS_HASH_CTX_SIZE to be larger.
+ */
+typedef char t_cose_tbs_hash_ctx_size_check[
+    sizeof(struct t_cose_crypto_hash) <= T_COSE_TBS_HASH_CTX_SIZE ? 1 : -1];
+
+/* The hash context kept in the signing context */
+#define TBS_HASH_CTX(me) ((struct t_cose_crypto_hash *)(void *)(me)->tbs_hash_ctx.bytes)
+#endif /* T_COSE_ENABLE_INCREMENTAL_HASH */
+
+#if T_COSE_CRYPTO_MAX_HASH_SIZE > T_COSE_PREPARED_MAX_HASH_SIZE
+#error T_COSE_PREPARED_MAX_HASH_SIZE is too small for the largest hash
+#endif
+
 
 #ifndef T_COSE_DISABLE_SHORT_CIRCUIT_SIGN
 /**
@@ -120,8 +137,7 @@ Done:
 /**
  * \brief  Makes the protected header parameters for COSE.
  *
- * \param[in] cose_algorithm_id      The COSE algorithm ID to put in the
- *                                   header parameters.
+ * \param[in] me                     The t_cose signing context.
  * \param[in,out] cbor_encode_ctx    Encoding context to output to.
  *
  * \return   The pointer and length of the encoded protected
@@ -136,8 +152,8 @@ Done:
  * way.
  */
 static inline struct q_useful_buf_c
-encode_protected_parameters(int32_t             cose_algorithm_id,
-                            QCBOREncodeContext *cbor_encode_ctx)
+encode_protected_parameters(const struct t_cose_sign1_sign_ctx *me,
+                            QCBOREncodeContext                 *cbor_encode_ctx)
 {
     /* approximate stack use on 32-bit machine:
      *   local use: 16
@@ -146,7 +162,32 @@ encode_protected_parameters(int32_t             cose_algorithm_id,
 
     QCBOREncode_BstrWrap(cbor_encode_ctx);
     QCBOREncode_OpenMap(cbor_encode_ctx);
-    QCBOREncode_AddInt64ToMapN(cbor_encode_ctx, COSE_HEADER_PARAM_ALG, cose_algorithm_id);
+    QCBOREncode_AddInt64ToMapN(cbor_encode_ctx, COSE_HEADER_PARAM_ALG, me->cose_algorithm_id);
+
+#ifndef T_COSE_DISABLE_HASH_ENVELOPE
+    /* The hash envelope parameters are all protected */
+    if(me->payload_hash_alg_id != COSE_ALGORITHM_RESERVED) {
+        QCBOREncode_AddInt64ToMapN(cbor_encode_ctx,
+                                   COSE_HEADER_PARAM_PAYLOAD_HASH_ALG,
+                                   me->payload_hash_alg_id);
+    }
+    if(me->preimage_content_type_uint != T_COSE_EMPTY_UINT_CONTENT_TYPE) {
+        QCBOREncode_AddUInt64ToMapN(cbor_encode_ctx,
+                                    COSE_HEADER_PARAM_PAYLOAD_PREIMAGE_CONTENT_TYPE,
+                                    me->preimage_content_type_uint);
+    }
+    if(me->preimage_content_type_tstr != NULL) {
+        QCBOREncode_AddSZStringToMapN(cbor_encode_ctx,
+                                      COSE_HEADER_PARAM_PAYLOAD_PREIMAGE_CONTENT_TYPE,
+                                      me->preimage_content_type_tstr);
+    }
+    if(me->payload_location != NULL) {
+        QCBOREncode_AddSZStringToMapN(cbor_encode_ctx,
+                                      COSE_HEADER_PARAM_PAYLOAD_LOCATION,
+                                      me->payload_location);
+    }
+#endif /* T_COSE_DISABLE_HASH_ENVELOPE */
+
     QCBOREncode_CloseMap(cbor_encode_ctx);
     QCBOREncode_CloseBstrWrap2(cbor_encode_ctx, false, &protected_parameters);
 
@@ -211,12 +252,58 @@ add_unprotected_parameters(const struct t_cose_sign1_sign_ctx *me,
 }
 
 
-/*
- * Public function. See t_cose_sign1_sign.h
+/**
+ * \brief Get what has been encoded so far.
+ *
+ * \param[in] cbor_encode_ctx  Encoding context.
+ * \param[out] encoded         Pointer and length of the output so far.
+ *                             The pointer is \c NULL when only
+ *                             calculating the size.
+ *
+ * \returns An error of type \ref t_cose_err_t.
+ *
+ * This only works when no array, map or byte string wrapping is open
+ * as \c QCBOREncode_Finish() is used. It does not end the encoding.
  */
-enum t_cose_err_t
-t_cose_sign1_encode_parameters(struct t_cose_sign1_sign_ctx *me,
-                               QCBOREncodeContext           *cbor_encode_ctx)
+static inline enum t_cose_err_t
+encoding_so_far(QCBOREncodeContext    *cbor_encode_ctx,
+                struct q_useful_buf_c *encoded)
+{
+    QCBORError cbor_err;
+
+    cbor_err = QCBOREncode_Finish(cbor_encode_ctx, encoded);
+    if(cbor_err == QCBOR_ERR_BUFFER_TOO_SMALL) {
+        return T_COSE_ERR_TOO_SMALL;
+    } else if(cbor_err != QCBOR_SUCCESS) {
+        return T_COSE_ERR_CBOR_FORMATTING;
+    }
+    return T_COSE_SUCCESS;
+}
+
+
+/**
+ * \brief Output the first part and parameters of a \c COSE_Sign1.
+ *
+ * \param[in] me               The t_cose signing context.
+ * \param[in] cbor_encode_ctx  Encoding context to output to.
+ *
+ * \returns An error of type \ref t_cose_err_t.
+ *
+ * This is the body of t_cose_sign1_encode_parameters() and
+ * t_cose_sign1_encode_parameters_known_length(). Which is indicated
+ * by \c me->payload_len_known.
+ *
+ * When the payload length is known the array head and the head of
+ * the payload byte string are output directly rather than opened
+ * with QCBOR. The payload then goes in at the top nesting level of
+ * the encoder where QCBOR doesn't need an item count, and nothing
+ * has to be inserted in front of it when it is closed. With
+ * QCBOREncode_BstrWrap() the head is inserted in front of the payload
+ * when it is closed which moves the whole payload.
+ */
+static enum t_cose_err_t
+encode_parameters(struct t_cose_sign1_sign_ctx *me,
+                  QCBOREncodeContext           *cbor_encode_ctx)
 {
     /* approximate stack use on 32-bit machine:
      *    48 bytes local use
@@ -226,6 +313,8 @@ t_cose_sign1_encode_parameters(struct t_cose_sign1_sign_ctx *me,
     enum t_cose_err_t      return_value;
     struct q_useful_buf_c  kid;
     int32_t                hash_alg_id;
+    struct q_useful_buf_c  encoded;
+    Q_USEFUL_BUF_MAKE_STACK_UB(buffer_for_array_head, QCBOR_HEAD_BUFFER_SIZE);
 
     /* Check the cose_algorithm_id now by getting the hash alg as an
      * early error check even though it is not used until later.
@@ -235,6 +324,25 @@ t_cose_sign1_encode_parameters(struct t_cose_sign1_sign_ctx *me,
         return T_COSE_ERR_UNSUPPORTED_SIGNING_ALG;
     }
 
+#ifndef T_COSE_DISABLE_HASH_ENVELOPE
+    if(me->payload_hash_alg_id != COSE_ALGORITHM_RESERVED) {
+        if(hash_size_from_hash_alg_id(me->payload_hash_alg_id) == 0) {
+            return T_COSE_ERR_UNSUPPORTED_HASH;
+        }
+#ifndef T_COSE_DISABLE_CONTENT_TYPE
+        /* The payload is a hash so it can't have a content type */
+        if(me->content_type_uint != T_COSE_EMPTY_UINT_CONTENT_TYPE ||
+           me->content_type_tstr != NULL) {
+            return T_COSE_ERR_BAD_CONTENT_TYPE;
+        }
+#endif
+    }
+    if(me->preimage_content_type_uint != T_COSE_EMPTY_UINT_CONTENT_TYPE &&
+       me->preimage_content_type_tstr != NULL) {
+        return T_COSE_ERR_DUPLICATE_PARAMETER;
+    }
+#endif /* T_COSE_DISABLE_HASH_ENVELOPE */
+
     /* Add the CBOR tag indicating COSE_Sign1 */
     if(!(me->option_flags & T_COSE_OPT_OMIT_CBOR_TAG)) {
         QCBOREncode_AddTag(cbor_encode_ctx, CBOR_TAG_COSE_SIGN1);
@@ -242,10 +350,18 @@ t_cose_sign1_encode_parameters(struct t_cose_sign1_sign_ctx *me,
 
     /* Get started with the tagged array that holds the four parts of
      * a cose single signed message */
-    QCBOREncode_OpenArray(cbor_encode_ctx);
+    if(me->payload_len_known) {
+        QCBOREncode_AddEncoded(cbor_encode_ctx,
+                               QCBOREncode_EncodeHead(buffer_for_array_head,
+                                                      CBOR_MAJOR_TYPE_ARRAY,
+                                                      0,
+                                                      4));
+    } else {
+        QCBOREncode_OpenArray(cbor_encode_ctx);
+    }
 
     /* The protected parameters, which are added as a wrapped bstr  */
-    me->protected_parameters = encode_protected_parameters(me->cose_algorithm_id, cbor_encode_ctx);
+    me->protected_parameters = encode_protected_parameters(me, cbor_encode_ctx);
 
     /* The Unprotected parameters */
     /* Get the kid because it goes into the parameters that are about
@@ -269,7 +385,21 @@ t_cose_sign1_encode_parameters(struct t_cose_sign1_sign_ctx *me,
         goto Done;
     }
 
-    QCBOREncode_BstrWrap(cbor_encode_ctx);
+    if(me->payload_len_known) {
+        /* The exact head for the payload byte string. The caller
+         * adds exactly payload_len bytes of payload after it. */
+        QCBOREncode_AddBytesLenOnly(cbor_encode_ctx,
+                                    (struct q_useful_buf_c){NULL, me->payload_len});
+        /* Finish doesn't end the encoding, it just returns what has
+         * been output so far. That is how the payload is located. */
+        return_value = encoding_so_far(cbor_encode_ctx, &encoded);
+        if(return_value) {
+            goto Done;
+        }
+        me->payload_start = encoded.len;
+    } else {
+        QCBOREncode_BstrWrap(cbor_encode_ctx);
+    }
 
     /* Any failures in CBOR encoding will be caught in finish when the
      * CBOR encoding is closed off. No need to track here as the CBOR
@@ -285,30 +415,237 @@ Done:
  * Public function. See t_cose_sign1_sign.h
  */
 enum t_cose_err_t
-t_cose_sign1_encode_signature(struct t_cose_sign1_sign_ctx *me,
-                              QCBOREncodeContext           *cbor_encode_ctx)
+t_cose_sign1_encode_parameters(struct t_cose_sign1_sign_ctx *me,
+                               QCBOREncodeContext           *cbor_encode_ctx)
+{
+    me->payload_len_known = false;
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
+    me->tbs_hash_started  = false;
+#endif
+
+    return encode_parameters(me, cbor_encode_ctx);
+}
+
+
+/*
+ * Public function. See t_cose_sign1_sign.h
+ */
+enum t_cose_err_t
+t_cose_sign1_encode_parameters_known_length(struct t_cose_sign1_sign_ctx *me,
+                                            size_t                        payload_len,
+                                            QCBOREncodeContext           *cbor_encode_ctx)
+{
+    me->payload_len_known = true;
+    me->payload_len       = payload_len;
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
+    me->tbs_hash_started  = false;
+#endif
+
+    return encode_parameters(me, cbor_encode_ctx);
+}
+
+
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
+/**
+ * \brief Hash the payload bytes output since the last time.
+ *
+ * \param[in] me       The t_cose signing context.
+ * \param[in] encoded  All that has been output so far.
+ *
+ * Only the payload is hashed even if more than \c payload_len bytes
+ * have been output. The length is checked in
+ * t_cose_sign1_encode_signature().
+ */
+static void
+hash_new_payload(struct t_cose_sign1_sign_ctx *me,
+                 struct q_useful_buf_c         encoded)
+{
+    size_t                payload_so_far;
+    struct q_useful_buf_c new_bytes;
+
+    payload_so_far = encoded.len - me->payload_start;
+    if(payload_so_far > me->payload_len) {
+        payload_so_far = me->payload_len;
+    }
+
+    if(payload_so_far > me->payload_hashed) {
+        new_bytes.ptr = (const uint8_t *)encoded.ptr +
+                        me->payload_start + me->payload_hashed;
+        new_bytes.len = payload_so_far - me->payload_hashed;
+        t_cose_crypto_hash_update(TBS_HASH_CTX(me), new_bytes);
+        me->payload_hashed = payload_so_far;
+    }
+}
+
+
+/*
+ * Public function. See t_cose_sign1_sign.h
+ */
+enum t_cose_err_t
+t_cose_sign1_encode_parameters_incremental(struct t_cose_sign1_sign_ctx *me,
+                                           size_t                        payload_len,
+                                           QCBOREncodeContext           *cbor_encode_ctx)
+{
+    enum t_cose_err_t return_value;
+
+    return_value = t_cose_sign1_encode_parameters_known_length(me,
+                                                               payload_len,
+                                                               cbor_encode_ctx);
+    if(return_value) {
+        goto Done;
+    }
+
+    if(QCBOREncode_IsBufferNULL(cbor_encode_ctx)) {
+        /* Just calculating sizes. There is nothing to hash. */
+        goto Done;
+    }
+
+    /* The protected parameters are known now, so everything in the
+     * TBS bytes before the payload can be hashed. */
+    return_value = start_tbs_hash(me->cose_algorithm_id,
+                                  me->protected_parameters,
+                                  payload_len,
+                                  TBS_HASH_CTX(me));
+    if(return_value) {
+        goto Done;
+    }
+    me->payload_hashed   = 0;
+    me->tbs_hash_started = true;
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_sign1_sign.h
+ */
+enum t_cose_err_t
+t_cose_sign1_hash_encoded_payload(struct t_cose_sign1_sign_ctx *me,
+                                  QCBOREncodeContext           *cbor_encode_ctx)
+{
+    enum t_cose_err_t     return_value;
+    struct q_useful_buf_c encoded;
+
+    if(!me->tbs_hash_started) {
+        return_value = T_COSE_SUCCESS;
+        goto Done;
+    }
+
+    return_value = encoding_so_far(cbor_encode_ctx, &encoded);
+    if(return_value) {
+        goto Done;
+    }
+
+    hash_new_payload(me, encoded);
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_sign1_sign.h
+ */
+enum t_cose_err_t
+t_cose_sign1_add_payload_bytes(struct t_cose_sign1_sign_ctx *me,
+                               QCBOREncodeContext           *cbor_encode_ctx,
+                               struct q_useful_buf_c         bytes)
+{
+    enum t_cose_err_t     return_value;
+    struct q_useful_buf_c block;
+    size_t                offset;
+
+    return_value = T_COSE_SUCCESS;
+
+    for(offset = 0; offset < bytes.len; offset += block.len) {
+        block = q_useful_buf_tail(bytes, offset);
+        if(block.len > T_COSE_INCREMENTAL_HASH_BLOCK_SIZE) {
+            block.len = T_COSE_INCREMENTAL_HASH_BLOCK_SIZE;
+        }
+
+        QCBOREncode_AddEncoded(cbor_encode_ctx, block);
+
+        /* Hash the block just copied while it is still in cache */
+        return_value = t_cose_sign1_hash_encoded_payload(me, cbor_encode_ctx);
+        if(return_value) {
+            break;
+        }
+    }
+
+    return return_value;
+}
+#endif /* T_COSE_ENABLE_INCREMENTAL_HASH */
+
+
+/*
+ * Public function. See t_cose_sign1_sign.h
+ */
+enum t_cose_err_t
+t_cose_sign1_sign_prepare(struct t_cose_sign1_sign_ctx  *me,
+                          QCBOREncodeContext            *cbor_encode_ctx,
+                          struct t_cose_sign1_prepared  *prepared)
 {
     /* approximate stack use on 32-bit machine:
      *   32 bytes local use
      *   220 to 434 for calls depending on hash implementation
-     *   32 to 64 bytes depending on hash alg (SHA256, 384 or 512)
-     *   64 to 260 depending on EC alg
-     *   348 to 778 total depending on hash and EC alg
-     *   Also add stack use by EC and hash functions
+     *   Also add stack use by hash functions
      */
     enum t_cose_err_t            return_value;
     QCBORError                   cbor_err;
     /* pointer and length of the completed tbs hash */
     struct q_useful_buf_c        tbs_hash;
-    /* Pointer and length of the completed signature */
-    struct q_useful_buf_c        signature;
-    /* Buffer for the actual signature */
-    Q_USEFUL_BUF_MAKE_STACK_UB(  buffer_for_signature, T_COSE_MAX_SIG_SIZE);
-    /* Buffer for the tbs hash. */
-    Q_USEFUL_BUF_MAKE_STACK_UB(  buffer_for_tbs_hash, T_COSE_CRYPTO_MAX_HASH_SIZE);
+    /* Buffer for the tbs hash is in the prepared signature */
+    const struct q_useful_buf    buffer_for_tbs_hash = {prepared->tbs_hash_bytes,
+                                                        sizeof(prepared->tbs_hash_bytes)};
     struct q_useful_buf_c        signed_payload;
+    struct q_useful_buf_c        encoded;
+    bool                         payload_len_known;
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
+    bool                         tbs_hash_started;
+    enum t_cose_err_t            hash_result;
+
+    tbs_hash_started     = me->tbs_hash_started;
+    me->tbs_hash_started = false;
+#endif
+
+    tbs_hash = NULL_Q_USEFUL_BUF_C;
 
-    QCBOREncode_CloseBstrWrap2(cbor_encode_ctx, false, &signed_payload);
+    payload_len_known     = me->payload_len_known;
+    me->payload_len_known = false;
+
+    if(payload_len_known) {
+        /* The payload is whatever was output after its head. Nothing
+         * has to be moved to close it. */
+        return_value = encoding_so_far(cbor_encode_ctx, &encoded);
+        if(return_value == T_COSE_SUCCESS &&
+           encoded.len - me->payload_start != me->payload_len) {
+            return_value = T_COSE_ERR_WRONG_PAYLOAD_LENGTH;
+        }
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
+        if(tbs_hash_started) {
+            if(return_value == T_COSE_SUCCESS) {
+                hash_new_payload(me, encoded);
+            }
+            /* Finish even on error so the crypto adapter can release
+             * anything held by the hash context. */
+            hash_result = t_cose_crypto_hash_finish(TBS_HASH_CTX(me),
+                                                    buffer_for_tbs_hash,
+                                                    &tbs_hash);
+            if(return_value == T_COSE_SUCCESS) {
+                return_value = hash_result;
+            }
+        }
+#endif
+        if(return_value) {
+            goto Done;
+        }
+        signed_payload.len = me->payload_len;
+        signed_payload.ptr = encoded.ptr == NULL ? NULL :
+                             (const uint8_t *)encoded.ptr + me->payload_start;
+    } else {
+        QCBOREncode_CloseBstrWrap2(cbor_encode_ctx, false, &signed_payload);
+    }
 
     /* Check that there are no CBOR encoding errors before proceeding
      * with hashing and signing. This is not actually necessary as the
@@ -324,31 +661,74 @@ t_cose_sign1_encode_signature(struct t_cose_sign1_sign_ctx *me,
         goto Done;
     }
 
-    if (QCBOREncode_IsBufferNULL(cbor_encode_ctx)) {
-        /* Just calculating sizes. All that is needed is the signature
-         * size.
-         */
-        signature.ptr = NULL;
-        return_value  = t_cose_crypto_sig_size(me->cose_algorithm_id,
-                                               me->signing_key,
-                                              &signature.len);
-     } else {
-
+    /* When just calculating sizes there is nothing to hash. */
+    if(!QCBOREncode_IsBufferNULL(cbor_encode_ctx)) {
         /* Create the hash of the to-be-signed bytes. Inputs to the
          * hash are the protected parameters, the payload that is
          * getting signed, the cose signature alg from which the hash
          * alg is determined. The cose_algorithm_id was checked in
          * t_cose_sign1_init() so it doesn't need to be checked here.
          */
-        return_value = create_tbs_hash(me->cose_algorithm_id,
-                                       me->protected_parameters,
-                                       signed_payload,
-                                       buffer_for_tbs_hash,
-                                       &tbs_hash);
-        if(return_value) {
-            goto Done;
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
+        if(tbs_hash_started) {
+            /* Already hashed as the payload was output */
+        } else
+#endif
+        {
+            return_value = create_tbs_hash(me->cose_algorithm_id,
+                                           me->protected_parameters,
+                                           signed_payload,
+                                           buffer_for_tbs_hash,
+                                           &tbs_hash);
+            if(return_value) {
+                goto Done;
+            }
         }
+    }
+
+    prepared->tbs_hash_len         = tbs_hash.len;
+    prepared->protected_parameters = me->protected_parameters;
+    prepared->cose_algorithm_id    = me->cose_algorithm_id;
+    /* With a known-length payload the array was not opened in the
+     * encoder so it is not closed. */
+    prepared->close_array          = !payload_len_known;
+
+Done:
+    return return_value;
+}
+
 
+/*
+ * Public function. See t_cose_sign1_sign.h
+ */
+enum t_cose_err_t
+t_cose_sign1_sign_complete(const struct t_cose_sign1_sign_ctx *me,
+                           const struct t_cose_sign1_prepared *prepared,
+                           QCBOREncodeContext                 *cbor_encode_ctx)
+{
+    /* approximate stack use on 32-bit machine:
+     *   32 bytes local use
+     *   64 to 260 depending on EC alg
+     *   Also add stack use by EC functions
+     */
+    enum t_cose_err_t            return_value;
+    /* The hash of the to-be-signed bytes from the prepared signature */
+    const struct q_useful_buf_c  tbs_hash = {prepared->tbs_hash_bytes,
+                                             prepared->tbs_hash_len};
+    /* Pointer and length of the completed signature */
+    struct q_useful_buf_c        signature;
+    /* Buffer for the actual signature */
+    Q_USEFUL_BUF_MAKE_STACK_UB(  buffer_for_signature, T_COSE_MAX_SIG_SIZE);
+
+    if (QCBOREncode_IsBufferNULL(cbor_encode_ctx)) {
+        /* Just calculating sizes. All that is needed is the signature
+         * size.
+         */
+        signature.ptr = NULL;
+        return_value  = t_cose_crypto_sig_size(prepared->cose_algorithm_id,
+                                               me->signing_key,
+                                              &signature.len);
+     } else {
         /* Compute the signature using public key crypto. The key and
          * algorithm ID are passed in to know how and what to sign
          * with. The hash of the TBS bytes is what is signed. A buffer
@@ -361,8 +741,21 @@ t_cose_sign1_encode_signature(struct t_cose_sign1_sign_ctx *me,
          * integrated.
          */
         if(!(me->option_flags & T_COSE_OPT_SHORT_CIRCUIT_SIG)) {
+#ifdef T_COSE_ENABLE_RESTARTABLE
+            if(me->restart_ctx != NULL) {
+                /* Time-sliced signing. T_COSE_ERR_SIG_IN_PROGRESS
+                 * comes back through return_value below. */
+                return_value = t_cose_crypto_pub_key_sign_restartable(
+                                                      prepared->cose_algorithm_id,
+                                                      me->signing_key,
+                                                      tbs_hash,
+                                                      buffer_for_signature,
+                                                      &signature,
+                                                      me->restart_ctx);
+            } else
+#endif /* T_COSE_ENABLE_RESTARTABLE */
             /* Normal, non-short-circuit signing */
-            return_value = t_cose_crypto_pub_key_sign(me->cose_algorithm_id,
+            return_value = t_cose_crypto_pub_key_sign(prepared->cose_algorithm_id,
                                                       me->signing_key,
                                                       tbs_hash,
                                                       buffer_for_signature,
@@ -370,31 +763,60 @@ t_cose_sign1_encode_signature(struct t_cose_sign1_sign_ctx *me,
         } else {
     #ifndef T_COSE_DISABLE_SHORT_CIRCUIT_SIGN
             /* Short-circuit signing */
-            return_value = short_circuit_sign(me->cose_algorithm_id,
+            return_value = short_circuit_sign(prepared->cose_algorithm_id,
                                               tbs_hash,
                                               buffer_for_signature,
                                               &signature);
     #endif
         }
+    }
 
-        if(return_value) {
-            goto Done;
-        }
+    if(return_value) {
+        goto Done;
     }
 
     /* Add signature to CBOR and close out the array */
     QCBOREncode_AddBytes(cbor_encode_ctx, signature);
-    QCBOREncode_CloseArray(cbor_encode_ctx);
+    if(prepared->close_array) {
+        QCBOREncode_CloseArray(cbor_encode_ctx);
+    }
 
     /* The layer above this must check for and handle CBOR encoding
-     * errors CBOR encoding errors.  Some are detected at the start of
-     * this function, but they cannot all be deteced there.
+     * errors CBOR encoding errors.  Some are detected in
+     * t_cose_sign1_sign_prepare(), but they cannot all be deteced there.
      */
 Done:
     return return_value;
 }
 
 
+/*
+ * Public function. See t_cose_sign1_sign.h
+ */
+enum t_cose_err_t
+t_cose_sign1_encode_signature(struct t_cose_sign1_sign_ctx *me,
+                              QCBOREncodeContext           *cbor_encode_ctx)
+{
+    /* approximate stack use on 32-bit machine:
+     *   80 to 112 bytes for the prepared signature
+     *   Plus the larger of t_cose_sign1_sign_prepare() and
+     *   t_cose_sign1_sign_complete()
+     */
+    enum t_cose_err_t            return_value;
+    struct t_cose_sign1_prepared prepared;
+
+    return_value = t_cose_sign1_sign_prepare(me, cbor_encode_ctx, &prepared);
+    if(return_value) {
+        goto Done;
+    }
+
+    return_value = t_cose_sign1_sign_complete(me, &prepared, cbor_encode_ctx);
+
+Done:
+    return return_value;
+}
+
+
 /*
  * Public function. See t_cose_sign1_sign.h
  */
@@ -407,11 +829,30 @@ t_cose_sign1_sign(struct t_cose_sign1_sign_ctx *me,
     QCBOREncodeContext  encode_context;
     enum t_cose_err_t   return_value;
 
+#ifndef T_COSE_DISABLE_HASH_ENVELOPE
+    /* -- For a hash envelope the payload must be the hash -- */
+    if(me->payload_hash_alg_id != COSE_ALGORITHM_RESERVED &&
+       payload.len != hash_size_from_hash_alg_id(me->payload_hash_alg_id)) {
+        return_value = T_COSE_ERR_INVALID_ARGUMENT;
+        goto Done;
+    }
+#endif /* T_COSE_DISABLE_HASH_ENVELOPE */
+
     /* -- Initialize CBOR encoder context with output buffer -- */
     QCBOREncode_Init(&encode_context, out_buf);
 
     /* -- Output the header parameters into the encoder context -- */
-    return_value = t_cose_sign1_encode_parameters(me, &encode_context);
+    /* The payload length is known here, so the payload never has to
+     * be moved to insert the head of its byte string. */
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
+    return_value = t_cose_sign1_encode_parameters_incremental(me,
+                                                              payload.len,
+                                                             &encode_context);
+#else
+    return_value = t_cose_sign1_encode_parameters_known_length(me,
+                                                               payload.len,
+                                                              &encode_context);
+#endif
     if(return_value != T_COSE_SUCCESS) {
         goto Done;
     }
@@ -421,7 +862,14 @@ t_cose_sign1_sign(struct t_cose_sign1_sign_ctx *me,
      * function does the job just fine because it just adds bytes to
      * the encoded output without anything extra.
      */
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
+    /* Copied and hashed a block at a time for a single pass over it.
+     * Errors are caught in t_cose_sign1_encode_signature(), which
+     * must be called to release the hash context. */
+    (void)t_cose_sign1_add_payload_bytes(me, &encode_context, payload);
+#else
     QCBOREncode_AddEncoded(&encode_context, payload);
+#endif
 
     /* -- Sign and put signature in the encoder context -- */
     return_value = t_cose_sign1_encode_signature(me, &encode_context);
@@ -15,6 +15,8 @@
 #include "t_cose_crypto.h"
 #include "t_cose_util.h"
 #include "t_cose_parameters.h"
+#include "t_cose_verify_cache_internal.h"
+#include "t_cose_capture_internal.h"
 
 
 /**
@@ -29,6 +31,25 @@ t_cose_sign1_verify_init(struct t_cose_sign1_verify_ctx *me,
 {
     me->option_flags = option_flags;
     me->verification_key = T_COSE_NULL_KEY;
+    me->custom_params     = NULL;
+    me->num_custom_params = 0;
+#ifdef T_COSE_ENABLE_RESTARTABLE
+    me->restart_ctx = NULL;
+#endif
+#ifdef T_COSE_ENABLE_VERIFY_CACHE
+    me->verify_cache    = NULL;
+    me->cache_key_label = NULL_Q_USEFUL_BUF_C;
+    me->cache_snapshot  = NULL;
+#endif
+#ifdef T_COSE_ENABLE_RATE_LIMIT
+    me->rate_limit = NULL;
+#endif
+#ifndef T_COSE_DISABLE_PROTECTED_INTERN
+    me->intern_table = NULL;
+#endif
+#ifdef T_COSE_ENABLE_CAPTURE
+    me->capture = NULL;
+#endif
 }
 
 
@@ -37,7 +58,25 @@ t_cose_sign1_set_verification_key(struct t_cose_sign1_verify_ctx *me,
                                   struct t_cose_key               verification_key)
 {
     me->verification_key = verification_key;
+#ifdef T_COSE_ENABLE_VERIFY_CACHE
+    /* The label was for the old key. The cache is not used until a
+     * label for this key is set. */
+    me->cache_key_label = NULL_Q_USEFUL_BUF_C;
+#endif
+}
+
+
+#ifdef T_COSE_ENABLE_RESTARTABLE
+/*
+ * Public function. See t_cose_sign1_verify.h
+ */
+void
+t_cose_sign1_verify_set_restart_ctx(struct t_cose_sign1_verify_ctx *me,
+                                    struct t_cose_restart_ctx      *restart_ctx)
+{
+    me->restart_ctx = restart_ctx;
 }
+#endif /* T_COSE_ENABLE_RESTARTABLE */
 
 #ifndef T_COSE_DISABLE_SHORT_CIRCUIT_SIGN
 /**
@@ -104,10 +143,11 @@ t_cose_sign1_get_verification_pubkey(uint32_t key_handle,
  * Public function. See t_cose_sign1_verify.h
  */
 enum t_cose_err_t
-t_cose_sign1_verify(struct t_cose_sign1_verify_ctx *me,
-                    struct q_useful_buf_c           cose_sign1,
-                    struct q_useful_buf_c          *payload,
-                    struct t_cose_parameters       *parameters)
+t_cose_sign1_verify_prepare(struct t_cose_sign1_verify_ctx      *me,
+                            struct q_useful_buf_c                cose_sign1,
+                            struct q_useful_buf_c               *payload,
+                            struct t_cose_parameters            *parameters,
+                            struct t_cose_sign1_verify_prepared *prepared)
 {
     /* Stack use for 32-bit CPUs:
      *   268 for local except hash output
@@ -120,18 +160,15 @@ t_cose_sign1_verify(struct t_cose_sign1_verify_ctx *me,
     QCBORItem                     item;
     struct q_useful_buf_c         protected_parameters;
     enum t_cose_err_t             return_value;
-    Q_USEFUL_BUF_MAKE_STACK_UB(   buffer_for_tbs_hash, T_COSE_CRYPTO_MAX_HASH_SIZE);
     struct q_useful_buf_c         tbs_hash;
-    struct q_useful_buf_c         signature;
     struct t_cose_parameters      unprotected_parameters;
     struct t_cose_parameters      parsed_protected_parameters;
     struct t_cose_label_list      critical_labels;
     struct t_cose_label_list      unknown_labels;
-#ifndef T_COSE_DISABLE_SHORT_CIRCUIT_SIGN
-    struct q_useful_buf_c         short_circuit_kid;
-#endif
+    size_t                        custom_index;
 
     *payload = NULL_Q_USEFUL_BUF_C;
+    prepared->decode_only = false;
 
     QCBORDecode_Init(&decode_context, cose_sign1, QCBOR_DECODE_MODE_NORMAL);
     /* Calls to QCBORDecode_GetNext() rely on item.uDataType != QCBOR_TYPE_ARRAY
@@ -154,6 +191,11 @@ t_cose_sign1_verify(struct t_cose_sign1_verify_ctx *me,
     /* -- Clear list where uknown labels are accumulated -- */
     clear_label_list(&unknown_labels);
 
+    /* -- Mark all application parameters as not yet seen -- */
+    for(custom_index = 0; custom_index < me->num_custom_params; custom_index++) {
+        me->custom_params[custom_index].type = T_COSE_CUSTOM_PARAM_ABSENT;
+    }
+
 
     /* --  Get the protected header parameters -- */
     (void)QCBORDecode_GetNext(&decode_context, &item);
@@ -164,19 +206,35 @@ t_cose_sign1_verify(struct t_cose_sign1_verify_ctx *me,
 
     protected_parameters = item.val.string;
 
-    return_value = parse_protected_header_parameters(protected_parameters,
-                                                    &parsed_protected_parameters,
-                                                    &critical_labels,
-                                                    &unknown_labels);
-    if(return_value != T_COSE_SUCCESS) {
-        goto Done;
+#ifndef T_COSE_DISABLE_PROTECTED_INTERN
+    /* Most messages have one of a few protected headers that have
+     * been parsed before. */
+    if(find_interned_protected_parameters(me->intern_table,
+                                          protected_parameters,
+                                         &parsed_protected_parameters,
+                                         &critical_labels)) {
+        /* Nothing unknown or custom in an interned header */
+    } else
+#endif /* T_COSE_DISABLE_PROTECTED_INTERN */
+    {
+        return_value = parse_protected_header_parameters(protected_parameters,
+                                                        &parsed_protected_parameters,
+                                                        &critical_labels,
+                                                        &unknown_labels,
+                                                         me->custom_params,
+                                                         me->num_custom_params);
+        if(return_value != T_COSE_SUCCESS) {
+            goto Done;
+        }
     }
 
 
     /* --  Get the unprotected parameters -- */
     return_value = parse_unprotected_header_parameters(&decode_context,
                                                        &unprotected_parameters,
-                                                       &unknown_labels);
+                                                       &unknown_labels,
+                                                        me->custom_params,
+                                                        me->num_custom_params);
     if(return_value != T_COSE_SUCCESS) {
         goto Done;
     }
@@ -217,7 +275,10 @@ t_cose_sign1_verify(struct t_cose_sign1_verify_ctx *me,
         return_value = T_COSE_ERR_SIGN1_FORMAT;
         goto Done;
     }
-    signature = item.val.string;
+    prepared->signature            = item.val.string;
+    prepared->protected_parameters = protected_parameters;
+    prepared->cose_algorithm_id    = parsed_protected_parameters.cose_algorithm_id;
+    prepared->kid                  = unprotected_parameters.kid;
 
 
     /* -- Finish up the CBOR decode -- */
@@ -232,44 +293,185 @@ t_cose_sign1_verify(struct t_cose_sign1_verify_ctx *me,
 
     /* -- Skip signature verification if such is requested --*/
     if(me->option_flags & T_COSE_OPT_DECODE_ONLY) {
+        prepared->decode_only = true;
         return_value = T_COSE_SUCCESS;
         goto Done;
     }
 
 
+#ifdef T_COSE_ENABLE_RATE_LIMIT
+    /* -- Charge the kid before spending CPU on it -- */
+    if(me->rate_limit != NULL &&
+       !t_cose_rate_limit_take(me->rate_limit, prepared->kid)) {
+        return_value = T_COSE_ERR_RATE_LIMITED;
+        goto Done;
+    }
+#endif /* T_COSE_ENABLE_RATE_LIMIT */
+
+
     /* -- Compute the TBS bytes -- */
     return_value = create_tbs_hash(parsed_protected_parameters.cose_algorithm_id,
                                    protected_parameters,
                                    *payload,
-                                   buffer_for_tbs_hash,
+                                   (struct q_useful_buf){prepared->tbs_hash_bytes,
+                                                 sizeof(prepared->tbs_hash_bytes)},
                                    &tbs_hash);
     if(return_value) {
         goto Done;
     }
 
+    prepared->tbs_hash_len = tbs_hash.len;
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_sign1_verify.h
+ */
+enum t_cose_err_t
+t_cose_sign1_verify_complete(const struct t_cose_sign1_verify_ctx      *me,
+                             const struct t_cose_sign1_verify_prepared *prepared)
+{
+    enum t_cose_err_t              return_value;
+    struct q_useful_buf_c          tbs_hash;
+#ifndef T_COSE_DISABLE_SHORT_CIRCUIT_SIGN
+    struct q_useful_buf_c          short_circuit_kid;
+#endif
+#ifdef T_COSE_ENABLE_VERIFY_CACHE
+    struct t_cose_verify_cache_key cache_key;
+#endif
+
+    /* -- Nothing to do if the signature isn't to be verified -- */
+    if(prepared->decode_only) {
+        return_value = T_COSE_SUCCESS;
+        goto Done;
+    }
+
+    tbs_hash.ptr = prepared->tbs_hash_bytes;
+    tbs_hash.len = prepared->tbs_hash_len;
 
     /* -- Check for short-circuit signature and verify if it exists -- */
 #ifndef T_COSE_DISABLE_SHORT_CIRCUIT_SIGN
     short_circuit_kid = get_short_circuit_kid();
-    if(!q_useful_buf_compare(unprotected_parameters.kid, short_circuit_kid)) {
+    if(!q_useful_buf_compare(prepared->kid, short_circuit_kid)) {
         if(!(me->option_flags & T_COSE_OPT_ALLOW_SHORT_CIRCUIT)) {
             return_value = T_COSE_ERR_SHORT_CIRCUIT_SIG;
             goto Done;
         }
 
-        return_value = t_cose_crypto_short_circuit_verify(tbs_hash, signature);
+        T_COSE_COST_ADD(public_key_ops, 1);
+        return_value = t_cose_crypto_short_circuit_verify(tbs_hash,
+                                                          prepared->signature);
         goto Done;
     }
 #endif /* T_COSE_DISABLE_SHORT_CIRCUIT_SIGN */
 
 
+#ifdef T_COSE_ENABLE_VERIFY_CACHE
+    /* -- Skip the public key operation if verified before -- */
+    /* Without a label there's nothing in the cache entry to tell the
+     * verification key from another, so the cache isn't used. */
+    if(me->verify_cache != NULL && !q_useful_buf_c_is_empty(me->cache_key_label)) {
+        return_value = t_cose_verify_cache_make_key(tbs_hash,
+                                                    prepared->signature,
+                                                    prepared->kid,
+                                                    me->cache_key_label,
+                                                    &cache_key);
+        if(return_value) {
+            goto Done;
+        }
+        if(t_cose_verify_cache_lookup(me->verify_cache, &cache_key)) {
+            return_value = T_COSE_SUCCESS;
+            goto Done;
+        }
+        if(me->cache_snapshot != NULL &&
+           t_cose_verify_snapshot_lookup(me->cache_snapshot,
+                                         me->verify_cache,
+                                         &cache_key)) {
+            return_value = T_COSE_SUCCESS;
+            goto Done;
+        }
+    }
+#endif /* T_COSE_ENABLE_VERIFY_CACHE */
+
+
     /* -- Verify the signature (if it wasn't short-circuit) -- */
-    return_value = t_cose_crypto_pub_key_verify(parsed_protected_parameters.cose_algorithm_id,
+    T_COSE_COST_ADD(public_key_ops, 1);
+#ifdef T_COSE_ENABLE_RESTARTABLE
+    if(me->restart_ctx != NULL) {
+        /* May return T_COSE_ERR_SIG_IN_PROGRESS in which case the
+         * caller calls again with the same COSE_Sign1. */
+        return_value = t_cose_crypto_pub_key_verify_restartable(
+                                      prepared->cose_algorithm_id,
+                                      me->verification_key,
+                                      prepared->kid,
+                                      tbs_hash,
+                                      prepared->signature,
+                                      me->restart_ctx);
+    } else
+#endif /* T_COSE_ENABLE_RESTARTABLE */
+    return_value = t_cose_crypto_pub_key_verify(prepared->cose_algorithm_id,
                                                 me->verification_key,
-                                                unprotected_parameters.kid,
+                                                prepared->kid,
                                                 tbs_hash,
-                                                signature);
+                                                prepared->signature);
+
+#ifdef T_COSE_ENABLE_VERIFY_CACHE
+    if(return_value == T_COSE_SUCCESS && me->verify_cache != NULL &&
+       !q_useful_buf_c_is_empty(me->cache_key_label)) {
+        t_cose_verify_cache_insert(me->verify_cache, &cache_key);
+    }
+#endif /* T_COSE_ENABLE_VERIFY_CACHE */
 
 Done:
     return return_value;
 }
+
+
+/*
+ * Public function. See t_cose_sign1_verify.h
+ */
+enum t_cose_err_t
+t_cose_sign1_verify(struct t_cose_sign1_verify_ctx *me,
+                    struct q_useful_buf_c           cose_sign1,
+                    struct q_useful_buf_c          *payload,
+                    struct t_cose_parameters       *parameters)
+{
+    enum t_cose_err_t                   return_value;
+    struct t_cose_sign1_verify_prepared prepared;
+
+#ifdef T_COSE_ENABLE_CAPTURE
+    /* Parts not reached before an error are captured as absent */
+    prepared.cose_algorithm_id    = T_COSE_UNSET_ALGORITHM_ID;
+    prepared.protected_parameters = NULL_Q_USEFUL_BUF_C;
+    prepared.signature            = NULL_Q_USEFUL_BUF_C;
+    prepared.kid                  = NULL_Q_USEFUL_BUF_C;
+#endif /* T_COSE_ENABLE_CAPTURE */
+
+    return_value = t_cose_sign1_verify_prepare(me,
+                                               cose_sign1,
+                                               payload,
+                                               parameters,
+                                              &prepared);
+    if(return_value) {
+        goto Done;
+    }
+
+    return_value = t_cose_sign1_verify_complete(me, &prepared);
+
+Done:
+#ifdef T_COSE_ENABLE_CAPTURE
+    if(me->capture != NULL) {
+        t_cose_capture_verified(me->capture,
+                                me->option_flags,
+                                cose_sign1,
+                               *payload,
+                                parameters,
+                               &prepared,
+                                return_value);
+    }
+#endif /* T_COSE_ENABLE_CAPTURE */
+    return return_value;
+}
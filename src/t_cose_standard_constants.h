@@ -125,6 +125,62 @@
 #define COSE_HEADER_PARAM_COUNTER_SIGNATURE 6
 
 
+/**
+ * \def COSE_HEADER_PARAM_COUNTER_SIGNATURE_V2
+ *
+ * \brief CBOR map label of the unprotected parameter that holds one
+ * \c COSE_Countersignature or an array of them. See RFC 9338.
+ */
+#define COSE_HEADER_PARAM_COUNTER_SIGNATURE_V2 11
+
+
+/**
+ * \def COSE_HEADER_PARAM_PAYLOAD_HASH_ALG
+ *
+ * \brief CBOR map label of parameter giving the hash algorithm used
+ * for a COSE Hash Envelope.
+ *
+ * When present, the payload is not the content but the hash of it
+ * with this algorithm. The value is a COSE algorithm ID such as \ref
+ * COSE_ALGORITHM_SHA_256. This must be protected. See
+ * draft-ietf-cose-hash-envelope.
+ */
+#define COSE_HEADER_PARAM_PAYLOAD_HASH_ALG 258
+
+
+/**
+ * \def COSE_HEADER_PARAM_PAYLOAD_PREIMAGE_CONTENT_TYPE
+ *
+ * \brief CBOR map label of parameter giving the content type of the
+ * content that was hashed for a COSE Hash Envelope.
+ *
+ * Same as \ref COSE_HEADER_PARAM_CONTENT_TYPE, either a CoAP
+ * content-format integer or a MIME type text string.
+ */
+#define COSE_HEADER_PARAM_PAYLOAD_PREIMAGE_CONTENT_TYPE 259
+
+
+/**
+ * \def COSE_HEADER_PARAM_PAYLOAD_LOCATION
+ *
+ * \brief CBOR map label of parameter giving where the content that was
+ * hashed for a COSE Hash Envelope can be found.
+ *
+ * A text string, typically a URI.
+ */
+#define COSE_HEADER_PARAM_PAYLOAD_LOCATION 260
+
+/**
+ * \def COSE_HEADER_PARAM_EPHEMERAL_KEY
+ *
+ * \brief Label of header parameter with an ephemeral \c COSE_Key.
+ *
+ * In a \c COSE_recipient using ECDH-ES, the public key the sender
+ * generated for the key agreement. See RFC 9053 section 6.4.1.
+ */
+#define COSE_HEADER_PARAM_EPHEMERAL_KEY -1
+
+
 
 
 
@@ -217,6 +273,60 @@
  */
 #define COSE_ALGORITHM_SHA_512 -44
 
+/**
+ * \def COSE_ALGORITHM_A128GCM
+ *
+ * \brief Indicates AES-GCM with a 128-bit key.
+ *
+ * Value for \ref COSE_HEADER_PARAM_ALG to indicate AES-GCM with a
+ * 128-bit key and a 128-bit tag. See RFC 9053 section 4.1.
+ */
+#define COSE_ALGORITHM_A128GCM 1
+
+/**
+ * \def COSE_ALGORITHM_A192GCM
+ *
+ * \brief Indicates AES-GCM with a 192-bit key.
+ */
+#define COSE_ALGORITHM_A192GCM 2
+
+/**
+ * \def COSE_ALGORITHM_A256GCM
+ *
+ * \brief Indicates AES-GCM with a 256-bit key.
+ */
+#define COSE_ALGORITHM_A256GCM 3
+
+/**
+ * \def COSE_ALGORITHM_AES_CCM_16_64_128
+ *
+ * \brief Indicates AES-CCM with a 128-bit key, 64-bit tag and 13-byte
+ * nonce.
+ *
+ * See RFC 9053 section 4.2. This is the mandatory algorithm of OSCORE.
+ */
+#define COSE_ALGORITHM_AES_CCM_16_64_128 10
+
+/**
+ * \def COSE_ALGORITHM_A128KW
+ *
+ * \brief Indicates AES key wrap with a 128-bit key.
+ *
+ * See RFC 9053 section 6.2.1 and RFC 3394.
+ */
+#define COSE_ALGORITHM_A128KW -3
+
+/**
+ * \def COSE_ALGORITHM_ECDH_ES_A128KW
+ *
+ * \brief Indicates ECDH-ES with HKDF SHA-256 and AES key wrap.
+ *
+ * The key encryption key is derived from the ECDH shared secret with
+ * HKDF SHA-256 and used with \ref COSE_ALGORITHM_A128KW. See RFC 9053
+ * section 6.4.
+ */
+#define COSE_ALGORITHM_ECDH_ES_A128KW -29
+
 
 
 
@@ -402,4 +512,43 @@
 #define COSE_SIG_CONTEXT_STRING_SIGNATURE1 "Signature1"
 
 
+/**
+ * \def COSE_SIG_CONTEXT_STRING_SIGNATURE
+ *
+ * \brief This is a string constant used by COSE to label the
+ * signatures of \c COSE_Sign structures. See RFC 8152, section 4.4.
+ */
+#define COSE_SIG_CONTEXT_STRING_SIGNATURE "Signature"
+
+
+/**
+ * \def COSE_SIG_CONTEXT_STRING_COUNTER_SIGNATURE
+ *
+ * \brief This is a string constant used by COSE to label the
+ * to-be-signed bytes of a full countersignature. See RFC 9338,
+ * section 3.3.
+ */
+#define COSE_SIG_CONTEXT_STRING_COUNTER_SIGNATURE "CounterSignature"
+
+
+/**
+ * \def COSE_ENC_CONTEXT_STRING_ENCRYPT
+ *
+ * \brief This is a string constant used by COSE to label the
+ * additional authenticated data of a \c COSE_Encrypt. See RFC 9052,
+ * section 5.3.
+ */
+#define COSE_ENC_CONTEXT_STRING_ENCRYPT "Encrypt"
+
+
+/**
+ * \def COSE_ENC_CONTEXT_STRING_ENCRYPT0
+ *
+ * \brief This is a string constant used by COSE to label the
+ * additional authenticated data of a \c COSE_Encrypt0. See RFC 9052,
+ * section 5.3. OSCORE uses it too.
+ */
+#define COSE_ENC_CONTEXT_STRING_ENCRYPT0 "Encrypt0"
+
+
 #endif /* __T_COSE_STANDARD_CONSTANTS_H__ */
@@ -0,0 +1,777 @@
+/*
+ *  t_cose_suit.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifdef T_COSE_ENABLE_SUIT
+/* For fstat() and friends when compiling with -std=c99 */
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "qcbor/qcbor.h"
+#include "t_cose/t_cose_suit.h"
+#include "t_cose_crypto.h"
+#include "t_cose_util.h"
+#include "t_cose_parameters.h"
+#include "t_cose_standard_constants.h"
+
+#ifdef T_COSE_ENABLE_SUIT
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+
+/**
+ * \file t_cose_suit.c
+ *
+ * \brief Implementation of SUIT manifest and component image
+ * verification.
+ */
+
+
+#ifdef T_COSE_ENABLE_SUIT
+
+/* Map labels and command IDs from draft-ietf-suit-manifest */
+#define SUIT_ENVELOPE_AUTHENTICATION_WRAPPER 2
+#define SUIT_ENVELOPE_MANIFEST               3
+
+#define SUIT_MANIFEST_SEQUENCE_NUMBER        2
+#define SUIT_MANIFEST_COMMON                 3
+
+#define SUIT_COMMON_COMPONENTS               2
+#define SUIT_COMMON_SHARED_SEQUENCE          4
+
+#define SUIT_DIRECTIVE_SET_COMPONENT_INDEX  12
+#define SUIT_DIRECTIVE_SET_PARAMETERS       19
+#define SUIT_DIRECTIVE_OVERRIDE_PARAMETERS  20
+
+#define SUIT_PARAMETER_IMAGE_DIGEST          3
+#define SUIT_PARAMETER_IMAGE_SIZE           14
+
+
+/**
+ * Size of the part of an image that is mapped at one time. It must
+ * be a multiple of the page size.
+ */
+#ifndef T_COSE_SUIT_MAP_WINDOW
+#define T_COSE_SUIT_MAP_WINDOW (64 * 1024 * 1024)
+#endif
+
+
+/* A bit per component is used for the components selected by
+ * set-component-index. */
+#if T_COSE_SUIT_MAX_COMPONENTS > 64
+#error T_COSE_SUIT_MAX_COMPONENTS must be 64 or less
+#endif
+
+
+/**
+ * \brief Find an entry with an integer label in an encoded map.
+ *
+ * \param[in] encoded_map  The encoded map.
+ * \param[in] label        The label to find.
+ * \param[out] found       The entry. Its \c uDataType is
+ *                         \c QCBOR_TYPE_NONE if it is not in the map.
+ *
+ * \retval T_COSE_ERR_SUIT_FORMAT  \c encoded_map is not a well-formed
+ *                                 map or has \c label twice.
+ *
+ * Strings in \c found point into \c encoded_map. Maps and arrays
+ * don't have their contents, only their count.
+ */
+static enum t_cose_err_t
+find_in_map(struct q_useful_buf_c  encoded_map,
+            int64_t                label,
+            QCBORItem             *found)
+{
+    enum t_cose_err_t  return_value;
+    QCBORDecodeContext decode_context;
+    QCBORItem          item;
+    uint_fast8_t       map_nest_level;
+    uint_fast8_t       next_nest_level;
+
+    found->uDataType = QCBOR_TYPE_NONE;
+
+    QCBORDecode_Init(&decode_context, encoded_map, QCBOR_DECODE_MODE_NORMAL);
+
+    (void)QCBORDecode_GetNext(&decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_MAP) {
+        return_value = T_COSE_ERR_SUIT_FORMAT;
+        goto Done;
+    }
+
+    map_nest_level  = item.uNestingLevel;
+    next_nest_level = item.uNextNestLevel;
+    while(next_nest_level > map_nest_level) {
+        if(QCBORDecode_GetNext(&decode_context, &item) != QCBOR_SUCCESS) {
+            return_value = T_COSE_ERR_SUIT_FORMAT;
+            goto Done;
+        }
+        if(item.uLabelType == QCBOR_TYPE_INT64 && item.label.int64 == label) {
+            if(found->uDataType != QCBOR_TYPE_NONE) {
+                return_value = T_COSE_ERR_SUIT_FORMAT;
+                goto Done;
+            }
+            *found = item;
+        }
+        if(consume_item(&decode_context, &item, &next_nest_level)) {
+            return_value = T_COSE_ERR_SUIT_FORMAT;
+            goto Done;
+        }
+    }
+
+    if(QCBORDecode_Finish(&decode_context) != QCBOR_SUCCESS) {
+        return_value = T_COSE_ERR_SUIT_FORMAT;
+        goto Done;
+    }
+
+    return_value = T_COSE_SUCCESS;
+
+Done:
+    return return_value;
+}
+
+
+/**
+ * \brief Get an unsigned integer from a decoded item.
+ *
+ * \param[in] item    The item.
+ * \param[out] value  The integer.
+ *
+ * \return \c false if \c item is not a non-negative integer.
+ */
+static inline bool
+get_uint(const QCBORItem *item, uint64_t *value)
+{
+    if(item->uDataType == QCBOR_TYPE_INT64 && item->val.int64 >= 0) {
+        *value = (uint64_t)item->val.int64;
+        return true;
+    }
+    if(item->uDataType == QCBOR_TYPE_UINT64) {
+        *value = item->val.uint64;
+        return true;
+    }
+    return false;
+}
+
+
+/**
+ * \brief Decode a SUIT_Digest.
+ *
+ * \param[in] encoded_digest  The encoded SUIT_Digest.
+ * \param[out] alg_id         COSE ID of the hash algorithm.
+ * \param[out] digest         The digest bytes.
+ *
+ * \retval T_COSE_ERR_SUIT_FORMAT  It is not an array of an integer
+ *                                 and a byte string.
+ */
+static enum t_cose_err_t
+decode_digest(struct q_useful_buf_c  encoded_digest,
+              int32_t               *alg_id,
+              struct q_useful_buf_c *digest)
+{
+    enum t_cose_err_t  return_value;
+    QCBORDecodeContext decode_context;
+    QCBORItem          item;
+
+    return_value = T_COSE_ERR_SUIT_FORMAT;
+
+    QCBORDecode_Init(&decode_context, encoded_digest, QCBOR_DECODE_MODE_NORMAL);
+
+    (void)QCBORDecode_GetNext(&decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_ARRAY || item.val.uCount != 2) {
+        goto Done;
+    }
+
+    (void)QCBORDecode_GetNext(&decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_INT64 ||
+       item.val.int64 < INT32_MIN || item.val.int64 > INT32_MAX) {
+        goto Done;
+    }
+    *alg_id = (int32_t)item.val.int64;
+
+    (void)QCBORDecode_GetNext(&decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+        goto Done;
+    }
+    *digest = item.val.string;
+
+    if(QCBORDecode_Finish(&decode_context) != QCBOR_SUCCESS) {
+        goto Done;
+    }
+
+    return_value = T_COSE_SUCCESS;
+
+Done:
+    return return_value;
+}
+
+
+/**
+ * \brief Decode the parameters of a set- or override-parameters directive.
+ *
+ * \param[in] decode_context    Context positioned after the map item.
+ * \param[in] map_item          The map of parameters.
+ * \param[in] selected          Bit mask of the components they are for.
+ * \param[in] override          Whether they replace ones already set.
+ * \param[in,out] manifest      Manifest to set them in.
+ * \param[out] next_nest_level  Nesting level of the item after the map.
+ *
+ * \return This returns one of the error codes defined by \ref t_cose_err_t.
+ */
+static enum t_cose_err_t
+decode_parameters(QCBORDecodeContext          *decode_context,
+                  const QCBORItem             *map_item,
+                  uint64_t                     selected,
+                  bool                         override,
+                  struct t_cose_suit_manifest *manifest,
+                  uint_fast8_t                *next_nest_level)
+{
+    enum t_cose_err_t             return_value;
+    QCBORItem                     item;
+    uint_fast8_t                  map_nest_level;
+    int32_t                       digest_alg_id;
+    struct q_useful_buf_c         digest;
+    uint64_t                      image_size;
+    struct t_cose_suit_component *component;
+    size_t                        i;
+
+    map_nest_level   = map_item->uNestingLevel;
+    *next_nest_level = map_item->uNextNestLevel;
+    while(*next_nest_level > map_nest_level) {
+        if(QCBORDecode_GetNext(decode_context, &item) != QCBOR_SUCCESS) {
+            return_value = T_COSE_ERR_SUIT_FORMAT;
+            goto Done;
+        }
+
+        if(item.uLabelType == QCBOR_TYPE_INT64 &&
+           item.label.int64 == SUIT_PARAMETER_IMAGE_DIGEST) {
+            /* The digest is a byte string wrapping a SUIT_Digest */
+            if(item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+                return_value = T_COSE_ERR_SUIT_FORMAT;
+                goto Done;
+            }
+            return_value = decode_digest(item.val.string, &digest_alg_id, &digest);
+            if(return_value) {
+                goto Done;
+            }
+            for(i = 0; i < manifest->num_components; i++) {
+                component = &manifest->components[i];
+                if((selected & ((uint64_t)1 << i)) &&
+                   (override || q_useful_buf_c_is_null(component->digest))) {
+                    component->digest_alg_id = digest_alg_id;
+                    component->digest        = digest;
+                }
+            }
+
+        } else if(item.uLabelType == QCBOR_TYPE_INT64 &&
+                  item.label.int64 == SUIT_PARAMETER_IMAGE_SIZE) {
+            if(!get_uint(&item, &image_size)) {
+                return_value = T_COSE_ERR_SUIT_FORMAT;
+                goto Done;
+            }
+            for(i = 0; i < manifest->num_components; i++) {
+                component = &manifest->components[i];
+                if((selected & ((uint64_t)1 << i)) &&
+                   (override || !component->has_image_size)) {
+                    component->has_image_size = true;
+                    component->image_size     = image_size;
+                }
+            }
+        }
+
+        if(consume_item(decode_context, &item, next_nest_level)) {
+            return_value = T_COSE_ERR_SUIT_FORMAT;
+            goto Done;
+        }
+    }
+
+    return_value = T_COSE_SUCCESS;
+
+Done:
+    return return_value;
+}
+
+
+/**
+ * \brief Decode the image parameters set by a command sequence.
+ *
+ * \param[in] sequence      The encoded SUIT_Command_Sequence.
+ * \param[in,out] manifest  Manifest to set them in.
+ *
+ * \return This returns one of the error codes defined by \ref t_cose_err_t.
+ *
+ * A command sequence is an array of command IDs each followed by its
+ * argument. Component 0 is selected until set-component-index
+ * selects others.
+ */
+static enum t_cose_err_t
+decode_command_sequence(struct q_useful_buf_c        sequence,
+                        struct t_cose_suit_manifest *manifest)
+{
+    enum t_cose_err_t  return_value;
+    QCBORDecodeContext decode_context;
+    QCBORItem          item;
+    QCBORItem          argument;
+    uint_fast8_t       array_nest_level;
+    uint_fast8_t       next_nest_level;
+    uint64_t           selected;
+    uint64_t           index;
+    uint16_t           i;
+
+    QCBORDecode_Init(&decode_context, sequence, QCBOR_DECODE_MODE_NORMAL);
+
+    (void)QCBORDecode_GetNext(&decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_ARRAY) {
+        return_value = T_COSE_ERR_SUIT_FORMAT;
+        goto Done;
+    }
+
+    selected = 1;
+
+    array_nest_level = item.uNestingLevel;
+    next_nest_level  = item.uNextNestLevel;
+    while(next_nest_level > array_nest_level) {
+        (void)QCBORDecode_GetNext(&decode_context, &item);
+        if(item.uDataType != QCBOR_TYPE_INT64 ||
+           item.uNextNestLevel <= array_nest_level) {
+            /* Not a command ID or no argument after it */
+            return_value = T_COSE_ERR_SUIT_FORMAT;
+            goto Done;
+        }
+        if(QCBORDecode_GetNext(&decode_context, &argument) != QCBOR_SUCCESS) {
+            return_value = T_COSE_ERR_SUIT_FORMAT;
+            goto Done;
+        }
+
+        switch(item.val.int64) {
+        case SUIT_DIRECTIVE_SET_COMPONENT_INDEX:
+            /* An index, true for all or an array of indexes */
+            next_nest_level = argument.uNextNestLevel;
+            if(argument.uDataType == QCBOR_TYPE_TRUE) {
+                selected = UINT64_MAX;
+            } else if(get_uint(&argument, &index) && index < manifest->num_components) {
+                selected = (uint64_t)1 << index;
+            } else if(argument.uDataType == QCBOR_TYPE_ARRAY) {
+                selected = 0;
+                for(i = 0; i < argument.val.uCount; i++) {
+                    (void)QCBORDecode_GetNext(&decode_context, &item);
+                    if(!get_uint(&item, &index) || index >= manifest->num_components) {
+                        return_value = T_COSE_ERR_SUIT_FORMAT;
+                        goto Done;
+                    }
+                    selected |= (uint64_t)1 << index;
+                    next_nest_level = item.uNextNestLevel;
+                }
+            } else {
+                return_value = T_COSE_ERR_SUIT_FORMAT;
+                goto Done;
+            }
+            break;
+
+        case SUIT_DIRECTIVE_SET_PARAMETERS:
+        case SUIT_DIRECTIVE_OVERRIDE_PARAMETERS:
+            if(argument.uDataType != QCBOR_TYPE_MAP) {
+                return_value = T_COSE_ERR_SUIT_FORMAT;
+                goto Done;
+            }
+            return_value = decode_parameters(&decode_context,
+                                             &argument,
+                                             selected,
+                                             item.val.int64 == SUIT_DIRECTIVE_OVERRIDE_PARAMETERS,
+                                             manifest,
+                                             &next_nest_level);
+            if(return_value) {
+                goto Done;
+            }
+            break;
+
+        default:
+            /* Conditions and other directives aren't needed to
+             * check the images */
+            if(consume_item(&decode_context, &argument, &next_nest_level)) {
+                return_value = T_COSE_ERR_SUIT_FORMAT;
+                goto Done;
+            }
+            break;
+        }
+    }
+
+    if(QCBORDecode_Finish(&decode_context) != QCBOR_SUCCESS) {
+        return_value = T_COSE_ERR_SUIT_FORMAT;
+        goto Done;
+    }
+
+    return_value = T_COSE_SUCCESS;
+
+Done:
+    return return_value;
+}
+
+
+/**
+ * \brief Decode what is needed to check the images from a manifest.
+ *
+ * \param[in,out] manifest  Manifest with \c manifest set to decode.
+ *
+ * \return This returns one of the error codes defined by \ref t_cose_err_t.
+ */
+static enum t_cose_err_t
+decode_manifest(struct t_cose_suit_manifest *manifest)
+{
+    enum t_cose_err_t     return_value;
+    QCBORItem             item;
+    struct q_useful_buf_c common;
+    size_t                i;
+
+    /* -- Sequence number -- */
+    return_value = find_in_map(manifest->manifest,
+                               SUIT_MANIFEST_SEQUENCE_NUMBER,
+                               &item);
+    if(return_value) {
+        goto Done;
+    }
+    if(!get_uint(&item, &manifest->sequence_number)) {
+        return_value = T_COSE_ERR_SUIT_FORMAT;
+        goto Done;
+    }
+
+    /* -- Common section -- */
+    return_value = find_in_map(manifest->manifest, SUIT_MANIFEST_COMMON, &item);
+    if(return_value) {
+        goto Done;
+    }
+    if(item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+        return_value = T_COSE_ERR_SUIT_FORMAT;
+        goto Done;
+    }
+    common = item.val.string;
+
+    /* -- Number of components -- */
+    return_value = find_in_map(common, SUIT_COMMON_COMPONENTS, &item);
+    if(return_value) {
+        goto Done;
+    }
+    if(item.uDataType != QCBOR_TYPE_ARRAY || item.val.uCount == 0) {
+        return_value = T_COSE_ERR_SUIT_FORMAT;
+        goto Done;
+    }
+    if(item.val.uCount > T_COSE_SUIT_MAX_COMPONENTS) {
+        return_value = T_COSE_ERR_TOO_MANY_PARAMETERS;
+        goto Done;
+    }
+    manifest->num_components = item.val.uCount;
+    for(i = 0; i < manifest->num_components; i++) {
+        manifest->components[i].digest_alg_id  = COSE_ALGORITHM_RESERVED;
+        manifest->components[i].digest         = NULL_Q_USEFUL_BUF_C;
+        manifest->components[i].has_image_size = false;
+        manifest->components[i].image_size     = 0;
+        manifest->components[i].path           = NULL;
+        manifest->components[i].result         = T_COSE_SUCCESS;
+    }
+
+    /* -- Image parameters from the shared sequence -- */
+    return_value = find_in_map(common, SUIT_COMMON_SHARED_SEQUENCE, &item);
+    if(return_value || item.uDataType == QCBOR_TYPE_NONE) {
+        goto Done;
+    }
+    if(item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+        return_value = T_COSE_ERR_SUIT_FORMAT;
+        goto Done;
+    }
+    return_value = decode_command_sequence(item.val.string, manifest);
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_suit.h
+ */
+enum t_cose_err_t
+t_cose_suit_verify_envelope(struct t_cose_sign1_verify_ctx *verify_ctx,
+                            struct q_useful_buf_c           envelope,
+                            struct t_cose_suit_manifest    *manifest)
+{
+    enum t_cose_err_t         return_value;
+    QCBORDecodeContext        decode_context;
+    QCBORItem                 item;
+    struct q_useful_buf_c     encoded_digest;
+    struct q_useful_buf_c     cose_sign1;
+    struct q_useful_buf_c     payload;
+    int32_t                   digest_alg_id;
+    struct q_useful_buf_c     expected_digest;
+    struct t_cose_crypto_hash hash_ctx;
+    Q_USEFUL_BUF_MAKE_STACK_UB(head_buffer, QCBOR_HEAD_BUFFER_SIZE);
+    Q_USEFUL_BUF_MAKE_STACK_UB(buffer_for_hash, T_COSE_CRYPTO_MAX_HASH_SIZE);
+    struct q_useful_buf_c     computed_digest;
+
+    /* -- Find the authentication wrapper and the manifest -- */
+    return_value = find_in_map(envelope, SUIT_ENVELOPE_MANIFEST, &item);
+    if(return_value) {
+        goto Done;
+    }
+    if(item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+        return_value = T_COSE_ERR_SUIT_FORMAT;
+        goto Done;
+    }
+    manifest->manifest = item.val.string;
+
+    return_value = find_in_map(envelope, SUIT_ENVELOPE_AUTHENTICATION_WRAPPER, &item);
+    if(return_value) {
+        goto Done;
+    }
+    if(item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+        return_value = T_COSE_ERR_SUIT_FORMAT;
+        goto Done;
+    }
+
+    /* -- The digest and the first authentication block -- */
+    QCBORDecode_Init(&decode_context, item.val.string, QCBOR_DECODE_MODE_NORMAL);
+    (void)QCBORDecode_GetNext(&decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_ARRAY || item.val.uCount < 2) {
+        return_value = T_COSE_ERR_SUIT_FORMAT;
+        goto Done;
+    }
+    (void)QCBORDecode_GetNext(&decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+        return_value = T_COSE_ERR_SUIT_FORMAT;
+        goto Done;
+    }
+    encoded_digest = item.val.string;
+    (void)QCBORDecode_GetNext(&decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+        return_value = T_COSE_ERR_SUIT_FORMAT;
+        goto Done;
+    }
+    cose_sign1 = item.val.string;
+
+    /* -- Verify the signature over the digest -- */
+    return_value = t_cose_sign1_verify(verify_ctx, cose_sign1, &payload, NULL);
+    if(return_value) {
+        goto Done;
+    }
+    if(q_useful_buf_compare(payload, encoded_digest)) {
+        return_value = T_COSE_ERR_PAYLOAD_HASH_MISMATCH;
+        goto Done;
+    }
+
+    /* -- Check the digest of the manifest --
+     * It is over the byte string wrapping the manifest, head and all. */
+    return_value = decode_digest(encoded_digest, &digest_alg_id, &expected_digest);
+    if(return_value) {
+        goto Done;
+    }
+    return_value = t_cose_crypto_hash_start(&hash_ctx, digest_alg_id);
+    if(return_value) {
+        goto Done;
+    }
+    t_cose_crypto_hash_update(&hash_ctx,
+                              QCBOREncode_EncodeHead(head_buffer,
+                                                     CBOR_MAJOR_TYPE_BYTE_STRING,
+                                                     0,
+                                                     manifest->manifest.len));
+    t_cose_crypto_hash_update(&hash_ctx, manifest->manifest);
+    return_value = t_cose_crypto_hash_finish(&hash_ctx, buffer_for_hash, &computed_digest);
+    if(return_value) {
+        goto Done;
+    }
+    /* The digest is not secret so the comparison need not be constant time */
+    if(q_useful_buf_compare(computed_digest, expected_digest)) {
+        return_value = T_COSE_ERR_PAYLOAD_HASH_MISMATCH;
+        goto Done;
+    }
+
+    /* -- What is needed to check the images -- */
+    return_value = decode_manifest(manifest);
+
+Done:
+    return return_value;
+}
+
+
+/**
+ * Hashing of one image by t_cose_suit_check_components().
+ */
+struct image_task {
+    struct t_cose_suit_component *component;
+    int                           fd;
+    off_t                         size;
+    /* Shared by all the tasks. Set when one fails. */
+    int                          *stop;
+};
+
+
+/**
+ * \brief Hash an image and compare it to its digest. This is a
+ * \ref t_cose_task_fn.
+ *
+ * \param[in,out] task  The \ref image_task.
+ */
+static void
+image_task_run(void *task)
+{
+    struct image_task            *image_task = (struct image_task *)task;
+    struct t_cose_suit_component *component  = image_task->component;
+    enum t_cose_err_t             return_value;
+    enum t_cose_err_t             finish_result;
+    struct t_cose_crypto_hash     hash_ctx;
+    Q_USEFUL_BUF_MAKE_STACK_UB(   buffer_for_hash, T_COSE_CRYPTO_MAX_HASH_SIZE);
+    struct q_useful_buf_c         computed_digest;
+
+    return_value = t_cose_crypto_hash_start(&hash_ctx, component->digest_alg_id);
+    if(return_value) {
+        goto Done;
+    }
+
+    /* A mismatch in one image stops the others */
+    return_value = hash_mapped_file(image_task->fd,
+                                    image_task->size,
+                                    T_COSE_SUIT_MAP_WINDOW,
+                                    image_task->stop,
+                                    &hash_ctx);
+
+    /* Always finish so the crypto adapter can release any resources
+     * held by the hash context, even if hashing was stopped. */
+    finish_result = t_cose_crypto_hash_finish(&hash_ctx, buffer_for_hash, &computed_digest);
+    if(return_value == T_COSE_SUCCESS) {
+        return_value = finish_result;
+    }
+    if(return_value == T_COSE_SUCCESS &&
+       q_useful_buf_compare(computed_digest, component->digest)) {
+        return_value = T_COSE_ERR_PAYLOAD_HASH_MISMATCH;
+    }
+
+Done:
+    if(return_value != T_COSE_SUCCESS && return_value != T_COSE_ERR_ABORTED) {
+        __atomic_store_n(image_task->stop, 1, __ATOMIC_RELAXED);
+    }
+    close(image_task->fd);
+    component->result = return_value;
+}
+
+
+/**
+ * \brief Open an image and check its size.
+ *
+ * \param[in] component  The component with the image.
+ * \param[out] task      Task to hash it.
+ *
+ * \return This returns one of the error codes defined by \ref t_cose_err_t.
+ *
+ * The file is left open in \c task only when this succeeds.
+ */
+static enum t_cose_err_t
+open_image(struct t_cose_suit_component *component,
+           struct image_task            *task)
+{
+    enum t_cose_err_t return_value;
+    struct stat       file_status;
+
+    if(q_useful_buf_c_is_null(component->digest)) {
+        return_value = T_COSE_ERR_SUIT_FORMAT;
+        goto Done;
+    }
+    if(hash_size_from_hash_alg_id(component->digest_alg_id) == 0) {
+        return_value = T_COSE_ERR_UNSUPPORTED_HASH;
+        goto Done;
+    }
+
+    task->component = component;
+    task->fd = open(component->path, O_RDONLY);
+    if(task->fd < 0) {
+        return_value = T_COSE_ERR_ARTIFACT_ACCESS;
+        goto Done;
+    }
+    if(fstat(task->fd, &file_status) || !S_ISREG(file_status.st_mode)) {
+        return_value = T_COSE_ERR_ARTIFACT_ACCESS;
+        goto CloseFile;
+    }
+    task->size = file_status.st_size;
+
+    if(component->has_image_size && (uint64_t)task->size != component->image_size) {
+        return_value = T_COSE_ERR_PAYLOAD_HASH_MISMATCH;
+        goto CloseFile;
+    }
+
+    return_value = T_COSE_SUCCESS;
+    goto Done;
+
+CloseFile:
+    close(task->fd);
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_suit.h
+ */
+enum t_cose_err_t
+t_cose_suit_check_components(struct t_cose_suit_manifest *manifest,
+                             t_cose_parallel_cb           parallel_cb,
+                             void                        *cb_context)
+{
+    enum t_cose_err_t             return_value;
+    struct image_task             tasks[T_COSE_SUIT_MAX_COMPONENTS];
+    struct t_cose_suit_component *component;
+    size_t                        num_tasks;
+    size_t                        i;
+    int                           stop;
+
+    /* -- Open all the images and check their sizes first -- */
+    return_value = T_COSE_SUCCESS;
+    num_tasks    = 0;
+    stop         = 0;
+    for(i = 0; i < manifest->num_components; i++) {
+        component = &manifest->components[i];
+        component->result = T_COSE_SUCCESS;
+        if(component->path == NULL) {
+            continue;
+        }
+        component->result = open_image(component, &tasks[num_tasks]);
+        if(component->result) {
+            if(return_value == T_COSE_SUCCESS) {
+                return_value = component->result;
+            }
+            continue;
+        }
+        tasks[num_tasks].stop = &stop;
+        num_tasks++;
+    }
+    if(return_value) {
+        for(i = 0; i < num_tasks; i++) {
+            close(tasks[i].fd);
+            tasks[i].component->result = T_COSE_ERR_ABORTED;
+        }
+        goto Done;
+    }
+
+    /* -- Hash them all at once -- */
+    if(parallel_cb == NULL) {
+        parallel_cb = t_cose_parallel_run_serial;
+    }
+    (*parallel_cb)(cb_context, image_task_run, tasks, sizeof(tasks[0]), num_tasks);
+
+    /* -- First failure in component order -- */
+    for(i = 0; i < manifest->num_components; i++) {
+        return_value = manifest->components[i].result;
+        if(return_value != T_COSE_SUCCESS && return_value != T_COSE_ERR_ABORTED) {
+            goto Done;
+        }
+    }
+    return_value = T_COSE_SUCCESS;
+
+Done:
+    return return_value;
+}
+
+#endif /* T_COSE_ENABLE_SUIT */
@@ -8,12 +8,21 @@
  * See BSD-3-Clause license in README.md
  */
 
+#if defined(T_COSE_ENABLE_HASH_ENVELOPE_FILE) || defined(T_COSE_ENABLE_SUIT)
+/* For mmap() and friends when compiling with -std=c99 */
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include "qcbor/qcbor.h"
 #include "t_cose/t_cose_common.h"
 #include "t_cose_util.h"
 #include "t_cose_standard_constants.h"
 #include "t_cose_crypto.h"
 
+#if defined(T_COSE_ENABLE_HASH_ENVELOPE_FILE) || defined(T_COSE_ENABLE_SUIT)
+#include <sys/mman.h>
+#endif
+
 
 /**
  * \file t_cose_util.c
@@ -49,16 +58,32 @@ int32_t hash_alg_id_from_sig_alg_id(int32_t cose_algorithm_id)
 }
 
 
+/*
+ * Public function. See t_cose_util.h
+ */
+size_t hash_size_from_hash_alg_id(int32_t cose_hash_alg_id)
+{
+    return cose_hash_alg_id == COSE_ALGORITHM_SHA_256 ? T_COSE_CRYPTO_SHA256_SIZE :
+#ifndef T_COSE_DISABLE_ES384
+           cose_hash_alg_id == COSE_ALGORITHM_SHA_384 ? T_COSE_CRYPTO_SHA384_SIZE :
+#endif
+#ifndef T_COSE_DISABLE_ES512
+           cose_hash_alg_id == COSE_ALGORITHM_SHA_512 ? T_COSE_CRYPTO_SHA512_SIZE :
+#endif
+                                                        0;
+}
+
+
 
 
 /**
- * \brief Hash an encoded bstr without actually encoding it in memory
+ * \brief Hash the head of an encoded bstr without encoding it in memory
  *
  * @param hash_ctx  Hash context to hash it into
- * @param bstr      Bytes of the bstr
+ * @param len       Length of the bstr
  */
-static void hash_bstr(struct t_cose_crypto_hash *hash_ctx,
-                      struct q_useful_buf_c      bstr)
+static void hash_bstr_head(struct t_cose_crypto_hash *hash_ctx,
+                           size_t                     len)
 {
     /* make a struct q_useful_buf on the stack of size QCBOR_HEAD_BUFFER_SIZE */
     Q_USEFUL_BUF_MAKE_STACK_UB (buffer_for_encoded_head, QCBOR_HEAD_BUFFER_SIZE);
@@ -67,11 +92,25 @@ static void hash_bstr(struct t_cose_crypto_hash *hash_ctx,
     encoded_head = QCBOREncode_EncodeHead(buffer_for_encoded_head,
                                           CBOR_MAJOR_TYPE_BYTE_STRING,
                                           0,
-                                          bstr.len);
+                                          len);
 
-    /* An encoded bstr is the CBOR head with its length followed by the bytes */
     t_cose_crypto_hash_update(hash_ctx, encoded_head);
+}
+
+
+/**
+ * \brief Hash an encoded bstr without actually encoding it in memory
+ *
+ * @param hash_ctx  Hash context to hash it into
+ * @param bstr      Bytes of the bstr
+ */
+static void hash_bstr(struct t_cose_crypto_hash *hash_ctx,
+                      struct q_useful_buf_c      bstr)
+{
+    /* An encoded bstr is the CBOR head with its length followed by the bytes */
+    hash_bstr_head(hash_ctx, bstr.len);
     t_cose_crypto_hash_update(hash_ctx, bstr);
+    T_COSE_COST_ADD(hash_bytes, bstr.len);
 }
 
 
@@ -79,7 +118,7 @@ static void hash_bstr(struct t_cose_crypto_hash *hash_ctx,
  * Public function. See t_cose_util.h
  */
 /*
- * Format of to-be-signed bytes used by create_tbs_hash().  This is
+ * Format of to-be-signed bytes used by start_tbs_hash().  This is
  * defined in COSE (RFC 8152) section 4.4. It is the input to the
  * hash.
  *
@@ -99,19 +138,12 @@ static void hash_bstr(struct t_cose_crypto_hash *hash_ctx,
  *
 
  */
-enum t_cose_err_t create_tbs_hash(int32_t                cose_algorithm_id,
-                                  struct q_useful_buf_c  protected_parameters,
-                                  struct q_useful_buf_c  payload,
-                                  struct q_useful_buf    buffer_for_hash,
-                                  struct q_useful_buf_c *hash)
+enum t_cose_err_t start_tbs_hash(int32_t                    cose_algorithm_id,
+                                 struct q_useful_buf_c      protected_parameters,
+                                 size_t                     payload_len,
+                                 struct t_cose_crypto_hash *hash_ctx)
 {
-    /* approximate stack use on 32-bit machine:
-     *    210 bytes for all but hash context
-     *    8 to 224 of hash context depending on hash implementation
-     *    220 to 434 bytes total
-     */
     enum t_cose_err_t           return_value;
-    struct t_cose_crypto_hash   hash_ctx;
     int32_t                     hash_alg_id;
 
     /* Start the hashing */
@@ -119,7 +151,7 @@ enum t_cose_err_t create_tbs_hash(int32_t                cose_algorithm_id,
     /* Don't check hash_alg_id for failure. t_cose_crypto_hash_start()
      * will handle error properly. It was also checked earlier.
      */
-    return_value = t_cose_crypto_hash_start(&hash_ctx, hash_alg_id);
+    return_value = t_cose_crypto_hash_start(hash_ctx, hash_alg_id);
     if(return_value) {
         goto Done;
     }
@@ -151,16 +183,259 @@ enum t_cose_err_t create_tbs_hash(int32_t                cose_algorithm_id,
 
     /* Hand-constructed CBOR for the array of 4 and the context string.
      * \x84 is an array of 4. \x6A is a text string of 10 bytes. */
-    t_cose_crypto_hash_update(&hash_ctx, Q_USEFUL_BUF_FROM_SZ_LITERAL("\x84\x6A" COSE_SIG_CONTEXT_STRING_SIGNATURE1));
+    t_cose_crypto_hash_update(hash_ctx, Q_USEFUL_BUF_FROM_SZ_LITERAL("\x84\x6A" COSE_SIG_CONTEXT_STRING_SIGNATURE1));
 
     /* body_protected */
-    hash_bstr(&hash_ctx, protected_parameters);
+    hash_bstr(hash_ctx, protected_parameters);
 
     /* external_aad which is an empty string since it is not supported here */
-    hash_bstr(&hash_ctx, NULL_Q_USEFUL_BUF_C);
+    hash_bstr(hash_ctx, NULL_Q_USEFUL_BUF_C);
+
+    /* The head of the payload. The payload itself is hashed by the caller. */
+    hash_bstr_head(hash_ctx, payload_len);
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_util.h
+ *
+ * The to-be-signed bytes of a countersignature on a COSE_Sign1 are
+ * defined in RFC 9338 section 3.3.
+ *
+ * Countersign_structure = [
+ *    context : "CounterSignature",
+ *    body_protected : empty_or_serialized_map,
+ *    sign_protected : empty_or_serialized_map,
+ *    external_aad : bstr,
+ *    payload : bstr,
+ *    other_fields : [ signature : bstr ]
+ * ]
+ *
+ * body_protected is from the COSE_Sign1 and sign_protected from the
+ * countersignature. other_fields is the signature of the COSE_Sign1.
+ */
+enum t_cose_err_t
+start_countersign_hash(int32_t                    cose_algorithm_id,
+                       struct q_useful_buf_c      body_protected,
+                       struct q_useful_buf_c      sign_protected,
+                       size_t                     payload_len,
+                       struct t_cose_crypto_hash *hash_ctx)
+{
+    enum t_cose_err_t return_value;
+
+    return_value = t_cose_crypto_hash_start(hash_ctx,
+                                            hash_alg_id_from_sig_alg_id(cose_algorithm_id));
+    if(return_value) {
+        goto Done;
+    }
+
+    /* \x86 is an array of 6. \x70 is a text string of 16 bytes. */
+    t_cose_crypto_hash_update(hash_ctx, Q_USEFUL_BUF_FROM_SZ_LITERAL("\x86\x70" COSE_SIG_CONTEXT_STRING_COUNTER_SIGNATURE));
+    hash_bstr(hash_ctx, body_protected);
+    hash_bstr(hash_ctx, sign_protected);
+    /* external_aad is not supported */
+    hash_bstr(hash_ctx, NULL_Q_USEFUL_BUF_C);
+    hash_bstr_head(hash_ctx, payload_len);
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_util.h
+ */
+enum t_cose_err_t
+finish_countersign_hash(struct t_cose_crypto_hash *hash_ctx,
+                        struct q_useful_buf_c      target_signature,
+                        struct q_useful_buf        buffer_for_hash,
+                        struct q_useful_buf_c     *hash)
+{
+    /* other_fields, \x81 is an array of 1 */
+    t_cose_crypto_hash_update(hash_ctx, Q_USEFUL_BUF_FROM_SZ_LITERAL("\x81"));
+    hash_bstr(hash_ctx, target_signature);
+
+    return t_cose_crypto_hash_finish(hash_ctx, buffer_for_hash, hash);
+}
+
+
+/*
+ * Public function. See t_cose_util.h
+ *
+ * The to-be-signed bytes of one signer of a COSE_Sign are the
+ * Sig_structure of RFC 9052 section 4.4 with the "Signature" context
+ * and the sign_protected field.
+ */
+enum t_cose_err_t
+start_sign_hash(int32_t                    cose_algorithm_id,
+                struct q_useful_buf_c      body_protected,
+                struct q_useful_buf_c      sign_protected,
+                size_t                     payload_len,
+                struct t_cose_crypto_hash *hash_ctx)
+{
+    enum t_cose_err_t return_value;
+
+    return_value = t_cose_crypto_hash_start(hash_ctx,
+                                            hash_alg_id_from_sig_alg_id(cose_algorithm_id));
+    if(return_value) {
+        goto Done;
+    }
+
+    /* \x85 is an array of 5. \x69 is a text string of 9 bytes. */
+    t_cose_crypto_hash_update(hash_ctx, Q_USEFUL_BUF_FROM_SZ_LITERAL("\x85\x69" COSE_SIG_CONTEXT_STRING_SIGNATURE));
+    hash_bstr(hash_ctx, body_protected);
+    hash_bstr(hash_ctx, sign_protected);
+    /* external_aad is not supported */
+    hash_bstr(hash_ctx, NULL_Q_USEFUL_BUF_C);
+    hash_bstr_head(hash_ctx, payload_len);
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_util.h
+ */
+void
+abandon_hashes(struct t_cose_crypto_hash *hash_ctxs, size_t num_hash_ctxs)
+{
+    struct q_useful_buf_c unused;
+    size_t                i;
+    Q_USEFUL_BUF_MAKE_STACK_UB(buffer_for_hash, T_COSE_CRYPTO_MAX_HASH_SIZE);
+
+    for(i = 0; i < num_hash_ctxs; i++) {
+        (void)t_cose_crypto_hash_finish(&hash_ctxs[i], buffer_for_hash, &unused);
+    }
+}
+
+
+/*
+ * Public function. See t_cose_util.h
+ */
+enum t_cose_err_t
+append_bytes(struct q_useful_buf    out_buffer,
+             size_t                *offset,
+             struct q_useful_buf_c  bytes)
+{
+    if(q_useful_buf_c_is_null(useful_buf_copy_offset(out_buffer, *offset, bytes))) {
+        return T_COSE_ERR_TOO_SMALL;
+    }
+    *offset += bytes.len;
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function. See t_cose_util.h
+ */
+enum t_cose_err_t
+append_head(struct q_useful_buf out_buffer,
+            size_t             *offset,
+            uint8_t             major_type,
+            uint64_t            argument)
+{
+    Q_USEFUL_BUF_MAKE_STACK_UB(head_buffer, QCBOR_HEAD_BUFFER_SIZE);
+
+    return append_bytes(out_buffer,
+                        offset,
+                        QCBOREncode_EncodeHead(head_buffer,
+                                               major_type,
+                                               0,
+                                               argument));
+}
+
+
+#if defined(T_COSE_ENABLE_HASH_ENVELOPE_FILE) || defined(T_COSE_ENABLE_SUIT)
+/*
+ * Public function. See t_cose_util.h
+ */
+enum t_cose_err_t
+hash_mapped_file(int                        fd,
+                 off_t                      size,
+                 size_t                     window_size,
+                 const int                 *stop,
+                 struct t_cose_crypto_hash *hash_ctx)
+{
+    enum t_cose_err_t     return_value;
+    off_t                 offset;
+    size_t                window_len;
+    void                 *window;
+    struct q_useful_buf_c chunk;
+    size_t                chunk_offset;
+
+    return_value = T_COSE_SUCCESS;
+
+    for(offset = 0; offset < size; offset += (off_t)window_len) {
+        window_len = window_size;
+        if(size - offset < (off_t)window_len) {
+            window_len = (size_t)(size - offset);
+        }
+
+        window = mmap(NULL, window_len, PROT_READ, MAP_PRIVATE, fd, offset);
+        if(window == MAP_FAILED) {
+            return_value = T_COSE_ERR_ARTIFACT_ACCESS;
+            break;
+        }
+        /* Only advisory; hashing reads each page once front to back */
+        (void)posix_madvise(window, window_len, POSIX_MADV_SEQUENTIAL);
+
+        for(chunk_offset = 0; chunk_offset < window_len; chunk_offset += chunk.len) {
+            /* A stale read only delays stopping by a chunk */
+            if(stop != NULL && __atomic_load_n(stop, __ATOMIC_RELAXED)) {
+                return_value = T_COSE_ERR_ABORTED;
+                break;
+            }
+            chunk.ptr = (const uint8_t *)window + chunk_offset;
+            chunk.len = window_len - chunk_offset;
+            if(stop != NULL && chunk.len > T_COSE_HASH_MAPPED_FILE_CHUNK) {
+                chunk.len = T_COSE_HASH_MAPPED_FILE_CHUNK;
+            }
+            t_cose_crypto_hash_update(hash_ctx, chunk);
+        }
+
+        munmap(window, window_len);
+        if(return_value) {
+            break;
+        }
+    }
+
+    return return_value;
+}
+#endif /* T_COSE_ENABLE_HASH_ENVELOPE_FILE || T_COSE_ENABLE_SUIT */
+
+
+/*
+ * Public function. See t_cose_util.h
+ */
+enum t_cose_err_t create_tbs_hash(int32_t                cose_algorithm_id,
+                                  struct q_useful_buf_c  protected_parameters,
+                                  struct q_useful_buf_c  payload,
+                                  struct q_useful_buf    buffer_for_hash,
+                                  struct q_useful_buf_c *hash)
+{
+    /* approximate stack use on 32-bit machine:
+     *    210 bytes for all but hash context
+     *    8 to 224 of hash context depending on hash implementation
+     *    220 to 434 bytes total
+     */
+    enum t_cose_err_t           return_value;
+    struct t_cose_crypto_hash   hash_ctx;
+
+    return_value = start_tbs_hash(cose_algorithm_id,
+                                  protected_parameters,
+                                  payload.len,
+                                  &hash_ctx);
+    if(return_value) {
+        goto Done;
+    }
 
     /* payload */
-    hash_bstr(&hash_ctx, payload);
+    t_cose_crypto_hash_update(&hash_ctx, payload);
+    T_COSE_COST_ADD(hash_bytes, payload.len);
 
     /* Finish the hash and set up to return it */
     return_value = t_cose_crypto_hash_finish(&hash_ctx,
@@ -197,3 +472,15 @@ struct q_useful_buf_c get_short_circuit_kid(void)
     return short_circuit_kid;
 }
 #endif
+
+
+#ifdef T_COSE_ENABLE_RESTARTABLE
+/*
+ * Public function. See t_cose_common.h
+ */
+void t_cose_restart_ctx_abort(struct t_cose_restart_ctx *restart_ctx)
+{
+    t_cose_crypto_restart_free(restart_ctx);
+    restart_ctx->crypto_ctx = NULL;
+}
+#endif /* T_COSE_ENABLE_RESTARTABLE */
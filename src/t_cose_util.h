@@ -15,6 +15,7 @@
 #include <stdint.h>
 #include "t_cose/q_useful_buf.h"
 #include "t_cose/t_cose_common.h"
+#include "t_cose/t_cose_cost.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -28,6 +29,22 @@ extern "C" {
  */
 
 
+/**
+ * \brief Add to one of the verification cost counters.
+ *
+ * \param[in] counter  Name of the member of \ref t_cose_cost.
+ * \param[in] n        Amount to add.
+ *
+ * This compiles to nothing unless \c T_COSE_ENABLE_COST_COUNTERS is
+ * defined. See t_cose_cost.h.
+ */
+#ifdef T_COSE_ENABLE_COST_COUNTERS
+#define T_COSE_COST_ADD(counter, n) (t_cose_cost_counters.counter += (uint64_t)(n))
+#else
+#define T_COSE_COST_ADD(counter, n)
+#endif
+
+
 /**
  * This value represents an invalid or in-error algorithm ID.  The
  * value selected is 0 as this is reserved in the IANA COSE algorithm
@@ -65,6 +82,18 @@ extern "C" {
 int32_t hash_alg_id_from_sig_alg_id(int32_t cose_algorithm_id);
 
 
+/**
+ * \brief Return the size of the output of a hash algorithm.
+ *
+ * \param[in] cose_hash_alg_id  A COSE hash algorithm identifier such as
+ *                              \ref COSE_ALGORITHM_SHA_256.
+ *
+ * \return The size in bytes or 0 if the hash algorithm is not known
+ *         or is disabled.
+ */
+size_t hash_size_from_hash_alg_id(int32_t cose_hash_alg_id);
+
+
 /**
  * \brief Create the hash of the to-be-signed (TBS) bytes for COSE.
  *
@@ -104,6 +133,192 @@ enum t_cose_err_t create_tbs_hash(int32_t                     cose_algorithm_id,
 
 
 
+struct t_cose_crypto_hash;
+
+/**
+ * \brief Start the hash of the to-be-signed (TBS) bytes for COSE.
+ *
+ * \param[in] cose_algorithm_id     The COSE signing algorithm ID.
+ * \param[in] protected_parameters  Full, CBOR encoded, protected parameters.
+ * \param[in] payload_len           Length of the payload.
+ * \param[out] hash_ctx             The hash context to start.
+ *
+ * \return This returns one of the error codes defined by \ref t_cose_err_t.
+ *
+ * This hashes everything in the TBS bytes that comes before the
+ * payload. The caller hashes exactly \c payload_len bytes of payload
+ * with t_cose_crypto_hash_update() and then calls
+ * t_cose_crypto_hash_finish(). The result is the same as from
+ * create_tbs_hash(). This allows the payload to be hashed in pieces
+ * as it is produced.
+ */
+enum t_cose_err_t start_tbs_hash(int32_t                    cose_algorithm_id,
+                                 struct q_useful_buf_c      protected_parameters,
+                                 size_t                     payload_len,
+                                 struct t_cose_crypto_hash *hash_ctx);
+
+
+/**
+ * \brief Start the hash of the to-be-signed bytes of a countersignature.
+ *
+ * \param[in] cose_algorithm_id  The COSE signing algorithm ID of the
+ *                               countersignature.
+ * \param[in] body_protected     Protected parameters of the \c COSE_Sign1
+ *                               being countersigned.
+ * \param[in] sign_protected     Protected parameters of the
+ *                               countersignature.
+ * \param[in] payload_len        Length of the payload.
+ * \param[out] hash_ctx          The hash context to start.
+ *
+ * \return This returns one of the error codes defined by \ref t_cose_err_t.
+ *
+ * This is the same as start_tbs_hash() but for the
+ * Countersign_structure of RFC 9338. The caller hashes the payload
+ * and then calls finish_countersign_hash().
+ */
+enum t_cose_err_t
+start_countersign_hash(int32_t                    cose_algorithm_id,
+                       struct q_useful_buf_c      body_protected,
+                       struct q_useful_buf_c      sign_protected,
+                       size_t                     payload_len,
+                       struct t_cose_crypto_hash *hash_ctx);
+
+
+/**
+ * \brief Finish the hash of the to-be-signed bytes of a countersignature.
+ *
+ * \param[in] hash_ctx          Context from start_countersign_hash() with
+ *                              the payload hashed.
+ * \param[in] target_signature  Signature of the \c COSE_Sign1 being
+ *                              countersigned.
+ * \param[in] buffer_for_hash   Buffer the hash is written to.
+ * \param[out] hash             The hash.
+ *
+ * \return This returns one of the error codes defined by \ref t_cose_err_t.
+ */
+enum t_cose_err_t
+finish_countersign_hash(struct t_cose_crypto_hash *hash_ctx,
+                        struct q_useful_buf_c      target_signature,
+                        struct q_useful_buf        buffer_for_hash,
+                        struct q_useful_buf_c     *hash);
+
+
+/**
+ * \brief Start the hash of the to-be-signed bytes of one signer of a
+ * \c COSE_Sign.
+ *
+ * \param[in] cose_algorithm_id  The COSE signing algorithm ID of the
+ *                               signer.
+ * \param[in] body_protected     Protected parameters of the \c COSE_Sign.
+ * \param[in] sign_protected     Protected parameters of the signer.
+ * \param[in] payload_len        Length of the payload.
+ * \param[out] hash_ctx          The hash context to start.
+ *
+ * \return This returns one of the error codes defined by \ref t_cose_err_t.
+ *
+ * This is the same as start_tbs_hash() but for the Sig_structure of
+ * a \c COSE_Sign, which has the protected parameters of the signer.
+ * The caller hashes the payload and calls t_cose_crypto_hash_finish().
+ */
+enum t_cose_err_t
+start_sign_hash(int32_t                    cose_algorithm_id,
+                struct q_useful_buf_c      body_protected,
+                struct q_useful_buf_c      sign_protected,
+                size_t                     payload_len,
+                struct t_cose_crypto_hash *hash_ctx);
+
+
+/**
+ * \brief Finish hash contexts whose hashes are not needed.
+ *
+ * \param[in] hash_ctxs      The started hash contexts.
+ * \param[in] num_hash_ctxs  The number of them.
+ *
+ * When one of several hashes fails, the others that were started are
+ * finished with this so the crypto adapter can release what it holds
+ * for them.
+ */
+void
+abandon_hashes(struct t_cose_crypto_hash *hash_ctxs, size_t num_hash_ctxs);
+
+
+/**
+ * \brief Append bytes to the output.
+ *
+ * \param[in] out_buffer  The output buffer.
+ * \param[in,out] offset  Where to append. Advanced past the bytes.
+ * \param[in] bytes       The bytes.
+ *
+ * \retval T_COSE_ERR_TOO_SMALL  They don't fit.
+ *
+ * This and append_head() are for CBOR put together by hand from parts
+ * that are already encoded.
+ */
+enum t_cose_err_t
+append_bytes(struct q_useful_buf    out_buffer,
+             size_t                *offset,
+             struct q_useful_buf_c  bytes);
+
+
+/**
+ * \brief Append a CBOR head to the output.
+ *
+ * \param[in] out_buffer  The output buffer.
+ * \param[in,out] offset  Where to append. Advanced past the head.
+ * \param[in] major_type  The CBOR major type.
+ * \param[in] argument    The argument of the head.
+ *
+ * \retval T_COSE_ERR_TOO_SMALL  It doesn't fit.
+ */
+enum t_cose_err_t
+append_head(struct q_useful_buf out_buffer,
+            size_t             *offset,
+            uint8_t             major_type,
+            uint64_t            argument);
+
+
+#if defined(T_COSE_ENABLE_HASH_ENVELOPE_FILE) || defined(T_COSE_ENABLE_SUIT)
+
+#include <sys/types.h>
+
+/**
+ * Amount of a file hashed by hash_mapped_file() between checks of
+ * whether to stop. Stopping takes at most about the time to hash
+ * this much.
+ */
+#define T_COSE_HASH_MAPPED_FILE_CHUNK (1024 * 1024)
+
+
+/**
+ * \brief Hash a regular file by mapping a window at a time.
+ *
+ * \param[in] fd           Open file descriptor.
+ * \param[in] size         Size of the file.
+ * \param[in] window_size  Size of the part mapped at one time. It must
+ *                         be a multiple of the page size.
+ * \param[in] stop         Flag set by another thread to stop hashing
+ *                         or \c NULL.
+ * \param[in] hash_ctx     Started hash context to add the contents to.
+ *
+ * \retval T_COSE_ERR_ARTIFACT_ACCESS  The file could not be mapped.
+ * \retval T_COSE_ERR_ABORTED          \c *stop was set.
+ *
+ * Mapping a window at a time bounds the address space used, so files
+ * larger than the address space of a 32-bit process can be hashed.
+ * The hash context is not finished, even on error. This uses the GCC
+ * / Clang \c __atomic builtins when \c stop is not \c NULL.
+ */
+enum t_cose_err_t
+hash_mapped_file(int                        fd,
+                 off_t                      size,
+                 size_t                     window_size,
+                 const int                 *stop,
+                 struct t_cose_crypto_hash *hash_ctx);
+
+#endif /* T_COSE_ENABLE_HASH_ENVELOPE_FILE || T_COSE_ENABLE_SUIT */
+
+
+
 
 #ifndef T_COSE_DISABLE_SHORT_CIRCUIT_SIGN
 
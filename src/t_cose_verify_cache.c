@@ -0,0 +1,828 @@
+/*
+ *  t_cose_verify_cache.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifdef T_COSE_ENABLE_VERIFY_SNAPSHOT_FILE
+/* For mmap() and friends when compiling with -std=c99 */
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "t_cose/t_cose_verify_cache.h"
+#include "t_cose_verify_cache_internal.h"
+#include "t_cose_crypto.h"
+#include "t_cose_standard_constants.h"
+#include <string.h>
+#include <stdlib.h>
+#ifdef T_COSE_ENABLE_VERIFY_SNAPSHOT_FILE
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+/**
+ * \file t_cose_verify_cache.c
+ *
+ * \brief Implementation of the shared verification cache.
+ *
+ * The memory layout is a struct t_cose_verify_cache followed by
+ * bucket_count struct verify_cache_bucket. Offsets are all computed
+ * from the start of the memory so it works wherever it is mapped.
+ *
+ * Each bucket has a sequence number. Zero means the bucket has never
+ * been written. Odd means a writer is in the middle of updating it.
+ * A writer takes the bucket by a compare-and-swap of the sequence
+ * number from even to odd, writes the entry and then releases it by
+ * storing the next even number. A reader reads the sequence number,
+ * the entry and the sequence number again; if they differ or are odd
+ * the read raced with a writer and is counted as contended. Neither
+ * side ever waits.
+ *
+ * A snapshot is in the byte order of the machine that wrote it. One
+ * from a machine of the other byte order fails the magic number
+ * check. It is a struct
+ * verify_snapshot_header followed by entry_count struct
+ * verify_snapshot_entry sorted by key so it can be binary searched
+ * where it is mapped without being copied or parsed.
+ */
+
+
+#ifdef T_COSE_ENABLE_VERIFY_CACHE
+
+#define VERIFY_CACHE_MAGIC   0x54435643 /* "TCVC" */
+#define VERIFY_CACHE_VERSION 2
+
+/* How many buckets past the home bucket are searched */
+#define VERIFY_CACHE_PROBE_LIMIT 8
+
+/* The counters are each on their own cache line so that processes
+ * updating different counters don't contend for the same line. */
+#define VERIFY_CACHE_LINE_SIZE 64
+
+struct verify_cache_counter {
+    uint64_t value;
+    uint8_t  pad[VERIFY_CACHE_LINE_SIZE - sizeof(uint64_t)];
+};
+
+
+/* This is the start of the caller's memory. No pointers are allowed
+ * in here. */
+struct t_cose_verify_cache {
+    uint32_t                    magic;
+    uint32_t                    version;
+    uint32_t                    bucket_count;
+    uint32_t                    now;
+    uint8_t                     pad[VERIFY_CACHE_LINE_SIZE - 4 * sizeof(uint32_t)];
+    struct verify_cache_counter hits;
+    struct verify_cache_counter misses;
+    struct verify_cache_counter inserts;
+    struct verify_cache_counter evictions;
+    struct verify_cache_counter contended;
+    struct verify_cache_counter restored;
+    /* The buckets follow */
+};
+
+
+struct verify_cache_bucket {
+    uint32_t seq;
+    /* Time the entry was added, see t_cose_verify_cache_set_time() */
+    uint32_t stamp;
+    uint64_t words[T_COSE_VERIFY_CACHE_KEY_WORDS];
+};
+
+
+#define VERIFY_SNAPSHOT_MAGIC   0x53564354 /* "TCVS" */
+#define VERIFY_SNAPSHOT_VERSION 1
+
+struct verify_snapshot_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t saved_time;
+    uint32_t max_age;
+    uint32_t reserved;
+    /* Over the rest of the header and all the entries */
+    uint64_t checksum;
+};
+
+struct verify_snapshot_entry {
+    uint32_t stamp;
+    uint32_t reserved;
+    uint64_t words[T_COSE_VERIFY_CACHE_KEY_WORDS];
+};
+
+
+static inline struct verify_cache_bucket *
+get_buckets(struct t_cose_verify_cache *cache)
+{
+    return (struct verify_cache_bucket *)(cache + 1);
+}
+
+
+static inline void count(struct verify_cache_counter *counter)
+{
+    __atomic_fetch_add(&counter->value, 1, __ATOMIC_RELAXED);
+}
+
+
+static inline bool is_power_of_two(uint32_t n)
+{
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+
+/*
+ * Public function. See t_cose_verify_cache.h
+ */
+size_t t_cose_verify_cache_size(uint32_t bucket_count)
+{
+    if(!is_power_of_two(bucket_count)) {
+        return 0;
+    }
+    return sizeof(struct t_cose_verify_cache) +
+           (size_t)bucket_count * sizeof(struct verify_cache_bucket);
+}
+
+
+/*
+ * Public function. See t_cose_verify_cache.h
+ */
+enum t_cose_err_t
+t_cose_verify_cache_format(struct q_useful_buf          memory,
+                           uint32_t                     bucket_count,
+                           struct t_cose_verify_cache **cache)
+{
+    struct t_cose_verify_cache *new_cache;
+    const size_t                size = t_cose_verify_cache_size(bucket_count);
+
+    if(size == 0 || ((uintptr_t)memory.ptr % sizeof(uint64_t)) != 0) {
+        return T_COSE_ERR_INVALID_ARGUMENT;
+    }
+    if(memory.len < size) {
+        return T_COSE_ERR_TOO_SMALL;
+    }
+
+    /* All buckets get sequence number 0, empty */
+    memset(memory.ptr, 0, size);
+
+    new_cache = (struct t_cose_verify_cache *)memory.ptr;
+    new_cache->version      = VERIFY_CACHE_VERSION;
+    new_cache->bucket_count = bucket_count;
+    /* Written last so an attacher never sees a half-made header */
+    __atomic_store_n(&new_cache->magic, VERIFY_CACHE_MAGIC, __ATOMIC_RELEASE);
+
+    *cache = new_cache;
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function. See t_cose_verify_cache.h
+ */
+enum t_cose_err_t
+t_cose_verify_cache_attach(struct q_useful_buf          memory,
+                           struct t_cose_verify_cache **cache)
+{
+    struct t_cose_verify_cache *existing;
+    size_t                      size;
+
+    if(memory.len < sizeof(struct t_cose_verify_cache) ||
+       ((uintptr_t)memory.ptr % sizeof(uint64_t)) != 0) {
+        return T_COSE_ERR_INVALID_ARGUMENT;
+    }
+
+    existing = (struct t_cose_verify_cache *)memory.ptr;
+    if(__atomic_load_n(&existing->magic, __ATOMIC_ACQUIRE) != VERIFY_CACHE_MAGIC ||
+       existing->version != VERIFY_CACHE_VERSION) {
+        return T_COSE_ERR_INVALID_ARGUMENT;
+    }
+    size = t_cose_verify_cache_size(existing->bucket_count);
+    if(size == 0) {
+        return T_COSE_ERR_INVALID_ARGUMENT;
+    }
+    if(memory.len < size) {
+        return T_COSE_ERR_TOO_SMALL;
+    }
+
+    *cache = existing;
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function. See t_cose_verify_cache.h
+ */
+void
+t_cose_verify_cache_get_stats(const struct t_cose_verify_cache  *cache,
+                              struct t_cose_verify_cache_stats *stats)
+{
+    stats->hits         = __atomic_load_n(&cache->hits.value, __ATOMIC_RELAXED);
+    stats->misses       = __atomic_load_n(&cache->misses.value, __ATOMIC_RELAXED);
+    stats->inserts      = __atomic_load_n(&cache->inserts.value, __ATOMIC_RELAXED);
+    stats->evictions    = __atomic_load_n(&cache->evictions.value, __ATOMIC_RELAXED);
+    stats->contended    = __atomic_load_n(&cache->contended.value, __ATOMIC_RELAXED);
+    stats->restored     = __atomic_load_n(&cache->restored.value, __ATOMIC_RELAXED);
+    stats->bucket_count = cache->bucket_count;
+}
+
+
+/*
+ * Public function. See t_cose_verify_cache.h
+ */
+void
+t_cose_verify_cache_set_time(struct t_cose_verify_cache *cache,
+                             uint32_t                    now)
+{
+    __atomic_store_n(&cache->now, now, __ATOMIC_RELAXED);
+}
+
+
+/* Feed a length-prefixed field to the hash so fields can't run together */
+static void hash_field(struct t_cose_crypto_hash *hash_ctx,
+                       struct q_useful_buf_c      field)
+{
+    uint8_t len_bytes[4];
+
+    len_bytes[0] = (uint8_t)(field.len >> 24);
+    len_bytes[1] = (uint8_t)(field.len >> 16);
+    len_bytes[2] = (uint8_t)(field.len >> 8);
+    len_bytes[3] = (uint8_t)field.len;
+
+    t_cose_crypto_hash_update(hash_ctx,
+                              (struct q_useful_buf_c){len_bytes, sizeof(len_bytes)});
+    if(field.len) {
+        t_cose_crypto_hash_update(hash_ctx, field);
+    }
+}
+
+
+/*
+ * Public function. See t_cose_verify_cache_internal.h
+ */
+enum t_cose_err_t
+t_cose_verify_cache_make_key(struct q_useful_buf_c           tbs_hash,
+                             struct q_useful_buf_c           signature,
+                             struct q_useful_buf_c           kid,
+                             struct q_useful_buf_c           key_label,
+                             struct t_cose_verify_cache_key *key)
+{
+    enum t_cose_err_t         return_value;
+    struct t_cose_crypto_hash hash_ctx;
+    Q_USEFUL_BUF_MAKE_STACK_UB(buffer_for_hash, T_COSE_CRYPTO_SHA256_SIZE);
+    struct q_useful_buf_c     hash;
+
+    return_value = t_cose_crypto_hash_start(&hash_ctx, COSE_ALGORITHM_SHA_256);
+    if(return_value) {
+        goto Done;
+    }
+    hash_field(&hash_ctx, tbs_hash);
+    hash_field(&hash_ctx, signature);
+    hash_field(&hash_ctx, kid);
+    hash_field(&hash_ctx, key_label);
+    return_value = t_cose_crypto_hash_finish(&hash_ctx, buffer_for_hash, &hash);
+    if(return_value) {
+        goto Done;
+    }
+
+    memcpy(key->words, hash.ptr, sizeof(key->words));
+
+    /* All zero is never stored so that an empty bucket can't match.
+     * The chance of a SHA-256 being zero is negligible, but be sure. */
+    key->words[0] |= 1;
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Read a bucket without locking.
+ *
+ * Returns the sequence number if a consistent copy was read into
+ * words or 1 (odd) if the read raced with a writer.
+ */
+static uint32_t read_bucket(struct verify_cache_bucket *bucket,
+                            uint64_t                    words[T_COSE_VERIFY_CACHE_KEY_WORDS],
+                            uint32_t                   *stamp)
+{
+    uint32_t seq_before;
+    uint32_t seq_after;
+    int      i;
+
+    seq_before = __atomic_load_n(&bucket->seq, __ATOMIC_ACQUIRE);
+    if(seq_before & 1) {
+        return 1;
+    }
+    for(i = 0; i < T_COSE_VERIFY_CACHE_KEY_WORDS; i++) {
+        words[i] = __atomic_load_n(&bucket->words[i], __ATOMIC_RELAXED);
+    }
+    *stamp = __atomic_load_n(&bucket->stamp, __ATOMIC_RELAXED);
+    /* Keep the reads of the words before the second read of seq */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    seq_after = __atomic_load_n(&bucket->seq, __ATOMIC_RELAXED);
+
+    return seq_before == seq_after ? seq_before : 1;
+}
+
+
+static inline bool
+words_match(const uint64_t words[T_COSE_VERIFY_CACHE_KEY_WORDS],
+            const struct t_cose_verify_cache_key *key)
+{
+    return words[0] == key->words[0] && words[1] == key->words[1] &&
+           words[2] == key->words[2] && words[3] == key->words[3];
+}
+
+
+/*
+ * Public function. See t_cose_verify_cache_internal.h
+ */
+bool
+t_cose_verify_cache_lookup(struct t_cose_verify_cache           *cache,
+                           const struct t_cose_verify_cache_key *key)
+{
+    struct verify_cache_bucket *buckets = get_buckets(cache);
+    const uint32_t              mask    = cache->bucket_count - 1;
+    uint64_t                    words[T_COSE_VERIFY_CACHE_KEY_WORDS];
+    uint32_t                    index;
+    uint32_t                    probe;
+    uint32_t                    seq;
+    uint32_t                    stamp;
+
+    index = (uint32_t)key->words[0] & mask;
+    for(probe = 0; probe < VERIFY_CACHE_PROBE_LIMIT; probe++) {
+        seq = read_bucket(&buckets[(index + probe) & mask], words, &stamp);
+        if(seq == 0) {
+            /* Entries are never removed so the first empty bucket
+             * ends the search */
+            break;
+        }
+        if(seq & 1) {
+            count(&cache->contended);
+            continue;
+        }
+        if(words_match(words, key)) {
+            count(&cache->hits);
+            return true;
+        }
+    }
+
+    count(&cache->misses);
+    return false;
+}
+
+
+/*
+ * Add an entry with the given time. Entries restored from a snapshot
+ * keep the time they were first added so they expire as they would
+ * have.
+ */
+static void
+insert_stamped(struct t_cose_verify_cache           *cache,
+               const struct t_cose_verify_cache_key *key,
+               uint32_t                              stamp)
+{
+    struct verify_cache_bucket *buckets = get_buckets(cache);
+    const uint32_t              mask    = cache->bucket_count - 1;
+    struct verify_cache_bucket *bucket;
+    uint64_t                    words[T_COSE_VERIFY_CACHE_KEY_WORDS];
+    uint32_t                    index;
+    uint32_t                    probe;
+    uint32_t                    seq;
+    uint32_t                    next_seq;
+    uint32_t                    old_stamp;
+    int                         i;
+
+    index = (uint32_t)key->words[0] & mask;
+
+    /* Find an empty bucket or this same entry put in by another
+     * process. If the probe window is full, replace a bucket in it
+     * chosen by other bits of the key so that hot entries in a full
+     * window don't all evict the same one. */
+    for(probe = 0; probe < VERIFY_CACHE_PROBE_LIMIT; probe++) {
+        seq = read_bucket(&buckets[(index + probe) & mask], words, &old_stamp);
+        if(seq == 0) {
+            break;
+        }
+        if(!(seq & 1) && words_match(words, key)) {
+            return;
+        }
+    }
+    if(probe == VERIFY_CACHE_PROBE_LIMIT) {
+        probe = (uint32_t)(key->words[1] % VERIFY_CACHE_PROBE_LIMIT);
+        count(&cache->evictions);
+    }
+    bucket = &buckets[(index + probe) & mask];
+
+    /* Take the bucket by making seq odd */
+    seq = __atomic_load_n(&bucket->seq, __ATOMIC_RELAXED);
+    if((seq & 1) ||
+       !__atomic_compare_exchange_n(&bucket->seq, &seq, seq + 1, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        /* Another writer has it. Skip rather than wait. */
+        count(&cache->contended);
+        return;
+    }
+    /* The odd seq must be visible before any of the words change */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for(i = 0; i < T_COSE_VERIFY_CACHE_KEY_WORDS; i++) {
+        __atomic_store_n(&bucket->words[i], key->words[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&bucket->stamp, stamp, __ATOMIC_RELAXED);
+
+    /* Zero is reserved for empty, so skip it on wrap around */
+    next_seq = seq + 2;
+    if(next_seq == 0) {
+        next_seq = 2;
+    }
+    __atomic_store_n(&bucket->seq, next_seq, __ATOMIC_RELEASE);
+
+    count(&cache->inserts);
+}
+
+
+/*
+ * Public function. See t_cose_verify_cache_internal.h
+ */
+void
+t_cose_verify_cache_insert(struct t_cose_verify_cache           *cache,
+                           const struct t_cose_verify_cache_key *key)
+{
+    insert_stamped(cache, key, __atomic_load_n(&cache->now, __ATOMIC_RELAXED));
+}
+
+
+/* True if an entry stamped at stamp is older than max_age at now. The
+ * subtraction is modulo 2^32 so the clock wrapping is not a problem,
+ * but a stamp in the future (clock set back) counts as very old. */
+static inline bool
+is_expired(uint32_t stamp, uint32_t now, uint32_t max_age)
+{
+    return (uint32_t)(now - stamp) > max_age;
+}
+
+
+static int
+compare_entries(const void *a, const void *b)
+{
+    const struct verify_snapshot_entry *entry_a = a;
+    const struct verify_snapshot_entry *entry_b = b;
+    int                                 i;
+
+    for(i = 0; i < T_COSE_VERIFY_CACHE_KEY_WORDS; i++) {
+        if(entry_a->words[i] != entry_b->words[i]) {
+            return entry_a->words[i] < entry_b->words[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * FNV-1a over 64-bit words rather than bytes. It only has to catch
+ * truncation and corruption, and this runs at memory speed over a
+ * snapshot of millions of entries.
+ */
+static uint64_t
+snapshot_checksum(const struct verify_snapshot_header *header,
+                  const struct verify_snapshot_entry  *entries)
+{
+    uint64_t sum = 0xcbf29ce484222325ull;
+    uint32_t n;
+    int      i;
+
+#define MIX(value) (sum = (sum ^ (uint64_t)(value)) * 0x100000001b3ull)
+    MIX(header->entry_count);
+    MIX(header->saved_time);
+    MIX(header->max_age);
+    for(n = 0; n < header->entry_count; n++) {
+        MIX(entries[n].stamp);
+        for(i = 0; i < T_COSE_VERIFY_CACHE_KEY_WORDS; i++) {
+            MIX(entries[n].words[i]);
+        }
+    }
+#undef MIX
+
+    return sum;
+}
+
+
+/*
+ * Public function. See t_cose_verify_cache.h
+ */
+size_t
+t_cose_verify_cache_snapshot_size(const struct t_cose_verify_cache *cache)
+{
+    return sizeof(struct verify_snapshot_header) +
+           (size_t)cache->bucket_count * sizeof(struct verify_snapshot_entry);
+}
+
+
+/*
+ * Public function. See t_cose_verify_cache.h
+ */
+enum t_cose_err_t
+t_cose_verify_cache_snapshot(struct t_cose_verify_cache *cache,
+                             uint32_t                    max_age,
+                             struct q_useful_buf         buffer,
+                             struct q_useful_buf_c      *snapshot)
+{
+    struct verify_cache_bucket    *buckets = get_buckets(cache);
+    struct verify_snapshot_header *header;
+    struct verify_snapshot_entry  *entries;
+    uint64_t                       words[T_COSE_VERIFY_CACHE_KEY_WORDS];
+    size_t                         capacity;
+    uint32_t                       entry_count;
+    uint32_t                       now;
+    uint32_t                       stamp;
+    uint32_t                       seq;
+    uint32_t                       index;
+
+    if(buffer.ptr == NULL || ((uintptr_t)buffer.ptr % sizeof(uint64_t)) != 0) {
+        return T_COSE_ERR_INVALID_ARGUMENT;
+    }
+    if(buffer.len < sizeof(struct verify_snapshot_header)) {
+        return T_COSE_ERR_TOO_SMALL;
+    }
+
+    header   = (struct verify_snapshot_header *)buffer.ptr;
+    entries  = (struct verify_snapshot_entry *)(header + 1);
+    capacity = (buffer.len - sizeof(*header)) / sizeof(*entries);
+    now      = __atomic_load_n(&cache->now, __ATOMIC_RELAXED);
+
+    entry_count = 0;
+    for(index = 0; index < cache->bucket_count; index++) {
+        seq = read_bucket(&buckets[index], words, &stamp);
+        if(seq == 0 || (seq & 1) || is_expired(stamp, now, max_age)) {
+            /* A bucket being written is left out. It is only a cache. */
+            continue;
+        }
+        if(entry_count == capacity) {
+            return T_COSE_ERR_TOO_SMALL;
+        }
+        entries[entry_count].stamp    = stamp;
+        entries[entry_count].reserved = 0;
+        memcpy(entries[entry_count].words, words, sizeof(words));
+        entry_count++;
+    }
+
+    qsort(entries, entry_count, sizeof(*entries), compare_entries);
+
+    header->magic       = VERIFY_SNAPSHOT_MAGIC;
+    header->version     = VERIFY_SNAPSHOT_VERSION;
+    header->entry_count = entry_count;
+    header->saved_time  = now;
+    header->max_age     = max_age;
+    header->reserved    = 0;
+    header->checksum    = snapshot_checksum(header, entries);
+
+    snapshot->ptr = buffer.ptr;
+    snapshot->len = sizeof(*header) + (size_t)entry_count * sizeof(*entries);
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function. See t_cose_verify_cache.h
+ */
+enum t_cose_err_t
+t_cose_verify_snapshot_open(struct q_useful_buf_c          snapshot_bytes,
+                            struct t_cose_verify_snapshot *snapshot)
+{
+    const struct verify_snapshot_header *header;
+    const struct verify_snapshot_entry  *entries;
+
+    if(snapshot_bytes.ptr == NULL ||
+       ((uintptr_t)snapshot_bytes.ptr % sizeof(uint64_t)) != 0 ||
+       snapshot_bytes.len < sizeof(*header)) {
+        return T_COSE_ERR_SNAPSHOT_FORMAT;
+    }
+
+    header  = snapshot_bytes.ptr;
+    entries = (const struct verify_snapshot_entry *)(header + 1);
+    if(header->magic != VERIFY_SNAPSHOT_MAGIC ||
+       header->version != VERIFY_SNAPSHOT_VERSION ||
+       (snapshot_bytes.len - sizeof(*header)) / sizeof(*entries) != header->entry_count ||
+       (snapshot_bytes.len - sizeof(*header)) % sizeof(*entries) != 0 ||
+       header->checksum != snapshot_checksum(header, entries)) {
+        return T_COSE_ERR_SNAPSHOT_FORMAT;
+    }
+
+    snapshot->entries     = entries;
+    snapshot->entry_count = header->entry_count;
+    snapshot->saved_time  = header->saved_time;
+    snapshot->max_age     = header->max_age;
+    snapshot->mapping     = NULL;
+    snapshot->mapping_len = 0;
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function. See t_cose_verify_cache_internal.h
+ */
+bool
+t_cose_verify_snapshot_lookup(const struct t_cose_verify_snapshot  *snapshot,
+                              struct t_cose_verify_cache           *cache,
+                              const struct t_cose_verify_cache_key *key)
+{
+    const struct verify_snapshot_entry *entries = snapshot->entries;
+    struct verify_snapshot_entry        wanted;
+    uint32_t                            low;
+    uint32_t                            high;
+    uint32_t                            middle;
+    int                                 order;
+
+    memcpy(wanted.words, key->words, sizeof(wanted.words));
+
+    low  = 0;
+    high = snapshot->entry_count;
+    while(low < high) {
+        middle = low + (high - low) / 2;
+        order  = compare_entries(&wanted, &entries[middle]);
+        if(order == 0) {
+            if(is_expired(entries[middle].stamp,
+                          __atomic_load_n(&cache->now, __ATOMIC_RELAXED),
+                          snapshot->max_age)) {
+                return false;
+            }
+            insert_stamped(cache, key, entries[middle].stamp);
+            count(&cache->restored);
+            return true;
+        }
+        if(order < 0) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+
+    return false;
+}
+
+
+/*
+ * Public function. See t_cose_verify_cache.h
+ */
+void
+t_cose_verify_cache_restore(struct t_cose_verify_cache          *cache,
+                            const struct t_cose_verify_snapshot *snapshot)
+{
+    const struct verify_snapshot_entry *entries = snapshot->entries;
+    struct t_cose_verify_cache_key      key;
+    const uint32_t                      now = __atomic_load_n(&cache->now,
+                                                              __ATOMIC_RELAXED);
+    uint32_t                            n;
+
+    for(n = 0; n < snapshot->entry_count; n++) {
+        if(is_expired(entries[n].stamp, now, snapshot->max_age)) {
+            continue;
+        }
+        memcpy(key.words, entries[n].words, sizeof(key.words));
+        insert_stamped(cache, &key, entries[n].stamp);
+        count(&cache->restored);
+    }
+}
+
+
+#ifdef T_COSE_ENABLE_VERIFY_SNAPSHOT_FILE
+/*
+ * Public function. See t_cose_verify_cache.h
+ */
+enum t_cose_err_t
+t_cose_verify_cache_save_file(struct t_cose_verify_cache *cache,
+                              uint32_t                    max_age,
+                              const char                 *path)
+{
+    enum t_cose_err_t     return_value;
+    char                  temp_path[1024];
+    int                   fd;
+    void                 *mapping;
+    const size_t          max_size = t_cose_verify_cache_snapshot_size(cache);
+    struct q_useful_buf_c snapshot;
+
+    if(snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= (int)sizeof(temp_path)) {
+        return T_COSE_ERR_ARTIFACT_ACCESS;
+    }
+
+    fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if(fd < 0) {
+        return T_COSE_ERR_ARTIFACT_ACCESS;
+    }
+    mapping = MAP_FAILED;
+    return_value = T_COSE_ERR_ARTIFACT_ACCESS;
+
+    if(ftruncate(fd, (off_t)max_size) != 0) {
+        goto Done;
+    }
+    mapping = mmap(NULL, max_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(mapping == MAP_FAILED) {
+        goto Done;
+    }
+
+    return_value = t_cose_verify_cache_snapshot(cache,
+                                                max_age,
+                                                (struct q_useful_buf){mapping, max_size},
+                                                &snapshot);
+    if(return_value) {
+        goto Done;
+    }
+
+    return_value = T_COSE_ERR_ARTIFACT_ACCESS;
+    /* Unmap before truncating the unused end off */
+    munmap(mapping, max_size);
+    mapping = MAP_FAILED;
+    if(ftruncate(fd, (off_t)snapshot.len) != 0 || fsync(fd) != 0) {
+        goto Done;
+    }
+    if(rename(temp_path, path) != 0) {
+        goto Done;
+    }
+    return_value = T_COSE_SUCCESS;
+
+Done:
+    if(mapping != MAP_FAILED) {
+        munmap(mapping, max_size);
+    }
+    close(fd);
+    if(return_value) {
+        unlink(temp_path);
+    }
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_verify_cache.h
+ */
+enum t_cose_err_t
+t_cose_verify_snapshot_map_file(const char                    *path,
+                                struct t_cose_verify_snapshot *snapshot)
+{
+    enum t_cose_err_t return_value;
+    int               fd;
+    struct stat       file_stat;
+    void             *mapping;
+    size_t            length;
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return T_COSE_ERR_ARTIFACT_ACCESS;
+    }
+    if(fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0) {
+        close(fd);
+        return T_COSE_ERR_ARTIFACT_ACCESS;
+    }
+    length = (size_t)file_stat.st_size;
+
+    /* Only the pages of the entries searched are ever read in, other
+     * than once for the checksum */
+    mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) {
+        return T_COSE_ERR_ARTIFACT_ACCESS;
+    }
+
+    return_value = t_cose_verify_snapshot_open((struct q_useful_buf_c){mapping, length},
+                                               snapshot);
+    if(return_value) {
+        munmap(mapping, length);
+        return return_value;
+    }
+    snapshot->mapping     = mapping;
+    snapshot->mapping_len = length;
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function. See t_cose_verify_cache.h
+ */
+void
+t_cose_verify_snapshot_unmap_file(struct t_cose_verify_snapshot *snapshot)
+{
+    if(snapshot->mapping != NULL) {
+        munmap(snapshot->mapping, snapshot->mapping_len);
+    }
+    snapshot->entries     = NULL;
+    snapshot->entry_count = 0;
+    snapshot->mapping     = NULL;
+    snapshot->mapping_len = 0;
+}
+#endif /* T_COSE_ENABLE_VERIFY_SNAPSHOT_FILE */
+
+#endif /* T_COSE_ENABLE_VERIFY_CACHE */
@@ -0,0 +1,113 @@
+/*
+ *  t_cose_verify_cache_internal.h
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+
+#ifndef __T_COSE_VERIFY_CACHE_INTERNAL_H__
+#define __T_COSE_VERIFY_CACHE_INTERNAL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+#include "t_cose/t_cose_verify_cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \file t_cose_verify_cache_internal.h
+ *
+ * \brief Functions of the verification cache used by t_cose_sign1_verify().
+ */
+
+
+#ifdef T_COSE_ENABLE_VERIFY_CACHE
+
+/** Number of 64-bit words in a cache entry; 256 bits for SHA-256 */
+#define T_COSE_VERIFY_CACHE_KEY_WORDS 4
+
+
+/** The identity of one verification */
+struct t_cose_verify_cache_key {
+    uint64_t words[T_COSE_VERIFY_CACHE_KEY_WORDS];
+};
+
+
+/**
+ * \brief Compute the cache entry for a verification.
+ *
+ * \param[in] tbs_hash   The hash of the to-be-signed bytes.
+ * \param[in] signature  The signature.
+ * \param[in] kid        The kid from the message or \c NULL_Q_USEFUL_BUF_C.
+ * \param[in] key_label  Caller's label for the verification key.
+ * \param[out] key       The cache entry.
+ *
+ * \return Error from the hash or \ref T_COSE_SUCCESS.
+ */
+enum t_cose_err_t
+t_cose_verify_cache_make_key(struct q_useful_buf_c           tbs_hash,
+                             struct q_useful_buf_c           signature,
+                             struct q_useful_buf_c           kid,
+                             struct q_useful_buf_c           key_label,
+                             struct t_cose_verify_cache_key *key);
+
+
+/**
+ * \brief Look for an entry.
+ *
+ * \param[in] cache  The cache.
+ * \param[in] key    The entry to look for.
+ *
+ * \return \c true if found.
+ */
+bool
+t_cose_verify_cache_lookup(struct t_cose_verify_cache           *cache,
+                           const struct t_cose_verify_cache_key *key);
+
+
+/**
+ * \brief Add an entry.
+ *
+ * \param[in] cache  The cache.
+ * \param[in] key    The entry to add.
+ *
+ * If the bucket to use is being written by another process the
+ * entry is not added. It is only a cache.
+ */
+void
+t_cose_verify_cache_insert(struct t_cose_verify_cache           *cache,
+                           const struct t_cose_verify_cache_key *key);
+
+
+/**
+ * \brief Look for an entry in a snapshot and copy it to the cache.
+ *
+ * \param[in] snapshot  The snapshot.
+ * \param[in] cache     The cache to copy the entry to.
+ * \param[in] key       The entry to look for.
+ *
+ * \return \c true if found and not expired.
+ *
+ * This is called after t_cose_verify_cache_lookup() misses so the
+ * snapshot is read lazily, one entry at a time as they are needed.
+ */
+bool
+t_cose_verify_snapshot_lookup(const struct t_cose_verify_snapshot  *snapshot,
+                              struct t_cose_verify_cache           *cache,
+                              const struct t_cose_verify_cache_key *key);
+
+#endif /* T_COSE_ENABLE_VERIFY_CACHE */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __T_COSE_VERIFY_CACHE_INTERNAL_H__ */
@@ -0,0 +1,287 @@
+/*
+ *  t_cose_verify_sched.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "t_cose/t_cose_verify_sched.h"
+#include <string.h>
+
+
+/**
+ * \file t_cose_verify_sched.c
+ *
+ * \brief Implementation of the deadline-ordered verification queue.
+ */
+
+
+/**
+ * The weight of a new verification time in the running average is
+ * 1 / 2^AVERAGE_SHIFT.
+ */
+#define AVERAGE_SHIFT 3
+
+
+/**
+ * \brief Whether one request is scheduled before another.
+ *
+ * \param[in] a  A request.
+ * \param[in] b  Another request.
+ *
+ * \return \c true if \c a goes first.
+ */
+static inline bool
+goes_before(const struct t_cose_verify_sched_request *a,
+            const struct t_cose_verify_sched_request *b)
+{
+    if(a->effective_deadline != b->effective_deadline) {
+        return a->effective_deadline < b->effective_deadline;
+    }
+    if(a->priority_class != b->priority_class) {
+        return a->priority_class < b->priority_class;
+    }
+    return a->sequence < b->sequence;
+}
+
+
+/**
+ * \brief Histogram bucket for a queue time.
+ *
+ * \param[in] queue_time  The time.
+ *
+ * \return The index of the highest bit set, limited to the number of
+ *         buckets.
+ */
+static inline unsigned
+histogram_bucket(uint64_t queue_time)
+{
+    unsigned bucket;
+
+    bucket = 0;
+    while(queue_time > 1 && bucket < T_COSE_SCHED_HISTOGRAM_BUCKETS - 1) {
+        queue_time >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+
+/**
+ * \brief Move the request at a position up the heap to where it goes.
+ *
+ * \param[in] sched     The queue.
+ * \param[in] position  Index in the heap of the request.
+ */
+static void
+sift_up(struct t_cose_verify_sched *sched, size_t position)
+{
+    struct t_cose_verify_sched_request *request = sched->heap[position];
+    size_t                              parent;
+
+    while(position > 0) {
+        parent = (position - 1) / 2;
+        if(!goes_before(request, sched->heap[parent])) {
+            break;
+        }
+        sched->heap[position] = sched->heap[parent];
+        position = parent;
+    }
+    sched->heap[position] = request;
+}
+
+
+/**
+ * \brief Move the request at the top of the heap down to where it goes.
+ *
+ * \param[in] sched  The queue.
+ */
+static void
+sift_down(struct t_cose_verify_sched *sched)
+{
+    struct t_cose_verify_sched_request *request = sched->heap[0];
+    size_t                              position;
+    size_t                              child;
+
+    position = 0;
+    while(1) {
+        child = 2 * position + 1;
+        if(child >= sched->num_requests) {
+            break;
+        }
+        if(child + 1 < sched->num_requests &&
+           goes_before(sched->heap[child + 1], sched->heap[child])) {
+            child++;
+        }
+        if(!goes_before(sched->heap[child], request)) {
+            break;
+        }
+        sched->heap[position] = sched->heap[child];
+        position = child;
+    }
+    sched->heap[position] = request;
+}
+
+
+/*
+ * Public function. See t_cose_verify_sched.h
+ */
+void
+t_cose_verify_sched_init(struct t_cose_verify_sched          *sched,
+                         struct t_cose_verify_sched_request **heap,
+                         size_t                               max_requests,
+                         t_cose_sched_clock_cb                clock_cb,
+                         void                                *cb_context,
+                         uint64_t                             initial_verify_time)
+{
+    unsigned priority_class;
+
+    memset(sched, 0, sizeof(*sched));
+    sched->heap         = heap;
+    sched->max_requests = max_requests;
+    sched->clock_cb     = clock_cb;
+    sched->cb_context   = cb_context;
+    for(priority_class = 0; priority_class < T_COSE_SCHED_NUM_CLASSES; priority_class++) {
+        sched->class_max_wait[priority_class] = T_COSE_SCHED_NO_DEADLINE;
+    }
+    sched->stats.average_verify_time = initial_verify_time;
+}
+
+
+/*
+ * Public function. See t_cose_verify_sched.h
+ */
+enum t_cose_err_t
+t_cose_verify_sched_submit(struct t_cose_verify_sched         *sched,
+                           struct t_cose_verify_sched_request *request)
+{
+    enum t_cose_err_t return_value;
+    uint64_t          now;
+    uint64_t          max_wait;
+    uint64_t          estimated_finish;
+    size_t            num_ahead;
+    size_t            i;
+
+    if(request->priority_class >= T_COSE_SCHED_NUM_CLASSES) {
+        return_value = T_COSE_ERR_INVALID_ARGUMENT;
+        goto Done;
+    }
+    if(sched->num_requests >= sched->max_requests) {
+        return_value = T_COSE_ERR_TOO_SMALL;
+        goto Done;
+    }
+
+    now = (*sched->clock_cb)(sched->cb_context);
+
+    /* -- Deadline for ordering, with aging for those without one -- */
+    request->submit_time        = now;
+    request->effective_deadline = request->deadline;
+    max_wait = sched->class_max_wait[request->priority_class];
+    if(max_wait <= UINT64_MAX - now &&
+       now + max_wait < request->effective_deadline) {
+        request->effective_deadline = now + max_wait;
+    }
+    request->sequence = sched->next_sequence;
+
+    /* -- Admission control -- */
+    if(request->deadline != T_COSE_SCHED_NO_DEADLINE) {
+        /* The whole queue going first is an upper bound. Only when
+         * that misses the deadline are the ones that go first counted,
+         * so queuing a large batch isn't quadratic. */
+        num_ahead = sched->num_requests;
+        estimated_finish = now + (num_ahead + 1) * sched->stats.average_verify_time;
+        if(estimated_finish > request->deadline) {
+            num_ahead = 0;
+            for(i = 0; i < sched->num_requests; i++) {
+                if(goes_before(sched->heap[i], request)) {
+                    num_ahead++;
+                }
+            }
+            estimated_finish = now + (num_ahead + 1) * sched->stats.average_verify_time;
+        }
+        if(estimated_finish > request->deadline) {
+            sched->stats.rejected++;
+            return_value = T_COSE_ERR_DEADLINE_UNREACHABLE;
+            goto Done;
+        }
+    }
+
+    /* -- Queue it -- */
+    sched->next_sequence++;
+    sched->heap[sched->num_requests] = request;
+    sched->num_requests++;
+    sift_up(sched, sched->num_requests - 1);
+    sched->stats.submitted++;
+
+    return_value = T_COSE_SUCCESS;
+
+Done:
+    return return_value;
+}
+
+
+/*
+ * Public function. See t_cose_verify_sched.h
+ */
+struct t_cose_verify_sched_request *
+t_cose_verify_sched_run_next(struct t_cose_verify_sched *sched)
+{
+    struct t_cose_verify_sched_request *request;
+    uint64_t                            start;
+    uint64_t                            end;
+    uint64_t                            elapsed;
+    uint64_t                           *average;
+
+    if(sched->num_requests == 0) {
+        return NULL;
+    }
+
+    /* -- Take the top off the heap -- */
+    request = sched->heap[0];
+    sched->num_requests--;
+    if(sched->num_requests > 0) {
+        sched->heap[0] = sched->heap[sched->num_requests];
+        sift_down(sched);
+    }
+
+    /* -- Count the queue time -- */
+    start = (*sched->clock_cb)(sched->cb_context);
+    request->queue_time = start - request->submit_time;
+    sched->stats.queue_time_histogram[request->priority_class]
+                                     [histogram_bucket(request->queue_time)]++;
+
+    request->payload = NULL_Q_USEFUL_BUF_C;
+    if(start > request->deadline) {
+        /* Too late to be of use, so don't spend time verifying */
+        sched->stats.expired[request->priority_class]++;
+        request->result = T_COSE_ERR_DEADLINE_MISSED;
+        goto Done;
+    }
+
+    /* -- Verify and time it -- */
+    request->result = t_cose_sign1_verify(request->verify_ctx,
+                                          request->cose_sign1,
+                                         &request->payload,
+                                          request->parameters);
+    end = (*sched->clock_cb)(sched->cb_context);
+
+    sched->stats.verified++;
+    if(end > request->deadline) {
+        sched->stats.finished_late[request->priority_class]++;
+    }
+
+    elapsed = end - start;
+    average = &sched->stats.average_verify_time;
+    if(elapsed > *average) {
+        *average += (elapsed - *average) >> AVERAGE_SHIFT;
+    } else {
+        *average -= (*average - elapsed) >> AVERAGE_SHIFT;
+    }
+
+Done:
+    return request;
+}
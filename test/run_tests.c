@@ -52,6 +52,18 @@ static test_entry s_tests[] = {
     TEST_ENTRY(sign1_structure_decode_test),
     TEST_ENTRY(crit_parameters_test),
     TEST_ENTRY(bad_parameters_test),
+    TEST_ENTRY(hash_known_answer_test),
+    TEST_ENTRY(autotune_test),
+#ifdef T_COSE_ENABLE_VERIFY_CACHE
+    TEST_ENTRY(verify_cache_test),
+    TEST_ENTRY(verify_snapshot_test),
+#endif /* T_COSE_ENABLE_VERIFY_CACHE */
+#ifdef T_COSE_ENABLE_RATE_LIMIT
+    TEST_ENTRY(rate_limit_test),
+#endif /* T_COSE_ENABLE_RATE_LIMIT */
+#ifdef T_COSE_ENABLE_KEY_ARENA
+    TEST_ENTRY(key_arena_test),
+#endif /* T_COSE_ENABLE_KEY_ARENA */
 
 #ifndef T_COSE_DISABLE_SIGN_VERIFY_TESTS
     /* Many tests can be run without a crypto library integration and
@@ -63,6 +75,21 @@ static test_entry s_tests[] = {
     TEST_ENTRY(sign_verify_make_cwt_test),
     TEST_ENTRY(sign_verify_sig_fail_test),
     TEST_ENTRY(sign_verify_get_size_test),
+#ifdef T_COSE_ENABLE_RESTARTABLE
+    TEST_ENTRY(sign_verify_restartable_test),
+#endif /* T_COSE_ENABLE_RESTARTABLE */
+#ifdef T_COSE_ENABLE_VERIFY_CACHE
+    TEST_ENTRY(sign_verify_cache_test),
+#endif /* T_COSE_ENABLE_VERIFY_CACHE */
+#ifdef T_COSE_ENABLE_KEY_RECOVERY
+    TEST_ENTRY(sign_verify_recover_signer_test),
+#endif /* T_COSE_ENABLE_KEY_RECOVERY */
+#ifdef T_COSE_ENABLE_ENCRYPT
+    TEST_ENTRY(sign_verify_encrypt_test),
+#endif /* T_COSE_ENABLE_ENCRYPT */
+#ifdef T_COSE_ENABLE_OSCORE
+    TEST_ENTRY(sign_verify_oscore_test),
+#endif /* T_COSE_ENABLE_OSCORE */
 #endif /* T_COSE_DISABLE_SIGN_VERIFY_TESTS */
 
 #ifndef T_COSE_DISABLE_SHORT_CIRCUIT_SIGN
@@ -74,6 +101,34 @@ static test_entry s_tests[] = {
      */
     TEST_ENTRY(content_type_test),
     TEST_ENTRY(all_header_parameters_test),
+    TEST_ENTRY(custom_parameters_test),
+#ifndef T_COSE_DISABLE_HASH_ENVELOPE
+    TEST_ENTRY(hash_envelope_test),
+#endif /* T_COSE_DISABLE_HASH_ENVELOPE */
+#if !defined(T_COSE_DISABLE_PROTECTED_INTERN) && !defined(T_COSE_DISABLE_HASH_ENVELOPE)
+    TEST_ENTRY(protected_intern_test),
+#endif /* !T_COSE_DISABLE_PROTECTED_INTERN && !T_COSE_DISABLE_HASH_ENVELOPE */
+    TEST_ENTRY(sign1_batch_test),
+    TEST_ENTRY(known_length_payload_test),
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
+    TEST_ENTRY(incremental_hash_test),
+#endif /* T_COSE_ENABLE_INCREMENTAL_HASH */
+    TEST_ENTRY(two_stage_test),
+    TEST_ENTRY(verify_sched_test),
+    TEST_ENTRY(countersign_test),
+    TEST_ENTRY(multi_sign_test),
+#ifdef T_COSE_ENABLE_COST_COUNTERS
+    TEST_ENTRY(cost_budget_test),
+#endif /* T_COSE_ENABLE_COST_COUNTERS */
+#ifdef T_COSE_ENABLE_CAPTURE
+    TEST_ENTRY(capture_test),
+#endif /* T_COSE_ENABLE_CAPTURE */
+#ifdef T_COSE_ENABLE_SUIT
+    TEST_ENTRY(suit_test),
+#endif /* T_COSE_ENABLE_SUIT */
+#ifdef T_COSE_ENABLE_BULK_VERIFY
+    TEST_ENTRY(bulk_verify_test),
+#endif /* T_COSE_ENABLE_BULK_VERIFY */
     TEST_ENTRY(cose_example_test),
     TEST_ENTRY(short_circuit_signing_error_conditions_test),
     TEST_ENTRY(short_circuit_self_test),
@@ -0,0 +1,210 @@
+/*
+ *  t_cose_make_mbedtls_test_key.c
+ *
+ * Copyright 2019-2020, Laurence Lundblade
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "t_cose_make_test_pub_key.h" /* The interface implemented here */
+
+#include <stdlib.h>
+#include "mbedtls/ecdsa.h"
+#include "mbedtls/ecp.h"
+
+#ifndef MBEDTLS_PRIVATE
+#define MBEDTLS_PRIVATE(member) member
+#endif
+
+
+/*
+ * Some hard coded keys for the test cases here. These are the same
+ * as the OpenSSL test keys.
+ */
+#define PUBLIC_KEY_prime256v1 \
+    "0437ab65955fae0466673c3a2934a3" \
+    "4f2f0ec2b3eec224198557998fc04b" \
+    "f4b2b495d9798f2539c90d7d102b3b" \
+    "bbda7fcbdb0e9b58d4e1ad2e61508d" \
+    "a75f84a67b"
+
+#define PRIVATE_KEY_prime256v1 \
+    "f1b7142343402f3b5de7315ea894f9" \
+    "da5cf503ff7938a37ca14eb0328698" \
+    "8450"
+
+
+#define PUBLIC_KEY_secp384r1 \
+    "04bdd9c3f818c9cef3e11e2d40e775" \
+    "beb37bc376698d71967f93337a4e03" \
+    "2dffb11b505067dddb4214b56d9bce" \
+    "c59177eccd8ab05f50975933b9a738" \
+    "d90c0b07eb9519567ef9075807cf77" \
+    "139fc1fe85608851361136806123ed" \
+    "c735ce5a03e8e4"
+
+#define PRIVATE_KEY_secp384r1 \
+    "03df14f4b8a43fd8ab75a6046bd2b5" \
+    "eaa6fd10b2b203fd8a78d7916de20a" \
+    "a241eb37ec3d4c693d23ba2b4f6e5b" \
+    "66f57f"
+
+
+#define PUBLIC_KEY_secp521r1 \
+    "0400e4d253175a14311fc2dd487687" \
+    "70cb49b07bd15d327beb98aa33e60c" \
+    "d0181b17fb8f1cbf07dbc8652ff5b7" \
+    "b4452c082e0686c0fab8089071cbc5" \
+    "37101d344b94c201e6424f3a18da4f" \
+    "20ecabfbc84b8467c217cd67055fa5" \
+    "dec7fb1ae87082302c1813caa4b7b1" \
+    "cf28d94677e486fb4b317097e9307a" \
+    "bdb9d50187779a3d1e682c123c"
+
+#define PRIVATE_KEY_secp521r1 \
+    "0045d2d1439435fab333b1c6c8b534" \
+    "f0969396ad64d5f535d65f68f2a160" \
+    "6590bb15fd5322fc97a416c395745e" \
+    "72c7c85198c0921ab3b8e92dd901b5" \
+    "a42159adac6d"
+
+
+/* Convert hex to binary. Returns length or 0 on error */
+static size_t hex_to_bin(const char *hex, uint8_t *bin, size_t bin_size)
+{
+    size_t  len;
+    uint8_t nibble;
+    size_t  i;
+
+    for(len = 0; hex[len]; len++);
+    if(len % 2 || len / 2 > bin_size) {
+        return 0;
+    }
+
+    for(i = 0; i < len; i++) {
+        const char c = hex[i];
+        nibble = (uint8_t)(c >= 'a' ? c - 'a' + 10 : c - '0');
+        if(i % 2) {
+            bin[i/2] |= nibble;
+        } else {
+            bin[i/2] = (uint8_t)(nibble << 4);
+        }
+    }
+
+    return len / 2;
+}
+
+
+static int key_pairs_outstanding = 0;
+
+
+/*
+ * Public function, see t_cose_make_test_pub_key.h
+ */
+/*
+ * The key object returned by this is malloced and has to be freed by
+ * by calling free_ecdsa_key_pair().
+ */
+enum t_cose_err_t make_ecdsa_key_pair(int32_t           cose_algorithm_id,
+                                      struct t_cose_key *key_pair)
+{
+    enum t_cose_err_t      return_value;
+    mbedtls_ecdsa_context *mbed_ec_key;
+    mbedtls_ecp_group_id   group_id;
+    const char            *public_key;
+    const char            *private_key;
+    uint8_t                key_bytes[1 + 2 * 66];
+    size_t                 key_len;
+    int                    mbed_result;
+
+    switch (cose_algorithm_id) {
+    case T_COSE_ALGORITHM_ES256:
+        group_id    = MBEDTLS_ECP_DP_SECP256R1;
+        public_key  = PUBLIC_KEY_prime256v1;
+        private_key = PRIVATE_KEY_prime256v1;
+        break;
+
+    case T_COSE_ALGORITHM_ES384:
+        group_id    = MBEDTLS_ECP_DP_SECP384R1;
+        public_key  = PUBLIC_KEY_secp384r1;
+        private_key = PRIVATE_KEY_secp384r1;
+        break;
+
+    case T_COSE_ALGORITHM_ES512:
+        group_id    = MBEDTLS_ECP_DP_SECP521R1;
+        public_key  = PUBLIC_KEY_secp521r1;
+        private_key = PRIVATE_KEY_secp521r1;
+        break;
+
+    default:
+        return -1;
+    }
+
+    mbed_ec_key = malloc(sizeof(mbedtls_ecdsa_context));
+    if(mbed_ec_key == NULL) {
+        return_value = T_COSE_ERR_INSUFFICIENT_MEMORY;
+        goto Done;
+    }
+    mbedtls_ecdsa_init(mbed_ec_key);
+
+    mbed_result = mbedtls_ecp_group_load(&mbed_ec_key->MBEDTLS_PRIVATE(grp),
+                                         group_id);
+    if(mbed_result) {
+        return_value = T_COSE_ERR_SIG_FAIL;
+        goto Done;
+    }
+
+    key_len = hex_to_bin(private_key, key_bytes, sizeof(key_bytes));
+    mbed_result = mbedtls_mpi_read_binary(&mbed_ec_key->MBEDTLS_PRIVATE(d),
+                                          key_bytes,
+                                          key_len);
+    if(mbed_result || key_len == 0) {
+        return_value = T_COSE_ERR_SIG_FAIL;
+        goto Done;
+    }
+
+    key_len = hex_to_bin(public_key, key_bytes, sizeof(key_bytes));
+    mbed_result = mbedtls_ecp_point_read_binary(&mbed_ec_key->MBEDTLS_PRIVATE(grp),
+                                                &mbed_ec_key->MBEDTLS_PRIVATE(Q),
+                                                key_bytes,
+                                                key_len);
+    if(mbed_result || key_len == 0) {
+        return_value = T_COSE_ERR_SIG_FAIL;
+        goto Done;
+    }
+
+    key_pair->k.key_ptr  = mbed_ec_key;
+    key_pair->crypto_lib = T_COSE_CRYPTO_LIB_MBEDTLS;
+    key_pairs_outstanding++;
+    mbed_ec_key          = NULL;
+    return_value         = T_COSE_SUCCESS;
+
+Done:
+    if(mbed_ec_key != NULL) {
+        mbedtls_ecdsa_free(mbed_ec_key);
+        free(mbed_ec_key);
+    }
+    return return_value;
+}
+
+
+/*
+ * Public function, see t_cose_make_test_pub_key.h
+ */
+void free_ecdsa_key_pair(struct t_cose_key key_pair)
+{
+    mbedtls_ecdsa_free(key_pair.k.key_ptr);
+    free(key_pair.k.key_ptr);
+    key_pairs_outstanding--;
+}
+
+
+/*
+ * Public function, see t_cose_make_test_pub_key.h
+ */
+int check_for_key_pair_leaks()
+{
+    return key_pairs_outstanding;
+}
@@ -10,6 +10,9 @@
 
 #include "t_cose/t_cose_sign1_sign.h"
 #include "t_cose/t_cose_sign1_verify.h"
+#include "t_cose/t_cose_key_index.h"
+#include "t_cose/t_cose_encrypt.h"
+#include "t_cose/t_cose_oscore.h"
 #include "t_cose/q_useful_buf.h"
 #include "t_cose_make_test_pub_key.h"
 
@@ -498,3 +501,701 @@ int_fast32_t sign_verify_get_size_test()
 
     return 0;
 }
+
+
+#ifdef T_COSE_ENABLE_RESTARTABLE
+/*
+ * Public function, see t_cose_sign_verify_test.h
+ */
+int_fast32_t sign_verify_restartable_test()
+{
+    struct t_cose_sign1_sign_ctx   sign_ctx;
+    struct t_cose_sign1_verify_ctx verify_ctx;
+    struct t_cose_restart_ctx      restart_ctx;
+    int32_t                        return_value;
+    enum t_cose_err_t              result;
+    Q_USEFUL_BUF_MAKE_STACK_UB(    signed_cose_buffer, 300);
+    struct q_useful_buf_c          signed_cose;
+    struct t_cose_key              key_pair;
+    struct q_useful_buf_c          payload;
+    int                            slices;
+
+    result = make_ecdsa_key_pair(T_COSE_ALGORITHM_ES256, &key_pair);
+    if(result) {
+        return 1000 + (int32_t)result;
+    }
+
+    /* -- Sign in small slices. It must take more than one -- */
+    t_cose_restart_ctx_init(&restart_ctx, 100);
+    t_cose_sign1_sign_init(&sign_ctx, 0, T_COSE_ALGORITHM_ES256);
+    t_cose_sign1_set_signing_key(&sign_ctx, key_pair, NULL_Q_USEFUL_BUF_C);
+    t_cose_sign1_sign_set_restart_ctx(&sign_ctx, &restart_ctx);
+
+    slices = 0;
+    do {
+        result = t_cose_sign1_sign(&sign_ctx,
+                                   Q_USEFUL_BUF_FROM_SZ_LITERAL("payload"),
+                                   signed_cose_buffer,
+                                   &signed_cose);
+        slices++;
+    } while(result == T_COSE_ERR_SIG_IN_PROGRESS);
+    if(result) {
+        return_value = 2000 + (int32_t)result;
+        goto Done;
+    }
+    if(slices < 2 || restart_ctx.crypto_ctx != NULL) {
+        return_value = 3000 + slices;
+        goto Done;
+    }
+
+    /* -- Verify in slices -- */
+    t_cose_sign1_verify_init(&verify_ctx, 0);
+    t_cose_sign1_set_verification_key(&verify_ctx, key_pair);
+    t_cose_sign1_verify_set_restart_ctx(&verify_ctx, &restart_ctx);
+
+    slices = 0;
+    do {
+        result = t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, NULL);
+        slices++;
+    } while(result == T_COSE_ERR_SIG_IN_PROGRESS);
+    if(result) {
+        return_value = 4000 + (int32_t)result;
+        goto Done;
+    }
+    if(slices < 2 || restart_ctx.crypto_ctx != NULL) {
+        return_value = 5000 + slices;
+        goto Done;
+    }
+
+    if(q_useful_buf_compare(payload, Q_USEFUL_BUF_FROM_SZ_LITERAL("payload"))) {
+        return_value = 6000;
+        goto Done;
+    }
+
+    /* -- Abandon a verification part way through -- */
+    result = t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, NULL);
+    if(result != T_COSE_ERR_SIG_IN_PROGRESS) {
+        return_value = 7000 + (int32_t)result;
+        goto Done;
+    }
+    t_cose_restart_ctx_abort(&restart_ctx);
+    if(restart_ctx.crypto_ctx != NULL) {
+        return_value = 7100;
+        goto Done;
+    }
+
+    /* -- Unlimited budget completes in one call -- */
+    t_cose_restart_ctx_init(&restart_ctx, 0);
+    result = t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, NULL);
+    if(result) {
+        return_value = 8000 + (int32_t)result;
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    t_cose_restart_ctx_abort(&restart_ctx);
+    free_ecdsa_key_pair(key_pair);
+
+    return return_value;
+}
+#endif /* T_COSE_ENABLE_RESTARTABLE */
+
+
+#ifdef T_COSE_ENABLE_VERIFY_CACHE
+/*
+ * Public function, see t_cose_sign_verify_test.h
+ */
+int_fast32_t sign_verify_cache_test()
+{
+    static uint64_t                  cache_memory[256];
+    struct t_cose_verify_cache      *cache;
+    struct t_cose_verify_cache_stats stats;
+    struct t_cose_sign1_sign_ctx     sign_ctx;
+    struct t_cose_sign1_verify_ctx   verify_ctx;
+    int32_t                          return_value;
+    enum t_cose_err_t                result;
+    Q_USEFUL_BUF_MAKE_STACK_UB(      signed_cose_buffer, 300);
+    struct q_useful_buf_c            signed_cose;
+    struct t_cose_key                key_pair;
+    struct t_cose_key                other_key_pair;
+    bool                             have_other_key_pair;
+    struct q_useful_buf_c            payload;
+    const struct q_useful_buf_c      key_label = Q_USEFUL_BUF_FROM_SZ_LITERAL("test key");
+
+    have_other_key_pair = false;
+    result = make_ecdsa_key_pair(T_COSE_ALGORITHM_ES256, &key_pair);
+    if(result) {
+        return 1000 + (int32_t)result;
+    }
+
+    result = t_cose_verify_cache_format((struct q_useful_buf){cache_memory,
+                                                              sizeof(cache_memory)},
+                                        4, &cache);
+    if(result) {
+        return_value = 2000 + (int32_t)result;
+        goto Done;
+    }
+
+    t_cose_sign1_sign_init(&sign_ctx, 0, T_COSE_ALGORITHM_ES256);
+    t_cose_sign1_set_signing_key(&sign_ctx, key_pair, NULL_Q_USEFUL_BUF_C);
+    result = t_cose_sign1_sign(&sign_ctx,
+                               Q_USEFUL_BUF_FROM_SZ_LITERAL("payload"),
+                               signed_cose_buffer,
+                               &signed_cose);
+    if(result) {
+        return_value = 3000 + (int32_t)result;
+        goto Done;
+    }
+
+    t_cose_sign1_verify_init(&verify_ctx, 0);
+    t_cose_sign1_set_verification_key(&verify_ctx, key_pair);
+    t_cose_sign1_verify_set_cache(&verify_ctx, cache, key_label);
+
+    /* First is a miss, second a hit */
+    result = t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, NULL);
+    if(result) {
+        return_value = 4000 + (int32_t)result;
+        goto Done;
+    }
+    result = t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, NULL);
+    if(result) {
+        return_value = 5000 + (int32_t)result;
+        goto Done;
+    }
+    t_cose_verify_cache_get_stats(cache, &stats);
+    if(stats.hits != 1 || stats.misses != 1 || stats.inserts != 1) {
+        return_value = 6000;
+        goto Done;
+    }
+
+    /* A different key label must not hit */
+    t_cose_sign1_verify_set_cache(&verify_ctx, cache,
+                                  Q_USEFUL_BUF_FROM_SZ_LITERAL("other key"));
+    result = t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, NULL);
+    if(result) {
+        return_value = 7000 + (int32_t)result;
+        goto Done;
+    }
+    t_cose_verify_cache_get_stats(cache, &stats);
+    if(stats.hits != 1 || stats.misses != 2) {
+        return_value = 7100;
+        goto Done;
+    }
+
+    /* A failed verification is not cached. Tamper with the last
+     * byte of the signature. */
+    ((uint8_t *)(uintptr_t)signed_cose.ptr)[signed_cose.len - 1] ^= 0x01;
+    t_cose_sign1_verify_set_cache(&verify_ctx, cache, key_label);
+    result = t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, NULL);
+    if(result != T_COSE_ERR_SIG_VERIFY) {
+        return_value = 8000 + (int32_t)result;
+        goto Done;
+    }
+    t_cose_verify_cache_get_stats(cache, &stats);
+    if(stats.inserts != 2) {
+        return_value = 8100;
+        goto Done;
+    }
+    ((uint8_t *)(uintptr_t)signed_cose.ptr)[signed_cose.len - 1] ^= 0x01;
+
+    /* Without a label the cache is not used, not even for a message
+     * that is in it */
+    t_cose_sign1_verify_set_cache(&verify_ctx, cache, NULL_Q_USEFUL_BUF_C);
+    result = t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, NULL);
+    if(result) {
+        return_value = 9000 + (int32_t)result;
+        goto Done;
+    }
+    t_cose_verify_cache_get_stats(cache, &stats);
+    if(stats.hits != 1 || stats.misses != 3 || stats.inserts != 2) {
+        return_value = 9100;
+        goto Done;
+    }
+
+#ifndef T_COSE_DISABLE_ES384
+    /* A message cached as verified with key A must not verify with
+     * key B, whether the label is left as it was or set for B */
+    result = make_ecdsa_key_pair(T_COSE_ALGORITHM_ES384, &other_key_pair);
+    if(result) {
+        return_value = 10000 + (int32_t)result;
+        goto Done;
+    }
+    have_other_key_pair = true;
+    t_cose_sign1_verify_set_cache(&verify_ctx, cache, key_label);
+    t_cose_sign1_set_verification_key(&verify_ctx, other_key_pair);
+    result = t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, NULL);
+    if(result == T_COSE_SUCCESS) {
+        return_value = 10100;
+        goto Done;
+    }
+    t_cose_sign1_verify_set_cache(&verify_ctx, cache,
+                                  Q_USEFUL_BUF_FROM_SZ_LITERAL("key b"));
+    result = t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, NULL);
+    if(result == T_COSE_SUCCESS) {
+        return_value = 10200;
+        goto Done;
+    }
+    t_cose_verify_cache_get_stats(cache, &stats);
+    if(stats.hits != 1) {
+        return_value = 10300;
+        goto Done;
+    }
+#endif /* T_COSE_DISABLE_ES384 */
+
+    return_value = 0;
+
+Done:
+    free_ecdsa_key_pair(key_pair);
+    if(have_other_key_pair) {
+        free_ecdsa_key_pair(other_key_pair);
+    }
+
+    return return_value;
+}
+#endif /* T_COSE_ENABLE_VERIFY_CACHE */
+
+
+#ifdef T_COSE_ENABLE_KEY_RECOVERY
+/*
+ * Public function, see t_cose_sign_verify_test.h
+ */
+int_fast32_t sign_verify_recover_signer_test()
+{
+    struct t_cose_key_index_entry  entries[8];
+    struct t_cose_key_index        index;
+    struct t_cose_key              key_pairs[3];
+    struct t_cose_key              signer;
+    struct t_cose_sign1_sign_ctx   sign_ctx;
+    struct t_cose_sign1_verify_ctx verify_ctx;
+    int32_t                        return_value;
+    enum t_cose_err_t              result;
+    Q_USEFUL_BUF_MAKE_STACK_UB(    signed_cose_buffer, 300);
+    struct q_useful_buf_c          signed_cose;
+    struct q_useful_buf_c          payload;
+    size_t                         num_keys;
+    size_t                         i;
+
+    num_keys = 0;
+    t_cose_key_index_init(&index, entries, 8);
+
+    /* -- Register several keys -- */
+    for(i = 0; i < 3; i++) {
+        result = make_ecdsa_key_pair(T_COSE_ALGORITHM_ES256, &key_pairs[i]);
+        if(result) {
+            return_value = 1000 + (int32_t)result;
+            goto Done;
+        }
+        num_keys++;
+        result = t_cose_key_index_add(&index, key_pairs[i]);
+        if(result) {
+            return_value = 2000 + (int32_t)result;
+            goto Done;
+        }
+    }
+
+    /* -- Sign with the middle one and no kid -- */
+    t_cose_sign1_sign_init(&sign_ctx, 0, T_COSE_ALGORITHM_ES256);
+    t_cose_sign1_set_signing_key(&sign_ctx, key_pairs[1], NULL_Q_USEFUL_BUF_C);
+    result = t_cose_sign1_sign(&sign_ctx,
+                               Q_USEFUL_BUF_FROM_SZ_LITERAL("payload"),
+                               signed_cose_buffer,
+                               &signed_cose);
+    if(result) {
+        return_value = 3000 + (int32_t)result;
+        goto Done;
+    }
+
+    /* -- The signer is found without a verification key -- */
+    t_cose_sign1_verify_init(&verify_ctx, 0);
+    result = t_cose_sign1_verify_recover_signer(&verify_ctx,
+                                                &index,
+                                                 signed_cose,
+                                                &payload,
+                                                 NULL,
+                                                &signer);
+    if(result) {
+        return_value = 4000 + (int32_t)result;
+        goto Done;
+    }
+    if(signer.k.key_ptr != key_pairs[1].k.key_ptr ||
+       q_useful_buf_compare(payload, Q_USEFUL_BUF_FROM_SZ_LITERAL("payload"))) {
+        return_value = 5000;
+        goto Done;
+    }
+
+    /* -- A modified payload is signed by no known key -- */
+    ((uint8_t *)(uintptr_t)payload.ptr)[0] ^= 0x01;
+    result = t_cose_sign1_verify_recover_signer(&verify_ctx,
+                                                &index,
+                                                 signed_cose,
+                                                &payload,
+                                                 NULL,
+                                                &signer);
+    if(result != T_COSE_ERR_UNKNOWN_KEY) {
+        return_value = 6000 + (int32_t)result;
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    for(i = 0; i < num_keys; i++) {
+        free_ecdsa_key_pair(key_pairs[i]);
+    }
+
+    return return_value;
+}
+#endif /* T_COSE_ENABLE_KEY_RECOVERY */
+
+
+#ifdef T_COSE_ENABLE_ENCRYPT
+/*
+ * Public function, see t_cose_sign_verify_test.h
+ */
+int_fast32_t sign_verify_encrypt_test()
+{
+    static const char              *kids[] = {"dev-0", "dev-1", "dev-2"};
+    struct t_cose_encrypt_recipient recipients[3];
+    struct t_cose_key               key_pairs[3];
+    struct t_cose_encrypt_ctx       encrypt_ctx;
+    struct t_cose_decrypt_ctx       decrypt_ctx;
+    int32_t                         return_value;
+    enum t_cose_err_t               result;
+    Q_USEFUL_BUF_MAKE_STACK_UB(     encrypted_buffer, 600);
+    Q_USEFUL_BUF_MAKE_STACK_UB(     plaintext_buffer, 64);
+    Q_USEFUL_BUF_MAKE_STACK_UB(     big_buffer, 4 + T_COSE_ENCRYPT_MAX_PROTECTED_SIZE + 1);
+    struct q_useful_buf_c           encrypted;
+    struct q_useful_buf_c           plaintext;
+    size_t                          num_keys;
+    size_t                          i;
+
+    num_keys = 0;
+
+    for(i = 0; i < 3; i++) {
+        result = make_ecdsa_key_pair(T_COSE_ALGORITHM_ES256, &key_pairs[i]);
+        if(result) {
+            return_value = 1000 + (int32_t)result;
+            goto Done;
+        }
+        num_keys++;
+        recipients[i].public_key = key_pairs[i];
+        recipients[i].kid        = q_useful_buf_from_sz(kids[i]);
+    }
+
+    /* -- Encrypt once for all three -- */
+    t_cose_encrypt_init(&encrypt_ctx,
+                        T_COSE_ALGORITHM_A128GCM,
+                        T_COSE_ALGORITHM_ECDH_ES_A128KW);
+#ifdef T_COSE_ENABLE_PTHREADS
+    t_cose_encrypt_set_parallel(&encrypt_ctx, t_cose_parallel_run_pthreads, NULL);
+#endif
+    result = t_cose_encrypt(&encrypt_ctx,
+                            Q_USEFUL_BUF_FROM_SZ_LITERAL("config"),
+                            recipients,
+                            3,
+                            encrypted_buffer,
+                            &encrypted);
+    if(result) {
+        return_value = 2000 + (int32_t)result;
+        goto Done;
+    }
+
+    /* -- Each recipient decrypts with its own key -- */
+    for(i = 0; i < 3; i++) {
+        t_cose_decrypt_init(&decrypt_ctx);
+        t_cose_decrypt_set_private_key(&decrypt_ctx,
+                                       key_pairs[i],
+                                       q_useful_buf_from_sz(kids[i]));
+        result = t_cose_decrypt(&decrypt_ctx,
+                                encrypted,
+                                plaintext_buffer,
+                                &plaintext);
+        if(result) {
+            return_value = 3000 + (int32_t)result;
+            goto Done;
+        }
+        if(q_useful_buf_compare(plaintext, Q_USEFUL_BUF_FROM_SZ_LITERAL("config"))) {
+            return_value = 4000;
+            goto Done;
+        }
+    }
+
+    /* -- A kid that isn't there -- */
+    t_cose_decrypt_set_private_key(&decrypt_ctx,
+                                   key_pairs[0],
+                                   Q_USEFUL_BUF_FROM_SZ_LITERAL("dev-9"));
+    result = t_cose_decrypt(&decrypt_ctx, encrypted, plaintext_buffer, &plaintext);
+    if(result != T_COSE_ERR_UNKNOWN_KEY) {
+        return_value = 5000 + (int32_t)result;
+        goto Done;
+    }
+
+    /* -- The wrong key for the kid -- */
+    t_cose_decrypt_set_private_key(&decrypt_ctx,
+                                   key_pairs[0],
+                                   q_useful_buf_from_sz(kids[1]));
+    result = t_cose_decrypt(&decrypt_ctx, encrypted, plaintext_buffer, &plaintext);
+    if(result != T_COSE_ERR_DECRYPT_FAIL) {
+        return_value = 6000 + (int32_t)result;
+        goto Done;
+    }
+
+    /* -- Modified ciphertext. It starts after the tag, the array head,
+     * the 4 bytes of protected parameters, the 15 bytes of unprotected
+     * parameters and its own 1-byte head. -- */
+    ((uint8_t *)(uintptr_t)encrypted.ptr)[2 + 1 + 4 + 15 + 1] ^= 0x01;
+    t_cose_decrypt_set_private_key(&decrypt_ctx,
+                                   key_pairs[0],
+                                   q_useful_buf_from_sz(kids[0]));
+    result = t_cose_decrypt(&decrypt_ctx, encrypted, plaintext_buffer, &plaintext);
+    if(result != T_COSE_ERR_DECRYPT_FAIL) {
+        return_value = 7000 + (int32_t)result;
+        goto Done;
+    }
+
+    /* -- Protected parameters too large for the AAD buffer. Only the
+     * array head and the byte string are needed to get to the check. -- */
+    memset(big_buffer.ptr, 0xa0, big_buffer.len);
+    ((uint8_t *)big_buffer.ptr)[0] = 0x84;
+    ((uint8_t *)big_buffer.ptr)[1] = 0x59;
+    ((uint8_t *)big_buffer.ptr)[2] = (uint8_t)((T_COSE_ENCRYPT_MAX_PROTECTED_SIZE + 1) >> 8);
+    ((uint8_t *)big_buffer.ptr)[3] = (uint8_t)(T_COSE_ENCRYPT_MAX_PROTECTED_SIZE + 1);
+    result = t_cose_decrypt(&decrypt_ctx,
+                            q_useful_buf_const(big_buffer),
+                            plaintext_buffer,
+                            &plaintext);
+    if(result != T_COSE_ERR_ENCRYPT_PROTECTED_SIZE) {
+        return_value = 8000 + (int32_t)result;
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    for(i = 0; i < num_keys; i++) {
+        free_ecdsa_key_pair(key_pairs[i]);
+    }
+
+    return return_value;
+}
+#endif /* T_COSE_ENABLE_ENCRYPT */
+
+
+#ifdef T_COSE_ENABLE_OSCORE
+/*
+ * Public function, see t_cose_sign_verify_test.h
+ *
+ * The request and response are test vectors 4 and 7 of RFC 8613
+ * appendix C.
+ */
+int_fast32_t sign_verify_oscore_test()
+{
+    static const uint8_t master_secret[] = {
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+        0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10};
+    static const uint8_t master_salt[] = {
+        0x9e, 0x7c, 0xa9, 0x22, 0x23, 0x78, 0x63, 0x40};
+    static const uint8_t server_id[] = {0x01};
+    static const uint8_t request_plaintext[] = {
+        0x01, 0xb3, 0x74, 0x76, 0x31};
+    static const uint8_t request_option[] = {0x09, 0x14};
+    static const uint8_t request_ciphertext[] = {
+        0x61, 0x2f, 0x10, 0x92, 0xf1, 0x77, 0x6f, 0x1c,
+        0x16, 0x68, 0xb3, 0x82, 0x5e};
+    static const uint8_t response_plaintext[] = {
+        0x45, 0xff, 0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x20,
+        0x57, 0x6f, 0x72, 0x6c, 0x64, 0x21};
+    static const uint8_t response_ciphertext[] = {
+        0xdb, 0xaa, 0xd1, 0xe9, 0xa7, 0xe7, 0xb2, 0xa8,
+        0x13, 0xd3, 0xc3, 0x15, 0x24, 0x37, 0x83, 0x03,
+        0xcd, 0xaf, 0xae, 0x11, 0x91, 0x06};
+
+    struct t_cose_oscore_ctx     client;
+    struct t_cose_oscore_ctx     server;
+    struct t_cose_oscore_request client_request;
+    struct t_cose_oscore_request server_request;
+    struct t_cose_oscore_option  option;
+    int32_t                      return_value;
+    enum t_cose_err_t            result;
+    Q_USEFUL_BUF_MAKE_STACK_UB(  option_buffer, T_COSE_OSCORE_MAX_OPTION_SIZE);
+    Q_USEFUL_BUF_MAKE_STACK_UB(  ciphertext_buffer, 64);
+    Q_USEFUL_BUF_MAKE_STACK_UB(  plaintext_buffer, 64);
+    struct q_useful_buf_c        option_value;
+    struct q_useful_buf_c        ciphertext;
+    struct q_useful_buf_c        plaintext;
+    int                          i;
+
+    result = t_cose_oscore_init(&client,
+                                T_COSE_ALGORITHM_AES_CCM_16_64_128,
+                                Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(master_secret),
+                                Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(master_salt),
+                                Q_USEFUL_BUF_FROM_SZ_LITERAL(""),
+                                Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(server_id),
+                                NULL_Q_USEFUL_BUF_C);
+    if(result) {
+        return_value = 1000 + (int32_t)result;
+        goto Done;
+    }
+    result = t_cose_oscore_init(&server,
+                                T_COSE_ALGORITHM_AES_CCM_16_64_128,
+                                Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(master_secret),
+                                Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(master_salt),
+                                Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(server_id),
+                                Q_USEFUL_BUF_FROM_SZ_LITERAL(""),
+                                NULL_Q_USEFUL_BUF_C);
+    if(result) {
+        return_value = 1100 + (int32_t)result;
+        goto Done;
+    }
+
+    /* -- The test vector request has sequence number 20 -- */
+    for(i = 0; i <= 20; i++) {
+        result = t_cose_oscore_protect_request(&client,
+                                               Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(request_plaintext),
+                                               option_buffer,
+                                               &option_value,
+                                               ciphertext_buffer,
+                                               &ciphertext,
+                                               &client_request);
+        if(result) {
+            return_value = 2000 + (int32_t)result;
+            goto Done;
+        }
+    }
+    if(q_useful_buf_compare(option_value,
+                            Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(request_option)) ||
+       q_useful_buf_compare(ciphertext,
+                            Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(request_ciphertext))) {
+        return_value = 2100;
+        goto Done;
+    }
+
+    /* -- The server unprotects it -- */
+    result = t_cose_oscore_parse_option(option_value, &option);
+    if(result) {
+        return_value = 3000 + (int32_t)result;
+        goto Done;
+    }
+    result = t_cose_oscore_unprotect_request(&server,
+                                             &option,
+                                             ciphertext,
+                                             plaintext_buffer,
+                                             &plaintext,
+                                             &server_request);
+    if(result) {
+        return_value = 3100 + (int32_t)result;
+        goto Done;
+    }
+    if(q_useful_buf_compare(plaintext,
+                            Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(request_plaintext))) {
+        return_value = 3200;
+        goto Done;
+    }
+
+    /* -- The same request again is a replay -- */
+    result = t_cose_oscore_unprotect_request(&server,
+                                             &option,
+                                             ciphertext,
+                                             plaintext_buffer,
+                                             &plaintext,
+                                             &server_request);
+    if(result != T_COSE_ERR_REPLAY) {
+        return_value = 4000 + (int32_t)result;
+        goto Done;
+    }
+
+    /* -- The response -- */
+    result = t_cose_oscore_protect_response(&server,
+                                            &server_request,
+                                            Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(response_plaintext),
+                                            ciphertext_buffer,
+                                            &ciphertext);
+    if(result) {
+        return_value = 5000 + (int32_t)result;
+        goto Done;
+    }
+    if(q_useful_buf_compare(ciphertext,
+                            Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(response_ciphertext))) {
+        return_value = 5100;
+        goto Done;
+    }
+
+    /* The option of the response is empty */
+    t_cose_oscore_parse_option(NULL_Q_USEFUL_BUF_C, &option);
+    result = t_cose_oscore_unprotect_response(&client,
+                                              &client_request,
+                                              &option,
+                                              ciphertext,
+                                              plaintext_buffer,
+                                              &plaintext);
+    if(result) {
+        return_value = 6000 + (int32_t)result;
+        goto Done;
+    }
+    if(q_useful_buf_compare(plaintext,
+                            Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(response_plaintext))) {
+        return_value = 6100;
+        goto Done;
+    }
+
+    /* -- A modified response -- */
+    ((uint8_t *)(uintptr_t)ciphertext.ptr)[0] ^= 0x01;
+    result = t_cose_oscore_unprotect_response(&client,
+                                              &client_request,
+                                              &option,
+                                              ciphertext,
+                                              plaintext_buffer,
+                                              &plaintext);
+    if(result != T_COSE_ERR_DECRYPT_FAIL) {
+        return_value = 7000 + (int32_t)result;
+        goto Done;
+    }
+
+    /* -- An option not from t_cose_oscore_parse_option() with a
+     * partial IV that is too long -- */
+    option.partial_iv  = Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(master_secret);
+    option.kid_context = NULL_Q_USEFUL_BUF_C;
+    option.kid         = Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(server_id);
+    result = t_cose_oscore_unprotect_request(&server,
+                                             &option,
+                                             ciphertext,
+                                             plaintext_buffer,
+                                             &plaintext,
+                                             &server_request);
+    if(result != T_COSE_ERR_OSCORE_FORMAT) {
+        return_value = 8000 + (int32_t)result;
+        goto Done;
+    }
+    result = t_cose_oscore_unprotect_response(&client,
+                                              &client_request,
+                                              &option,
+                                              ciphertext,
+                                              plaintext_buffer,
+                                              &plaintext);
+    if(result != T_COSE_ERR_OSCORE_FORMAT) {
+        return_value = 8100 + (int32_t)result;
+        goto Done;
+    }
+
+    /* -- And one with a kid that is too long -- */
+    option.partial_iv = Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(server_id);
+    option.kid        = Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(master_secret);
+    result = t_cose_oscore_unprotect_request(&server,
+                                             &option,
+                                             ciphertext,
+                                             plaintext_buffer,
+                                             &plaintext,
+                                             &server_request);
+    if(result != T_COSE_ERR_OSCORE_FORMAT) {
+        return_value = 8200 + (int32_t)result;
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    return return_value;
+}
+#endif /* T_COSE_ENABLE_OSCORE */
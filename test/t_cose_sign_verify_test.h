@@ -46,4 +46,41 @@ int_fast32_t sign_verify_make_cwt_test(void);
  */
 int_fast32_t sign_verify_get_size_test(void);
 
+
+#ifdef T_COSE_ENABLE_RESTARTABLE
+/*
+ * Sign and verify in time slices with a restart context
+ */
+int_fast32_t sign_verify_restartable_test(void);
+#endif
+
+#ifdef T_COSE_ENABLE_VERIFY_CACHE
+/*
+ * Verify twice with the verification cache and see it hit
+ */
+int_fast32_t sign_verify_cache_test(void);
+#endif
+
+#ifdef T_COSE_ENABLE_KEY_RECOVERY
+/*
+ * Find the signer of a COSE_Sign1 without a kid from several keys
+ */
+int_fast32_t sign_verify_recover_signer_test(void);
+#endif
+
+#ifdef T_COSE_ENABLE_ENCRYPT
+/*
+ * Encrypt once for several recipients and have each decrypt
+ */
+int_fast32_t sign_verify_encrypt_test(void);
+#endif
+
+#ifdef T_COSE_ENABLE_OSCORE
+/*
+ * Protect and unprotect the OSCORE test vectors of RFC 8613
+ */
+int_fast32_t sign_verify_oscore_test(void);
+#endif
+
+
 #endif /* t_cose_sign_verify_test_h */
@@ -11,6 +11,13 @@
 #include "t_cose_test.h"
 #include "t_cose/t_cose_sign1_sign.h"
 #include "t_cose/t_cose_sign1_verify.h"
+#include "t_cose/t_cose_hash_envelope.h"
+#include "t_cose/t_cose_sign1_batch.h"
+#include "t_cose/t_cose_protected_intern.h"
+#include "t_cose/t_cose_verify_sched.h"
+#include "t_cose/t_cose_countersign.h"
+#include "t_cose/t_cose_multi_sign.h"
+#include "t_cose/t_cose_suit.h"
 #include "t_cose_make_test_messages.h"
 #include "t_cose/q_useful_buf.h"
 #include "t_cose_crypto.h" /* For signature size constant */
@@ -692,114 +699,103 @@ int_fast32_t all_header_parameters_test()
     return 0;
 }
 
-struct test_case {
-    uint32_t           test_option;
-    enum t_cose_err_t  result;
-};
-
-static struct test_case bad_parameters_tests_table[] = {
-
-    {T_COSE_TEST_EMPTY_PROTECTED_PARAMETERS, T_COSE_ERR_UNSUPPORTED_HASH},
-
-    {T_COSE_TEST_DUP_CONTENT_ID, T_COSE_ERR_DUPLICATE_PARAMETER},
-
-    {T_COSE_TEST_UNCLOSED_PROTECTED, T_COSE_ERR_CBOR_NOT_WELL_FORMED},
-
-    {T_COSE_TEST_TOO_LARGE_CONTENT_TYPE, T_COSE_ERR_BAD_CONTENT_TYPE},
-
-    /* This makes consume_item() error out */
-    {T_COSE_TEST_NOT_WELL_FORMED_2, T_COSE_ERR_CBOR_NOT_WELL_FORMED},
-
-    {T_COSE_TEST_KID_IN_PROTECTED, T_COSE_ERR_DUPLICATE_PARAMETER},
-
-    {T_COSE_TEST_TOO_MANY_UNKNOWN, T_COSE_ERR_TOO_MANY_PARAMETERS},
-
-    {T_COSE_TEST_UNPROTECTED_NOT_MAP, T_COSE_ERR_PARAMETER_CBOR},
-
-    {T_COSE_TEST_BAD_CRIT_PARAMETER, T_COSE_ERR_PARAMETER_NOT_PROTECTED},
-
-    {T_COSE_TEST_BAD_CRIT_PARAMETER, T_COSE_ERR_PARAMETER_NOT_PROTECTED},
-
-    {T_COSE_TEST_NOT_WELL_FORMED_1, T_COSE_ERR_CBOR_NOT_WELL_FORMED},
-
-    {T_COSE_TEST_NO_UNPROTECTED_PARAMETERS, T_COSE_ERR_PARAMETER_CBOR},
 
-    {T_COSE_TEST_NO_PROTECTED_PARAMETERS, T_COSE_ERR_SIGN1_FORMAT},
+/* Sign with short-circuit and verify with application parameters */
+static enum t_cose_err_t
+run_custom_parameters(uint32_t                        test_mess_options,
+                      struct t_cose_custom_parameter *custom_params,
+                      size_t                          num_custom_params)
+{
+    struct t_cose_sign1_sign_ctx    sign_ctx;
+    struct t_cose_sign1_verify_ctx  verify_ctx;
+    enum t_cose_err_t               result;
+    Q_USEFUL_BUF_MAKE_STACK_UB(     signed_cose_buffer, 300);
+    struct q_useful_buf_c           signed_cose;
+    struct q_useful_buf_c           payload;
 
-    {T_COSE_TEST_EXTRA_PARAMETER, T_COSE_SUCCESS},
+    t_cose_sign1_sign_init(&sign_ctx,
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           T_COSE_ALGORITHM_ES256);
 
-    {T_COSE_TEST_PARAMETER_LABEL, T_COSE_ERR_PARAMETER_CBOR},
+    result =
+        t_cose_test_message_sign1_sign(&sign_ctx,
+                                       test_mess_options,
+                                       Q_USEFUL_BUF_FROM_SZ_LITERAL("payload"),
+                                       signed_cose_buffer,
+                                       &signed_cose);
+    if(result) {
+        return result;
+    }
 
-    {T_COSE_TEST_BAD_PROTECTED, T_COSE_ERR_PARAMETER_CBOR},
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+    t_cose_sign1_verify_set_custom_parameters(&verify_ctx,
+                                              custom_params,
+                                              num_custom_params);
 
-    {0, 0}
-};
+    return t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, NULL);
+}
 
 
 /*
  * Public function, see t_cose_test.h
  */
-int_fast32_t bad_parameters_test()
+int_fast32_t custom_parameters_test()
 {
-    struct test_case *test;
-
-    for(test = bad_parameters_tests_table; test->test_option; test++) {
-        if(run_test_sign_and_verify(test->test_option) != test->result) {
-            return (int_fast32_t)(test - bad_parameters_tests_table + 1);
-        }
+    enum t_cose_err_t              result;
+    struct t_cose_custom_parameter custom[T_COSE_PARAMETER_LIST_MAX + 1];
+    int                            i;
+
+    /* An array-valued parameter in the unprotected bucket and one
+     * that is not present at all */
+    custom[0].label = 55;
+    custom[1].label = 99;
+    result = run_custom_parameters(T_COSE_TEST_ALL_PARAMETERS, custom, 2);
+    if(result) {
+        return 1;
+    }
+    if(custom[0].type != T_COSE_CUSTOM_PARAM_OTHER || custom[0].in_protected) {
+        return 2;
+    }
+    if(custom[1].type != T_COSE_CUSTOM_PARAM_ABSENT) {
+        return 3;
     }
 
-    return 0;
-}
-
-
-
-
-static struct test_case crit_tests_table[] = {
-    /* Test existance of the critical header. Also makes sure that
-     * it works with the max number of labels allowed in it.
-     */
-    {T_COSE_TEST_CRIT_PARAMETER_EXIST, T_COSE_SUCCESS},
-
-    /* Exceed the max number of labels by one and get an error */
-    {T_COSE_TEST_TOO_MANY_CRIT_PARAMETER_EXIST, T_COSE_ERR_CRIT_PARAMETER},
-
-    /* A critical parameter exists in the protected section, but the
-     * format of the internals of this parameter is not the expected CBOR
-     */
-    {T_COSE_TEST_BAD_CRIT_LABEL, T_COSE_ERR_CRIT_PARAMETER},
-
-    /* A critical label is listed in the protected section, but
-     * the label doesn't exist. This works for integer-labeled header params.
-     */
-    {T_COSE_TEST_UNKNOWN_CRIT_UINT_PARAMETER, T_COSE_ERR_UNKNOWN_CRITICAL_PARAMETER},
-
-    /* A critical label is listed in the protected section, but
-     * the label doesn't exist. This works for string-labeled header params.
-     */
-    {T_COSE_TEST_UNKNOWN_CRIT_TSTR_PARAMETER, T_COSE_ERR_UNKNOWN_CRITICAL_PARAMETER},
-
-    /* The critical labels list is not protected */
-    {T_COSE_TEST_CRIT_NOT_PROTECTED, T_COSE_ERR_PARAMETER_NOT_PROTECTED},
-
-    {T_COSE_TEST_EMPTY_CRIT_PARAMETER, T_COSE_ERR_CRIT_PARAMETER},
-
-    {T_COSE_TEST_TOO_MANY_TSTR_CRIT_LABLELS, T_COSE_ERR_CRIT_PARAMETER},
-
-    {0, 0}
-};
-
-
-/*
- * Public function, see t_cose_test.h
- */
-int_fast32_t crit_parameters_test()
-{
-    struct test_case *test;
+    /* Without it label 42 is an unknown critical parameter. With it
+     * the application has declared it understands it. */
+    result = run_custom_parameters(T_COSE_TEST_UNKNOWN_CRIT_UINT_PARAMETER,
+                                   NULL,
+                                   0);
+    if(result != T_COSE_ERR_UNKNOWN_CRITICAL_PARAMETER) {
+        return 4;
+    }
+    custom[0].label = 42;
+    result = run_custom_parameters(T_COSE_TEST_UNKNOWN_CRIT_UINT_PARAMETER,
+                                   custom,
+                                   1);
+    if(result) {
+        return 5;
+    }
+    if(custom[0].type != T_COSE_CUSTOM_PARAM_INT64 ||
+       custom[0].value.int64 != 43 ||
+       !custom[0].in_protected) {
+        return 6;
+    }
 
-    for(test = crit_tests_table; test->test_option; test++) {
-        if(run_test_sign_and_verify(test->test_option) != test->result) {
-            return (int_fast32_t)(test - crit_tests_table);
+    /* More parameters than fit in the unknown label list are fine
+     * when the application asks for all of them */
+    for(i = 0; i < T_COSE_PARAMETER_LIST_MAX + 1; i++) {
+        custom[i].label = i + 10;
+    }
+    result = run_custom_parameters(T_COSE_TEST_TOO_MANY_UNKNOWN,
+                                   custom,
+                                   T_COSE_PARAMETER_LIST_MAX + 1);
+    if(result) {
+        return 7;
+    }
+    for(i = 0; i < T_COSE_PARAMETER_LIST_MAX + 1; i++) {
+        if(custom[i].type != T_COSE_CUSTOM_PARAM_BOOL ||
+           !custom[i].value.boolean) {
+            return 8;
         }
     }
 
@@ -807,232 +803,2890 @@ int_fast32_t crit_parameters_test()
 }
 
 
+
+#ifndef T_COSE_DISABLE_HASH_ENVELOPE
 /*
  * Public function, see t_cose_test.h
  */
-int_fast32_t content_type_test()
+int_fast32_t hash_envelope_test()
 {
-#ifndef T_COSE_DISABLE_CONTENT_TYPE
-
+    enum t_cose_err_t               result;
+    Q_USEFUL_BUF_MAKE_STACK_UB(     signed_cose_buffer, 300);
+    Q_USEFUL_BUF_MAKE_STACK_UB(     hash_buffer, T_COSE_CRYPTO_SHA256_SIZE);
+    struct q_useful_buf_c           signed_cose;
+    struct q_useful_buf_c           content_hash;
+    struct q_useful_buf_c           payload;
     struct t_cose_parameters        parameters;
     struct t_cose_sign1_sign_ctx    sign_ctx;
-    Q_USEFUL_BUF_MAKE_STACK_UB(     signed_cose_buffer, 200);
-    struct q_useful_buf_c           output;
-    struct q_useful_buf_c           payload;
-    enum t_cose_err_t               result;
     struct t_cose_sign1_verify_ctx  verify_ctx;
 
+    /* -- Hash the content once as a build system would -- */
+    result = t_cose_hash_envelope_compute(T_COSE_ALGORITHM_SHA_256,
+                                          s_input_payload,
+                                          hash_buffer,
+                                          &content_hash);
+    if(result) {
+        return 1;
+    }
 
-    /* -- integer content type -- */
+    /* -- Sign the hash -- */
     t_cose_sign1_sign_init(&sign_ctx,
                            T_COSE_OPT_SHORT_CIRCUIT_SIG,
                            T_COSE_ALGORITHM_ES256);
-
-    t_cose_sign1_set_content_type_uint(&sign_ctx, 42);
+    t_cose_sign1_set_payload_hash_alg(&sign_ctx, T_COSE_ALGORITHM_SHA_256);
+    t_cose_sign1_set_preimage_content_type_tstr(&sign_ctx, "text/plain");
+    t_cose_sign1_set_payload_location(&sign_ctx, "https://example.com/a");
 
     result = t_cose_sign1_sign(&sign_ctx,
-                                      s_input_payload,
-                                      signed_cose_buffer,
-                                     &output);
+                               content_hash,
+                               signed_cose_buffer,
+                               &signed_cose);
     if(result) {
-        return 1;
+        return 2;
     }
 
+    /* -- Verify and check the content against the hash -- */
     t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
-
     result = t_cose_sign1_verify(&verify_ctx,
-                                        output,
-                                       &payload,
-                                       &parameters);
+                                 signed_cose,
+                                 &payload,
+                                 &parameters);
     if(result) {
-        return 2;
+        return 3;
     }
 
-    if(parameters.content_type_uint != 42) {
+    if(parameters.payload_hash_alg_id != T_COSE_ALGORITHM_SHA_256 ||
+       q_useful_buf_compare(parameters.preimage_content_type_tstr,
+                            Q_USEFUL_BUF_FROM_SZ_LITERAL("text/plain")) ||
+       parameters.preimage_content_type_uint != T_COSE_EMPTY_UINT_CONTENT_TYPE ||
+       q_useful_buf_compare(parameters.payload_location,
+                            Q_USEFUL_BUF_FROM_SZ_LITERAL("https://example.com/a"))) {
+        return 4;
+    }
+
+    result = t_cose_hash_envelope_check(&parameters, payload, s_input_payload);
+    if(result) {
         return 5;
     }
 
+    result = t_cose_hash_envelope_check(&parameters,
+                                        payload,
+                                        Q_USEFUL_BUF_FROM_SZ_LITERAL("not it"));
+    if(result != T_COSE_ERR_PAYLOAD_HASH_MISMATCH) {
+        return 6;
+    }
 
-    /* -- string content type -- */
+    /* -- A payload that is not the size of the hash -- */
     t_cose_sign1_sign_init(&sign_ctx,
                            T_COSE_OPT_SHORT_CIRCUIT_SIG,
                            T_COSE_ALGORITHM_ES256);
+    t_cose_sign1_set_payload_hash_alg(&sign_ctx, T_COSE_ALGORITHM_SHA_256);
+    result = t_cose_sign1_sign(&sign_ctx,
+                               s_input_payload,
+                               signed_cose_buffer,
+                               &signed_cose);
+    if(result != T_COSE_ERR_INVALID_ARGUMENT) {
+        return 7;
+    }
 
-    t_cose_sign1_set_content_type_tstr(&sign_ctx, "text/plain");
-
+#ifndef T_COSE_DISABLE_CONTENT_TYPE
+    /* -- The payload is a hash so it can't have a content type -- */
+    t_cose_sign1_set_content_type_uint(&sign_ctx, 42);
     result = t_cose_sign1_sign(&sign_ctx,
-                                     s_input_payload,
-                                     signed_cose_buffer,
-                                     &output);
+                               content_hash,
+                               signed_cose_buffer,
+                               &signed_cose);
+    if(result != T_COSE_ERR_BAD_CONTENT_TYPE) {
+        return 8;
+    }
+#endif
+
+    /* -- Not a hash envelope -- */
+    parameters.payload_hash_alg_id = T_COSE_UNSET_ALGORITHM_ID;
+    result = t_cose_hash_envelope_check(&parameters, payload, s_input_payload);
+    if(result != T_COSE_ERR_UNSUPPORTED_HASH) {
+        return 9;
+    }
+
+    return 0;
+}
+#endif /* T_COSE_DISABLE_HASH_ENVELOPE */
+
+
+#if !defined(T_COSE_DISABLE_PROTECTED_INTERN) && !defined(T_COSE_DISABLE_HASH_ENVELOPE)
+/* Get the encoded protected parameters out of a COSE_Sign1 */
+static struct q_useful_buf_c get_protected(struct q_useful_buf_c cose_sign1)
+{
+    QCBORDecodeContext decode_context;
+    QCBORItem          item;
+
+    QCBORDecode_Init(&decode_context, cose_sign1, QCBOR_DECODE_MODE_NORMAL);
+    QCBORDecode_GetNext(&decode_context, &item);
+    QCBORDecode_GetNext(&decode_context, &item);
+    if(item.uDataType != QCBOR_TYPE_BYTE_STRING) {
+        return NULL_Q_USEFUL_BUF_C;
+    }
+    return item.val.string;
+}
+
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t protected_intern_test()
+{
+    enum t_cose_err_t                    result;
+    struct t_cose_protected_intern_entry entries[2];
+    struct t_cose_protected_intern_table table;
+    struct t_cose_sign1_sign_ctx         sign_ctx;
+    struct t_cose_sign1_verify_ctx       verify_ctx;
+    Q_USEFUL_BUF_MAKE_STACK_UB(          signed_cose_buffer, 300);
+    Q_USEFUL_BUF_MAKE_STACK_UB(          hash_buffer, T_COSE_CRYPTO_SHA256_SIZE);
+    struct q_useful_buf_c                signed_cose;
+    struct q_useful_buf_c                content_hash;
+    struct q_useful_buf_c                protected_parameters;
+    struct q_useful_buf_c                payload;
+    struct t_cose_parameters             parameters;
+    struct t_cose_parameters             interned_parameters;
+    const uint8_t                       *message_end;
+
+    t_cose_protected_intern_init(&table, entries, 2);
+
+    /* -- A hash envelope has a longer protected header -- */
+    result = t_cose_hash_envelope_compute(T_COSE_ALGORITHM_SHA_256,
+                                          s_input_payload,
+                                          hash_buffer,
+                                          &content_hash);
     if(result) {
         return 1;
     }
+    t_cose_sign1_sign_init(&sign_ctx,
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           T_COSE_ALGORITHM_ES256);
+    t_cose_sign1_set_payload_hash_alg(&sign_ctx, T_COSE_ALGORITHM_SHA_256);
+    t_cose_sign1_set_preimage_content_type_tstr(&sign_ctx, "text/plain");
+    t_cose_sign1_set_payload_location(&sign_ctx, "https://example.com/a");
+    result = t_cose_sign1_sign(&sign_ctx,
+                               content_hash,
+                               signed_cose_buffer,
+                               &signed_cose);
+    if(result) {
+        return 2;
+    }
 
-    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+    /* -- Intern it, twice which is the same as once -- */
+    protected_parameters = get_protected(signed_cose);
+    result = t_cose_protected_intern_add(&table, protected_parameters);
+    if(result) {
+        return 3;
+    }
+    result = t_cose_protected_intern_add(&table, protected_parameters);
+    if(result || table.num_entries != 1) {
+        return 4;
+    }
 
-    result = t_cose_sign1_verify(&verify_ctx,
-                                       output,
-                                       &payload,
-                                       &parameters);
+    /* -- Same parameters with and without the table -- */
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+    result = t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, &parameters);
     if(result) {
-        return 2;
+        return 5;
     }
 
-    if(q_useful_buf_compare(parameters.content_type_tstr, Q_USEFUL_BUF_FROM_SZ_LITERAL("text/plain"))) {
+    t_cose_sign1_verify_set_intern_table(&verify_ctx, &table);
+    result = t_cose_sign1_verify(&verify_ctx,
+                                 signed_cose,
+                                 &payload,
+                                 &interned_parameters);
+    if(result) {
         return 6;
     }
+    if(interned_parameters.cose_algorithm_id != parameters.cose_algorithm_id ||
+       interned_parameters.payload_hash_alg_id != parameters.payload_hash_alg_id ||
+       q_useful_buf_compare(interned_parameters.preimage_content_type_tstr,
+                            parameters.preimage_content_type_tstr) ||
+       q_useful_buf_compare(interned_parameters.payload_location,
+                            parameters.payload_location) ||
+       q_useful_buf_compare(interned_parameters.kid, parameters.kid)) {
+        return 7;
+    }
 
+    /* -- Strings point into the message, not the table -- */
+    message_end = (const uint8_t *)signed_cose.ptr + signed_cose.len;
+    if(interned_parameters.payload_location.ptr != parameters.payload_location.ptr ||
+       (const uint8_t *)interned_parameters.payload_location.ptr >= message_end) {
+        return 8;
+    }
 
-    /* -- content type in error -- */
+    /* -- A built-in header with no table -- */
     t_cose_sign1_sign_init(&sign_ctx,
                            T_COSE_OPT_SHORT_CIRCUIT_SIG,
                            T_COSE_ALGORITHM_ES256);
+    result = t_cose_sign1_sign(&sign_ctx,
+                               s_input_payload,
+                               signed_cose_buffer,
+                               &signed_cose);
+    if(result ||
+       q_useful_buf_compare(get_protected(signed_cose),
+                            Q_USEFUL_BUF_FROM_SZ_LITERAL("\xa1\x01\x26"))) {
+        return 9;
+    }
+    t_cose_sign1_verify_set_intern_table(&verify_ctx, NULL);
+    result = t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, &parameters);
+    if(result || parameters.cose_algorithm_id != T_COSE_ALGORITHM_ES256) {
+        return 10;
+    }
 
-    t_cose_sign1_set_content_type_tstr(&sign_ctx, "text/plain");
-    t_cose_sign1_set_content_type_uint(&sign_ctx, 42);
+    /* -- Headers that can't be interned -- */
+    /* {1: -7, 99: 1}, an unknown label */
+    result = t_cose_protected_intern_add(&table,
+                           Q_USEFUL_BUF_FROM_SZ_LITERAL("\xa2\x01\x26\x18\x63\x01"));
+    if(result != T_COSE_ERR_INVALID_ARGUMENT) {
+        return 11;
+    }
 
+    /* Not a map */
+    result = t_cose_protected_intern_add(&table,
+                           Q_USEFUL_BUF_FROM_SZ_LITERAL("\x81\x01"));
+    if(result != T_COSE_ERR_PARAMETER_CBOR) {
+        return 12;
+    }
 
-    result = t_cose_sign1_sign(&sign_ctx,
-                                     Q_USEFUL_BUF_FROM_SZ_LITERAL("payload"),
-                                     signed_cose_buffer,
-                                     &output);
-    if(result != T_COSE_ERR_DUPLICATE_PARAMETER) {
-        return 1;
+    /* -- Full table -- */
+    /* {1: -35} */
+    result = t_cose_protected_intern_add(&table,
+                           Q_USEFUL_BUF_FROM_SZ_LITERAL("\xa1\x01\x38\x22"));
+    if(result) {
+        return 13;
     }
-#endif
+    /* {1: -36} */
+    result = t_cose_protected_intern_add(&table,
+                           Q_USEFUL_BUF_FROM_SZ_LITERAL("\xa1\x01\x38\x23"));
+    if(result != T_COSE_ERR_TOO_SMALL) {
+        return 14;
+    }
+
     return 0;
+}
+#endif /* !T_COSE_DISABLE_PROTECTED_INTERN && !T_COSE_DISABLE_HASH_ENVELOPE */
 
+
+
+/* Encode a small CWT-like payload. Used to compare the two ways of
+ * making a COSE_Sign1 with the payload output through QCBOR. */
+static void encode_test_claims(QCBOREncodeContext *cbor_encode)
+{
+    QCBOREncode_OpenMap(cbor_encode);
+    QCBOREncode_AddSZStringToMapN(cbor_encode, 1, "coap://as.example.com");
+    QCBOREncode_AddInt64ToMapN(cbor_encode, 4, 1444064944);
+    QCBOREncode_CloseMap(cbor_encode);
 }
 
 
-struct sign1_sample {
-    struct q_useful_buf_c CBOR;
-    enum t_cose_err_t     expected_error;
-};
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t known_length_payload_test()
+{
+    enum t_cose_err_t               result;
+    struct t_cose_sign1_sign_ctx    sign_ctx;
+    struct t_cose_sign1_verify_ctx  verify_ctx;
+    QCBOREncodeContext              cbor_encode;
+    Q_USEFUL_BUF_MAKE_STACK_UB(     claims_buffer, 100);
+    Q_USEFUL_BUF_MAKE_STACK_UB(     wrapped_buffer, 300);
+    Q_USEFUL_BUF_MAKE_STACK_UB(     known_buffer, 300);
+    struct q_useful_buf_c           claims;
+    struct q_useful_buf_c           wrapped_cose;
+    struct q_useful_buf_c           known_cose;
+    struct q_useful_buf_c           payload;
+    size_t                          calculated_size;
 
-static struct sign1_sample sign1_sample_inputs[] = {
-    /* With an indefinite length string payload */
-    { {(uint8_t[]){0x84, 0x40, 0xa0, 0x5f, 0x00, 0xff, 0x40}, 7}, T_COSE_ERR_SIGN1_FORMAT},
-    /* Too few items in unprotected header parameters bucket */
-    { {(uint8_t[]){0x84, 0x40, 0xa3, 0x40, 0x40}, 5}, T_COSE_ERR_PARAMETER_CBOR},
-    /* Too few items in definite array */
-    { {(uint8_t[]){0x83, 0x40, 0xa0, 0x40}, 4}, T_COSE_ERR_SIGN1_FORMAT},
-    /* Too-long signature */
-    { {(uint8_t[]){0x84, 0x40, 0xa0, 0x40, 0x4f}, 5}, T_COSE_ERR_SIGN1_FORMAT},
-    /* Too-long payload */
-    { {(uint8_t[]){0x84, 0x40, 0xa0, 0x4f, 0x40}, 5}, T_COSE_ERR_SIGN1_FORMAT},
-    /* Too-long protected parameters bucket */
-    { {(uint8_t[]){0x84, 0x4f, 0xa0, 0x40, 0x40}, 5}, T_COSE_ERR_SIGN1_FORMAT},
-    /* Unterminated indefinite length */
-    { {(uint8_t[]){0x9f, 0x40, 0xbf, 0xff, 0x40, 0x40}, 6}, T_COSE_ERR_CBOR_NOT_WELL_FORMED},
-    /* The smallest legal COSE_Sign1 using indefinite lengths */
-    { {(uint8_t[]){0x9f, 0x40, 0xbf, 0xff, 0x40, 0x40, 0xff}, 7}, T_COSE_SUCCESS},
-    /* The smallest legal COSE_Sign1 using definite lengths */
-    { {(uint8_t[]){0x84, 0x40, 0xa0, 0x40, 0x40}, 5}, T_COSE_SUCCESS},
-    /* Just one not-well-formed byte -- a reserved value */
-    { {(uint8_t[]){0x3c}, 1}, T_COSE_ERR_SIGN1_FORMAT },
-    /* terminate the list */
-    { {NULL, 0}, 0 },
-};
+    /* -- Get the length of the payload -- */
+    QCBOREncode_Init(&cbor_encode, claims_buffer);
+    encode_test_claims(&cbor_encode);
+    if(QCBOREncode_Finish(&cbor_encode, &claims)) {
+        return 1;
+    }
+
+    t_cose_sign1_sign_init(&sign_ctx,
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           T_COSE_ALGORITHM_ES256);
+
+    /* -- The usual way with byte string wrapping -- */
+    QCBOREncode_Init(&cbor_encode, wrapped_buffer);
+    result = t_cose_sign1_encode_parameters(&sign_ctx, &cbor_encode);
+    if(result) {
+        return 2;
+    }
+    encode_test_claims(&cbor_encode);
+    result = t_cose_sign1_encode_signature(&sign_ctx, &cbor_encode);
+    if(result || QCBOREncode_Finish(&cbor_encode, &wrapped_cose)) {
+        return 3;
+    }
+
+    /* -- With the length given up front -- */
+    QCBOREncode_Init(&cbor_encode, known_buffer);
+    result = t_cose_sign1_encode_parameters_known_length(&sign_ctx,
+                                                         claims.len,
+                                                         &cbor_encode);
+    if(result) {
+        return 4;
+    }
+    encode_test_claims(&cbor_encode);
+    result = t_cose_sign1_encode_signature(&sign_ctx, &cbor_encode);
+    if(result || QCBOREncode_Finish(&cbor_encode, &known_cose)) {
+        return 5;
+    }
+
+    /* -- Both are exactly the same and verify -- */
+    if(q_useful_buf_compare(wrapped_cose, known_cose)) {
+        return 6;
+    }
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+    result = t_cose_sign1_verify(&verify_ctx, known_cose, &payload, NULL);
+    if(result || q_useful_buf_compare(payload, claims)) {
+        return 7;
+    }
+
+    /* -- Size calculation gives the same size -- */
+    QCBOREncode_Init(&cbor_encode, (struct q_useful_buf){NULL, INT32_MAX});
+    result = t_cose_sign1_encode_parameters_known_length(&sign_ctx,
+                                                         claims.len,
+                                                         &cbor_encode);
+    encode_test_claims(&cbor_encode);
+    if(result || t_cose_sign1_encode_signature(&sign_ctx, &cbor_encode)) {
+        return 8;
+    }
+    if(QCBOREncode_FinishGetSize(&cbor_encode, &calculated_size) ||
+       calculated_size != known_cose.len) {
+        return 9;
+    }
+
+    /* -- A payload shorter than declared is an error -- */
+    QCBOREncode_Init(&cbor_encode, known_buffer);
+    result = t_cose_sign1_encode_parameters_known_length(&sign_ctx,
+                                                         claims.len + 1,
+                                                         &cbor_encode);
+    encode_test_claims(&cbor_encode);
+    result = t_cose_sign1_encode_signature(&sign_ctx, &cbor_encode);
+    if(result != T_COSE_ERR_WRONG_PAYLOAD_LENGTH) {
+        return 10;
+    }
 
+    return 0;
+}
 
+
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
 /*
  * Public function, see t_cose_test.h
  */
-int_fast32_t sign1_structure_decode_test(void)
+int_fast32_t incremental_hash_test()
 {
-    const struct sign1_sample      *sample;
-    struct q_useful_buf_c           payload;
     enum t_cose_err_t               result;
+    struct t_cose_sign1_sign_ctx    sign_ctx;
     struct t_cose_sign1_verify_ctx  verify_ctx;
+    QCBOREncodeContext              cbor_encode;
+    /* Bigger than T_COSE_INCREMENTAL_HASH_BLOCK_SIZE so it takes
+     * several blocks */
+    static uint8_t                  big_payload[40000];
+    static uint8_t                  wrapped_bytes[40200];
+    static uint8_t                  incremental_bytes[40200];
+    struct q_useful_buf_c           claims;
+    struct q_useful_buf_c           wrapped_cose;
+    struct q_useful_buf_c           incremental_cose;
+    struct q_useful_buf_c           payload;
+    size_t                          i;
+    Q_USEFUL_BUF_MAKE_STACK_UB(     claims_buffer, 100);
+    Q_USEFUL_BUF_MAKE_STACK_UB(     small_buffer, 300);
 
+    for(i = 0; i < sizeof(big_payload); i++) {
+        big_payload[i] = (uint8_t)(i * 7);
+    }
 
-    for(sample = sign1_sample_inputs; !q_useful_buf_c_is_null(sample->CBOR); sample++) {
-        t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_DECODE_ONLY);
+    t_cose_sign1_sign_init(&sign_ctx,
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           T_COSE_ALGORITHM_ES256);
 
+    /* -- Reference made the usual way with byte string wrapping -- */
+    QCBOREncode_Init(&cbor_encode, Q_USEFUL_BUF_FROM_BYTE_ARRAY(wrapped_bytes));
+    result = t_cose_sign1_encode_parameters(&sign_ctx, &cbor_encode);
+    QCBOREncode_AddEncoded(&cbor_encode,
+                           Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(big_payload));
+    if(result ||
+       t_cose_sign1_encode_signature(&sign_ctx, &cbor_encode) ||
+       QCBOREncode_Finish(&cbor_encode, &wrapped_cose)) {
+        return 1;
+    }
 
-        result = t_cose_sign1_verify(&verify_ctx,
-                                      sample->CBOR,
-                                     &payload,
-                                      NULL);
-        if(result != sample->expected_error) {
-            /* Returns 100 * index of the input + the unexpected error code */
-            const size_t sample_index = (size_t)(sample - sign1_sample_inputs) / sizeof(struct sign1_sample);
-            return (int32_t)((sample_index+1)*100 + result);
-        }
+    /* -- A large byte string added a block at a time -- */
+    QCBOREncode_Init(&cbor_encode, Q_USEFUL_BUF_FROM_BYTE_ARRAY(incremental_bytes));
+    result = t_cose_sign1_encode_parameters_incremental(&sign_ctx,
+                                                        sizeof(big_payload),
+                                                        &cbor_encode);
+    if(result) {
+        return 2;
+    }
+    result = t_cose_sign1_add_payload_bytes(&sign_ctx,
+                                            &cbor_encode,
+                                            Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(big_payload));
+    if(result) {
+        return 3;
+    }
+    result = t_cose_sign1_encode_signature(&sign_ctx, &cbor_encode);
+    if(result || QCBOREncode_Finish(&cbor_encode, &incremental_cose)) {
+        return 4;
+    }
+    if(q_useful_buf_compare(wrapped_cose, incremental_cose)) {
+        return 5;
     }
 
-    return 0;
-}
+    /* -- t_cose_sign1_sign() hashes incrementally too -- */
+    result = t_cose_sign1_sign(&sign_ctx,
+                               Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(big_payload),
+                               Q_USEFUL_BUF_FROM_BYTE_ARRAY(incremental_bytes),
+                               &incremental_cose);
+    if(result || q_useful_buf_compare(wrapped_cose, incremental_cose)) {
+        return 6;
+    }
 
+    /* -- A CBOR payload hashed part way through -- */
+    QCBOREncode_Init(&cbor_encode, claims_buffer);
+    encode_test_claims(&cbor_encode);
+    if(QCBOREncode_Finish(&cbor_encode, &claims)) {
+        return 7;
+    }
 
-#ifdef T_COSE_ENABLE_HASH_FAIL_TEST
+    QCBOREncode_Init(&cbor_encode, Q_USEFUL_BUF_FROM_BYTE_ARRAY(wrapped_bytes));
+    result = t_cose_sign1_encode_parameters_incremental(&sign_ctx,
+                                                        claims.len,
+                                                        &cbor_encode);
+    if(result) {
+        return 8;
+    }
+    QCBOREncode_OpenMap(&cbor_encode);
+    QCBOREncode_AddSZStringToMapN(&cbor_encode, 1, "coap://as.example.com");
+    QCBOREncode_AddInt64ToMapN(&cbor_encode, 4, 1444064944);
+    /* Not allowed while the map is open */
+    if(t_cose_sign1_hash_encoded_payload(&sign_ctx, &cbor_encode) !=
+       T_COSE_ERR_CBOR_FORMATTING) {
+        return 9;
+    }
+    QCBOREncode_CloseMap(&cbor_encode);
+    result = t_cose_sign1_hash_encoded_payload(&sign_ctx, &cbor_encode);
+    if(result) {
+        return 10;
+    }
+    result = t_cose_sign1_encode_signature(&sign_ctx, &cbor_encode);
+    if(result || QCBOREncode_Finish(&cbor_encode, &incremental_cose)) {
+        return 11;
+    }
 
-/* Linkage to global variable in t_cose_test_crypto.c. This is only
- * used for an occasional test in a non-threaded environment so a global
- * variable is safe. This test and the hacks in the crypto code are
- * never enabled for commercial deployments.
- */
-extern int hash_test_mode;
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+    result = t_cose_sign1_verify(&verify_ctx, incremental_cose, &payload, NULL);
+    if(result || q_useful_buf_compare(payload, claims)) {
+        return 12;
+    }
+
+    /* -- Too much payload is caught -- */
+    QCBOREncode_Init(&cbor_encode, small_buffer);
+    result = t_cose_sign1_encode_parameters_incremental(&sign_ctx,
+                                                        claims.len - 1,
+                                                        &cbor_encode);
+    encode_test_claims(&cbor_encode);
+    if(result ||
+       t_cose_sign1_hash_encoded_payload(&sign_ctx, &cbor_encode) ||
+       t_cose_sign1_encode_signature(&sign_ctx, &cbor_encode) !=
+           T_COSE_ERR_WRONG_PAYLOAD_LENGTH) {
+        return 13;
+    }
+
+    /* -- Output buffer too small for the payload -- */
+    result = t_cose_sign1_sign(&sign_ctx,
+                               Q_USEFUL_BUF_FROM_BYTE_ARRAY_LITERAL(big_payload),
+                               small_buffer,
+                               &incremental_cose);
+    if(result != T_COSE_ERR_TOO_SMALL) {
+        return 14;
+    }
+
+    return 0;
+}
+#endif /* T_COSE_ENABLE_INCREMENTAL_HASH */
 
 
 /*
  * Public function, see t_cose_test.h
  */
-int_fast32_t short_circuit_hash_fail_test()
+int_fast32_t two_stage_test()
 {
-    struct t_cose_sign1_sign_ctx sign_ctx;
-    enum t_cose_err_t            result;
-    struct q_useful_buf_c        wrapped_payload;
-    Q_USEFUL_BUF_MAKE_STACK_UB(  signed_cose_buffer, 200);
-
-    /* See test description in t_cose_test.h for a full description of
-     * what this does and what it needs to run.
-     */
-
-
-    /* Set the global variable to cause the hash implementation to
-     * error out so this test can see what happens
-     */
-    hash_test_mode = 1;
+    enum t_cose_err_t                   result;
+    struct t_cose_sign1_sign_ctx        sign_ctx;
+    struct t_cose_sign1_verify_ctx      verify_ctx;
+    struct t_cose_sign1_prepared        prepared;
+    struct t_cose_sign1_verify_prepared verify_prepared;
+    QCBOREncodeContext                  cbor_encode;
+    Q_USEFUL_BUF_MAKE_STACK_UB(         one_stage_buffer, 200);
+    Q_USEFUL_BUF_MAKE_STACK_UB(         two_stage_buffer, 200);
+    struct q_useful_buf_c               one_stage_cose;
+    struct q_useful_buf_c               two_stage_cose;
+    struct q_useful_buf_c               payload;
+    struct t_cose_parameters            parameters;
+    struct q_useful_buf_c               payload_in = Q_USEFUL_BUF_FROM_SZ_LITERAL("payload");
 
     t_cose_sign1_sign_init(&sign_ctx,
                            T_COSE_OPT_SHORT_CIRCUIT_SIG,
                            T_COSE_ALGORITHM_ES256);
 
+    /* -- Reference made in one call -- */
     result = t_cose_sign1_sign(&sign_ctx,
-                                     s_input_payload,
-                                     signed_cose_buffer,
-                                     &wrapped_payload);
+                               payload_in,
+                               one_stage_buffer,
+                               &one_stage_cose);
+    if(result) {
+        return 1;
+    }
 
-    hash_test_mode = 0;
+    /* -- Hash and sign separately -- */
+    QCBOREncode_Init(&cbor_encode, two_stage_buffer);
+    result = t_cose_sign1_encode_parameters(&sign_ctx, &cbor_encode);
+    if(result) {
+        return 2;
+    }
+    QCBOREncode_AddEncoded(&cbor_encode, payload_in);
+    result = t_cose_sign1_sign_prepare(&sign_ctx, &cbor_encode, &prepared);
+    if(result) {
+        return 3;
+    }
+    result = t_cose_sign1_sign_complete(&sign_ctx, &prepared, &cbor_encode);
+    if(result || QCBOREncode_Finish(&cbor_encode, &two_stage_cose)) {
+        return 4;
+    }
 
-    if(result != T_COSE_ERR_HASH_GENERAL_FAIL) {
-        return 2000 + (int32_t)result;
+    /* -- Same output as made in one call -- */
+    if(q_useful_buf_compare(one_stage_cose, two_stage_cose)) {
+        return 5;
     }
 
+    /* -- Decode and hash, then verify separately -- */
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+    result = t_cose_sign1_verify_prepare(&verify_ctx,
+                                          two_stage_cose,
+                                         &payload,
+                                         &parameters,
+                                         &verify_prepared);
+    if(result) {
+        return 6;
+    }
+    result = t_cose_sign1_verify_complete(&verify_ctx, &verify_prepared);
+    if(result || q_useful_buf_compare(payload, payload_in)) {
+        return 7;
+    }
 
-    /* Set the global variable to cause the hash implementation to
-     * error out so this test can see what happens
-     */
-    hash_test_mode = 2;
+    /* -- A modified hash fails -- */
+    verify_prepared.tbs_hash_bytes[0] ^= 0x01;
+    if(t_cose_sign1_verify_complete(&verify_ctx, &verify_prepared) !=
+       T_COSE_ERR_SIG_VERIFY) {
+        return 8;
+    }
+
+    return 0;
+}
+
+
+/* Grows the arena by moving to a bigger static buffer */
+static enum t_cose_err_t
+batch_test_grow(void *cb_context, size_t min_size, struct q_useful_buf *arena)
+{
+    struct q_useful_buf *bigger = (struct q_useful_buf *)cb_context;
+
+    if(min_size > bigger->len || arena->ptr == bigger->ptr) {
+        return T_COSE_ERR_INSUFFICIENT_MEMORY;
+    }
+    memcpy(bigger->ptr, arena->ptr, arena->len);
+    *arena = *bigger;
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Clock for verify_sched_test() that advances by one each time it
+ * is read.
+ */
+static uint64_t sched_test_clock(void *cb_context)
+{
+    uint64_t *clock = (uint64_t *)cb_context;
+
+    return (*clock)++;
+}
+
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t verify_sched_test()
+{
+    enum t_cose_err_t                       result;
+    struct t_cose_sign1_sign_ctx            sign_ctx;
+    struct t_cose_sign1_verify_ctx          verify_ctx;
+    Q_USEFUL_BUF_MAKE_STACK_UB(             signed_cose_buffer, 200);
+    struct q_useful_buf_c                   signed_cose;
+    struct t_cose_verify_sched              sched;
+    struct t_cose_verify_sched_request     *heap[4];
+    struct t_cose_verify_sched_request      requests[5];
+    struct t_cose_verify_sched_request     *done;
+    const struct t_cose_verify_sched_stats *stats;
+    uint64_t                                clock;
+    size_t                                  i;
 
     t_cose_sign1_sign_init(&sign_ctx,
                            T_COSE_OPT_SHORT_CIRCUIT_SIG,
                            T_COSE_ALGORITHM_ES256);
-
     result = t_cose_sign1_sign(&sign_ctx,
-                                     s_input_payload,
-                                     signed_cose_buffer,
-                                     &wrapped_payload);
+                               Q_USEFUL_BUF_FROM_SZ_LITERAL("payload"),
+                               signed_cose_buffer,
+                               &signed_cose);
+    if(result) {
+        return 1;
+    }
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
 
-    hash_test_mode = 0;
+    for(i = 0; i < 5; i++) {
+        requests[i].verify_ctx     = &verify_ctx;
+        requests[i].cose_sign1     = signed_cose;
+        requests[i].parameters     = NULL;
+        requests[i].deadline       = T_COSE_SCHED_NO_DEADLINE;
+        requests[i].priority_class = T_COSE_SCHED_CLASS_BULK;
+    }
 
-    if(result != T_COSE_ERR_HASH_GENERAL_FAIL) {
-        return 2000 + (int32_t)result;
+    clock = 1000;
+    t_cose_verify_sched_init(&sched, heap, 4, sched_test_clock, &clock, 10);
+    stats = t_cose_verify_sched_get_stats(&sched);
+
+    /* -- An interactive request goes ahead of bulk ones -- */
+    requests[2].priority_class = T_COSE_SCHED_CLASS_INTERACTIVE;
+    requests[2].deadline       = clock + 1000;
+    for(i = 0; i < 3; i++) {
+        if(t_cose_verify_sched_submit(&sched, &requests[i])) {
+            return 2;
+        }
+    }
+    if(t_cose_verify_sched_run_next(&sched) != &requests[2] ||
+       requests[2].result != T_COSE_SUCCESS ||
+       q_useful_buf_compare(requests[2].payload,
+                            Q_USEFUL_BUF_FROM_SZ_LITERAL("payload"))) {
+        return 3;
+    }
+    /* The bulk ones in the order they came */
+    if(t_cose_verify_sched_run_next(&sched) != &requests[0] ||
+       t_cose_verify_sched_run_next(&sched) != &requests[1] ||
+       t_cose_verify_sched_run_next(&sched) != NULL) {
+        return 4;
+    }
+
+    /* -- Aging puts a bulk request ahead of a later deadline -- */
+    t_cose_verify_sched_set_max_wait(&sched, T_COSE_SCHED_CLASS_BULK, 50);
+    requests[2].deadline = clock + 1000;
+    if(t_cose_verify_sched_submit(&sched, &requests[2]) ||
+       t_cose_verify_sched_submit(&sched, &requests[3])) {
+        return 5;
+    }
+    if(t_cose_verify_sched_run_next(&sched) != &requests[3] ||
+       t_cose_verify_sched_run_next(&sched) != &requests[2]) {
+        return 6;
+    }
+
+    /* -- A deadline that can't be met is rejected -- */
+    requests[4].priority_class = T_COSE_SCHED_CLASS_INTERACTIVE;
+    requests[4].deadline       = clock + 1;
+    result = t_cose_verify_sched_submit(&sched, &requests[4]);
+    if(result != T_COSE_ERR_DEADLINE_UNREACHABLE || stats->rejected != 1) {
+        return 7;
+    }
+
+    /* -- A deadline that passes while queued is not verified -- */
+    requests[4].deadline = clock + 50;
+    if(t_cose_verify_sched_submit(&sched, &requests[4])) {
+        return 8;
+    }
+    clock += 100;
+    done = t_cose_verify_sched_run_next(&sched);
+    if(done != &requests[4] ||
+       done->result != T_COSE_ERR_DEADLINE_MISSED ||
+       stats->expired[T_COSE_SCHED_CLASS_INTERACTIVE] != 1) {
+        return 9;
+    }
+
+    /* -- A full queue -- */
+    for(i = 0; i < 4; i++) {
+        if(t_cose_verify_sched_submit(&sched, &requests[i])) {
+            return 10;
+        }
+    }
+    if(t_cose_verify_sched_submit(&sched, &requests[4]) != T_COSE_ERR_TOO_SMALL) {
+        return 11;
+    }
+    while(t_cose_verify_sched_run_next(&sched) != NULL);
+
+    /* -- Counters -- */
+    if(stats->submitted != 10 || stats->verified != 9 ||
+       stats->queue_time_histogram[T_COSE_SCHED_CLASS_INTERACTIVE][6] != 1) {
+        return 12;
     }
 
     return 0;
 }
 
-#endif /* T_COSE_ENABLE_HASH_FAIL_TEST */
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t countersign_test()
+{
+    enum t_cose_err_t                  result;
+    struct t_cose_sign1_sign_ctx       sign_ctx;
+    struct t_cose_sign1_verify_ctx     verify_ctx;
+    struct t_cose_countersign_verifier verifiers[4];
+    Q_USEFUL_BUF_MAKE_STACK_UB(        signed_cose_buffer, 200);
+    Q_USEFUL_BUF_MAKE_STACK_UB(        one_buffer, 400);
+    Q_USEFUL_BUF_MAKE_STACK_UB(        two_buffer, 600);
+    Q_USEFUL_BUF_MAKE_STACK_UB(        three_buffer, 800);
+    Q_USEFUL_BUF_MAKE_STACK_UB(        tampered_buffer, 400);
+    struct q_useful_buf_c              signed_cose;
+    struct q_useful_buf_c              one;
+    struct q_useful_buf_c              two;
+    struct q_useful_buf_c              three;
+    struct q_useful_buf_c              tampered;
+    struct q_useful_buf_c              payload;
+    struct q_useful_buf_c              payload_in = Q_USEFUL_BUF_FROM_SZ_LITERAL("payload");
+    size_t                             i;
+
+    t_cose_sign1_sign_init(&sign_ctx,
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           T_COSE_ALGORITHM_ES256);
+    result = t_cose_sign1_sign(&sign_ctx, payload_in, signed_cose_buffer, &signed_cose);
+    if(result) {
+        return 1;
+    }
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+    for(i = 0; i < 4; i++) {
+        verifiers[i].verify_ctx = &verify_ctx;
+    }
+
+    /* -- Countersign and verify both signatures -- */
+    result = t_cose_countersign(&sign_ctx, signed_cose, one_buffer, &one);
+    if(result) {
+        return 2;
+    }
+    result = t_cose_countersign_verify(&verify_ctx, one, verifiers, 1,
+                                       NULL, NULL, &payload, NULL);
+    if(result || verifiers[0].result ||
+       q_useful_buf_compare(payload, payload_in) ||
+       q_useful_buf_compare(verifiers[0].kid, get_short_circuit_kid())) {
+        return 3;
+    }
+
+    /* -- The original signature still verifies on its own -- */
+    if(t_cose_sign1_verify(&verify_ctx, one, &payload, NULL)) {
+        return 4;
+    }
+
+    /* -- A second goes in an array with the first, a third is added to it -- */
+    result = t_cose_countersign(&sign_ctx, one, two_buffer, &two);
+    if(result) {
+        return 5;
+    }
+    result = t_cose_countersign(&sign_ctx, two, three_buffer, &three);
+    if(result) {
+        return 6;
+    }
+#ifdef T_COSE_ENABLE_PTHREADS
+    result = t_cose_countersign_verify(&verify_ctx, three, verifiers, 3,
+                                       t_cose_parallel_run_pthreads, NULL,
+                                       &payload, NULL);
+#else
+    result = t_cose_countersign_verify(&verify_ctx, three, verifiers, 3,
+                                       t_cose_parallel_run_serial, NULL,
+                                       &payload, NULL);
+#endif
+    if(result || verifiers[0].result || verifiers[1].result || verifiers[2].result) {
+        return 7;
+    }
+
+    /* -- Wrong number of verifiers -- */
+    result = t_cose_countersign_verify(&verify_ctx, two, verifiers, 1,
+                                       NULL, NULL, &payload, NULL);
+    if(result != T_COSE_ERR_COUNTERSIGNATURE_COUNT) {
+        return 8;
+    }
+
+    /* -- Decode only to count them -- */
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_DECODE_ONLY);
+    result = t_cose_countersign_verify(&verify_ctx, two, verifiers, 4,
+                                       NULL, NULL, &payload, NULL);
+    if(result || verifiers[1].result ||
+       verifiers[2].result != T_COSE_ERR_COUNTERSIGNATURE_COUNT ||
+       q_useful_buf_compare(verifiers[1].kid, get_short_circuit_kid())) {
+        return 9;
+    }
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+
+    /* -- A modified countersignature fails, but not the COSE_Sign1 --
+     * The countersignature is the 64 bytes before the payload and the
+     * COSE_Sign1 signature, which together are 74 bytes. */
+    tampered = q_useful_buf_copy(tampered_buffer, one);
+    ((uint8_t *)tampered_buffer.ptr)[tampered.len - 74 - 64] ^= 0x01;
+    result = t_cose_countersign_verify(&verify_ctx, tampered, verifiers, 1,
+                                       NULL, NULL, &payload, NULL);
+    if(result != T_COSE_ERR_SIG_VERIFY ||
+       verifiers[0].result != T_COSE_ERR_SIG_VERIFY) {
+        return 10;
+    }
+    if(t_cose_sign1_verify(&verify_ctx, tampered, &payload, NULL)) {
+        return 11;
+    }
+
+    /* -- Too small a buffer -- */
+    result = t_cose_countersign(&sign_ctx,
+                                signed_cose,
+                                (struct q_useful_buf){one_buffer.ptr, signed_cose.len},
+                                &one);
+    if(result != T_COSE_ERR_TOO_SMALL) {
+        return 12;
+    }
+
+    return 0;
+}
+
+
+/* The second signer uses a different algorithm and hash. ES256 is
+ * only for builds without ES384. */
+#ifndef T_COSE_DISABLE_ES384
+#define MULTI_SIGN_SECOND_ALG T_COSE_ALGORITHM_ES384
+#else
+#define MULTI_SIGN_SECOND_ALG T_COSE_ALGORITHM_ES256
+#endif
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t multi_sign_test()
+{
+    enum t_cose_err_t              result;
+    struct t_cose_sign1_sign_ctx   sign_ctxs[2];
+    struct t_cose_sign1_verify_ctx verify_ctx;
+    struct t_cose_multi_signer     signers[T_COSE_MAX_SIGNERS + 1];
+    struct t_cose_multi_verifier   verifiers[3];
+    Q_USEFUL_BUF_MAKE_STACK_UB(    signed_cose_buffer, 400);
+    Q_USEFUL_BUF_MAKE_STACK_UB(    tampered_buffer, 400);
+    struct q_useful_buf_c          signed_cose;
+    struct q_useful_buf_c          tampered;
+    struct q_useful_buf_c          payload;
+    struct q_useful_buf_c          payload_in = Q_USEFUL_BUF_FROM_SZ_LITERAL("payload");
+    size_t                         i;
+
+    t_cose_sign1_sign_init(&sign_ctxs[0],
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           T_COSE_ALGORITHM_ES256);
+    t_cose_sign1_sign_init(&sign_ctxs[1],
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           MULTI_SIGN_SECOND_ALG);
+    for(i = 0; i < T_COSE_MAX_SIGNERS + 1; i++) {
+        signers[i].sign_ctx = &sign_ctxs[i % 2];
+    }
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+    for(i = 0; i < 3; i++) {
+        verifiers[i].verify_ctx = &verify_ctx;
+    }
+
+    /* -- Sign with two algorithms and verify both -- */
+    result = t_cose_multi_sign(signers, 2, payload_in, NULL, NULL,
+                               signed_cose_buffer, &signed_cose);
+    if(result || signers[0].result || signers[1].result) {
+        return 1;
+    }
+#ifdef T_COSE_ENABLE_PTHREADS
+    result = t_cose_multi_sign_verify(0, signed_cose, verifiers, 2,
+                                      t_cose_parallel_run_pthreads, NULL,
+                                      &payload);
+#else
+    result = t_cose_multi_sign_verify(0, signed_cose, verifiers, 2,
+                                      t_cose_parallel_run_serial, NULL,
+                                      &payload);
+#endif
+    if(result || verifiers[0].result || verifiers[1].result ||
+       q_useful_buf_compare(payload, payload_in) ||
+       verifiers[0].cose_algorithm_id != T_COSE_ALGORITHM_ES256 ||
+       verifiers[1].cose_algorithm_id != MULTI_SIGN_SECOND_ALG ||
+       q_useful_buf_compare(verifiers[1].kid, get_short_circuit_kid())) {
+        return 2;
+    }
+
+    /* -- Decode only to find the signers -- */
+    result = t_cose_multi_sign_verify(T_COSE_OPT_DECODE_ONLY, signed_cose,
+                                      verifiers, 3, NULL, NULL, &payload);
+    if(result || verifiers[1].cose_algorithm_id != MULTI_SIGN_SECOND_ALG ||
+       verifiers[2].result != T_COSE_ERR_SIGNER_COUNT) {
+        return 3;
+    }
+
+    /* -- Wrong number of verifiers -- */
+    result = t_cose_multi_sign_verify(0, signed_cose, verifiers, 1,
+                                      NULL, NULL, &payload);
+    if(result != T_COSE_ERR_SIGNER_COUNT) {
+        return 4;
+    }
+
+    /* -- A modified second signature fails, but not the first --
+     * The second signature is at the end. */
+    tampered = q_useful_buf_copy(tampered_buffer, signed_cose);
+    ((uint8_t *)tampered_buffer.ptr)[tampered.len - 1] ^= 0x01;
+    result = t_cose_multi_sign_verify(0, tampered, verifiers, 2,
+                                      NULL, NULL, &payload);
+    if(result != T_COSE_ERR_SIG_VERIFY ||
+       verifiers[0].result != T_COSE_SUCCESS ||
+       verifiers[1].result != T_COSE_ERR_SIG_VERIFY) {
+        return 5;
+    }
+
+    /* -- A COSE_Sign1 is not a COSE_Sign -- */
+    result = t_cose_sign1_sign(&sign_ctxs[0], payload_in, tampered_buffer, &tampered);
+    if(result) {
+        return 6;
+    }
+    result = t_cose_multi_sign_verify(0, tampered, verifiers, 1,
+                                      NULL, NULL, &payload);
+    if(result != T_COSE_ERR_SIGN_FORMAT) {
+        return 7;
+    }
+
+    /* -- Too many signers and too small a buffer -- */
+    result = t_cose_multi_sign(signers, T_COSE_MAX_SIGNERS + 1, payload_in,
+                               NULL, NULL, signed_cose_buffer, &signed_cose);
+    if(result != T_COSE_ERR_SIGNER_COUNT) {
+        return 8;
+    }
+    result = t_cose_multi_sign(signers, 2, payload_in, NULL, NULL,
+                               (struct q_useful_buf){signed_cose_buffer.ptr, 100},
+                               &signed_cose);
+    if(result != T_COSE_ERR_TOO_SMALL) {
+        return 9;
+    }
+
+    return 0;
+}
+
+
+#ifdef T_COSE_ENABLE_COST_COUNTERS
+#include "t_cose/t_cose_cost.h"
+#include "t_cose_parameters.h"
+#include "t_cose_cost_corpus.h"
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t cost_budget_test()
+{
+    struct t_cose_sign1_verify_ctx verify_ctx;
+    struct q_useful_buf_c          payload;
+    struct t_cose_parameters       parameters;
+    struct t_cose_label_list       critical_labels;
+    struct t_cose_label_list       unknown_labels;
+    struct t_cose_cost             cost;
+    uint64_t                       max_hash_bytes;
+    uint64_t                       max_items;
+    size_t                         i;
+
+    max_hash_bytes = 0;
+    max_items      = 0;
+
+    for(i = 0; i < sizeof(s_cost_corpus) / sizeof(s_cost_corpus[0]); i++) {
+        /* -- As a COSE_Sign1 -- */
+        t_cose_cost_reset();
+        t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+        (void)t_cose_sign1_verify(&verify_ctx, s_cost_corpus[i], &payload, &parameters);
+        t_cose_cost_get(&cost);
+        if(t_cose_cost_total(&cost) > T_COSE_COST_BUDGET(s_cost_corpus[i].len)) {
+            return (int_fast32_t)(i * 10 + 1);
+        }
+        if(cost.public_key_ops > 1) {
+            return (int_fast32_t)(i * 10 + 2);
+        }
+        if(cost.hash_bytes > max_hash_bytes) {
+            max_hash_bytes = cost.hash_bytes;
+        }
+        if(cost.cbor_items > max_items) {
+            max_items = cost.cbor_items;
+        }
+
+        /* -- As a header parameter map -- */
+        t_cose_cost_reset();
+        clear_label_list(&unknown_labels);
+        if(parse_protected_header_parameters(s_cost_corpus[i],
+                                            &parameters,
+                                            &critical_labels,
+                                            &unknown_labels,
+                                             NULL,
+                                             0) == T_COSE_SUCCESS) {
+            (void)check_critical_labels(&critical_labels, &unknown_labels);
+        }
+        t_cose_cost_get(&cost);
+        if(t_cose_cost_total(&cost) > T_COSE_COST_BUDGET(s_cost_corpus[i].len)) {
+            return (int_fast32_t)(i * 10 + 3);
+        }
+    }
+
+    /* -- The counters counted -- */
+    if(max_hash_bytes < 4000 || max_items < 1000) {
+        return -1;
+    }
+
+    return 0;
+}
+#endif /* T_COSE_ENABLE_COST_COUNTERS */
+
+
+#ifdef T_COSE_ENABLE_CAPTURE
+#include "t_cose/t_cose_capture.h"
+
+struct capture_test_log {
+    uint8_t bytes[T_COSE_CAPTURE_HEADER_SIZE + 4 * T_COSE_CAPTURE_RECORD_SIZE];
+    size_t  len;
+};
+
+static void
+capture_test_flush(void *cb_context, struct q_useful_buf_c log_bytes)
+{
+    struct capture_test_log *log = cb_context;
+
+    if(log->len + log_bytes.len <= sizeof(log->bytes)) {
+        memcpy(log->bytes + log->len, log_bytes.ptr, log_bytes.len);
+    }
+    log->len += log_bytes.len;
+}
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t capture_test()
+{
+    struct t_cose_sign1_sign_ctx   sign_ctx;
+    struct t_cose_sign1_verify_ctx verify_ctx;
+    struct t_cose_capture          capture;
+    struct t_cose_capture_record   good;
+    struct t_cose_capture_record   bad;
+    struct capture_test_log        log;
+    Q_USEFUL_BUF_MAKE_STACK_UB(    signed_cose_buffer, 200);
+    Q_USEFUL_BUF_MAKE_STACK_UB(    tampered_buffer, 200);
+    Q_USEFUL_BUF_MAKE_STACK_UB(    capture_buffer, T_COSE_CAPTURE_HEADER_SIZE +
+                                                   2 * T_COSE_CAPTURE_RECORD_SIZE);
+    Q_USEFUL_BUF_MAKE_STACK_UB(    small_buffer, T_COSE_CAPTURE_HEADER_SIZE +
+                                                 T_COSE_CAPTURE_RECORD_SIZE);
+    struct q_useful_buf_c          signed_cose;
+    struct q_useful_buf_c          tampered;
+    struct q_useful_buf_c          payload;
+    struct q_useful_buf_c          records;
+    struct t_cose_parameters       parameters;
+    uint64_t                       seen;
+    uint64_t                       recorded;
+    uint64_t                       dropped;
+    uint32_t                       sample_rate;
+    int                            i;
+
+    t_cose_sign1_sign_init(&sign_ctx,
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           T_COSE_ALGORITHM_ES256);
+#ifndef T_COSE_DISABLE_CONTENT_TYPE
+    t_cose_sign1_set_content_type_uint(&sign_ctx, 42);
+#endif
+    if(t_cose_sign1_sign(&sign_ctx, s_input_payload, signed_cose_buffer, &signed_cose)) {
+        return 1;
+    }
+    tampered = q_useful_buf_copy(tampered_buffer, signed_cose);
+    ((uint8_t *)tampered_buffer.ptr)[tampered.len - 1] ^= 0x01;
+
+    /* -- A good and a bad message are recorded, a third doesn't fit -- */
+    if(t_cose_capture_init(&capture, small_buffer, 1, 1, NULL, NULL) != T_COSE_SUCCESS ||
+       t_cose_capture_init(&capture, (struct q_useful_buf){capture_buffer.ptr, 20},
+                           1, 1, NULL, NULL) != T_COSE_ERR_TOO_SMALL) {
+        return 2;
+    }
+    if(t_cose_capture_init(&capture, capture_buffer, 1, 1234, NULL, NULL)) {
+        return 3;
+    }
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+    t_cose_sign1_verify_set_capture(&verify_ctx, &capture);
+    if(t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, &parameters) ||
+       t_cose_sign1_verify(&verify_ctx, tampered, &payload, &parameters) != T_COSE_ERR_SIG_VERIFY ||
+       t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, NULL)) {
+        return 4;
+    }
+    t_cose_capture_get_counts(&capture, &seen, &recorded, &dropped);
+    if(seen != 3 || recorded != 2 || dropped != 1) {
+        return 5;
+    }
+
+    /* -- The records have the shape of the messages and nothing else -- */
+    if(t_cose_capture_decode_header(t_cose_capture_get_log(&capture), &sample_rate, &records) ||
+       sample_rate != 1 ||
+       t_cose_capture_decode_record(&records, &good) ||
+       t_cose_capture_decode_record(&records, &bad) ||
+       t_cose_capture_decode_record(&records, &bad) != T_COSE_ERR_CAPTURE_FORMAT) {
+        return 6;
+    }
+    if(good.cose_algorithm_id != T_COSE_ALGORITHM_ES256 ||
+       good.result != T_COSE_SUCCESS ||
+       good.payload_len != s_input_payload.len ||
+       good.signature_len != T_COSE_EC_P256_SIG_SIZE ||
+       good.kid_len != T_COSE_SHORT_CIRCUIT_KID_SIZE ||
+       good.payload_len + good.protected_len + good.signature_len +
+           good.kid_len + good.other_len != signed_cose.len) {
+        return 7;
+    }
+    if(!(good.flags & T_COSE_CAPTURE_FLAG_TAGGED) ||
+       !(good.flags & T_COSE_CAPTURE_FLAG_SHORT_CIRCUIT) ||
+       good.flags & T_COSE_CAPTURE_FLAG_DECODE_ONLY) {
+        return 8;
+    }
+#ifndef T_COSE_DISABLE_CONTENT_TYPE
+    if(!(good.flags & T_COSE_CAPTURE_FLAG_CONTENT_TYPE)) {
+        return 9;
+    }
+#endif
+    if(bad.result != T_COSE_ERR_SIG_VERIFY || bad.kid_tag != good.kid_tag) {
+        return 10;
+    }
+
+    /* -- Records not sent to t_cose_sign1_verify() are absent -- */
+    (void)t_cose_capture_init(&capture, capture_buffer, 1, 1234, NULL, NULL);
+    if(t_cose_sign1_verify(&verify_ctx, q_useful_buf_head(signed_cose, 3),
+                           &payload, &parameters) == T_COSE_SUCCESS) {
+        return 11;
+    }
+    records = q_useful_buf_tail(t_cose_capture_get_log(&capture), T_COSE_CAPTURE_HEADER_SIZE);
+    if(t_cose_capture_decode_record(&records, &bad) ||
+       bad.result == T_COSE_SUCCESS ||
+       bad.cose_algorithm_id != T_COSE_UNSET_ALGORITHM_ID ||
+       bad.payload_len != 0 || bad.kid_len != 0 || bad.other_len != 3) {
+        return 12;
+    }
+
+    /* -- With a flush callback nothing is dropped and the pieces are one log -- */
+    log.len = 0;
+    (void)t_cose_capture_init(&capture, small_buffer, 1, 1, capture_test_flush, &log);
+    t_cose_sign1_verify_set_capture(&verify_ctx, &capture);
+    for(i = 0; i < 3; i++) {
+        (void)t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, &parameters);
+    }
+    t_cose_capture_flush(&capture);
+    t_cose_capture_get_counts(&capture, &seen, &recorded, &dropped);
+    if(recorded != 3 || dropped != 0 ||
+       log.len != T_COSE_CAPTURE_HEADER_SIZE + 3 * T_COSE_CAPTURE_RECORD_SIZE ||
+       t_cose_capture_decode_header((struct q_useful_buf_c){log.bytes, log.len},
+                                    &sample_rate, &records) ||
+       records.len != 3 * T_COSE_CAPTURE_RECORD_SIZE) {
+        return 13;
+    }
+
+    /* -- Sampling records about one in the rate -- */
+    (void)t_cose_capture_init(&capture, small_buffer, 4, 99, NULL, NULL);
+    for(i = 0; i < 400; i++) {
+        (void)t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, &parameters);
+    }
+    t_cose_capture_get_counts(&capture, &seen, &recorded, &dropped);
+    if(seen != 400 || recorded + dropped < 60 || recorded + dropped > 140) {
+        return 14;
+    }
+
+    return 0;
+}
+#endif /* T_COSE_ENABLE_CAPTURE */
+
+
+#ifdef T_COSE_ENABLE_SUIT
+#include <stdio.h>
+
+/* Component images written by suit_test() */
+static const char *s_suit_test_paths[2] = {"t_cose_suit_test_0.bin",
+                                           "t_cose_suit_test_1.bin"};
+static const size_t s_suit_test_sizes[2] = {3000, 100};
+
+
+/*
+ * Write a test image of len bytes all of value byte and put its
+ * encoded SUIT_Digest in digest_buffer.
+ */
+static int
+suit_test_make_image(const char            *path,
+                     uint8_t                byte,
+                     size_t                 len,
+                     struct q_useful_buf    digest_buffer,
+                     struct q_useful_buf_c *encoded_digest)
+{
+    FILE                      *file;
+    size_t                     i;
+    struct t_cose_crypto_hash  hash_ctx;
+    Q_USEFUL_BUF_MAKE_STACK_UB(hash_buffer, T_COSE_CRYPTO_MAX_HASH_SIZE);
+    struct q_useful_buf_c      hash;
+    QCBOREncodeContext         cbor_encode;
+
+    file = fopen(path, "wb");
+    if(file == NULL) {
+        return 1;
+    }
+    t_cose_crypto_hash_start(&hash_ctx, T_COSE_ALGORITHM_SHA_256);
+    for(i = 0; i < len; i++) {
+        fputc(byte, file);
+        t_cose_crypto_hash_update(&hash_ctx, (struct q_useful_buf_c){&byte, 1});
+    }
+    if(fclose(file) || t_cose_crypto_hash_finish(&hash_ctx, hash_buffer, &hash)) {
+        return 1;
+    }
+
+    if(encoded_digest != NULL) {
+        QCBOREncode_Init(&cbor_encode, digest_buffer);
+        QCBOREncode_OpenArray(&cbor_encode);
+        QCBOREncode_AddInt64(&cbor_encode, T_COSE_ALGORITHM_SHA_256);
+        QCBOREncode_AddBytes(&cbor_encode, hash);
+        QCBOREncode_CloseArray(&cbor_encode);
+        if(QCBOREncode_Finish(&cbor_encode, encoded_digest)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t suit_test()
+{
+    enum t_cose_err_t              result;
+    struct t_cose_sign1_sign_ctx   sign_ctx;
+    struct t_cose_sign1_verify_ctx verify_ctx;
+    QCBOREncodeContext             cbor_encode;
+    struct t_cose_crypto_hash      hash_ctx;
+    Q_USEFUL_BUF_MAKE_STACK_UB(    head_buffer, QCBOR_HEAD_BUFFER_SIZE);
+    Q_USEFUL_BUF_MAKE_STACK_UB(    hash_buffer, T_COSE_CRYPTO_MAX_HASH_SIZE);
+    Q_USEFUL_BUF_MAKE_STACK_UB(    image_digest_buffer_0, 50);
+    Q_USEFUL_BUF_MAKE_STACK_UB(    image_digest_buffer_1, 50);
+    Q_USEFUL_BUF_MAKE_STACK_UB(    sequence_buffer, 200);
+    Q_USEFUL_BUF_MAKE_STACK_UB(    common_buffer, 250);
+    Q_USEFUL_BUF_MAKE_STACK_UB(    manifest_buffer, 300);
+    Q_USEFUL_BUF_MAKE_STACK_UB(    manifest_digest_buffer, 50);
+    Q_USEFUL_BUF_MAKE_STACK_UB(    cose_buffer, 200);
+    Q_USEFUL_BUF_MAKE_STACK_UB(    auth_buffer, 300);
+    Q_USEFUL_BUF_MAKE_STACK_UB(    envelope_buffer, 700);
+    struct q_useful_buf_c          image_digests[2];
+    struct q_useful_buf_c          sequence;
+    struct q_useful_buf_c          common;
+    struct q_useful_buf_c          manifest_bytes;
+    struct q_useful_buf_c          hash;
+    struct q_useful_buf_c          manifest_digest;
+    struct q_useful_buf_c          cose;
+    struct q_useful_buf_c          auth;
+    struct q_useful_buf_c          envelope;
+    struct t_cose_suit_manifest    manifest;
+    int_fast32_t                   return_value;
+    uint8_t                        component_id;
+    size_t                         i;
+
+    /* -- Two images and their digests -- */
+    if(suit_test_make_image(s_suit_test_paths[0], 'a', s_suit_test_sizes[0],
+                            image_digest_buffer_0, &image_digests[0]) ||
+       suit_test_make_image(s_suit_test_paths[1], 'b', s_suit_test_sizes[1],
+                            image_digest_buffer_1, &image_digests[1])) {
+        return_value = 1;
+        goto Done;
+    }
+
+    /* -- Shared sequence that sets the digest and size of each -- */
+    QCBOREncode_Init(&cbor_encode, sequence_buffer);
+    QCBOREncode_OpenArray(&cbor_encode);
+    for(i = 0; i < 2; i++) {
+        QCBOREncode_AddInt64(&cbor_encode, 12); /* set-component-index */
+        QCBOREncode_AddUInt64(&cbor_encode, i);
+        QCBOREncode_AddInt64(&cbor_encode, 20); /* override-parameters */
+        QCBOREncode_OpenMap(&cbor_encode);
+        QCBOREncode_AddBytesToMapN(&cbor_encode, 3, image_digests[i]);
+        QCBOREncode_AddUInt64ToMapN(&cbor_encode, 14, s_suit_test_sizes[i]);
+        QCBOREncode_CloseMap(&cbor_encode);
+    }
+    QCBOREncode_AddInt64(&cbor_encode, 1); /* vendor-identifier condition */
+    QCBOREncode_AddUInt64(&cbor_encode, 15);
+    QCBOREncode_CloseArray(&cbor_encode);
+    if(QCBOREncode_Finish(&cbor_encode, &sequence)) {
+        return_value = 2;
+        goto Done;
+    }
+
+    /* -- Common section and manifest -- */
+    QCBOREncode_Init(&cbor_encode, common_buffer);
+    QCBOREncode_OpenMap(&cbor_encode);
+    QCBOREncode_OpenArrayInMapN(&cbor_encode, 2);
+    for(i = 0; i < 2; i++) {
+        QCBOREncode_OpenArray(&cbor_encode);
+        component_id = (uint8_t)i;
+        QCBOREncode_AddBytes(&cbor_encode, (struct q_useful_buf_c){&component_id, 1});
+        QCBOREncode_CloseArray(&cbor_encode);
+    }
+    QCBOREncode_CloseArray(&cbor_encode);
+    QCBOREncode_AddBytesToMapN(&cbor_encode, 4, sequence);
+    QCBOREncode_CloseMap(&cbor_encode);
+    if(QCBOREncode_Finish(&cbor_encode, &common)) {
+        return_value = 3;
+        goto Done;
+    }
+
+    QCBOREncode_Init(&cbor_encode, manifest_buffer);
+    QCBOREncode_OpenMap(&cbor_encode);
+    QCBOREncode_AddInt64ToMapN(&cbor_encode, 1, 1);
+    QCBOREncode_AddInt64ToMapN(&cbor_encode, 2, 5);
+    QCBOREncode_AddBytesToMapN(&cbor_encode, 3, common);
+    QCBOREncode_CloseMap(&cbor_encode);
+    if(QCBOREncode_Finish(&cbor_encode, &manifest_bytes)) {
+        return_value = 4;
+        goto Done;
+    }
+
+    /* -- Digest of the wrapped manifest, signed -- */
+    t_cose_crypto_hash_start(&hash_ctx, T_COSE_ALGORITHM_SHA_256);
+    t_cose_crypto_hash_update(&hash_ctx,
+                              QCBOREncode_EncodeHead(head_buffer,
+                                                     CBOR_MAJOR_TYPE_BYTE_STRING,
+                                                     0,
+                                                     manifest_bytes.len));
+    t_cose_crypto_hash_update(&hash_ctx, manifest_bytes);
+    if(t_cose_crypto_hash_finish(&hash_ctx, hash_buffer, &hash)) {
+        return_value = 5;
+        goto Done;
+    }
+    QCBOREncode_Init(&cbor_encode, manifest_digest_buffer);
+    QCBOREncode_OpenArray(&cbor_encode);
+    QCBOREncode_AddInt64(&cbor_encode, T_COSE_ALGORITHM_SHA_256);
+    QCBOREncode_AddBytes(&cbor_encode, hash);
+    QCBOREncode_CloseArray(&cbor_encode);
+    if(QCBOREncode_Finish(&cbor_encode, &manifest_digest)) {
+        return_value = 6;
+        goto Done;
+    }
+
+    t_cose_sign1_sign_init(&sign_ctx,
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           T_COSE_ALGORITHM_ES256);
+    result = t_cose_sign1_sign(&sign_ctx, manifest_digest, cose_buffer, &cose);
+    if(result) {
+        return_value = 7;
+        goto Done;
+    }
+
+    /* -- Authentication wrapper and envelope -- */
+    QCBOREncode_Init(&cbor_encode, auth_buffer);
+    QCBOREncode_OpenArray(&cbor_encode);
+    QCBOREncode_AddBytes(&cbor_encode, manifest_digest);
+    QCBOREncode_AddBytes(&cbor_encode, cose);
+    QCBOREncode_CloseArray(&cbor_encode);
+    if(QCBOREncode_Finish(&cbor_encode, &auth)) {
+        return_value = 8;
+        goto Done;
+    }
+
+    QCBOREncode_Init(&cbor_encode, envelope_buffer);
+    QCBOREncode_OpenMap(&cbor_encode);
+    QCBOREncode_AddBytesToMapN(&cbor_encode, 2, auth);
+    QCBOREncode_AddBytesToMapN(&cbor_encode, 3, manifest_bytes);
+    QCBOREncode_CloseMap(&cbor_encode);
+    if(QCBOREncode_Finish(&cbor_encode, &envelope)) {
+        return_value = 9;
+        goto Done;
+    }
+
+    /* -- Verify the envelope and check the images -- */
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+    result = t_cose_suit_verify_envelope(&verify_ctx, envelope, &manifest);
+    if(result ||
+       manifest.sequence_number != 5 ||
+       manifest.num_components != 2 ||
+       manifest.components[1].image_size != s_suit_test_sizes[1] ||
+       q_useful_buf_compare(manifest.components[1].digest,
+                            q_useful_buf_tail(image_digests[1], 4))) {
+        return_value = 10;
+        goto Done;
+    }
+    for(i = 0; i < 2; i++) {
+        manifest.components[i].path = s_suit_test_paths[i];
+    }
+#ifdef T_COSE_ENABLE_PTHREADS
+    result = t_cose_suit_check_components(&manifest, t_cose_parallel_run_pthreads, NULL);
+#else
+    result = t_cose_suit_check_components(&manifest, NULL, NULL);
+#endif
+    if(result) {
+        return_value = 11;
+        goto Done;
+    }
+
+    /* -- A modified image of the same size fails -- */
+    if(suit_test_make_image(s_suit_test_paths[1], 'c', s_suit_test_sizes[1],
+                            image_digest_buffer_1, NULL)) {
+        return_value = 12;
+        goto Done;
+    }
+    result = t_cose_suit_check_components(&manifest, NULL, NULL);
+    if(result != T_COSE_ERR_PAYLOAD_HASH_MISMATCH ||
+       manifest.components[1].result != T_COSE_ERR_PAYLOAD_HASH_MISMATCH) {
+        return_value = 13;
+        goto Done;
+    }
+
+    /* -- An image of the wrong size fails without hashing -- */
+    if(suit_test_make_image(s_suit_test_paths[0], 'a', 10,
+                            image_digest_buffer_0, NULL)) {
+        return_value = 14;
+        goto Done;
+    }
+    result = t_cose_suit_check_components(&manifest, NULL, NULL);
+    if(result != T_COSE_ERR_PAYLOAD_HASH_MISMATCH ||
+       manifest.components[1].result != T_COSE_ERR_ABORTED) {
+        return_value = 15;
+        goto Done;
+    }
+
+    /* -- A modified manifest fails -- */
+    ((uint8_t *)envelope_buffer.ptr)[envelope.len - 1] ^= 0x01;
+    result = t_cose_suit_verify_envelope(&verify_ctx, envelope, &manifest);
+    if(result != T_COSE_ERR_PAYLOAD_HASH_MISMATCH) {
+        return_value = 16;
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    remove(s_suit_test_paths[0]);
+    remove(s_suit_test_paths[1]);
+    return return_value;
+}
+#endif /* T_COSE_ENABLE_SUIT */
+
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t sign1_batch_test()
+{
+    enum t_cose_err_t               result;
+    struct t_cose_sign1_sign_ctx    sign_ctx;
+    struct t_cose_sign1_verify_ctx  verify_ctx;
+    struct t_cose_sign1_arena       arena;
+    struct t_cose_sign1_batch_entry entries[4];
+    size_t                          num_signed;
+    size_t                          index;
+    struct q_useful_buf_c           record;
+    struct q_useful_buf_c           payload;
+    struct q_useful_buf_c           single;
+    struct q_useful_buf             bigger;
+    uint8_t                         bigger_bytes[1000];
+    Q_USEFUL_BUF_MAKE_STACK_UB(     small_arena, 250);
+    Q_USEFUL_BUF_MAKE_STACK_UB(     single_buffer, 500);
+    uint8_t                         long_payload[300];
+    struct q_useful_buf_c           payloads[4];
+
+    memset(long_payload, 'x', sizeof(long_payload));
+    payloads[0] = Q_USEFUL_BUF_FROM_SZ_LITERAL("");
+    payloads[1] = Q_USEFUL_BUF_FROM_SZ_LITERAL("payload");
+    payloads[2] = (struct q_useful_buf_c){long_payload, 30};
+    payloads[3] = (struct q_useful_buf_c){long_payload, sizeof(long_payload)};
+
+    t_cose_sign1_sign_init(&sign_ctx,
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           T_COSE_ALGORITHM_ES256);
+
+    /* -- A fixed arena that fills up -- */
+    t_cose_sign1_arena_init(&arena, small_arena, NULL, NULL);
+    result = t_cose_sign1_sign_batch(&sign_ctx, payloads, 4,
+                                     &arena, entries, &num_signed);
+    if(result != T_COSE_ERR_TOO_SMALL || num_signed == 0 || num_signed == 4) {
+        return 1;
+    }
+    if(arena.used != entries[num_signed-1].offset + entries[num_signed-1].len) {
+        return 2;
+    }
+
+    /* -- Grows into the bigger buffer part way through -- */
+    bigger = (struct q_useful_buf){bigger_bytes, sizeof(bigger_bytes)};
+    t_cose_sign1_arena_init(&arena, small_arena, batch_test_grow, &bigger);
+    result = t_cose_sign1_sign_batch(&sign_ctx, payloads, 4,
+                                     &arena, entries, &num_signed);
+    if(result || num_signed != 4 || arena.buffer.ptr != bigger_bytes) {
+        return 3;
+    }
+
+    /* -- Each record is back-to-back, the same as signing one at a
+     * time and verifies -- */
+    for(index = 0; index < 4; index++) {
+        if(entries[index].offset != (index ? entries[index-1].offset +
+                                             entries[index-1].len : 0)) {
+            return 4;
+        }
+        record = (struct q_useful_buf_c){bigger_bytes + entries[index].offset,
+                                         entries[index].len};
+
+        result = t_cose_sign1_sign(&sign_ctx,
+                                   payloads[index],
+                                   single_buffer,
+                                   &single);
+        if(result || q_useful_buf_compare(single, record)) {
+            return 5;
+        }
+
+        t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+        result = t_cose_sign1_verify(&verify_ctx, record, &payload, NULL);
+        if(result || q_useful_buf_compare(payload, payloads[index])) {
+            return 6;
+        }
+    }
+
+    if(t_cose_sign1_arena_output(&arena).len !=
+       entries[3].offset + entries[3].len) {
+        return 7;
+    }
+
+    /* -- The grow callback failing stops the batch -- */
+    result = t_cose_sign1_sign_batch(&sign_ctx, payloads, 4,
+                                     &arena, entries, &num_signed);
+    if(result != T_COSE_ERR_INSUFFICIENT_MEMORY) {
+        return 8;
+    }
+
+    return 0;
+}
+
+
+struct test_case {
+    uint32_t           test_option;
+    enum t_cose_err_t  result;
+};
+
+static struct test_case bad_parameters_tests_table[] = {
+
+    {T_COSE_TEST_EMPTY_PROTECTED_PARAMETERS, T_COSE_ERR_UNSUPPORTED_HASH},
+
+    {T_COSE_TEST_DUP_CONTENT_ID, T_COSE_ERR_DUPLICATE_PARAMETER},
+
+    {T_COSE_TEST_UNCLOSED_PROTECTED, T_COSE_ERR_CBOR_NOT_WELL_FORMED},
+
+    {T_COSE_TEST_TOO_LARGE_CONTENT_TYPE, T_COSE_ERR_BAD_CONTENT_TYPE},
+
+    /* This makes consume_item() error out */
+    {T_COSE_TEST_NOT_WELL_FORMED_2, T_COSE_ERR_CBOR_NOT_WELL_FORMED},
+
+    {T_COSE_TEST_KID_IN_PROTECTED, T_COSE_ERR_DUPLICATE_PARAMETER},
+
+    {T_COSE_TEST_TOO_MANY_UNKNOWN, T_COSE_ERR_TOO_MANY_PARAMETERS},
+
+    {T_COSE_TEST_UNPROTECTED_NOT_MAP, T_COSE_ERR_PARAMETER_CBOR},
+
+    {T_COSE_TEST_BAD_CRIT_PARAMETER, T_COSE_ERR_PARAMETER_NOT_PROTECTED},
+
+    {T_COSE_TEST_BAD_CRIT_PARAMETER, T_COSE_ERR_PARAMETER_NOT_PROTECTED},
+
+    {T_COSE_TEST_NOT_WELL_FORMED_1, T_COSE_ERR_CBOR_NOT_WELL_FORMED},
+
+    {T_COSE_TEST_NO_UNPROTECTED_PARAMETERS, T_COSE_ERR_PARAMETER_CBOR},
+
+    {T_COSE_TEST_NO_PROTECTED_PARAMETERS, T_COSE_ERR_SIGN1_FORMAT},
+
+    {T_COSE_TEST_EXTRA_PARAMETER, T_COSE_SUCCESS},
+
+    {T_COSE_TEST_PARAMETER_LABEL, T_COSE_ERR_PARAMETER_CBOR},
+
+    {T_COSE_TEST_BAD_PROTECTED, T_COSE_ERR_PARAMETER_CBOR},
+
+    {0, 0}
+};
+
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t bad_parameters_test()
+{
+    struct test_case *test;
+
+    for(test = bad_parameters_tests_table; test->test_option; test++) {
+        if(run_test_sign_and_verify(test->test_option) != test->result) {
+            return (int_fast32_t)(test - bad_parameters_tests_table + 1);
+        }
+    }
+
+    return 0;
+}
+
+
+
+
+static struct test_case crit_tests_table[] = {
+    /* Test existance of the critical header. Also makes sure that
+     * it works with the max number of labels allowed in it.
+     */
+    {T_COSE_TEST_CRIT_PARAMETER_EXIST, T_COSE_SUCCESS},
+
+    /* Exceed the max number of labels by one and get an error */
+    {T_COSE_TEST_TOO_MANY_CRIT_PARAMETER_EXIST, T_COSE_ERR_CRIT_PARAMETER},
+
+    /* A critical parameter exists in the protected section, but the
+     * format of the internals of this parameter is not the expected CBOR
+     */
+    {T_COSE_TEST_BAD_CRIT_LABEL, T_COSE_ERR_CRIT_PARAMETER},
+
+    /* A critical label is listed in the protected section, but
+     * the label doesn't exist. This works for integer-labeled header params.
+     */
+    {T_COSE_TEST_UNKNOWN_CRIT_UINT_PARAMETER, T_COSE_ERR_UNKNOWN_CRITICAL_PARAMETER},
+
+    /* A critical label is listed in the protected section, but
+     * the label doesn't exist. This works for string-labeled header params.
+     */
+    {T_COSE_TEST_UNKNOWN_CRIT_TSTR_PARAMETER, T_COSE_ERR_UNKNOWN_CRITICAL_PARAMETER},
+
+    /* The critical labels list is not protected */
+    {T_COSE_TEST_CRIT_NOT_PROTECTED, T_COSE_ERR_PARAMETER_NOT_PROTECTED},
+
+    {T_COSE_TEST_EMPTY_CRIT_PARAMETER, T_COSE_ERR_CRIT_PARAMETER},
+
+    {T_COSE_TEST_TOO_MANY_TSTR_CRIT_LABLELS, T_COSE_ERR_CRIT_PARAMETER},
+
+    {0, 0}
+};
+
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t crit_parameters_test()
+{
+    struct test_case *test;
+
+    for(test = crit_tests_table; test->test_option; test++) {
+        if(run_test_sign_and_verify(test->test_option) != test->result) {
+            return (int_fast32_t)(test - crit_tests_table);
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t content_type_test()
+{
+#ifndef T_COSE_DISABLE_CONTENT_TYPE
+
+    struct t_cose_parameters        parameters;
+    struct t_cose_sign1_sign_ctx    sign_ctx;
+    Q_USEFUL_BUF_MAKE_STACK_UB(     signed_cose_buffer, 200);
+    struct q_useful_buf_c           output;
+    struct q_useful_buf_c           payload;
+    enum t_cose_err_t               result;
+    struct t_cose_sign1_verify_ctx  verify_ctx;
+
+
+    /* -- integer content type -- */
+    t_cose_sign1_sign_init(&sign_ctx,
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           T_COSE_ALGORITHM_ES256);
+
+    t_cose_sign1_set_content_type_uint(&sign_ctx, 42);
+
+    result = t_cose_sign1_sign(&sign_ctx,
+                                      s_input_payload,
+                                      signed_cose_buffer,
+                                     &output);
+    if(result) {
+        return 1;
+    }
+
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+
+    result = t_cose_sign1_verify(&verify_ctx,
+                                        output,
+                                       &payload,
+                                       &parameters);
+    if(result) {
+        return 2;
+    }
+
+    if(parameters.content_type_uint != 42) {
+        return 5;
+    }
+
+
+    /* -- string content type -- */
+    t_cose_sign1_sign_init(&sign_ctx,
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           T_COSE_ALGORITHM_ES256);
+
+    t_cose_sign1_set_content_type_tstr(&sign_ctx, "text/plain");
+
+    result = t_cose_sign1_sign(&sign_ctx,
+                                     s_input_payload,
+                                     signed_cose_buffer,
+                                     &output);
+    if(result) {
+        return 1;
+    }
+
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+
+    result = t_cose_sign1_verify(&verify_ctx,
+                                       output,
+                                       &payload,
+                                       &parameters);
+    if(result) {
+        return 2;
+    }
+
+    if(q_useful_buf_compare(parameters.content_type_tstr, Q_USEFUL_BUF_FROM_SZ_LITERAL("text/plain"))) {
+        return 6;
+    }
+
+
+    /* -- content type in error -- */
+    t_cose_sign1_sign_init(&sign_ctx,
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           T_COSE_ALGORITHM_ES256);
+
+    t_cose_sign1_set_content_type_tstr(&sign_ctx, "text/plain");
+    t_cose_sign1_set_content_type_uint(&sign_ctx, 42);
+
+
+    result = t_cose_sign1_sign(&sign_ctx,
+                                     Q_USEFUL_BUF_FROM_SZ_LITERAL("payload"),
+                                     signed_cose_buffer,
+                                     &output);
+    if(result != T_COSE_ERR_DUPLICATE_PARAMETER) {
+        return 1;
+    }
+#endif
+    return 0;
+
+}
+
+
+struct sign1_sample {
+    struct q_useful_buf_c CBOR;
+    enum t_cose_err_t     expected_error;
+};
+
+static struct sign1_sample sign1_sample_inputs[] = {
+    /* With an indefinite length string payload */
+    { {(uint8_t[]){0x84, 0x40, 0xa0, 0x5f, 0x00, 0xff, 0x40}, 7}, T_COSE_ERR_SIGN1_FORMAT},
+    /* Too few items in unprotected header parameters bucket */
+    { {(uint8_t[]){0x84, 0x40, 0xa3, 0x40, 0x40}, 5}, T_COSE_ERR_PARAMETER_CBOR},
+    /* Too few items in definite array */
+    { {(uint8_t[]){0x83, 0x40, 0xa0, 0x40}, 4}, T_COSE_ERR_SIGN1_FORMAT},
+    /* Too-long signature */
+    { {(uint8_t[]){0x84, 0x40, 0xa0, 0x40, 0x4f}, 5}, T_COSE_ERR_SIGN1_FORMAT},
+    /* Too-long payload */
+    { {(uint8_t[]){0x84, 0x40, 0xa0, 0x4f, 0x40}, 5}, T_COSE_ERR_SIGN1_FORMAT},
+    /* Too-long protected parameters bucket */
+    { {(uint8_t[]){0x84, 0x4f, 0xa0, 0x40, 0x40}, 5}, T_COSE_ERR_SIGN1_FORMAT},
+    /* Unterminated indefinite length */
+    { {(uint8_t[]){0x9f, 0x40, 0xbf, 0xff, 0x40, 0x40}, 6}, T_COSE_ERR_CBOR_NOT_WELL_FORMED},
+    /* The smallest legal COSE_Sign1 using indefinite lengths */
+    { {(uint8_t[]){0x9f, 0x40, 0xbf, 0xff, 0x40, 0x40, 0xff}, 7}, T_COSE_SUCCESS},
+    /* The smallest legal COSE_Sign1 using definite lengths */
+    { {(uint8_t[]){0x84, 0x40, 0xa0, 0x40, 0x40}, 5}, T_COSE_SUCCESS},
+    /* Just one not-well-formed byte -- a reserved value */
+    { {(uint8_t[]){0x3c}, 1}, T_COSE_ERR_SIGN1_FORMAT },
+    /* terminate the list */
+    { {NULL, 0}, 0 },
+};
+
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t sign1_structure_decode_test(void)
+{
+    const struct sign1_sample      *sample;
+    struct q_useful_buf_c           payload;
+    enum t_cose_err_t               result;
+    struct t_cose_sign1_verify_ctx  verify_ctx;
+
+
+    for(sample = sign1_sample_inputs; !q_useful_buf_c_is_null(sample->CBOR); sample++) {
+        t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_DECODE_ONLY);
+
+
+        result = t_cose_sign1_verify(&verify_ctx,
+                                      sample->CBOR,
+                                     &payload,
+                                      NULL);
+        if(result != sample->expected_error) {
+            /* Returns 100 * index of the input + the unexpected error code */
+            const size_t sample_index = (size_t)(sample - sign1_sample_inputs) / sizeof(struct sign1_sample);
+            return (int32_t)((sample_index+1)*100 + result);
+        }
+    }
+
+    return 0;
+}
+
+
+#ifdef T_COSE_ENABLE_HASH_FAIL_TEST
+
+/* Linkage to global variable in t_cose_test_crypto.c. This is only
+ * used for an occasional test in a non-threaded environment so a global
+ * variable is safe. This test and the hacks in the crypto code are
+ * never enabled for commercial deployments.
+ */
+extern int hash_test_mode;
+
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t short_circuit_hash_fail_test()
+{
+    struct t_cose_sign1_sign_ctx sign_ctx;
+    enum t_cose_err_t            result;
+    struct q_useful_buf_c        wrapped_payload;
+    Q_USEFUL_BUF_MAKE_STACK_UB(  signed_cose_buffer, 200);
+
+    /* See test description in t_cose_test.h for a full description of
+     * what this does and what it needs to run.
+     */
+
+
+    /* Set the global variable to cause the hash implementation to
+     * error out so this test can see what happens
+     */
+    hash_test_mode = 1;
+
+    t_cose_sign1_sign_init(&sign_ctx,
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           T_COSE_ALGORITHM_ES256);
+
+    result = t_cose_sign1_sign(&sign_ctx,
+                                     s_input_payload,
+                                     signed_cose_buffer,
+                                     &wrapped_payload);
+
+    hash_test_mode = 0;
+
+    if(result != T_COSE_ERR_HASH_GENERAL_FAIL) {
+        return 2000 + (int32_t)result;
+    }
+
+
+    /* Set the global variable to cause the hash implementation to
+     * error out so this test can see what happens
+     */
+    hash_test_mode = 2;
+
+    t_cose_sign1_sign_init(&sign_ctx,
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           T_COSE_ALGORITHM_ES256);
+
+    result = t_cose_sign1_sign(&sign_ctx,
+                                     s_input_payload,
+                                     signed_cose_buffer,
+                                     &wrapped_payload);
+
+    hash_test_mode = 0;
+
+    if(result != T_COSE_ERR_HASH_GENERAL_FAIL) {
+        return 2000 + (int32_t)result;
+    }
+
+    return 0;
+}
+
+#endif /* T_COSE_ENABLE_HASH_FAIL_TEST */
+
+
+#ifdef T_COSE_ENABLE_VERIFY_CACHE
+#include "t_cose_verify_cache_internal.h"
+#ifdef T_COSE_ENABLE_VERIFY_SNAPSHOT_FILE
+#include <unistd.h> /* for unlink() */
+#endif
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t verify_cache_test()
+{
+    /* Two buffers to act like the same shared memory mapped at two
+     * different addresses. uint64_t for alignment. */
+    static uint64_t                  memory_a[512];
+    static uint64_t                  memory_b[512];
+    struct t_cose_verify_cache      *cache;
+    struct t_cose_verify_cache      *cache_b;
+    struct t_cose_verify_cache_key   key1;
+    struct t_cose_verify_cache_key   key2;
+    struct t_cose_verify_cache_key   key_n;
+    struct t_cose_verify_cache_stats stats;
+    enum t_cose_err_t                result;
+    uint8_t                          n;
+    const struct q_useful_buf_c      tbs  = Q_USEFUL_BUF_FROM_SZ_LITERAL("tbs hash");
+    const struct q_useful_buf_c      sig  = Q_USEFUL_BUF_FROM_SZ_LITERAL("signature");
+    const struct q_useful_buf_c      kid  = Q_USEFUL_BUF_FROM_SZ_LITERAL("kid");
+
+    /* -- Error conditions -- */
+    if(t_cose_verify_cache_size(3) != 0) {
+        return 100;
+    }
+    result = t_cose_verify_cache_format((struct q_useful_buf){memory_a, sizeof(memory_a)},
+                                        6, &cache);
+    if(result != T_COSE_ERR_INVALID_ARGUMENT) {
+        return 200 + (int32_t)result;
+    }
+    result = t_cose_verify_cache_format((struct q_useful_buf){memory_a, 100},
+                                        16, &cache);
+    if(result != T_COSE_ERR_TOO_SMALL) {
+        return 300 + (int32_t)result;
+    }
+    memset(memory_b, 0, sizeof(memory_b));
+    result = t_cose_verify_cache_attach((struct q_useful_buf){memory_b, sizeof(memory_b)},
+                                        &cache_b);
+    if(result != T_COSE_ERR_INVALID_ARGUMENT) {
+        return 400 + (int32_t)result;
+    }
+
+    /* -- Format and add an entry -- */
+    if(t_cose_verify_cache_size(16) > sizeof(memory_a)) {
+        return 500;
+    }
+    result = t_cose_verify_cache_format((struct q_useful_buf){memory_a, sizeof(memory_a)},
+                                        16, &cache);
+    if(result) {
+        return 600 + (int32_t)result;
+    }
+
+    result = t_cose_verify_cache_make_key(tbs, sig, kid, NULL_Q_USEFUL_BUF_C, &key1);
+    if(result) {
+        return 700 + (int32_t)result;
+    }
+    /* Same bytes split differently between fields must differ */
+    result = t_cose_verify_cache_make_key(tbs, sig, NULL_Q_USEFUL_BUF_C, kid, &key2);
+    if(result) {
+        return 800 + (int32_t)result;
+    }
+    if(!memcmp(&key1, &key2, sizeof(key1))) {
+        return 900;
+    }
+
+    if(t_cose_verify_cache_lookup(cache, &key1)) {
+        return 1000;
+    }
+    t_cose_verify_cache_insert(cache, &key1);
+    if(!t_cose_verify_cache_lookup(cache, &key1)) {
+        return 1100;
+    }
+    if(t_cose_verify_cache_lookup(cache, &key2)) {
+        return 1200;
+    }
+
+    /* -- Attach at another address; entries are still there -- */
+    memcpy(memory_b, memory_a, sizeof(memory_a));
+    result = t_cose_verify_cache_attach((struct q_useful_buf){memory_b, sizeof(memory_b)},
+                                        &cache_b);
+    if(result) {
+        return 1300 + (int32_t)result;
+    }
+    if(!t_cose_verify_cache_lookup(cache_b, &key1)) {
+        return 1400;
+    }
+
+    t_cose_verify_cache_get_stats(cache, &stats);
+    if(stats.hits != 1 || stats.misses != 2 || stats.inserts != 1 ||
+       stats.evictions != 0 || stats.bucket_count != 16) {
+        return 1500;
+    }
+
+    /* -- Overfill so entries get evicted -- */
+    for(n = 0; n < 40; n++) {
+        result = t_cose_verify_cache_make_key(tbs,
+                                              sig,
+                                              (struct q_useful_buf_c){&n, 1},
+                                              NULL_Q_USEFUL_BUF_C,
+                                              &key_n);
+        if(result) {
+            return 1600 + (int32_t)result;
+        }
+        t_cose_verify_cache_insert(cache, &key_n);
+        if(!t_cose_verify_cache_lookup(cache, &key_n)) {
+            return 1700 + n;
+        }
+    }
+    t_cose_verify_cache_get_stats(cache, &stats);
+    if(stats.inserts != 41 || stats.evictions == 0 || stats.contended != 0) {
+        return 1800;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t verify_snapshot_test()
+{
+    static uint64_t                  memory_a[512];
+    static uint64_t                  memory_b[512];
+    static uint64_t                  snapshot_buffer[16 * 5 + 4];
+    struct t_cose_verify_cache      *cache;
+    struct t_cose_verify_cache      *cache_b;
+    struct t_cose_verify_cache_key   key_n;
+    struct t_cose_verify_cache_key   key_old;
+    struct t_cose_verify_cache_stats stats;
+    struct t_cose_verify_snapshot    snapshot;
+    struct q_useful_buf_c            snapshot_bytes;
+    enum t_cose_err_t                result;
+    uint8_t                          n;
+    const struct q_useful_buf_c      tbs  = Q_USEFUL_BUF_FROM_SZ_LITERAL("tbs hash");
+    const struct q_useful_buf_c      sig  = Q_USEFUL_BUF_FROM_SZ_LITERAL("signature");
+    const struct q_useful_buf_c      kid  = Q_USEFUL_BUF_FROM_SZ_LITERAL("old kid");
+
+    result = t_cose_verify_cache_format((struct q_useful_buf){memory_a, sizeof(memory_a)},
+                                        16, &cache);
+    if(result) {
+        return 100 + (int32_t)result;
+    }
+    if(t_cose_verify_cache_snapshot_size(cache) > sizeof(snapshot_buffer)) {
+        return 200;
+    }
+
+    /* -- One entry that will be too old and eight current ones -- */
+    t_cose_verify_cache_set_time(cache, 1000);
+    result = t_cose_verify_cache_make_key(tbs, sig, kid, NULL_Q_USEFUL_BUF_C, &key_old);
+    if(result) {
+        return 300 + (int32_t)result;
+    }
+    t_cose_verify_cache_insert(cache, &key_old);
+
+    t_cose_verify_cache_set_time(cache, 5000);
+    for(n = 0; n < 8; n++) {
+        result = t_cose_verify_cache_make_key(tbs,
+                                              sig,
+                                              (struct q_useful_buf_c){&n, 1},
+                                              NULL_Q_USEFUL_BUF_C,
+                                              &key_n);
+        if(result) {
+            return 400 + (int32_t)result;
+        }
+        t_cose_verify_cache_insert(cache, &key_n);
+    }
+
+    /* -- Snapshot leaves out the old entry -- */
+    result = t_cose_verify_cache_snapshot(cache,
+                                          3600,
+                                          (struct q_useful_buf){snapshot_buffer, 10},
+                                          &snapshot_bytes);
+    if(result != T_COSE_ERR_TOO_SMALL) {
+        return 500 + (int32_t)result;
+    }
+    result = t_cose_verify_cache_snapshot(cache,
+                                          3600,
+                                          (struct q_useful_buf){snapshot_buffer,
+                                                                sizeof(snapshot_buffer)},
+                                          &snapshot_bytes);
+    if(result) {
+        return 600 + (int32_t)result;
+    }
+    result = t_cose_verify_snapshot_open(snapshot_bytes, &snapshot);
+    if(result) {
+        return 700 + (int32_t)result;
+    }
+    if(snapshot.entry_count != 8 || snapshot.saved_time != 5000) {
+        return 800;
+    }
+
+    /* -- Damage is detected -- */
+    ((uint8_t *)snapshot_buffer)[snapshot_bytes.len - 1] ^= 1;
+    result = t_cose_verify_snapshot_open(snapshot_bytes, &snapshot);
+    if(result != T_COSE_ERR_SNAPSHOT_FORMAT) {
+        return 900 + (int32_t)result;
+    }
+    ((uint8_t *)snapshot_buffer)[snapshot_bytes.len - 1] ^= 1;
+    result = t_cose_verify_snapshot_open(q_useful_buf_head(snapshot_bytes,
+                                                           snapshot_bytes.len - 8),
+                                         &snapshot);
+    if(result != T_COSE_ERR_SNAPSHOT_FORMAT) {
+        return 1000 + (int32_t)result;
+    }
+    result = t_cose_verify_snapshot_open(snapshot_bytes, &snapshot);
+    if(result) {
+        return 1100 + (int32_t)result;
+    }
+
+    /* -- Lazy restore into a new cache after a restart -- */
+    result = t_cose_verify_cache_format((struct q_useful_buf){memory_b, sizeof(memory_b)},
+                                        16, &cache_b);
+    if(result) {
+        return 1200 + (int32_t)result;
+    }
+    t_cose_verify_cache_set_time(cache_b, 6000);
+    n = 3;
+    result = t_cose_verify_cache_make_key(tbs,
+                                          sig,
+                                          (struct q_useful_buf_c){&n, 1},
+                                          NULL_Q_USEFUL_BUF_C,
+                                          &key_n);
+    if(result) {
+        return 1300 + (int32_t)result;
+    }
+    if(t_cose_verify_cache_lookup(cache_b, &key_n) ||
+       !t_cose_verify_snapshot_lookup(&snapshot, cache_b, &key_n) ||
+       !t_cose_verify_cache_lookup(cache_b, &key_n)) {
+        return 1400;
+    }
+    if(t_cose_verify_snapshot_lookup(&snapshot, cache_b, &key_old)) {
+        return 1500;
+    }
+
+    /* -- Entries expire against the time of the cache reading it -- */
+    t_cose_verify_cache_set_time(cache_b, 5000 + 3601);
+    n = 4;
+    result = t_cose_verify_cache_make_key(tbs,
+                                          sig,
+                                          (struct q_useful_buf_c){&n, 1},
+                                          NULL_Q_USEFUL_BUF_C,
+                                          &key_n);
+    if(result) {
+        return 1600 + (int32_t)result;
+    }
+    if(t_cose_verify_snapshot_lookup(&snapshot, cache_b, &key_n)) {
+        return 1700;
+    }
+
+    /* -- Eager restore -- */
+    t_cose_verify_cache_set_time(cache_b, 6000);
+    t_cose_verify_cache_restore(cache_b, &snapshot);
+    if(!t_cose_verify_cache_lookup(cache_b, &key_n)) {
+        return 1800;
+    }
+    t_cose_verify_cache_get_stats(cache_b, &stats);
+    if(stats.restored != 9 || stats.inserts != 8) {
+        return 1900;
+    }
+
+#ifdef T_COSE_ENABLE_VERIFY_SNAPSHOT_FILE
+    /* -- Through a file -- */
+    result = t_cose_verify_cache_save_file(cache, 3600, "t_cose_snapshot_test.bin");
+    if(result) {
+        return 2000 + (int32_t)result;
+    }
+    result = t_cose_verify_snapshot_map_file("t_cose_snapshot_test.bin", &snapshot);
+    unlink("t_cose_snapshot_test.bin");
+    if(result) {
+        return 2100 + (int32_t)result;
+    }
+    if(snapshot.entry_count != 8 ||
+       !t_cose_verify_snapshot_lookup(&snapshot, cache_b, &key_n)) {
+        t_cose_verify_snapshot_unmap_file(&snapshot);
+        return 2200;
+    }
+    t_cose_verify_snapshot_unmap_file(&snapshot);
+#endif /* T_COSE_ENABLE_VERIFY_SNAPSHOT_FILE */
+
+    return 0;
+}
+#endif /* T_COSE_ENABLE_VERIFY_CACHE */
+
+
+#ifdef T_COSE_USE_B_CON_SHA256
+#if !defined T_COSE_DISABLE_ES512 || !defined T_COSE_DISABLE_ES384
+#include "sha512.h" /* For sha512_select_kernel() */
+#define HASH_KAT_KERNELS 2
+#endif
+#endif
+#ifndef HASH_KAT_KERNELS
+#define HASH_KAT_KERNELS 1
+#endif
+
+/* The messages of the FIPS 180 examples */
+#define HASH_KAT_ABC      0
+#define HASH_KAT_TWO_BLOCK 1
+#define HASH_KAT_MILLION_A 2
+
+static const struct {
+    int32_t     cose_hash_alg_id;
+    int         message;
+    const char *hex_digest;
+} s_hash_kat[] = {
+    {COSE_ALGORITHM_SHA_256, HASH_KAT_ABC,
+     "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+    {COSE_ALGORITHM_SHA_256, HASH_KAT_MILLION_A,
+     "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+#ifndef T_COSE_DISABLE_ES384
+    {COSE_ALGORITHM_SHA_384, HASH_KAT_ABC,
+     "cb00753f45a35e8bb5a03d699ac65007272c32ab0eded1631a8b605a43ff5bed"
+     "8086072ba1e7cc2358baeca134c825a7"},
+    {COSE_ALGORITHM_SHA_384, HASH_KAT_TWO_BLOCK,
+     "09330c33f71147e83d192fc782cd1b4753111b173b3b05d22fa08086e3b0f712"
+     "fcc7c71a557e2db966c3e9fa91746039"},
+    {COSE_ALGORITHM_SHA_384, HASH_KAT_MILLION_A,
+     "9d0e1809716474cb086e834e310a4a1ced149e9c00f248527972cec5704c2a5b"
+     "07b8b3dc38ecc4ebae97ddd87f3d8985"},
+#endif
+#ifndef T_COSE_DISABLE_ES512
+    {COSE_ALGORITHM_SHA_512, HASH_KAT_ABC,
+     "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+     "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f"},
+    {COSE_ALGORITHM_SHA_512, HASH_KAT_TWO_BLOCK,
+     "8e959b75dae313da8cf4f72814fc143f8f7779c6eb9f7fa17299aeadb6889018"
+     "501d289e4900f7e4331b99dec4b5433ac7d329eeb6dd26545e96e55b874be909"},
+    {COSE_ALGORITHM_SHA_512, HASH_KAT_MILLION_A,
+     "e718483d0ce769644e2e42c7bc15b4638e1f98b13b2044285632a803afa973eb"
+     "de0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b"},
+#endif
+};
+
+
+/*
+ * Hash one of the example messages and compare to the expected
+ * digest in hex. The million a's are given 1000 at a time.
+ */
+static enum t_cose_err_t
+hash_kat_one(int32_t cose_hash_alg_id, int message, const char *hex_digest)
+{
+    static const char           two_block[] =
+        "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+        "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu";
+    static uint8_t              a_1000[1000];
+    static const char           hex[] = "0123456789abcdef";
+    struct t_cose_crypto_hash   hash_ctx;
+    Q_USEFUL_BUF_MAKE_STACK_UB( hash_buffer, T_COSE_CRYPTO_MAX_HASH_SIZE);
+    struct q_useful_buf_c       hash;
+    enum t_cose_err_t           result;
+    const uint8_t              *digest;
+    size_t                      i;
+
+    result = t_cose_crypto_hash_start(&hash_ctx, cose_hash_alg_id);
+    if(result) {
+        return result;
+    }
+    switch(message) {
+    case HASH_KAT_ABC:
+        t_cose_crypto_hash_update(&hash_ctx, Q_USEFUL_BUF_FROM_SZ_LITERAL("abc"));
+        break;
+
+    case HASH_KAT_TWO_BLOCK:
+        t_cose_crypto_hash_update(&hash_ctx,
+                                  (struct q_useful_buf_c){two_block,
+                                                          sizeof(two_block) - 1});
+        break;
+
+    default:
+        memset(a_1000, 'a', sizeof(a_1000));
+        for(i = 0; i < 1000; i++) {
+            t_cose_crypto_hash_update(&hash_ctx,
+                                      (struct q_useful_buf_c){a_1000,
+                                                              sizeof(a_1000)});
+        }
+        break;
+    }
+    result = t_cose_crypto_hash_finish(&hash_ctx, hash_buffer, &hash);
+    if(result) {
+        return result;
+    }
+
+    if(hash.len * 2 != strlen(hex_digest)) {
+        return T_COSE_ERR_FAIL;
+    }
+    digest = hash.ptr;
+    for(i = 0; i < hash.len; i++) {
+        if(hex_digest[2 * i] != hex[digest[i] >> 4] ||
+           hex_digest[2 * i + 1] != hex[digest[i] & 0x0f]) {
+            return T_COSE_ERR_FAIL;
+        }
+    }
+
+    return T_COSE_SUCCESS;
+}
+
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t hash_known_answer_test()
+{
+    enum t_cose_err_t result;
+    int               kernel;
+    size_t            i;
+
+    for(kernel = 0; kernel < HASH_KAT_KERNELS; kernel++) {
+#if HASH_KAT_KERNELS > 1
+        /* Scalar first, then AVX2 if this CPU has it */
+        if(sha512_select_kernel(kernel) != kernel) {
+            break;
+        }
+#endif
+        for(i = 0; i < sizeof(s_hash_kat) / sizeof(s_hash_kat[0]); i++) {
+            result = hash_kat_one(s_hash_kat[i].cose_hash_alg_id,
+                                  s_hash_kat[i].message,
+                                  s_hash_kat[i].hex_digest);
+            if(result) {
+                return (int_fast32_t)(kernel * 10000 + (i + 1) * 100) + result;
+            }
+        }
+    }
+
+#if HASH_KAT_KERNELS > 1
+    sha512_select_kernel(SHA512_KERNEL_AVX2);
+#endif
+
+    return 0;
+}
+
+
+#ifdef T_COSE_ENABLE_RATE_LIMIT
+#include "t_cose/t_cose_rate_limit.h"
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t rate_limit_test()
+{
+    static uint64_t                memory[64];
+    struct t_cose_rate_limit      *limiter;
+    struct t_cose_rate_limit_stats stats;
+    enum t_cose_err_t              result;
+    uint8_t                        n;
+    int                            i;
+    const struct q_useful_buf_c    kid_a = Q_USEFUL_BUF_FROM_SZ_LITERAL("device a");
+    const struct q_useful_buf_c    kid_b = Q_USEFUL_BUF_FROM_SZ_LITERAL("device b");
+
+    /* -- Error conditions -- */
+    if(t_cose_rate_limit_size(12) != 0) {
+        return 100;
+    }
+    result = t_cose_rate_limit_init((struct q_useful_buf){memory, sizeof(memory)},
+                                    4, 10, 0, &limiter);
+    if(result != T_COSE_ERR_INVALID_ARGUMENT) {
+        return 200 + (int32_t)result;
+    }
+    result = t_cose_rate_limit_init((struct q_useful_buf){memory, 40},
+                                    4, 10, 3, &limiter);
+    if(result != T_COSE_ERR_TOO_SMALL) {
+        return 300 + (int32_t)result;
+    }
+
+    /* -- Burst of 3, 10 per second -- */
+    result = t_cose_rate_limit_init((struct q_useful_buf){memory, sizeof(memory)},
+                                    4, 10, 3, &limiter);
+    if(result) {
+        return 400 + (int32_t)result;
+    }
+    t_cose_rate_limit_set_time(limiter, 1000);
+    for(i = 0; i < 3; i++) {
+        if(!t_cose_rate_limit_take(limiter, kid_a)) {
+            return 500 + i;
+        }
+    }
+    if(t_cose_rate_limit_take(limiter, kid_a)) {
+        return 600;
+    }
+    /* Another kid has its own bucket */
+    if(!t_cose_rate_limit_take(limiter, kid_b)) {
+        return 700;
+    }
+
+    /* -- One token after 100ms, not before -- */
+    t_cose_rate_limit_set_time(limiter, 1099);
+    if(t_cose_rate_limit_take(limiter, kid_a)) {
+        return 800;
+    }
+    t_cose_rate_limit_set_time(limiter, 1100);
+    if(!t_cose_rate_limit_take(limiter, kid_a) ||
+       t_cose_rate_limit_take(limiter, kid_a)) {
+        return 900;
+    }
+
+    /* -- Refills no higher than the burst, even across a wrap -- */
+    t_cose_rate_limit_set_time(limiter, 1100 + 0xfffff000u);
+    for(i = 0; i < 3; i++) {
+        if(!t_cose_rate_limit_take(limiter, kid_a)) {
+            return 1000 + i;
+        }
+    }
+    if(t_cose_rate_limit_take(limiter, kid_a)) {
+        return 1100;
+    }
+
+    t_cose_rate_limit_get_stats(limiter, &stats);
+    if(stats.limited != 4 || stats.evictions != 0 || stats.slot_count != 4) {
+        return 1200;
+    }
+
+    /* -- More kids than slots evicts the least recently used -- */
+    for(n = 0; n < 8; n++) {
+        if(!t_cose_rate_limit_take(limiter, (struct q_useful_buf_c){&n, 1})) {
+            return 1300 + n;
+        }
+    }
+    t_cose_rate_limit_get_stats(limiter, &stats);
+    if(stats.evictions == 0) {
+        return 1400;
+    }
+
+#ifndef T_COSE_DISABLE_SHORT_CIRCUIT_SIGN
+    {
+        struct t_cose_sign1_sign_ctx   sign_ctx;
+        struct t_cose_sign1_verify_ctx verify_ctx;
+        Q_USEFUL_BUF_MAKE_STACK_UB(    signed_cose_buffer, 200);
+        struct q_useful_buf_c          signed_cose;
+        struct q_useful_buf_c          payload;
+
+        t_cose_sign1_sign_init(&sign_ctx,
+                               T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                               T_COSE_ALGORITHM_ES256);
+        result = t_cose_sign1_sign(&sign_ctx,
+                                   s_input_payload,
+                                   signed_cose_buffer,
+                                   &signed_cose);
+        if(result) {
+            return 2000 + (int32_t)result;
+        }
+
+        result = t_cose_rate_limit_init((struct q_useful_buf){memory, sizeof(memory)},
+                                        4, 10, 2, &limiter);
+        if(result) {
+            return 2100 + (int32_t)result;
+        }
+        t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+        t_cose_sign1_verify_set_rate_limit(&verify_ctx, limiter);
+        for(i = 0; i < 2; i++) {
+            result = t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, NULL);
+            if(result) {
+                return 2200 + (int32_t)result;
+            }
+        }
+        result = t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, NULL);
+        if(result != T_COSE_ERR_RATE_LIMITED) {
+            return 2300 + (int32_t)result;
+        }
+
+        /* Decode-only is not counted */
+        t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_DECODE_ONLY);
+        t_cose_sign1_verify_set_rate_limit(&verify_ctx, limiter);
+        result = t_cose_sign1_verify(&verify_ctx, signed_cose, &payload, NULL);
+        if(result) {
+            return 2400 + (int32_t)result;
+        }
+    }
+#endif /* T_COSE_DISABLE_SHORT_CIRCUIT_SIGN */
+
+    return 0;
+}
+#endif /* T_COSE_ENABLE_RATE_LIMIT */
+
+
+#ifdef T_COSE_ENABLE_BULK_VERIFY
+#include "t_cose/t_cose_bulk_verify.h"
+#include <stdio.h>
+#include <fcntl.h>  /* for open() */
+#include <unistd.h> /* for unlink() */
+
+/* Files for bulk_verify_test(). The third is never written. */
+static const char *s_bulk_test_paths[4] = {"t_cose_bulk_test_0.bin",
+                                           "t_cose_bulk_test_1.bin",
+                                           "t_cose_bulk_test_2.bin",
+                                           "t_cose_bulk_test_3.bin"};
+
+
+static int
+bulk_test_write(const char *path, struct q_useful_buf_c bytes)
+{
+    FILE *file;
+
+    file = fopen(path, "wb");
+    if(file == NULL) {
+        return 1;
+    }
+    if(fwrite(bytes.ptr, 1, bytes.len, file) != bytes.len) {
+        fclose(file);
+        return 1;
+    }
+    return fclose(file) ? 1 : 0;
+}
+
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t bulk_verify_test()
+{
+    static uint64_t                  memory[1024];
+    static uint8_t                   long_file[600];
+    struct t_cose_sign1_sign_ctx     sign_ctx;
+    struct t_cose_sign1_verify_ctx   verify_ctx;
+    struct t_cose_bulk_verify_config config;
+    struct t_cose_bulk_result        results[4];
+    struct t_cose_bulk_verify_stats  stats;
+    Q_USEFUL_BUF_MAKE_STACK_UB(      signed_cose_buffer, 200);
+    struct q_useful_buf_c            signed_cose;
+    enum t_cose_err_t                result;
+    int                              mode;
+    int                              fd;
+    int_fast32_t                     return_value;
+
+    t_cose_sign1_sign_init(&sign_ctx,
+                           T_COSE_OPT_SHORT_CIRCUIT_SIG,
+                           T_COSE_ALGORITHM_ES256);
+    result = t_cose_sign1_sign(&sign_ctx,
+                               s_input_payload,
+                               signed_cose_buffer,
+                               &signed_cose);
+    if(result) {
+        return 1000 + (int32_t)result;
+    }
+
+    /* Good, too long, missing and corrupted */
+    memset(long_file, 'x', sizeof(long_file));
+    if(bulk_test_write(s_bulk_test_paths[0], signed_cose) ||
+       bulk_test_write(s_bulk_test_paths[1],
+                       (struct q_useful_buf_c){long_file, sizeof(long_file)})) {
+        return 1100;
+    }
+    /* Change the last byte of the short-circuit signature */
+    ((uint8_t *)signed_cose_buffer.ptr)[signed_cose.len - 1] ^= 0x01;
+    if(bulk_test_write(s_bulk_test_paths[3], signed_cose)) {
+        return 1200;
+    }
+
+    t_cose_sign1_verify_init(&verify_ctx, T_COSE_OPT_ALLOW_SHORT_CIRCUIT);
+
+    return_value = 0;
+    memset(&config, 0, sizeof(config));
+    config.verify_template = &verify_ctx;
+    config.worker_threads  = 2;
+    config.queue_depth     = 4;
+    config.max_file_size   = 512;
+
+    /* -- Error conditions -- */
+    if(t_cose_bulk_verify_buffer_size(&config) > sizeof(memory)) {
+        return_value = 1300;
+        goto Done;
+    }
+    result = t_cose_bulk_verify(&config,
+                                (struct q_useful_buf){memory, 100},
+                                s_bulk_test_paths, 4, results, &stats);
+    if(result != T_COSE_ERR_TOO_SMALL) {
+        return_value = 1400 + (int32_t)result;
+        goto Done;
+    }
+    config.worker_threads = T_COSE_BULK_VERIFY_MAX_THREADS + 1;
+    result = t_cose_bulk_verify(&config,
+                                (struct q_useful_buf){memory, sizeof(memory)},
+                                s_bulk_test_paths, 4, results, &stats);
+    if(result != T_COSE_ERR_INVALID_ARGUMENT) {
+        return_value = 1500 + (int32_t)result;
+        goto Done;
+    }
+    config.worker_threads = 2;
+
+    /* -- With io_uring if there is one, then without -- */
+    for(mode = 0; mode < 2; mode++) {
+        config.disable_io_uring = mode == 1;
+        memset(results, 0xff, sizeof(results));
+        result = t_cose_bulk_verify(&config,
+                                    (struct q_useful_buf){memory, sizeof(memory)},
+                                    s_bulk_test_paths, 4, results, &stats);
+        if(result) {
+            return_value = 2000 + mode * 1000 + (int32_t)result;
+            goto Done;
+        }
+        if(results[0].result != T_COSE_SUCCESS ||
+           results[0].file_len != signed_cose.len ||
+           results[1].result != T_COSE_ERR_TOO_SMALL ||
+           results[2].result != T_COSE_ERR_ARTIFACT_ACCESS ||
+           results[2].os_error == 0 ||
+           results[3].result != T_COSE_ERR_SIG_VERIFY) {
+            return_value = 2100 + mode * 1000;
+            goto Done;
+        }
+        if(stats.files != 4 || stats.failed != 3 ||
+           (mode == 1 && stats.used_io_uring)) {
+            return_value = 2200 + mode * 1000;
+            goto Done;
+        }
+    }
+
+    /* -- The manifest -- */
+    fd = open("t_cose_bulk_test_manifest.txt", O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if(fd < 0) {
+        return_value = 4000;
+        goto Done;
+    }
+    result = t_cose_bulk_verify_write_manifest(fd, s_bulk_test_paths, results, 4);
+    close(fd);
+    unlink("t_cose_bulk_test_manifest.txt");
+    if(result) {
+        return_value = 4100 + (int32_t)result;
+    }
+
+Done:
+    unlink(s_bulk_test_paths[0]);
+    unlink(s_bulk_test_paths[1]);
+    unlink(s_bulk_test_paths[3]);
+
+    return return_value;
+}
+#endif /* T_COSE_ENABLE_BULK_VERIFY */
+
+
+#include "t_cose/t_cose_autotune.h"
+
+/*
+ * A made-up machine for autotune_test(). A run has a fixed overhead,
+ * a cost per message spread over the workers up to the number of
+ * cores and a cost per worker started. Returns the run time in
+ * nanoseconds.
+ */
+static uint64_t
+autotune_test_model(struct t_cose_autotune_settings settings, uint32_t cores)
+{
+    const uint32_t parallel = settings.worker_count < cores ?
+                                  settings.worker_count : cores;
+
+    return 20000 +
+           (uint64_t)settings.batch_size * 1000 / parallel +
+           (uint64_t)settings.worker_count * 30000;
+}
+
+
+/*
+ * Give the tuner a number of runs of the model. Returns whether it
+ * has converged.
+ */
+static bool
+autotune_test_run(struct t_cose_autotune *tuner, uint32_t cores, int runs)
+{
+    struct t_cose_autotune_settings settings;
+    uint64_t                        run_time;
+    int                             i;
+
+    for(i = 0; i < runs; i++) {
+        settings = t_cose_autotune_current(tuner);
+        if(settings.lane_width != 1) {
+            return false;
+        }
+        run_time = autotune_test_model(settings, cores);
+        t_cose_autotune_record(tuner, settings.batch_size, run_time, run_time);
+    }
+    return t_cose_autotune_get_stats(tuner)->converged;
+}
+
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t autotune_test()
+{
+    struct t_cose_autotune              tuner;
+    struct t_cose_autotune_config       config;
+    const struct t_cose_autotune_stats *stats;
+    enum t_cose_err_t                   result;
+    int                                 i;
+
+    memset(&config, 0, sizeof(config));
+    config.batch_size   = (struct t_cose_autotune_range){1, 1024, 8};
+    config.worker_count = (struct t_cose_autotune_range){1, 16, 0};
+    config.lane_width   = (struct t_cose_autotune_range){1, 1, 0};
+
+    /* -- Error conditions -- */
+    config.worker_count.min = 0;
+    if(t_cose_autotune_init(&tuner, &config) != T_COSE_ERR_INVALID_ARGUMENT) {
+        return 100;
+    }
+    config.worker_count.min = 1;
+    config.batch_size.start = 2000;
+    if(t_cose_autotune_init(&tuner, &config) != T_COSE_ERR_INVALID_ARGUMENT) {
+        return 200;
+    }
+    config.batch_size.start = 8;
+
+    /* -- Nothing changes until a trial of runs is complete -- */
+    result = t_cose_autotune_init(&tuner, &config);
+    if(result) {
+        return 300 + (int32_t)result;
+    }
+    for(i = 0; i < 3; i++) {
+        t_cose_autotune_record(&tuner, 8, 1000, 1000);
+        if(t_cose_autotune_current(&tuner).batch_size != 8 ||
+           t_cose_autotune_current(&tuner).worker_count != 1) {
+            return 400;
+        }
+    }
+    /* 32 messages in 4000ns */
+    t_cose_autotune_record(&tuner, 8, 1000, 1000);
+    stats = t_cose_autotune_get_stats(&tuner);
+    if(stats->trials != 1 || stats->best_throughput != 8000000 ||
+       stats->best_latency != 1000) {
+        return 500;
+    }
+    /* The first neighbour is a doubled batch */
+    if(t_cose_autotune_current(&tuner).batch_size != 16) {
+        return 600;
+    }
+
+    /* -- Throughput only: the largest batch on all four cores -- */
+    result = t_cose_autotune_init(&tuner, &config);
+    if(result) {
+        return 700 + (int32_t)result;
+    }
+    if(!autotune_test_run(&tuner, 4, 2000)) {
+        return 800;
+    }
+    stats = t_cose_autotune_get_stats(&tuner);
+    if(stats->best.batch_size != 1024 || stats->best.worker_count != 4 ||
+       stats->best.lane_width != 1 || stats->moves == 0 ||
+       !stats->within_target) {
+        return 900;
+    }
+
+    /* -- With a latency target the batch stays small enough. It
+     * stops at 64 messages on one worker, a local best with about two
+     * thirds of the throughput of 128 on two. -- */
+    config.latency_target = 150000;
+    result = t_cose_autotune_init(&tuner, &config);
+    if(result) {
+        return 1000 + (int32_t)result;
+    }
+    if(!autotune_test_run(&tuner, 4, 2000)) {
+        return 1100;
+    }
+    stats = t_cose_autotune_get_stats(&tuner);
+    if(!stats->within_target || stats->best_latency > 150000 ||
+       stats->best.batch_size != 64 || stats->best_throughput < 500000) {
+        return 1200;
+    }
+
+    /* -- Starting over the target it comes back under -- */
+    config.batch_size.start = 1024;
+    result = t_cose_autotune_init(&tuner, &config);
+    if(result) {
+        return 1300 + (int32_t)result;
+    }
+    if(!autotune_test_run(&tuner, 4, 2000) ||
+       !t_cose_autotune_get_stats(&tuner)->within_target) {
+        return 1400;
+    }
+    config.batch_size.start = 8;
+    config.latency_target   = 0;
+
+    /* -- With reprobing it follows the machine getting smaller -- */
+    config.reprobe_trials = 2;
+    result = t_cose_autotune_init(&tuner, &config);
+    if(result) {
+        return 1500 + (int32_t)result;
+    }
+    if(!autotune_test_run(&tuner, 4, 2000)) {
+        return 1600;
+    }
+    autotune_test_run(&tuner, 2, 2000);
+    stats = t_cose_autotune_get_stats(&tuner);
+    if(!stats->converged || stats->best.worker_count != 2) {
+        return 1700;
+    }
+
+    return 0;
+}
+
+
+#ifdef T_COSE_ENABLE_KEY_ARENA
+#include "t_cose/t_cose_key_arena.h"
+
+/*
+ * Public function, see t_cose_test.h
+ */
+int_fast32_t key_arena_test()
+{
+    struct t_cose_key_arena              arena;
+    const struct t_cose_key_arena_stats *stats;
+    struct q_useful_buf                  first;
+    struct q_useful_buf                  memory;
+    enum t_cose_err_t                    result;
+    static const uint32_t                options[2] = {T_COSE_KEY_ARENA_OPT_NO_HUGE_PAGES, 0};
+    int_fast32_t                         return_value;
+    size_t                               i;
+    int                                  n;
+
+    /* -- Error conditions -- */
+    if(t_cose_key_arena_init(&arena, 0, 0) != T_COSE_ERR_INVALID_ARGUMENT) {
+        return 100;
+    }
+    if(t_cose_key_arena_init(&arena, SIZE_MAX, 0) != T_COSE_ERR_INVALID_ARGUMENT) {
+        return 200;
+    }
+
+    /* -- Once on ordinary pages and once on huge pages if there are
+     * any -- */
+    for(n = 0; n < 2; n++) {
+        result = t_cose_key_arena_init(&arena, 1000, options[n]);
+        if(result) {
+            return 300 + (int32_t)result;
+        }
+        stats = t_cose_key_arena_get_stats(&arena);
+        if(stats->capacity != T_COSE_KEY_ARENA_HUGE_PAGE_SIZE ||
+           stats->used != 0 ||
+           (options[n] && stats->backing != T_COSE_KEY_ARENA_SMALL_PAGES)) {
+            return_value = 400;
+            goto Done;
+        }
+
+        /* Each allocation is on its own cache line and zero */
+        first = t_cose_key_arena_alloc(&arena, 1);
+        memory = t_cose_key_arena_alloc(&arena, 100);
+        if(q_useful_buf_is_null(first) || q_useful_buf_is_null(memory) ||
+           ((uintptr_t)first.ptr % T_COSE_KEY_ARENA_ALIGN) != 0 ||
+           (uint8_t *)memory.ptr != (uint8_t *)first.ptr + T_COSE_KEY_ARENA_ALIGN ||
+           memory.len != 100 || stats->used != 3 * T_COSE_KEY_ARENA_ALIGN) {
+            return_value = 500;
+            goto Done;
+        }
+        for(i = 0; i < memory.len; i++) {
+            if(((uint8_t *)memory.ptr)[i] != 0) {
+                return_value = 600;
+                goto Done;
+            }
+        }
+        memset(memory.ptr, 0xff, memory.len);
+
+        /* Exactly what is left fits, then nothing more does */
+        memory = t_cose_key_arena_alloc(&arena, stats->capacity - stats->used);
+        if(q_useful_buf_is_null(memory)) {
+            return_value = 700;
+            goto Done;
+        }
+        if(!q_useful_buf_is_null(t_cose_key_arena_alloc(&arena, 1))) {
+            return_value = 800;
+            goto Done;
+        }
+
+        /* A reset frees everything at once */
+        t_cose_key_arena_reset(&arena);
+        memory = t_cose_key_arena_alloc(&arena, 1);
+        if(memory.ptr != first.ptr || stats->used != T_COSE_KEY_ARENA_ALIGN ||
+           stats->high_water != stats->capacity || stats->resets != 1) {
+            return_value = 900;
+            goto Done;
+        }
+
+        t_cose_key_arena_free(&arena);
+    }
+
+    return 0;
+
+Done:
+    t_cose_key_arena_free(&arena);
+    return return_value;
+}
+#endif /* T_COSE_ENABLE_KEY_ARENA */
@@ -92,11 +92,122 @@ int_fast32_t cose_example_test(void);
 int_fast32_t crit_parameters_test(void);
 
 
+/*
+ * Known-answer tests of SHA-256, SHA-384 and SHA-512 through the
+ * crypto adapter, with each SHA-512 kernel there is.
+ */
+int_fast32_t hash_known_answer_test(void);
+
+
+/*
+ * Convergence of the autotuner on a made-up machine, with and without
+ * a latency target.
+ */
+int_fast32_t autotune_test(void);
+
+
 /*
  Check that all types of headers are correctly returned.
  */
 int_fast32_t all_header_parameters_test(void);
 
+
+/*
+ * Check that application-defined parameters are returned.
+ */
+int_fast32_t custom_parameters_test(void);
+
+
+#ifndef T_COSE_DISABLE_HASH_ENVELOPE
+/*
+ * Sign and verify a COSE Hash Envelope and check content against it.
+ */
+int_fast32_t hash_envelope_test(void);
+#endif /* T_COSE_DISABLE_HASH_ENVELOPE */
+
+
+#if !defined(T_COSE_DISABLE_PROTECTED_INTERN) && !defined(T_COSE_DISABLE_HASH_ENVELOPE)
+/*
+ * Verify with pre-parsed protected headers and check the parameters
+ * are the same as when parsed.
+ */
+int_fast32_t protected_intern_test(void);
+#endif /* !T_COSE_DISABLE_PROTECTED_INTERN && !T_COSE_DISABLE_HASH_ENVELOPE */
+
+
+/*
+ * Sign several payloads into an arena.
+ */
+int_fast32_t sign1_batch_test(void);
+
+
+/*
+ * Output the payload after its length is given and compare to the
+ * usual byte string wrapping.
+ */
+int_fast32_t known_length_payload_test(void);
+
+
+#ifdef T_COSE_ENABLE_INCREMENTAL_HASH
+/*
+ * Hash the payload as it is output and compare to hashing it after.
+ */
+int_fast32_t incremental_hash_test(void);
+#endif /* T_COSE_ENABLE_INCREMENTAL_HASH */
+
+
+/*
+ * Hash and sign separately, then decode and hash and verify separately.
+ */
+int_fast32_t two_stage_test(void);
+
+
+/*
+ * Order, age, reject and expire requests in the verification queue.
+ */
+int_fast32_t verify_sched_test(void);
+
+
+/*
+ * Countersign a COSE_Sign1 up to three times and verify the
+ * countersignatures along with the COSE_Sign1.
+ */
+int_fast32_t countersign_test(void);
+
+
+/*
+ * Sign a COSE_Sign with two signers using different algorithms and
+ * verify both signatures.
+ */
+int_fast32_t multi_sign_test(void);
+
+
+#ifdef T_COSE_ENABLE_COST_COUNTERS
+/*
+ * Check the verification cost of the slow inputs found by the fuzzer
+ * is within budget.
+ */
+int_fast32_t cost_budget_test(void);
+#endif /* T_COSE_ENABLE_COST_COUNTERS */
+
+
+#ifdef T_COSE_ENABLE_CAPTURE
+/*
+ * Capture good, bad and malformed messages with and without a flush
+ * callback and sampling and check the records.
+ */
+int_fast32_t capture_test(void);
+#endif /* T_COSE_ENABLE_CAPTURE */
+
+
+#ifdef T_COSE_ENABLE_SUIT
+/*
+ * Verify a SUIT envelope and check its component images, then
+ * modify the images and the manifest.
+ */
+int_fast32_t suit_test(void);
+#endif /* T_COSE_ENABLE_SUIT */
+
 /*
  * Check that setting the content type works
  */
@@ -109,6 +220,47 @@ int_fast32_t content_type_test(void);
 int_fast32_t sign1_structure_decode_test(void);
 
 
+#ifdef T_COSE_ENABLE_VERIFY_CACHE
+/*
+ * Format, attach, insert, look up and evict in the verification cache.
+ */
+int_fast32_t verify_cache_test(void);
+
+
+/*
+ * Snapshot, check, expire and restore the verification cache.
+ */
+int_fast32_t verify_snapshot_test(void);
+#endif /* T_COSE_ENABLE_VERIFY_CACHE */
+
+
+#ifdef T_COSE_ENABLE_RATE_LIMIT
+/*
+ * Burst, refill, eviction and refusal of verification by the per-kid
+ * rate limiter.
+ */
+int_fast32_t rate_limit_test(void);
+#endif /* T_COSE_ENABLE_RATE_LIMIT */
+
+
+#ifdef T_COSE_ENABLE_BULK_VERIFY
+/*
+ * Verify good, too long, missing and corrupted files in bulk, with
+ * and without io_uring.
+ */
+int_fast32_t bulk_verify_test(void);
+#endif /* T_COSE_ENABLE_BULK_VERIFY */
+
+
+#ifdef T_COSE_ENABLE_KEY_ARENA
+/*
+ * Alignment, filling, reset and the fallback to ordinary pages of the
+ * key table arena.
+ */
+int_fast32_t key_arena_test(void);
+#endif /* T_COSE_ENABLE_KEY_ARENA */
+
+
 #ifdef T_COSE_ENABLE_HASH_FAIL_TEST
 /*
  * This forces / simulates failures in the hash algorithm implementation